@@ -18,6 +18,10 @@
 # LIBTEXTCLASSIFIER_STRIP_OPTS: (optional) value for LOCAL_STRIP_MODULE (for all
 #   modules we build).  NOT for prod builds.  Can be set to keep_symbols for
 #   debug / treemap purposes.
+#
+# LIBTEXTCLASSIFIER_UNILIB: (optional) the Unicode backend, "icu" (default) or
+#   "lite", which uses generated character tables and RE2 for the regular
+#   expressions instead of ICU.
 
 
 LOCAL_PATH := $(call my-dir)
@@ -37,9 +41,23 @@ MY_LIBTEXTCLASSIFIER_WARNING_CFLAGS := \
 MY_LIBTEXTCLASSIFIER_CFLAGS := \
     $(MY_LIBTEXTCLASSIFIER_WARNING_CFLAGS) \
     -fvisibility=hidden \
-    -DLIBTEXTCLASSIFIER_UNILIB_ICU \
     -DZLIB_CONST
 
+# Sources that are not part of any module: the generator of the Unicode tables
+# is a host tool, and only one UniLib backend is built.
+MY_LIBTEXTCLASSIFIER_EXCLUDED_SRC_FILES := %_generator.cc
+
+LIBTEXTCLASSIFIER_UNILIB ?= icu
+ifeq ($(LIBTEXTCLASSIFIER_UNILIB),lite)
+  MY_LIBTEXTCLASSIFIER_CFLAGS += -DLIBTEXTCLASSIFIER_UNILIB_LITE
+  MY_LIBTEXTCLASSIFIER_EXCLUDED_SRC_FILES += util/utf8/unilib-icu.cc
+  MY_LIBTEXTCLASSIFIER_UNILIB_STATIC_LIBRARIES := libregex-re2
+else
+  MY_LIBTEXTCLASSIFIER_CFLAGS += -DLIBTEXTCLASSIFIER_UNILIB_ICU
+  MY_LIBTEXTCLASSIFIER_EXCLUDED_SRC_FILES += util/utf8/unilib-lite.cc
+  MY_LIBTEXTCLASSIFIER_UNILIB_STATIC_LIBRARIES :=
+endif
+
 # Only enable debug logging in userdebug/eng builds.
 ifneq (,$(filter userdebug eng, $(TARGET_BUILD_VARIANT)))
   MY_LIBTEXTCLASSIFIER_CFLAGS += -DTC_DEBUG_LOGGING=1
@@ -70,19 +88,23 @@ LOCAL_CPP_EXTENSION := .cc
 LOCAL_CFLAGS += $(MY_LIBTEXTCLASSIFIER_CFLAGS)
 LOCAL_STRIP_MODULE := $(LIBTEXTCLASSIFIER_STRIP_OPTS)
 
-LOCAL_SRC_FILES := $(filter-out tests/% %_test.cc test-util.%,$(call all-subdir-cpp-files))
+LOCAL_SRC_FILES := $(filter-out tests/% %_test.cc %_benchmark.cc test-util.% $(MY_LIBTEXTCLASSIFIER_EXCLUDED_SRC_FILES),$(call all-subdir-cpp-files))
 
 LOCAL_C_INCLUDES := $(TOP)/external/zlib
+LOCAL_C_INCLUDES += $(TOP)/external/lz4/lib
 LOCAL_C_INCLUDES += $(TOP)/external/tensorflow
 LOCAL_C_INCLUDES += $(TOP)/external/flatbuffers/include
 
 LOCAL_SHARED_LIBRARIES += liblog
+LOCAL_SHARED_LIBRARIES += libcutils
 LOCAL_SHARED_LIBRARIES += libicuuc
 LOCAL_SHARED_LIBRARIES += libicui18n
 LOCAL_SHARED_LIBRARIES += libtflite
 LOCAL_SHARED_LIBRARIES += libz
 
 LOCAL_STATIC_LIBRARIES += flatbuffers
+LOCAL_STATIC_LIBRARIES += liblz4
+LOCAL_STATIC_LIBRARIES += $(MY_LIBTEXTCLASSIFIER_UNILIB_STATIC_LIBRARIES)
 
 LOCAL_REQUIRED_MODULES := textclassifier.en.model
 LOCAL_REQUIRED_MODULES += textclassifier.universal.model
@@ -113,23 +135,136 @@ LOCAL_TEST_DATA := $(call find-test-data-in-subdirs, $(LOCAL_PATH), *, test_data
 LOCAL_CPPFLAGS_32 += -DLIBTEXTCLASSIFIER_TEST_DATA_DIR="\"/data/nativetest/libtextclassifier_tests/test_data/\""
 LOCAL_CPPFLAGS_64 += -DLIBTEXTCLASSIFIER_TEST_DATA_DIR="\"/data/nativetest64/libtextclassifier_tests/test_data/\""
 
-LOCAL_SRC_FILES := $(call all-subdir-cpp-files)
+LOCAL_SRC_FILES := $(filter-out %_benchmark.cc $(MY_LIBTEXTCLASSIFIER_EXCLUDED_SRC_FILES),$(call all-subdir-cpp-files))
 
 LOCAL_C_INCLUDES := $(TOP)/external/zlib
+LOCAL_C_INCLUDES += $(TOP)/external/lz4/lib
 LOCAL_C_INCLUDES += $(TOP)/external/tensorflow
 LOCAL_C_INCLUDES += $(TOP)/external/flatbuffers/include
 
 LOCAL_STATIC_LIBRARIES += libgmock
 LOCAL_SHARED_LIBRARIES += liblog
+LOCAL_SHARED_LIBRARIES += libcutils
 LOCAL_SHARED_LIBRARIES += libicuuc
 LOCAL_SHARED_LIBRARIES += libicui18n
 LOCAL_SHARED_LIBRARIES += libtflite
 LOCAL_SHARED_LIBRARIES += libz
 
 LOCAL_STATIC_LIBRARIES += flatbuffers
+LOCAL_STATIC_LIBRARIES += liblz4
+LOCAL_STATIC_LIBRARIES += $(MY_LIBTEXTCLASSIFIER_UNILIB_STATIC_LIBRARIES)
 
 include $(BUILD_NATIVE_TEST)
 
+# ---------------------------
+# libtextclassifier_benchmark
+# ---------------------------
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := libtextclassifier_benchmark
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_CPP_EXTENSION := .cc
+LOCAL_CFLAGS += $(MY_LIBTEXTCLASSIFIER_CFLAGS)
+LOCAL_STRIP_MODULE := $(LIBTEXTCLASSIFIER_STRIP_OPTS)
+
+LOCAL_SRC_FILES := $(filter-out tests/% %_test.cc %_benchmark.cc test-util.% $(MY_LIBTEXTCLASSIFIER_EXCLUDED_SRC_FILES),$(call all-subdir-cpp-files))
+LOCAL_SRC_FILES += text-classifier_benchmark.cc
+
+LOCAL_C_INCLUDES := $(TOP)/external/zlib
+LOCAL_C_INCLUDES += $(TOP)/external/lz4/lib
+LOCAL_C_INCLUDES += $(TOP)/external/tensorflow
+LOCAL_C_INCLUDES += $(TOP)/external/flatbuffers/include
+
+LOCAL_SHARED_LIBRARIES += liblog
+LOCAL_SHARED_LIBRARIES += libcutils
+LOCAL_SHARED_LIBRARIES += libicuuc
+LOCAL_SHARED_LIBRARIES += libicui18n
+LOCAL_SHARED_LIBRARIES += libtflite
+LOCAL_SHARED_LIBRARIES += libz
+
+LOCAL_STATIC_LIBRARIES += flatbuffers
+LOCAL_STATIC_LIBRARIES += liblz4
+LOCAL_STATIC_LIBRARIES += $(MY_LIBTEXTCLASSIFIER_UNILIB_STATIC_LIBRARIES)
+
+LOCAL_REQUIRED_MODULES := textclassifier.en.model
+LOCAL_REQUIRED_MODULES += textclassifier.universal.model
+
+include $(BUILD_EXECUTABLE)
+
+# -----------------------------------
+# libtextclassifier_kernels_benchmark
+# -----------------------------------
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := libtextclassifier_kernels_benchmark
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_CPP_EXTENSION := .cc
+LOCAL_CFLAGS += $(MY_LIBTEXTCLASSIFIER_CFLAGS)
+LOCAL_STRIP_MODULE := $(LIBTEXTCLASSIFIER_STRIP_OPTS)
+
+LOCAL_SRC_FILES := $(filter-out tests/% %_test.cc %_benchmark.cc test-util.% $(MY_LIBTEXTCLASSIFIER_EXCLUDED_SRC_FILES),$(call all-subdir-cpp-files))
+LOCAL_SRC_FILES += kernels_benchmark.cc
+
+LOCAL_C_INCLUDES := $(TOP)/external/zlib
+LOCAL_C_INCLUDES += $(TOP)/external/lz4/lib
+LOCAL_C_INCLUDES += $(TOP)/external/tensorflow
+LOCAL_C_INCLUDES += $(TOP)/external/flatbuffers/include
+
+LOCAL_SHARED_LIBRARIES += liblog
+LOCAL_SHARED_LIBRARIES += libcutils
+LOCAL_SHARED_LIBRARIES += libicuuc
+LOCAL_SHARED_LIBRARIES += libicui18n
+LOCAL_SHARED_LIBRARIES += libtflite
+LOCAL_SHARED_LIBRARIES += libz
+
+LOCAL_STATIC_LIBRARIES += flatbuffers
+LOCAL_STATIC_LIBRARIES += liblz4
+LOCAL_STATIC_LIBRARIES += $(MY_LIBTEXTCLASSIFIER_UNILIB_STATIC_LIBRARIES)
+
+LOCAL_REQUIRED_MODULES := textclassifier.en.model
+
+include $(BUILD_EXECUTABLE)
+
+# --------------------------------
+# libtextclassifier_load_generator
+# --------------------------------
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := libtextclassifier_load_generator
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_CPP_EXTENSION := .cc
+LOCAL_CFLAGS += $(MY_LIBTEXTCLASSIFIER_CFLAGS)
+LOCAL_STRIP_MODULE := $(LIBTEXTCLASSIFIER_STRIP_OPTS)
+
+LOCAL_SRC_FILES := $(filter-out tests/% %_test.cc %_benchmark.cc test-util.% $(MY_LIBTEXTCLASSIFIER_EXCLUDED_SRC_FILES),$(call all-subdir-cpp-files))
+LOCAL_SRC_FILES += load-generator_benchmark.cc
+
+LOCAL_C_INCLUDES := $(TOP)/external/zlib
+LOCAL_C_INCLUDES += $(TOP)/external/lz4/lib
+LOCAL_C_INCLUDES += $(TOP)/external/tensorflow
+LOCAL_C_INCLUDES += $(TOP)/external/flatbuffers/include
+
+LOCAL_SHARED_LIBRARIES += liblog
+LOCAL_SHARED_LIBRARIES += libcutils
+LOCAL_SHARED_LIBRARIES += libicuuc
+LOCAL_SHARED_LIBRARIES += libicui18n
+LOCAL_SHARED_LIBRARIES += libtflite
+LOCAL_SHARED_LIBRARIES += libz
+
+LOCAL_STATIC_LIBRARIES += flatbuffers
+LOCAL_STATIC_LIBRARIES += liblz4
+LOCAL_STATIC_LIBRARIES += $(MY_LIBTEXTCLASSIFIER_UNILIB_STATIC_LIBRARIES)
+
+LOCAL_REQUIRED_MODULES := textclassifier.en.model
+
+include $(BUILD_EXECUTABLE)
+
 # ----------------------
 # Smart Selection models
 # ----------------------
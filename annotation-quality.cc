@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "annotation-quality.h"
+
+#include <algorithm>
+
+namespace libtextclassifier2 {
+
+namespace {
+// The weight of a new sample in the moving averages, as a power of two.
+const int kAverageShift = 3;
+}  // namespace
+
+const char* AnnotationQualityName(AnnotationQuality quality) {
+  switch (quality) {
+    case AnnotationQuality::FULL:
+      return "full";
+    case AnnotationQuality::NO_MODEL:
+      return "no_model";
+    case AnnotationQuality::REGEX_ONLY:
+      return "regex_only";
+    case AnnotationQuality::NUM_LEVELS:
+      break;
+  }
+  return "unknown";
+}
+
+AnnotationQualityController::AnnotationQualityController(int probe_interval)
+    : probe_interval_(std::max(probe_interval, 1)) {
+  for (std::atomic<int64>& estimate : nanos_per_byte_) {
+    estimate = 0;
+  }
+}
+
+int64 AnnotationQualityController::EstimatedLatencyMicros(
+    AnnotationQuality quality, int64 input_bytes) const {
+  const int64 nanos_per_byte =
+      nanos_per_byte_[static_cast<int>(quality)].load(
+          std::memory_order_relaxed);
+  if (nanos_per_byte == 0) {
+    return -1;
+  }
+  return nanos_per_byte * (input_bytes + kRequestOverheadBytes) / 1000;
+}
+
+AnnotationQuality AnnotationQualityController::Choose(
+    int64 input_bytes, int64 budget_micros,
+    AnnotationQuality lowest_quality) const {
+  if (budget_micros <= 0) {
+    return AnnotationQuality::FULL;
+  }
+  int level = 0;
+  const int lowest_level = static_cast<int>(lowest_quality);
+  for (; level < lowest_level; ++level) {
+    if (EstimatedLatencyMicros(static_cast<AnnotationQuality>(level),
+                               input_bytes) <= budget_micros) {
+      break;
+    }
+  }
+  if (level > 0 &&
+      num_degraded_.fetch_add(1, std::memory_order_relaxed) % probe_interval_ ==
+          probe_interval_ - 1) {
+    --level;
+  }
+  return static_cast<AnnotationQuality>(level);
+}
+
+void AnnotationQualityController::Record(AnnotationQuality quality,
+                                         int64 input_bytes,
+                                         int64 latency_micros) {
+  std::atomic<int64>& estimate = nanos_per_byte_[static_cast<int>(quality)];
+  const int64 sample = std::max<int64>(
+      1, latency_micros * 1000 / (input_bytes + kRequestOverheadBytes));
+  const int64 old_estimate = estimate.load(std::memory_order_relaxed);
+  estimate.store(old_estimate == 0
+                     ? sample
+                     : old_estimate +
+                           ((sample - old_estimate) >> kAverageShift),
+                 std::memory_order_relaxed);
+}
+
+}  // namespace libtextclassifier2
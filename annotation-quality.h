@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Picks how much of the annotation to run from the recent latencies, so that
+// the annotation degrades instead of timing out under load.
+
+#ifndef LIBTEXTCLASSIFIER_ANNOTATION_QUALITY_H_
+#define LIBTEXTCLASSIFIER_ANNOTATION_QUALITY_H_
+
+#include <atomic>
+
+#include "util/base/integral_types.h"
+#include "util/base/macros.h"
+
+namespace libtextclassifier2 {
+
+// How much of the annotation Annotate() runs, from the best to the cheapest.
+enum class AnnotationQuality {
+  // All the annotators.
+  FULL = 0,
+  // The regex rules and the datetime parser, without the selection and
+  // classification models.
+  NO_MODEL,
+  // Only the regex rules.
+  REGEX_ONLY,
+  NUM_LEVELS,
+};
+
+// Returns a human readable name of the quality.
+const char* AnnotationQualityName(AnnotationQuality quality);
+
+// Estimates the latency of the annotation at each quality from the recent
+// requests, and picks the best quality that fits into a latency budget.
+// The estimates are moving averages of the latency per byte of input (plus a
+// fixed overhead per request), so they follow the load: when the requests
+// slow down, e.g. because of a traffic spike, the cheaper qualities are
+// picked until the latencies recover. Since the estimate of a quality is only
+// updated by its requests, every 'probe_interval'-th degraded request runs at
+// the next better quality, which is how the better qualities come back once
+// the load subsides.
+// NOTE: This class is thread-safe. Concurrent updates of an estimate may lose
+// one of the samples, which doesn't matter for a moving average.
+class AnnotationQualityController {
+ public:
+  static const int kNumLevels =
+      static_cast<int>(AnnotationQuality::NUM_LEVELS);
+
+  // The fixed overhead of a request, in bytes of input.
+  static const int64 kRequestOverheadBytes = 256;
+
+  explicit AnnotationQualityController(int probe_interval = 16);
+
+  // Returns the best quality, but not worse than 'lowest_quality', whose
+  // estimated latency for an input of 'input_bytes' is within
+  // 'budget_micros'. The qualities without estimates are assumed to fit.
+  // Returns 'lowest_quality' if none fits, and FULL if 'budget_micros' <= 0.
+  AnnotationQuality Choose(int64 input_bytes, int64 budget_micros,
+                           AnnotationQuality lowest_quality) const;
+
+  // Updates the estimate of 'quality' with a request of 'input_bytes' that
+  // took 'latency_micros'.
+  void Record(AnnotationQuality quality, int64 input_bytes,
+              int64 latency_micros);
+
+  // Returns the estimated latency of 'quality' for 'input_bytes', or -1 if
+  // there's no estimate yet.
+  int64 EstimatedLatencyMicros(AnnotationQuality quality,
+                               int64 input_bytes) const;
+
+ private:
+  const int probe_interval_;
+
+  // The moving averages of the latency, in nanoseconds per byte of input
+  // including the overhead, by quality. 0 until the first request.
+  std::atomic<int64> nanos_per_byte_[kNumLevels];
+
+  // The number of degraded choices, for the probes.
+  mutable std::atomic<int64> num_degraded_{0};
+
+  TC_DISALLOW_COPY_AND_ASSIGN(AnnotationQualityController);
+};
+
+}  // namespace libtextclassifier2
+
+#endif  // LIBTEXTCLASSIFIER_ANNOTATION_QUALITY_H_
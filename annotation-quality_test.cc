@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "annotation-quality.h"
+
+#include "gtest/gtest.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+TEST(AnnotationQualityControllerTest, FullWithoutBudgetOrEstimates) {
+  AnnotationQualityController controller;
+  EXPECT_EQ(controller.Choose(1000, /*budget_micros=*/0,
+                              AnnotationQuality::REGEX_ONLY),
+            AnnotationQuality::FULL);
+  EXPECT_EQ(controller.Choose(1000, /*budget_micros=*/10,
+                              AnnotationQuality::REGEX_ONLY),
+            AnnotationQuality::FULL);
+  EXPECT_EQ(controller.EstimatedLatencyMicros(AnnotationQuality::FULL, 1000),
+            -1);
+}
+
+TEST(AnnotationQualityControllerTest, DegradesToTheBestQualityThatFits) {
+  AnnotationQualityController controller(/*probe_interval=*/1000);
+  const int64 bytes = 1000 - AnnotationQualityController::kRequestOverheadBytes;
+  controller.Record(AnnotationQuality::FULL, bytes, 10000);
+  controller.Record(AnnotationQuality::NO_MODEL, bytes, 2000);
+  controller.Record(AnnotationQuality::REGEX_ONLY, bytes, 500);
+  EXPECT_EQ(controller.EstimatedLatencyMicros(AnnotationQuality::FULL, bytes),
+            10000);
+
+  EXPECT_EQ(controller.Choose(bytes, 20000, AnnotationQuality::REGEX_ONLY),
+            AnnotationQuality::FULL);
+  EXPECT_EQ(controller.Choose(bytes, 5000, AnnotationQuality::REGEX_ONLY),
+            AnnotationQuality::NO_MODEL);
+  EXPECT_EQ(controller.Choose(bytes, 1000, AnnotationQuality::REGEX_ONLY),
+            AnnotationQuality::REGEX_ONLY);
+  EXPECT_EQ(controller.Choose(bytes, 100, AnnotationQuality::REGEX_ONLY),
+            AnnotationQuality::REGEX_ONLY);
+
+  // Callers can bound the degradation.
+  EXPECT_EQ(controller.Choose(bytes, 100, AnnotationQuality::NO_MODEL),
+            AnnotationQuality::NO_MODEL);
+  EXPECT_EQ(controller.Choose(bytes, 100, AnnotationQuality::FULL),
+            AnnotationQuality::FULL);
+
+  // Shorter inputs take less time.
+  EXPECT_EQ(controller.Choose(bytes / 100, 5000,
+                              AnnotationQuality::REGEX_ONLY),
+            AnnotationQuality::FULL);
+}
+
+TEST(AnnotationQualityControllerTest, RecoversThroughProbes) {
+  AnnotationQualityController controller(/*probe_interval=*/4);
+  controller.Record(AnnotationQuality::FULL, 1000, 100000);
+  controller.Record(AnnotationQuality::NO_MODEL, 1000, 100);
+
+  // Every fourth degraded request probes the full quality.
+  int num_probes = 0;
+  for (int i = 0; i < 8; ++i) {
+    if (controller.Choose(1000, 1000, AnnotationQuality::REGEX_ONLY) ==
+        AnnotationQuality::FULL) {
+      ++num_probes;
+    }
+  }
+  EXPECT_EQ(num_probes, 2);
+
+  // Once the probes are fast again, the full quality is back.
+  for (int i = 0; i < 100; ++i) {
+    controller.Record(AnnotationQuality::FULL, 1000, 500);
+  }
+  EXPECT_EQ(controller.Choose(1000, 1000, AnnotationQuality::REGEX_ONLY),
+            AnnotationQuality::FULL);
+  EXPECT_EQ(AnnotationQualityName(AnnotationQuality::NO_MODEL),
+            std::string("no_model"));
+}
+
+}  // namespace
+}  // namespace libtextclassifier2
@@ -16,158 +16,287 @@
 
 #include "cached-features.h"
 
+#include <algorithm>
+#include <utility>
+
 #include "tensor-view.h"
 #include "util/base/logging.h"
 
 namespace libtextclassifier2 {
 
-namespace {
-
-int CalculateOutputFeaturesSize(const FeatureProcessorOptions* options,
-                                int feature_vector_size) {
-  const bool bounds_sensitive_enabled =
-      options->bounds_sensitive_features() &&
-      options->bounds_sensitive_features()->enabled();
+FeatureExtractionPlan FeatureExtractionPlan::FromOptions(
+    const FeatureProcessorOptions* options) {
+  FeatureExtractionPlan plan;
+  plan.feature_version = options->feature_version();
+  plan.context_size = options->context_size();
+  const FeatureProcessorOptions_::BoundsSensitiveFeatures* config =
+      options->bounds_sensitive_features();
+  if (config != nullptr && config->enabled()) {
+    plan.bounds_sensitive = true;
+    plan.num_tokens_before = config->num_tokens_before();
+    plan.num_tokens_inside_left = config->num_tokens_inside_left();
+    plan.num_tokens_inside_right = config->num_tokens_inside_right();
+    plan.num_tokens_after = config->num_tokens_after();
+    plan.include_inside_bag = config->include_inside_bag();
+    plan.include_inside_length = config->include_inside_length();
+  }
+  return plan;
+}
 
+int FeatureExtractionPlan::OutputFeaturesSize(int feature_vector_size) const {
   int num_extracted_tokens = 0;
-  if (bounds_sensitive_enabled) {
-    const FeatureProcessorOptions_::BoundsSensitiveFeatures* config =
-        options->bounds_sensitive_features();
-    num_extracted_tokens += config->num_tokens_before();
-    num_extracted_tokens += config->num_tokens_inside_left();
-    num_extracted_tokens += config->num_tokens_inside_right();
-    num_extracted_tokens += config->num_tokens_after();
-    if (config->include_inside_bag()) {
+  if (bounds_sensitive) {
+    num_extracted_tokens += num_tokens_before;
+    num_extracted_tokens += num_tokens_inside_left;
+    num_extracted_tokens += num_tokens_inside_right;
+    num_extracted_tokens += num_tokens_after;
+    if (include_inside_bag) {
       ++num_extracted_tokens;
     }
   } else {
-    num_extracted_tokens = 2 * options->context_size() + 1;
+    num_extracted_tokens = 2 * context_size + 1;
   }
 
   int output_features_size = num_extracted_tokens * feature_vector_size;
 
-  if (bounds_sensitive_enabled &&
-      options->bounds_sensitive_features()->include_inside_length()) {
+  if (bounds_sensitive && include_inside_length) {
     ++output_features_size;
   }
 
   return output_features_size;
 }
 
-}  // namespace
-
 std::unique_ptr<CachedFeatures> CachedFeatures::Create(
-    const TokenSpan& extraction_span,
-    std::unique_ptr<std::vector<float>> features,
-    std::unique_ptr<std::vector<float>> padding_features,
+    const TokenSpan& extraction_span, std::vector<float> features,
     const FeatureProcessorOptions* options, int feature_vector_size) {
-  const int min_feature_version =
-      options->bounds_sensitive_features() &&
-              options->bounds_sensitive_features()->enabled()
-          ? 2
-          : 1;
-  if (options->feature_version() < min_feature_version) {
+  return Create(extraction_span, std::move(features),
+                FeatureExtractionPlan::FromOptions(options),
+                feature_vector_size);
+}
+
+std::unique_ptr<CachedFeatures> CachedFeatures::Create(
+    const TokenSpan& extraction_span, std::vector<float> features,
+    const FeatureExtractionPlan& plan, int feature_vector_size) {
+  const int min_feature_version = plan.bounds_sensitive ? 2 : 1;
+  if (plan.feature_version < min_feature_version) {
     TC_LOG(ERROR) << "Unsupported feature version.";
     return nullptr;
   }
 
+  const int num_tokens = TokenSpanSize(extraction_span);
+  if (feature_vector_size <= 0 ||
+      features.size() != (num_tokens + 1) * feature_vector_size) {
+    TC_LOG(ERROR) << "Unexpected size of the features.";
+    return nullptr;
+  }
+
   std::unique_ptr<CachedFeatures> cached_features(new CachedFeatures());
   cached_features->extraction_span_ = extraction_span;
   cached_features->features_ = std::move(features);
-  cached_features->padding_features_ = std::move(padding_features);
-  cached_features->options_ = options;
+  cached_features->plan_ = plan;
+  cached_features->num_tokens_ = num_tokens;
+  cached_features->num_features_per_token_ = feature_vector_size;
 
   cached_features->output_features_size_ =
-      CalculateOutputFeaturesSize(options, feature_vector_size);
+      plan.OutputFeaturesSize(feature_vector_size);
+
+  if (plan.bounds_sensitive && plan.include_inside_bag) {
+    cached_features->ComputeBagPrefixSums();
+  }
 
   return cached_features;
 }
 
+void CachedFeatures::ComputeBagPrefixSums() {
+  bag_prefix_sums_.assign((num_tokens_ + 1) * num_features_per_token_, 0.0);
+  for (int i = 0; i < num_tokens_; ++i) {
+    const float* token_features = TokenFeatures(i);
+    double* sums = bag_prefix_sums_.data() + i * num_features_per_token_;
+    double* next_sums = sums + num_features_per_token_;
+    for (int j = 0; j < num_features_per_token_; ++j) {
+      next_sums[j] = sums[j] + token_features[j];
+    }
+  }
+}
+
 void CachedFeatures::AppendClickContextFeaturesForClick(
     int click_pos, std::vector<float>* output_features) const {
+  const int offset = output_features->size();
+  output_features->resize(offset + output_features_size_);
+  AppendClickContextFeaturesForClick(click_pos,
+                                     output_features->data() + offset);
+}
+
+void CachedFeatures::AppendClickContextFeaturesForClick(
+    int click_pos, float* output_features) const {
   click_pos -= extraction_span_.first;
 
   AppendFeaturesInternal(
       /*intended_span=*/ExpandTokenSpan(SingleTokenSpan(click_pos),
-                                        options_->context_size(),
-                                        options_->context_size()),
-      /*read_mask_span=*/{0, TokenSpanSize(extraction_span_)}, output_features);
+                                        plan_.context_size,
+                                        plan_.context_size),
+      /*read_mask_span=*/{0, TokenSpanSize(extraction_span_)},
+      features_.data(), output_features);
 }
 
 void CachedFeatures::AppendBoundsSensitiveFeaturesForSpan(
     TokenSpan selected_span, std::vector<float>* output_features) const {
-  const FeatureProcessorOptions_::BoundsSensitiveFeatures* config =
-      options_->bounds_sensitive_features();
+  const int offset = output_features->size();
+  output_features->resize(offset + output_features_size_);
+  AppendBoundsSensitiveFeaturesForSpan(selected_span,
+                                       output_features->data() + offset);
+}
 
+void CachedFeatures::AppendClickContextFeaturesForClick(
+    int click_pos, const FeaturesInput& input, int row) const {
+  if (input.floats != nullptr) {
+    AppendClickContextFeaturesForClick(
+        click_pos, input.floats + row * output_features_size_);
+    return;
+  }
+  click_pos -= extraction_span_.first;
+  AppendFeaturesInternal(
+      /*intended_span=*/ExpandTokenSpan(SingleTokenSpan(click_pos),
+                                        plan_.context_size,
+                                        plan_.context_size),
+      /*read_mask_span=*/{0, TokenSpanSize(extraction_span_)},
+      QuantizedTokenFeatures(input.quantization),
+      input.quantized + row * output_features_size_);
+}
+
+void CachedFeatures::AppendBoundsSensitiveFeaturesForSpan(
+    TokenSpan selected_span, float* output_features) const {
+  AppendBoundsSensitiveFeaturesInternal(
+      selected_span, features_.data(), [](float value) { return value; },
+      output_features);
+}
+
+void CachedFeatures::AppendBoundsSensitiveFeaturesForSpan(
+    TokenSpan selected_span, const FeaturesInput& input, int row) const {
+  if (input.floats != nullptr) {
+    AppendBoundsSensitiveFeaturesForSpan(
+        selected_span, input.floats + row * output_features_size_);
+    return;
+  }
+  const TensorQuantization quantization = input.quantization;
+  AppendBoundsSensitiveFeaturesInternal(
+      selected_span, QuantizedTokenFeatures(quantization),
+      [&quantization](float value) {
+        return QuantizeValue(value, quantization);
+      },
+      input.quantized + row * output_features_size_);
+}
+
+template <typename T, typename Quantize>
+void CachedFeatures::AppendBoundsSensitiveFeaturesInternal(
+    TokenSpan selected_span, const T* token_features, const Quantize& quantize,
+    T* output_features) const {
   selected_span.first -= extraction_span_.first;
   selected_span.second -= extraction_span_.first;
 
   // Append the features for tokens around the left bound. Masks out tokens
   // after the right bound, so that if num_tokens_inside_left goes past it,
   // padding tokens will be used.
-  AppendFeaturesInternal(
-      /*intended_span=*/{selected_span.first - config->num_tokens_before(),
+  output_features = AppendFeaturesInternal(
+      /*intended_span=*/{selected_span.first - plan_.num_tokens_before,
                          selected_span.first +
-                             config->num_tokens_inside_left()},
-      /*read_mask_span=*/{0, selected_span.second}, output_features);
+                             plan_.num_tokens_inside_left},
+      /*read_mask_span=*/{0, selected_span.second}, token_features,
+      output_features);
 
   // Append the features for tokens around the right bound. Masks out tokens
   // before the left bound, so that if num_tokens_inside_right goes past it,
   // padding tokens will be used.
-  AppendFeaturesInternal(
+  output_features = AppendFeaturesInternal(
       /*intended_span=*/{selected_span.second -
-                             config->num_tokens_inside_right(),
-                         selected_span.second + config->num_tokens_after()},
+                             plan_.num_tokens_inside_right,
+                         selected_span.second + plan_.num_tokens_after},
       /*read_mask_span=*/{selected_span.first, TokenSpanSize(extraction_span_)},
-      output_features);
+      token_features, output_features);
 
-  if (config->include_inside_bag()) {
-    AppendBagFeatures(selected_span, output_features);
+  if (plan_.include_inside_bag) {
+    output_features =
+        AppendBagFeatures(selected_span, quantize, output_features);
   }
 
-  if (config->include_inside_length()) {
-    output_features->push_back(
-        static_cast<float>(TokenSpanSize(selected_span)));
+  if (plan_.include_inside_length) {
+    *output_features++ =
+        quantize(static_cast<float>(TokenSpanSize(selected_span)));
   }
 }
 
-void CachedFeatures::AppendFeaturesInternal(
-    const TokenSpan& intended_span, const TokenSpan& read_mask_span,
-    std::vector<float>* output_features) const {
+template <typename T>
+T* CachedFeatures::AppendFeaturesInternal(const TokenSpan& intended_span,
+                                          const TokenSpan& read_mask_span,
+                                          const T* token_features,
+                                          T* output_features) const {
   const TokenSpan copy_span =
       IntersectTokenSpans(intended_span, read_mask_span);
-  for (int i = intended_span.first; i < copy_span.first; ++i) {
-    AppendPaddingFeatures(output_features);
+  for (int i = intended_span.first;
+       i < std::min(copy_span.first, intended_span.second); ++i) {
+    output_features = AppendPaddingFeatures(token_features, output_features);
   }
-  output_features->insert(
-      output_features->end(),
-      features_->begin() + copy_span.first * NumFeaturesPerToken(),
-      features_->begin() + copy_span.second * NumFeaturesPerToken());
-  for (int i = copy_span.second; i < intended_span.second; ++i) {
-    AppendPaddingFeatures(output_features);
+  if (copy_span.first < copy_span.second) {
+    output_features = std::copy(
+        token_features + copy_span.first * num_features_per_token_,
+        token_features + copy_span.second * num_features_per_token_,
+        output_features);
   }
+  for (int i = std::max(copy_span.first, copy_span.second);
+       i < intended_span.second; ++i) {
+    output_features = AppendPaddingFeatures(token_features, output_features);
+  }
+  return output_features;
 }
 
-void CachedFeatures::AppendPaddingFeatures(
-    std::vector<float>* output_features) const {
-  output_features->insert(output_features->end(), padding_features_->begin(),
-                          padding_features_->end());
+template <typename T>
+T* CachedFeatures::AppendPaddingFeatures(const T* token_features,
+                                         T* output_features) const {
+  const T* padding_features =
+      token_features + num_tokens_ * num_features_per_token_;
+  return std::copy(padding_features,
+                   padding_features + num_features_per_token_,
+                   output_features);
 }
 
-void CachedFeatures::AppendBagFeatures(
-    const TokenSpan& bag_span, std::vector<float>* output_features) const {
-  const int offset = output_features->size();
-  output_features->resize(output_features->size() + NumFeaturesPerToken());
-  for (int i = bag_span.first; i < bag_span.second; ++i) {
-    for (int j = 0; j < NumFeaturesPerToken(); ++j) {
-      (*output_features)[offset + j] +=
-          (*features_)[i * NumFeaturesPerToken() + j] / TokenSpanSize(bag_span);
-    }
+template <typename T, typename Quantize>
+T* CachedFeatures::AppendBagFeatures(const TokenSpan& bag_span,
+                                     const Quantize& quantize,
+                                     T* output_features) const {
+  const int bag_size = TokenSpanSize(bag_span);
+  if (bag_size <= 0) {
+    std::fill(output_features, output_features + num_features_per_token_,
+              quantize(0.0f));
+    return output_features + num_features_per_token_;
+  }
+  const double* begin_sums =
+      bag_prefix_sums_.data() + bag_span.first * num_features_per_token_;
+  const double* end_sums =
+      bag_prefix_sums_.data() + bag_span.second * num_features_per_token_;
+  for (int j = 0; j < num_features_per_token_; ++j) {
+    *output_features++ = quantize(
+        static_cast<float>((end_sums[j] - begin_sums[j]) / bag_size));
+  }
+  return output_features;
+}
+
+void CachedFeatures::PrepareInput(const FeaturesInput& input) const {
+  if (input.quantized != nullptr) {
+    QuantizedTokenFeatures(input.quantization);
   }
 }
 
-int CachedFeatures::NumFeaturesPerToken() const {
-  return padding_features_->size();
+const uint8* CachedFeatures::QuantizedTokenFeatures(
+    const TensorQuantization& quantization) const {
+  if (quantized_features_.size() != features_.size() ||
+      !(quantization_ == quantization)) {
+    quantized_features_.resize(features_.size());
+    for (int i = 0; i < features_.size(); ++i) {
+      quantized_features_[i] = QuantizeValue(features_[i], quantization);
+    }
+    quantization_ = quantization;
+  }
+  return quantized_features_.data();
 }
 
 }  // namespace libtextclassifier2
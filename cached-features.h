@@ -26,14 +26,46 @@
 
 namespace libtextclassifier2 {
 
+// The options of the feature extraction, resolved from the
+// FeatureProcessorOptions once, so that the code that runs per span or per
+// token reads plain fields instead of going through the flatbuffer.
+struct FeatureExtractionPlan {
+  int feature_version = 0;
+
+  // The tokens on each side of the click of the click context features.
+  int context_size = 0;
+
+  // FeatureProcessorOptions::bounds_sensitive_features(). The counts are 0
+  // when the bounds-sensitive features are disabled.
+  bool bounds_sensitive = false;
+  int num_tokens_before = 0;
+  int num_tokens_inside_left = 0;
+  int num_tokens_inside_right = 0;
+  int num_tokens_after = 0;
+  bool include_inside_bag = false;
+  bool include_inside_length = false;
+
+  static FeatureExtractionPlan FromOptions(
+      const FeatureProcessorOptions* options);
+
+  // Returns the number of features of a click or a span, given the number of
+  // features of a token.
+  int OutputFeaturesSize(int feature_vector_size) const;
+};
+
 // Holds state for extracting features across multiple calls and reusing them.
 // Assumes that features for each Token are independent.
 class CachedFeatures {
  public:
+  // The 'features' hold the feature vectors of the tokens of the extraction
+  // span, followed by the feature vector of the padding token, in one buffer.
   static std::unique_ptr<CachedFeatures> Create(
-      const TokenSpan& extraction_span,
-      std::unique_ptr<std::vector<float>> features,
-      std::unique_ptr<std::vector<float>> padding_features,
+      const TokenSpan& extraction_span, std::vector<float> features,
+      const FeatureExtractionPlan& plan, int feature_vector_size);
+
+  // Same as above, but resolves the plan from the options.
+  static std::unique_ptr<CachedFeatures> Create(
+      const TokenSpan& extraction_span, std::vector<float> features,
       const FeatureProcessorOptions* options, int feature_vector_size);
 
   // Appends the click context features for the given click position to
@@ -41,41 +73,109 @@ class CachedFeatures {
   void AppendClickContextFeaturesForClick(
       int click_pos, std::vector<float>* output_features) const;
 
+  // Same as above, but writes the OutputFeaturesSize() features to the buffer
+  // 'output_features' points to, e.g. to the input tensor of the model.
+  void AppendClickContextFeaturesForClick(int click_pos,
+                                          float* output_features) const;
+
   // Appends the bounds-sensitive features for the given token span to
   // 'output_features'.
   void AppendBoundsSensitiveFeaturesForSpan(
       TokenSpan selected_span, std::vector<float>* output_features) const;
 
+  // Same as above, but writes the OutputFeaturesSize() features to the buffer
+  // 'output_features' points to.
+  void AppendBoundsSensitiveFeaturesForSpan(TokenSpan selected_span,
+                                            float* output_features) const;
+
+  // Same as above, but writes the features of a batch row to the input of a
+  // model, as floats or quantized to what the model takes. Quantizes the token
+  // features once, not once per row, so that the float vector of the row is
+  // never built. Not thread-safe for quantized inputs, unless PrepareInput()
+  // was called for their quantization.
+  void AppendClickContextFeaturesForClick(int click_pos,
+                                          const FeaturesInput& input,
+                                          int row) const;
+  void AppendBoundsSensitiveFeaturesForSpan(TokenSpan selected_span,
+                                            const FeaturesInput& input,
+                                            int row) const;
+
+  // Quantizes the token features for inputs like 'input' ahead of time, so
+  // that the methods above can then be called concurrently for them.
+  void PrepareInput(const FeaturesInput& input) const;
+
   // Returns number of features that 'AppendFeaturesForSpan' appends.
   int OutputFeaturesSize() const { return output_features_size_; }
 
+  // Returns the span of the tokens that have features, the others are padded.
+  const TokenSpan& ExtractionSpan() const { return extraction_span_; }
+
  private:
   CachedFeatures() {}
 
-  // Appends token features to the output. The intended_span specifies which
-  // tokens' features should be used in principle. The read_mask_span restricts
-  // which tokens are actually read. For tokens outside of the read_mask_span,
-  // padding tokens are used instead.
-  void AppendFeaturesInternal(const TokenSpan& intended_span,
-                              const TokenSpan& read_mask_span,
-                              std::vector<float>* output_features) const;
-
-  // Appends features of one padding token to the output.
-  void AppendPaddingFeatures(std::vector<float>* output_features) const;
-
-  // Appends the features of tokens from the given span to the output. The
-  // features are averaged so that the appended features have the size
-  // corresponding to one token.
-  void AppendBagFeatures(const TokenSpan& bag_span,
-                         std::vector<float>* output_features) const;
-
-  int NumFeaturesPerToken() const;
+  // Writes token features to the output and returns the end of what was
+  // written. The intended_span specifies which tokens' features should be
+  // used in principle. The read_mask_span restricts which tokens are actually
+  // read. For tokens outside of the read_mask_span, padding tokens are used
+  // instead. The 'token_features' are the rows of the token features, as
+  // floats or quantized.
+  template <typename T>
+  T* AppendFeaturesInternal(const TokenSpan& intended_span,
+                            const TokenSpan& read_mask_span,
+                            const T* token_features, T* output_features) const;
+
+  // Writes features of one padding token to the output and returns the end of
+  // what was written.
+  template <typename T>
+  T* AppendPaddingFeatures(const T* token_features, T* output_features) const;
+
+  // Writes the features of tokens from the given span to the output and
+  // returns the end of what was written. The features are averaged so that
+  // the written features have the size corresponding to one token, and then
+  // quantized with 'quantize'. Takes time independent of the bag size.
+  template <typename T, typename Quantize>
+  T* AppendBagFeatures(const TokenSpan& bag_span, const Quantize& quantize,
+                       T* output_features) const;
+
+  // Writes the bounds-sensitive features, with the token features in
+  // 'token_features' and the others quantized with 'quantize'.
+  template <typename T, typename Quantize>
+  void AppendBoundsSensitiveFeaturesInternal(TokenSpan selected_span,
+                                             const T* token_features,
+                                             const Quantize& quantize,
+                                             T* output_features) const;
+
+  // Returns the rows of the token features quantized with 'quantization'.
+  const uint8* QuantizedTokenFeatures(
+      const TensorQuantization& quantization) const;
+
+  // Fills bag_prefix_sums_ from the token features.
+  void ComputeBagPrefixSums();
+
+  const float* TokenFeatures(int token_index) const {
+    return features_.data() + token_index * num_features_per_token_;
+  }
 
   TokenSpan extraction_span_;
-  const FeatureProcessorOptions* options_;
+  FeatureExtractionPlan plan_;
   int output_features_size_;
-  std::unique_ptr<std::vector<float>> features_;
-  std::unique_ptr<std::vector<float>> padding_features_;
+  int num_tokens_;
+  int num_features_per_token_;
+
+  // Features of the tokens of the extraction span and of the padding token,
+  // one row per token.
+  std::vector<float> features_;
+
+  // Row i holds the sums of the features of the tokens before token i, for
+  // the inside bag of the bounds-sensitive features. Empty if the bag is not
+  // used. Accumulated in double, so that differences of the sums are as exact
+  // as summing up the bag directly.
+  std::vector<double> bag_prefix_sums_;
+
+  // features_ quantized with quantization_, when a quantized model asked for
+  // them.
+  mutable std::vector<uint8> quantized_features_;
+  mutable TensorQuantization quantization_;
 };
 
 }  // namespace libtextclassifier2
@@ -37,13 +37,17 @@ Matcher<std::vector<float>> ElementsAreFloat(const std::vector<float>& values) {
   return ElementsAreArray(matchers);
 }
 
-std::unique_ptr<std::vector<float>> MakeFeatures(int num_tokens) {
-  std::unique_ptr<std::vector<float>> features(new std::vector<float>());
+// Makes the features of the tokens, followed by the padding features.
+std::vector<float> MakeFeatures(int num_tokens) {
+  std::vector<float> features;
   for (int i = 1; i <= num_tokens; ++i) {
-    features->push_back(i * 11.0f);
-    features->push_back(-i * 11.0f);
-    features->push_back(i * 0.1f);
+    features.push_back(i * 11.0f);
+    features.push_back(-i * 11.0f);
+    features.push_back(i * 0.1f);
   }
+  features.push_back(112233.0);
+  features.push_back(-112233.0);
+  features.push_back(321.0);
   return features;
 }
 
@@ -71,13 +75,9 @@ TEST(CachedFeaturesTest, ClickContext) {
   builder.Finish(CreateFeatureProcessorOptions(builder, &options));
   flatbuffers::DetachedBuffer options_fb = builder.Release();
 
-  std::unique_ptr<std::vector<float>> features = MakeFeatures(9);
-  std::unique_ptr<std::vector<float>> padding_features(
-      new std::vector<float>{112233.0, -112233.0, 321.0});
-
   const std::unique_ptr<CachedFeatures> cached_features =
       CachedFeatures::Create(
-          {3, 10}, std::move(features), std::move(padding_features),
+          {3, 10}, MakeFeatures(7),
           flatbuffers::GetRoot<FeatureProcessorOptions>(options_fb.data()),
           /*feature_vector_size=*/3);
   ASSERT_TRUE(cached_features);
@@ -112,13 +112,9 @@ TEST(CachedFeaturesTest, BoundsSensitive) {
   builder.Finish(CreateFeatureProcessorOptions(builder, &options));
   flatbuffers::DetachedBuffer options_fb = builder.Release();
 
-  std::unique_ptr<std::vector<float>> features = MakeFeatures(9);
-  std::unique_ptr<std::vector<float>> padding_features(
-      new std::vector<float>{112233.0, -112233.0, 321.0});
-
   const std::unique_ptr<CachedFeatures> cached_features =
       CachedFeatures::Create(
-          {3, 9}, std::move(features), std::move(padding_features),
+          {3, 9}, MakeFeatures(6),
           flatbuffers::GetRoot<FeatureProcessorOptions>(options_fb.data()),
           /*feature_vector_size=*/3);
   ASSERT_TRUE(cached_features);
@@ -153,5 +149,157 @@ TEST(CachedFeaturesTest, BoundsSensitive) {
                         44.0,     -44.0,     0.4,   1.0}));
 }
 
+TEST(CachedFeaturesTest, BoundsSensitiveBagOfManyTokens) {
+  std::unique_ptr<FeatureProcessorOptions_::BoundsSensitiveFeaturesT> config(
+      new FeatureProcessorOptions_::BoundsSensitiveFeaturesT());
+  config->enabled = true;
+  config->include_inside_bag = true;
+  FeatureProcessorOptionsT options;
+  options.bounds_sensitive_features = std::move(config);
+  options.feature_version = 2;
+  flatbuffers::FlatBufferBuilder builder;
+  builder.Finish(CreateFeatureProcessorOptions(builder, &options));
+  flatbuffers::DetachedBuffer options_fb = builder.Release();
+
+  const int num_tokens = 500;
+  const std::unique_ptr<CachedFeatures> cached_features =
+      CachedFeatures::Create(
+          {0, num_tokens}, MakeFeatures(num_tokens),
+          flatbuffers::GetRoot<FeatureProcessorOptions>(options_fb.data()),
+          /*feature_vector_size=*/3);
+  ASSERT_TRUE(cached_features);
+
+  // The average of the tokens i in [100, 400) is (i + 1) * 11 at i = 249.5.
+  EXPECT_THAT(GetCachedBoundsSensitiveFeatures(*cached_features, {100, 400}),
+              ElementsAreFloat({250.5 * 11.0, -250.5 * 11.0, 25.05}));
+  EXPECT_THAT(GetCachedBoundsSensitiveFeatures(*cached_features, {0, 1}),
+              ElementsAreFloat({11.0, -11.0, 0.1}));
+}
+
+TEST(CachedFeaturesTest, WritesToRawBuffer) {
+  std::unique_ptr<FeatureProcessorOptions_::BoundsSensitiveFeaturesT> config(
+      new FeatureProcessorOptions_::BoundsSensitiveFeaturesT());
+  config->enabled = true;
+  config->num_tokens_before = 1;
+  config->num_tokens_inside_left = 1;
+  config->num_tokens_inside_right = 1;
+  config->num_tokens_after = 1;
+  config->include_inside_bag = true;
+  config->include_inside_length = true;
+  FeatureProcessorOptionsT options;
+  options.bounds_sensitive_features = std::move(config);
+  options.feature_version = 2;
+  flatbuffers::FlatBufferBuilder builder;
+  builder.Finish(CreateFeatureProcessorOptions(builder, &options));
+  flatbuffers::DetachedBuffer options_fb = builder.Release();
+
+  const std::unique_ptr<CachedFeatures> cached_features =
+      CachedFeatures::Create(
+          {0, 6}, MakeFeatures(6),
+          flatbuffers::GetRoot<FeatureProcessorOptions>(options_fb.data()),
+          /*feature_vector_size=*/3);
+  ASSERT_TRUE(cached_features);
+
+  const int size = cached_features->OutputFeaturesSize();
+  std::vector<float> buffer(2 * size, -1.0);
+  cached_features->AppendBoundsSensitiveFeaturesForSpan({0, 2}, buffer.data());
+  cached_features->AppendBoundsSensitiveFeaturesForSpan({3, 6},
+                                                        buffer.data() + size);
+
+  std::vector<float> expected =
+      GetCachedBoundsSensitiveFeatures(*cached_features, {0, 2});
+  cached_features->AppendBoundsSensitiveFeaturesForSpan({3, 6}, &expected);
+  EXPECT_THAT(buffer, ElementsAreFloat(expected));
+}
+
+TEST(CachedFeaturesTest, WritesQuantizedFeatures) {
+  std::unique_ptr<FeatureProcessorOptions_::BoundsSensitiveFeaturesT> config(
+      new FeatureProcessorOptions_::BoundsSensitiveFeaturesT());
+  config->enabled = true;
+  config->num_tokens_before = 1;
+  config->num_tokens_inside_left = 1;
+  config->num_tokens_inside_right = 1;
+  config->num_tokens_after = 1;
+  config->include_inside_bag = true;
+  config->include_inside_length = true;
+  FeatureProcessorOptionsT options;
+  options.bounds_sensitive_features = std::move(config);
+  options.feature_version = 2;
+  flatbuffers::FlatBufferBuilder builder;
+  builder.Finish(CreateFeatureProcessorOptions(builder, &options));
+  flatbuffers::DetachedBuffer options_fb = builder.Release();
+
+  const std::unique_ptr<CachedFeatures> cached_features =
+      CachedFeatures::Create(
+          {0, 6}, MakeFeatures(6),
+          flatbuffers::GetRoot<FeatureProcessorOptions>(options_fb.data()),
+          /*feature_vector_size=*/3);
+  ASSERT_TRUE(cached_features);
+
+  const int size = cached_features->OutputFeaturesSize();
+  std::vector<uint8> buffer(2 * size, 0);
+  FeaturesInput input;
+  input.quantized = buffer.data();
+  input.quantization.scale = 0.5;
+  input.quantization.zero_point = 128;
+  cached_features->AppendBoundsSensitiveFeaturesForSpan({3, 6}, input,
+                                                        /*row=*/1);
+
+  // The same as the float features quantized one by one.
+  const std::vector<float> features =
+      GetCachedBoundsSensitiveFeatures(*cached_features, {3, 6});
+  std::vector<uint8> expected(size, 0);
+  for (const float feature : features) {
+    expected.push_back(QuantizeValue(feature, input.quantization));
+  }
+  EXPECT_THAT(buffer, ElementsAreArray(expected));
+
+  // Values out of the range saturate.
+  EXPECT_EQ(QuantizeValue(-112233.0, input.quantization), 0);
+  EXPECT_EQ(QuantizeValue(112233.0, input.quantization), 255);
+  EXPECT_EQ(QuantizeValue(1.0, input.quantization), 130);
+
+  // Float inputs get the float features.
+  std::vector<float> float_buffer(2 * size, -1.0);
+  FeaturesInput float_input;
+  float_input.floats = float_buffer.data();
+  cached_features->AppendBoundsSensitiveFeaturesForSpan({3, 6}, float_input,
+                                                        /*row=*/0);
+  EXPECT_THAT(std::vector<float>(float_buffer.begin(),
+                                 float_buffer.begin() + size),
+              ElementsAreFloat(features));
+}
+
+TEST(CachedFeaturesTest, RejectsFeaturesOfWrongSize) {
+  FeatureProcessorOptionsT options;
+  options.context_size = 2;
+  options.feature_version = 1;
+  flatbuffers::FlatBufferBuilder builder;
+  builder.Finish(CreateFeatureProcessorOptions(builder, &options));
+  flatbuffers::DetachedBuffer options_fb = builder.Release();
+
+  // The padding features are missing.
+  EXPECT_FALSE(CachedFeatures::Create(
+      {3, 10}, MakeFeatures(6),
+      flatbuffers::GetRoot<FeatureProcessorOptions>(options_fb.data()),
+      /*feature_vector_size=*/3));
+}
+
+TEST(CachedFeaturesTest, CreatesFromPlan) {
+  FeatureExtractionPlan plan;
+  plan.feature_version = 1;
+  plan.context_size = 1;
+  EXPECT_EQ(plan.OutputFeaturesSize(/*feature_vector_size=*/3), 9);
+
+  const std::unique_ptr<CachedFeatures> cached_features =
+      CachedFeatures::Create({3, 10}, MakeFeatures(7), plan,
+                             /*feature_vector_size=*/3);
+  ASSERT_TRUE(cached_features);
+
+  EXPECT_THAT(GetCachedClickContextFeatures(*cached_features, 3),
+              ElementsAreFloat({112233.0, -112233.0, 321.0, 11.0, -11.0, 0.1,
+                                22.0, -22.0, 0.2}));
+}
+
 }  // namespace
 }  // namespace libtextclassifier2
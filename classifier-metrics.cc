@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "classifier-metrics.h"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace libtextclassifier2 {
+
+namespace {
+
+// The counters per cache line.
+const int kCountersPerCacheLine = 64 / sizeof(std::atomic<int64>);
+
+// The shard of the calling thread, assigned round-robin to the threads.
+std::atomic<int> next_thread_shard(0);
+thread_local int thread_shard = -1;
+
+void AppendCount(const std::string& name, const std::string& labels,
+                 int64 count, std::string* result) {
+  if (count == 0) {
+    return;
+  }
+  result->append(name);
+  result->append("{");
+  result->append(labels);
+  result->append("} ");
+  result->append(std::to_string(count));
+  result->append("\n");
+}
+
+void AppendHistogram(const std::string& name, const std::string& labels,
+                     const MetricsHistogram& histogram, std::string* result) {
+  for (int i = 0; i < MetricsHistogram::kNumBuckets; ++i) {
+    // The exclusive upper bound of the bucket.
+    const std::string bound = i == MetricsHistogram::kNumBuckets - 1
+                                  ? "inf"
+                                  : std::to_string(int64{1} << i);
+    AppendCount(name, labels + ",lt=\"" + bound + "\"", histogram.counts[i],
+                result);
+  }
+}
+
+}  // namespace
+
+const char* MetricsModeName(MetricsMode mode) {
+  switch (mode) {
+    case MetricsMode::SUGGEST_SELECTION:
+      return "suggest_selection";
+    case MetricsMode::CLASSIFY_TEXT:
+      return "classify_text";
+    case MetricsMode::SUGGEST_AND_CLASSIFY:
+      return "suggest_and_classify";
+    case MetricsMode::ANNOTATE:
+      return "annotate";
+    case MetricsMode::NUM_MODES:
+      break;
+  }
+  return "unknown";
+}
+
+const char* AnnotatedSpanSourceName(AnnotatedSpan::Source source) {
+  switch (source) {
+    case AnnotatedSpan::Source::OTHER:
+      return "other";
+    case AnnotatedSpan::Source::MODEL:
+      return "model";
+    case AnnotatedSpan::Source::REGEX:
+      return "regex";
+    case AnnotatedSpan::Source::DATETIME:
+      return "datetime";
+    case AnnotatedSpan::Source::NUM_SOURCES:
+      break;
+  }
+  return "unknown";
+}
+
+int MetricsHistogram::Bucket(int64 value) {
+  int bucket = 0;
+  while (value > 0 && bucket < kNumBuckets - 1) {
+    value >>= 1;
+    ++bucket;
+  }
+  return bucket;
+}
+
+int64 MetricsHistogram::TotalCount() const {
+  int64 total_count = 0;
+  for (const int64 count : counts) {
+    total_count += count;
+  }
+  return total_count;
+}
+
+std::string MetricsSnapshot::ToString() const {
+  std::string result;
+  for (int mode = 0; mode < kNumModes; ++mode) {
+    const ModeMetrics& mode_metrics = modes[mode];
+    const std::string labels = std::string("mode=\"") +
+                               MetricsModeName(static_cast<MetricsMode>(mode)) +
+                               "\"";
+    AppendCount("requests", labels, mode_metrics.requests, &result);
+    AppendHistogram("input_bytes", labels, mode_metrics.input_bytes, &result);
+    AppendHistogram("latency_micros", labels, mode_metrics.latency_micros,
+                    &result);
+    for (int i = 0; i < mode_metrics.results_by_collection.size() &&
+                    i < collections.size();
+         ++i) {
+      AppendCount("results",
+                  labels + ",collection=\"" + collections[i] + "\"",
+                  mode_metrics.results_by_collection[i], &result);
+    }
+  }
+  for (int source = 0; source < kNumSources; ++source) {
+    AppendCount("conflict_wins",
+                std::string("source=\"") +
+                    AnnotatedSpanSourceName(
+                        static_cast<AnnotatedSpan::Source>(source)) +
+                    "\"",
+                conflict_wins[source], &result);
+  }
+  AppendCount("regex_timeouts", "", regex_timeouts, &result);
+  return result;
+}
+
+ClassifierMetrics::ClassifierMetrics(std::vector<std::string> collections,
+                                     int num_shards)
+    : collections_(std::move(collections)),
+      mode_size_(kResultsOffset + collections_.size()),
+      shard_size_((MetricsSnapshot::kNumModes * mode_size_ +
+                   MetricsSnapshot::kNumSources + 1 + kCountersPerCacheLine -
+                   1) /
+                  kCountersPerCacheLine * kCountersPerCacheLine),
+      num_shards_(std::max(1, num_shards)),
+      allocated_counters_(new std::atomic<int64>[num_shards_ * shard_size_ +
+                                                 kCountersPerCacheLine]) {
+  // Aligns the shards to the cache lines.
+  const uintptr_t address =
+      reinterpret_cast<uintptr_t>(allocated_counters_.get());
+  const int misalignment = address % 64 / sizeof(std::atomic<int64>);
+  counters_ = allocated_counters_.get() +
+              (misalignment == 0 ? 0 : kCountersPerCacheLine - misalignment);
+  for (int i = 0; i < num_shards_ * shard_size_; ++i) {
+    counters_[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+std::atomic<int64>* ClassifierMetrics::ThreadShard() const {
+  if (thread_shard < 0) {
+    thread_shard = next_thread_shard.fetch_add(1, std::memory_order_relaxed) &
+                   0x7FFFFFFF;
+  }
+  return counters_ + (thread_shard % num_shards_) * shard_size_;
+}
+
+void ClassifierMetrics::RecordRequest(MetricsMode mode, int64 input_bytes,
+                                      int64 latency_micros) const {
+  std::atomic<int64>* counters = ThreadShard() + ModeOffset(mode);
+  counters[kRequestsOffset].fetch_add(1, std::memory_order_relaxed);
+  counters[kInputBytesOffset + MetricsHistogram::Bucket(input_bytes)]
+      .fetch_add(1, std::memory_order_relaxed);
+  counters[kLatencyOffset + MetricsHistogram::Bucket(latency_micros)]
+      .fetch_add(1, std::memory_order_relaxed);
+}
+
+void ClassifierMetrics::RecordResult(MetricsMode mode,
+                                     int collection_id) const {
+  if (collection_id < 0 || collection_id >= collections_.size()) {
+    return;
+  }
+  ThreadShard()[ModeOffset(mode) + kResultsOffset + collection_id].fetch_add(
+      1, std::memory_order_relaxed);
+}
+
+void ClassifierMetrics::RecordConflictWin(AnnotatedSpan::Source source) const {
+  ThreadShard()[MetricsSnapshot::kNumModes * mode_size_ +
+                static_cast<int>(source)]
+      .fetch_add(1, std::memory_order_relaxed);
+}
+
+void ClassifierMetrics::RecordRegexTimeout() const {
+  ThreadShard()[MetricsSnapshot::kNumModes * mode_size_ +
+                MetricsSnapshot::kNumSources]
+      .fetch_add(1, std::memory_order_relaxed);
+}
+
+MetricsSnapshot ClassifierMetrics::Snapshot() const {
+  MetricsSnapshot snapshot;
+  snapshot.collections = collections_;
+  for (MetricsSnapshot::ModeMetrics& mode_metrics : snapshot.modes) {
+    mode_metrics.results_by_collection.assign(collections_.size(), 0);
+  }
+  for (int shard = 0; shard < num_shards_; ++shard) {
+    const std::atomic<int64>* counters = counters_ + shard * shard_size_;
+    for (int mode = 0; mode < MetricsSnapshot::kNumModes; ++mode) {
+      const std::atomic<int64>* mode_counters = counters + mode * mode_size_;
+      MetricsSnapshot::ModeMetrics& mode_metrics = snapshot.modes[mode];
+      mode_metrics.requests +=
+          mode_counters[kRequestsOffset].load(std::memory_order_relaxed);
+      for (int i = 0; i < MetricsHistogram::kNumBuckets; ++i) {
+        mode_metrics.input_bytes.counts[i] +=
+            mode_counters[kInputBytesOffset + i].load(
+                std::memory_order_relaxed);
+        mode_metrics.latency_micros.counts[i] +=
+            mode_counters[kLatencyOffset + i].load(std::memory_order_relaxed);
+      }
+      for (int i = 0; i < collections_.size(); ++i) {
+        mode_metrics.results_by_collection[i] +=
+            mode_counters[kResultsOffset + i].load(std::memory_order_relaxed);
+      }
+    }
+    for (int source = 0; source < MetricsSnapshot::kNumSources; ++source) {
+      snapshot.conflict_wins[source] +=
+          counters[MetricsSnapshot::kNumModes * mode_size_ + source].load(
+              std::memory_order_relaxed);
+    }
+    snapshot.regex_timeouts +=
+        counters[MetricsSnapshot::kNumModes * mode_size_ +
+                 MetricsSnapshot::kNumSources]
+            .load(std::memory_order_relaxed);
+  }
+  return snapshot;
+}
+
+}  // namespace libtextclassifier2
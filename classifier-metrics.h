@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Always-on counters and histograms of the requests of a model, for capacity
+// planning.
+
+#ifndef LIBTEXTCLASSIFIER_CLASSIFIER_METRICS_H_
+#define LIBTEXTCLASSIFIER_CLASSIFIER_METRICS_H_
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "types.h"
+#include "util/base/integral_types.h"
+#include "util/base/macros.h"
+
+namespace libtextclassifier2 {
+
+enum class MetricsMode {
+  SUGGEST_SELECTION = 0,
+  CLASSIFY_TEXT,
+  SUGGEST_AND_CLASSIFY,
+  ANNOTATE,
+  NUM_MODES,
+};
+
+// Returns a human readable name of the mode.
+const char* MetricsModeName(MetricsMode mode);
+
+// Returns a human readable name of the source.
+const char* AnnotatedSpanSourceName(AnnotatedSpan::Source source);
+
+// A histogram of non-negative values in power of two buckets: bucket 0 counts
+// the zeros, and bucket i > 0 the values in [2^(i - 1), 2^i). The last bucket
+// also counts all the larger values.
+struct MetricsHistogram {
+  static const int kNumBuckets = 32;
+
+  // Returns the bucket of a value.
+  static int Bucket(int64 value);
+
+  int64 counts[kNumBuckets] = {};
+
+  int64 TotalCount() const;
+};
+
+// The metrics of a model at a point in time, see ClassifierMetrics.
+struct MetricsSnapshot {
+  static const int kNumModes = static_cast<int>(MetricsMode::NUM_MODES);
+  static const int kNumSources =
+      static_cast<int>(AnnotatedSpan::Source::NUM_SOURCES);
+
+  struct ModeMetrics {
+    int64 requests = 0;
+
+    // The UTF8 size of the inputs, and the wall time of the requests.
+    MetricsHistogram input_bytes;
+    MetricsHistogram latency_micros;
+
+    // The produced spans (annotation) or top classifications, indexed by
+    // collection id, see TextClassifier::Collections().
+    std::vector<int64> results_by_collection;
+  };
+
+  ModeMetrics modes[kNumModes];
+
+  // How often a candidate of each source was kept in a conflict.
+  int64 conflict_wins[kNumSources] = {};
+
+  // How often a regex match ran out of its time limit, see
+  // LoadOptions::regex_time_limit_millis.
+  int64 regex_timeouts = 0;
+
+  // The names of the collections, indexed by collection id.
+  std::vector<std::string> collections;
+
+  // Returns the metrics as text, one metric per line, as
+  //   name{label="value",...} count
+  // Skips the zero counts.
+  std::string ToString() const;
+};
+
+// Counts the requests of a model, cheap enough to stay on in production.
+// The counters are relaxed atomics sharded by thread, so that the recording
+// threads don't share cache lines and never wait. Snapshot() sums the shards.
+// NOTE: This class is thread-safe.
+class ClassifierMetrics {
+ public:
+  explicit ClassifierMetrics(std::vector<std::string> collections,
+                             int num_shards = 16);
+
+  // Counts a request of 'mode' with an input of 'input_bytes' that took
+  // 'latency_micros'.
+  void RecordRequest(MetricsMode mode, int64 input_bytes,
+                     int64 latency_micros) const;
+
+  // Counts a span or classification of the given collection id produced by a
+  // request of 'mode'. Ignores the invalid ids.
+  void RecordResult(MetricsMode mode, int collection_id) const;
+
+  // Counts a candidate of 'source' that was kept in a conflict.
+  void RecordConflictWin(AnnotatedSpan::Source source) const;
+
+  // Counts a regex match that ran out of its time limit.
+  void RecordRegexTimeout() const;
+
+  // Returns the sums of the counters. Concurrent requests may or may not be
+  // included.
+  MetricsSnapshot Snapshot() const;
+
+ private:
+  // The counters of a shard are laid out as, per mode: requests, input bytes
+  // histogram, latency histogram, results by collection; followed by the
+  // conflict wins and the regex timeouts.
+  int ModeOffset(MetricsMode mode) const {
+    return static_cast<int>(mode) * mode_size_;
+  }
+  static const int kRequestsOffset = 0;
+  static const int kInputBytesOffset = 1;
+  static const int kLatencyOffset =
+      kInputBytesOffset + MetricsHistogram::kNumBuckets;
+  static const int kResultsOffset =
+      kLatencyOffset + MetricsHistogram::kNumBuckets;
+
+  // Returns the counters of the shard of the calling thread.
+  std::atomic<int64>* ThreadShard() const;
+
+  const std::vector<std::string> collections_;
+  const int mode_size_;
+  const int shard_size_;
+  const int num_shards_;
+
+  // num_shards_ * shard_size_ counters, each shard starting on its own cache
+  // line, in a slightly larger allocation.
+  std::unique_ptr<std::atomic<int64>[]> allocated_counters_;
+  std::atomic<int64>* counters_;
+
+  TC_DISALLOW_COPY_AND_ASSIGN(ClassifierMetrics);
+};
+
+// Records a request in 'metrics', if it's not nullptr, with the time between
+// its construction and destruction. Only reads the clock with metrics.
+class ScopedRequestMetrics {
+ public:
+  ScopedRequestMetrics(const ClassifierMetrics* metrics, MetricsMode mode,
+                       int64 input_bytes)
+      : metrics_(metrics), mode_(mode), input_bytes_(input_bytes) {
+    if (metrics_ != nullptr) {
+      start_ = std::chrono::steady_clock::now();
+    }
+  }
+
+  ~ScopedRequestMetrics() {
+    if (metrics_ != nullptr) {
+      metrics_->RecordRequest(
+          mode_, input_bytes_,
+          std::chrono::duration_cast<std::chrono::microseconds>(
+              std::chrono::steady_clock::now() - start_)
+              .count());
+    }
+  }
+
+ private:
+  const ClassifierMetrics* const metrics_;
+  const MetricsMode mode_;
+  const int64 input_bytes_;
+  std::chrono::steady_clock::time_point start_;
+
+  TC_DISALLOW_COPY_AND_ASSIGN(ScopedRequestMetrics);
+};
+
+}  // namespace libtextclassifier2
+
+#endif  // LIBTEXTCLASSIFIER_CLASSIFIER_METRICS_H_
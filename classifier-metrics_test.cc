@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "classifier-metrics.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+TEST(ClassifierMetricsTest, HistogramBuckets) {
+  EXPECT_EQ(MetricsHistogram::Bucket(0), 0);
+  EXPECT_EQ(MetricsHistogram::Bucket(1), 1);
+  EXPECT_EQ(MetricsHistogram::Bucket(2), 2);
+  EXPECT_EQ(MetricsHistogram::Bucket(3), 2);
+  EXPECT_EQ(MetricsHistogram::Bucket(1024), 11);
+  EXPECT_EQ(MetricsHistogram::Bucket(int64{1} << 40),
+            MetricsHistogram::kNumBuckets - 1);
+}
+
+TEST(ClassifierMetricsTest, RecordsRequests) {
+  const ClassifierMetrics metrics({"address", "other", "phone"});
+  metrics.RecordRequest(MetricsMode::ANNOTATE, /*input_bytes=*/100,
+                        /*latency_micros=*/3);
+  metrics.RecordRequest(MetricsMode::ANNOTATE, /*input_bytes=*/120,
+                        /*latency_micros=*/900);
+  metrics.RecordRequest(MetricsMode::CLASSIFY_TEXT, /*input_bytes=*/10,
+                        /*latency_micros=*/0);
+  metrics.RecordResult(MetricsMode::ANNOTATE, 2);
+  metrics.RecordResult(MetricsMode::ANNOTATE, 2);
+  metrics.RecordResult(MetricsMode::CLASSIFY_TEXT, 0);
+  metrics.RecordResult(MetricsMode::CLASSIFY_TEXT, -1);
+  metrics.RecordConflictWin(AnnotatedSpan::Source::REGEX);
+  metrics.RecordRegexTimeout();
+
+  const MetricsSnapshot snapshot = metrics.Snapshot();
+  const MetricsSnapshot::ModeMetrics& annotate =
+      snapshot.modes[static_cast<int>(MetricsMode::ANNOTATE)];
+  EXPECT_EQ(annotate.requests, 2);
+  EXPECT_EQ(annotate.input_bytes.counts[7], 2);
+  EXPECT_EQ(annotate.latency_micros.counts[2], 1);
+  EXPECT_EQ(annotate.latency_micros.counts[10], 1);
+  EXPECT_EQ(annotate.results_by_collection,
+            std::vector<int64>({0, 0, 2}));
+  EXPECT_EQ(snapshot.modes[static_cast<int>(MetricsMode::CLASSIFY_TEXT)]
+                .results_by_collection,
+            std::vector<int64>({1, 0, 0}));
+  EXPECT_EQ(snapshot.modes[static_cast<int>(MetricsMode::SUGGEST_SELECTION)]
+                .requests,
+            0);
+  EXPECT_EQ(snapshot.conflict_wins[static_cast<int>(
+                AnnotatedSpan::Source::REGEX)],
+            1);
+  EXPECT_EQ(snapshot.regex_timeouts, 1);
+
+  const std::string text = snapshot.ToString();
+  EXPECT_NE(text.find("requests{mode=\"annotate\"} 2\n"), std::string::npos);
+  EXPECT_NE(text.find("input_bytes{mode=\"annotate\",lt=\"128\"} 2\n"),
+            std::string::npos);
+  EXPECT_NE(
+      text.find("results{mode=\"annotate\",collection=\"phone\"} 2\n"),
+      std::string::npos);
+  EXPECT_NE(text.find("conflict_wins{source=\"regex\"} 1\n"),
+            std::string::npos);
+  EXPECT_NE(text.find("regex_timeouts{} 1\n"), std::string::npos);
+  EXPECT_EQ(text.find("suggest_selection"), std::string::npos);
+}
+
+TEST(ClassifierMetricsTest, SumsThreads) {
+  const ClassifierMetrics metrics({"phone"}, /*num_shards=*/4);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 8; ++i) {
+    threads.emplace_back([&metrics]() {
+      for (int j = 0; j < 1000; ++j) {
+        metrics.RecordRequest(MetricsMode::SUGGEST_SELECTION, j, j);
+        metrics.RecordResult(MetricsMode::SUGGEST_SELECTION, 0);
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  const MetricsSnapshot snapshot = metrics.Snapshot();
+  const MetricsSnapshot::ModeMetrics& selection =
+      snapshot.modes[static_cast<int>(MetricsMode::SUGGEST_SELECTION)];
+  EXPECT_EQ(selection.requests, 8000);
+  EXPECT_EQ(selection.input_bytes.TotalCount(), 8000);
+  EXPECT_EQ(selection.latency_micros.TotalCount(), 8000);
+  EXPECT_EQ(selection.results_by_collection, std::vector<int64>({8000}));
+}
+
+}  // namespace
+}  // namespace libtextclassifier2
@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "datetime/extractor-vocabulary.h"
+
+#include <cctype>
+#include <cstring>
+
+#include "util/gtl/stl_util.h"
+#include "util/strings/utf8.h"
+
+namespace libtextclassifier2 {
+
+namespace {
+
+// Vocabularies with more words are not worth it compared to the regex.
+const int kMaxWords = 512;
+
+// Expands the literal alternation of a pattern into the words it matches.
+class WordExpander {
+ public:
+  explicit WordExpander(const std::string& pattern)
+      : pattern_(pattern), pos_(0) {}
+
+  // Expands the whole pattern (without flags and word boundaries). Returns
+  // false if it is not a literal alternation.
+  bool Expand(std::vector<std::string>* words) {
+    return ExpandAlternation(words) && pos_ == pattern_.size();
+  }
+
+ private:
+  // Alternation := Sequence ('|' Sequence)*
+  bool ExpandAlternation(std::vector<std::string>* words) {
+    words->clear();
+    while (true) {
+      std::vector<std::string> sequence_words;
+      if (!ExpandSequence(&sequence_words)) {
+        return false;
+      }
+      words->insert(words->end(), sequence_words.begin(),
+                    sequence_words.end());
+      if (words->size() > kMaxWords) {
+        return false;
+      }
+      if (pos_ == pattern_.size() || pattern_[pos_] != '|') {
+        return true;
+      }
+      ++pos_;
+    }
+  }
+
+  // Sequence := (Atom '?'? '?'?)*
+  bool ExpandSequence(std::vector<std::string>* words) {
+    words->assign(1, "");
+    while (pos_ < pattern_.size() && pattern_[pos_] != '|' &&
+           pattern_[pos_] != ')') {
+      std::vector<std::string> atom_words;
+      if (!ExpandAtom(&atom_words)) {
+        return false;
+      }
+      if (pos_ < pattern_.size() && pattern_[pos_] == '?') {
+        ++pos_;
+        // A lazy optional matches the same words.
+        if (pos_ < pattern_.size() && pattern_[pos_] == '?') {
+          ++pos_;
+        }
+        atom_words.push_back("");
+      }
+      std::vector<std::string> product;
+      for (const std::string& prefix : *words) {
+        for (const std::string& suffix : atom_words) {
+          product.push_back(prefix + suffix);
+        }
+      }
+      if (product.size() > kMaxWords) {
+        return false;
+      }
+      words->swap(product);
+    }
+    return true;
+  }
+
+  // Atom := literal | '\' punctuation | '(' ('?:')? Alternation ')'
+  bool ExpandAtom(std::vector<std::string>* words) {
+    const char c = pattern_[pos_];
+    if (c == '(') {
+      ++pos_;
+      if (pattern_.compare(pos_, 2, "?:") == 0) {
+        pos_ += 2;
+      } else if (pos_ < pattern_.size() && pattern_[pos_] == '?') {
+        // Lookaround, named groups, flags.
+        return false;
+      }
+      if (!ExpandAlternation(words) || pos_ == pattern_.size()) {
+        return false;
+      }
+      ++pos_;  // ')'
+      return true;
+    }
+    if (c == '\\') {
+      // Only escaped punctuation is literal, letters and digits start
+      // character classes, boundaries and other special escapes.
+      if (pos_ + 1 == pattern_.size() ||
+          !std::ispunct(static_cast<unsigned char>(pattern_[pos_ + 1]))) {
+        return false;
+      }
+      words->assign(1, std::string(1, pattern_[pos_ + 1]));
+      pos_ += 2;
+      return true;
+    }
+    if (std::strchr("^$.*+[]{}", c) != nullptr) {
+      return false;
+    }
+    const int num_bytes = GetNumBytesForNonZeroUTF8Char(&pattern_[pos_]);
+    if (pos_ + num_bytes > pattern_.size()) {
+      return false;
+    }
+    words->assign(1, pattern_.substr(pos_, num_bytes));
+    pos_ += num_bytes;
+    return true;
+  }
+
+  const std::string& pattern_;
+  int pos_;
+};
+
+}  // namespace
+
+ExtractorVocabulary::Input::Input(const UniLib& unilib, const UnicodeText& text)
+    : unilib_(unilib),
+      text_(text),
+      utf8_(text.ToUTF8String()),
+      folded_computed_(false) {}
+
+const std::string& ExtractorVocabulary::Input::Folded() const {
+  if (!folded_computed_) {
+    folded_ = unilib_.FoldCase(text_);
+    folded_computed_ = true;
+  }
+  return folded_;
+}
+
+std::unique_ptr<ExtractorVocabulary> ExtractorVocabulary::ForPattern(
+    const UniLib& unilib, const std::string& pattern) {
+  std::unique_ptr<ExtractorVocabulary> vocabulary(new ExtractorVocabulary());
+
+  int begin = 0;
+  int end = pattern.size();
+  while (true) {
+    if (pattern.compare(begin, 4, "(?i)") == 0) {
+      vocabulary->case_insensitive_ = true;
+      begin += 4;
+    } else if (pattern.compare(begin, 2, "\\b") == 0) {
+      vocabulary->word_bounded_ = true;
+      begin += 2;
+    } else {
+      break;
+    }
+  }
+  if (end - begin >= 2 && pattern.compare(end - 2, 2, "\\b") == 0) {
+    // Make sure the backslash is not itself escaped.
+    int num_backslashes = 0;
+    for (int i = end - 2; i >= begin && pattern[i] == '\\'; --i) {
+      ++num_backslashes;
+    }
+    if (num_backslashes % 2 == 1) {
+      vocabulary->word_bounded_ = true;
+      end -= 2;
+    }
+  }
+
+  std::vector<std::string> words;
+  if (!WordExpander(pattern.substr(begin, end - begin)).Expand(&words)) {
+    return nullptr;
+  }
+  for (const std::string& word : words) {
+    // An empty word matches anywhere.
+    if (word.empty()) {
+      return nullptr;
+    }
+    if (vocabulary->case_insensitive_) {
+      vocabulary->words_.insert(
+          unilib.FoldCase(UTF8ToUnicodeText(word, /*do_copy=*/false)));
+    } else {
+      vocabulary->words_.insert(word);
+    }
+  }
+  return vocabulary;
+}
+
+int64 ExtractorVocabulary::EstimateMemoryBytes() const {
+  int64 bytes =
+      sizeof(ExtractorVocabulary) + STLNodeContainerMemoryBytes(words_);
+  for (const std::string& word : words_) {
+    bytes += STLStringMemoryBytes(word);
+  }
+  return bytes;
+}
+
+ExtractorVocabulary::Result ExtractorVocabulary::Lookup(
+    const Input& input) const {
+  const std::string& text = case_insensitive_ ? input.Folded() : input.utf8_;
+
+  if (words_.find(text) != words_.end()) {
+    if (!word_bounded_) {
+      return MATCH;
+    }
+    // A word spanning the whole text is enclosed in word boundaries if it
+    // starts and ends with word characters.
+    const char32 first = *input.text_.begin();
+    const char32 last = *--input.text_.end();
+    if (input.unilib_.IsLetterOrDigit(first) &&
+        input.unilib_.IsLetterOrDigit(last)) {
+      return MATCH;
+    }
+    return UNKNOWN;
+  }
+
+  for (const std::string& word : words_) {
+    if (text.find(word) != std::string::npos) {
+      // The occurrence might not be on word boundaries, and in the folded
+      // text it might not be on character boundaries.
+      if (!word_bounded_ && !case_insensitive_) {
+        return MATCH;
+      }
+      return UNKNOWN;
+    }
+  }
+  return NO_MATCH;
+}
+
+}  // namespace libtextclassifier2
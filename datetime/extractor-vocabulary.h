@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBTEXTCLASSIFIER_DATETIME_EXTRACTOR_VOCABULARY_H_
+#define LIBTEXTCLASSIFIER_DATETIME_EXTRACTOR_VOCABULARY_H_
+
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "util/base/macros.h"
+#include "util/utf8/unicodetext.h"
+#include "util/utf8/unilib.h"
+
+namespace libtextclassifier2 {
+
+// The finite set of words that an extractor pattern like
+// "(?i)\b(?:jan(?:uary)?|jän\.?)\b" matches, for deciding whether the pattern
+// matches a group text without running the regex.
+class ExtractorVocabulary {
+ public:
+  // A group text prepared once for the lookups in all vocabularies.
+  class Input {
+   public:
+    Input(const UniLib& unilib, const UnicodeText& text);
+
+   private:
+    friend class ExtractorVocabulary;
+
+    const UniLib& unilib_;
+    const UnicodeText& text_;
+    std::string utf8_;
+
+    // Computed on the first case-insensitive lookup.
+    mutable bool folded_computed_;
+    mutable std::string folded_;
+
+    const std::string& Folded() const;
+  };
+
+  enum Result {
+    // The pattern doesn't match anywhere in the text.
+    NO_MATCH,
+    // The pattern matches the text.
+    MATCH,
+    // The vocabulary can't tell, the regex needs to be run.
+    UNKNOWN,
+  };
+
+  // Returns the vocabulary of the given pattern in UniLib::RegexPattern
+  // syntax, or nullptr if the pattern is not an alternation of literal words,
+  // optionally case-insensitive and enclosed in word boundaries.
+  static std::unique_ptr<ExtractorVocabulary> ForPattern(
+      const UniLib& unilib, const std::string& pattern);
+
+  // Decides whether the pattern finds a match in the text.
+  Result Lookup(const Input& input) const;
+
+  int NumWords() const { return words_.size(); }
+
+  // Returns an estimate of the memory held by the vocabulary.
+  int64 EstimateMemoryBytes() const;
+
+ private:
+  ExtractorVocabulary() {}
+
+  bool case_insensitive_ = false;
+  bool word_bounded_ = false;
+
+  // The words, case folded if case-insensitive, UTF8 encoded.
+  std::unordered_set<std::string> words_;
+
+  TC_DISALLOW_COPY_AND_ASSIGN(ExtractorVocabulary);
+};
+
+}  // namespace libtextclassifier2
+
+#endif  // LIBTEXTCLASSIFIER_DATETIME_EXTRACTOR_VOCABULARY_H_
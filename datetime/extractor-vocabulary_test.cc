@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "datetime/extractor-vocabulary.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "util/utf8/unicodetext.h"
+#include "util/utf8/unilib.h"
+
+#include "gtest/gtest.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+class ExtractorVocabularyTest : public testing::Test {
+ protected:
+  ExtractorVocabulary::Result Lookup(const ExtractorVocabulary& vocabulary,
+                                     const std::string& text) {
+    const UnicodeText unicode_text = UTF8ToUnicodeText(text, /*do_copy=*/false);
+    return vocabulary.Lookup(ExtractorVocabulary::Input(unilib_, unicode_text));
+  }
+
+  UniLib unilib_;
+};
+
+TEST_F(ExtractorVocabularyTest, ExpandsLiteralAlternations) {
+  std::unique_ptr<ExtractorVocabulary> vocabulary =
+      ExtractorVocabulary::ForPattern(
+          unilib_, "(?i)\\b(?:jan(?:uary)?|j\xC3\xA4n\\.?)\\b");
+  ASSERT_TRUE(vocabulary);
+  EXPECT_EQ(vocabulary->NumWords(), 4);
+  EXPECT_EQ(Lookup(*vocabulary, "January"), ExtractorVocabulary::MATCH);
+  EXPECT_EQ(Lookup(*vocabulary, "J\xC3\x84N"), ExtractorVocabulary::MATCH);
+  EXPECT_EQ(Lookup(*vocabulary, "February"), ExtractorVocabulary::NO_MATCH);
+  // Might or might not be on word boundaries.
+  EXPECT_EQ(Lookup(*vocabulary, "j\xC3\xA4n."), ExtractorVocabulary::UNKNOWN);
+  EXPECT_EQ(Lookup(*vocabulary, "janvier"), ExtractorVocabulary::UNKNOWN);
+
+  vocabulary = ExtractorVocabulary::ForPattern(unilib_, "am|a\\.m\\.");
+  ASSERT_TRUE(vocabulary);
+  EXPECT_EQ(Lookup(*vocabulary, "a.m."), ExtractorVocabulary::MATCH);
+  EXPECT_EQ(Lookup(*vocabulary, "9 am"), ExtractorVocabulary::MATCH);
+  EXPECT_EQ(Lookup(*vocabulary, "AM"), ExtractorVocabulary::NO_MATCH);
+}
+
+TEST_F(ExtractorVocabularyTest, RejectsOtherPatterns) {
+  for (const std::string& pattern : std::vector<std::string>{
+           "\\d+", "(?i)mon(day)*", "[0-9]", "(?<week>week)", "a|", "(a|b",
+           "a.m", "(?=a)a", "\\bmon\\bday"}) {
+    EXPECT_FALSE(ExtractorVocabulary::ForPattern(unilib_, pattern))
+        << pattern;
+  }
+}
+
+#ifdef LIBTEXTCLASSIFIER_UNILIB_ICU
+TEST_F(ExtractorVocabularyTest, AgreesWithRegex) {
+  const std::vector<std::string> patterns = {
+      "(?i)\\b(?:jan(?:uary)?|j\xC3\xA4n\\.?)\\b",
+      "(?i)stra\xC3\x9F" "e|\xCE\xA3\xCE\xB5\xCF\x80",
+      "\\b(?:Mo|Di)\\.?\\b",
+      "(?i)n\xC3\xA4" "chste[nrs]?|n\xC3\xA4" "chste",
+      "(?:next|following)(?: week)?",
+  };
+  const std::vector<std::string> texts = {
+      "jan",      "JANUARY", "j\xC3\xA4n.", "j\xC3\xA4n",  "janx",
+      "xjan",     "januar",  "STRASSE",     "\xCF\x83\xCE\xB5\xCF\x80",
+      "Mo.",      "Mo",      "Di.",         "mo",          "Monday",
+      "N\xC3\x84" "CHSTE",   "next week",   "following",   "",
+      "the next", "nex",
+  };
+  for (const std::string& pattern : patterns) {
+    std::unique_ptr<ExtractorVocabulary> vocabulary =
+        ExtractorVocabulary::ForPattern(unilib_, pattern);
+    std::unique_ptr<UniLib::RegexPattern> regex = unilib_.CreateRegexPattern(
+        UTF8ToUnicodeText(pattern, /*do_copy=*/false));
+    if (pattern.find("[nrs]") != std::string::npos) {
+      EXPECT_FALSE(vocabulary);
+      continue;
+    }
+    ASSERT_TRUE(vocabulary) << pattern;
+    ASSERT_TRUE(regex) << pattern;
+    for (const std::string& text : texts) {
+      const UnicodeText unicode_text =
+          UTF8ToUnicodeText(text, /*do_copy=*/false);
+      int status;
+      const bool regex_found = regex->Matcher(unicode_text)->Find(&status);
+      switch (Lookup(*vocabulary, text)) {
+        case ExtractorVocabulary::MATCH:
+          EXPECT_TRUE(regex_found) << pattern << " " << text;
+          break;
+        case ExtractorVocabulary::NO_MATCH:
+          EXPECT_FALSE(regex_found) << pattern << " " << text;
+          break;
+        case ExtractorVocabulary::UNKNOWN:
+          break;
+      }
+    }
+  }
+}
+#endif  // LIBTEXTCLASSIFIER_UNILIB_ICU
+
+}  // namespace
+}  // namespace libtextclassifier2
@@ -20,6 +20,18 @@
 
 namespace libtextclassifier2 {
 
+void ExtractorRuleTable::Set(DatetimeExtractorType type, int locale_id,
+                             int rule_id) {
+  if (locale_id < 0 || type < 0 || type >= kNumTypes) {
+    return;
+  }
+  const int index = locale_id * kNumTypes + type;
+  if (index >= rule_ids_.size()) {
+    rule_ids_.resize((locale_id + 1) * kNumTypes, -1);
+  }
+  rule_ids_[index] = rule_id;
+}
+
 bool DatetimeExtractor::Extract(DateParseData* result,
                                 CodepointSpan* result_span) const {
   result->field_set_mask = 0;
@@ -148,17 +160,8 @@ bool DatetimeExtractor::Extract(DateParseData* result,
 
 bool DatetimeExtractor::RuleIdForType(DatetimeExtractorType type,
                                       int* rule_id) const {
-  auto type_it = type_and_locale_to_rule_.find(type);
-  if (type_it == type_and_locale_to_rule_.end()) {
-    return false;
-  }
-
-  auto locale_it = type_it->second.find(locale_id_);
-  if (locale_it == type_it->second.end()) {
-    return false;
-  }
-  *rule_id = locale_it->second;
-  return true;
+  *rule_id = rule_table_.Get(type, locale_id_);
+  return *rule_id != -1;
 }
 
 bool DatetimeExtractor::ExtractType(const UnicodeText& input,
@@ -189,6 +192,26 @@ bool DatetimeExtractor::ExtractType(const UnicodeText& input,
   return true;
 }
 
+bool DatetimeExtractor::ExtractTypeWithVocabulary(
+    const UnicodeText& input, const ExtractorVocabulary::Input& words,
+    DatetimeExtractorType extractor_type) const {
+  int rule_id;
+  if (!RuleIdForType(extractor_type, &rule_id)) {
+    return false;
+  }
+  if (vocabularies_[rule_id] != nullptr) {
+    switch (vocabularies_[rule_id]->Lookup(words)) {
+      case ExtractorVocabulary::MATCH:
+        return true;
+      case ExtractorVocabulary::NO_MATCH:
+        return false;
+      case ExtractorVocabulary::UNKNOWN:
+        break;
+    }
+  }
+  return ExtractType(input, extractor_type);
+}
+
 bool DatetimeExtractor::GroupTextFromMatch(int group_id,
                                            UnicodeText* result) const {
   int status;
@@ -225,8 +248,9 @@ bool DatetimeExtractor::MapInput(
     const UnicodeText& input,
     const std::vector<std::pair<DatetimeExtractorType, T>>& mapping,
     T* result) const {
+  const ExtractorVocabulary::Input words(unilib_, input);
   for (const auto& type_value_pair : mapping) {
-    if (ExtractType(input, type_value_pair.first)) {
+    if (ExtractTypeWithVocabulary(input, words, type_value_pair.first)) {
       *result = type_value_pair.second;
       return true;
     }
@@ -236,6 +260,7 @@ bool DatetimeExtractor::MapInput(
 
 bool DatetimeExtractor::ParseWrittenNumber(const UnicodeText& input,
                                            int* parsed_number) const {
+  const ExtractorVocabulary::Input words(unilib_, input);
   std::vector<std::pair<int, int>> found_numbers;
   for (const auto& type_value_pair :
        std::vector<std::pair<DatetimeExtractorType, int>>{
@@ -274,6 +299,11 @@ bool DatetimeExtractor::ParseWrittenNumber(const UnicodeText& input,
     if (!RuleIdForType(type_value_pair.first, &rule_id)) {
       return false;
     }
+    if (vocabularies_[rule_id] != nullptr &&
+        vocabularies_[rule_id]->Lookup(words) ==
+            ExtractorVocabulary::NO_MATCH) {
+      continue;
+    }
 
     std::unique_ptr<UniLib::RegexMatcher> matcher =
         rules_[rule_id]->Matcher(input);
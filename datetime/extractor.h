@@ -18,9 +18,9 @@
 #define LIBTEXTCLASSIFIER_DATETIME_EXTRACTOR_H_
 
 #include <string>
-#include <unordered_map>
 #include <vector>
 
+#include "datetime/extractor-vocabulary.h"
 #include "model_generated.h"
 #include "types.h"
 #include "util/strings/stringpiece.h"
@@ -31,7 +31,7 @@ namespace libtextclassifier2 {
 
 struct CompiledRule {
   // The compiled regular expression.
-  std::unique_ptr<const UniLib::RegexPattern> compiled_regex;
+  std::shared_ptr<const UniLib::RegexPattern> compiled_regex;
 
   // The uncompiled pattern and information about the pattern groups.
   const DatetimeModelPattern_::Regex* regex;
@@ -40,6 +40,32 @@ struct CompiledRule {
   const DatetimeModelPattern* pattern;
 };
 
+// The extractor rule of each type and locale id, in one dense table.
+class ExtractorRuleTable {
+ public:
+  ExtractorRuleTable() {}
+
+  void Set(DatetimeExtractorType type, int locale_id, int rule_id);
+
+  // Returns the rule id, or -1 if there is none for the type and locale.
+  int Get(DatetimeExtractorType type, int locale_id) const {
+    const int index = locale_id * kNumTypes + type;
+    return (locale_id >= 0 && type < kNumTypes && index < rule_ids_.size())
+               ? rule_ids_[index]
+               : -1;
+  }
+
+  int64 EstimateMemoryBytes() const {
+    return rule_ids_.capacity() * sizeof(int);
+  }
+
+ private:
+  static const int kNumTypes = DatetimeExtractorType_MAX + 1;
+
+  // Row 'locale_id' holds the rule ids of the types.
+  std::vector<int> rule_ids_;
+};
+
 // A helper class for DatetimeParser that extracts structured data
 // (DateParseDate) from the current match of the passed RegexMatcher.
 class DatetimeExtractor {
@@ -47,17 +73,18 @@ class DatetimeExtractor {
   DatetimeExtractor(
       const CompiledRule& rule, const UniLib::RegexMatcher& matcher,
       int locale_id, const UniLib& unilib,
-      const std::vector<std::unique_ptr<const UniLib::RegexPattern>>&
+      const std::vector<std::shared_ptr<const UniLib::RegexPattern>>&
           extractor_rules,
-      const std::unordered_map<DatetimeExtractorType,
-                               std::unordered_map<int, int>>&
-          type_and_locale_to_extractor_rule)
+      const std::vector<std::unique_ptr<const ExtractorVocabulary>>&
+          extractor_vocabularies,
+      const ExtractorRuleTable& extractor_rule_table)
       : rule_(rule),
         matcher_(matcher),
         locale_id_(locale_id),
         unilib_(unilib),
         rules_(extractor_rules),
-        type_and_locale_to_rule_(type_and_locale_to_extractor_rule) {}
+        vocabularies_(extractor_vocabularies),
+        rule_table_(extractor_rule_table) {}
   bool Extract(DateParseData* result, CodepointSpan* result_span) const;
 
  private:
@@ -75,6 +102,12 @@ class DatetimeExtractor {
   // Updates the span to include the current match for the given group.
   bool UpdateMatchSpan(int group_id, CodepointSpan* span) const;
 
+  // Like ExtractType without 'match_result', but decides from the vocabulary
+  // of the rule when it can.
+  bool ExtractTypeWithVocabulary(const UnicodeText& input,
+                                 const ExtractorVocabulary::Input& words,
+                                 DatetimeExtractorType extractor_type) const;
+
   // Returns true if any of the extractors from 'mapping' matched. If it did,
   // will fill 'result' with the associated value from 'mapping'.
   template <typename T>
@@ -101,9 +134,9 @@ class DatetimeExtractor {
   const UniLib::RegexMatcher& matcher_;
   int locale_id_;
   const UniLib& unilib_;
-  const std::vector<std::unique_ptr<const UniLib::RegexPattern>>& rules_;
-  const std::unordered_map<DatetimeExtractorType, std::unordered_map<int, int>>&
-      type_and_locale_to_rule_;
+  const std::vector<std::shared_ptr<const UniLib::RegexPattern>>& rules_;
+  const std::vector<std::unique_ptr<const ExtractorVocabulary>>& vocabularies_;
+  const ExtractorRuleTable& rule_table_;
 };
 
 }  // namespace libtextclassifier2
@@ -16,20 +16,22 @@
 
 #include "datetime/parser.h"
 
-#include <set>
-#include <unordered_set>
+#include <algorithm>
+#include <utility>
 
 #include "datetime/extractor.h"
+#include "non-overlapping-spans.h"
 #include "util/calendar/calendar.h"
-#include "util/i18n/locale.h"
-#include "util/strings/split.h"
+#include "util/gtl/stl_util.h"
 
 namespace libtextclassifier2 {
 std::unique_ptr<DatetimeParser> DatetimeParser::Instance(
     const DatetimeModel* model, const UniLib& unilib,
-    ZlibDecompressor* decompressor) {
+    ZlibDecompressor* decompressor, bool lazy_regex_compilation,
+    TaskRunner* task_runner, SharedRegexPatterns* shared_patterns) {
   std::unique_ptr<DatetimeParser> result(
-      new DatetimeParser(model, unilib, decompressor));
+      new DatetimeParser(model, unilib, decompressor, lazy_regex_compilation,
+                         task_runner, shared_patterns));
   if (!result->initialized_) {
     result.reset();
   }
@@ -37,7 +39,10 @@ std::unique_ptr<DatetimeParser> DatetimeParser::Instance(
 }
 
 DatetimeParser::DatetimeParser(const DatetimeModel* model, const UniLib& unilib,
-                               ZlibDecompressor* decompressor)
+                               ZlibDecompressor* decompressor,
+                               bool lazy_regex_compilation,
+                               TaskRunner* task_runner,
+                               SharedRegexPatterns* shared_patterns)
     : unilib_(unilib) {
   initialized_ = false;
 
@@ -45,22 +50,61 @@ DatetimeParser::DatetimeParser(const DatetimeModel* model, const UniLib& unilib,
     return;
   }
 
+  // Decompress the rule and extractor patterns in order, as they share one
+  // decompression stream, then compile them all at once.
+  std::vector<std::string> pattern_texts;
   if (model->patterns() != nullptr) {
     for (const DatetimeModelPattern* pattern : *model->patterns()) {
       if (pattern->regexes()) {
         for (const DatetimeModelPattern_::Regex* regex : *pattern->regexes()) {
-          std::unique_ptr<UniLib::RegexPattern> regex_pattern =
-              UncompressMakeRegexPattern(unilib, regex->pattern(),
-                                         regex->compressed_pattern(),
-                                         decompressor);
-          if (!regex_pattern) {
+          pattern_texts.emplace_back();
+          if (!UncompressRegexPatternText(regex->pattern(),
+                                          regex->compressed_pattern(),
+                                          decompressor,
+                                          &pattern_texts.back())) {
             TC_LOG(ERROR) << "Couldn't create rule pattern.";
             return;
           }
-          rules_.push_back({std::move(regex_pattern), regex, pattern});
+        }
+      }
+    }
+  }
+  const int num_rule_patterns = pattern_texts.size();
+  if (model->extractors() != nullptr) {
+    for (const DatetimeModelExtractor* extractor : *model->extractors()) {
+      pattern_texts.emplace_back();
+      if (!UncompressRegexPatternText(extractor->pattern(),
+                                      extractor->compressed_pattern(),
+                                      decompressor, &pattern_texts.back())) {
+        TC_LOG(ERROR) << "Couldn't create extractor pattern";
+        return;
+      }
+    }
+  }
+
+  std::vector<std::shared_ptr<const UniLib::RegexPattern>> regex_patterns;
+  if (!MakeRegexPatterns(unilib, pattern_texts, lazy_regex_compilation,
+                         task_runner, shared_patterns, &regex_patterns)) {
+    TC_LOG(ERROR) << "Couldn't create datetime patterns.";
+    return;
+  }
+
+  if (model->patterns() != nullptr) {
+    int pattern_index = 0;
+    for (const DatetimeModelPattern* pattern : *model->patterns()) {
+      if (pattern->regexes()) {
+        for (const DatetimeModelPattern_::Regex* regex : *pattern->regexes()) {
+          rules_.push_back(
+              {std::move(regex_patterns[pattern_index++]), regex, pattern});
           if (pattern->locales()) {
             for (int locale : *pattern->locales()) {
-              locale_to_rules_[locale].push_back(rules_.size() - 1);
+              if (locale < 0) {
+                continue;
+              }
+              if (locale >= locale_rules_.size()) {
+                locale_rules_.resize(locale + 1);
+              }
+              locale_rules_[locale].push_back(rules_.size() - 1);
             }
           }
         }
@@ -69,30 +113,27 @@ DatetimeParser::DatetimeParser(const DatetimeModel* model, const UniLib& unilib,
   }
 
   if (model->extractors() != nullptr) {
+    int pattern_index = num_rule_patterns;
     for (const DatetimeModelExtractor* extractor : *model->extractors()) {
-      std::unique_ptr<UniLib::RegexPattern> regex_pattern =
-          UncompressMakeRegexPattern(unilib, extractor->pattern(),
-                                     extractor->compressed_pattern(),
-                                     decompressor);
-      if (!regex_pattern) {
-        TC_LOG(ERROR) << "Couldn't create extractor pattern";
-        return;
-      }
-      extractor_rules_.push_back(std::move(regex_pattern));
+      extractor_vocabularies_.push_back(ExtractorVocabulary::ForPattern(
+          unilib, pattern_texts[pattern_index]));
+      extractor_rules_.push_back(std::move(regex_patterns[pattern_index++]));
 
       if (extractor->locales()) {
         for (int locale : *extractor->locales()) {
-          type_and_locale_to_extractor_rule_[extractor->extractor()][locale] =
-              extractor_rules_.size() - 1;
+          extractor_rule_table_.Set(extractor->extractor(), locale,
+                                    extractor_rules_.size() - 1);
         }
       }
     }
   }
 
   if (model->locales() != nullptr) {
+    std::vector<std::string> locale_tags;
     for (int i = 0; i < model->locales()->Length(); ++i) {
-      locale_string_to_id_[model->locales()->Get(i)->str()] = i;
+      locale_tags.push_back(model->locales()->Get(i)->str());
     }
+    locale_index_ = LocaleIndex(locale_tags);
   }
 
   if (model->default_locales() != nullptr) {
@@ -106,6 +147,69 @@ DatetimeParser::DatetimeParser(const DatetimeModel* model, const UniLib& unilib,
   initialized_ = true;
 }
 
+bool DatetimeParser::Warmup() const {
+  bool success = true;
+  for (const CompiledRule& rule : rules_) {
+    success &= rule.compiled_regex->Compile();
+  }
+  for (const auto& extractor_rule : extractor_rules_) {
+    success &= extractor_rule->Compile();
+  }
+  return success;
+}
+
+void DatetimeParser::ReleaseCompiledPatterns() const {
+  for (const CompiledRule& rule : rules_) {
+    rule.compiled_regex->ReleaseCompiled();
+  }
+  for (const auto& extractor_rule : extractor_rules_) {
+    extractor_rule->ReleaseCompiled();
+  }
+}
+
+void DatetimeParser::SetRegexTimeLimit(int time_limit_millis,
+                                       std::function<void()> on_timeout) {
+  regex_time_limit_millis_ = time_limit_millis;
+  on_regex_timeout_ = std::move(on_timeout);
+}
+
+int64 DatetimeParser::EstimateMemoryBytes() const {
+  int64 bytes =
+      STLVectorMemoryBytes(rules_) + STLVectorMemoryBytes(locale_rules_) +
+      STLVectorMemoryBytes(extractor_rules_) +
+      STLVectorMemoryBytes(extractor_vocabularies_) +
+      extractor_rule_table_.EstimateMemoryBytes() +
+      locale_index_.EstimateMemoryBytes() +
+      STLVectorMemoryBytes(default_locale_ids_) +
+      calendar_lib_.EstimateMemoryBytes();
+  for (const CompiledRule& rule : rules_) {
+    bytes += rule.compiled_regex->EstimateMemoryBytes();
+  }
+  for (const std::vector<int>& locale_rules : locale_rules_) {
+    bytes += STLVectorMemoryBytes(locale_rules);
+  }
+  for (const auto& extractor_rule : extractor_rules_) {
+    bytes += extractor_rule->EstimateMemoryBytes();
+  }
+  for (const auto& vocabulary : extractor_vocabularies_) {
+    if (vocabulary != nullptr) {
+      bytes += vocabulary->EstimateMemoryBytes();
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(rule_selections_mutex_);
+  for (const auto& mode_selections : rule_selections_) {
+    bytes += STLNodeContainerMemoryBytes(mode_selections);
+    for (const auto& key_selection : mode_selections) {
+      bytes += STLStringMemoryBytes(key_selection.first) +
+               sizeof(RuleSelection) +
+               STLStringMemoryBytes(key_selection.second->reference_locale) +
+               STLVectorMemoryBytes(key_selection.second->rules);
+    }
+  }
+  return bytes;
+}
+
 bool DatetimeParser::Parse(
     const std::string& input, const int64 reference_time_ms_utc,
     const std::string& reference_timezone, const std::string& locales,
@@ -116,21 +220,20 @@ bool DatetimeParser::Parse(
                anchor_start_end, results);
 }
 
-bool DatetimeParser::FindSpansUsingLocales(
-    const std::vector<int>& locale_ids, const UnicodeText& input,
-    const int64 reference_time_ms_utc, const std::string& reference_timezone,
-    ModeFlag mode, bool anchor_start_end, const std::string& reference_locale,
-    std::unordered_set<int>* executed_rules,
-    std::vector<DatetimeParseResultSpan>* found_spans) const {
+void DatetimeParser::SelectRules(const std::string& locales, ModeFlag mode,
+                                 RuleSelection* selection) const {
+  selection->rules.clear();
+  const std::vector<int> locale_ids =
+      ParseAndExpandLocales(locales, &selection->reference_locale);
+  std::vector<bool> selected_rules(rules_.size(), false);
   for (const int locale_id : locale_ids) {
-    auto rules_it = locale_to_rules_.find(locale_id);
-    if (rules_it == locale_to_rules_.end()) {
+    if (locale_id < 0 || locale_id >= locale_rules_.size()) {
       continue;
     }
 
-    for (const int rule_id : rules_it->second) {
-      // Skip rules that were already executed in previous locales.
-      if (executed_rules->find(rule_id) != executed_rules->end()) {
+    for (const int rule_id : locale_rules_[locale_id]) {
+      // Skip rules that were already selected in previous locales.
+      if (selected_rules[rule_id]) {
         continue;
       }
 
@@ -138,13 +241,52 @@ bool DatetimeParser::FindSpansUsingLocales(
         continue;
       }
 
-      executed_rules->insert(rule_id);
+      selected_rules[rule_id] = true;
+      selection->rules.push_back({rule_id, locale_id});
+    }
+  }
+}
 
-      if (!ParseWithRule(rules_[rule_id], input, reference_time_ms_utc,
-                         reference_timezone, reference_locale, locale_id,
-                         anchor_start_end, found_spans)) {
-        return false;
-      }
+const DatetimeParser::RuleSelection& DatetimeParser::GetRuleSelection(
+    const std::string& locales, ModeFlag mode, RuleSelection* scratch) const {
+  // Bounds the memory used for callers that pass many different locale specs.
+  const int kMaxCachedRuleSelections = 64;
+
+  std::unordered_map<std::string, std::unique_ptr<const RuleSelection>>*
+      mode_selections = &rule_selections_[mode & ModeFlag_ALL];
+  {
+    std::lock_guard<std::mutex> lock(rule_selections_mutex_);
+    auto it = mode_selections->find(locales);
+    if (it != mode_selections->end()) {
+      return *it->second;
+    }
+  }
+
+  std::unique_ptr<RuleSelection> selection(new RuleSelection);
+  SelectRules(locales, mode, selection.get());
+
+  std::lock_guard<std::mutex> lock(rule_selections_mutex_);
+  if (mode_selections->size() >= kMaxCachedRuleSelections) {
+    *scratch = std::move(*selection);
+    return *scratch;
+  }
+  // Another thread may have inserted the same key meanwhile; the entries are
+  // never replaced, so references to them stay valid.
+  auto inserted = mode_selections->emplace(locales, std::move(selection));
+  return *inserted.first->second;
+}
+
+bool DatetimeParser::FindSpansUsingRules(
+    const RuleSelection& selection, const UniLib::RegexInput& input,
+    const int64 reference_time_ms_utc, const std::string& reference_timezone,
+    bool anchor_start_end,
+    std::vector<DatetimeParseResultSpan>* found_spans) const {
+  for (const SelectedRule& selected_rule : selection.rules) {
+    if (!ParseWithRule(rules_[selected_rule.rule_id], input,
+                       reference_time_ms_utc, reference_timezone,
+                       selection.reference_locale, selected_rule.locale_id,
+                       anchor_start_end, found_spans)) {
+      return false;
     }
   }
   return true;
@@ -155,14 +297,22 @@ bool DatetimeParser::Parse(
     const std::string& reference_timezone, const std::string& locales,
     ModeFlag mode, bool anchor_start_end,
     std::vector<DatetimeParseResultSpan>* results) const {
+  return Parse(*unilib_.CreateRegexInput(input), reference_time_ms_utc,
+               reference_timezone, locales, mode, anchor_start_end, results);
+}
+
+bool DatetimeParser::Parse(
+    const UniLib::RegexInput& input, const int64 reference_time_ms_utc,
+    const std::string& reference_timezone, const std::string& locales,
+    ModeFlag mode, bool anchor_start_end,
+    std::vector<DatetimeParseResultSpan>* results) const {
   std::vector<DatetimeParseResultSpan> found_spans;
-  std::unordered_set<int> executed_rules;
-  std::string reference_locale;
-  const std::vector<int> requested_locales =
-      ParseAndExpandLocales(locales, &reference_locale);
-  if (!FindSpansUsingLocales(requested_locales, input, reference_time_ms_utc,
-                             reference_timezone, mode, anchor_start_end,
-                             reference_locale, &executed_rules, &found_spans)) {
+  RuleSelection scratch_selection;
+  const RuleSelection& selection =
+      GetRuleSelection(locales, mode, &scratch_selection);
+  if (!FindSpansUsingRules(selection, input, reference_time_ms_utc,
+                           reference_timezone, anchor_start_end,
+                           &found_spans)) {
     return false;
   }
 
@@ -192,13 +342,11 @@ bool DatetimeParser::Parse(
     found_spans.push_back(span_index_pair.first);
   }
 
-  std::set<int, std::function<bool(int, int)>> chosen_indices_set(
-      [&found_spans](int a, int b) {
-        return found_spans[a].span.first < found_spans[b].span.first;
-      });
+  NonOverlappingSpans<> chosen_spans;
+  chosen_spans.Reset(found_spans.begin(), found_spans.end());
   for (int i = 0; i < found_spans.size(); ++i) {
-    if (!DoesCandidateConflict(i, found_spans, chosen_indices_set)) {
-      chosen_indices_set.insert(i);
+    if (!chosen_spans.Overlaps(found_spans[i].span)) {
+      chosen_spans.Add(found_spans[i].span);
       results->push_back(found_spans[i]);
     }
   }
@@ -242,12 +390,23 @@ bool DatetimeParser::HandleParseMatch(
 }
 
 bool DatetimeParser::ParseWithRule(
-    const CompiledRule& rule, const UnicodeText& input,
+    const CompiledRule& rule, const UniLib::RegexInput& input,
     const int64 reference_time_ms_utc, const std::string& reference_timezone,
     const std::string& reference_locale, const int locale_id,
     bool anchor_start_end, std::vector<DatetimeParseResultSpan>* result) const {
+  if (anchor_start_end ? !rule.compiled_regex->MayMatchWhole(input)
+                       : !rule.compiled_regex->MayMatch(input)) {
+    return true;
+  }
   std::unique_ptr<UniLib::RegexMatcher> matcher =
       rule.compiled_regex->Matcher(input);
+  if (!matcher) {
+    TC_LOG(ERROR) << "Couldn't create matcher for rule.";
+    return false;
+  }
+  if (regex_time_limit_millis_ > 0) {
+    matcher->SetTimeLimit(regex_time_limit_millis_);
+  }
   int status = UniLib::RegexMatcher::kNoError;
   if (anchor_start_end) {
     if (matcher->Matches(&status) && status == UniLib::RegexMatcher::kNoError) {
@@ -266,62 +425,24 @@ bool DatetimeParser::ParseWithRule(
       }
     }
   }
+  // The rule is skipped from the match that timed out on.
+  if (status == UniLib::RegexMatcher::kTimeout && on_regex_timeout_) {
+    on_regex_timeout_();
+  }
   return true;
 }
 
 std::vector<int> DatetimeParser::ParseAndExpandLocales(
     const std::string& locales, std::string* reference_locale) const {
-  std::vector<StringPiece> split_locales = strings::Split(locales, ',');
-  if (!split_locales.empty()) {
-    *reference_locale = split_locales[0].ToString();
-  } else {
-    *reference_locale = "";
-  }
-
   std::vector<int> result;
-  for (const StringPiece& locale_str : split_locales) {
-    auto locale_it = locale_string_to_id_.find(locale_str.ToString());
-    if (locale_it != locale_string_to_id_.end()) {
-      result.push_back(locale_it->second);
-    }
-
-    const Locale locale = Locale::FromBCP47(locale_str.ToString());
-    if (!locale.IsValid()) {
-      continue;
-    }
-
-    const std::string language = locale.Language();
-    const std::string script = locale.Script();
-    const std::string region = locale.Region();
-
-    // First, try adding *-region locale.
-    if (!region.empty()) {
-      locale_it = locale_string_to_id_.find("*-" + region);
-      if (locale_it != locale_string_to_id_.end()) {
-        result.push_back(locale_it->second);
-      }
-    }
-    // Second, try adding language-script-* locale.
-    if (!script.empty()) {
-      locale_it = locale_string_to_id_.find(language + "-" + script + "-*");
-      if (locale_it != locale_string_to_id_.end()) {
-        result.push_back(locale_it->second);
-      }
-    }
-    // Third, try adding language-* locale.
-    if (!language.empty()) {
-      locale_it = locale_string_to_id_.find(language + "-*");
-      if (locale_it != locale_string_to_id_.end()) {
-        result.push_back(locale_it->second);
-      }
-    }
-  }
+  LocaleSet result_set;
+  locale_index_.ExpandLocales(locales, &result, &result_set, reference_locale);
 
   // Add the default locales if they haven't been added already.
-  const std::unordered_set<int> result_set(result.begin(), result.end());
   for (const int default_locale_id : default_locale_ids_) {
-    if (result_set.find(default_locale_id) == result_set.end()) {
+    if (!result_set.Contains(default_locale_id)) {
       result.push_back(default_locale_id);
+      result_set.Add(default_locale_id);
     }
   }
 
@@ -385,8 +506,8 @@ bool DatetimeParser::ExtractDatetime(const CompiledRule& rule,
                                      CodepointSpan* result_span) const {
   DateParseData parse;
   DatetimeExtractor extractor(rule, matcher, locale_id, unilib_,
-                              extractor_rules_,
-                              type_and_locale_to_extractor_rule_);
+                              extractor_rules_, extractor_vocabularies_,
+                              extractor_rule_table_);
   if (!extractor.Extract(&parse, result_span)) {
     return false;
   }
@@ -17,7 +17,9 @@
 #ifndef LIBTEXTCLASSIFIER_DATETIME_PARSER_H_
 #define LIBTEXTCLASSIFIER_DATETIME_PARSER_H_
 
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
@@ -27,7 +29,9 @@
 #include "model_generated.h"
 #include "types.h"
 #include "util/base/integral_types.h"
+#include "util/base/task-runner.h"
 #include "util/calendar/calendar.h"
+#include "util/i18n/locale-set.h"
 #include "util/utf8/unilib.h"
 #include "zlib-utils.h"
 
@@ -37,9 +41,34 @@ namespace libtextclassifier2 {
 // time.
 class DatetimeParser {
  public:
+  // If 'lazy_regex_compilation' is true, the rule patterns compile on first
+  // use instead of here, see Warmup(). Otherwise they are compiled in
+  // parallel with 'task_runner' if it's not nullptr. The patterns come from
+  // 'shared_patterns' if it's not nullptr, see MakeRegexPatterns().
   static std::unique_ptr<DatetimeParser> Instance(
       const DatetimeModel* model, const UniLib& unilib,
-      ZlibDecompressor* decompressor);
+      ZlibDecompressor* decompressor, bool lazy_regex_compilation = false,
+      TaskRunner* task_runner = nullptr,
+      SharedRegexPatterns* shared_patterns = nullptr);
+
+  // Compiles all the rule patterns that are not compiled yet. Returns false
+  // if some pattern doesn't compile.
+  bool Warmup() const;
+
+  // Returns an estimate of the memory held by the parser: the compiled rules,
+  // the rule tables and the caches.
+  int64 EstimateMemoryBytes() const;
+
+  // Releases the compiled rule patterns if they were created with
+  // 'lazy_regex_compilation', to be compiled again on their next use.
+  void ReleaseCompiledPatterns() const;
+
+  // Limits each match of a rule to about this many milliseconds, see
+  // UniLib::RegexMatcher::SetTimeLimit(). A rule that runs out of it is
+  // skipped, with a call to 'on_timeout' if it's set. 0 is no limit. Not
+  // thread-safe, so call it before the parser is used.
+  void SetRegexTimeLimit(int time_limit_millis,
+                         std::function<void()> on_timeout);
 
   // Parses the dates in 'input' and fills result. Makes sure that the results
   // do not overlap.
@@ -56,25 +85,56 @@ class DatetimeParser {
              ModeFlag mode, bool anchor_start_end,
              std::vector<DatetimeParseResultSpan>* results) const;
 
+  // Same as above but takes the input already converted for the regex
+  // matchers, e.g. to share it with other regex models.
+  bool Parse(const UniLib::RegexInput& input, int64 reference_time_ms_utc,
+             const std::string& reference_timezone, const std::string& locales,
+             ModeFlag mode, bool anchor_start_end,
+             std::vector<DatetimeParseResultSpan>* results) const;
+
  protected:
   DatetimeParser(const DatetimeModel* model, const UniLib& unilib,
-                 ZlibDecompressor* decompressor);
+                 ZlibDecompressor* decompressor, bool lazy_regex_compilation,
+                 TaskRunner* task_runner, SharedRegexPatterns* shared_patterns);
 
   // Returns a list of locale ids for given locale spec string (comma-separated
   // locale names). Assigns the first parsed locale to reference_locale.
   std::vector<int> ParseAndExpandLocales(const std::string& locales,
                                          std::string* reference_locale) const;
 
-  // Helper function that finds datetime spans, only using the rules associated
-  // with the given locales.
-  bool FindSpansUsingLocales(
-      const std::vector<int>& locale_ids, const UnicodeText& input,
-      const int64 reference_time_ms_utc, const std::string& reference_timezone,
-      ModeFlag mode, bool anchor_start_end, const std::string& reference_locale,
-      std::unordered_set<int>* executed_rules,
-      std::vector<DatetimeParseResultSpan>* found_spans) const;
-
-  bool ParseWithRule(const CompiledRule& rule, const UnicodeText& input,
+  // A rule to run for a locale spec and mode, with the first of the expanded
+  // locales it is associated with.
+  struct SelectedRule {
+    int rule_id;
+    int locale_id;
+  };
+
+  // The rules to run for a locale spec and mode, in order, each once.
+  struct RuleSelection {
+    std::string reference_locale;
+    std::vector<SelectedRule> rules;
+  };
+
+  // Computes the rule selection for the given locale spec and mode.
+  void SelectRules(const std::string& locales, ModeFlag mode,
+                   RuleSelection* selection) const;
+
+  // Returns the rule selection for the given locale spec and mode, from the
+  // cache if possible. Returns 'scratch', filled, when the cache is full.
+  const RuleSelection& GetRuleSelection(const std::string& locales,
+                                        ModeFlag mode,
+                                        RuleSelection* scratch) const;
+
+  // Helper function that finds datetime spans, only using the selected rules.
+  bool FindSpansUsingRules(const RuleSelection& selection,
+                           const UniLib::RegexInput& input,
+                           const int64 reference_time_ms_utc,
+                           const std::string& reference_timezone,
+                           bool anchor_start_end,
+                           std::vector<DatetimeParseResultSpan>* found_spans)
+      const;
+
+  bool ParseWithRule(const CompiledRule& rule, const UniLib::RegexInput& input,
                      int64 reference_time_ms_utc,
                      const std::string& reference_timezone,
                      const std::string& reference_locale, const int locale_id,
@@ -102,14 +162,28 @@ class DatetimeParser {
   bool initialized_;
   const UniLib& unilib_;
   std::vector<CompiledRule> rules_;
-  std::unordered_map<int, std::vector<int>> locale_to_rules_;
-  std::vector<std::unique_ptr<const UniLib::RegexPattern>> extractor_rules_;
-  std::unordered_map<DatetimeExtractorType, std::unordered_map<int, int>>
-      type_and_locale_to_extractor_rule_;
-  std::unordered_map<std::string, int> locale_string_to_id_;
+  // The rules of each locale id.
+  std::vector<std::vector<int>> locale_rules_;
+  std::vector<std::shared_ptr<const UniLib::RegexPattern>> extractor_rules_;
+  // The vocabularies of the extractor rules, or nullptr for the rules that
+  // are not alternations of words.
+  std::vector<std::unique_ptr<const ExtractorVocabulary>>
+      extractor_vocabularies_;
+  ExtractorRuleTable extractor_rule_table_;
+  LocaleIndex locale_index_;
   std::vector<int> default_locale_ids_;
   CalendarLib calendar_lib_;
   bool use_extractors_for_locating_;
+
+  // See SetRegexTimeLimit().
+  int regex_time_limit_millis_ = 0;
+  std::function<void()> on_regex_timeout_;
+
+  // Rule selections by mode and locale spec, computed on first use. Callers
+  // typically use a handful of locale specs.
+  mutable std::mutex rule_selections_mutex_;
+  mutable std::unordered_map<std::string, std::unique_ptr<const RuleSelection>>
+      rule_selections_[ModeFlag_MAX + 1];
 };
 
 }  // namespace libtextclassifier2
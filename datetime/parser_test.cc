@@ -453,5 +453,17 @@ TEST_F(ParserLocaleTest, SwissEnglish) {
   EXPECT_TRUE(HasResult("default", /*locales=*/"en-CH"));
 }
 
+TEST_F(ParserLocaleTest, ManyLocaleSpecs) {
+  // More locale specs than the parser caches rule selections for.
+  for (int i = 0; i < 100; ++i) {
+    const std::string locales = "en-US,xx-" + std::to_string(i);
+    EXPECT_TRUE(HasResult("en-US", locales));
+    EXPECT_FALSE(HasResult("en-CH", locales));
+    EXPECT_TRUE(HasResult("default", locales));
+  }
+  EXPECT_TRUE(HasResult("en-CH", /*locales=*/"en-CH"));
+  EXPECT_FALSE(HasResult("en-US", /*locales=*/"en-CH"));
+}
+
 }  // namespace
 }  // namespace libtextclassifier2
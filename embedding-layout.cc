@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "embedding-layout.h"
+
+#include <algorithm>
+#include <memory>
+
+#include "feature-processor.h"
+#include "model-executor.h"
+#include "token-feature-extractor.h"
+#include "util/base/logging.h"
+#include "util/flatbuffers.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+void CountBucketHits(const FeatureProcessorOptions* options,
+                     const std::vector<std::string>& texts,
+                     const UniLib& unilib, std::vector<int64>* bucket_hits) {
+  if (options == nullptr) {
+    return;
+  }
+  const FeatureProcessor feature_processor(options, &unilib);
+  const TokenFeatureExtractor feature_extractor(
+      internal::BuildTokenFeatureExtractorOptions(options), unilib);
+  for (const std::string& text : texts) {
+    for (const Token& token : feature_processor.Tokenize(text)) {
+      for (const int bucket :
+           feature_extractor.ExtractCharactergramFeatures(token)) {
+        if (bucket >= 0 && bucket < bucket_hits->size()) {
+          ++(*bucket_hits)[bucket];
+        }
+      }
+    }
+  }
+}
+
+// Returns the bucket the given remap assigns to a bucket.
+int RemapBucket(const std::vector<int>& remap_from,
+                const std::vector<int>& remap_to, int bucket) {
+  const auto it =
+      std::lower_bound(remap_from.begin(), remap_from.end(), bucket);
+  if (it == remap_from.end() || *it != bucket) {
+    return bucket;
+  }
+  return remap_to[it - remap_from.begin()];
+}
+
+// Composes the existing bucket remap of the options with the new positions.
+void UpdateBucketRemap(const std::vector<int>& new_positions,
+                       FeatureProcessorOptionsT* options) {
+  if (options == nullptr) {
+    return;
+  }
+  std::vector<int> remap_from;
+  std::vector<int> remap_to;
+  for (int bucket = 0; bucket < new_positions.size(); ++bucket) {
+    const int current_bucket =
+        RemapBucket(options->embedding_bucket_remap_from,
+                    options->embedding_bucket_remap_to, bucket);
+    if (current_bucket < 0 || current_bucket >= new_positions.size()) {
+      continue;
+    }
+    const int new_bucket = new_positions[current_bucket];
+    if (new_bucket != bucket) {
+      remap_from.push_back(bucket);
+      remap_to.push_back(new_bucket);
+    }
+  }
+  options->embedding_bucket_remap_from = std::move(remap_from);
+  options->embedding_bucket_remap_to = std::move(remap_to);
+}
+
+// Moves the fixed size rows of a table to their new positions.
+void PermuteRows(const std::vector<int>& new_positions, int row_bytes,
+                 uint8* table) {
+  const std::vector<uint8> old_table(
+      table, table + new_positions.size() * row_bytes);
+  for (int row = 0; row < new_positions.size(); ++row) {
+    std::copy(old_table.begin() + row * row_bytes,
+              old_table.begin() + (row + 1) * row_bytes,
+              table + new_positions[row] * row_bytes);
+  }
+}
+
+}  // namespace
+
+std::vector<int64> CountEmbeddingBucketHits(
+    const Model* model, const std::vector<std::string>& texts,
+    const UniLib& unilib) {
+  int num_buckets = 0;
+  if (model->selection_feature_options() != nullptr) {
+    num_buckets = model->selection_feature_options()->num_buckets();
+  }
+  if (model->classification_feature_options() != nullptr) {
+    num_buckets = std::max(
+        num_buckets, model->classification_feature_options()->num_buckets());
+  }
+  std::vector<int64> bucket_hits(num_buckets, 0);
+  CountBucketHits(model->selection_feature_options(), texts, unilib,
+                  &bucket_hits);
+  CountBucketHits(model->classification_feature_options(), texts, unilib,
+                  &bucket_hits);
+  return bucket_hits;
+}
+
+std::vector<int> FrequencyOrderedBucketLayout(
+    const std::vector<int64>& bucket_hits, int max_hot_buckets) {
+  std::vector<int> hot_buckets;
+  for (int bucket = 0; bucket < bucket_hits.size(); ++bucket) {
+    if (bucket_hits[bucket] > 0) {
+      hot_buckets.push_back(bucket);
+    }
+  }
+  std::stable_sort(hot_buckets.begin(), hot_buckets.end(),
+                   [&bucket_hits](int a, int b) {
+                     return bucket_hits[a] > bucket_hits[b];
+                   });
+  if (max_hot_buckets < static_cast<int>(hot_buckets.size())) {
+    hot_buckets.resize(std::max(max_hot_buckets, 0));
+  }
+
+  const int num_hot_buckets = hot_buckets.size();
+  std::vector<int> new_positions(bucket_hits.size());
+  std::vector<bool> is_hot(bucket_hits.size(), false);
+  for (int i = 0; i < num_hot_buckets; ++i) {
+    new_positions[hot_buckets[i]] = i;
+    is_hot[hot_buckets[i]] = true;
+  }
+
+  // The cold buckets from the start of the table move to the positions that
+  // the hot buckets from further back vacated.
+  std::vector<int> vacated_positions;
+  for (const int bucket : hot_buckets) {
+    if (bucket >= num_hot_buckets) {
+      vacated_positions.push_back(bucket);
+    }
+  }
+  std::sort(vacated_positions.begin(), vacated_positions.end());
+  auto vacated_position = vacated_positions.begin();
+  for (int bucket = 0; bucket < bucket_hits.size(); ++bucket) {
+    if (is_hot[bucket]) {
+      continue;
+    }
+    if (bucket < num_hot_buckets) {
+      new_positions[bucket] = *vacated_position++;
+    } else {
+      new_positions[bucket] = bucket;
+    }
+  }
+  return new_positions;
+}
+
+bool ApplyEmbeddingBucketLayout(const std::vector<int>& new_positions,
+                                ModelT* model) {
+  std::vector<bool> is_taken(new_positions.size(), false);
+  for (const int position : new_positions) {
+    if (position < 0 || position >= new_positions.size() ||
+        is_taken[position]) {
+      TC_LOG(ERROR) << "The new bucket positions are not a permutation.";
+      return false;
+    }
+    is_taken[position] = true;
+  }
+  if (model->embedding_model.empty()) {
+    TC_LOG(ERROR) << "No embedding model.";
+    return false;
+  }
+
+  // Locate the embedding and scale tables within the TFLite model buffer. Both
+  // are constant tensors, so they point directly into the buffer.
+  uint8* const buffer_begin = model->embedding_model.data();
+  uint8* const buffer_end = buffer_begin + model->embedding_model.size();
+  uint8* embeddings_data;
+  uint8* scales_data;
+  int bytes_per_embedding;
+  {
+    const tflite::Model* model_spec =
+        flatbuffers::GetRoot<tflite::Model>(buffer_begin);
+    flatbuffers::Verifier verifier(buffer_begin,
+                                   model->embedding_model.size());
+    std::unique_ptr<const tflite::FlatBufferModel> embedding_model;
+    if (!model_spec->Verify(verifier) ||
+        !internal::FromModelSpec(model_spec, &embedding_model)) {
+      TC_LOG(ERROR) << "Could not load TFLite model.";
+      return false;
+    }
+    std::unique_ptr<tflite::Interpreter> interpreter;
+    tflite::ops::builtin::BuiltinOpResolver builtins;
+    tflite::InterpreterBuilder(*embedding_model, builtins)(&interpreter);
+    if (!interpreter || interpreter->tensors_size() != 2) {
+      TC_LOG(ERROR) << "Could not build TFLite interpreter for embeddings.";
+      return false;
+    }
+    const TfLiteTensor* embeddings = interpreter->tensor(0);
+    const TfLiteTensor* scales = interpreter->tensor(1);
+    if (embeddings->dims->size != 2 ||
+        embeddings->dims->data[0] != new_positions.size() ||
+        scales->dims->size != 2 ||
+        scales->dims->data[0] != new_positions.size() ||
+        scales->dims->data[1] != 1 || scales->type != kTfLiteFloat32) {
+      TC_LOG(ERROR) << "Unexpected shape of the embedding tables.";
+      return false;
+    }
+    bytes_per_embedding = embeddings->dims->data[1];
+    embeddings_data = reinterpret_cast<uint8*>(embeddings->data.raw);
+    scales_data = reinterpret_cast<uint8*>(scales->data.raw);
+    if (embeddings->allocation_type != kTfLiteMmapRo ||
+        scales->allocation_type != kTfLiteMmapRo ||
+        embeddings_data < buffer_begin ||
+        embeddings_data + embeddings->bytes > buffer_end ||
+        scales_data < buffer_begin ||
+        scales_data + scales->bytes > buffer_end) {
+      TC_LOG(ERROR) << "The embedding tables are not part of the model.";
+      return false;
+    }
+  }
+
+  PermuteRows(new_positions, bytes_per_embedding, embeddings_data);
+  PermuteRows(new_positions, sizeof(float), scales_data);
+  UpdateBucketRemap(new_positions, model->selection_feature_options.get());
+  UpdateBucketRemap(new_positions,
+                    model->classification_feature_options.get());
+  return true;
+}
+
+std::string ReorderEmbeddingBucketsInSerializedModel(
+    const std::string& model, const std::vector<std::string>& texts,
+    int max_hot_buckets, const UniLib& unilib) {
+  const std::vector<int64> bucket_hits =
+      CountEmbeddingBucketHits(GetModel(model.c_str()), texts, unilib);
+  std::unique_ptr<ModelT> unpacked_model = UnPackModel(model.c_str());
+  if (unpacked_model == nullptr ||
+      !ApplyEmbeddingBucketLayout(
+          FrequencyOrderedBucketLayout(bucket_hits, max_hot_buckets),
+          unpacked_model.get())) {
+    return "";
+  }
+  flatbuffers::FlatBufferBuilder builder;
+  FinishModelBuffer(builder, Model::Pack(builder, unpacked_model.get()));
+  return std::string(reinterpret_cast<const char*>(builder.GetBufferPointer()),
+                     builder.GetSize());
+}
+
+}  // namespace libtextclassifier2
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Offline tool to renumber the embedding buckets of a model, so that the
+// frequently hit buckets are stored contiguously at the start of the
+// embedding table. The hot rows then share pages and cache lines, instead of
+// being scattered over the whole table by the hashing.
+//
+// Only the hot buckets and the buckets they displace are renumbered, and the
+// model stores just these as the remap table applied by
+// TokenFeatureExtractor::HashToken.
+
+#ifndef LIBTEXTCLASSIFIER_EMBEDDING_LAYOUT_H_
+#define LIBTEXTCLASSIFIER_EMBEDDING_LAYOUT_H_
+
+#include <string>
+#include <vector>
+
+#include "model_generated.h"
+#include "util/base/integral_types.h"
+#include "util/utf8/unilib.h"
+
+namespace libtextclassifier2 {
+
+// Counts how many times each embedding bucket is hit by the charactergram
+// features of the given texts, with both the selection and the
+// classification feature options of the model. The buckets are in the
+// current numbering of the model, i.e. with its remap applied.
+std::vector<int64> CountEmbeddingBucketHits(
+    const Model* model, const std::vector<std::string>& texts,
+    const UniLib& unilib);
+
+// Returns the new position of each bucket, such that the (at most
+// max_hot_buckets) buckets with hits are placed at the start in the order of
+// decreasing hits. The buckets they displace take over their old positions,
+// all other buckets stay in place.
+std::vector<int> FrequencyOrderedBucketLayout(
+    const std::vector<int64>& bucket_hits, int max_hot_buckets);
+
+// Moves the rows of the embedding table to the given new positions of the
+// buckets, and updates the bucket remap in the feature options to match.
+// Returns false if the model has no usable embedding table.
+bool ApplyEmbeddingBucketLayout(const std::vector<int>& new_positions,
+                                ModelT* model);
+
+// Reorders the embedding buckets of a serialized model by their hits on the
+// given texts. Returns an empty string on error.
+std::string ReorderEmbeddingBucketsInSerializedModel(
+    const std::string& model, const std::vector<std::string>& texts,
+    int max_hot_buckets, const UniLib& unilib);
+
+}  // namespace libtextclassifier2
+
+#endif  // LIBTEXTCLASSIFIER_EMBEDDING_LAYOUT_H_
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "embedding-layout.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "text-classifier.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+std::string ReadFile(const std::string& file_name) {
+  std::ifstream file_stream(file_name);
+  return std::string(std::istreambuf_iterator<char>(file_stream), {});
+}
+
+std::string GetModelPath() {
+  return LIBTEXTCLASSIFIER_TEST_DATA_DIR;
+}
+
+void ExpectSameClassification(const std::vector<ClassificationResult>& a,
+                              const std::vector<ClassificationResult>& b) {
+  ASSERT_EQ(a.size(), b.size());
+  for (int i = 0; i < a.size(); ++i) {
+    EXPECT_EQ(a[i].collection, b[i].collection);
+    EXPECT_EQ(a[i].score, b[i].score);
+  }
+}
+
+TEST(EmbeddingLayoutTest, FrequencyOrderedBucketLayout) {
+  const std::vector<int64> bucket_hits = {0, 5, 0, 0, 7, 0, 1, 0};
+  EXPECT_THAT(FrequencyOrderedBucketLayout(bucket_hits, 100),
+              testing::ElementsAreArray({4, 1, 6, 3, 0, 5, 2, 7}));
+
+  // Only the hottest bucket is moved.
+  EXPECT_THAT(FrequencyOrderedBucketLayout(bucket_hits, 1),
+              testing::ElementsAreArray({4, 1, 2, 3, 0, 5, 6, 7}));
+
+  // Without hits, nothing is moved.
+  EXPECT_THAT(FrequencyOrderedBucketLayout(std::vector<int64>(3, 0), 100),
+              testing::ElementsAreArray({0, 1, 2}));
+}
+
+TEST(EmbeddingLayoutTest, ReorderedModelGivesSameResults) {
+  CREATE_UNILIB_FOR_TESTING;
+  const std::string model_buffer = ReadFile(GetModelPath() + "test_model.fb");
+  const std::string reordered_buffer = ReorderEmbeddingBucketsInSerializedModel(
+      model_buffer, {"call me at 857 225 3556 today", "hello world"},
+      /*max_hot_buckets=*/1000, unilib);
+  ASSERT_FALSE(reordered_buffer.empty());
+
+  const Model* reordered_model = GetModel(reordered_buffer.data());
+  ASSERT_TRUE(reordered_model->classification_feature_options()
+                  ->embedding_bucket_remap_from() != nullptr);
+  EXPECT_GT(reordered_model->classification_feature_options()
+                ->embedding_bucket_remap_from()
+                ->size(),
+            0);
+
+  // The hottest bucket now comes first.
+  const std::vector<int64> bucket_hits = CountEmbeddingBucketHits(
+      reordered_model, {"call me at 857 225 3556 today", "hello world"},
+      unilib);
+  EXPECT_EQ(std::max_element(bucket_hits.begin(), bucket_hits.end()),
+            bucket_hits.begin());
+
+  std::unique_ptr<TextClassifier> classifier =
+      TextClassifier::FromUnownedBuffer(model_buffer.data(),
+                                        model_buffer.size(), &unilib);
+  std::unique_ptr<TextClassifier> reordered_classifier =
+      TextClassifier::FromUnownedBuffer(reordered_buffer.data(),
+                                        reordered_buffer.size(), &unilib);
+  ASSERT_TRUE(classifier);
+  ASSERT_TRUE(reordered_classifier);
+  for (const std::string& text :
+       {"call me at 857 225 3556 today", "visit www.google.com today",
+        "hello world"}) {
+    EXPECT_EQ(reordered_classifier->SuggestSelection(text, {0, 4}),
+              classifier->SuggestSelection(text, {0, 4}));
+    ExpectSameClassification(reordered_classifier->ClassifyText(text, {0, 4}),
+                             classifier->ClassifyText(text, {0, 4}));
+  }
+
+  // Reordering again composes with the existing remap.
+  const std::string twice_reordered_buffer =
+      ReorderEmbeddingBucketsInSerializedModel(
+          reordered_buffer, {"visit www.google.com today"},
+          /*max_hot_buckets=*/1000, unilib);
+  std::unique_ptr<TextClassifier> twice_reordered_classifier =
+      TextClassifier::FromUnownedBuffer(twice_reordered_buffer.data(),
+                                        twice_reordered_buffer.size(),
+                                        &unilib);
+  ASSERT_TRUE(twice_reordered_classifier);
+  ExpectSameClassification(
+      twice_reordered_classifier->ClassifyText("call me at 857 225 3556 today",
+                                               {11, 23}),
+      classifier->ClassifyText("call me at 857 225 3556 today", {11, 23}));
+}
+
+}  // namespace
+}  // namespace libtextclassifier2
@@ -16,11 +16,16 @@
 
 #include "feature-processor.h"
 
+#include <algorithm>
 #include <iterator>
+#include <limits>
 #include <set>
 #include <vector>
 
+#include "stage-profile.h"
 #include "util/base/logging.h"
+#include "util/gtl/stl_util.h"
+#include "util/hash/farmhash.h"
 #include "util/strings/utf8.h"
 #include "util/utf8/unicodetext.h"
 
@@ -51,64 +56,125 @@ TokenFeatureExtractorOptions BuildTokenFeatureExtractorOptions(
   extractor_options.remap_digits = options->remap_digits();
   extractor_options.lowercase_tokens = options->lowercase_tokens();
 
-  if (options->allowed_chargrams() != nullptr) {
+  // Prefer the precomputed fingerprints, so that the chargram strings don't
+  // need to be touched at all.
+  if (options->allowed_chargram_fingerprints() != nullptr &&
+      options->allowed_chargram_fingerprints()->size() > 0) {
+    extractor_options.allowed_chargram_fingerprints.assign(
+        options->allowed_chargram_fingerprints()->begin(),
+        options->allowed_chargram_fingerprints()->end());
+  } else if (options->allowed_chargrams() != nullptr) {
+    extractor_options.allowed_chargram_fingerprints.reserve(
+        options->allowed_chargrams()->size());
     for (const auto& chargram : *options->allowed_chargrams()) {
-      extractor_options.allowed_chargrams.insert(chargram->str());
+      extractor_options.allowed_chargram_fingerprints.push_back(
+          tc2farmhash::Fingerprint64(chargram->c_str(), chargram->size()));
     }
   }
+  if (options->embedding_bucket_remap_from() != nullptr &&
+      options->embedding_bucket_remap_to() != nullptr) {
+    extractor_options.embedding_bucket_remap_from.assign(
+        options->embedding_bucket_remap_from()->begin(),
+        options->embedding_bucket_remap_from()->end());
+    extractor_options.embedding_bucket_remap_to.assign(
+        options->embedding_bucket_remap_to()->begin(),
+        options->embedding_bucket_remap_to()->end());
+  }
   return extractor_options;
 }
 
-void SplitTokensOnSelectionBoundaries(CodepointSpan selection,
-                                      std::vector<Token>* tokens) {
-  for (auto it = tokens->begin(); it != tokens->end(); ++it) {
-    const UnicodeText token_word =
-        UTF8ToUnicodeText(it->value, /*do_copy=*/false);
-
-    auto last_start = token_word.begin();
-    int last_start_index = it->start;
-    std::vector<UnicodeText::const_iterator> split_points;
+bool SplitTokenOnSelectionBoundaries(CodepointSpan selection,
+                                     const Token& token,
+                                     std::vector<Token>* pieces) {
+  const bool split_at_start =
+      selection.first > token.start && selection.first < token.end;
+  const bool split_at_end =
+      selection.second > token.start && selection.second < token.end;
+  if (!split_at_start && !split_at_end) {
+    return false;
+  }
 
-    // Selection start split point.
-    if (selection.first > it->start && selection.first < it->end) {
-      std::advance(last_start, selection.first - last_start_index);
-      split_points.push_back(last_start);
-      last_start_index = selection.first;
-    }
+  const UnicodeText token_word =
+      UTF8ToUnicodeText(token.value, /*do_copy=*/false);
+  auto last_start = token_word.begin();
+  int current_pos = token.start;
+  const auto append_piece_until = [&](int end) {
+    auto piece_end = last_start;
+    std::advance(piece_end, end - current_pos);
+    pieces->emplace_back(token_word.UTF8Substring(last_start, piece_end),
+                         current_pos, end);
+    last_start = piece_end;
+    current_pos = end;
+  };
+  if (split_at_start) {
+    append_piece_until(selection.first);
+  }
+  if (split_at_end) {
+    append_piece_until(selection.second);
+  }
+  // The rest of the token.
+  pieces->emplace_back(token_word.UTF8Substring(last_start, token_word.end()),
+                       current_pos, token.end);
+  return true;
+}
 
-    // Selection end split point.
-    if (selection.second > it->start && selection.second < it->end) {
-      std::advance(last_start, selection.second - last_start_index);
-      split_points.push_back(last_start);
-    }
+void SplitTokensOnSelectionBoundaries(CodepointSpan selection,
+                                      std::vector<Token>* tokens) {
+  RetokenizeTokens(selection, /*split_tokens=*/true,
+                   /*line_span=*/{0, std::numeric_limits<int>::max()},
+                   tokens);
+}
 
-    if (!split_points.empty()) {
-      // Add a final split for the rest of the token unless it's been all
-      // consumed already.
-      if (split_points.back() != token_word.end()) {
-        split_points.push_back(token_word.end());
+void RetokenizeTokens(CodepointSpan selection, bool split_tokens,
+                      CodepointSpan line_span, std::vector<Token>* tokens) {
+  const auto in_line = [&line_span](const Token& token) {
+    return token.start >= line_span.first && token.end <= line_span.second;
+  };
+  const auto crosses_boundary = [&selection](const Token& token) {
+    return (selection.first > token.start && selection.first < token.end) ||
+           (selection.second > token.start && selection.second < token.end);
+  };
+
+  // The tokens before the first one that changes stay where they are. The
+  // rest are moved down in place while nothing is split, and only once a
+  // token is split, into a new vector.
+  int num_kept = 0;
+  std::vector<Token> result;
+  bool has_result = false;
+  for (int i = 0; i < tokens->size(); ++i) {
+    Token& token = (*tokens)[i];
+    if (split_tokens && crosses_boundary(token)) {
+      if (!has_result) {
+        result.reserve(tokens->size() + 2);
+        std::move(tokens->begin(), tokens->begin() + num_kept,
+                  std::back_inserter(result));
+        has_result = true;
       }
-
-      std::vector<Token> replacement_tokens;
-      last_start = token_word.begin();
-      int current_pos = it->start;
-      for (const auto& split_point : split_points) {
-        Token new_token(token_word.UTF8Substring(last_start, split_point),
-                        current_pos,
-                        current_pos + std::distance(last_start, split_point));
-
-        last_start = split_point;
-        current_pos = new_token.end;
-
-        replacement_tokens.push_back(new_token);
+      const int num_pieces = result.size();
+      SplitTokenOnSelectionBoundaries(selection, token, &result);
+      // The pieces of a token can be on different lines only when the token
+      // contains a line separator.
+      result.erase(std::remove_if(result.begin() + num_pieces, result.end(),
+                                  [&in_line](const Token& piece) {
+                                    return !in_line(piece);
+                                  }),
+                   result.end());
+    } else if (in_line(token)) {
+      if (has_result) {
+        result.push_back(std::move(token));
+      } else {
+        if (num_kept != i) {
+          (*tokens)[num_kept] = std::move(token);
+        }
+        ++num_kept;
       }
-
-      it = tokens->erase(it);
-      it = tokens->insert(it, replacement_tokens.begin(),
-                          replacement_tokens.end());
-      std::advance(it, replacement_tokens.size() - 1);
     }
   }
+  if (has_result) {
+    tokens->swap(result);
+  } else {
+    tokens->resize(num_kept);
+  }
 }
 
 const UniLib* MaybeCreateUnilib(const UniLib* unilib,
@@ -131,9 +197,8 @@ void FeatureProcessor::StripTokensFromOtherLines(
   StripTokensFromOtherLines(context_unicode, span, tokens);
 }
 
-void FeatureProcessor::StripTokensFromOtherLines(
-    const UnicodeText& context_unicode, CodepointSpan span,
-    std::vector<Token>* tokens) const {
+CodepointSpan FeatureProcessor::LineOfSpan(const UnicodeText& context_unicode,
+                                           CodepointSpan span) const {
   std::vector<UnicodeTextRange> lines = SplitContext(context_unicode);
 
   auto span_start = context_unicode.begin();
@@ -144,24 +209,26 @@ void FeatureProcessor::StripTokensFromOtherLines(
   if (span.second > 0) {
     std::advance(span_end, span.second);
   }
+  CodepointSpan line_span = {0, std::numeric_limits<int>::max()};
   for (const UnicodeTextRange& line : lines) {
     // Find the line that completely contains the span.
     if (line.first <= span_start && line.second >= span_end) {
-      const CodepointIndex last_line_begin_index =
+      const CodepointIndex line_begin_index =
           std::distance(context_unicode.begin(), line.first);
-      const CodepointIndex last_line_end_index =
-          last_line_begin_index + std::distance(line.first, line.second);
-
-      for (auto token = tokens->begin(); token != tokens->end();) {
-        if (token->start >= last_line_begin_index &&
-            token->end <= last_line_end_index) {
-          ++token;
-        } else {
-          token = tokens->erase(token);
-        }
-      }
+      const CodepointIndex line_end_index =
+          line_begin_index + std::distance(line.first, line.second);
+      line_span.first = std::max(line_span.first, line_begin_index);
+      line_span.second = std::min(line_span.second, line_end_index);
     }
   }
+  return line_span;
+}
+
+void FeatureProcessor::StripTokensFromOtherLines(
+    const UnicodeText& context_unicode, CodepointSpan span,
+    std::vector<Token>* tokens) const {
+  internal::RetokenizeTokens(span, /*split_tokens=*/false,
+                             LineOfSpan(context_unicode, span), tokens);
 }
 
 std::string FeatureProcessor::GetDefaultCollection() const {
@@ -175,6 +242,27 @@ std::string FeatureProcessor::GetDefaultCollection() const {
   return (*options_->collections())[options_->default_collection()]->str();
 }
 
+FeatureProcessor::Plan FeatureProcessor::Plan::FromOptions(
+    const FeatureProcessorOptions* options) {
+  Plan plan;
+  plan.extraction = FeatureExtractionPlan::FromOptions(options);
+  plan.tokenization_type = options->tokenization_type();
+  plan.center_token_selection_method = options->center_token_selection_method();
+  plan.context_size = options->context_size();
+  plan.max_selection_span = options->max_selection_span();
+  plan.embedding_size = options->embedding_size();
+  plan.selection_reduced_output_space =
+      options->selection_reduced_output_space();
+  plan.split_tokens_on_selection_boundaries =
+      options->split_tokens_on_selection_boundaries();
+  plan.snap_label_span_boundaries_to_containing_tokens =
+      options->snap_label_span_boundaries_to_containing_tokens();
+  plan.icu_preserve_whitespace_tokens =
+      options->icu_preserve_whitespace_tokens();
+  plan.min_supported_codepoint_ratio = options->min_supported_codepoint_ratio();
+  return plan;
+}
+
 std::vector<Token> FeatureProcessor::Tokenize(const std::string& text) const {
   const UnicodeText text_unicode = UTF8ToUnicodeText(text, /*do_copy=*/false);
   return Tokenize(text_unicode);
@@ -182,18 +270,19 @@ std::vector<Token> FeatureProcessor::Tokenize(const std::string& text) const {
 
 std::vector<Token> FeatureProcessor::Tokenize(
     const UnicodeText& text_unicode) const {
-  if (options_->tokenization_type() ==
+  ScopedStageTimer timer(ProfiledStage::TOKENIZE);
+  if (plan_.tokenization_type ==
       FeatureProcessorOptions_::TokenizationType_INTERNAL_TOKENIZER) {
     return tokenizer_.Tokenize(text_unicode);
-  } else if (options_->tokenization_type() ==
+  } else if (plan_.tokenization_type ==
                  FeatureProcessorOptions_::TokenizationType_ICU ||
-             options_->tokenization_type() ==
+             plan_.tokenization_type ==
                  FeatureProcessorOptions_::TokenizationType_MIXED) {
     std::vector<Token> result;
     if (!ICUTokenize(text_unicode, &result)) {
       return {};
     }
-    if (options_->tokenization_type() ==
+    if (plan_.tokenization_type ==
         FeatureProcessorOptions_::TokenizationType_MIXED) {
       InternalRetokenize(text_unicode, &result);
     }
@@ -205,6 +294,92 @@ std::vector<Token> FeatureProcessor::Tokenize(
   }
 }
 
+namespace {
+
+// The number of codepoints around the span that TokenizeAroundSpan starts
+// with, per needed token and at least.
+const int kTokenizationRadiusPerToken = 8;
+const int kMinTokenizationRadius = 64;
+
+}  // namespace
+
+std::vector<Token> FeatureProcessor::TokenizeAroundSpan(
+    const UnicodeTextIndex& context_index, CodepointSpan span,
+    TokenSpan num_tokens_around) const {
+  const int num_codepoints = context_index.NumCodepoints();
+  const auto tokenize_part = [this, &context_index](int begin, int end) {
+    const char* begin_data = context_index.IteratorAt(begin).utf8_data();
+    const char* end_data = context_index.IteratorAt(end).utf8_data();
+    std::vector<Token> tokens = Tokenize(UTF8ToUnicodeText(
+        begin_data, end_data - begin_data, /*do_copy=*/false));
+    for (Token& token : tokens) {
+      token.start += begin;
+      token.end += begin;
+    }
+    return tokens;
+  };
+
+  if (plan_.tokenization_type ==
+          FeatureProcessorOptions_::TokenizationType_ICU ||
+      plan_.tokenization_type ==
+          FeatureProcessorOptions_::TokenizationType_MIXED) {
+    return tokenize_part(0, num_codepoints);
+  }
+
+  span.first = std::min(std::max(span.first, 0), num_codepoints);
+  span.second = std::min(std::max(span.second, span.first), num_codepoints);
+
+  // Starts with a few codepoints per needed token, and widens the part until
+  // it has enough tokens on both sides.
+  int radius = std::max(
+      kMinTokenizationRadius,
+      kTokenizationRadiusPerToken *
+          (std::max(num_tokens_around.first, num_tokens_around.second) + 1));
+  while (true) {
+    // Moves both ends outwards to where a token of the whole context ends, so
+    // that no token is cut.
+    int begin = std::max(span.first - radius, 0);
+    UnicodeText::const_iterator it = context_index.IteratorAt(begin);
+    while (begin > 0) {
+      --it;
+      if (tokenizer_.SplitsAfter(*it)) {
+        break;
+      }
+      --begin;
+    }
+    int end = std::min(span.second + radius, num_codepoints);
+    if (end > 0) {
+      it = context_index.IteratorAt(end - 1);
+      while (end < num_codepoints && !tokenizer_.SplitsAfter(*it)) {
+        ++it;
+        ++end;
+      }
+    }
+
+    std::vector<Token> tokens = tokenize_part(begin, end);
+
+    // Counts the tokens as CopyCachedTokens does.
+    const int num_tokens_before =
+        std::upper_bound(tokens.begin(), tokens.end(), span.first,
+                         [](int position, const Token& token) {
+                           return position < token.end;
+                         }) -
+        tokens.begin();
+    const int num_tokens_after =
+        tokens.end() -
+        std::lower_bound(tokens.begin(), tokens.end(), span.second,
+                         [](const Token& token, int position) {
+                           return token.start < position;
+                         });
+    if ((begin == 0 || num_tokens_before >= num_tokens_around.first) &&
+        (end == num_codepoints ||
+         num_tokens_after >= num_tokens_around.second)) {
+      return tokens;
+    }
+    radius *= 4;
+  }
+}
+
 bool FeatureProcessor::LabelToSpan(
     const int label, const VectorSpan<Token>& tokens,
     std::pair<CodepointIndex, CodepointIndex>* span) const {
@@ -219,11 +394,11 @@ bool FeatureProcessor::LabelToSpan(
 
   const int result_begin_token_index = token_span.first;
   const Token& result_begin_token =
-      tokens[options_->context_size() - result_begin_token_index];
+      tokens[plan_.context_size - result_begin_token_index];
   const int result_begin_codepoint = result_begin_token.start;
   const int result_end_token_index = token_span.second;
   const Token& result_end_token =
-      tokens[options_->context_size() + result_end_token_index];
+      tokens[plan_.context_size + result_end_token_index];
   const int result_end_codepoint = result_end_token.end;
 
   if (result_begin_codepoint == kInvalidIndex ||
@@ -273,8 +448,8 @@ bool FeatureProcessor::SpanToLabel(
   }
 
   const int click_position =
-      options_->context_size();  // Click is always in the middle.
-  const int padding = options_->context_size() - options_->max_selection_span();
+      plan_.context_size;  // Click is always in the middle.
+  const int padding = plan_.context_size - plan_.max_selection_span;
 
   int span_left = 0;
   for (int i = click_position - 1; i >= padding; i--) {
@@ -298,7 +473,7 @@ bool FeatureProcessor::SpanToLabel(
   bool tokens_match_span;
   const CodepointIndex tokens_start = tokens[click_position - span_left].start;
   const CodepointIndex tokens_end = tokens[click_position + span_right].end;
-  if (options_->snap_label_span_boundaries_to_containing_tokens()) {
+  if (plan_.snap_label_span_boundaries_to_containing_tokens) {
     tokens_match_span = tokens_start <= span.first && tokens_end >= span.second;
   } else {
     const UnicodeText token_left_unicode = UTF8ToUnicodeText(
@@ -339,7 +514,7 @@ int FeatureProcessor::TokenSpanToLabel(const TokenSpan& span) const {
   }
 }
 
-TokenSpan CodepointSpanToTokenSpan(const std::vector<Token>& selectable_tokens,
+TokenSpan CodepointSpanToTokenSpan(const VectorSpan<Token>& selectable_tokens,
                                    CodepointSpan codepoint_span,
                                    bool snap_boundaries_to_containing_tokens) {
   const int codepoint_start = std::get<0>(codepoint_span);
@@ -375,7 +550,7 @@ CodepointSpan TokenSpanToCodepointSpan(
 namespace {
 
 // Finds a single token that completely contains the given span.
-int FindTokenThatContainsSpan(const std::vector<Token>& selectable_tokens,
+int FindTokenThatContainsSpan(const VectorSpan<Token>& selectable_tokens,
                               CodepointSpan codepoint_span) {
   const int codepoint_start = std::get<0>(codepoint_span);
   const int codepoint_end = std::get<1>(codepoint_span);
@@ -389,12 +564,9 @@ int FindTokenThatContainsSpan(const std::vector<Token>& selectable_tokens,
   return kInvalidIndex;
 }
 
-}  // namespace
-
-namespace internal {
-
-int CenterTokenFromClick(CodepointSpan span,
-                         const std::vector<Token>& selectable_tokens) {
+// Implements internal::CenterTokenFromClick() on a view of the tokens.
+int CenterTokenFromClickInView(CodepointSpan span,
+                               const VectorSpan<Token>& selectable_tokens) {
   int range_begin;
   int range_end;
   std::tie(range_begin, range_end) =
@@ -420,8 +592,10 @@ int CenterTokenFromClick(CodepointSpan span,
   }
 }
 
-int CenterTokenFromMiddleOfSelection(
-    CodepointSpan span, const std::vector<Token>& selectable_tokens) {
+// Implements internal::CenterTokenFromMiddleOfSelection() on a view of the
+// tokens.
+int CenterTokenFromMiddleOfSelectionInView(
+    CodepointSpan span, const VectorSpan<Token>& selectable_tokens) {
   int range_begin;
   int range_end;
   std::tie(range_begin, range_end) =
@@ -435,31 +609,45 @@ int CenterTokenFromMiddleOfSelection(
   }
 }
 
+}  // namespace
+
+namespace internal {
+
+int CenterTokenFromClick(CodepointSpan span,
+                         const std::vector<Token>& selectable_tokens) {
+  return CenterTokenFromClickInView(span, selectable_tokens);
+}
+
+int CenterTokenFromMiddleOfSelection(
+    CodepointSpan span, const std::vector<Token>& selectable_tokens) {
+  return CenterTokenFromMiddleOfSelectionInView(span, selectable_tokens);
+}
+
 }  // namespace internal
 
 int FeatureProcessor::FindCenterToken(CodepointSpan span,
-                                      const std::vector<Token>& tokens) const {
-  if (options_->center_token_selection_method() ==
+                                      const VectorSpan<Token>& tokens) const {
+  if (plan_.center_token_selection_method ==
       FeatureProcessorOptions_::
           CenterTokenSelectionMethod_CENTER_TOKEN_FROM_CLICK) {
-    return internal::CenterTokenFromClick(span, tokens);
-  } else if (options_->center_token_selection_method() ==
+    return CenterTokenFromClickInView(span, tokens);
+  } else if (plan_.center_token_selection_method ==
              FeatureProcessorOptions_::
                  CenterTokenSelectionMethod_CENTER_TOKEN_MIDDLE_OF_SELECTION) {
-    return internal::CenterTokenFromMiddleOfSelection(span, tokens);
-  } else if (options_->center_token_selection_method() ==
+    return CenterTokenFromMiddleOfSelectionInView(span, tokens);
+  } else if (plan_.center_token_selection_method ==
              FeatureProcessorOptions_::
                  CenterTokenSelectionMethod_DEFAULT_CENTER_TOKEN_METHOD) {
     // TODO(zilka): Remove once we have new models on the device.
     // It uses the fact that sharing model use
     // split_tokens_on_selection_boundaries and selection not. So depending on
     // this we select the right way of finding the click location.
-    if (!options_->split_tokens_on_selection_boundaries()) {
+    if (!plan_.split_tokens_on_selection_boundaries) {
       // SmartSelection model.
-      return internal::CenterTokenFromClick(span, tokens);
+      return CenterTokenFromClickInView(span, tokens);
     } else {
       // SmartSharing model.
-      return internal::CenterTokenFromMiddleOfSelection(span, tokens);
+      return CenterTokenFromMiddleOfSelectionInView(span, tokens);
     }
   } else {
     TC_LOG(ERROR) << "Invalid center token selection method.";
@@ -484,7 +672,8 @@ bool FeatureProcessor::SelectionLabelSpans(
 void FeatureProcessor::PrepareCodepointRanges(
     const std::vector<const FeatureProcessorOptions_::CodepointRange*>&
         codepoint_ranges,
-    std::vector<CodepointRange>* prepared_codepoint_ranges) {
+    std::vector<CodepointRange>* prepared_codepoint_ranges,
+    CodepointSet* prepared_codepoint_set) {
   prepared_codepoint_ranges->clear();
   prepared_codepoint_ranges->reserve(codepoint_ranges.size());
   for (const FeatureProcessorOptions_::CodepointRange* range :
@@ -498,13 +687,20 @@ void FeatureProcessor::PrepareCodepointRanges(
             [](const CodepointRange& a, const CodepointRange& b) {
               return a.start < b.start;
             });
+
+  std::vector<std::pair<char32, char32>> ranges;
+  ranges.reserve(prepared_codepoint_ranges->size());
+  for (const CodepointRange& range : *prepared_codepoint_ranges) {
+    ranges.push_back({range.start, range.end});
+  }
+  *prepared_codepoint_set = CodepointSet(ranges);
 }
 
 void FeatureProcessor::PrepareIgnoredSpanBoundaryCodepoints() {
   if (options_->ignored_span_boundary_codepoints() != nullptr) {
-    for (const int codepoint : *options_->ignored_span_boundary_codepoints()) {
-      ignored_span_boundary_codepoints_.insert(codepoint);
-    }
+    ignored_span_boundary_codepoints_ = CodepointSet::FromCodepoints(
+        {options_->ignored_span_boundary_codepoints()->begin(),
+         options_->ignored_span_boundary_codepoints()->end()});
   }
 }
 
@@ -534,8 +730,7 @@ int FeatureProcessor::CountIgnoredSpanBoundaryCodepoints(
 
   // Move until we encounter a non-ignored character.
   int num_ignored = 0;
-  while (ignored_span_boundary_codepoints_.find(*it) !=
-         ignored_span_boundary_codepoints_.end()) {
+  while (ignored_span_boundary_codepoints_.Contains(*it)) {
     ++num_ignored;
 
     if (it == it_last) {
@@ -600,7 +795,22 @@ CodepointSpan FeatureProcessor::StripBoundaryCodepoints(
   std::advance(span_begin, span.first);
   UnicodeText::const_iterator span_end = context_unicode.begin();
   std::advance(span_end, span.second);
+  return StripBoundaryCodepoints(span, span_begin, span_end);
+}
+
+CodepointSpan FeatureProcessor::StripBoundaryCodepoints(
+    const UnicodeTextIndex& context_index, CodepointSpan span) const {
+  if (context_index.NumCodepoints() == 0 || !ValidNonEmptySpan(span)) {
+    return span;
+  }
+
+  const UnicodeTextRange span_range = context_index.RangeAt(span);
+  return StripBoundaryCodepoints(span, span_range.first, span_range.second);
+}
 
+CodepointSpan FeatureProcessor::StripBoundaryCodepoints(
+    CodepointSpan span, const UnicodeText::const_iterator& span_begin,
+    const UnicodeText::const_iterator& span_end) const {
   const int start_offset = CountIgnoredSpanBoundaryCodepoints(
       span_begin, span_end, /*count_from_beginning=*/true);
   const int end_offset = CountIgnoredSpanBoundaryCodepoints(
@@ -614,18 +824,14 @@ CodepointSpan FeatureProcessor::StripBoundaryCodepoints(
 }
 
 float FeatureProcessor::SupportedCodepointsRatio(
-    const TokenSpan& token_span, const std::vector<Token>& tokens) const {
+    const TokenSpan& token_span, const VectorSpan<Token>& tokens) const {
   int num_supported = 0;
   int num_total = 0;
   for (int i = token_span.first; i < token_span.second; ++i) {
-    const UnicodeText value =
-        UTF8ToUnicodeText(tokens[i].value, /*do_copy=*/false);
-    for (auto codepoint : value) {
-      if (IsCodepointInRanges(codepoint, supported_codepoint_ranges_)) {
-        ++num_supported;
-      }
-      ++num_total;
-    }
+    int num_codepoints;
+    num_supported +=
+        supported_codepoints_.CountInUTF8(tokens[i].value, &num_codepoints);
+    num_total += num_codepoints;
   }
   return static_cast<float>(num_supported) / static_cast<float>(num_total);
 }
@@ -667,26 +873,34 @@ int FeatureProcessor::CollectionToLabel(const std::string& collection) const {
   }
 }
 
-std::string FeatureProcessor::LabelToCollection(int label) const {
+const std::string& FeatureProcessor::LabelToCollection(int label) const {
   if (label >= 0 && label < collection_to_label_.size()) {
-    return (*options_->collections())[label]->str();
-  } else {
-    return GetDefaultCollection();
+    return label_to_collection_[label];
   }
+  if (options_->default_collection() < 0 ||
+      options_->default_collection() >= label_to_collection_.size()) {
+    TC_LOG(ERROR)
+        << "Invalid or missing default collection. Returning empty string.";
+    static const std::string* const kEmptyCollection = new std::string();
+    return *kEmptyCollection;
+  }
+  return label_to_collection_[options_->default_collection()];
 }
 
 void FeatureProcessor::MakeLabelMaps() {
   if (options_->collections() != nullptr) {
+    label_to_collection_.reserve(options_->collections()->size());
     for (int i = 0; i < options_->collections()->size(); ++i) {
-      collection_to_label_[(*options_->collections())[i]->str()] = i;
+      label_to_collection_.push_back((*options_->collections())[i]->str());
+      collection_to_label_[label_to_collection_.back()] = i;
     }
   }
 
   int selection_label_id = 0;
-  for (int l = 0; l < (options_->max_selection_span() + 1); ++l) {
-    for (int r = 0; r < (options_->max_selection_span() + 1); ++r) {
-      if (!options_->selection_reduced_output_space() ||
-          r + l <= options_->max_selection_span()) {
+  for (int l = 0; l < (plan_.max_selection_span + 1); ++l) {
+    for (int r = 0; r < (plan_.max_selection_span + 1); ++r) {
+      if (!plan_.selection_reduced_output_space ||
+          r + l <= plan_.max_selection_span) {
         TokenSpan token_span{l, r};
         selection_to_label_[token_span] = selection_label_id;
         label_to_selection_.push_back(token_span);
@@ -713,24 +927,51 @@ void FeatureProcessor::RetokenizeAndFindClick(
     int* click_pos) const {
   TC_CHECK(tokens != nullptr);
 
-  if (options_->split_tokens_on_selection_boundaries()) {
-    internal::SplitTokensOnSelectionBoundaries(input_span, tokens);
+  // Splits and strips the tokens in one pass.
+  const bool split_tokens = plan_.split_tokens_on_selection_boundaries;
+  if (split_tokens || only_use_line_with_click) {
+    internal::RetokenizeTokens(
+        input_span, split_tokens,
+        only_use_line_with_click
+            ? LineOfSpan(context_unicode, input_span)
+            : CodepointSpan{0, std::numeric_limits<int>::max()},
+        tokens);
   }
 
-  if (only_use_line_with_click) {
-    StripTokensFromOtherLines(context_unicode, input_span, tokens);
+  if (click_pos != nullptr) {
+    *click_pos = FindClick(input_span, *tokens);
   }
+}
 
-  int local_click_pos;
-  if (click_pos == nullptr) {
-    click_pos = &local_click_pos;
+bool FeatureProcessor::RetokenizationKeepsTokens(
+    const VectorSpan<Token>& tokens, CodepointSpan input_span,
+    bool only_use_line_with_click) const {
+  if (only_use_line_with_click) {
+    return false;
+  }
+  if (!plan_.split_tokens_on_selection_boundaries) {
+    return true;
+  }
+  // As SplitTokensOnSelectionBoundaries(), which splits the tokens with a
+  // boundary of the span strictly inside.
+  for (const Token& token : tokens) {
+    if ((input_span.first > token.start && input_span.first < token.end) ||
+        (input_span.second > token.start && input_span.second < token.end)) {
+      return false;
+    }
   }
-  *click_pos = FindCenterToken(input_span, *tokens);
-  if (*click_pos == kInvalidIndex) {
-    // If the default click method failed, let's try to do sub-token matching
-    // before we fail.
-    *click_pos = internal::CenterTokenFromClick(input_span, *tokens);
+  return true;
+}
+
+int FeatureProcessor::FindClick(CodepointSpan input_span,
+                                const VectorSpan<Token>& tokens) const {
+  const int click_pos = FindCenterToken(input_span, tokens);
+  if (click_pos != kInvalidIndex) {
+    return click_pos;
   }
+  // If the default click method failed, let's try to do sub-token matching
+  // before we fail.
+  return CenterTokenFromClickInView(input_span, tokens);
 }
 
 namespace internal {
@@ -772,11 +1013,11 @@ void StripOrPadTokens(TokenSpan relative_click_span, int context_size,
 }  // namespace internal
 
 bool FeatureProcessor::HasEnoughSupportedCodepoints(
-    const std::vector<Token>& tokens, TokenSpan token_span) const {
-  if (options_->min_supported_codepoint_ratio() > 0) {
+    const VectorSpan<Token>& tokens, TokenSpan token_span) const {
+  if (plan_.min_supported_codepoint_ratio > 0) {
     const float supported_codepoint_ratio =
         SupportedCodepointsRatio(token_span, tokens);
-    if (supported_codepoint_ratio < options_->min_supported_codepoint_ratio()) {
+    if (supported_codepoint_ratio < plan_.min_supported_codepoint_ratio) {
       TC_VLOG(1) << "Not enough supported codepoints in the context: "
                  << supported_codepoint_ratio;
       return false;
@@ -786,35 +1027,57 @@ bool FeatureProcessor::HasEnoughSupportedCodepoints(
 }
 
 bool FeatureProcessor::ExtractFeatures(
-    const std::vector<Token>& tokens, TokenSpan token_span,
+    const VectorSpan<Token>& tokens, TokenSpan token_span,
     CodepointSpan selection_span_for_feature,
     const EmbeddingExecutor* embedding_executor,
     EmbeddingCache* embedding_cache, int feature_vector_size,
     std::unique_ptr<CachedFeatures>* cached_features) const {
-  std::unique_ptr<std::vector<float>> features(new std::vector<float>());
-  features->reserve(feature_vector_size * TokenSpanSize(token_span));
-  for (int i = token_span.first; i < token_span.second; ++i) {
-    if (!AppendTokenFeaturesWithCache(tokens[i], selection_span_for_feature,
-                                      embedding_executor, embedding_cache,
-                                      features.get())) {
+  ScopedStageTimer timer(ProfiledStage::FEATURES);
+  const int num_tokens = TokenSpanSize(token_span);
+  // The features of the padding token go to the last row.
+  std::vector<float> features(feature_vector_size * (num_tokens + 1));
+
+  // The tokens whose embeddings are not cached are embedded in one batch at the
+  // end. The padding token is handled as the last token.
+  EmbeddingBatch batch;
+  const Token padding_token;
+  for (int i = 0; i <= num_tokens; ++i) {
+    const bool is_padding = (i == num_tokens);
+    if (!ExtractTokenFeatures(
+            is_padding ? padding_token : tokens[token_span.first + i],
+            selection_span_for_feature, embedding_cache, feature_vector_size,
+            features.data() + i * feature_vector_size,
+            &batch)) {
       TC_LOG(ERROR) << "Could not get token features.";
       return false;
     }
   }
 
-  std::unique_ptr<std::vector<float>> padding_features(
-      new std::vector<float>());
-  padding_features->reserve(feature_vector_size);
-  if (!AppendTokenFeaturesWithCache(Token(), selection_span_for_feature,
-                                    embedding_executor, embedding_cache,
-                                    padding_features.get())) {
-    TC_LOG(ERROR) << "Count not get padding token features.";
+  const int embedding_size = GetOptions()->embedding_size();
+  if (!batch.dests.empty() &&
+      !embedding_executor->AddEmbeddingsBatch(batch.sparse_features,
+                                              batch.token_starts, batch.dests,
+                                              embedding_size)) {
+    TC_LOG(ERROR) << "Cound not embed tokens' sparse features.";
     return false;
   }
 
-  *cached_features = CachedFeatures::Create(token_span, std::move(features),
-                                            std::move(padding_features),
-                                            options_, feature_vector_size);
+  // The embedded features for the tokens of the batch were not in the cache,
+  // so insert them.
+  if (embedding_cache) {
+    for (int i = 0; i < batch.dests.size(); ++i) {
+      embedding_cache->Insert(batch.spans[i], batch.dests[i], embedding_size);
+    }
+  }
+  if (shared_embedding_cache_ != nullptr) {
+    for (int i = 0; i < batch.dests.size(); ++i) {
+      shared_embedding_cache_->Insert(batch.shared_keys[i], batch.dests[i]);
+    }
+  }
+
+  *cached_features =
+      CachedFeatures::Create(token_span, std::move(features), plan_.extraction,
+                             feature_vector_size);
   if (!*cached_features) {
     TC_LOG(ERROR) << "Cound not create cached features.";
     return false;
@@ -823,47 +1086,70 @@ bool FeatureProcessor::ExtractFeatures(
   return true;
 }
 
+std::unique_ptr<UniLib::BreakIterator> FeatureProcessor::AcquireBreakIterator(
+    const UnicodeText& text) const {
+  {
+    std::lock_guard<std::mutex> lock(break_iterators_mutex_);
+    if (!break_iterators_.empty()) {
+      std::unique_ptr<UniLib::BreakIterator> break_iterator =
+          std::move(break_iterators_.back());
+      break_iterators_.pop_back();
+      break_iterator->Reset(text);
+      return break_iterator;
+    }
+  }
+  return unilib_->CreateBreakIterator(text);
+}
+
+void FeatureProcessor::ReleaseBreakIterator(
+    std::unique_ptr<UniLib::BreakIterator> break_iterator) const {
+  std::lock_guard<std::mutex> lock(break_iterators_mutex_);
+  break_iterators_.push_back(std::move(break_iterator));
+}
+
+void FeatureProcessor::ReleaseBreakIterators() const {
+  std::vector<std::unique_ptr<UniLib::BreakIterator>> break_iterators;
+  {
+    std::lock_guard<std::mutex> lock(break_iterators_mutex_);
+    break_iterators.swap(break_iterators_);
+  }
+}
+
 bool FeatureProcessor::ICUTokenize(const UnicodeText& context_unicode,
                                    std::vector<Token>* result) const {
   std::unique_ptr<UniLib::BreakIterator> break_iterator =
-      unilib_->CreateBreakIterator(context_unicode);
+      AcquireBreakIterator(context_unicode);
   if (!break_iterator) {
     return false;
   }
-  int last_break_index = 0;
-  int break_index = 0;
   int last_unicode_index = 0;
   int unicode_index = 0;
   auto token_begin_it = context_unicode.begin();
-  while ((break_index = break_iterator->Next()) !=
+  while ((unicode_index = break_iterator->Next()) !=
          UniLib::BreakIterator::kDone) {
-    const int token_length = break_index - last_break_index;
-    unicode_index = last_unicode_index + token_length;
-
-    auto token_end_it = token_begin_it;
-    std::advance(token_end_it, token_length);
-
-    // Determine if the whole token is whitespace.
+    // Advances to the end of the token and determines on the way if the whole
+    // token is whitespace.
     bool is_whitespace = true;
-    for (auto char_it = token_begin_it; char_it < token_end_it; ++char_it) {
-      if (!unilib_->IsWhitespace(*char_it)) {
+    auto token_end_it = token_begin_it;
+    for (int i = last_unicode_index; i < unicode_index; ++i, ++token_end_it) {
+      if (is_whitespace && !unilib_->IsWhitespace(*token_end_it)) {
         is_whitespace = false;
-        break;
       }
     }
 
-    const std::string token =
-        context_unicode.UTF8Substring(token_begin_it, token_end_it);
-
-    if (!is_whitespace || options_->icu_preserve_whitespace_tokens()) {
-      result->push_back(Token(token, last_unicode_index, unicode_index));
+    if (!is_whitespace || plan_.icu_preserve_whitespace_tokens) {
+      // The token value is copied straight from the UTF8 data of the context.
+      result->push_back(Token("", last_unicode_index, unicode_index));
+      result->back().value.assign(
+          token_begin_it.utf8_data(),
+          token_end_it.utf8_data() - token_begin_it.utf8_data());
     }
 
-    last_break_index = break_index;
     last_unicode_index = unicode_index;
     token_begin_it = token_end_it;
   }
 
+  ReleaseBreakIterator(std::move(break_iterator));
   return true;
 }
 
@@ -876,8 +1162,7 @@ void FeatureProcessor::InternalRetokenize(const UnicodeText& unicode_text,
         UTF8ToUnicodeText(token.value, /*do_copy=*/false);
     bool should_retokenize = true;
     for (const int codepoint : unicode_token_value) {
-      if (!IsCodepointInRanges(codepoint,
-                               internal_tokenizer_codepoint_ranges_)) {
+      if (!internal_tokenizer_codepoints_.Contains(codepoint)) {
         should_retokenize = false;
         break;
       }
@@ -930,69 +1215,172 @@ void FeatureProcessor::TokenizeSubstring(const UnicodeText& unicode_text,
   }
 }
 
-bool FeatureProcessor::AppendTokenFeaturesWithCache(
+namespace {
+// Initial number of slots of the embedding cache. Must be a power of two.
+const int kEmbeddingCacheInitialSlots = 64;
+
+int HashCodepointSpan(const CodepointSpan& span) {
+  const uint64 key = (static_cast<uint64>(static_cast<uint32>(span.first))
+                      << 32) |
+                     static_cast<uint32>(span.second);
+  return static_cast<int>((key * 0x9E3779B97F4A7C15ull) >> 33);
+}
+}  // namespace
+
+const float* FeatureProcessor::EmbeddingCache::Find(
+    const CodepointSpan& span) {
+  if (num_entries_ == 0) {
+    ++num_misses_;
+    return nullptr;
+  }
+  const Slot& slot = slots_[FindSlot(span)];
+  if (slot.embedding_offset < 0) {
+    ++num_misses_;
+    return nullptr;
+  }
+  ++num_hits_;
+  return embeddings_.data() + slot.embedding_offset;
+}
+
+void FeatureProcessor::EmbeddingCache::Insert(const CodepointSpan& span,
+                                              const float* embedding,
+                                              int size) {
+  if (num_entries_ == 0) {
+    embedding_size_ = size;
+  }
+  TC_DCHECK_EQ(size, embedding_size_);
+
+  // Keep the load factor at most 1/2, so that the probe sequences stay short.
+  if (2 * (num_entries_ + 1) > slots_.size()) {
+    Grow();
+  }
+
+  Slot& slot = slots_[FindSlot(span)];
+  if (slot.embedding_offset < 0) {
+    slot.span = span;
+    slot.embedding_offset = embeddings_.size();
+    embeddings_.insert(embeddings_.end(), embedding, embedding + size);
+    ++num_entries_;
+  } else {
+    std::copy(embedding, embedding + size,
+              embeddings_.begin() + slot.embedding_offset);
+  }
+}
+
+void FeatureProcessor::EmbeddingCache::clear() {
+  for (Slot& slot : slots_) {
+    slot.embedding_offset = -1;
+  }
+  embeddings_.clear();
+  embedding_size_ = 0;
+  num_entries_ = 0;
+  num_hits_ = 0;
+  num_misses_ = 0;
+}
+
+int FeatureProcessor::EmbeddingCache::FindSlot(
+    const CodepointSpan& span) const {
+  const int mask = slots_.size() - 1;
+  int index = HashCodepointSpan(span) & mask;
+  while (slots_[index].embedding_offset >= 0 && slots_[index].span != span) {
+    index = (index + 1) & mask;
+  }
+  return index;
+}
+
+void FeatureProcessor::EmbeddingCache::Grow() {
+  std::vector<Slot> old_slots(
+      slots_.empty() ? kEmbeddingCacheInitialSlots : 2 * slots_.size(),
+      Slot{{kInvalidIndex, kInvalidIndex}, -1});
+  old_slots.swap(slots_);
+  for (const Slot& old_slot : old_slots) {
+    if (old_slot.embedding_offset >= 0) {
+      slots_[FindSlot(old_slot.span)] = old_slot;
+    }
+  }
+}
+
+bool FeatureProcessor::ExtractTokenFeatures(
     const Token& token, CodepointSpan selection_span_for_feature,
-    const EmbeddingExecutor* embedding_executor,
-    EmbeddingCache* embedding_cache,
-    std::vector<float>* output_features) const {
+    EmbeddingCache* embedding_cache, int feature_vector_size,
+    float* output_features, EmbeddingBatch* batch) const {
   // Look for the embedded features for the token in the cache, if there is one.
-  if (embedding_cache) {
-    const auto it = embedding_cache->find({token.start, token.end});
-    if (it != embedding_cache->end()) {
-      // The embedded features were found in the cache, extract only the dense
-      // features.
-      std::vector<float> dense_features;
-      if (!feature_extractor_.Extract(
-              token, token.IsContainedInSpan(selection_span_for_feature),
-              /*sparse_features=*/nullptr, &dense_features)) {
-        TC_LOG(ERROR) << "Could not extract token's dense features.";
-        return false;
-      }
+  const float* cached_embedding =
+      embedding_cache ? embedding_cache->Find({token.start, token.end})
+                      : nullptr;
 
-      // Append both embedded and dense features to the output and return.
-      output_features->insert(output_features->end(), it->second.begin(),
-                              it->second.end());
-      output_features->insert(output_features->end(), dense_features.begin(),
-                              dense_features.end());
-      return true;
-    }
+  // Then in the cache shared across the requests, which copies the embedding
+  // to the output directly.
+  const int embedding_size = GetOptions()->embedding_size();
+  uint64 shared_key = 0;
+  bool found_shared_embedding = false;
+  if (cached_embedding == nullptr && shared_embedding_cache_ != nullptr &&
+      embedding_size <= feature_vector_size) {
+    shared_key =
+        SharedEmbeddingCache::TokenKey(token, shared_embedding_cache_salt_);
+    found_shared_embedding =
+        shared_embedding_cache_->Find(shared_key, output_features);
   }
 
-  // Extract the sparse and dense features.
+  // Extract the dense features, and the sparse ones if they are needed.
   std::vector<int> sparse_features;
   std::vector<float> dense_features;
   if (!feature_extractor_.Extract(
           token, token.IsContainedInSpan(selection_span_for_feature),
-          &sparse_features, &dense_features)) {
+          (cached_embedding || found_shared_embedding) ? nullptr
+                                                       : &sparse_features,
+          &dense_features)) {
     TC_LOG(ERROR) << "Could not extract token's features.";
     return false;
   }
 
-  // Embed the sparse features, appending them directly to the output.
-  const int embedding_size = GetOptions()->embedding_size();
-  output_features->resize(output_features->size() + embedding_size);
-  float* output_features_end =
-      output_features->data() + output_features->size();
-  if (!embedding_executor->AddEmbedding(
-          TensorView<int>(sparse_features.data(),
-                          {static_cast<int>(sparse_features.size())}),
-          /*dest=*/output_features_end - embedding_size,
-          /*dest_size=*/embedding_size)) {
-    TC_LOG(ERROR) << "Cound not embed token's sparse features.";
+  if (embedding_size + dense_features.size() != feature_vector_size) {
+    TC_LOG(ERROR) << "Mismatching feature vector size: "
+                  << embedding_size + dense_features.size() << " "
+                  << feature_vector_size;
     return false;
   }
 
-  // If there is a cache, the embedded features for the token were not in it,
-  // so insert them.
-  if (embedding_cache) {
-    (*embedding_cache)[{token.start, token.end}] = std::vector<float>(
-        output_features_end - embedding_size, output_features_end);
+  if (cached_embedding) {
+    std::copy(cached_embedding, cached_embedding + embedding_size,
+              output_features);
+  } else if (!found_shared_embedding) {
+    // Queue the sparse features to be embedded directly to the output.
+    batch->token_starts.push_back(batch->sparse_features.size());
+    batch->sparse_features.insert(batch->sparse_features.end(),
+                                  sparse_features.begin(),
+                                  sparse_features.end());
+    batch->dests.push_back(output_features);
+    batch->spans.push_back({token.start, token.end});
+    if (shared_embedding_cache_ != nullptr) {
+      batch->shared_keys.push_back(shared_key);
+    }
   }
 
-  // Append the dense features to the output.
-  output_features->insert(output_features->end(), dense_features.begin(),
-                          dense_features.end());
+  // Put the dense features after the embedding.
+  std::copy(dense_features.begin(), dense_features.end(),
+            output_features + embedding_size);
   return true;
 }
 
+int64 FeatureProcessor::EstimateMemoryBytes() const {
+  int64 bytes = STLNodeContainerMemoryBytes(selection_to_label_) +
+                STLVectorMemoryBytes(label_to_selection_) +
+                STLNodeContainerMemoryBytes(collection_to_label_) +
+                STLVectorMemoryBytes(label_to_collection_) +
+                STLVectorMemoryBytes(supported_codepoint_ranges_) +
+                STLVectorMemoryBytes(internal_tokenizer_codepoint_ranges_) +
+                supported_codepoints_.MemoryBytes() +
+                internal_tokenizer_codepoints_.MemoryBytes() +
+                ignored_span_boundary_codepoints_.MemoryBytes();
+  for (const auto& collection_label : collection_to_label_) {
+    bytes += STLStringMemoryBytes(collection_label.first);
+  }
+  for (const std::string& collection : label_to_collection_) {
+    bytes += STLStringMemoryBytes(collection);
+  }
+  return bytes + feature_extractor_.EstimateMemoryBytes() +
+         tokenizer_.EstimateMemoryBytes();
+}
+
 }  // namespace libtextclassifier2
@@ -21,17 +21,20 @@
 
 #include <map>
 #include <memory>
-#include <set>
+#include <mutex>
 #include <string>
 #include <vector>
 
 #include "cached-features.h"
 #include "model_generated.h"
+#include "shared-embedding-cache.h"
 #include "token-feature-extractor.h"
 #include "tokenizer.h"
 #include "types.h"
 #include "util/base/integral_types.h"
 #include "util/base/logging.h"
+#include "util/utf8/codepoint-set.h"
+#include "util/utf8/unicodetext-index.h"
 #include "util/utf8/unicodetext.h"
 #include "util/utf8/unilib.h"
 
@@ -49,6 +52,19 @@ TokenFeatureExtractorOptions BuildTokenFeatureExtractorOptions(
 void SplitTokensOnSelectionBoundaries(CodepointSpan selection,
                                       std::vector<Token>* tokens);
 
+// Appends the pieces of a token split on the selection boundaries inside it
+// to pieces. Returns false, without appending anything, if no boundary is
+// inside the token.
+bool SplitTokenOnSelectionBoundaries(CodepointSpan selection,
+                                     const Token& token,
+                                     std::vector<Token>* pieces);
+
+// Optionally splits the tokens on the selection boundaries, and removes the
+// tokens (and pieces) outside of line_span, in one pass over the tokens. Same
+// as SplitTokensOnSelectionBoundaries() followed by a filter on the line.
+void RetokenizeTokens(CodepointSpan selection, bool split_tokens,
+                      CodepointSpan line_span, std::vector<Token>* tokens);
+
 // Returns the index of token that corresponds to the codepoint span.
 int CenterTokenFromClick(CodepointSpan span, const std::vector<Token>& tokens);
 
@@ -76,7 +92,7 @@ const UniLib* MaybeCreateUnilib(const UniLib* unilib,
 // token to overlap with the codepoint range to be considered part of it.
 // Otherwise it must be fully included in the range.
 TokenSpan CodepointSpanToTokenSpan(
-    const std::vector<Token>& selectable_tokens, CodepointSpan codepoint_span,
+    const VectorSpan<Token>& selectable_tokens, CodepointSpan codepoint_span,
     bool snap_boundaries_to_containing_tokens = false);
 
 // Converts a token span to a codepoint span in the given list of tokens.
@@ -91,7 +107,57 @@ class FeatureProcessor {
   // same context (the same codepoint spans corresponding to the same tokens),
   // as an optimization. Note that the tokenizations do not have to be
   // identical.
-  typedef std::map<CodepointSpan, std::vector<float>> EmbeddingCache;
+  // The cache is a flat open-addressing hash table, with all the embeddings
+  // stored back to back in one buffer, so that clear() can keep the memory
+  // around for the next request.
+  // NOTE: This class is not thread-safe.
+  class EmbeddingCache {
+   public:
+    // Returns the cached embedding for the span, or nullptr if there is none.
+    // The embedding has embedding_size() values and is only valid until the
+    // next Insert() or clear(). Counts the lookup as a hit or a miss.
+    const float* Find(const CodepointSpan& span);
+
+    // Caches the embedding for the span, replacing any previous one. All the
+    // embeddings in the cache must have the same size.
+    void Insert(const CodepointSpan& span, const float* embedding, int size);
+
+    // Removes all the embeddings and resets the counters, but keeps the
+    // allocated memory.
+    void clear();
+
+    // Number of cached embeddings.
+    int size() const { return num_entries_; }
+
+    // Number of values of each cached embedding, 0 while the cache is empty.
+    int embedding_size() const { return embedding_size_; }
+
+    // Numbers of Find() calls that did and did not find an embedding.
+    int num_hits() const { return num_hits_; }
+    int num_misses() const { return num_misses_; }
+
+   private:
+    struct Slot {
+      CodepointSpan span;
+
+      // Offset of the embedding in embeddings_, or -1 if the slot is empty.
+      int embedding_offset;
+    };
+
+    // Returns the index of the slot holding 'span', or of the empty slot where
+    // it would be inserted. Requires a non-full table.
+    int FindSlot(const CodepointSpan& span) const;
+
+    // Doubles the number of slots and re-inserts the entries.
+    void Grow();
+
+    std::vector<Slot> slots_;
+    std::vector<float> embeddings_;
+    int embedding_size_ = 0;
+    int num_entries_ = 0;
+    int num_hits_ = 0;
+    int num_misses_ = 0;
+  };
 
   // If unilib is nullptr, will create and own an instance of a UniLib,
   // otherwise will use what's passed in.
@@ -102,23 +168,27 @@ class FeatureProcessor {
         feature_extractor_(internal::BuildTokenFeatureExtractorOptions(options),
                            *unilib_),
         options_(options),
+        plan_(Plan::FromOptions(options)),
         tokenizer_(
             options->tokenization_codepoint_config() != nullptr
                 ? Tokenizer({options->tokenization_codepoint_config()->begin(),
                              options->tokenization_codepoint_config()->end()},
-                            options->tokenize_on_script_change())
+                            options->tokenize_on_script_change(),
+                            options->tokenizer_codepoint_page_table())
                 : Tokenizer({}, /*split_on_script_change=*/false)) {
     MakeLabelMaps();
     if (options->supported_codepoint_ranges() != nullptr) {
       PrepareCodepointRanges({options->supported_codepoint_ranges()->begin(),
                               options->supported_codepoint_ranges()->end()},
-                             &supported_codepoint_ranges_);
+                             &supported_codepoint_ranges_,
+                             &supported_codepoints_);
     }
     if (options->internal_tokenizer_codepoint_ranges() != nullptr) {
       PrepareCodepointRanges(
           {options->internal_tokenizer_codepoint_ranges()->begin(),
            options->internal_tokenizer_codepoint_ranges()->end()},
-          &internal_tokenizer_codepoint_ranges_);
+          &internal_tokenizer_codepoint_ranges_,
+          &internal_tokenizer_codepoints_);
     }
     PrepareIgnoredSpanBoundaryCodepoints();
   }
@@ -129,14 +199,31 @@ class FeatureProcessor {
   // Same as above but takes UnicodeText.
   std::vector<Token> Tokenize(const UnicodeText& text_unicode) const;
 
+  // Tokenizes only the part of the context around the span that has at least
+  // num_tokens_around.first tokens before the span and num_tokens_around.second
+  // tokens after it, or reaches the beginning and the end of the context. The
+  // tokens are the ones Tokenize() gives for the whole context, with the same
+  // codepoint indices. Tokenizes the whole context for the ICU and mixed
+  // tokenization, which cannot start in the middle of the text.
+  std::vector<Token> TokenizeAroundSpan(const UnicodeTextIndex& context_index,
+                                        CodepointSpan span,
+                                        TokenSpan num_tokens_around) const;
+
   // Converts a label into a token span.
   bool LabelToTokenSpan(int label, TokenSpan* token_span) const;
 
   // Gets the total number of selection labels.
   int GetSelectionLabelCount() const { return label_to_selection_.size(); }
 
-  // Gets the string value for given collection label.
-  std::string LabelToCollection(int label) const;
+  // Gets the relative token spans of all the selection labels, indexed by
+  // label, as LabelToTokenSpan returns them.
+  const std::vector<TokenSpan>& GetSelectionLabelSpans() const {
+    return label_to_selection_;
+  }
+
+  // Gets the string value for given collection label. The reference stays
+  // valid for the lifetime of the feature processor.
+  const std::string& LabelToCollection(int label) const;
 
   // Gets the total number of collections of the model.
   int NumCollections() const { return collection_to_label_.size(); }
@@ -159,14 +246,28 @@ class FeatureProcessor {
                               bool only_use_line_with_click,
                               std::vector<Token>* tokens, int* click_pos) const;
 
+  // Returns whether RetokenizeAndFindClick() would leave the tokens as they
+  // are, so that a view of them can be used in place of a retokenized copy,
+  // with the click from FindClick(). Always false with
+  // 'only_use_line_with_click', as finding the line of the span takes the
+  // context.
+  bool RetokenizationKeepsTokens(const VectorSpan<Token>& tokens,
+                                 CodepointSpan input_span,
+                                 bool only_use_line_with_click) const;
+
+  // Finds the click position of the input span in the tokens, as
+  // RetokenizeAndFindClick() does after the retokenization.
+  int FindClick(CodepointSpan input_span,
+                const VectorSpan<Token>& tokens) const;
+
   // Returns true if the token span has enough supported codepoints (as defined
   // in the model config) or not and model should not run.
-  bool HasEnoughSupportedCodepoints(const std::vector<Token>& tokens,
+  bool HasEnoughSupportedCodepoints(const VectorSpan<Token>& tokens,
                                     TokenSpan token_span) const;
 
   // Extracts features as a CachedFeatures object that can be used for repeated
   // inference over token spans in the given context.
-  bool ExtractFeatures(const std::vector<Token>& tokens, TokenSpan token_span,
+  bool ExtractFeatures(const VectorSpan<Token>& tokens, TokenSpan token_span,
                        CodepointSpan selection_span_for_feature,
                        const EmbeddingExecutor* embedding_executor,
                        EmbeddingCache* embedding_cache, int feature_vector_size,
@@ -183,7 +284,35 @@ class FeatureProcessor {
     return feature_extractor_.DenseFeaturesCount();
   }
 
-  int EmbeddingSize() const { return options_->embedding_size(); }
+  int EmbeddingSize() const { return plan_.embedding_size; }
+
+  // Whether the processor embeds every token the same as 'other', which holds
+  // for the same sparse features and embedding size. The embeddings that one
+  // of them puts in an EmbeddingCache can then be used by the other for the
+  // same tokens, and only the dense features are extracted by both.
+  bool HasSameTokenEmbeddingsAs(const FeatureProcessor& other) const {
+    return EmbeddingSize() == other.EmbeddingSize() &&
+           feature_extractor_.HasSameSparseFeaturesAs(
+               other.feature_extractor_);
+  }
+
+  // Returns an estimate of the memory held by the feature processor, i.e. its
+  // label maps, feature extractor and tokenizer.
+  int64 EstimateMemoryBytes() const;
+
+  // Frees the break iterators pooled for the tokenization, to be re-created
+  // by the next requests. Thread-safe.
+  void ReleaseBreakIterators() const;
+
+  // Looks up the embeddings of the tokens that are not in the embedding cache
+  // of the request in 'cache' as well, under keys with the given 'salt', and
+  // caches the new embeddings there. The cache must outlive the processor,
+  // and have the embedding size of this processor. Not thread-safe, to be
+  // set before the processor is used.
+  void SetSharedEmbeddingCache(const SharedEmbeddingCache* cache, uint64 salt) {
+    shared_embedding_cache_ = cache;
+    shared_embedding_cache_salt_ = salt;
+  }
 
   // Splits context to several segments.
   std::vector<UnicodeTextRange> SplitContext(
@@ -199,6 +328,11 @@ class FeatureProcessor {
   CodepointSpan StripBoundaryCodepoints(const UnicodeText& context_unicode,
                                         CodepointSpan span) const;
 
+  // Same as above but seeks the span through an index of the context, for
+  // callers that strip many spans of the same context.
+  CodepointSpan StripBoundaryCodepoints(const UnicodeTextIndex& context_index,
+                                        CodepointSpan span) const;
+
  protected:
   // Represents a codepoint range [start, end).
   struct CodepointRange {
@@ -222,7 +356,7 @@ class FeatureProcessor {
   // Spannable tokens are those tokens of context, which the model predicts
   // selection spans over (i.e., there is 1:1 correspondence between the output
   // classes of the model and each of the spannable tokens).
-  int GetNumContextTokens() const { return options_->context_size() * 2 + 1; }
+  int GetNumContextTokens() const { return plan_.context_size * 2 + 1; }
 
   // Converts a label into a span of codepoint indices corresponding to it
   // given output_tokens.
@@ -236,15 +370,17 @@ class FeatureProcessor {
   // Converts a token span to the corresponding label.
   int TokenSpanToLabel(const std::pair<TokenIndex, TokenIndex>& span) const;
 
+  // Sorts the codepoint ranges, and builds the bitmap of their codepoints.
   void PrepareCodepointRanges(
       const std::vector<const FeatureProcessorOptions_::CodepointRange*>&
           codepoint_ranges,
-      std::vector<CodepointRange>* prepared_codepoint_ranges);
+      std::vector<CodepointRange>* prepared_codepoint_ranges,
+      CodepointSet* prepared_codepoint_set);
 
   // Returns the ratio of supported codepoints to total number of codepoints in
   // the given token span.
   float SupportedCodepointsRatio(const TokenSpan& token_span,
-                                 const std::vector<Token>& tokens) const;
+                                 const VectorSpan<Token>& tokens) const;
 
   // Returns true if given codepoint is covered by the given sorted vector of
   // codepoint ranges.
@@ -263,15 +399,29 @@ class FeatureProcessor {
       const UnicodeText::const_iterator& span_end,
       bool count_from_beginning) const;
 
+  // Strips the boundary codepoints of a span, given the iterators at its ends.
+  CodepointSpan StripBoundaryCodepoints(
+      CodepointSpan span, const UnicodeText::const_iterator& span_begin,
+      const UnicodeText::const_iterator& span_end) const;
+
   // Finds the center token index in tokens vector, using the method defined
   // in options_.
   int FindCenterToken(CodepointSpan span,
-                      const std::vector<Token>& tokens) const;
+                      const VectorSpan<Token>& tokens) const;
 
   // Tokenizes the input text using ICU tokenizer.
   bool ICUTokenize(const UnicodeText& context_unicode,
                    std::vector<Token>* result) const;
 
+  // Returns a break iterator set to the given text, taken from the pool of
+  // released iterators if possible. Returns nullptr on error.
+  std::unique_ptr<UniLib::BreakIterator> AcquireBreakIterator(
+      const UnicodeText& text) const;
+
+  // Returns the break iterator to the pool for reuse by later calls.
+  void ReleaseBreakIterator(
+      std::unique_ptr<UniLib::BreakIterator> break_iterator) const;
+
   // Takes the result of ICU tokenization and retokenizes stretches of tokens
   // made of a specific subset of characters using the internal tokenizer.
   void InternalRetokenize(const UnicodeText& unicode_text,
@@ -293,19 +443,48 @@ class FeatureProcessor {
                                  CodepointSpan span,
                                  std::vector<Token>* tokens) const;
 
-  // Extracts the features of a token and appends them to the output vector.
-  // Uses the embedding cache to to avoid re-extracting the re-embedding the
-  // sparse features for the same token.
-  bool AppendTokenFeaturesWithCache(const Token& token,
-                                    CodepointSpan selection_span_for_feature,
-                                    const EmbeddingExecutor* embedding_executor,
-                                    EmbeddingCache* embedding_cache,
-                                    std::vector<float>* output_features) const;
+  // Returns the codepoint bounds of the line (defined by calling SplitContext
+  // on the context) to which span points, or {0, INT_MAX} if there is none.
+  CodepointSpan LineOfSpan(const UnicodeText& context_unicode,
+                           CodepointSpan span) const;
+
+  // Tokens whose sparse features are to be embedded together, in the format
+  // of EmbeddingExecutor::AddEmbeddingsBatch().
+  struct EmbeddingBatch {
+    std::vector<int> sparse_features;
+    std::vector<int> token_starts;
+    std::vector<float*> dests;
+
+    // Codepoint spans of the tokens, for the embedding cache.
+    std::vector<CodepointSpan> spans;
+
+    // Keys of the tokens in the shared embedding cache, if there is one.
+    std::vector<uint64> shared_keys;
+  };
+
+  // Extracts the features of a token into 'output_features', which has room
+  // for 'feature_vector_size' values. Takes the embedding from the embedding
+  // cache if it is there, otherwise adds the token to 'batch', to be embedded
+  // in place later.
+  bool ExtractTokenFeatures(const Token& token,
+                            CodepointSpan selection_span_for_feature,
+                            EmbeddingCache* embedding_cache,
+                            int feature_vector_size, float* output_features,
+                            EmbeddingBatch* batch) const;
 
  private:
   std::unique_ptr<UniLib> owned_unilib_;
   const UniLib* unilib_;
 
+  // ICU break iterators are expensive to create, so the ones released by
+  // ICUTokenize are kept here. Holds at most one per concurrent caller.
+  mutable std::mutex break_iterators_mutex_;
+  mutable std::vector<std::unique_ptr<UniLib::BreakIterator>> break_iterators_;
+
+  // See SetSharedEmbeddingCache(). Not owned.
+  const SharedEmbeddingCache* shared_embedding_cache_ = nullptr;
+  uint64 shared_embedding_cache_salt_ = 0;
+
  protected:
   const TokenFeatureExtractor feature_extractor_;
 
@@ -313,25 +492,53 @@ class FeatureProcessor {
   // NOTE: Must be sorted.
   std::vector<CodepointRange> supported_codepoint_ranges_;
 
+  // The codepoints of supported_codepoint_ranges_, for the lookups.
+  CodepointSet supported_codepoints_;
+
   // Codepoint ranges that define which tokens (consisting of which codepoints)
   // should be re-tokenized with the internal tokenizer in the mixed
   // tokenization mode.
   // NOTE: Must be sorted.
   std::vector<CodepointRange> internal_tokenizer_codepoint_ranges_;
 
+  // The codepoints of internal_tokenizer_codepoint_ranges_, for the lookups.
+  CodepointSet internal_tokenizer_codepoints_;
+
  private:
   // Set of codepoints that will be stripped from beginning and end of
   // predicted spans.
-  std::set<int32> ignored_span_boundary_codepoints_;
+  CodepointSet ignored_span_boundary_codepoints_;
 
   const FeatureProcessorOptions* const options_;
 
+  // The options that are read on every request, resolved from options_ once,
+  // so that the per-request code reads plain fields instead of going through
+  // the flatbuffer vtables.
+  struct Plan {
+    FeatureExtractionPlan extraction;
+    FeatureProcessorOptions_::TokenizationType tokenization_type;
+    FeatureProcessorOptions_::CenterTokenSelectionMethod
+        center_token_selection_method;
+    int context_size;
+    int max_selection_span;
+    int embedding_size;
+    bool selection_reduced_output_space;
+    bool split_tokens_on_selection_boundaries;
+    bool snap_label_span_boundaries_to_containing_tokens;
+    bool icu_preserve_whitespace_tokens;
+    float min_supported_codepoint_ratio;
+
+    static Plan FromOptions(const FeatureProcessorOptions* options);
+  };
+  const Plan plan_;
+
   // Mapping between token selection spans and labels ids.
   std::map<TokenSpan, int> selection_to_label_;
   std::vector<TokenSpan> label_to_selection_;
 
   // Mapping between collections and labels.
   std::map<std::string, int> collection_to_label_;
+  std::vector<std::string> label_to_collection_;
 
   Tokenizer tokenizer_;
 };
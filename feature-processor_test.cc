@@ -16,6 +16,8 @@
 
 #include "feature-processor.h"
 
+#include <algorithm>
+
 #include "model-executor.h"
 #include "tensor-view.h"
 
@@ -58,6 +60,7 @@ class TestingFeatureProcessor : public FeatureProcessor {
   using FeatureProcessor::SpanToLabel;
   using FeatureProcessor::StripTokensFromOtherLines;
   using FeatureProcessor::supported_codepoint_ranges_;
+  using FeatureProcessor::supported_codepoints_;
   using FeatureProcessor::SupportedCodepointsRatio;
 };
 
@@ -160,6 +163,63 @@ TEST(FeatureProcessorTest, SplitTokensOnSelectionBoundariesCrossToken) {
   // clang-format on
 }
 
+TEST(FeatureProcessorTest, RetokenizeTokensSplitsAndStripsLines) {
+  // clang-format off
+  const std::vector<Token> tokens{Token("Hělló", 0, 5),
+                                  Token("fěě\nbař", 6, 13),
+                                  Token("heře!", 14, 19)};
+  // clang-format on
+
+  // Same as splitting, and then removing the pieces outside of the line.
+  std::vector<Token> retokenized = tokens;
+  internal::RetokenizeTokens({10, 13}, /*split_tokens=*/true,
+                             /*line_span=*/{10, 19}, &retokenized);
+  EXPECT_THAT(retokenized, ElementsAreArray({Token("bař", 10, 13),
+                                             Token("heře!", 14, 19)}));
+
+  // Without the split, the token across the lines is removed.
+  retokenized = tokens;
+  internal::RetokenizeTokens({10, 13}, /*split_tokens=*/false,
+                             /*line_span=*/{10, 19}, &retokenized);
+  EXPECT_THAT(retokenized, ElementsAreArray({Token("heře!", 14, 19)}));
+
+  // Nothing to split or strip.
+  retokenized = tokens;
+  internal::RetokenizeTokens({6, 13}, /*split_tokens=*/true,
+                             /*line_span=*/{0, 19}, &retokenized);
+  EXPECT_THAT(retokenized, ElementsAreArray(tokens));
+}
+
+TEST(FeatureProcessorTest, RetokenizationKeepsTokens) {
+  CREATE_UNILIB_FOR_TESTING;
+  FeatureProcessorOptionsT options;
+  options.split_tokens_on_selection_boundaries = true;
+  flatbuffers::DetachedBuffer options_fb = PackFeatureProcessorOptions(options);
+  TestingFeatureProcessor feature_processor(
+      flatbuffers::GetRoot<FeatureProcessorOptions>(options_fb.data()),
+      &unilib);
+
+  const std::vector<Token> tokens{Token("Hělló", 0, 5),
+                                  Token("fěěbař@google.com", 6, 23),
+                                  Token("heře!", 24, 29)};
+  EXPECT_TRUE(feature_processor.RetokenizationKeepsTokens(
+      tokens, {6, 23}, /*only_use_line_with_click=*/false));
+  EXPECT_FALSE(feature_processor.RetokenizationKeepsTokens(
+      tokens, {9, 23}, /*only_use_line_with_click=*/false));
+  EXPECT_FALSE(feature_processor.RetokenizationKeepsTokens(
+      tokens, {6, 23}, /*only_use_line_with_click=*/true));
+
+  // The view only covers the tokens it has.
+  EXPECT_TRUE(feature_processor.RetokenizationKeepsTokens(
+      VectorSpan<Token>(tokens.begin() + 2, tokens.end()), {9, 23},
+      /*only_use_line_with_click=*/false));
+
+  // The click in a view is relative to it.
+  EXPECT_EQ(feature_processor.FindClick(
+                {24, 29}, VectorSpan<Token>(tokens.begin() + 1, tokens.end())),
+            1);
+}
+
 TEST(FeatureProcessorTest, KeepLineWithClickFirst) {
   CREATE_UNILIB_FOR_TESTING;
   FeatureProcessorOptionsT options;
@@ -588,6 +648,14 @@ TEST(FeatureProcessorTest, SupportedCodepointsRatio) {
   EXPECT_TRUE(feature_processor.IsCodepointInRanges(
       25000, feature_processor.supported_codepoint_ranges_));
 
+  // The bitmap of the ranges agrees with them.
+  for (const int codepoint : {-1, 0, 10, 127, 128, 9999, 10000, 10001, 25000}) {
+    EXPECT_EQ(feature_processor.supported_codepoints_.Contains(codepoint),
+              feature_processor.IsCodepointInRanges(
+                  codepoint, feature_processor.supported_codepoint_ranges_))
+        << codepoint;
+  }
+
   const std::vector<Token> tokens = {Token("ěěě", 0, 3), Token("řřř", 4, 7),
                                      Token("eee", 8, 11)};
 
@@ -656,6 +724,49 @@ TEST(FeatureProcessorTest, InSpanFeature) {
   EXPECT_THAT(features[24], FloatEq(0.0));
 }
 
+std::vector<float> CachedEmbedding(FeatureProcessor::EmbeddingCache* cache,
+                                   const CodepointSpan& span) {
+  const float* embedding = cache->Find(span);
+  if (embedding == nullptr) {
+    return {};
+  }
+  return std::vector<float>(embedding, embedding + cache->embedding_size());
+}
+
+TEST(FeatureProcessorTest, EmbeddingCacheInsertFindClear) {
+  FeatureProcessor::EmbeddingCache cache;
+  EXPECT_EQ(cache.Find({0, 1}), nullptr);
+
+  // Insert enough entries to make the table grow a few times.
+  for (int i = 0; i < 1000; ++i) {
+    const std::vector<float> embedding = {static_cast<float>(i),
+                                          static_cast<float>(-i)};
+    cache.Insert({i, i + 1}, embedding.data(), embedding.size());
+  }
+  EXPECT_EQ(cache.size(), 1000);
+  EXPECT_EQ(cache.embedding_size(), 2);
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_THAT(CachedEmbedding(&cache, {i, i + 1}),
+                ElementsAreFloat({static_cast<float>(i),
+                                  static_cast<float>(-i)}));
+  }
+  EXPECT_EQ(cache.Find({1, 0}), nullptr);
+
+  // Replacing an embedding does not add an entry.
+  const std::vector<float> replacement = {7.0, 8.0};
+  cache.Insert({5, 6}, replacement.data(), replacement.size());
+  EXPECT_EQ(cache.size(), 1000);
+  EXPECT_THAT(CachedEmbedding(&cache, {5, 6}), ElementsAreFloat(replacement));
+
+  cache.clear();
+  EXPECT_EQ(cache.size(), 0);
+  EXPECT_EQ(cache.num_hits(), 0);
+  EXPECT_EQ(cache.num_misses(), 0);
+  EXPECT_EQ(cache.Find({5, 6}), nullptr);
+  cache.Insert({5, 6}, replacement.data(), replacement.size());
+  EXPECT_THAT(CachedEmbedding(&cache, {5, 6}), ElementsAreFloat(replacement));
+}
+
 TEST(FeatureProcessorTest, EmbeddingCache) {
   FeatureProcessorOptionsT options;
   options.context_size = 2;
@@ -690,11 +801,11 @@ TEST(FeatureProcessorTest, EmbeddingCache) {
   const std::vector<float> cached_padding_features = {10.0, -10.0, 10.0, -10.0};
   const std::vector<float> cached_features1 = {1.0, 2.0, 3.0, 4.0};
   const std::vector<float> cached_features2 = {5.0, 6.0, 7.0, 8.0};
-  FeatureProcessor::EmbeddingCache embedding_cache = {
-      {{kInvalidIndex, kInvalidIndex}, cached_padding_features},
-      {{4, 7}, cached_features1},
-      {{12, 15}, cached_features2},
-  };
+  FeatureProcessor::EmbeddingCache embedding_cache;
+  embedding_cache.Insert({kInvalidIndex, kInvalidIndex},
+                         cached_padding_features.data(), 4);
+  embedding_cache.Insert({4, 7}, cached_features1.data(), 4);
+  embedding_cache.Insert({12, 15}, cached_features2.data(), 4);
 
   EXPECT_TRUE(feature_processor.ExtractFeatures(
       tokens, /*token_span=*/{0, 6},
@@ -713,17 +824,19 @@ TEST(FeatureProcessorTest, EmbeddingCache) {
   EXPECT_THAT(Subvector(features, 36, 40),
               ElementsAreFloat(cached_padding_features));
   // Check that the real embeddings were cached.
+  EXPECT_EQ(embedding_cache.num_hits(), 3);
+  EXPECT_EQ(embedding_cache.num_misses(), 4);
   EXPECT_EQ(embedding_cache.size(), 7);
   EXPECT_THAT(Subvector(features, 4, 8),
-              ElementsAreFloat(embedding_cache.at({0, 3})));
+              ElementsAreFloat(CachedEmbedding(&embedding_cache, {0, 3})));
   EXPECT_THAT(Subvector(features, 12, 16),
-              ElementsAreFloat(embedding_cache.at({8, 11})));
+              ElementsAreFloat(CachedEmbedding(&embedding_cache, {8, 11})));
   EXPECT_THAT(Subvector(features, 20, 24),
-              ElementsAreFloat(embedding_cache.at({8, 11})));
+              ElementsAreFloat(CachedEmbedding(&embedding_cache, {8, 11})));
   EXPECT_THAT(Subvector(features, 28, 32),
-              ElementsAreFloat(embedding_cache.at({16, 19})));
+              ElementsAreFloat(CachedEmbedding(&embedding_cache, {16, 19})));
   EXPECT_THAT(Subvector(features, 32, 36),
-              ElementsAreFloat(embedding_cache.at({20, 23})));
+              ElementsAreFloat(CachedEmbedding(&embedding_cache, {20, 23})));
 }
 
 TEST(FeatureProcessorTest, StripUnusedTokensWithNoRelativeClick) {
@@ -872,6 +985,75 @@ TEST(FeatureProcessorTest, InternalTokenizeOnScriptChange) {
                                 Token("웹사이트", 7, 11)}));
 }
 
+TEST(FeatureProcessorTest, TokenizeAroundSpanMatchesTokenize) {
+  CREATE_UNILIB_FOR_TESTING;
+  FeatureProcessorOptionsT options;
+  const auto add_range = [&options](int start, int end,
+                                    TokenizationCodepointRange_::Role role,
+                                    int script_id) {
+    options.tokenization_codepoint_config.emplace_back(
+        new TokenizationCodepointRangeT());
+    auto& config = options.tokenization_codepoint_config.back();
+    config->start = start;
+    config->end = end;
+    config->role = role;
+    config->script_id = script_id;
+  };
+  add_range(32, 33, TokenizationCodepointRange_::Role_WHITESPACE_SEPARATOR, 0);
+  add_range(45, 46, TokenizationCodepointRange_::Role_SPLIT_AFTER, 0);
+  add_range(46, 47, TokenizationCodepointRange_::Role_SPLIT_BEFORE, 0);
+  add_range(48, 58, TokenizationCodepointRange_::Role_DEFAULT_ROLE, 2);
+  add_range(97, 123, TokenizationCodepointRange_::Role_DEFAULT_ROLE, 1);
+  options.tokenize_on_script_change = true;
+
+  flatbuffers::DetachedBuffer options_fb = PackFeatureProcessorOptions(options);
+  TestingFeatureProcessor feature_processor(
+      flatbuffers::GetRoot<FeatureProcessorOptions>(options_fb.data()),
+      &unilib);
+
+  std::string text;
+  for (int i = 0; i < 300; ++i) {
+    text += (i % 7 == 0) ? "ab12.cd-ef" : (i % 3 == 0) ? "x  " : "hello ";
+  }
+  const UnicodeText text_unicode = UTF8ToUnicodeText(text, /*do_copy=*/false);
+  const UnicodeTextIndex text_index(text_unicode);
+  const std::vector<Token> all_tokens = feature_processor.Tokenize(text);
+
+  for (const CodepointSpan span :
+       {CodepointSpan{0, 1}, CodepointSpan{3, 9}, CodepointSpan{700, 712},
+        CodepointSpan{1000, 1001}, CodepointSpan{text_index.NumCodepoints() - 1,
+                                                 text_index.NumCodepoints()}}) {
+    for (const TokenSpan num_tokens_around :
+         {TokenSpan{0, 0}, TokenSpan{3, 5}, TokenSpan{40, 2},
+          TokenSpan{1000, 1000}}) {
+      const std::vector<Token> tokens =
+          feature_processor.TokenizeAroundSpan(text_index, span,
+                                               num_tokens_around);
+      ASSERT_FALSE(tokens.empty());
+
+      // The tokens are a part of the tokens of the whole text.
+      const auto first = std::find(all_tokens.begin(), all_tokens.end(),
+                                   tokens.front());
+      ASSERT_NE(first, all_tokens.end()) << span.first;
+      ASSERT_LE(tokens.size(), all_tokens.end() - first);
+      EXPECT_EQ(tokens,
+                std::vector<Token>(first, first + tokens.size()));
+
+      // The part reaches far enough, or to the ends of the text.
+      const int num_tokens_before = std::count_if(
+          tokens.begin(), tokens.end(),
+          [span](const Token& token) { return token.end <= span.first; });
+      const int num_tokens_after = std::count_if(
+          tokens.begin(), tokens.end(),
+          [span](const Token& token) { return token.start >= span.second; });
+      EXPECT_TRUE(num_tokens_before >= num_tokens_around.first ||
+                  tokens.front() == all_tokens.front());
+      EXPECT_TRUE(num_tokens_after >= num_tokens_around.second ||
+                  tokens.back() == all_tokens.back());
+    }
+  }
+}
+
 #ifdef LIBTEXTCLASSIFIER_TEST_ICU
 TEST(FeatureProcessorTest, ICUTokenize) {
   FeatureProcessorOptionsT options;
@@ -892,6 +1074,23 @@ TEST(FeatureProcessorTest, ICUTokenize) {
 }
 #endif
 
+#ifdef LIBTEXTCLASSIFIER_TEST_ICU
+TEST(FeatureProcessorTest, ICUTokenizeReusesBreakIterator) {
+  FeatureProcessorOptionsT options;
+  options.tokenization_type = FeatureProcessorOptions_::TokenizationType_ICU;
+
+  flatbuffers::DetachedBuffer options_fb = PackFeatureProcessorOptions(options);
+  TestingFeatureProcessor feature_processor(
+      flatbuffers::GetRoot<FeatureProcessorOptions>(options_fb.data()));
+  EXPECT_EQ(feature_processor.Tokenize("พระบาทสมเด็จ"),
+            std::vector<Token>(
+                {Token("พระบาท", 0, 6), Token("สมเด็จ", 6, 12)}));
+  EXPECT_EQ(feature_processor.Tokenize("😀 hello"),
+            std::vector<Token>({Token("😀", 0, 1), Token("hello", 2, 7)}));
+  EXPECT_EQ(feature_processor.Tokenize(""), std::vector<Token>());
+}
+#endif
+
 #ifdef LIBTEXTCLASSIFIER_TEST_ICU
 TEST(FeatureProcessorTest, ICUTokenizeWithWhitespaces) {
   FeatureProcessorOptionsT options;
@@ -1089,6 +1288,15 @@ TEST(FeatureProcessorTest, IgnoredSpanBoundaryCodepoints) {
   // Test stripping empty string.
   EXPECT_EQ(feature_processor.StripBoundaryCodepoints("", {0, 0}),
             std::make_pair(0, 0));
+
+  // Test stripping through an index of the context.
+  const UnicodeText context_unicode =
+      UTF8ToUnicodeText("Hello [[[Wořld]] or not?", /*do_copy=*/false);
+  const UnicodeTextIndex context_index(context_unicode);
+  EXPECT_EQ(feature_processor.StripBoundaryCodepoints(context_index, {6, 16}),
+            std::make_pair(9, 14));
+  EXPECT_EQ(feature_processor.StripBoundaryCodepoints(context_index, {0, 24}),
+            std::make_pair(0, 24));
 }
 
 TEST(FeatureProcessorTest, CodepointSpanToTokenSpan) {
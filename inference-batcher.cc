@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "inference-batcher.h"
+
+#include <algorithm>
+
+#include "util/base/logging.h"
+
+namespace libtextclassifier2 {
+
+InferenceBatcher::InferenceBatcher(RunBatchFn run_batch, int max_batch_rows,
+                                   int64 max_wait_micros)
+    : run_batch_(std::move(run_batch)),
+      max_batch_rows_(std::max(max_batch_rows, 1)),
+      max_wait_(max_wait_micros) {}
+
+void InferenceBatcher::CloseBatch(Batch* batch) const {
+  batch->closed = true;
+  if (open_batch_.get() == batch) {
+    open_batch_.reset();
+  }
+  batch_changed_.notify_all();
+}
+
+void InferenceBatcher::RunBatch(Batch* batch) const {
+  const bool success = run_batch_(
+      TensorView<float>(batch->features.data(),
+                        {batch->num_rows, batch->features_size}),
+      &batch->logits);
+  std::lock_guard<std::mutex> lock(mutex_);
+  batch->success = success && batch->logits.size() % batch->num_rows == 0;
+  batch->done = true;
+  ++stats_.num_batches;
+  stats_.num_rows += batch->num_rows;
+  batch_changed_.notify_all();
+}
+
+bool InferenceBatcher::ComputeLogits(const TensorView<float>& features,
+                                     std::vector<float>* logits) const {
+  if (features.dims() != 2) {
+    TC_LOG(ERROR) << "Expected a batch of feature rows.";
+    return false;
+  }
+  const int num_rows = features.dim(0);
+  const int features_size = features.dim(1);
+  if (num_rows > max_batch_rows_) {
+    return run_batch_(features, logits);
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  bool leader = false;
+  if (open_batch_ != nullptr &&
+      (open_batch_->num_rows + num_rows > max_batch_rows_ ||
+       open_batch_->features_size != features_size)) {
+    // Its leader runs it as it is.
+    CloseBatch(open_batch_.get());
+  }
+  if (open_batch_ == nullptr) {
+    open_batch_ = std::make_shared<Batch>();
+    open_batch_->features_size = features_size;
+    open_batch_->features.reserve(max_batch_rows_ * features_size);
+    leader = true;
+  }
+  const std::shared_ptr<Batch> batch = open_batch_;
+  const int first_row = batch->num_rows;
+  batch->features.insert(batch->features.end(), features.data(),
+                         features.data() + features.size());
+  batch->num_rows += num_rows;
+  if (batch->num_rows == max_batch_rows_) {
+    CloseBatch(batch.get());
+  }
+
+  if (leader) {
+    const auto wait_end = std::chrono::steady_clock::now() + max_wait_;
+    batch_changed_.wait_until(lock, wait_end,
+                              [&batch]() { return batch->closed; });
+    CloseBatch(batch.get());
+    lock.unlock();
+    RunBatch(batch.get());
+    lock.lock();
+  } else {
+    batch_changed_.wait(lock, [&batch]() { return batch->done; });
+  }
+  if (!batch->success) {
+    return false;
+  }
+
+  // Only read once the batch is done, so no one writes the logits anymore.
+  lock.unlock();
+  const int num_logits = batch->logits.size() / batch->num_rows;
+  logits->assign(batch->logits.begin() + first_row * num_logits,
+                 batch->logits.begin() + (first_row + num_rows) * num_logits);
+  return true;
+}
+
+InferenceBatcher::Stats InferenceBatcher::GetStats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+}  // namespace libtextclassifier2
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Merges the model inferences of concurrent requests into shared batches.
+
+#ifndef LIBTEXTCLASSIFIER_INFERENCE_BATCHER_H_
+#define LIBTEXTCLASSIFIER_INFERENCE_BATCHER_H_
+
+#include <chrono>  // NOLINT
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "tensor-view.h"
+#include "util/base/integral_types.h"
+#include "util/base/macros.h"
+
+namespace libtextclassifier2 {
+
+// Collects the feature rows of concurrent ComputeLogits() calls into one batch
+// for a bounded time, runs the batch at once and hands each call its rows of
+// the logits. With many concurrent requests of a few rows each, e.g.
+// ClassifyText() calls on a server, this runs the model on full batches
+// instead of many tiny ones, for a latency increase of at most the wait.
+// There's no thread of its own: the first call of a batch waits for the
+// others, up to 'max_wait_micros' or until the batch has 'max_batch_rows'
+// rows, and then runs the batch for all of them.
+// NOTE: This class is thread-safe.
+class InferenceBatcher {
+ public:
+  // Computes the logits of a batch of features (rows x features size) into
+  // 'logits', as rows x num logits values. Returns false on error.
+  typedef std::function<bool(const TensorView<float>& features,
+                             std::vector<float>* logits)>
+      RunBatchFn;
+
+  InferenceBatcher(RunBatchFn run_batch, int max_batch_rows,
+                   int64 max_wait_micros);
+
+  // Computes the logits of 'features', a rows x features size tensor, with
+  // the rows of the concurrent calls, into 'logits', as rows x num logits
+  // values. The calls with more than max_batch_rows rows run on their own.
+  // Returns false if the batch failed.
+  bool ComputeLogits(const TensorView<float>& features,
+                     std::vector<float>* logits) const;
+
+  // The number of batches run and the rows in them, since the creation.
+  struct Stats {
+    int64 num_batches = 0;
+    int64 num_rows = 0;
+  };
+  Stats GetStats() const;
+
+ private:
+  struct Batch {
+    std::vector<float> features;
+    int features_size = 0;
+    int num_rows = 0;
+
+    // Set once no more rows can join, and once the logits are in.
+    bool closed = false;
+    bool done = false;
+    bool success = false;
+    std::vector<float> logits;
+  };
+
+  // Runs the closed batch and wakes up its calls. Called without the lock.
+  void RunBatch(Batch* batch) const;
+
+  // Stops new rows from joining the batch. Called with the lock.
+  void CloseBatch(Batch* batch) const;
+
+  const RunBatchFn run_batch_;
+  const int max_batch_rows_;
+  const std::chrono::microseconds max_wait_;
+
+  mutable std::mutex mutex_;
+  mutable std::condition_variable batch_changed_;
+
+  // The batch that the next calls join, or nullptr.
+  mutable std::shared_ptr<Batch> open_batch_;
+  mutable Stats stats_;
+
+  TC_DISALLOW_COPY_AND_ASSIGN(InferenceBatcher);
+};
+
+}  // namespace libtextclassifier2
+
+#endif  // LIBTEXTCLASSIFIER_INFERENCE_BATCHER_H_
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "inference-batcher.h"
+
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+// A model with two logits per row: the sum of the features and the batch
+// size.
+bool RunSumModel(const TensorView<float>& features,
+                 std::vector<float>* logits) {
+  logits->clear();
+  for (int row = 0; row < features.dim(0); ++row) {
+    float sum = 0.0f;
+    for (int i = 0; i < features.dim(1); ++i) {
+      sum += features.data()[row * features.dim(1) + i];
+    }
+    logits->push_back(sum);
+    logits->push_back(features.dim(0));
+  }
+  return true;
+}
+
+TEST(InferenceBatcherTest, SingleCallRunsAfterTheWait) {
+  const InferenceBatcher batcher(RunSumModel, /*max_batch_rows=*/8,
+                                 /*max_wait_micros=*/100);
+  const std::vector<float> features = {1, 2, 3, 4};
+  std::vector<float> logits;
+  ASSERT_TRUE(
+      batcher.ComputeLogits(TensorView<float>(features.data(), {2, 2}),
+                            &logits));
+  EXPECT_THAT(logits, testing::ElementsAre(3, 2, 7, 2));
+  EXPECT_EQ(batcher.GetStats().num_batches, 1);
+  EXPECT_EQ(batcher.GetStats().num_rows, 2);
+}
+
+TEST(InferenceBatcherTest, LargeCallsRunOnTheirOwn) {
+  const InferenceBatcher batcher(RunSumModel, /*max_batch_rows=*/1,
+                                 /*max_wait_micros=*/1000000);
+  const std::vector<float> features = {1, 2, 3, 4};
+  std::vector<float> logits;
+  ASSERT_TRUE(
+      batcher.ComputeLogits(TensorView<float>(features.data(), {2, 2}),
+                            &logits));
+  EXPECT_THAT(logits, testing::ElementsAre(3, 2, 7, 2));
+  EXPECT_EQ(batcher.GetStats().num_batches, 0);
+}
+
+TEST(InferenceBatcherTest, BatchesConcurrentCalls) {
+  const int kNumThreads = 4;
+  // Long enough for all the threads to join the first batch, which then runs
+  // once full.
+  const InferenceBatcher batcher(RunSumModel, /*max_batch_rows=*/kNumThreads,
+                                 /*max_wait_micros=*/10000000);
+  std::vector<std::vector<float>> logits(kNumThreads);
+  std::vector<int> success(kNumThreads);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads.emplace_back([&batcher, &logits, &success, i]() {
+      const std::vector<float> features = {static_cast<float>(i), 1.0f};
+      success[i] = batcher.ComputeLogits(
+          TensorView<float>(features.data(), {1, 2}), &logits[i]);
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  for (int i = 0; i < kNumThreads; ++i) {
+    ASSERT_TRUE(success[i]);
+    EXPECT_THAT(logits[i], testing::ElementsAre(i + 1, kNumThreads));
+  }
+  EXPECT_EQ(batcher.GetStats().num_batches, 1);
+  EXPECT_EQ(batcher.GetStats().num_rows, kNumThreads);
+}
+
+TEST(InferenceBatcherTest, FailedBatchFailsAllCalls) {
+  const InferenceBatcher batcher(
+      [](const TensorView<float>&, std::vector<float>*) { return false; },
+      /*max_batch_rows=*/8, /*max_wait_micros=*/0);
+  const std::vector<float> features = {1, 2};
+  std::vector<float> logits;
+  EXPECT_FALSE(batcher.ComputeLogits(
+      TensorView<float>(features.data(), {1, 2}), &logits));
+}
+
+}  // namespace
+}  // namespace libtextclassifier2
@@ -0,0 +1,544 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Microbenchmarks of the kernels under the public TextClassifier APIs.
+//
+// Runs each kernel in isolation on the texts of a built-in corpus, with the
+// options, embedding sizes and rules of a real model, and reports the time
+// per operation and the throughput. text-classifier_benchmark.cc covers the
+// end-to-end latencies.
+//
+// Usage:
+//   libtextclassifier_kernels_benchmark [--model=PATH] [--filter=SUBSTRING]
+//       [--min_time_ms=N]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "cached-features.h"
+#include "datetime/parser.h"
+#include "feature-processor.h"
+#include "model-executor.h"
+#include "model_generated.h"
+#include "quantization.h"
+#include "text-classifier.h"
+#include "textclassifier_jni.h"
+#include "token-feature-extractor.h"
+#include "tokenizer.h"
+#include "util/calendar/calendar.h"
+#include "util/math/softmax.h"
+#include "util/memory/mmap.h"
+#include "util/utf8/unicodetext.h"
+#include "util/utf8/unilib.h"
+#include "zlib-utils.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+const char kDefaultModel[] = "/etc/textclassifier/textclassifier.en.model";
+
+// 2018-05-03 10:00 UTC, the reference time of the datetime benchmarks.
+const int64 kReferenceTimeMsUtc = 1525341600000L;
+
+struct BenchmarkFlags {
+  std::string model = kDefaultModel;
+  std::string filter;
+  int min_time_ms = 500;
+};
+
+// Keeps the results of the benchmarked calls alive, so that the compiler
+// can't drop the calls.
+volatile int64 benchmark_sink = 0;
+
+std::vector<std::string> BenchmarkTexts() {
+  return {
+      "Call me at (800) 123-456 today",
+      "this afternoon Barack Obama gave a speech at|Visit www.google.com "
+      "every today!|Call me at (800) 123-456 today.",
+      "The meeting is at 350 Third Street, Cambridge MA on January 1, 2018 "
+      "at 10:30am, call 617-555-0123 to reschedule.",
+      "Hi Tom, thanks for the note. The offsite is on March 4th, 2018 at 9am "
+      "in 1600 Amphitheatre Parkway, Mountain View, CA 94043. Please call "
+      "me at (650) 253-0000 or email me at tom@example.com if you cannot "
+      "make it. The agenda is at http://www.example.com/agenda, and the "
+      "flight leaves tomorrow at 5:30pm.|See you there!",
+      "Rendez-vous le 3 mars à 10h, 12 rue de Rivoli, Paris. 😁",
+      "明日の午後3時に03-1234-5678まで電話してください。",
+  };
+}
+
+bool StartsWith(const std::string& s, const std::string& prefix) {
+  return s.compare(0, prefix.size(), prefix) == 0;
+}
+
+bool ParseFlags(int argc, char** argv, BenchmarkFlags* flags) {
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const std::string value = arg.substr(arg.find('=') + 1);
+    if (StartsWith(arg, "--model=")) {
+      flags->model = value;
+    } else if (StartsWith(arg, "--filter=")) {
+      flags->filter = value;
+    } else if (StartsWith(arg, "--min_time_ms=")) {
+      flags->min_time_ms = std::max(1, atoi(value.c_str()));
+    } else {
+      fprintf(stderr, "Unknown flag: %s\n", arg.c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+int64 NanosSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+// Runs the benchmarks whose name contains the filter. Each operation of a
+// benchmark processes 'bytes_per_op' bytes of input, or 0 if the throughput
+// is not meaningful.
+class BenchmarkRunner {
+ public:
+  explicit BenchmarkRunner(const BenchmarkFlags& flags) : flags_(flags) {}
+
+  void Run(const std::string& name, int64 bytes_per_op,
+           const std::function<void()>& op) const {
+    if (name.find(flags_.filter) == std::string::npos) {
+      return;
+    }
+
+    // One untimed run for the caches and the lazily initialized state, then
+    // twice as many operations until the minimum time is reached.
+    op();
+    const int64 min_nanos = flags_.min_time_ms * 1000000L;
+    int64 num_ops = 1;
+    int64 nanos = 0;
+    while (true) {
+      const auto start = std::chrono::steady_clock::now();
+      for (int64 i = 0; i < num_ops; ++i) {
+        op();
+      }
+      nanos = NanosSince(start);
+      if (nanos >= min_nanos || num_ops >= (1L << 40)) {
+        break;
+      }
+      num_ops *= 2;
+    }
+
+    const double nanos_per_op = static_cast<double>(nanos) / num_ops;
+    if (bytes_per_op > 0) {
+      printf("%-44s %12.1f ns/op %10.2f MB/s\n", name.c_str(), nanos_per_op,
+             bytes_per_op * 1e3 / nanos_per_op);
+    } else {
+      printf("%-44s %12.1f ns/op\n", name.c_str(), nanos_per_op);
+    }
+  }
+
+ private:
+  const BenchmarkFlags& flags_;
+};
+
+// Exposes the ICU tokenization of the feature processor.
+class BenchmarkFeatureProcessor : public FeatureProcessor {
+ public:
+  using FeatureProcessor::FeatureProcessor;
+  using FeatureProcessor::ICUTokenize;
+};
+
+int64 TotalBytes(const std::vector<std::string>& texts) {
+  int64 bytes = 0;
+  for (const std::string& text : texts) {
+    bytes += text.size();
+  }
+  return bytes;
+}
+
+void BenchmarkTokenization(const BenchmarkRunner& runner,
+                           const FeatureProcessorOptions* options,
+                           const UniLib& unilib,
+                           const std::vector<std::string>& texts) {
+  std::vector<const TokenizationCodepointRange*> codepoint_ranges;
+  if (options->tokenization_codepoint_config() != nullptr) {
+    codepoint_ranges.assign(options->tokenization_codepoint_config()->begin(),
+                            options->tokenization_codepoint_config()->end());
+  }
+  const Tokenizer tokenizer(codepoint_ranges,
+                            options->tokenize_on_script_change());
+  runner.Run("Tokenizer::Tokenize", TotalBytes(texts), [&]() {
+    for (const std::string& text : texts) {
+      benchmark_sink += tokenizer.Tokenize(text).size();
+    }
+  });
+
+  const BenchmarkFeatureProcessor feature_processor(options, &unilib);
+  std::vector<UnicodeText> texts_unicode;
+  for (const std::string& text : texts) {
+    texts_unicode.push_back(UTF8ToUnicodeText(text, /*do_copy=*/false));
+  }
+  std::vector<Token> tokens;
+  runner.Run("FeatureProcessor::ICUTokenize", TotalBytes(texts), [&]() {
+    for (const UnicodeText& text_unicode : texts_unicode) {
+      feature_processor.ICUTokenize(text_unicode, &tokens);
+      benchmark_sink += tokens.size();
+    }
+  });
+}
+
+void BenchmarkTokenFeatureExtractor(const BenchmarkRunner& runner,
+                                    const FeatureProcessor& feature_processor,
+                                    const UniLib& unilib,
+                                    const std::vector<std::string>& texts) {
+  const TokenFeatureExtractor extractor(
+      internal::BuildTokenFeatureExtractorOptions(
+          feature_processor.GetOptions()),
+      unilib);
+  std::vector<Token> tokens;
+  for (const std::string& text : texts) {
+    const std::vector<Token> text_tokens = feature_processor.Tokenize(text);
+    tokens.insert(tokens.end(), text_tokens.begin(), text_tokens.end());
+  }
+  std::vector<int> sparse_features;
+  std::vector<float> dense_features;
+  runner.Run("TokenFeatureExtractor::Extract", TotalBytes(texts), [&]() {
+    for (int i = 0; i < tokens.size(); ++i) {
+      sparse_features.clear();
+      dense_features.clear();
+      extractor.Extract(tokens[i], /*is_in_span=*/i % 2 == 0,
+                        &sparse_features, &dense_features);
+      benchmark_sink += sparse_features.size();
+    }
+  });
+}
+
+// Dequantizes the embeddings of the sparse features of one token, from an
+// embedding table with the model's embedding size.
+void BenchmarkDequantizeAdd(const BenchmarkRunner& runner, int embedding_size,
+                            int quantization_bits) {
+  const int kNumBuckets = 4096;
+  const int kNumSparseFeatures = 20;
+  const int bytes_per_embedding =
+      (embedding_size * quantization_bits + 7) / 8;
+  if (!CheckQuantizationParams(bytes_per_embedding, quantization_bits,
+                               embedding_size)) {
+    fprintf(stderr, "Invalid quantization params.\n");
+    return;
+  }
+
+  std::mt19937 random(42);
+  std::uniform_real_distribution<float> scale_distribution(0.01, 1.0);
+  std::vector<float> scales(kNumBuckets);
+  for (float& scale : scales) {
+    scale = scale_distribution(random);
+  }
+  std::vector<uint8> embeddings(kNumBuckets * bytes_per_embedding);
+  for (uint8& byte : embeddings) {
+    byte = random() & 0xFF;
+  }
+  std::vector<int> bucket_ids(kNumSparseFeatures);
+  for (int& bucket_id : bucket_ids) {
+    bucket_id = random() % kNumBuckets;
+  }
+
+  std::vector<float> dest(embedding_size);
+  runner.Run(
+      "DequantizeAdd/" + std::to_string(quantization_bits) + "bit",
+      /*bytes_per_op=*/0, [&]() {
+        std::fill(dest.begin(), dest.end(), 0.0);
+        for (const int bucket_id : bucket_ids) {
+          DequantizeAdd(scales.data(), embeddings.data(), bytes_per_embedding,
+                        kNumSparseFeatures, quantization_bits, bucket_id,
+                        dest.data(), dest.size());
+        }
+        benchmark_sink += dest[0] > 0;
+      });
+}
+
+// Appends the bounds-sensitive features of every span of up to 3 tokens of
+// the longest text.
+void BenchmarkCachedFeatures(const BenchmarkRunner& runner,
+                             const Model* model,
+                             const FeatureProcessor& feature_processor,
+                             const std::vector<std::string>& texts) {
+  const FeatureProcessorOptions* options = feature_processor.GetOptions();
+  if (options->bounds_sensitive_features() == nullptr ||
+      !options->bounds_sensitive_features()->enabled()) {
+    fprintf(stderr, "The model has no bounds-sensitive features.\n");
+    return;
+  }
+  const std::unique_ptr<TFLiteEmbeddingExecutor> embedding_executor =
+      TFLiteEmbeddingExecutor::Instance(
+          model->embedding_model(), options->embedding_size(),
+          options->embedding_quantization_bits());
+  if (!embedding_executor) {
+    fprintf(stderr, "Could not create the embedding executor.\n");
+    return;
+  }
+
+  const std::string& text = *std::max_element(
+      texts.begin(), texts.end(),
+      [](const std::string& a, const std::string& b) {
+        return a.size() < b.size();
+      });
+  const std::vector<Token> tokens = feature_processor.Tokenize(text);
+  std::unique_ptr<CachedFeatures> cached_features;
+  if (!feature_processor.ExtractFeatures(
+          tokens, /*token_span=*/{0, static_cast<int>(tokens.size())},
+          /*selection_span_for_feature=*/{kInvalidIndex, kInvalidIndex},
+          embedding_executor.get(), /*embedding_cache=*/nullptr,
+          feature_processor.EmbeddingSize() +
+              feature_processor.DenseFeaturesCount(),
+          &cached_features)) {
+    fprintf(stderr, "Could not extract features.\n");
+    return;
+  }
+
+  std::vector<float> features;
+  runner.Run("CachedFeatures::AppendBoundsSensitiveFeaturesForSpan",
+             /*bytes_per_op=*/0, [&]() {
+               for (int start = 0; start < tokens.size(); ++start) {
+                 for (int end = start + 1;
+                      end <= std::min<int>(start + 3, tokens.size()); ++end) {
+                   features.clear();
+                   cached_features->AppendBoundsSensitiveFeaturesForSpan(
+                       {start, end}, &features);
+                 }
+               }
+               benchmark_sink += features.size();
+             });
+}
+
+void BenchmarkSoftmax(const BenchmarkRunner& runner, int num_scores) {
+  std::mt19937 random(42);
+  std::normal_distribution<float> score_distribution(0.0, 3.0);
+  std::vector<float> scores(num_scores);
+  for (float& score : scores) {
+    score = score_distribution(random);
+  }
+  std::vector<float> softmax(num_scores);
+  runner.Run("ComputeSoftmax/" + std::to_string(num_scores),
+             /*bytes_per_op=*/0, [&]() {
+               ComputeSoftmax(scores.data(), scores.size(), softmax.data());
+               benchmark_sink += softmax[0] > 0.5;
+             });
+}
+
+// Runs the annotation patterns of the model the way RegexChunk() does.
+void BenchmarkRegexChunk(const BenchmarkRunner& runner, const Model* model,
+                         const UniLib& unilib,
+                         const std::vector<std::string>& texts) {
+  if (model->regex_model() == nullptr ||
+      model->regex_model()->patterns() == nullptr) {
+    fprintf(stderr, "The model has no regex patterns.\n");
+    return;
+  }
+  std::unique_ptr<ZlibDecompressor> decompressor = ZlibDecompressor::Instance();
+  std::vector<std::unique_ptr<UniLib::RegexPattern>> patterns;
+  for (const auto& regex_pattern : *model->regex_model()->patterns()) {
+    if (!(regex_pattern->enabled_modes() & ModeFlag_ANNOTATION)) {
+      continue;
+    }
+    std::string pattern_text;
+    if (!UncompressRegexPatternText(regex_pattern->pattern(),
+                                    regex_pattern->compressed_pattern(),
+                                    decompressor.get(), &pattern_text)) {
+      fprintf(stderr, "Could not uncompress a regex pattern.\n");
+      return;
+    }
+    std::unique_ptr<UniLib::RegexPattern> pattern =
+        MakeRegexPattern(unilib, pattern_text, /*lazy_compile=*/false);
+    if (!pattern) {
+      fprintf(stderr, "Could not compile a regex pattern.\n");
+      return;
+    }
+    patterns.push_back(std::move(pattern));
+  }
+
+  std::vector<std::unique_ptr<UniLib::RegexInput>> inputs;
+  for (const std::string& text : texts) {
+    inputs.push_back(
+        unilib.CreateRegexInput(UTF8ToUnicodeText(text, /*do_copy=*/false)));
+  }
+  runner.Run("RegexChunk", TotalBytes(texts), [&]() {
+    for (const std::unique_ptr<UniLib::RegexInput>& input : inputs) {
+      for (const std::unique_ptr<UniLib::RegexPattern>& pattern : patterns) {
+        if (!pattern->MayMatch(*input)) {
+          continue;
+        }
+        const auto matcher = pattern->Matcher(*input);
+        int status = UniLib::RegexMatcher::kNoError;
+        while (matcher->Find(&status) &&
+               status == UniLib::RegexMatcher::kNoError) {
+          benchmark_sink += matcher->Start(1, &status);
+        }
+      }
+    }
+  });
+}
+
+void BenchmarkDatetimeParser(const BenchmarkRunner& runner, const Model* model,
+                             const UniLib& unilib,
+                             const std::vector<std::string>& texts) {
+  if (model->datetime_model() == nullptr) {
+    fprintf(stderr, "The model has no datetime model.\n");
+    return;
+  }
+  std::unique_ptr<ZlibDecompressor> decompressor = ZlibDecompressor::Instance();
+  const std::unique_ptr<DatetimeParser> parser = DatetimeParser::Instance(
+      model->datetime_model(), unilib, decompressor.get());
+  if (!parser) {
+    fprintf(stderr, "Could not create the datetime parser.\n");
+    return;
+  }
+  std::vector<DatetimeParseResultSpan> results;
+  runner.Run("DatetimeParser::Parse", TotalBytes(texts), [&]() {
+    for (const std::string& text : texts) {
+      results.clear();
+      parser->Parse(text, kReferenceTimeMsUtc, "Europe/Zurich", "en",
+                    ModeFlag_ANNOTATION, /*anchor_start_end=*/false,
+                    &results);
+      benchmark_sink += results.size();
+    }
+  });
+}
+
+// Interprets what the datetime rules parse from "March 4th, 2018 at 9am",
+// "tomorrow at 5:30pm" and "next friday".
+void BenchmarkCalendar(const BenchmarkRunner& runner) {
+  std::vector<DateParseData> parse_data(3);
+  parse_data[0].field_set_mask =
+      DateParseData::YEAR_FIELD | DateParseData::MONTH_FIELD |
+      DateParseData::DAY_FIELD | DateParseData::HOUR_FIELD |
+      DateParseData::AMPM_FIELD;
+  parse_data[0].year = 2018;
+  parse_data[0].month = 3;
+  parse_data[0].day_of_month = 4;
+  parse_data[0].hour = 9;
+  parse_data[0].ampm = DateParseData::AM;
+
+  parse_data[1].field_set_mask =
+      DateParseData::RELATION_FIELD | DateParseData::HOUR_FIELD |
+      DateParseData::MINUTE_FIELD | DateParseData::AMPM_FIELD;
+  parse_data[1].relation = DateParseData::TOMORROW;
+  parse_data[1].hour = 5;
+  parse_data[1].minute = 30;
+  parse_data[1].ampm = DateParseData::PM;
+
+  parse_data[2].field_set_mask = DateParseData::RELATION_FIELD |
+                                 DateParseData::RELATION_TYPE_FIELD;
+  parse_data[2].relation = DateParseData::NEXT;
+  parse_data[2].relation_type = DateParseData::FRIDAY;
+
+  const CalendarLib calendar;
+  runner.Run("CalendarLib::InterpretParseData", /*bytes_per_op=*/0, [&]() {
+    for (const DateParseData& data : parse_data) {
+      int64 time_ms_utc;
+      calendar.InterpretParseData(data, kReferenceTimeMsUtc, "Europe/Zurich",
+                                  "en-CH", GRANULARITY_MINUTE, &time_ms_utc);
+      benchmark_sink += time_ms_utc;
+    }
+  });
+
+  // A reference time on another day each time misses the memoized
+  // interpretations, and runs the calendar arithmetic.
+  int64 reference_time_ms_utc = kReferenceTimeMsUtc;
+  runner.Run("CalendarLib::InterpretParseData/new_day", /*bytes_per_op=*/0,
+             [&]() {
+               reference_time_ms_utc += 24 * 60 * 60 * 1000L;
+               for (const DateParseData& data : parse_data) {
+                 int64 time_ms_utc;
+                 calendar.InterpretParseData(data, reference_time_ms_utc,
+                                             "Europe/Zurich", "en-CH",
+                                             GRANULARITY_MINUTE, &time_ms_utc);
+                 benchmark_sink += time_ms_utc;
+               }
+             });
+}
+
+// Converts the span of the middle half of each text.
+void BenchmarkConvertIndices(const BenchmarkRunner& runner,
+                             const std::vector<std::string>& texts) {
+  std::vector<CodepointSpan> spans;
+  for (const std::string& text : texts) {
+    const int num_codepoints =
+        UTF8ToUnicodeText(text, /*do_copy=*/false).size_codepoints();
+    spans.push_back({num_codepoints / 4, num_codepoints * 3 / 4});
+  }
+  runner.Run("ConvertIndicesBMPToUTF8", TotalBytes(texts), [&]() {
+    for (int i = 0; i < texts.size(); ++i) {
+      benchmark_sink += ConvertIndicesBMPToUTF8(texts[i], spans[i]).first;
+    }
+  });
+}
+
+int RunBenchmarks(const BenchmarkFlags& flags) {
+  ScopedMmap mmap(flags.model);
+  if (!mmap.handle().ok()) {
+    fprintf(stderr, "Could not map model %s\n", flags.model.c_str());
+    return 1;
+  }
+  const Model* model =
+      ViewModel(mmap.handle().start(), mmap.handle().num_bytes());
+  if (model == nullptr || model->selection_feature_options() == nullptr ||
+      model->classification_feature_options() == nullptr) {
+    fprintf(stderr, "Could not read model %s\n", flags.model.c_str());
+    return 1;
+  }
+  printf("Model %s\n", flags.model.c_str());
+
+  CREATE_UNILIB_FOR_TESTING;
+  const BenchmarkRunner runner(flags);
+  const std::vector<std::string> texts = BenchmarkTexts();
+  const FeatureProcessor selection_feature_processor(
+      model->selection_feature_options(), &unilib);
+  const FeatureProcessor classification_feature_processor(
+      model->classification_feature_options(), &unilib);
+
+  BenchmarkTokenization(runner, model->selection_feature_options(), unilib,
+                        texts);
+  BenchmarkTokenFeatureExtractor(runner, selection_feature_processor, unilib,
+                                 texts);
+  const int embedding_size =
+      model->classification_feature_options()->embedding_size();
+  BenchmarkDequantizeAdd(runner, embedding_size, /*quantization_bits=*/8);
+  BenchmarkDequantizeAdd(runner, embedding_size, /*quantization_bits=*/4);
+  BenchmarkDequantizeAdd(runner, embedding_size, /*quantization_bits=*/3);
+  BenchmarkCachedFeatures(runner, model, selection_feature_processor, texts);
+  BenchmarkSoftmax(runner, classification_feature_processor.NumCollections());
+  BenchmarkRegexChunk(runner, model, unilib, texts);
+  BenchmarkDatetimeParser(runner, model, unilib, texts);
+  BenchmarkCalendar(runner);
+  BenchmarkConvertIndices(runner, texts);
+  return 0;
+}
+
+}  // namespace
+}  // namespace libtextclassifier2
+
+int main(int argc, char** argv) {
+  libtextclassifier2::BenchmarkFlags flags;
+  if (!libtextclassifier2::ParseFlags(argc, argv, &flags)) {
+    return 1;
+  }
+  return libtextclassifier2::RunBenchmarks(flags);
+}
@@ -0,0 +1,380 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Load generator for the scaling of TextClassifier over threads.
+//
+// Drives an open-loop request rate with a mix of short, medium and long
+// inputs from 1 to N threads, both with one TextClassifier per thread and
+// with one instance shared by all threads (through its interpreter pools),
+// and reports the throughput per thread and the latency percentiles.
+//
+// The latency of a request is measured from the time it was scheduled to
+// arrive, not from when a thread got to it, so that a saturated classifier
+// shows up as growing latencies instead of as a lower request rate.
+//
+// Usage:
+//   libtextclassifier_load_generator [--model=PATH] [--threads=1,2,4,8]
+//       [--rate=REQUESTS_PER_SECOND] [--duration_ms=N]
+//       [--deployment=shared|per_thread|both]
+//       [--api=annotate|classify|suggest|mixed] [--corpus=PATH]
+//
+// A --rate of 0 runs closed-loop, each thread sending the next request as
+// soon as the last one returns. A corpus file contains one input text per
+// line, and replaces the built-in mix.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "text-classifier.h"
+#include "util/strings/split.h"
+#include "util/utf8/unicodetext.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+const char kDefaultModel[] = "/etc/textclassifier/textclassifier.en.model";
+
+enum class Api { ANNOTATE, CLASSIFY, SUGGEST, MIXED };
+
+struct LoadFlags {
+  std::string model = kDefaultModel;
+  std::vector<int> threads = {1, 2, 4, 8};
+  double rate = 0;
+  int duration_ms = 5000;
+  bool shared = true;
+  bool per_thread = true;
+  Api api = Api::MIXED;
+  std::string corpus;
+};
+
+// An input and how often it's sent, relative to the other inputs.
+struct WeightedText {
+  std::string text;
+  double weight;
+  CodepointSpan click;
+};
+
+struct ThreadResult {
+  std::vector<int64> latencies_nanos;
+  int64 processed_bytes = 0;
+};
+
+std::vector<WeightedText> BuiltinTexts() {
+  const std::string paragraph =
+      "Hi Tom, thanks for the note. The offsite is on March 4th, 2018 at 9am "
+      "in 1600 Amphitheatre Parkway, Mountain View, CA 94043. Please call "
+      "me at (650) 253-0000 or email me at tom@example.com if you cannot "
+      "make it. The agenda is at http://www.example.com/agenda, and the "
+      "flight leaves tomorrow at 5:30pm.|See you there!";
+
+  // Mostly short messages, with a tail of long ones, as in chat apps.
+  return {
+      {"Call me at (800) 123-456 today", 0.3},
+      {"See you tomorrow at 3pm", 0.2},
+      {"Visit www.google.com", 0.2},
+      {"The meeting is at 350 Third Street, Cambridge MA on January 1, 2018 "
+       "at 10:30am, call 617-555-0123 to reschedule.",
+       0.2},
+      {paragraph, 0.08},
+      {paragraph + " " + paragraph + " " + paragraph + " " + paragraph, 0.02},
+  };
+}
+
+bool ReadCorpus(const std::string& path, std::vector<WeightedText>* texts) {
+  std::ifstream file(path);
+  if (!file) {
+    fprintf(stderr, "Could not open corpus %s\n", path.c_str());
+    return false;
+  }
+  std::string line;
+  while (std::getline(file, line)) {
+    if (!line.empty()) {
+      texts->push_back({line, 1.0});
+    }
+  }
+  return !texts->empty();
+}
+
+bool StartsWith(const std::string& s, const std::string& prefix) {
+  return s.compare(0, prefix.size(), prefix) == 0;
+}
+
+bool ParseFlags(int argc, char** argv, LoadFlags* flags) {
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const std::string value = arg.substr(arg.find('=') + 1);
+    if (StartsWith(arg, "--model=")) {
+      flags->model = value;
+    } else if (StartsWith(arg, "--threads=")) {
+      flags->threads.clear();
+      for (const StringPiece num_threads : strings::Split(value, ',')) {
+        flags->threads.push_back(
+            std::max(1, atoi(num_threads.ToString().c_str())));
+      }
+    } else if (StartsWith(arg, "--rate=")) {
+      flags->rate = std::max(0.0, atof(value.c_str()));
+    } else if (StartsWith(arg, "--duration_ms=")) {
+      flags->duration_ms = std::max(1, atoi(value.c_str()));
+    } else if (StartsWith(arg, "--deployment=")) {
+      flags->shared = value == "shared" || value == "both";
+      flags->per_thread = value == "per_thread" || value == "both";
+      if (!flags->shared && !flags->per_thread) {
+        fprintf(stderr, "Unknown deployment: %s\n", value.c_str());
+        return false;
+      }
+    } else if (StartsWith(arg, "--api=")) {
+      if (value == "annotate") {
+        flags->api = Api::ANNOTATE;
+      } else if (value == "classify") {
+        flags->api = Api::CLASSIFY;
+      } else if (value == "suggest") {
+        flags->api = Api::SUGGEST;
+      } else if (value == "mixed") {
+        flags->api = Api::MIXED;
+      } else {
+        fprintf(stderr, "Unknown api: %s\n", value.c_str());
+        return false;
+      }
+    } else if (StartsWith(arg, "--corpus=")) {
+      flags->corpus = value;
+    } else {
+      fprintf(stderr, "Unknown flag: %s\n", arg.c_str());
+      return false;
+    }
+  }
+  if (flags->threads.empty()) {
+    fprintf(stderr, "No thread counts.\n");
+    return false;
+  }
+  return true;
+}
+
+// Sets the click of each text to the middle codepoint.
+void SetClicks(std::vector<WeightedText>* texts) {
+  for (WeightedText& text : *texts) {
+    const int num_codepoints =
+        UTF8ToUnicodeText(text.text, /*do_copy=*/false).size_codepoints();
+    const int middle = num_codepoints / 2;
+    text.click = {middle, std::min(middle + 1, num_codepoints)};
+  }
+}
+
+// Sends one request for the text. The mixed load does what a selection
+// does: a suggestion followed by a classification of the suggested span,
+// one time in two, and an annotation otherwise.
+void SendRequest(const TextClassifier& classifier, Api api,
+                 const WeightedText& text, std::mt19937* random) {
+  if (api == Api::MIXED) {
+    api = (*random)() % 2 == 0 ? Api::ANNOTATE : Api::CLASSIFY;
+  }
+  switch (api) {
+    case Api::ANNOTATE:
+      classifier.Annotate(text.text);
+      break;
+    case Api::CLASSIFY:
+      classifier.ClassifyText(
+          text.text, classifier.SuggestSelection(text.text, text.click));
+      break;
+    case Api::SUGGEST:
+      classifier.SuggestSelection(text.text, text.click);
+      break;
+    case Api::MIXED:
+      break;
+  }
+}
+
+// Sends requests to the classifier until the end time. With a rate, their
+// arrivals are a Poisson process of that rate, otherwise each request is
+// sent as soon as the last one returns.
+void RunThread(const TextClassifier& classifier, const LoadFlags& flags,
+               const std::vector<WeightedText>& texts, double thread_rate,
+               int seed, std::chrono::steady_clock::time_point start,
+               std::chrono::steady_clock::time_point end,
+               ThreadResult* result) {
+  std::mt19937 random(seed);
+  std::vector<double> weights;
+  for (const WeightedText& text : texts) {
+    weights.push_back(text.weight);
+  }
+  std::discrete_distribution<int> text_distribution(weights.begin(),
+                                                    weights.end());
+  std::exponential_distribution<double> interval_distribution(
+      thread_rate > 0 ? thread_rate : 1.0);
+
+  auto arrival = start;
+  while (true) {
+    if (thread_rate > 0) {
+      arrival +=
+          std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+              std::chrono::duration<double>(interval_distribution(random)));
+      if (arrival >= end) {
+        break;
+      }
+      std::this_thread::sleep_until(arrival);
+    } else {
+      arrival = std::chrono::steady_clock::now();
+      if (arrival >= end) {
+        break;
+      }
+    }
+    const WeightedText& text = texts[text_distribution(random)];
+    SendRequest(classifier, flags.api, text, &random);
+    result->latencies_nanos.push_back(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - arrival)
+            .count());
+    result->processed_bytes += text.text.size();
+  }
+}
+
+double Percentile(const std::vector<int64>& sorted_values, double percentile) {
+  if (sorted_values.empty()) {
+    return 0.0;
+  }
+  const int index = std::min<int>(sorted_values.size() - 1,
+                                  percentile / 100.0 * sorted_values.size());
+  return sorted_values[index];
+}
+
+// Runs the load on 'num_threads' threads, each sending its requests to
+// 'classifiers[thread % classifiers.size()]'.
+void RunLoad(const std::string& deployment,
+             const std::vector<std::unique_ptr<TextClassifier>>& classifiers,
+             int num_threads, const LoadFlags& flags,
+             const std::vector<WeightedText>& texts) {
+  const double thread_rate = flags.rate / num_threads;
+  std::vector<ThreadResult> thread_results(num_threads);
+  const auto start = std::chrono::steady_clock::now();
+  const auto end = start + std::chrono::milliseconds(flags.duration_ms);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; ++t) {
+    threads.emplace_back(RunThread,
+                         std::cref(*classifiers[t % classifiers.size()]),
+                         std::cref(flags), std::cref(texts), thread_rate,
+                         /*seed=*/t + 1, start, end, &thread_results[t]);
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  const double wall_seconds =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - start)
+          .count() /
+      1e9;
+
+  std::vector<int64> latencies_nanos;
+  int64 processed_bytes = 0;
+  for (const ThreadResult& thread_result : thread_results) {
+    latencies_nanos.insert(latencies_nanos.end(),
+                           thread_result.latencies_nanos.begin(),
+                           thread_result.latencies_nanos.end());
+    processed_bytes += thread_result.processed_bytes;
+  }
+  std::sort(latencies_nanos.begin(), latencies_nanos.end());
+  const double requests_per_second = latencies_nanos.size() / wall_seconds;
+  printf("  %-10s threads %3d  req/s %9.1f  req/s/thread %9.1f  KB/s %9.1f  "
+         "latency us p50 %9.1f  p99 %9.1f  p999 %9.1f  max %9.1f\n",
+         deployment.c_str(), num_threads, requests_per_second,
+         requests_per_second / num_threads,
+         processed_bytes / 1024.0 / wall_seconds,
+         Percentile(latencies_nanos, 50) / 1e3,
+         Percentile(latencies_nanos, 99) / 1e3,
+         Percentile(latencies_nanos, 99.9) / 1e3,
+         Percentile(latencies_nanos, 100) / 1e3);
+}
+
+bool LoadClassifiers(
+    const std::string& model_path, int num_classifiers,
+    std::vector<std::unique_ptr<TextClassifier>>* classifiers) {
+  while (classifiers->size() < num_classifiers) {
+    std::unique_ptr<TextClassifier> classifier =
+        TextClassifier::FromPath(model_path);
+    if (!classifier) {
+      fprintf(stderr, "Could not load model %s\n", model_path.c_str());
+      return false;
+    }
+    classifiers->push_back(std::move(classifier));
+  }
+  return true;
+}
+
+int RunLoads(const LoadFlags& flags) {
+  std::vector<WeightedText> texts;
+  if (flags.corpus.empty()) {
+    texts = BuiltinTexts();
+  } else if (!ReadCorpus(flags.corpus, &texts)) {
+    return 1;
+  }
+  SetClicks(&texts);
+
+  const std::string load =
+      flags.rate > 0 ? "open loop at " + std::to_string(flags.rate) + " req/s"
+                     : "closed loop";
+  printf("Model %s, %s, %d ms per run, hardware threads %u\n",
+         flags.model.c_str(), load.c_str(), flags.duration_ms,
+         std::thread::hardware_concurrency());
+
+  // The classifiers are loaded once and reused by the runs with more
+  // threads, and warmed up by one request per text.
+  std::vector<std::unique_ptr<TextClassifier>> shared_classifier;
+  std::vector<std::unique_ptr<TextClassifier>> per_thread_classifiers;
+  std::mt19937 random(0);
+  for (const int num_threads : flags.threads) {
+    if (flags.shared) {
+      if (!LoadClassifiers(flags.model, 1, &shared_classifier)) {
+        return 1;
+      }
+      for (const WeightedText& text : texts) {
+        SendRequest(*shared_classifier[0], flags.api, text, &random);
+      }
+      RunLoad("shared", shared_classifier, num_threads, flags, texts);
+    }
+    if (flags.per_thread) {
+      const int num_loaded = per_thread_classifiers.size();
+      if (!LoadClassifiers(flags.model, num_threads,
+                           &per_thread_classifiers)) {
+        return 1;
+      }
+      for (int i = num_loaded; i < per_thread_classifiers.size(); ++i) {
+        for (const WeightedText& text : texts) {
+          SendRequest(*per_thread_classifiers[i], flags.api, text, &random);
+        }
+      }
+      RunLoad("per_thread", per_thread_classifiers, num_threads, flags,
+              texts);
+    }
+  }
+  return 0;
+}
+
+}  // namespace
+}  // namespace libtextclassifier2
+
+int main(int argc, char** argv) {
+  libtextclassifier2::LoadFlags flags;
+  if (!libtextclassifier2::ParseFlags(argc, argv, &flags)) {
+    return 1;
+  }
+  return libtextclassifier2::RunLoads(flags);
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "model-agreement.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace libtextclassifier2 {
+namespace {
+
+std::string TopCollection(
+    const std::vector<ClassificationResult>& classification) {
+  return classification.empty() ? "" : classification[0].collection;
+}
+
+// Returns the score of the collection in the classification, or 0 if it is
+// not there.
+float CollectionScore(const std::vector<ClassificationResult>& classification,
+                      const std::string& collection) {
+  for (const ClassificationResult& result : classification) {
+    if (result.collection == collection) {
+      return result.score;
+    }
+  }
+  return 0.0f;
+}
+
+}  // namespace
+
+ModelAgreement CompareModels(const TextClassifier& reference,
+                             const TextClassifier& candidate,
+                             const std::vector<std::string>& texts) {
+  ModelAgreement agreement;
+  for (const std::string& text : texts) {
+    const std::vector<AnnotatedSpan> reference_annotations =
+        reference.Annotate(text);
+    const std::vector<AnnotatedSpan> candidate_annotations =
+        candidate.Annotate(text);
+
+    agreement.num_annotations += reference_annotations.size();
+    for (const AnnotatedSpan& annotation : reference_annotations) {
+      const auto same_annotation = [&annotation](const AnnotatedSpan& other) {
+        return other.span == annotation.span &&
+               TopCollection(other.classification) ==
+                   TopCollection(annotation.classification);
+      };
+      if (std::any_of(candidate_annotations.begin(),
+                      candidate_annotations.end(), same_annotation)) {
+        ++agreement.num_same_annotations;
+      }
+    }
+    for (const AnnotatedSpan& annotation : candidate_annotations) {
+      const auto same_span = [&annotation](const AnnotatedSpan& other) {
+        return other.span == annotation.span;
+      };
+      if (std::none_of(reference_annotations.begin(),
+                       reference_annotations.end(), same_span)) {
+        ++agreement.num_extra_annotations;
+      }
+    }
+
+    for (const AnnotatedSpan& annotation : reference_annotations) {
+      const CodepointSpan click = {annotation.span.first,
+                                   annotation.span.first + 1};
+      ++agreement.num_selections;
+      if (reference.SuggestSelection(text, click) ==
+          candidate.SuggestSelection(text, click)) {
+        ++agreement.num_same_selections;
+      }
+
+      const std::vector<ClassificationResult> reference_classification =
+          reference.ClassifyText(text, annotation.span);
+      const std::vector<ClassificationResult> candidate_classification =
+          candidate.ClassifyText(text, annotation.span);
+      ++agreement.num_classifications;
+      const std::string top_collection =
+          TopCollection(reference_classification);
+      if (top_collection == TopCollection(candidate_classification)) {
+        ++agreement.num_same_classifications;
+      }
+      agreement.max_score_difference = std::max(
+          agreement.max_score_difference,
+          std::fabs(CollectionScore(reference_classification, top_collection) -
+                    CollectionScore(candidate_classification, top_collection)));
+    }
+  }
+  return agreement;
+}
+
+}  // namespace libtextclassifier2
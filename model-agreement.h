@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Offline tool to check a converted model, e.g. one with uint8 quantized
+// selection and classification graphs, against the model it was converted
+// from, by how often the two agree on a set of texts.
+
+#ifndef LIBTEXTCLASSIFIER_MODEL_AGREEMENT_H_
+#define LIBTEXTCLASSIFIER_MODEL_AGREEMENT_H_
+
+#include <string>
+#include <vector>
+
+#include "text-classifier.h"
+
+namespace libtextclassifier2 {
+
+struct ModelAgreement {
+  // Annotations of the reference model, and how many of them the candidate
+  // model found with the same span and top collection.
+  int num_annotations = 0;
+  int num_same_annotations = 0;
+
+  // Annotations of the candidate model that the reference model doesn't have.
+  int num_extra_annotations = 0;
+
+  // SuggestSelection from the first codepoint of each reference annotation,
+  // and how many times both models suggested the same span.
+  int num_selections = 0;
+  int num_same_selections = 0;
+
+  // ClassifyText of the span of each reference annotation, how many times both
+  // models put the same collection first, and the largest difference of the
+  // score of the reference's top collection.
+  int num_classifications = 0;
+  int num_same_classifications = 0;
+  float max_score_difference = 0.0f;
+};
+
+// Runs both classifiers on the texts and counts where they agree.
+ModelAgreement CompareModels(const TextClassifier& reference,
+                             const TextClassifier& candidate,
+                             const std::vector<std::string>& texts);
+
+}  // namespace libtextclassifier2
+
+#endif  // LIBTEXTCLASSIFIER_MODEL_AGREEMENT_H_
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "model-agreement.h"
+
+#include <memory>
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+std::string GetModelPath() {
+  return LIBTEXTCLASSIFIER_TEST_DATA_DIR;
+}
+
+TEST(ModelAgreementTest, SameModelsAgree) {
+  CREATE_UNILIB_FOR_TESTING;
+  std::unique_ptr<TextClassifier> classifier =
+      TextClassifier::FromPath(GetModelPath() + "test_model.fb", &unilib);
+  ASSERT_TRUE(classifier);
+
+  const ModelAgreement agreement = CompareModels(
+      *classifier, *classifier,
+      {"call me at 857 225 3556 today",
+       "& saw Barack Obama today .. 350 Third Street, Cambridge"});
+  EXPECT_GT(agreement.num_annotations, 0);
+  EXPECT_EQ(agreement.num_same_annotations, agreement.num_annotations);
+  EXPECT_EQ(agreement.num_extra_annotations, 0);
+  EXPECT_EQ(agreement.num_selections, agreement.num_annotations);
+  EXPECT_EQ(agreement.num_same_selections, agreement.num_selections);
+  EXPECT_EQ(agreement.num_classifications, agreement.num_annotations);
+  EXPECT_EQ(agreement.num_same_classifications,
+            agreement.num_classifications);
+  EXPECT_EQ(agreement.max_score_difference, 0.0f);
+}
+
+TEST(ModelAgreementTest, CountsDisagreements) {
+  CREATE_UNILIB_FOR_TESTING;
+  std::unique_ptr<TextClassifier> classifier =
+      TextClassifier::FromPath(GetModelPath() + "test_model.fb", &unilib);
+  std::unique_ptr<TextClassifier> cc_classifier =
+      TextClassifier::FromPath(GetModelPath() + "test_model_cc.fb", &unilib);
+  ASSERT_TRUE(classifier);
+  ASSERT_TRUE(cc_classifier);
+
+  const ModelAgreement agreement = CompareModels(
+      *classifier, *cc_classifier, {"call me at 857 225 3556 today"});
+  EXPECT_LE(agreement.num_same_annotations, agreement.num_annotations);
+  EXPECT_LE(agreement.num_same_selections, agreement.num_selections);
+  EXPECT_LE(agreement.num_same_classifications,
+            agreement.num_classifications);
+  EXPECT_GE(agreement.max_score_difference, 0.0f);
+}
+
+}  // namespace
+}  // namespace libtextclassifier2
@@ -16,6 +16,8 @@
 
 #include "model-executor.h"
 
+#include <algorithm>
+
 #include "quantization.h"
 #include "util/base/logging.h"
 
@@ -32,21 +34,444 @@ bool FromModelSpec(const tflite::Model* model_spec,
 }
 }  // namespace internal
 
-std::unique_ptr<tflite::Interpreter> ModelExecutor::CreateInterpreter() const {
+namespace {
+// Runs the interpreter and returns its logits tensor, or nullptr on error.
+const TfLiteTensor* InvokeForLogits(const int output_index_logits,
+                                    tflite::Interpreter* interpreter) {
+  if (!interpreter) {
+    return nullptr;
+  }
+  if (interpreter->Invoke() != kTfLiteOk) {
+    TC_VLOG(1) << "Interpreter failed.";
+    return nullptr;
+  }
+  return interpreter->tensor(interpreter->outputs()[output_index_logits]);
+}
+
+std::vector<int> TensorShape(const TfLiteTensor* tensor) {
+  return std::vector<int>(tensor->dims->data,
+                          tensor->dims->data + tensor->dims->size);
+}
+
+// Dequantizes uint8 logits into a buffer of the thread, which stays valid
+// until the next call on the same thread.
+TensorView<float> DequantizeLogits(const TfLiteTensor* logits_tensor) {
+  static thread_local std::vector<float> dequantized_logits;
+  const std::vector<int> shape = TensorShape(logits_tensor);
+  const int size = internal::NumberOfElements(shape);
+  dequantized_logits.resize(size);
+  const float scale = logits_tensor->params.scale;
+  const int32 zero_point = logits_tensor->params.zero_point;
+  for (int i = 0; i < size; ++i) {
+    dequantized_logits[i] =
+        scale * (static_cast<int32>(logits_tensor->data.uint8[i]) - zero_point);
+  }
+  return TensorView<float>(dequantized_logits.data(), shape);
+}
+
+// Returns the float logits, or the uint8 ones dequantized.
+TensorView<float> ReadLogits(const TfLiteTensor* logits_tensor) {
+  if (logits_tensor->type == kTfLiteUInt8) {
+    return DequantizeLogits(logits_tensor);
+  }
+  if (logits_tensor->type != kTfLiteFloat32) {
+    return TensorView<float>::Invalid();
+  }
+  return TensorView<float>(logits_tensor->data.f, TensorShape(logits_tensor));
+}
+}  // namespace
+
+ModelExecutor::ModelExecutor(
+    std::unique_ptr<const tflite::FlatBufferModel> model,
+    const std::vector<int>& batch_size_buckets, const ExecutorOptions& options)
+    : model_(std::move(model)), options_(options) {
+  for (const int bucket : batch_size_buckets) {
+    if (bucket > 0) {
+      batch_size_buckets_.push_back(bucket);
+    }
+  }
+  std::sort(batch_size_buckets_.begin(), batch_size_buckets_.end());
+  batch_size_buckets_.erase(
+      std::unique(batch_size_buckets_.begin(), batch_size_buckets_.end()),
+      batch_size_buckets_.end());
+}
+
+std::unique_ptr<tflite::Interpreter> ModelExecutor::BuildInterpreter(
+    InterpreterResources* resources) const {
   std::unique_ptr<tflite::Interpreter> interpreter;
   tflite::InterpreterBuilder(*model_, builtins_)(&interpreter);
+  if (interpreter == nullptr) {
+    return nullptr;
+  }
+  if (options_.num_threads > 0) {
+    interpreter->SetNumThreads(options_.num_threads);
+  }
+
+  if (options_.delegate_factory) {
+    resources->delegate = options_.delegate_factory();
+    if (resources->delegate != nullptr &&
+        interpreter->ModifyGraphWithDelegate(resources->delegate.get()) !=
+            kTfLiteOk) {
+      TC_LOG(WARNING) << "Could not apply the delegate, running without it.";
+
+      // A failed delegation can leave the graph half-modified, so start over
+      // from a fresh interpreter, and only then free the delegate.
+      tflite::InterpreterBuilder(*model_, builtins_)(&interpreter);
+      if (interpreter == nullptr) {
+        return nullptr;
+      }
+      if (options_.num_threads > 0) {
+        interpreter->SetNumThreads(options_.num_threads);
+      }
+      resources->delegate.reset();
+    }
+  }
+  if (options_.use_nnapi && resources->delegate == nullptr) {
+    interpreter->UseNNAPI(true);
+  }
+
+#ifdef TFLITE_PROFILING_ENABLED
+  if (options_.enable_operator_profiling) {
+    resources->profiler.reset(new tflite::profiling::Profiler());
+    interpreter->SetProfiler(resources->profiler.get());
+  }
+#endif
   return interpreter;
 }
 
+std::unique_ptr<tflite::Interpreter> ModelExecutor::CreateInterpreter() const {
+  InterpreterResources resources;
+  std::unique_ptr<tflite::Interpreter> interpreter =
+      BuildInterpreter(&resources);
+  if (interpreter == nullptr) {
+    return nullptr;
+  }
+  {
+    // Replaces the resources of a destroyed interpreter at the same address.
+    std::lock_guard<std::mutex> lock(resources_mutex_);
+    interpreter_resources_[interpreter.get()] = std::move(resources);
+  }
+  if (batch_size_buckets_.empty() ||
+      interpreter->inputs().size() <= kInputIndexFeatures) {
+    return interpreter;
+  }
+
+  // Allocates the tensors for the largest bucket, so that the arena never has
+  // to grow for the smaller ones.
+  const TfLiteTensor* features_tensor =
+      interpreter->tensor(interpreter->inputs()[kInputIndexFeatures]);
+  std::vector<int> shape(features_tensor->dims->data,
+                         features_tensor->dims->data +
+                             features_tensor->dims->size);
+  if (!shape.empty()) {
+    shape[0] = batch_size_buckets_.back();
+    if (ResizeFeaturesInput(kInputIndexFeatures, shape, interpreter.get()) ==
+        nullptr) {
+      TC_LOG(ERROR) << "Could not allocate the interpreter tensors.";
+      DestroyInterpreter(std::move(interpreter));
+      return nullptr;
+    }
+  }
+  return interpreter;
+}
+
+void ModelExecutor::DestroyInterpreter(
+    std::unique_ptr<tflite::Interpreter> interpreter) const {
+  if (interpreter == nullptr) {
+    return;
+  }
+  const tflite::Interpreter* key = interpreter.get();
+  interpreter.reset();
+  std::lock_guard<std::mutex> lock(resources_mutex_);
+  interpreter_resources_.erase(key);
+}
+
+bool ModelExecutor::Invoke(tflite::Interpreter* interpreter) const {
+#ifdef TFLITE_PROFILING_ENABLED
+  tflite::profiling::Profiler* profiler = nullptr;
+  if (options_.enable_operator_profiling) {
+    std::lock_guard<std::mutex> lock(resources_mutex_);
+    auto it = interpreter_resources_.find(interpreter);
+    if (it != interpreter_resources_.end()) {
+      profiler = it->second.profiler.get();
+    }
+  }
+  if (profiler != nullptr) {
+    profiler->Reset();
+    profiler->StartProfiling();
+  }
+#endif
+
+  TfLiteStatus status = interpreter->Invoke();
+  if (status != kTfLiteOk && options_.use_nnapi) {
+    // NNAPI only fails when the model is run, so the interpreter switches to
+    // the CPU kernels on the first failure and keeps them.
+    TC_LOG(WARNING) << "Could not run the model with NNAPI, running without.";
+    interpreter->UseNNAPI(false);
+    status = interpreter->Invoke();
+  }
+
+#ifdef TFLITE_PROFILING_ENABLED
+  if (profiler != nullptr) {
+    profiler->StopProfiling();
+    std::lock_guard<std::mutex> lock(profile_mutex_);
+    for (const tflite::profiling::ProfileEvent* event :
+         profiler->GetProfileEvents()) {
+      if (event->event_type != tflite::profiling::ProfileEvent::EventType::
+                                   OPERATOR_INVOKE_EVENT) {
+        continue;
+      }
+      const int node_index = event->event_metadata;
+      if (node_index >= operator_profile_.size()) {
+        operator_profile_.resize(node_index + 1);
+      }
+      OperatorProfile& profile = operator_profile_[node_index];
+      profile.node_index = node_index;
+      profile.op_name = event->tag;
+      ++profile.num_invocations;
+      profile.total_micros +=
+          event->end_timestamp_us - event->begin_timestamp_us;
+    }
+  }
+#endif
+
+  if (status != kTfLiteOk) {
+    TC_VLOG(1) << "Interpreter failed.";
+    return false;
+  }
+  return true;
+}
+
+std::vector<OperatorProfile> ModelExecutor::GetOperatorProfile() const {
+  std::vector<OperatorProfile> result;
+  std::lock_guard<std::mutex> lock(profile_mutex_);
+  for (const OperatorProfile& profile : operator_profile_) {
+    if (profile.num_invocations > 0) {
+      result.push_back(profile);
+    }
+  }
+  return result;
+}
+
+int ModelExecutor::PaddedBatchSize(int batch_size) const {
+  auto it = std::lower_bound(batch_size_buckets_.begin(),
+                             batch_size_buckets_.end(), batch_size);
+  return it == batch_size_buckets_.end() ? batch_size : *it;
+}
+
+TensorView<float> ModelExecutor::ComputeLogits(
+    const TensorView<float>& features, tflite::Interpreter* interpreter) const {
+  if (features.dims() == 0) {
+    return TensorView<float>::Invalid();
+  }
+  const FeaturesInput input = PrepareFeaturesInput(features.shape(),
+                                                   interpreter);
+  if (input.floats != nullptr) {
+    features.copy_to(input.floats, features.size());
+  } else if (input.quantized != nullptr) {
+    for (int i = 0; i < features.size(); ++i) {
+      input.quantized[i] =
+          QuantizeValue(features.data()[i], input.quantization);
+    }
+  } else {
+    return TensorView<float>::Invalid();
+  }
+  return ComputeLogitsFromInput(features.dim(0), interpreter);
+}
+
+FeaturesInput ModelExecutor::PrepareFeaturesInput(
+    const std::vector<int>& shape, tflite::Interpreter* interpreter) const {
+  std::vector<int> padded_shape = shape;
+  if (!shape.empty()) {
+    padded_shape[0] = PaddedBatchSize(shape[0]);
+  }
+
+  FeaturesInput input;
+  const TfLiteTensor* features_tensor =
+      ResizeFeaturesInput(kInputIndexFeatures, padded_shape, interpreter);
+  if (features_tensor == nullptr) {
+    return input;
+  }
+  if (features_tensor->type == kTfLiteUInt8) {
+    input.quantized = features_tensor->data.uint8;
+    input.quantization.scale = features_tensor->params.scale;
+    input.quantization.zero_point = features_tensor->params.zero_point;
+  } else if (features_tensor->type == kTfLiteFloat32) {
+    input.floats = features_tensor->data.f;
+  } else {
+    TC_LOG(ERROR) << "Unsupported type of the features input.";
+    return input;
+  }
+
+  // The padding rows are left over from the previous batch otherwise.
+  if (!shape.empty() && padded_shape[0] != shape[0]) {
+    const int num_elements = internal::NumberOfElements(shape);
+    const int num_padded_elements = internal::NumberOfElements(padded_shape);
+    if (input.floats != nullptr) {
+      std::fill(input.floats + num_elements,
+                input.floats + num_padded_elements, 0.0f);
+    } else {
+      std::fill(input.quantized + num_elements,
+                input.quantized + num_padded_elements,
+                QuantizeValue(0.0f, input.quantization));
+    }
+  }
+  return input;
+}
+
+TensorView<float> ModelExecutor::ComputeLogitsFromInput(
+    int batch_size, tflite::Interpreter* interpreter) const {
+  if (!interpreter || !Invoke(interpreter)) {
+    return TensorView<float>::Invalid();
+  }
+  const TfLiteTensor* logits_tensor =
+      interpreter->tensor(interpreter->outputs()[kOutputIndexLogits]);
+  const TensorView<float> logits = ReadLogits(logits_tensor);
+  if (!logits.is_valid() || logits.dims() == 0 ||
+      logits.dim(0) <= batch_size) {
+    return logits;
+  }
+
+  // Drops the logits of the padding rows, which come last.
+  std::vector<int> shape = logits.shape();
+  shape[0] = batch_size;
+  return TensorView<float>(logits.data(), shape);
+}
+
+std::unique_ptr<tflite::Interpreter> InterpreterPool::Acquire() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!free_interpreters_.empty()) {
+      std::unique_ptr<tflite::Interpreter> interpreter =
+          std::move(free_interpreters_.back());
+      free_interpreters_.pop_back();
+      return interpreter;
+    }
+  }
+
+  // Creating the interpreter is slow, so do it outside of the lock.
+  std::unique_ptr<tflite::Interpreter> interpreter =
+      executor_->CreateInterpreter();
+  if (interpreter != nullptr) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++num_interpreters_;
+  }
+  return interpreter;
+}
+
+void InterpreterPool::Release(
+    std::unique_ptr<tflite::Interpreter> interpreter) {
+  if (interpreter == nullptr) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  free_interpreters_.push_back(std::move(interpreter));
+}
+
+bool InterpreterPool::Reserve(int num_interpreters) {
+  // Holds on to the acquired interpreters, so that the free ones are not
+  // acquired over and over again.
+  std::vector<std::unique_ptr<tflite::Interpreter>> interpreters;
+  bool success = true;
+  while (NumInterpreters() < num_interpreters) {
+    std::unique_ptr<tflite::Interpreter> interpreter = Acquire();
+    if (interpreter == nullptr) {
+      success = false;
+      break;
+    }
+    interpreters.push_back(std::move(interpreter));
+  }
+  for (auto& interpreter : interpreters) {
+    Release(std::move(interpreter));
+  }
+  return success;
+}
+
+InterpreterPool::~InterpreterPool() {
+  for (auto& interpreter : free_interpreters_) {
+    executor_->DestroyInterpreter(std::move(interpreter));
+  }
+}
+
+void InterpreterPool::ReleaseFreeInterpreters() {
+  std::vector<std::unique_ptr<tflite::Interpreter>> free_interpreters;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_interpreters.swap(free_interpreters_);
+    num_interpreters_ -= free_interpreters.size();
+  }
+  for (auto& interpreter : free_interpreters) {
+    executor_->DestroyInterpreter(std::move(interpreter));
+  }
+}
+
+int InterpreterPool::NumInterpreters() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_interpreters_;
+}
+
+int64 InterpreterPool::EstimateMemoryBytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (free_interpreters_.empty()) {
+    return 0;
+  }
+  // The tensors that the interpreter allocates, as opposed to the constant
+  // ones in the model buffer. Tensors that share arena space are counted
+  // separately, so it's an upper bound.
+  int64 idle_bytes = 0;
+  for (const auto& interpreter : free_interpreters_) {
+    for (int i = 0; i < interpreter->tensors_size(); ++i) {
+      const TfLiteTensor* tensor = interpreter->tensor(i);
+      if (tensor->allocation_type != kTfLiteMmapRo) {
+        idle_bytes += tensor->bytes;
+      }
+    }
+  }
+  // The interpreters in use are assumed to be like the idle ones.
+  return idle_bytes * num_interpreters_ / free_interpreters_.size();
+}
+
+namespace {
+// Returns the number of features of the i-th token for AddEmbeddingsBatch().
+int NumTokenFeatures(const std::vector<int>& sparse_features,
+                     const std::vector<int>& token_starts, int i) {
+  const int token_end = (i + 1 < token_starts.size()) ? token_starts[i + 1]
+                                                      : sparse_features.size();
+  return token_end - token_starts[i];
+}
+}  // namespace
+
+bool EmbeddingExecutor::AddEmbeddingsBatch(
+    const std::vector<int>& sparse_features,
+    const std::vector<int>& token_starts, const std::vector<float*>& dests,
+    int dest_size) const {
+  if (token_starts.size() != dests.size()) {
+    TC_LOG(ERROR) << "Mismatching number of tokens and destinations.";
+    return false;
+  }
+  for (int i = 0; i < token_starts.size(); ++i) {
+    if (!AddEmbedding(
+            TensorView<int>(
+                sparse_features.data() + token_starts[i],
+                {NumTokenFeatures(sparse_features, token_starts, i)}),
+            dests[i], dest_size)) {
+      return false;
+    }
+  }
+  return true;
+}
+
 std::unique_ptr<TFLiteEmbeddingExecutor> TFLiteEmbeddingExecutor::Instance(
     const flatbuffers::Vector<uint8_t>* model_spec_buffer, int embedding_size,
-    int quantization_bits) {
+    int quantization_bits, bool dequantize_embeddings, bool verify,
+    const float* shared_dequantized_embeddings,
+    int64 shared_dequantized_embeddings_size) {
   const tflite::Model* model_spec =
       flatbuffers::GetRoot<tflite::Model>(model_spec_buffer->data());
   flatbuffers::Verifier verifier(model_spec_buffer->data(),
                                  model_spec_buffer->Length());
   std::unique_ptr<const tflite::FlatBufferModel> model;
-  if (!model_spec->Verify(verifier) ||
+  if ((verify && !model_spec->Verify(verifier)) ||
       !internal::FromModelSpec(model_spec, &model)) {
     TC_LOG(ERROR) << "Could not load TFLite model.";
     return nullptr;
@@ -80,9 +505,21 @@ std::unique_ptr<TFLiteEmbeddingExecutor> TFLiteEmbeddingExecutor::Instance(
     return nullptr;
   }
 
-  return std::unique_ptr<TFLiteEmbeddingExecutor>(new TFLiteEmbeddingExecutor(
+  std::unique_ptr<TFLiteEmbeddingExecutor> executor(new TFLiteEmbeddingExecutor(
       std::move(model), quantization_bits, num_buckets, bytes_per_embedding,
       embedding_size, scales, embeddings, std::move(interpreter)));
+  if (shared_dequantized_embeddings != nullptr) {
+    if (shared_dequantized_embeddings_size !=
+        executor->NumDequantizedEmbeddingValues()) {
+      TC_LOG(ERROR) << "Mismatching size of the shared embeddings.";
+      return nullptr;
+    }
+    executor->dequantized_embeddings_data_ = shared_dequantized_embeddings;
+  } else if (dequantize_embeddings && !executor->DequantizeEmbeddings()) {
+    TC_LOG(ERROR) << "Could not dequantize the embeddings.";
+    return nullptr;
+  }
+  return executor;
 }
 
 TFLiteEmbeddingExecutor::TFLiteEmbeddingExecutor(
@@ -99,6 +536,42 @@ TFLiteEmbeddingExecutor::TFLiteEmbeddingExecutor(
       embeddings_(embeddings),
       interpreter_(std::move(interpreter)) {}
 
+bool TFLiteEmbeddingExecutor::DequantizeEmbeddings() {
+  std::vector<float> dequantized(
+      static_cast<size_t>(num_buckets_) * output_embedding_size_, 0.0);
+  for (int bucket_id = 0; bucket_id < num_buckets_; ++bucket_id) {
+    if (!DequantizeAdd(scales_->data.f, embeddings_->data.uint8,
+                       bytes_per_embedding_, /*num_sparse_features=*/1,
+                       quantization_bits_, bucket_id,
+                       dequantized.data() + bucket_id * output_embedding_size_,
+                       output_embedding_size_)) {
+      return false;
+    }
+  }
+  dequantized_embeddings_ = std::move(dequantized);
+  dequantized_embeddings_data_ = dequantized_embeddings_.data();
+  return true;
+}
+
+bool TFLiteEmbeddingExecutor::AddBucketEmbedding(int bucket_id,
+                                                 int num_sparse_features,
+                                                 float* dest,
+                                                 int dest_size) const {
+  if (dequantized_embeddings_data_ == nullptr) {
+    return DequantizeAdd(scales_->data.f, embeddings_->data.uint8,
+                         bytes_per_embedding_, num_sparse_features,
+                         quantization_bits_, bucket_id, dest, dest_size);
+  }
+
+  const float factor = 1.0 / num_sparse_features;
+  const float* row =
+      dequantized_embeddings_data_ + bucket_id * output_embedding_size_;
+  for (int k = 0; k < dest_size; ++k) {
+    dest[k] += row[k] * factor;
+  }
+  return true;
+}
+
 bool TFLiteEmbeddingExecutor::AddEmbedding(
     const TensorView<int>& sparse_features, float* dest, int dest_size) const {
   if (dest_size != output_embedding_size_) {
@@ -113,9 +586,8 @@ bool TFLiteEmbeddingExecutor::AddEmbedding(
       return false;
     }
 
-    if (!DequantizeAdd(scales_->data.f, embeddings_->data.uint8,
-                       bytes_per_embedding_, num_sparse_features,
-                       quantization_bits_, bucket_id, dest, dest_size)) {
+    if (!AddBucketEmbedding(bucket_id, num_sparse_features, dest,
+                            dest_size)) {
       return false;
     }
   }
@@ -126,37 +598,137 @@ TensorView<float> ComputeLogitsHelper(const int input_index_features,
                                       const int output_index_logits,
                                       const TensorView<float>& features,
                                       tflite::Interpreter* interpreter) {
-  if (!interpreter) {
+  float* input = PrepareFeaturesInputHelper(input_index_features,
+                                            features.shape(), interpreter);
+  if (input == nullptr) {
     return TensorView<float>::Invalid();
   }
-  interpreter->ResizeInputTensor(input_index_features, features.shape());
-  if (interpreter->AllocateTensors() != kTfLiteOk) {
-    TC_VLOG(1) << "Allocation failed.";
-    return TensorView<float>::Invalid();
+  features.copy_to(input, features.size());
+  return InvokeHelper(output_index_logits, interpreter);
+}
+
+const TfLiteTensor* ResizeFeaturesInput(const int input_index_features,
+                                        const std::vector<int>& shape,
+                                        tflite::Interpreter* interpreter) {
+  if (!interpreter) {
+    return nullptr;
   }
 
-  TfLiteTensor* features_tensor =
+  // Resizing makes the interpreter re-plan all of its tensors, so skip it
+  // when the input keeps the shape of the previous call.
+  const TfLiteTensor* features_tensor =
       interpreter->tensor(interpreter->inputs()[input_index_features]);
+  bool same_shape = features_tensor->data.raw != nullptr &&
+                    features_tensor->dims->size == shape.size();
+  for (int i = 0; same_shape && i < shape.size(); ++i) {
+    same_shape = features_tensor->dims->data[i] == shape[i];
+  }
+  if (!same_shape) {
+    interpreter->ResizeInputTensor(input_index_features, shape);
+    if (interpreter->AllocateTensors() != kTfLiteOk) {
+      TC_VLOG(1) << "Allocation failed.";
+      return nullptr;
+    }
+    features_tensor =
+        interpreter->tensor(interpreter->inputs()[input_index_features]);
+  }
+
   int size = 1;
   for (int i = 0; i < features_tensor->dims->size; ++i) {
     size *= features_tensor->dims->data[i];
   }
-  features.copy_to(features_tensor->data.f, size);
+  if (size != internal::NumberOfElements(shape)) {
+    TC_VLOG(1) << "Mismatching size of the input tensor.";
+    return nullptr;
+  }
+  return features_tensor;
+}
 
-  if (interpreter->Invoke() != kTfLiteOk) {
-    TC_VLOG(1) << "Interpreter failed.";
+float* PrepareFeaturesInputHelper(const int input_index_features,
+                                  const std::vector<int>& shape,
+                                  tflite::Interpreter* interpreter) {
+  const TfLiteTensor* features_tensor =
+      ResizeFeaturesInput(input_index_features, shape, interpreter);
+  if (features_tensor == nullptr || features_tensor->type != kTfLiteFloat32) {
+    return nullptr;
+  }
+  return features_tensor->data.f;
+}
+
+TensorView<float> InvokeHelper(const int output_index_logits,
+                               tflite::Interpreter* interpreter) {
+  const TfLiteTensor* logits_tensor =
+      InvokeForLogits(output_index_logits, interpreter);
+  if (logits_tensor == nullptr || logits_tensor->type != kTfLiteFloat32) {
+    return TensorView<float>::Invalid();
+  }
+  return TensorView<float>(logits_tensor->data.f, TensorShape(logits_tensor));
+}
+
+TensorView<float> InvokeAndDequantize(const int output_index_logits,
+                                      tflite::Interpreter* interpreter) {
+  const TfLiteTensor* logits_tensor =
+      InvokeForLogits(output_index_logits, interpreter);
+  if (logits_tensor == nullptr || logits_tensor->type != kTfLiteUInt8) {
     return TensorView<float>::Invalid();
   }
 
-  TfLiteTensor* logits_tensor =
-      interpreter->tensor(interpreter->outputs()[output_index_logits]);
+  return DequantizeLogits(logits_tensor);
+}
 
-  std::vector<int> output_shape(logits_tensor->dims->size);
-  for (int i = 0; i < logits_tensor->dims->size; ++i) {
-    output_shape[i] = logits_tensor->dims->data[i];
+bool TFLiteEmbeddingExecutor::AddEmbeddingsBatch(
+    const std::vector<int>& sparse_features,
+    const std::vector<int>& token_starts, const std::vector<float*>& dests,
+    int dest_size) const {
+  if (dest_size != output_embedding_size_) {
+    TC_LOG(ERROR) << "Mismatching dest_size and output_embedding_size: "
+                  << dest_size << " " << output_embedding_size_;
+    return false;
+  }
+  if (token_starts.size() != dests.size()) {
+    TC_LOG(ERROR) << "Mismatching number of tokens and destinations.";
+    return false;
+  }
+
+  // Pairs of (bucket id, token index), one per lookup.
+  std::vector<std::pair<int, int>> lookups;
+  lookups.reserve(sparse_features.size());
+  for (int i = 0; i < token_starts.size(); ++i) {
+    const int token_end = token_starts[i] +
+                          NumTokenFeatures(sparse_features, token_starts, i);
+    for (int j = token_starts[i]; j < token_end; ++j) {
+      if (sparse_features[j] >= num_buckets_) {
+        return false;
+      }
+      lookups.push_back({sparse_features[j], i});
+    }
   }
+  std::sort(lookups.begin(), lookups.end());
 
-  return TensorView<float>(logits_tensor->data.f, output_shape);
+  // How many lookups ahead to prefetch the embedding row.
+  static const int kPrefetchDistance = 4;
+  const uint8* embeddings = embeddings_->data.uint8;
+  const float* dequantized_embeddings = dequantized_embeddings_data_;
+  for (int i = 0; i < lookups.size(); ++i) {
+    if (i + kPrefetchDistance < lookups.size()) {
+      const int prefetch_bucket_id = lookups[i + kPrefetchDistance].first;
+      if (dequantized_embeddings == nullptr) {
+        __builtin_prefetch(embeddings +
+                           prefetch_bucket_id * bytes_per_embedding_);
+      } else {
+        __builtin_prefetch(dequantized_embeddings +
+                           prefetch_bucket_id * output_embedding_size_);
+      }
+    }
+    const int token = lookups[i].second;
+    if (!AddBucketEmbedding(
+            lookups[i].first,
+            NumTokenFeatures(sparse_features, token_starts, token),
+            dests[token], dest_size)) {
+      return false;
+    }
+  }
+  return true;
 }
 
 }  // namespace libtextclassifier2
@@ -19,7 +19,12 @@
 #ifndef LIBTEXTCLASSIFIER_MODEL_EXECUTOR_H_
 #define LIBTEXTCLASSIFIER_MODEL_EXECUTOR_H_
 
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "tensor-view.h"
 #include "types.h"
@@ -27,6 +32,9 @@
 #include "tensorflow/contrib/lite/interpreter.h"
 #include "tensorflow/contrib/lite/kernels/register.h"
 #include "tensorflow/contrib/lite/model.h"
+#ifdef TFLITE_PROFILING_ENABLED
+#include "tensorflow/contrib/lite/profiling/profiler.h"
+#endif
 
 namespace libtextclassifier2 {
 
@@ -35,6 +43,77 @@ bool FromModelSpec(const tflite::Model* model_spec,
                    std::unique_ptr<const tflite::FlatBufferModel>* model);
 }  // namespace internal
 
+// The affine quantization of a uint8 tensor: a value v stands for
+// scale * (v - zero_point).
+struct TensorQuantization {
+  float scale = 1.0f;
+  int32 zero_point = 0;
+
+  bool operator==(const TensorQuantization& other) const {
+    return scale == other.scale && zero_point == other.zero_point;
+  }
+};
+
+// Quantizes the value to the nearest uint8, saturating.
+inline uint8 QuantizeValue(float value,
+                           const TensorQuantization& quantization) {
+  const float quantized =
+      quantization.zero_point + value / quantization.scale + 0.5f;
+  if (quantized <= 0.0f) {
+    return 0;
+  }
+  if (quantized >= 255.0f) {
+    return 255;
+  }
+  return static_cast<uint8>(quantized);
+}
+
+// The buffer of the features input tensor of a model, for the caller to write
+// the features into: 'floats' for float models, or 'quantized' for models
+// that take the features quantized to uint8 with 'quantization'.
+struct FeaturesInput {
+  float* floats = nullptr;
+  uint8* quantized = nullptr;
+  TensorQuantization quantization;
+
+  bool is_valid() const { return floats != nullptr || quantized != nullptr; }
+};
+
+// An owned TFLite delegate, with the function that frees it.
+typedef std::unique_ptr<TfLiteDelegate, std::function<void(TfLiteDelegate*)>>
+    DelegatePtr;
+
+// Options for the TFLite interpreters of a ModelExecutor.
+struct ExecutorOptions {
+  // The number of threads each inference may use, e.g. several for the large
+  // batches of annotation jobs on servers. -1 keeps the TFLite default.
+  int num_threads = -1;
+
+  // Creates a delegate, e.g. XNNPACK or GPU, for each new interpreter. The
+  // interpreters for which it returns nullptr, or whose model the delegate
+  // can not take, run on the next option: NNAPI if enabled, or the CPU
+  // kernels otherwise.
+  std::function<DelegatePtr()> delegate_factory;
+
+  // Runs the models with the Android Neural Networks API. The interpreters
+  // fall back to the CPU kernels for good when NNAPI fails to run the model,
+  // e.g. where it is not available.
+  bool use_nnapi = false;
+
+  // Measures the time spent in each operator of the models, see
+  // ModelExecutor::GetOperatorProfile(). Needs TFLite built with
+  // TFLITE_PROFILING_ENABLED, and is ignored otherwise.
+  bool enable_operator_profiling = false;
+};
+
+// The time spent in one operator of a model, summed over its invocations.
+struct OperatorProfile {
+  int node_index = -1;
+  std::string op_name;
+  int64 num_invocations = 0;
+  int64 total_micros = 0;
+};
+
 // A helper function that given indices of feature and logits tensor, feature
 // values computes the logits using given interpreter.
 TensorView<float> ComputeLogitsHelper(const int input_index_features,
@@ -42,49 +121,183 @@ TensorView<float> ComputeLogitsHelper(const int input_index_features,
                                       const TensorView<float>& features,
                                       tflite::Interpreter* interpreter);
 
+// Resizes the features input tensor of the interpreter to the given shape, if
+// it does not have that shape already, and returns its buffer, for the caller
+// to write the features into directly. Returns nullptr on error, or if the
+// tensor is not a float one.
+float* PrepareFeaturesInputHelper(const int input_index_features,
+                                  const std::vector<int>& shape,
+                                  tflite::Interpreter* interpreter);
+
+// Same as PrepareFeaturesInputHelper, but returns the tensor, of any type.
+const TfLiteTensor* ResizeFeaturesInput(const int input_index_features,
+                                        const std::vector<int>& shape,
+                                        tflite::Interpreter* interpreter);
+
+// Runs the interpreter on the input already in its tensor and returns the
+// logits. Fails for quantized logits.
+TensorView<float> InvokeHelper(const int output_index_logits,
+                               tflite::Interpreter* interpreter);
+
+// Same as above, for uint8 quantized logits, which are dequantized to a
+// buffer of the thread. The result is valid until the next call on the same
+// thread.
+TensorView<float> InvokeAndDequantize(const int output_index_logits,
+                                      tflite::Interpreter* interpreter);
+
 // Executor for the text selection prediction and classification models.
 class ModelExecutor {
  public:
+  // The flatbuffer verification can be skipped for a model buffer that is
+  // known to be valid, see LoadOptions::trusted_model_fingerprint.
+  //
+  // The batches are padded with zero rows up to the smallest of the
+  // 'batch_size_buckets' that fits them, so that consecutive batches mostly
+  // keep the same input shape and the interpreter does not re-plan its
+  // tensors between them. Batches larger than all the buckets are not padded.
+  // The interpreters are allocated for the largest bucket up front.
   static std::unique_ptr<const ModelExecutor> Instance(
-      const flatbuffers::Vector<uint8_t>* model_spec_buffer) {
+      const flatbuffers::Vector<uint8_t>* model_spec_buffer,
+      bool verify = true, const std::vector<int>& batch_size_buckets = {},
+      const ExecutorOptions& options = ExecutorOptions()) {
     const tflite::Model* model =
         flatbuffers::GetRoot<tflite::Model>(model_spec_buffer->data());
     flatbuffers::Verifier verifier(model_spec_buffer->data(),
                                    model_spec_buffer->Length());
-    if (!model->Verify(verifier)) {
+    if (verify && !model->Verify(verifier)) {
       return nullptr;
     }
-    return Instance(model);
+    return Instance(model, batch_size_buckets, options);
   }
 
   static std::unique_ptr<const ModelExecutor> Instance(
-      const tflite::Model* model_spec) {
+      const tflite::Model* model_spec,
+      const std::vector<int>& batch_size_buckets = {},
+      const ExecutorOptions& options = ExecutorOptions()) {
     std::unique_ptr<const tflite::FlatBufferModel> model;
     if (!internal::FromModelSpec(model_spec, &model)) {
       return nullptr;
     }
-    return std::unique_ptr<ModelExecutor>(new ModelExecutor(std::move(model)));
+    return std::unique_ptr<ModelExecutor>(
+        new ModelExecutor(std::move(model), batch_size_buckets, options));
   }
 
   // Creates an Interpreter for the model that serves as a scratch-pad for the
   // inference. The Interpreter is NOT thread-safe.
   std::unique_ptr<tflite::Interpreter> CreateInterpreter() const;
 
+  // Destroys an interpreter created by CreateInterpreter(), together with its
+  // delegate and profiler. Interpreters that are destroyed otherwise keep
+  // those until the executor is destroyed, or until a new interpreter gets
+  // the same address.
+  void DestroyInterpreter(
+      std::unique_ptr<tflite::Interpreter> interpreter) const;
+
+  // Models with uint8 quantized features input and logits output are run on
+  // the features quantized to the input, and the logits are dequantized. The
+  // dequantized logits stay valid until the next call on the same thread.
+  // Hybrid models, with quantized weights only, take floats.
   TensorView<float> ComputeLogits(const TensorView<float>& features,
-                                  tflite::Interpreter* interpreter) const {
-    return ComputeLogitsHelper(kInputIndexFeatures, kOutputIndexLogits,
-                               features, interpreter);
-  }
+                                  tflite::Interpreter* interpreter) const;
+
+  // Same as ComputeLogits, but in two steps so that the features can be
+  // written straight into the input tensor of the interpreter: first returns
+  // the buffer for the features of the given shape (invalid on error), in
+  // floats or already quantized, then computes the logits of the first
+  // 'batch_size' rows from what was written there.
+  FeaturesInput PrepareFeaturesInput(const std::vector<int>& shape,
+                                     tflite::Interpreter* interpreter) const;
+
+  TensorView<float> ComputeLogitsFromInput(
+      int batch_size, tflite::Interpreter* interpreter) const;
+
+  // Returns the batch size that a batch of 'batch_size' rows is padded to.
+  int PaddedBatchSize(int batch_size) const;
+
+  // Returns the time spent in each operator of the model since the executor
+  // was created, by node index, if ExecutorOptions::enable_operator_profiling
+  // is on. Empty otherwise.
+  std::vector<OperatorProfile> GetOperatorProfile() const;
 
  protected:
-  explicit ModelExecutor(std::unique_ptr<const tflite::FlatBufferModel> model)
-      : model_(std::move(model)) {}
+  ModelExecutor(std::unique_ptr<const tflite::FlatBufferModel> model,
+                const std::vector<int>& batch_size_buckets,
+                const ExecutorOptions& options);
+
+  // What an interpreter uses that has to outlive it.
+  struct InterpreterResources {
+    DelegatePtr delegate;
+#ifdef TFLITE_PROFILING_ENABLED
+    std::unique_ptr<tflite::profiling::Profiler> profiler;
+#endif
+  };
+
+  // Builds an interpreter with the threads and delegates of the options.
+  std::unique_ptr<tflite::Interpreter> BuildInterpreter(
+      InterpreterResources* resources) const;
+
+  // Runs the interpreter on the input in its tensor, with the NNAPI fallback
+  // and the operator profiling.
+  bool Invoke(tflite::Interpreter* interpreter) const;
 
   static const int kInputIndexFeatures = 0;
   static const int kOutputIndexLogits = 0;
 
   std::unique_ptr<const tflite::FlatBufferModel> model_;
   tflite::ops::builtin::BuiltinOpResolver builtins_;
+
+  // Sorted, positive and unique.
+  std::vector<int> batch_size_buckets_;
+
+  const ExecutorOptions options_;
+
+  mutable std::mutex resources_mutex_;
+  mutable std::unordered_map<const tflite::Interpreter*, InterpreterResources>
+      interpreter_resources_;
+
+  mutable std::mutex profile_mutex_;
+  mutable std::vector<OperatorProfile> operator_profile_;
+};
+
+// A thread-safe pool of TFLite interpreters for a single model executor.
+// Interpreters are created lazily and kept around after they are returned, so
+// that the allocation of the tensors is paid only once per interpreter, not
+// once per request.
+class InterpreterPool {
+ public:
+  // Does not take ownership of the executor, which must outlive the pool.
+  explicit InterpreterPool(const ModelExecutor* executor)
+      : executor_(executor) {}
+  ~InterpreterPool();
+
+  // Takes an interpreter out of the pool, or creates a new one when the pool
+  // is empty. Returns nullptr if the interpreter could not be created.
+  std::unique_ptr<tflite::Interpreter> Acquire();
+
+  // Puts an interpreter back into the pool to be re-used by later Acquire()
+  // calls. Null interpreters are ignored.
+  void Release(std::unique_ptr<tflite::Interpreter> interpreter);
+
+  // Creates interpreters until the pool has created at least
+  // 'num_interpreters'. Returns false if an interpreter could not be created.
+  bool Reserve(int num_interpreters);
+
+  // Frees the interpreters that are not in use.
+  void ReleaseFreeInterpreters();
+
+  // Returns the number of interpreters created by the pool, in use or not.
+  int NumInterpreters() const;
+
+  // Returns an estimate of the memory held by the tensors of the
+  // interpreters, measured on the idle ones.
+  int64 EstimateMemoryBytes() const;
+
+ private:
+  const ModelExecutor* executor_;
+
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<tflite::Interpreter>> free_interpreters_;
+  int num_interpreters_ = 0;
 };
 
 // Executor for embedding sparse features into a dense vector.
@@ -97,19 +310,65 @@ class EmbeddingExecutor {
   virtual bool AddEmbedding(const TensorView<int>& sparse_features, float* dest,
                             int dest_size) const = 0;
 
+  // Embeds the sparse features of multiple tokens at once, and adds (+) the
+  // embedding of the i-th token element-wise to dests[i]. The features of the
+  // i-th token are sparse_features[token_starts[i]] up to (excluding)
+  // sparse_features[token_starts[i + 1]], or the end for the last token.
+  // Implementations are free to reorder the lookups across tokens.
+  virtual bool AddEmbeddingsBatch(const std::vector<int>& sparse_features,
+                                  const std::vector<int>& token_starts,
+                                  const std::vector<float*>& dests,
+                                  int dest_size) const;
+
   // Returns true when the model is ready to be used, false otherwise.
   virtual bool IsReady() const { return true; }
+
+  // Returns the number of bytes the executor allocated on top of the model
+  // buffer, e.g. for a dequantized copy of the embeddings.
+  virtual int64 ExtraMemoryBytes() const { return 0; }
 };
 
 class TFLiteEmbeddingExecutor : public EmbeddingExecutor {
  public:
+  // If 'dequantize_embeddings' is true, the quantized embedding table is
+  // dequantized into a float table of num_buckets * embedding_size values
+  // once, and the embedding lookups read the floats directly. This trades
+  // memory for speed. If 'verify' is false, the flatbuffer verification of
+  // the model is skipped, as for ModelExecutor::Instance.
+  // If 'shared_dequantized_embeddings' is set, the lookups read that table
+  // instead, e.g. one published for many processes, see shared-model-data.h.
+  // It is not owned and must have num_buckets * embedding_size values, as
+  // given by 'shared_dequantized_embeddings_size'.
   static std::unique_ptr<TFLiteEmbeddingExecutor> Instance(
       const flatbuffers::Vector<uint8_t>* model_spec_buffer, int embedding_size,
-      int quantization_bits);
+      int quantization_bits, bool dequantize_embeddings = false,
+      bool verify = true, const float* shared_dequantized_embeddings = nullptr,
+      int64 shared_dequantized_embeddings_size = 0);
 
   bool AddEmbedding(const TensorView<int>& sparse_features, float* dest,
                     int dest_size) const override;
 
+  // Sorts the lookups of all the tokens by bucket, so that the embedding rows
+  // are read in memory order and each row is read once while it is hot in the
+  // cache, however many tokens use it.
+  bool AddEmbeddingsBatch(const std::vector<int>& sparse_features,
+                          const std::vector<int>& token_starts,
+                          const std::vector<float*>& dests,
+                          int dest_size) const override;
+
+  int64 ExtraMemoryBytes() const override {
+    return dequantized_embeddings_.size() * sizeof(float);
+  }
+
+  // The row-major num_buckets x embedding_size table of the dequantized
+  // embeddings, or nullptr if the embeddings are dequantized on the fly.
+  const float* DequantizedEmbeddings() const {
+    return dequantized_embeddings_data_;
+  }
+  int64 NumDequantizedEmbeddingValues() const {
+    return static_cast<int64>(num_buckets_) * output_embedding_size_;
+  }
+
  protected:
   explicit TFLiteEmbeddingExecutor(
       std::unique_ptr<const tflite::FlatBufferModel> model,
@@ -118,6 +377,14 @@ class TFLiteEmbeddingExecutor : public EmbeddingExecutor {
       const TfLiteTensor* embeddings,
       std::unique_ptr<tflite::Interpreter> interpreter);
 
+  // Dequantizes the whole embedding table into dequantized_embeddings_.
+  bool DequantizeEmbeddings();
+
+  // Adds the embedding of one bucket, divided by 'num_sparse_features', to
+  // the dest vector.
+  bool AddBucketEmbedding(int bucket_id, int num_sparse_features, float* dest,
+                          int dest_size) const;
+
   std::unique_ptr<const tflite::FlatBufferModel> model_;
 
   int quantization_bits_;
@@ -127,6 +394,15 @@ class TFLiteEmbeddingExecutor : public EmbeddingExecutor {
   const TfLiteTensor* scales_ = nullptr;
   const TfLiteTensor* embeddings_ = nullptr;
 
+  // Row-major num_buckets_ x output_embedding_size_ table of the dequantized
+  // embeddings. Empty when the embeddings are dequantized on the fly or read
+  // from a shared table.
+  std::vector<float> dequantized_embeddings_;
+
+  // The table of the lookups, either dequantized_embeddings_ or the shared
+  // one. nullptr when the embeddings are dequantized on the fly.
+  const float* dequantized_embeddings_data_ = nullptr;
+
   // NOTE: This interpreter is used in a read-only way (as a storage for the
   // model params), thus is still thread-safe.
   std::unique_ptr<tflite::Interpreter> interpreter_;
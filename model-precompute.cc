@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "model-precompute.h"
+
+#include <algorithm>
+#include <memory>
+
+#include "tokenizer.h"
+#include "util/hash/farmhash.h"
+#include "util/utf8/multi-regex.h"
+#include "zlib-utils.h"
+
+namespace libtextclassifier2 {
+
+void PrecomputeFeatureProcessorTables(
+    const FeatureProcessorOptions* options,
+    FeatureProcessorOptionsT* unpacked_options) {
+  std::vector<uint64_t>& fingerprints =
+      unpacked_options->allowed_chargram_fingerprints;
+  for (const std::string& chargram : unpacked_options->allowed_chargrams) {
+    fingerprints.push_back(tc2farmhash::Fingerprint64(chargram));
+  }
+  std::sort(fingerprints.begin(), fingerprints.end());
+  fingerprints.erase(std::unique(fingerprints.begin(), fingerprints.end()),
+                     fingerprints.end());
+  unpacked_options->allowed_chargrams.clear();
+
+  // Built from the packed options, as the tokenizer takes its ranges.
+  std::vector<const TokenizationCodepointRange*> codepoint_ranges;
+  if (options->tokenization_codepoint_config() != nullptr) {
+    codepoint_ranges.assign(options->tokenization_codepoint_config()->begin(),
+                            options->tokenization_codepoint_config()->end());
+  }
+  const Tokenizer tokenizer(codepoint_ranges,
+                            options->tokenize_on_script_change());
+  std::unique_ptr<FeatureProcessorOptions_::CodepointPageTableT> page_table(
+      new FeatureProcessorOptions_::CodepointPageTableT);
+  if (tokenizer.GetCodepointPageTable(page_table.get())) {
+    unpacked_options->tokenizer_codepoint_page_table = std::move(page_table);
+  } else {
+    unpacked_options->tokenizer_codepoint_page_table.reset();
+  }
+}
+
+bool PrecomputeMultiRegexPrograms(const RegexModel* regex_model,
+                                  RegexModelT* unpacked_regex_model) {
+  if (regex_model->patterns() == nullptr ||
+      regex_model->patterns()->size() !=
+          unpacked_regex_model->patterns.size()) {
+    return true;
+  }
+
+  // The patterns share one decompression stream, so they are decompressed in
+  // order.
+  std::unique_ptr<ZlibDecompressor> decompressor = ZlibDecompressor::Instance();
+  std::vector<std::string> pattern_texts;
+  for (const auto& regex_pattern : *regex_model->patterns()) {
+    pattern_texts.emplace_back();
+    if (!UncompressRegexPatternText(regex_pattern->pattern(),
+                                    regex_pattern->compressed_pattern(),
+                                    decompressor.get(),
+                                    &pattern_texts.back())) {
+      return false;
+    }
+  }
+
+  const std::unique_ptr<MultiRegex> multi_regex =
+      MultiRegex::Create(pattern_texts);
+  for (int i = 0; i < pattern_texts.size(); ++i) {
+    std::string program;
+    multi_regex->SerializeProgram(i, &program);
+    unpacked_regex_model->patterns[i]->multi_regex_program.assign(
+        program.begin(), program.end());
+  }
+  return true;
+}
+
+std::string PrecomputeLookupTablesInSerializedModel(const std::string& model) {
+  const Model* packed_model = GetModel(model.c_str());
+  std::unique_ptr<ModelT> unpacked_model = UnPackModel(model.c_str());
+  if (packed_model == nullptr || unpacked_model == nullptr) {
+    return "";
+  }
+  if (packed_model->selection_feature_options() != nullptr &&
+      unpacked_model->selection_feature_options != nullptr) {
+    PrecomputeFeatureProcessorTables(
+        packed_model->selection_feature_options(),
+        unpacked_model->selection_feature_options.get());
+  }
+  if (packed_model->classification_feature_options() != nullptr &&
+      unpacked_model->classification_feature_options != nullptr) {
+    PrecomputeFeatureProcessorTables(
+        packed_model->classification_feature_options(),
+        unpacked_model->classification_feature_options.get());
+  }
+  if (packed_model->regex_model() != nullptr &&
+      unpacked_model->regex_model != nullptr &&
+      !PrecomputeMultiRegexPrograms(packed_model->regex_model(),
+                                    unpacked_model->regex_model.get())) {
+    return "";
+  }
+  flatbuffers::FlatBufferBuilder builder;
+  FinishModelBuffer(builder, Model::Pack(builder, unpacked_model.get()));
+  return std::string(reinterpret_cast<const char*>(builder.GetBufferPointer()),
+                     builder.GetSize());
+}
+
+}  // namespace libtextclassifier2
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Offline tool to store in a model the lookup tables that are otherwise
+// derived from it at every load, in the form they are used at runtime:
+//   - the sorted fingerprints of the allowed charactergrams, which replace
+//     the charactergram strings,
+//   - the codepoint page table of the tokenizer,
+//   - the regex patterns compiled for the multi-pattern engine.
+// The tables are read in place from the model buffer, so that a memory-mapped
+// model shares them through the page cache.
+
+#ifndef LIBTEXTCLASSIFIER_MODEL_PRECOMPUTE_H_
+#define LIBTEXTCLASSIFIER_MODEL_PRECOMPUTE_H_
+
+#include <string>
+
+#include "model_generated.h"
+
+namespace libtextclassifier2 {
+
+// Fills in the precomputed tables of the unpacked copy of the given feature
+// processor options.
+void PrecomputeFeatureProcessorTables(
+    const FeatureProcessorOptions* options,
+    FeatureProcessorOptionsT* unpacked_options);
+
+// Stores the programs of the multi-pattern engine for the unpacked copy of the
+// given regex model, for the patterns that the engine supports. Returns false
+// if a pattern fails to decompress.
+bool PrecomputeMultiRegexPrograms(const RegexModel* regex_model,
+                                  RegexModelT* unpacked_regex_model);
+
+// Precomputes the lookup tables of both feature processors and the regex
+// programs of a serialized model. Returns an empty string on error.
+std::string PrecomputeLookupTablesInSerializedModel(const std::string& model);
+
+}  // namespace libtextclassifier2
+
+#endif  // LIBTEXTCLASSIFIER_MODEL_PRECOMPUTE_H_
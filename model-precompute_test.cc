@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "model-precompute.h"
+
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "text-classifier.h"
+#include "gtest/gtest.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+std::string ReadFile(const std::string& file_name) {
+  std::ifstream file_stream(file_name);
+  return std::string(std::istreambuf_iterator<char>(file_stream), {});
+}
+
+std::string GetModelPath() {
+  return LIBTEXTCLASSIFIER_TEST_DATA_DIR;
+}
+
+TEST(ModelPrecomputeTest, PrecomputedModelGivesSameResults) {
+  CREATE_UNILIB_FOR_TESTING;
+  const std::string model_buffer = ReadFile(GetModelPath() + "test_model.fb");
+  const std::string precomputed_buffer =
+      PrecomputeLookupTablesInSerializedModel(model_buffer);
+  ASSERT_FALSE(precomputed_buffer.empty());
+
+  const Model* precomputed_model = GetModel(precomputed_buffer.data());
+  for (const FeatureProcessorOptions* options :
+       {precomputed_model->selection_feature_options(),
+        precomputed_model->classification_feature_options()}) {
+    ASSERT_TRUE(options != nullptr);
+    EXPECT_TRUE(options->allowed_chargrams() == nullptr);
+    ASSERT_TRUE(options->tokenizer_codepoint_page_table() != nullptr);
+    EXPECT_GT(options->tokenizer_codepoint_page_table()->pages()->size(), 0);
+  }
+
+  std::unique_ptr<TextClassifier> classifier =
+      TextClassifier::FromUnownedBuffer(model_buffer.data(),
+                                        model_buffer.size(), &unilib);
+  std::unique_ptr<TextClassifier> precomputed_classifier =
+      TextClassifier::FromUnownedBuffer(precomputed_buffer.data(),
+                                        precomputed_buffer.size(), &unilib);
+  ASSERT_TRUE(classifier);
+  ASSERT_TRUE(precomputed_classifier);
+  for (const std::string& text :
+       {"call me at 857 225 3556 today", "visit www.google.com today",
+        "hello world", "Zürich 東京 مرحبا"}) {
+    EXPECT_EQ(precomputed_classifier->SuggestSelection(text, {0, 4}),
+              classifier->SuggestSelection(text, {0, 4}));
+    const std::vector<ClassificationResult> results =
+        classifier->ClassifyText(text, {0, 4});
+    const std::vector<ClassificationResult> precomputed_results =
+        precomputed_classifier->ClassifyText(text, {0, 4});
+    ASSERT_EQ(precomputed_results.size(), results.size());
+    for (int i = 0; i < results.size(); ++i) {
+      EXPECT_EQ(precomputed_results[i].collection, results[i].collection);
+      EXPECT_EQ(precomputed_results[i].score, results[i].score);
+    }
+  }
+
+  // The supported annotation patterns are stored compiled.
+  ASSERT_TRUE(precomputed_model->regex_model() != nullptr);
+  int num_programs = 0;
+  for (const auto& pattern : *precomputed_model->regex_model()->patterns()) {
+    if (pattern->multi_regex_program() != nullptr) {
+      ++num_programs;
+    }
+  }
+  EXPECT_GT(num_programs, 0);
+  LoadOptions load_options;
+  load_options.multi_pattern_annotation_regex = true;
+  std::unique_ptr<TextClassifier> multi_regex_classifier =
+      TextClassifier::FromUnownedBuffer(model_buffer.data(),
+                                        model_buffer.size(), &unilib,
+                                        load_options);
+  std::unique_ptr<TextClassifier> precomputed_multi_regex_classifier =
+      TextClassifier::FromUnownedBuffer(precomputed_buffer.data(),
+                                        precomputed_buffer.size(), &unilib,
+                                        load_options);
+  ASSERT_TRUE(multi_regex_classifier);
+  ASSERT_TRUE(precomputed_multi_regex_classifier);
+  const std::string text = "call me at 857 225 3556 or visit www.google.com";
+  const std::vector<AnnotatedSpan> annotations =
+      multi_regex_classifier->Annotate(text);
+  const std::vector<AnnotatedSpan> precomputed_annotations =
+      precomputed_multi_regex_classifier->Annotate(text);
+  ASSERT_EQ(precomputed_annotations.size(), annotations.size());
+  for (int i = 0; i < annotations.size(); ++i) {
+    EXPECT_EQ(precomputed_annotations[i].span, annotations[i].span);
+  }
+
+  // Precomputing again keeps the tables.
+  const std::string twice_precomputed_buffer =
+      PrecomputeLookupTablesInSerializedModel(precomputed_buffer);
+  const Model* twice_precomputed_model =
+      GetModel(twice_precomputed_buffer.data());
+  EXPECT_EQ(twice_precomputed_model->selection_feature_options()
+                ->allowed_chargram_fingerprints()
+                ->size(),
+            precomputed_model->selection_feature_options()
+                ->allowed_chargram_fingerprints()
+                ->size());
+}
+
+}  // namespace
+}  // namespace libtextclassifier2
@@ -0,0 +1,254 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "model-slimming.h"
+
+#include <algorithm>
+#include <memory>
+#include <set>
+
+#include "text-classifier.h"
+#include "util/base/logging.h"
+#include "util/i18n/locale-set.h"
+#include "zlib-utils.h"
+
+namespace libtextclassifier2 {
+
+namespace {
+
+// Returns true and the codec if any rule of the model is compressed.
+bool HasCompressedRules(const ModelT& model, CompressionCodec* codec) {
+  const auto check = [codec](const std::unique_ptr<CompressedBufferT>& buffer) {
+    if (buffer != nullptr) {
+      *codec = buffer->codec;
+      return true;
+    }
+    return false;
+  };
+  if (model.regex_model != nullptr) {
+    for (const auto& pattern : model.regex_model->patterns) {
+      if (check(pattern->compressed_pattern)) {
+        return true;
+      }
+    }
+  }
+  if (model.datetime_model != nullptr) {
+    for (const auto& pattern : model.datetime_model->patterns) {
+      for (const auto& regex : pattern->regexes) {
+        if (check(regex->compressed_pattern)) {
+          return true;
+        }
+      }
+    }
+    for (const auto& extractor : model.datetime_model->extractors) {
+      if (check(extractor->compressed_pattern)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// Maps the locale ids of a rule to the kept ones. Returns false if the rule
+// had locales and none of them is kept.
+bool RemapLocales(const std::vector<int>& new_locale_ids,
+                  std::vector<int>* locales) {
+  if (locales->empty()) {
+    return true;
+  }
+  std::vector<int> kept_locales;
+  for (const int locale : *locales) {
+    if (locale >= 0 && locale < new_locale_ids.size() &&
+        new_locale_ids[locale] >= 0) {
+      kept_locales.push_back(new_locale_ids[locale]);
+    }
+  }
+  if (kept_locales.empty()) {
+    return false;
+  }
+  *locales = std::move(kept_locales);
+  return true;
+}
+
+// Drops the datetime rules of the locales that won't be requested, and the
+// locales themselves.
+void SlimDatetimeLocales(const std::string& locales,
+                         DatetimeModelT* datetime_model) {
+  // The same expansion of the requested locales as in the DatetimeParser.
+  std::vector<int> requested_locale_ids;
+  LocaleIndex(datetime_model->locales)
+      .ExpandLocales(locales, &requested_locale_ids, /*locale_set=*/nullptr,
+                     /*reference_locale=*/nullptr);
+  std::vector<bool> kept(datetime_model->locales.size(), false);
+  for (const int locale : requested_locale_ids) {
+    kept[locale] = true;
+  }
+  for (const int locale : datetime_model->default_locales) {
+    if (locale >= 0 && locale < kept.size()) {
+      kept[locale] = true;
+    }
+  }
+
+  std::vector<int> new_locale_ids(kept.size(), -1);
+  std::vector<std::string> kept_locales;
+  for (int i = 0; i < kept.size(); ++i) {
+    if (kept[i]) {
+      new_locale_ids[i] = kept_locales.size();
+      kept_locales.push_back(datetime_model->locales[i]);
+    }
+  }
+  datetime_model->locales = std::move(kept_locales);
+  RemapLocales(new_locale_ids, &datetime_model->default_locales);
+
+  auto& patterns = datetime_model->patterns;
+  patterns.erase(
+      std::remove_if(
+          patterns.begin(), patterns.end(),
+          [&new_locale_ids](
+              const std::unique_ptr<DatetimeModelPatternT>& pattern) {
+            return !RemapLocales(new_locale_ids, &pattern->locales);
+          }),
+      patterns.end());
+  auto& extractors = datetime_model->extractors;
+  extractors.erase(
+      std::remove_if(
+          extractors.begin(), extractors.end(),
+          [&new_locale_ids](
+              const std::unique_ptr<DatetimeModelExtractorT>& extractor) {
+            return !RemapLocales(new_locale_ids, &extractor->locales);
+          }),
+      extractors.end());
+}
+
+// Adds the collections to the list, each once.
+void AddFilteredCollections(const std::vector<std::string>& collections,
+                            std::vector<std::string>* filtered_collections) {
+  std::set<std::string> filtered(filtered_collections->begin(),
+                                 filtered_collections->end());
+  for (const std::string& collection : collections) {
+    if (filtered.insert(collection).second) {
+      filtered_collections->push_back(collection);
+    }
+  }
+}
+
+}  // namespace
+
+bool SlimModel(const ModelSlimmingOptions& options, ModelT* model) {
+  // The zlib compressed rules continue one stream, so they are decompressed
+  // before any is dropped, and compressed again after.
+  CompressionCodec codec = CompressionCodec_ZLIB;
+  const bool compressed = HasCompressedRules(*model, &codec);
+  if (compressed && !DecompressModel(model)) {
+    TC_LOG(ERROR) << "Cannot decompress the rules of the model.";
+    return false;
+  }
+
+  const std::set<std::string> collections(options.collections.begin(),
+                                          options.collections.end());
+  const auto keeps_collection = [&collections](const std::string& collection) {
+    return collections.empty() || collections.count(collection) > 0;
+  };
+
+  model->enabled_modes =
+      static_cast<ModeFlag>(model->enabled_modes & options.enabled_modes);
+
+  if (model->regex_model != nullptr) {
+    auto& patterns = model->regex_model->patterns;
+    for (auto& pattern : patterns) {
+      pattern->enabled_modes =
+          static_cast<ModeFlag>(pattern->enabled_modes & model->enabled_modes);
+    }
+    patterns.erase(
+        std::remove_if(
+            patterns.begin(), patterns.end(),
+            [&keeps_collection](
+                const std::unique_ptr<RegexModel_::PatternT>& pattern) {
+              return pattern->enabled_modes == ModeFlag_NONE ||
+                     !keeps_collection(pattern->collection_name);
+            }),
+        patterns.end());
+  }
+
+  if (model->datetime_model != nullptr) {
+    if (!keeps_collection(TextClassifier::kDateCollection)) {
+      model->datetime_model.reset();
+    } else {
+      auto& patterns = model->datetime_model->patterns;
+      for (auto& pattern : patterns) {
+        pattern->enabled_modes = static_cast<ModeFlag>(pattern->enabled_modes &
+                                                       model->enabled_modes);
+      }
+      patterns.erase(
+          std::remove_if(
+              patterns.begin(), patterns.end(),
+              [](const std::unique_ptr<DatetimeModelPatternT>& pattern) {
+                return pattern->enabled_modes == ModeFlag_NONE;
+              }),
+          patterns.end());
+      if (!options.locales.empty()) {
+        SlimDatetimeLocales(options.locales, model->datetime_model.get());
+      }
+    }
+  }
+
+  if (!collections.empty() &&
+      model->classification_feature_options != nullptr) {
+    std::vector<std::string> dropped_collections;
+    for (const std::string& collection :
+         model->classification_feature_options->collections) {
+      if (!keeps_collection(collection) &&
+          collection != TextClassifier::kOtherCollection) {
+        dropped_collections.push_back(collection);
+      }
+    }
+    if (!dropped_collections.empty()) {
+      if (model->output_options == nullptr) {
+        model->output_options.reset(new OutputOptionsT);
+      }
+      AddFilteredCollections(
+          dropped_collections,
+          &model->output_options->filtered_collections_annotation);
+      AddFilteredCollections(
+          dropped_collections,
+          &model->output_options->filtered_collections_classification);
+      AddFilteredCollections(
+          dropped_collections,
+          &model->output_options->filtered_collections_selection);
+    }
+  }
+
+  if (compressed && !CompressModel(model, codec)) {
+    TC_LOG(ERROR) << "Cannot compress the rules of the model.";
+    return false;
+  }
+  return true;
+}
+
+std::string SlimSerializedModel(const std::string& model,
+                                const ModelSlimmingOptions& options) {
+  std::unique_ptr<ModelT> unpacked_model = UnPackModel(model.c_str());
+  if (unpacked_model == nullptr ||
+      !SlimModel(options, unpacked_model.get())) {
+    return "";
+  }
+  flatbuffers::FlatBufferBuilder builder;
+  FinishModelBuffer(builder, Model::Pack(builder, unpacked_model.get()));
+  return std::string(reinterpret_cast<const char*>(builder.GetBufferPointer()),
+                     builder.GetSize());
+}
+
+}  // namespace libtextclassifier2
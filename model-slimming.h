@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Offline tool to slim a model down for a deployment that only needs some of
+// its locales, modes and collections, by dropping the rules that can't
+// trigger there. The slimmed model loads faster, runs fewer rules per request
+// and uses less memory.
+
+#ifndef LIBTEXTCLASSIFIER_MODEL_SLIMMING_H_
+#define LIBTEXTCLASSIFIER_MODEL_SLIMMING_H_
+
+#include <string>
+#include <vector>
+
+#include "model_generated.h"
+
+namespace libtextclassifier2 {
+
+struct ModelSlimmingOptions {
+  // Comma-separated BCP 47 tags of the locales that the requests pass, as in
+  // e.g. AnnotationOptions::locales. Drops the datetime rules of the other
+  // locales, except those of the default locales, which always run. Empty
+  // keeps all the locales.
+  std::string locales;
+
+  // The modes to keep. The model and its rules are disabled for the others.
+  ModeFlag enabled_modes = ModeFlag_ALL;
+
+  // The collections to keep, or empty for all. Drops the regex rules of the
+  // other collections, and the datetime model unless "date" is kept. The other
+  // collections of the classification model are filtered out of the outputs,
+  // see OutputOptions.
+  // NOTE: The dropped rules no longer win conflicts against the kept models,
+  // so the results differ from filtering the collections in the full model.
+  std::vector<std::string> collections;
+};
+
+// Slims the unpacked model in place. Returns false if the rules of the model
+// fail to decompress.
+bool SlimModel(const ModelSlimmingOptions& options, ModelT* model);
+
+// Same as above, for a serialized model. Returns an empty string on error.
+std::string SlimSerializedModel(const std::string& model,
+                                const ModelSlimmingOptions& options);
+
+}  // namespace libtextclassifier2
+
+#endif  // LIBTEXTCLASSIFIER_MODEL_SLIMMING_H_
@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "model-slimming.h"
+
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "zlib-utils.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+using testing::Contains;
+using testing::ElementsAre;
+using testing::Not;
+
+std::string ReadFile(const std::string& file_name) {
+  std::ifstream file_stream(file_name);
+  return std::string(std::istreambuf_iterator<char>(file_stream), {});
+}
+
+std::string GetModelPath() {
+  return LIBTEXTCLASSIFIER_TEST_DATA_DIR;
+}
+
+std::unique_ptr<DatetimeModelPatternT> MakeDatetimePattern(
+    const std::string& pattern, const std::vector<int>& locales,
+    ModeFlag enabled_modes = ModeFlag_ALL) {
+  std::unique_ptr<DatetimeModelPatternT> result(new DatetimeModelPatternT);
+  result->regexes.emplace_back(new DatetimeModelPattern_::RegexT);
+  result->regexes.back()->pattern = pattern;
+  result->locales = locales;
+  result->enabled_modes = enabled_modes;
+  return result;
+}
+
+// A model with datetime rules for several locales.
+std::unique_ptr<ModelT> MakeDatetimeModel() {
+  std::unique_ptr<ModelT> model(new ModelT);
+  model->datetime_model.reset(new DatetimeModelT);
+  DatetimeModelT* datetime_model = model->datetime_model.get();
+  datetime_model->locales = {"en-*", "de-*", "*-CH", "fr-*", "und"};
+  datetime_model->default_locales = {4};
+  datetime_model->patterns.push_back(MakeDatetimePattern("en", {0}));
+  datetime_model->patterns.push_back(MakeDatetimePattern("de", {1}));
+  datetime_model->patterns.push_back(MakeDatetimePattern("ch", {2, 3}));
+  datetime_model->patterns.push_back(MakeDatetimePattern("fr", {3}));
+  datetime_model->patterns.push_back(MakeDatetimePattern("all", {}));
+  datetime_model->patterns.push_back(MakeDatetimePattern("und", {4}));
+  datetime_model->patterns.push_back(
+      MakeDatetimePattern("en-selection", {0}, ModeFlag_SELECTION));
+  datetime_model->extractors.emplace_back(new DatetimeModelExtractorT);
+  datetime_model->extractors.back()->pattern = "fr";
+  datetime_model->extractors.back()->locales = {3};
+  datetime_model->extractors.emplace_back(new DatetimeModelExtractorT);
+  datetime_model->extractors.back()->pattern = "de";
+  datetime_model->extractors.back()->locales = {1};
+  return model;
+}
+
+std::vector<std::string> DatetimePatterns(const DatetimeModelT& model) {
+  std::vector<std::string> patterns;
+  for (const auto& pattern : model.patterns) {
+    patterns.push_back(pattern->regexes[0]->pattern);
+  }
+  return patterns;
+}
+
+TEST(ModelSlimmingTest, DropsDatetimeRulesOfOtherLocalesAndModes) {
+  std::unique_ptr<ModelT> model = MakeDatetimeModel();
+  ModelSlimmingOptions options;
+  options.locales = "de-CH";
+  options.enabled_modes = ModeFlag_ANNOTATION_AND_CLASSIFICATION;
+  ASSERT_TRUE(SlimModel(options, model.get()));
+
+  EXPECT_EQ(model->enabled_modes, ModeFlag_ANNOTATION_AND_CLASSIFICATION);
+  const DatetimeModelT& datetime_model = *model->datetime_model;
+  EXPECT_THAT(datetime_model.locales, ElementsAre("de-*", "*-CH", "und"));
+  EXPECT_THAT(datetime_model.default_locales, ElementsAre(2));
+  EXPECT_THAT(DatetimePatterns(datetime_model),
+              ElementsAre("de", "ch", "all", "und"));
+  EXPECT_THAT(datetime_model.patterns[1]->locales, ElementsAre(1));
+  ASSERT_EQ(datetime_model.extractors.size(), 1);
+  EXPECT_EQ(datetime_model.extractors[0]->pattern, "de");
+  EXPECT_THAT(datetime_model.extractors[0]->locales, ElementsAre(0));
+}
+
+TEST(ModelSlimmingTest, KeepsAllLocalesByDefault) {
+  std::unique_ptr<ModelT> model = MakeDatetimeModel();
+  ASSERT_TRUE(SlimModel(ModelSlimmingOptions(), model.get()));
+  EXPECT_EQ(model->datetime_model->locales.size(), 5);
+  EXPECT_EQ(model->datetime_model->patterns.size(), 7);
+  EXPECT_EQ(model->datetime_model->extractors.size(), 2);
+}
+
+TEST(ModelSlimmingTest, DropsRulesOfOtherCollections) {
+  const std::string test_model = ReadFile(GetModelPath() + "test_model.fb");
+  std::unique_ptr<ModelT> unpacked_model = UnPackModel(test_model.c_str());
+  ASSERT_TRUE(unpacked_model != nullptr);
+  unpacked_model->datetime_model =
+      std::move(MakeDatetimeModel()->datetime_model);
+  unpacked_model->regex_model.reset(new RegexModelT);
+  for (const std::string& collection : {"phone", "url", "phone"}) {
+    unpacked_model->regex_model->patterns.emplace_back(
+        new RegexModel_::PatternT);
+    unpacked_model->regex_model->patterns.back()->collection_name = collection;
+    unpacked_model->regex_model->patterns.back()->pattern = collection;
+  }
+  ASSERT_TRUE(CompressModel(unpacked_model.get()));
+
+  flatbuffers::FlatBufferBuilder builder;
+  FinishModelBuffer(builder, Model::Pack(builder, unpacked_model.get()));
+  const std::string model(
+      reinterpret_cast<const char*>(builder.GetBufferPointer()),
+      builder.GetSize());
+
+  ModelSlimmingOptions options;
+  options.collections = {"url", "address"};
+  const std::string slimmed_model = SlimSerializedModel(model, options);
+  ASSERT_FALSE(slimmed_model.empty());
+  EXPECT_LT(slimmed_model.size(), model.size());
+
+  std::unique_ptr<ModelT> unpacked_slimmed_model =
+      UnPackModel(slimmed_model.c_str());
+  ASSERT_TRUE(DecompressModel(unpacked_slimmed_model.get()));
+  EXPECT_TRUE(unpacked_slimmed_model->datetime_model == nullptr);
+  ASSERT_EQ(unpacked_slimmed_model->regex_model->patterns.size(), 1);
+  EXPECT_EQ(unpacked_slimmed_model->regex_model->patterns[0]->pattern, "url");
+
+  const OutputOptionsT& output_options =
+      *unpacked_slimmed_model->output_options;
+  EXPECT_THAT(output_options.filtered_collections_annotation,
+              Contains("phone"));
+  EXPECT_THAT(output_options.filtered_collections_annotation,
+              Not(Contains("address")));
+  EXPECT_THAT(output_options.filtered_collections_annotation,
+              Not(Contains("other")));
+  EXPECT_EQ(output_options.filtered_collections_classification,
+            output_options.filtered_collections_annotation);
+  EXPECT_EQ(output_options.filtered_collections_selection,
+            output_options.filtered_collections_annotation);
+}
+
+}  // namespace
+}  // namespace libtextclassifier2
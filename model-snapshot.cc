@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "model-snapshot.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "model-precompute.h"
+#include "util/base/logging.h"
+#include "util/memory/mmap.h"
+
+namespace libtextclassifier2 {
+
+namespace {
+
+// Returns true if the trailer is the one of a snapshot file of the given size,
+// of the model with the given fingerprint.
+bool IsStartupSnapshotOf(const StartupSnapshotTrailer& trailer,
+                         uint64 source_fingerprint, int64 file_size) {
+  return trailer.magic == kStartupSnapshotMagic &&
+         trailer.version == kStartupSnapshotVersion &&
+         trailer.source_fingerprint == source_fingerprint &&
+         trailer.snapshot_size + sizeof(trailer) == file_size;
+}
+
+// Writes all of the data to the file descriptor. Returns false on error.
+bool WriteFully(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    const ssize_t written = write(fd, data, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += written;
+    size -= written;
+  }
+  return true;
+}
+
+// Loads the snapshot model of the snapshot file, if the file is a valid
+// snapshot of the model with the given fingerprint. The fingerprint of the
+// snapshot model is checked by the load. Returns nullptr otherwise.
+std::unique_ptr<TextClassifier> LoadValidStartupSnapshot(
+    const std::string& snapshot_path, uint64 source_fingerprint,
+    const UniLib* unilib, const LoadOptions& load_options) {
+  const int fd = open(snapshot_path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+  std::unique_ptr<TextClassifier> classifier;
+  struct stat sb;
+  StartupSnapshotTrailer trailer;
+  if (fstat(fd, &sb) == 0 && sb.st_size >= sizeof(trailer) &&
+      pread(fd, &trailer, sizeof(trailer), sb.st_size - sizeof(trailer)) ==
+          sizeof(trailer) &&
+      IsStartupSnapshotOf(trailer, source_fingerprint, sb.st_size)) {
+    std::unique_ptr<ScopedMmap> mmap(
+        new ScopedMmap(fd, /*segment_offset=*/0, trailer.snapshot_size));
+    if (mmap->handle().ok()) {
+      LoadOptions snapshot_load_options = load_options;
+      snapshot_load_options.trusted_model_fingerprint =
+          trailer.snapshot_fingerprint;
+      snapshot_load_options.require_trusted_model = true;
+      classifier = TextClassifier::FromScopedMmap(&mmap, unilib,
+                                                  snapshot_load_options);
+    }
+    if (classifier == nullptr) {
+      TC_LOG(WARNING) << "Corrupted startup snapshot " << snapshot_path;
+    }
+  }
+  close(fd);
+  return classifier;
+}
+
+}  // namespace
+
+std::string BuildStartupSnapshot(const std::string& model) {
+  std::string snapshot = PrecomputeLookupTablesInSerializedModel(model);
+  if (snapshot.empty()) {
+    return "";
+  }
+  StartupSnapshotTrailer trailer;
+  memset(&trailer, 0, sizeof(trailer));
+  trailer.magic = kStartupSnapshotMagic;
+  trailer.version = kStartupSnapshotVersion;
+  trailer.source_fingerprint = ModelFingerprint(model.data(), model.size());
+  trailer.snapshot_fingerprint =
+      ModelFingerprint(snapshot.data(), snapshot.size());
+  trailer.snapshot_size = snapshot.size();
+  snapshot.append(reinterpret_cast<const char*>(&trailer), sizeof(trailer));
+  return snapshot;
+}
+
+bool ParseStartupSnapshot(StringPiece snapshot, uint64 source_fingerprint,
+                          StartupSnapshotTrailer* trailer) {
+  if (snapshot.size() < sizeof(*trailer)) {
+    return false;
+  }
+  memcpy(trailer, snapshot.data() + snapshot.size() - sizeof(*trailer),
+         sizeof(*trailer));
+  return IsStartupSnapshotOf(*trailer, source_fingerprint, snapshot.size());
+}
+
+bool WriteStartupSnapshot(const std::string& model,
+                          const std::string& snapshot_path) {
+  const std::string snapshot = BuildStartupSnapshot(model);
+  if (snapshot.empty()) {
+    TC_LOG(ERROR) << "Could not build the startup snapshot.";
+    return false;
+  }
+
+  // Renaming a complete file over the old one is atomic. The temporary file
+  // is unique to the call, as other threads may be writing the snapshot, too.
+  std::string temp_path = snapshot_path + ".tmp.XXXXXX";
+  const int fd = mkstemp(&temp_path[0]);
+  if (fd < 0) {
+    TC_LOG(ERROR) << "Unable to create " << temp_path;
+    return false;
+  }
+  const bool written = fchmod(fd, 0644) == 0 &&
+                       WriteFully(fd, snapshot.data(), snapshot.size()) &&
+                       fsync(fd) == 0;
+  if (close(fd) != 0 || !written ||
+      rename(temp_path.c_str(), snapshot_path.c_str()) != 0) {
+    TC_LOG(ERROR) << "Unable to write " << snapshot_path;
+    unlink(temp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+std::unique_ptr<TextClassifier> FromPathWithStartupSnapshot(
+    const std::string& model_path, const std::string& snapshot_path,
+    const UniLib* unilib, const LoadOptions& load_options) {
+  uint64 source_fingerprint;
+  {
+    ScopedMmap model_mmap(model_path);
+    if (!model_mmap.handle().ok()) {
+      TC_LOG(ERROR) << "Unable to map " << model_path;
+      return nullptr;
+    }
+    source_fingerprint = ModelFingerprint(model_mmap.handle().start(),
+                                          model_mmap.handle().num_bytes());
+    std::unique_ptr<TextClassifier> classifier = LoadValidStartupSnapshot(
+        snapshot_path, source_fingerprint, unilib, load_options);
+    if (classifier != nullptr) {
+      return classifier;
+    }
+
+    // The tables are only derived from a verified model.
+    if (ViewModel(model_mmap.handle().start(),
+                  model_mmap.handle().num_bytes()) == nullptr) {
+      TC_LOG(ERROR) << "Model verification failed.";
+      return nullptr;
+    }
+    TC_LOG(INFO) << "Rebuilding the startup snapshot " << snapshot_path;
+    if (!WriteStartupSnapshot(
+            model_mmap.handle().to_stringpiece().ToString(), snapshot_path)) {
+      return TextClassifier::FromPath(model_path, unilib, load_options);
+    }
+  }
+
+  // Another process may have replaced the snapshot meanwhile, e.g. with the
+  // snapshot of a newer model.
+  std::unique_ptr<TextClassifier> classifier = LoadValidStartupSnapshot(
+      snapshot_path, source_fingerprint, unilib, load_options);
+  if (classifier == nullptr) {
+    return TextClassifier::FromPath(model_path, unilib, load_options);
+  }
+  return classifier;
+}
+
+}  // namespace libtextclassifier2
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Startup snapshots of models: a model with the lookup tables that are
+// otherwise derived from it at every load, see
+// PrecomputeLookupTablesInSerializedModel(), in a file of its own that is
+// tied to the fingerprint of the model it was built from. A process then
+// loads the snapshot with one mmap instead of the model, and the snapshot is
+// rebuilt when the model changes.
+
+#ifndef LIBTEXTCLASSIFIER_MODEL_SNAPSHOT_H_
+#define LIBTEXTCLASSIFIER_MODEL_SNAPSHOT_H_
+
+#include <memory>
+#include <string>
+
+#include "text-classifier.h"
+#include "util/base/integral_types.h"
+#include "util/strings/stringpiece.h"
+#include "util/utf8/unilib.h"
+
+namespace libtextclassifier2 {
+
+// The trailer at the end of a snapshot file, after the snapshot model, so
+// that the model starts at the page-aligned beginning of the file.
+struct StartupSnapshotTrailer {
+  // See kStartupSnapshotMagic and kStartupSnapshotVersion.
+  uint64 magic;
+  uint32 version;
+  uint32 reserved;
+
+  // ModelFingerprint() of the model the snapshot was built from.
+  uint64 source_fingerprint;
+
+  // ModelFingerprint() and size of the snapshot model before the trailer.
+  uint64 snapshot_fingerprint;
+  uint64 snapshot_size;
+};
+
+const uint64 kStartupSnapshotMagic = 0x50414e5343544c54ULL;  // "TLTCSNAP"
+
+// Changes whenever the derived tables of the snapshots change, which
+// invalidates the existing snapshots.
+const uint32 kStartupSnapshotVersion = 1;
+
+// Builds the snapshot file of a serialized model. Returns an empty string on
+// error.
+std::string BuildStartupSnapshot(const std::string& model);
+
+// Returns the trailer of a snapshot file if it is a snapshot of the model
+// with the given fingerprint. Returns false for snapshots of other models or
+// versions, and for truncated files.
+bool ParseStartupSnapshot(StringPiece snapshot, uint64 source_fingerprint,
+                          StartupSnapshotTrailer* trailer);
+
+// Writes the snapshot of a serialized model to the path, replacing the file
+// atomically, so that concurrent processes only ever read whole snapshots.
+// Returns false on error.
+bool WriteStartupSnapshot(const std::string& model,
+                          const std::string& snapshot_path);
+
+// Loads the model at 'model_path' from its snapshot at 'snapshot_path'. The
+// snapshot is trusted, see LoadOptions::trusted_model_fingerprint. If the
+// snapshot is missing, out of date or corrupted, it is rebuilt from the model
+// and written first. If it can't be written, e.g. in a read-only directory,
+// loads the model itself. Returns nullptr if the model can't be loaded.
+// NOTE: Checking that the snapshot is up to date and intact reads the model
+// and the snapshot to fingerprint them once each, which is much cheaper than
+// deriving the tables. The fingerprint of the snapshot is stored in the
+// snapshot file itself, so it detects corruption, e.g. a torn write, but does
+// not authenticate the file: the snapshot needs to be where only the users of
+// the model can write, like the model itself.
+std::unique_ptr<TextClassifier> FromPathWithStartupSnapshot(
+    const std::string& model_path, const std::string& snapshot_path,
+    const UniLib* unilib = nullptr,
+    const LoadOptions& load_options = LoadOptions::Default());
+
+}  // namespace libtextclassifier2
+
+#endif  // LIBTEXTCLASSIFIER_MODEL_SNAPSHOT_H_
@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "model-snapshot.h"
+
+#include <stdlib.h>
+
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+std::string ReadFile(const std::string& file_name) {
+  std::ifstream file_stream(file_name);
+  return std::string(std::istreambuf_iterator<char>(file_stream), {});
+}
+
+void WriteFile(const std::string& file_name, const std::string& content) {
+  std::ofstream file(file_name);
+  file.write(content.data(), content.size());
+}
+
+std::string GetModelPath() {
+  return LIBTEXTCLASSIFIER_TEST_DATA_DIR;
+}
+
+// Returns the test model with the given version.
+std::string MakeModel(int version) {
+  const std::string test_model = ReadFile(GetModelPath() + "test_model.fb");
+  std::unique_ptr<ModelT> unpacked_model = UnPackModel(test_model.c_str());
+  unpacked_model->version = version;
+  flatbuffers::FlatBufferBuilder builder;
+  FinishModelBuffer(builder, Model::Pack(builder, unpacked_model.get()));
+  return std::string(reinterpret_cast<const char*>(builder.GetBufferPointer()),
+                     builder.GetSize());
+}
+
+class ModelSnapshotTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    std::string directory = testing::TempDir() + "/snapshot_XXXXXX";
+    ASSERT_NE(mkdtemp(&directory[0]), nullptr);
+    model_path_ = directory + "/model.fb";
+    snapshot_path_ = directory + "/model.snapshot";
+  }
+
+  std::string model_path_;
+  std::string snapshot_path_;
+};
+
+TEST_F(ModelSnapshotTest, ParsesSnapshotOfTheModel) {
+  const std::string model = MakeModel(1);
+  const std::string snapshot = BuildStartupSnapshot(model);
+  ASSERT_FALSE(snapshot.empty());
+  const uint64 fingerprint = ModelFingerprint(model.data(), model.size());
+
+  StartupSnapshotTrailer trailer;
+  ASSERT_TRUE(ParseStartupSnapshot(snapshot, fingerprint, &trailer));
+  EXPECT_EQ(trailer.snapshot_size + sizeof(trailer), snapshot.size());
+  EXPECT_EQ(trailer.snapshot_fingerprint,
+            ModelFingerprint(snapshot.data(), trailer.snapshot_size));
+  EXPECT_TRUE(ViewModel(snapshot.data(), trailer.snapshot_size) != nullptr);
+
+  // Another model, and a truncated snapshot.
+  const std::string other_model = MakeModel(2);
+  EXPECT_FALSE(ParseStartupSnapshot(
+      snapshot, ModelFingerprint(other_model.data(), other_model.size()),
+      &trailer));
+  EXPECT_FALSE(ParseStartupSnapshot(
+      StringPiece(snapshot.data() + 1, snapshot.size() - 1), fingerprint,
+      &trailer));
+  EXPECT_FALSE(ParseStartupSnapshot(model, fingerprint, &trailer));
+}
+
+TEST_F(ModelSnapshotTest, RebuildsMissingAndOutdatedSnapshots) {
+  CREATE_UNILIB_FOR_TESTING;
+  const std::string model = MakeModel(1);
+  WriteFile(model_path_, model);
+  std::unique_ptr<TextClassifier> expected_classifier =
+      TextClassifier::FromPath(model_path_, &unilib);
+  ASSERT_TRUE(expected_classifier);
+
+  // The snapshot is written on the first load and used on the next ones.
+  StartupSnapshotTrailer trailer;
+  for (int i = 0; i < 2; ++i) {
+    std::unique_ptr<TextClassifier> classifier =
+        FromPathWithStartupSnapshot(model_path_, snapshot_path_, &unilib);
+    ASSERT_TRUE(classifier);
+    EXPECT_EQ(classifier->SuggestSelection("call me at 857 225 3556 today",
+                                           {11, 14}),
+              expected_classifier->SuggestSelection(
+                  "call me at 857 225 3556 today", {11, 14}));
+    ASSERT_TRUE(ParseStartupSnapshot(
+        ReadFile(snapshot_path_), ModelFingerprint(model.data(), model.size()),
+        &trailer));
+    EXPECT_EQ(classifier->GetMemoryStats().model_bytes, trailer.snapshot_size);
+  }
+
+  // A new model replaces the snapshot.
+  const std::string new_model = MakeModel(2);
+  WriteFile(model_path_, new_model);
+  std::unique_ptr<TextClassifier> new_classifier =
+      FromPathWithStartupSnapshot(model_path_, snapshot_path_, &unilib);
+  ASSERT_TRUE(new_classifier);
+  ASSERT_TRUE(ParseStartupSnapshot(
+      ReadFile(snapshot_path_),
+      ModelFingerprint(new_model.data(), new_model.size()), &trailer));
+  EXPECT_EQ(new_classifier->GetMemoryStats().model_bytes,
+            trailer.snapshot_size);
+}
+
+TEST_F(ModelSnapshotTest, RebuildsCorruptedSnapshots) {
+  CREATE_UNILIB_FOR_TESTING;
+  const std::string model = MakeModel(1);
+  WriteFile(model_path_, model);
+  std::string snapshot = BuildStartupSnapshot(model);
+  ASSERT_FALSE(snapshot.empty());
+  snapshot[snapshot.size() / 2] ^= 0x55;
+  WriteFile(snapshot_path_, snapshot);
+
+  std::unique_ptr<TextClassifier> classifier =
+      FromPathWithStartupSnapshot(model_path_, snapshot_path_, &unilib);
+  ASSERT_TRUE(classifier);
+  EXPECT_EQ(ReadFile(snapshot_path_), BuildStartupSnapshot(model));
+}
+
+}  // namespace
+}  // namespace libtextclassifier2
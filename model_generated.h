@@ -92,6 +92,9 @@ struct BoundsSensitiveFeaturesT;
 struct AlternativeCollectionMapEntry;
 struct AlternativeCollectionMapEntryT;
 
+struct CodepointPageTable;
+struct CodepointPageTableT;
+
 }  // namespace FeatureProcessorOptions_
 
 struct FeatureProcessorOptions;
@@ -451,6 +454,35 @@ inline const char *EnumNameDatetimeGroupType(DatetimeGroupType e) {
   return EnumNamesDatetimeGroupType()[index];
 }
 
+enum CompressionCodec {
+  CompressionCodec_ZLIB = 0,
+  CompressionCodec_LZ4 = 1,
+  CompressionCodec_MIN = CompressionCodec_ZLIB,
+  CompressionCodec_MAX = CompressionCodec_LZ4
+};
+
+inline CompressionCodec (&EnumValuesCompressionCodec())[2] {
+  static CompressionCodec values[] = {
+    CompressionCodec_ZLIB,
+    CompressionCodec_LZ4
+  };
+  return values;
+}
+
+inline const char **EnumNamesCompressionCodec() {
+  static const char *names[] = {
+    "ZLIB",
+    "LZ4",
+    nullptr
+  };
+  return names;
+}
+
+inline const char *EnumNameCompressionCodec(CompressionCodec e) {
+  const size_t index = static_cast<int>(e);
+  return EnumNamesCompressionCodec()[index];
+}
+
 namespace TokenizationCodepointRange_ {
 
 enum Role {
@@ -573,8 +605,10 @@ struct CompressedBufferT : public flatbuffers::NativeTable {
   typedef CompressedBuffer TableType;
   std::vector<uint8_t> buffer;
   int32_t uncompressed_size;
+  CompressionCodec codec;
   CompressedBufferT()
-      : uncompressed_size(0) {
+      : uncompressed_size(0),
+        codec(CompressionCodec_ZLIB) {
   }
 };
 
@@ -582,7 +616,8 @@ struct CompressedBuffer FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   typedef CompressedBufferT NativeTableType;
   enum {
     VT_BUFFER = 4,
-    VT_UNCOMPRESSED_SIZE = 6
+    VT_UNCOMPRESSED_SIZE = 6,
+    VT_CODEC = 8
   };
   const flatbuffers::Vector<uint8_t> *buffer() const {
     return GetPointer<const flatbuffers::Vector<uint8_t> *>(VT_BUFFER);
@@ -590,11 +625,15 @@ struct CompressedBuffer FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   int32_t uncompressed_size() const {
     return GetField<int32_t>(VT_UNCOMPRESSED_SIZE, 0);
   }
+  CompressionCodec codec() const {
+    return static_cast<CompressionCodec>(GetField<int32_t>(VT_CODEC, 0));
+  }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyOffset(verifier, VT_BUFFER) &&
            verifier.Verify(buffer()) &&
            VerifyField<int32_t>(verifier, VT_UNCOMPRESSED_SIZE) &&
+           VerifyField<int32_t>(verifier, VT_CODEC) &&
            verifier.EndTable();
   }
   CompressedBufferT *UnPack(const flatbuffers::resolver_function_t *_resolver = nullptr) const;
@@ -611,6 +650,9 @@ struct CompressedBufferBuilder {
   void add_uncompressed_size(int32_t uncompressed_size) {
     fbb_.AddElement<int32_t>(CompressedBuffer::VT_UNCOMPRESSED_SIZE, uncompressed_size, 0);
   }
+  void add_codec(CompressionCodec codec) {
+    fbb_.AddElement<int32_t>(CompressedBuffer::VT_CODEC, static_cast<int32_t>(codec), 0);
+  }
   explicit CompressedBufferBuilder(flatbuffers::FlatBufferBuilder &_fbb)
         : fbb_(_fbb) {
     start_ = fbb_.StartTable();
@@ -626,8 +668,10 @@ struct CompressedBufferBuilder {
 inline flatbuffers::Offset<CompressedBuffer> CreateCompressedBuffer(
     flatbuffers::FlatBufferBuilder &_fbb,
     flatbuffers::Offset<flatbuffers::Vector<uint8_t>> buffer = 0,
-    int32_t uncompressed_size = 0) {
+    int32_t uncompressed_size = 0,
+    CompressionCodec codec = CompressionCodec_ZLIB) {
   CompressedBufferBuilder builder_(_fbb);
+  builder_.add_codec(codec);
   builder_.add_uncompressed_size(uncompressed_size);
   builder_.add_buffer(buffer);
   return builder_.Finish();
@@ -636,11 +680,13 @@ inline flatbuffers::Offset<CompressedBuffer> CreateCompressedBuffer(
 inline flatbuffers::Offset<CompressedBuffer> CreateCompressedBufferDirect(
     flatbuffers::FlatBufferBuilder &_fbb,
     const std::vector<uint8_t> *buffer = nullptr,
-    int32_t uncompressed_size = 0) {
+    int32_t uncompressed_size = 0,
+    CompressionCodec codec = CompressionCodec_ZLIB) {
   return libtextclassifier2::CreateCompressedBuffer(
       _fbb,
       buffer ? _fbb.CreateVector<uint8_t>(*buffer) : 0,
-      uncompressed_size);
+      uncompressed_size,
+      codec);
 }
 
 flatbuffers::Offset<CompressedBuffer> CreateCompressedBuffer(flatbuffers::FlatBufferBuilder &_fbb, const CompressedBufferT *_o, const flatbuffers::rehasher_function_t *_rehasher = nullptr);
@@ -836,6 +882,7 @@ struct PatternT : public flatbuffers::NativeTable {
   float priority_score;
   bool use_approximate_matching;
   std::unique_ptr<libtextclassifier2::CompressedBufferT> compressed_pattern;
+  std::vector<uint8_t> multi_regex_program;
   PatternT()
       : enabled_modes(libtextclassifier2::ModeFlag_ALL),
         target_classification_score(1.0f),
@@ -853,7 +900,8 @@ struct Pattern FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
     VT_TARGET_CLASSIFICATION_SCORE = 10,
     VT_PRIORITY_SCORE = 12,
     VT_USE_APPROXIMATE_MATCHING = 14,
-    VT_COMPRESSED_PATTERN = 16
+    VT_COMPRESSED_PATTERN = 16,
+    VT_MULTI_REGEX_PROGRAM = 18
   };
   const flatbuffers::String *collection_name() const {
     return GetPointer<const flatbuffers::String *>(VT_COLLECTION_NAME);
@@ -876,6 +924,9 @@ struct Pattern FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   const libtextclassifier2::CompressedBuffer *compressed_pattern() const {
     return GetPointer<const libtextclassifier2::CompressedBuffer *>(VT_COMPRESSED_PATTERN);
   }
+  const flatbuffers::Vector<uint8_t> *multi_regex_program() const {
+    return GetPointer<const flatbuffers::Vector<uint8_t> *>(VT_MULTI_REGEX_PROGRAM);
+  }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyOffset(verifier, VT_COLLECTION_NAME) &&
@@ -888,6 +939,8 @@ struct Pattern FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
            VerifyField<uint8_t>(verifier, VT_USE_APPROXIMATE_MATCHING) &&
            VerifyOffset(verifier, VT_COMPRESSED_PATTERN) &&
            verifier.VerifyTable(compressed_pattern()) &&
+           VerifyOffset(verifier, VT_MULTI_REGEX_PROGRAM) &&
+           verifier.Verify(multi_regex_program()) &&
            verifier.EndTable();
   }
   PatternT *UnPack(const flatbuffers::resolver_function_t *_resolver = nullptr) const;
@@ -919,6 +972,9 @@ struct PatternBuilder {
   void add_compressed_pattern(flatbuffers::Offset<libtextclassifier2::CompressedBuffer> compressed_pattern) {
     fbb_.AddOffset(Pattern::VT_COMPRESSED_PATTERN, compressed_pattern);
   }
+  void add_multi_regex_program(flatbuffers::Offset<flatbuffers::Vector<uint8_t>> multi_regex_program) {
+    fbb_.AddOffset(Pattern::VT_MULTI_REGEX_PROGRAM, multi_regex_program);
+  }
   explicit PatternBuilder(flatbuffers::FlatBufferBuilder &_fbb)
         : fbb_(_fbb) {
     start_ = fbb_.StartTable();
@@ -939,8 +995,10 @@ inline flatbuffers::Offset<Pattern> CreatePattern(
     float target_classification_score = 1.0f,
     float priority_score = 0.0f,
     bool use_approximate_matching = false,
-    flatbuffers::Offset<libtextclassifier2::CompressedBuffer> compressed_pattern = 0) {
+    flatbuffers::Offset<libtextclassifier2::CompressedBuffer> compressed_pattern = 0,
+    flatbuffers::Offset<flatbuffers::Vector<uint8_t>> multi_regex_program = 0) {
   PatternBuilder builder_(_fbb);
+  builder_.add_multi_regex_program(multi_regex_program);
   builder_.add_compressed_pattern(compressed_pattern);
   builder_.add_priority_score(priority_score);
   builder_.add_target_classification_score(target_classification_score);
@@ -959,7 +1017,8 @@ inline flatbuffers::Offset<Pattern> CreatePatternDirect(
     float target_classification_score = 1.0f,
     float priority_score = 0.0f,
     bool use_approximate_matching = false,
-    flatbuffers::Offset<libtextclassifier2::CompressedBuffer> compressed_pattern = 0) {
+    flatbuffers::Offset<libtextclassifier2::CompressedBuffer> compressed_pattern = 0,
+    const std::vector<uint8_t> *multi_regex_program = nullptr) {
   return libtextclassifier2::RegexModel_::CreatePattern(
       _fbb,
       collection_name ? _fbb.CreateString(collection_name) : 0,
@@ -968,7 +1027,8 @@ inline flatbuffers::Offset<Pattern> CreatePatternDirect(
       target_classification_score,
       priority_score,
       use_approximate_matching,
-      compressed_pattern);
+      compressed_pattern,
+      multi_regex_program ? _fbb.CreateVector<uint8_t>(*multi_regex_program) : 0);
 }
 
 flatbuffers::Offset<Pattern> CreatePattern(flatbuffers::FlatBufferBuilder &_fbb, const PatternT *_o, const flatbuffers::rehasher_function_t *_rehasher = nullptr);
@@ -2422,6 +2482,124 @@ inline flatbuffers::Offset<AlternativeCollectionMapEntry> CreateAlternativeColle
 
 flatbuffers::Offset<AlternativeCollectionMapEntry> CreateAlternativeCollectionMapEntry(flatbuffers::FlatBufferBuilder &_fbb, const AlternativeCollectionMapEntryT *_o, const flatbuffers::rehasher_function_t *_rehasher = nullptr);
 
+struct CodepointPageTableT : public flatbuffers::NativeTable {
+  typedef CodepointPageTable TableType;
+  int32_t page_bits;
+  std::vector<int32_t> class_roles;
+  std::vector<int32_t> class_script_ids;
+  std::vector<uint16_t> page_index;
+  std::vector<uint8_t> pages;
+  CodepointPageTableT()
+      : page_bits(0) {
+  }
+};
+
+struct CodepointPageTable FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  typedef CodepointPageTableT NativeTableType;
+  enum {
+    VT_PAGE_BITS = 4,
+    VT_CLASS_ROLES = 6,
+    VT_CLASS_SCRIPT_IDS = 8,
+    VT_PAGE_INDEX = 10,
+    VT_PAGES = 12
+  };
+  int32_t page_bits() const {
+    return GetField<int32_t>(VT_PAGE_BITS, 0);
+  }
+  const flatbuffers::Vector<int32_t> *class_roles() const {
+    return GetPointer<const flatbuffers::Vector<int32_t> *>(VT_CLASS_ROLES);
+  }
+  const flatbuffers::Vector<int32_t> *class_script_ids() const {
+    return GetPointer<const flatbuffers::Vector<int32_t> *>(VT_CLASS_SCRIPT_IDS);
+  }
+  const flatbuffers::Vector<uint16_t> *page_index() const {
+    return GetPointer<const flatbuffers::Vector<uint16_t> *>(VT_PAGE_INDEX);
+  }
+  const flatbuffers::Vector<uint8_t> *pages() const {
+    return GetPointer<const flatbuffers::Vector<uint8_t> *>(VT_PAGES);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<int32_t>(verifier, VT_PAGE_BITS) &&
+           VerifyOffset(verifier, VT_CLASS_ROLES) &&
+           verifier.Verify(class_roles()) &&
+           VerifyOffset(verifier, VT_CLASS_SCRIPT_IDS) &&
+           verifier.Verify(class_script_ids()) &&
+           VerifyOffset(verifier, VT_PAGE_INDEX) &&
+           verifier.Verify(page_index()) &&
+           VerifyOffset(verifier, VT_PAGES) &&
+           verifier.Verify(pages()) &&
+           verifier.EndTable();
+  }
+  CodepointPageTableT *UnPack(const flatbuffers::resolver_function_t *_resolver = nullptr) const;
+  void UnPackTo(CodepointPageTableT *_o, const flatbuffers::resolver_function_t *_resolver = nullptr) const;
+  static flatbuffers::Offset<CodepointPageTable> Pack(flatbuffers::FlatBufferBuilder &_fbb, const CodepointPageTableT* _o, const flatbuffers::rehasher_function_t *_rehasher = nullptr);
+};
+
+struct CodepointPageTableBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_page_bits(int32_t page_bits) {
+    fbb_.AddElement<int32_t>(CodepointPageTable::VT_PAGE_BITS, page_bits, 0);
+  }
+  void add_class_roles(flatbuffers::Offset<flatbuffers::Vector<int32_t>> class_roles) {
+    fbb_.AddOffset(CodepointPageTable::VT_CLASS_ROLES, class_roles);
+  }
+  void add_class_script_ids(flatbuffers::Offset<flatbuffers::Vector<int32_t>> class_script_ids) {
+    fbb_.AddOffset(CodepointPageTable::VT_CLASS_SCRIPT_IDS, class_script_ids);
+  }
+  void add_page_index(flatbuffers::Offset<flatbuffers::Vector<uint16_t>> page_index) {
+    fbb_.AddOffset(CodepointPageTable::VT_PAGE_INDEX, page_index);
+  }
+  void add_pages(flatbuffers::Offset<flatbuffers::Vector<uint8_t>> pages) {
+    fbb_.AddOffset(CodepointPageTable::VT_PAGES, pages);
+  }
+  explicit CodepointPageTableBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  CodepointPageTableBuilder &operator=(const CodepointPageTableBuilder &);
+  flatbuffers::Offset<CodepointPageTable> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<CodepointPageTable>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<CodepointPageTable> CreateCodepointPageTable(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    int32_t page_bits = 0,
+    flatbuffers::Offset<flatbuffers::Vector<int32_t>> class_roles = 0,
+    flatbuffers::Offset<flatbuffers::Vector<int32_t>> class_script_ids = 0,
+    flatbuffers::Offset<flatbuffers::Vector<uint16_t>> page_index = 0,
+    flatbuffers::Offset<flatbuffers::Vector<uint8_t>> pages = 0) {
+  CodepointPageTableBuilder builder_(_fbb);
+  builder_.add_pages(pages);
+  builder_.add_page_index(page_index);
+  builder_.add_class_script_ids(class_script_ids);
+  builder_.add_class_roles(class_roles);
+  builder_.add_page_bits(page_bits);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<CodepointPageTable> CreateCodepointPageTableDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    int32_t page_bits = 0,
+    const std::vector<int32_t> *class_roles = nullptr,
+    const std::vector<int32_t> *class_script_ids = nullptr,
+    const std::vector<uint16_t> *page_index = nullptr,
+    const std::vector<uint8_t> *pages = nullptr) {
+  return libtextclassifier2::FeatureProcessorOptions_::CreateCodepointPageTable(
+      _fbb,
+      page_bits,
+      class_roles ? _fbb.CreateVector<int32_t>(*class_roles) : 0,
+      class_script_ids ? _fbb.CreateVector<int32_t>(*class_script_ids) : 0,
+      page_index ? _fbb.CreateVector<uint16_t>(*page_index) : 0,
+      pages ? _fbb.CreateVector<uint8_t>(*pages) : 0);
+}
+
+flatbuffers::Offset<CodepointPageTable> CreateCodepointPageTable(flatbuffers::FlatBufferBuilder &_fbb, const CodepointPageTableT *_o, const flatbuffers::rehasher_function_t *_rehasher = nullptr);
+
 }  // namespace FeatureProcessorOptions_
 
 struct FeatureProcessorOptionsT : public flatbuffers::NativeTable {
@@ -2457,6 +2635,10 @@ struct FeatureProcessorOptionsT : public flatbuffers::NativeTable {
   std::unique_ptr<libtextclassifier2::FeatureProcessorOptions_::BoundsSensitiveFeaturesT> bounds_sensitive_features;
   std::vector<std::string> allowed_chargrams;
   bool tokenize_on_script_change;
+  std::vector<uint64_t> allowed_chargram_fingerprints;
+  std::vector<int32_t> embedding_bucket_remap_from;
+  std::vector<int32_t> embedding_bucket_remap_to;
+  std::unique_ptr<libtextclassifier2::FeatureProcessorOptions_::CodepointPageTableT> tokenizer_codepoint_page_table;
   FeatureProcessorOptionsT()
       : num_buckets(-1),
         embedding_size(-1),
@@ -2516,7 +2698,11 @@ struct FeatureProcessorOptions FLATBUFFERS_FINAL_CLASS : private flatbuffers::Ta
     VT_IGNORED_SPAN_BOUNDARY_CODEPOINTS = 58,
     VT_BOUNDS_SENSITIVE_FEATURES = 60,
     VT_ALLOWED_CHARGRAMS = 62,
-    VT_TOKENIZE_ON_SCRIPT_CHANGE = 64
+    VT_TOKENIZE_ON_SCRIPT_CHANGE = 64,
+    VT_ALLOWED_CHARGRAM_FINGERPRINTS = 66,
+    VT_EMBEDDING_BUCKET_REMAP_FROM = 68,
+    VT_EMBEDDING_BUCKET_REMAP_TO = 70,
+    VT_TOKENIZER_CODEPOINT_PAGE_TABLE = 72
   };
   int32_t num_buckets() const {
     return GetField<int32_t>(VT_NUM_BUCKETS, -1);
@@ -2611,6 +2797,18 @@ struct FeatureProcessorOptions FLATBUFFERS_FINAL_CLASS : private flatbuffers::Ta
   bool tokenize_on_script_change() const {
     return GetField<uint8_t>(VT_TOKENIZE_ON_SCRIPT_CHANGE, 0) != 0;
   }
+  const flatbuffers::Vector<uint64_t> *allowed_chargram_fingerprints() const {
+    return GetPointer<const flatbuffers::Vector<uint64_t> *>(VT_ALLOWED_CHARGRAM_FINGERPRINTS);
+  }
+  const flatbuffers::Vector<int32_t> *embedding_bucket_remap_from() const {
+    return GetPointer<const flatbuffers::Vector<int32_t> *>(VT_EMBEDDING_BUCKET_REMAP_FROM);
+  }
+  const flatbuffers::Vector<int32_t> *embedding_bucket_remap_to() const {
+    return GetPointer<const flatbuffers::Vector<int32_t> *>(VT_EMBEDDING_BUCKET_REMAP_TO);
+  }
+  const libtextclassifier2::FeatureProcessorOptions_::CodepointPageTable *tokenizer_codepoint_page_table() const {
+    return GetPointer<const libtextclassifier2::FeatureProcessorOptions_::CodepointPageTable *>(VT_TOKENIZER_CODEPOINT_PAGE_TABLE);
+  }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyField<int32_t>(verifier, VT_NUM_BUCKETS) &&
@@ -2659,6 +2857,14 @@ struct FeatureProcessorOptions FLATBUFFERS_FINAL_CLASS : private flatbuffers::Ta
            verifier.Verify(allowed_chargrams()) &&
            verifier.VerifyVectorOfStrings(allowed_chargrams()) &&
            VerifyField<uint8_t>(verifier, VT_TOKENIZE_ON_SCRIPT_CHANGE) &&
+           VerifyOffset(verifier, VT_ALLOWED_CHARGRAM_FINGERPRINTS) &&
+           verifier.Verify(allowed_chargram_fingerprints()) &&
+           VerifyOffset(verifier, VT_EMBEDDING_BUCKET_REMAP_FROM) &&
+           verifier.Verify(embedding_bucket_remap_from()) &&
+           VerifyOffset(verifier, VT_EMBEDDING_BUCKET_REMAP_TO) &&
+           verifier.Verify(embedding_bucket_remap_to()) &&
+           VerifyOffset(verifier, VT_TOKENIZER_CODEPOINT_PAGE_TABLE) &&
+           verifier.VerifyTable(tokenizer_codepoint_page_table()) &&
            verifier.EndTable();
   }
   FeatureProcessorOptionsT *UnPack(const flatbuffers::resolver_function_t *_resolver = nullptr) const;
@@ -2762,6 +2968,18 @@ struct FeatureProcessorOptionsBuilder {
   void add_tokenize_on_script_change(bool tokenize_on_script_change) {
     fbb_.AddElement<uint8_t>(FeatureProcessorOptions::VT_TOKENIZE_ON_SCRIPT_CHANGE, static_cast<uint8_t>(tokenize_on_script_change), 0);
   }
+  void add_allowed_chargram_fingerprints(flatbuffers::Offset<flatbuffers::Vector<uint64_t>> allowed_chargram_fingerprints) {
+    fbb_.AddOffset(FeatureProcessorOptions::VT_ALLOWED_CHARGRAM_FINGERPRINTS, allowed_chargram_fingerprints);
+  }
+  void add_embedding_bucket_remap_from(flatbuffers::Offset<flatbuffers::Vector<int32_t>> embedding_bucket_remap_from) {
+    fbb_.AddOffset(FeatureProcessorOptions::VT_EMBEDDING_BUCKET_REMAP_FROM, embedding_bucket_remap_from);
+  }
+  void add_embedding_bucket_remap_to(flatbuffers::Offset<flatbuffers::Vector<int32_t>> embedding_bucket_remap_to) {
+    fbb_.AddOffset(FeatureProcessorOptions::VT_EMBEDDING_BUCKET_REMAP_TO, embedding_bucket_remap_to);
+  }
+  void add_tokenizer_codepoint_page_table(flatbuffers::Offset<libtextclassifier2::FeatureProcessorOptions_::CodepointPageTable> tokenizer_codepoint_page_table) {
+    fbb_.AddOffset(FeatureProcessorOptions::VT_TOKENIZER_CODEPOINT_PAGE_TABLE, tokenizer_codepoint_page_table);
+  }
   explicit FeatureProcessorOptionsBuilder(flatbuffers::FlatBufferBuilder &_fbb)
         : fbb_(_fbb) {
     start_ = fbb_.StartTable();
@@ -2806,8 +3024,16 @@ inline flatbuffers::Offset<FeatureProcessorOptions> CreateFeatureProcessorOption
     flatbuffers::Offset<flatbuffers::Vector<int32_t>> ignored_span_boundary_codepoints = 0,
     flatbuffers::Offset<libtextclassifier2::FeatureProcessorOptions_::BoundsSensitiveFeatures> bounds_sensitive_features = 0,
     flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>> allowed_chargrams = 0,
-    bool tokenize_on_script_change = false) {
+    bool tokenize_on_script_change = false,
+    flatbuffers::Offset<flatbuffers::Vector<uint64_t>> allowed_chargram_fingerprints = 0,
+    flatbuffers::Offset<flatbuffers::Vector<int32_t>> embedding_bucket_remap_from = 0,
+    flatbuffers::Offset<flatbuffers::Vector<int32_t>> embedding_bucket_remap_to = 0,
+    flatbuffers::Offset<libtextclassifier2::FeatureProcessorOptions_::CodepointPageTable> tokenizer_codepoint_page_table = 0) {
   FeatureProcessorOptionsBuilder builder_(_fbb);
+  builder_.add_tokenizer_codepoint_page_table(tokenizer_codepoint_page_table);
+  builder_.add_embedding_bucket_remap_to(embedding_bucket_remap_to);
+  builder_.add_embedding_bucket_remap_from(embedding_bucket_remap_from);
+  builder_.add_allowed_chargram_fingerprints(allowed_chargram_fingerprints);
   builder_.add_allowed_chargrams(allowed_chargrams);
   builder_.add_bounds_sensitive_features(bounds_sensitive_features);
   builder_.add_ignored_span_boundary_codepoints(ignored_span_boundary_codepoints);
@@ -2874,7 +3100,11 @@ inline flatbuffers::Offset<FeatureProcessorOptions> CreateFeatureProcessorOption
     const std::vector<int32_t> *ignored_span_boundary_codepoints = nullptr,
     flatbuffers::Offset<libtextclassifier2::FeatureProcessorOptions_::BoundsSensitiveFeatures> bounds_sensitive_features = 0,
     const std::vector<flatbuffers::Offset<flatbuffers::String>> *allowed_chargrams = nullptr,
-    bool tokenize_on_script_change = false) {
+    bool tokenize_on_script_change = false,
+    const std::vector<uint64_t> *allowed_chargram_fingerprints = nullptr,
+    const std::vector<int32_t> *embedding_bucket_remap_from = nullptr,
+    const std::vector<int32_t> *embedding_bucket_remap_to = nullptr,
+    flatbuffers::Offset<libtextclassifier2::FeatureProcessorOptions_::CodepointPageTable> tokenizer_codepoint_page_table = 0) {
   return libtextclassifier2::CreateFeatureProcessorOptions(
       _fbb,
       num_buckets,
@@ -2907,7 +3137,11 @@ inline flatbuffers::Offset<FeatureProcessorOptions> CreateFeatureProcessorOption
       ignored_span_boundary_codepoints ? _fbb.CreateVector<int32_t>(*ignored_span_boundary_codepoints) : 0,
       bounds_sensitive_features,
       allowed_chargrams ? _fbb.CreateVector<flatbuffers::Offset<flatbuffers::String>>(*allowed_chargrams) : 0,
-      tokenize_on_script_change);
+      tokenize_on_script_change,
+      allowed_chargram_fingerprints ? _fbb.CreateVector<uint64_t>(*allowed_chargram_fingerprints) : 0,
+      embedding_bucket_remap_from ? _fbb.CreateVector<int32_t>(*embedding_bucket_remap_from) : 0,
+      embedding_bucket_remap_to ? _fbb.CreateVector<int32_t>(*embedding_bucket_remap_to) : 0,
+      tokenizer_codepoint_page_table);
 }
 
 flatbuffers::Offset<FeatureProcessorOptions> CreateFeatureProcessorOptions(flatbuffers::FlatBufferBuilder &_fbb, const FeatureProcessorOptionsT *_o, const flatbuffers::rehasher_function_t *_rehasher = nullptr);
@@ -2923,6 +3157,7 @@ inline void CompressedBuffer::UnPackTo(CompressedBufferT *_o, const flatbuffers:
   (void)_resolver;
   { auto _e = buffer(); if (_e) { _o->buffer.resize(_e->size()); for (flatbuffers::uoffset_t _i = 0; _i < _e->size(); _i++) { _o->buffer[_i] = _e->Get(_i); } } };
   { auto _e = uncompressed_size(); _o->uncompressed_size = _e; };
+  { auto _e = codec(); _o->codec = _e; };
 }
 
 inline flatbuffers::Offset<CompressedBuffer> CompressedBuffer::Pack(flatbuffers::FlatBufferBuilder &_fbb, const CompressedBufferT* _o, const flatbuffers::rehasher_function_t *_rehasher) {
@@ -2935,10 +3170,12 @@ inline flatbuffers::Offset<CompressedBuffer> CreateCompressedBuffer(flatbuffers:
   struct _VectorArgs { flatbuffers::FlatBufferBuilder *__fbb; const CompressedBufferT* __o; const flatbuffers::rehasher_function_t *__rehasher; } _va = { &_fbb, _o, _rehasher}; (void)_va;
   auto _buffer = _o->buffer.size() ? _fbb.CreateVector(_o->buffer) : 0;
   auto _uncompressed_size = _o->uncompressed_size;
+  auto _codec = _o->codec;
   return libtextclassifier2::CreateCompressedBuffer(
       _fbb,
       _buffer,
-      _uncompressed_size);
+      _uncompressed_size,
+      _codec);
 }
 
 inline SelectionModelOptionsT *SelectionModelOptions::UnPack(const flatbuffers::resolver_function_t *_resolver) const {
@@ -3029,6 +3266,7 @@ inline void Pattern::UnPackTo(PatternT *_o, const flatbuffers::resolver_function
   { auto _e = priority_score(); _o->priority_score = _e; };
   { auto _e = use_approximate_matching(); _o->use_approximate_matching = _e; };
   { auto _e = compressed_pattern(); if (_e) _o->compressed_pattern = std::unique_ptr<libtextclassifier2::CompressedBufferT>(_e->UnPack(_resolver)); };
+  { auto _e = multi_regex_program(); if (_e) { _o->multi_regex_program.resize(_e->size()); for (flatbuffers::uoffset_t _i = 0; _i < _e->size(); _i++) { _o->multi_regex_program[_i] = _e->Get(_i); } } };
 }
 
 inline flatbuffers::Offset<Pattern> Pattern::Pack(flatbuffers::FlatBufferBuilder &_fbb, const PatternT* _o, const flatbuffers::rehasher_function_t *_rehasher) {
@@ -3046,6 +3284,7 @@ inline flatbuffers::Offset<Pattern> CreatePattern(flatbuffers::FlatBufferBuilder
   auto _priority_score = _o->priority_score;
   auto _use_approximate_matching = _o->use_approximate_matching;
   auto _compressed_pattern = _o->compressed_pattern ? CreateCompressedBuffer(_fbb, _o->compressed_pattern.get(), _rehasher) : 0;
+  auto _multi_regex_program = _o->multi_regex_program.size() ? _fbb.CreateVector(_o->multi_regex_program) : 0;
   return libtextclassifier2::RegexModel_::CreatePattern(
       _fbb,
       _collection_name,
@@ -3054,7 +3293,8 @@ inline flatbuffers::Offset<Pattern> CreatePattern(flatbuffers::FlatBufferBuilder
       _target_classification_score,
       _priority_score,
       _use_approximate_matching,
-      _compressed_pattern);
+      _compressed_pattern,
+      _multi_regex_program);
 }
 
 }  // namespace RegexModel_
@@ -3565,6 +3805,44 @@ inline flatbuffers::Offset<AlternativeCollectionMapEntry> CreateAlternativeColle
       _value);
 }
 
+inline CodepointPageTableT *CodepointPageTable::UnPack(const flatbuffers::resolver_function_t *_resolver) const {
+  auto _o = new CodepointPageTableT();
+  UnPackTo(_o, _resolver);
+  return _o;
+}
+
+inline void CodepointPageTable::UnPackTo(CodepointPageTableT *_o, const flatbuffers::resolver_function_t *_resolver) const {
+  (void)_o;
+  (void)_resolver;
+  { auto _e = page_bits(); _o->page_bits = _e; };
+  { auto _e = class_roles(); if (_e) { _o->class_roles.resize(_e->size()); for (flatbuffers::uoffset_t _i = 0; _i < _e->size(); _i++) { _o->class_roles[_i] = _e->Get(_i); } } };
+  { auto _e = class_script_ids(); if (_e) { _o->class_script_ids.resize(_e->size()); for (flatbuffers::uoffset_t _i = 0; _i < _e->size(); _i++) { _o->class_script_ids[_i] = _e->Get(_i); } } };
+  { auto _e = page_index(); if (_e) { _o->page_index.resize(_e->size()); for (flatbuffers::uoffset_t _i = 0; _i < _e->size(); _i++) { _o->page_index[_i] = _e->Get(_i); } } };
+  { auto _e = pages(); if (_e) { _o->pages.resize(_e->size()); for (flatbuffers::uoffset_t _i = 0; _i < _e->size(); _i++) { _o->pages[_i] = _e->Get(_i); } } };
+}
+
+inline flatbuffers::Offset<CodepointPageTable> CodepointPageTable::Pack(flatbuffers::FlatBufferBuilder &_fbb, const CodepointPageTableT* _o, const flatbuffers::rehasher_function_t *_rehasher) {
+  return CreateCodepointPageTable(_fbb, _o, _rehasher);
+}
+
+inline flatbuffers::Offset<CodepointPageTable> CreateCodepointPageTable(flatbuffers::FlatBufferBuilder &_fbb, const CodepointPageTableT *_o, const flatbuffers::rehasher_function_t *_rehasher) {
+  (void)_rehasher;
+  (void)_o;
+  struct _VectorArgs { flatbuffers::FlatBufferBuilder *__fbb; const CodepointPageTableT* __o; const flatbuffers::rehasher_function_t *__rehasher; } _va = { &_fbb, _o, _rehasher}; (void)_va;
+  auto _page_bits = _o->page_bits;
+  auto _class_roles = _o->class_roles.size() ? _fbb.CreateVector(_o->class_roles) : 0;
+  auto _class_script_ids = _o->class_script_ids.size() ? _fbb.CreateVector(_o->class_script_ids) : 0;
+  auto _page_index = _o->page_index.size() ? _fbb.CreateVector(_o->page_index) : 0;
+  auto _pages = _o->pages.size() ? _fbb.CreateVector(_o->pages) : 0;
+  return libtextclassifier2::FeatureProcessorOptions_::CreateCodepointPageTable(
+      _fbb,
+      _page_bits,
+      _class_roles,
+      _class_script_ids,
+      _page_index,
+      _pages);
+}
+
 }  // namespace FeatureProcessorOptions_
 
 inline FeatureProcessorOptionsT *FeatureProcessorOptions::UnPack(const flatbuffers::resolver_function_t *_resolver) const {
@@ -3607,6 +3885,10 @@ inline void FeatureProcessorOptions::UnPackTo(FeatureProcessorOptionsT *_o, cons
   { auto _e = bounds_sensitive_features(); if (_e) _o->bounds_sensitive_features = std::unique_ptr<libtextclassifier2::FeatureProcessorOptions_::BoundsSensitiveFeaturesT>(_e->UnPack(_resolver)); };
   { auto _e = allowed_chargrams(); if (_e) { _o->allowed_chargrams.resize(_e->size()); for (flatbuffers::uoffset_t _i = 0; _i < _e->size(); _i++) { _o->allowed_chargrams[_i] = _e->Get(_i)->str(); } } };
   { auto _e = tokenize_on_script_change(); _o->tokenize_on_script_change = _e; };
+  { auto _e = allowed_chargram_fingerprints(); if (_e) { _o->allowed_chargram_fingerprints.resize(_e->size()); for (flatbuffers::uoffset_t _i = 0; _i < _e->size(); _i++) { _o->allowed_chargram_fingerprints[_i] = _e->Get(_i); } } };
+  { auto _e = embedding_bucket_remap_from(); if (_e) { _o->embedding_bucket_remap_from.resize(_e->size()); for (flatbuffers::uoffset_t _i = 0; _i < _e->size(); _i++) { _o->embedding_bucket_remap_from[_i] = _e->Get(_i); } } };
+  { auto _e = embedding_bucket_remap_to(); if (_e) { _o->embedding_bucket_remap_to.resize(_e->size()); for (flatbuffers::uoffset_t _i = 0; _i < _e->size(); _i++) { _o->embedding_bucket_remap_to[_i] = _e->Get(_i); } } };
+  { auto _e = tokenizer_codepoint_page_table(); if (_e) _o->tokenizer_codepoint_page_table = std::unique_ptr<libtextclassifier2::FeatureProcessorOptions_::CodepointPageTableT>(_e->UnPack(_resolver)); };
 }
 
 inline flatbuffers::Offset<FeatureProcessorOptions> FeatureProcessorOptions::Pack(flatbuffers::FlatBufferBuilder &_fbb, const FeatureProcessorOptionsT* _o, const flatbuffers::rehasher_function_t *_rehasher) {
@@ -3648,6 +3930,10 @@ inline flatbuffers::Offset<FeatureProcessorOptions> CreateFeatureProcessorOption
   auto _bounds_sensitive_features = _o->bounds_sensitive_features ? CreateBoundsSensitiveFeatures(_fbb, _o->bounds_sensitive_features.get(), _rehasher) : 0;
   auto _allowed_chargrams = _o->allowed_chargrams.size() ? _fbb.CreateVectorOfStrings(_o->allowed_chargrams) : 0;
   auto _tokenize_on_script_change = _o->tokenize_on_script_change;
+  auto _allowed_chargram_fingerprints = _o->allowed_chargram_fingerprints.size() ? _fbb.CreateVector(_o->allowed_chargram_fingerprints) : 0;
+  auto _embedding_bucket_remap_from = _o->embedding_bucket_remap_from.size() ? _fbb.CreateVector(_o->embedding_bucket_remap_from) : 0;
+  auto _embedding_bucket_remap_to = _o->embedding_bucket_remap_to.size() ? _fbb.CreateVector(_o->embedding_bucket_remap_to) : 0;
+  auto _tokenizer_codepoint_page_table = _o->tokenizer_codepoint_page_table ? CreateCodepointPageTable(_fbb, _o->tokenizer_codepoint_page_table.get(), _rehasher) : 0;
   return libtextclassifier2::CreateFeatureProcessorOptions(
       _fbb,
       _num_buckets,
@@ -3680,7 +3966,11 @@ inline flatbuffers::Offset<FeatureProcessorOptions> CreateFeatureProcessorOption
       _ignored_span_boundary_codepoints,
       _bounds_sensitive_features,
       _allowed_chargrams,
-      _tokenize_on_script_change);
+      _tokenize_on_script_change,
+      _allowed_chargram_fingerprints,
+      _embedding_bucket_remap_from,
+      _embedding_bucket_remap_to,
+      _tokenizer_codepoint_page_table);
 }
 
 inline const libtextclassifier2::Model *GetModel(const void *buf) {
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBTEXTCLASSIFIER_NON_OVERLAPPING_SPANS_H_
+#define LIBTEXTCLASSIFIER_NON_OVERLAPPING_SPANS_H_
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "types.h"
+#include "util/base/logging.h"
+#include "util/base/macros.h"
+
+namespace libtextclassifier2 {
+
+// A set of pairwise non-overlapping spans that are chosen greedily from known
+// candidates, e.g. by descending score. The starts of the candidates are
+// declared upfront, after which checking a span against the chosen ones and
+// adding one take O(log n) for n candidates, with no allocation.
+//
+// Keeps the chosen spans in a Fenwick tree over the sorted distinct starts,
+// with the maximal end of the chosen spans in each prefix. A span overlaps a
+// chosen one iff some chosen span that starts before its end also ends after
+// its start.
+//
+// Behaves like a std::set of the chosen spans ordered by their start, which
+// the greedy placements used before: a span is not added if one with the
+// same start already is.
+template <typename Allocator = std::allocator<CodepointIndex>>
+class NonOverlappingSpans {
+ public:
+  explicit NonOverlappingSpans(const Allocator& allocator = Allocator())
+      : starts_(allocator), max_ends_(allocator), has_start_(allocator) {}
+
+  // Declares the candidates in [begin, end), elements with a 'span' member,
+  // in any order. Clears the chosen spans.
+  template <typename Iterator>
+  void Reset(Iterator begin, Iterator end) {
+    starts_.clear();
+    for (Iterator it = begin; it != end; ++it) {
+      starts_.push_back(it->span.first);
+    }
+    std::sort(starts_.begin(), starts_.end());
+    starts_.erase(std::unique(starts_.begin(), starts_.end()), starts_.end());
+    max_ends_.assign(starts_.size() + 1, kNoEnd);
+    has_start_.assign(starts_.size(), 0);
+  }
+
+  // Returns whether 'span' overlaps one of the chosen spans.
+  bool Overlaps(const CodepointSpan& span) const {
+    CodepointIndex max_end = kNoEnd;
+    for (int i = LowerBound(span.second); i > 0; i -= i & -i) {
+      max_end = std::max(max_end, max_ends_[i]);
+    }
+    return max_end > span.first;
+  }
+
+  // Adds 'span', which starts at a declared start and doesn't overlap a chosen
+  // span. Returns false and does nothing if a chosen span starts at the same
+  // position.
+  bool Add(const CodepointSpan& span) {
+    const int index = LowerBound(span.first);
+    TC_DCHECK(index < starts_.size() && starts_[index] == span.first);
+    if (has_start_[index]) {
+      return false;
+    }
+    has_start_[index] = 1;
+    for (int i = index + 1; i < max_ends_.size(); i += i & -i) {
+      max_ends_[i] = std::max(max_ends_[i], span.second);
+    }
+    return true;
+  }
+
+ private:
+  using IndexVector = std::vector<
+      CodepointIndex,
+      typename std::allocator_traits<Allocator>::template rebind_alloc<
+          CodepointIndex>>;
+  using FlagVector = std::vector<
+      char, typename std::allocator_traits<Allocator>::template rebind_alloc<
+                char>>;
+
+  static constexpr CodepointIndex kNoEnd =
+      std::numeric_limits<CodepointIndex>::min();
+
+  // Returns the number of declared starts before 'position'.
+  int LowerBound(CodepointIndex position) const {
+    return std::lower_bound(starts_.begin(), starts_.end(), position) -
+           starts_.begin();
+  }
+
+  // The distinct starts of the candidates, sorted.
+  IndexVector starts_;
+
+  // The Fenwick tree of the maximal ends, one-based: element i holds the
+  // maximum over the chosen spans with a start index in (i - lowbit(i), i].
+  IndexVector max_ends_;
+
+  // Whether a chosen span starts at each of the starts.
+  FlagVector has_start_;
+
+  TC_DISALLOW_COPY_AND_ASSIGN(NonOverlappingSpans);
+};
+
+template <typename Allocator>
+constexpr CodepointIndex NonOverlappingSpans<Allocator>::kNoEnd;
+
+}  // namespace libtextclassifier2
+
+#endif  // LIBTEXTCLASSIFIER_NON_OVERLAPPING_SPANS_H_
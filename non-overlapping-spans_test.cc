@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "non-overlapping-spans.h"
+
+#include <iterator>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+struct Candidate {
+  CodepointSpan span;
+};
+
+TEST(NonOverlappingSpansTest, Overlaps) {
+  const std::vector<Candidate> candidates = {
+      {{5, 8}}, {{0, 3}}, {{2, 6}}, {{8, 9}}, {{3, 5}}};
+  NonOverlappingSpans<> spans;
+  spans.Reset(candidates.begin(), candidates.end());
+  EXPECT_FALSE(spans.Overlaps({2, 6}));
+  EXPECT_TRUE(spans.Add({2, 6}));
+
+  EXPECT_TRUE(spans.Overlaps({0, 3}));
+  EXPECT_TRUE(spans.Overlaps({5, 8}));
+  EXPECT_TRUE(spans.Overlaps({3, 5}));
+  EXPECT_FALSE(spans.Overlaps({8, 9}));
+  EXPECT_FALSE(spans.Overlaps({0, 2}));
+  EXPECT_FALSE(spans.Overlaps({6, 100}));
+  EXPECT_TRUE(spans.Add({8, 9}));
+  EXPECT_TRUE(spans.Overlaps({6, 100}));
+
+  // Like a set ordered by the starts, a second span with a chosen start is not
+  // added.
+  EXPECT_FALSE(spans.Add({2, 2}));
+
+  spans.Reset(candidates.begin(), candidates.end());
+  EXPECT_FALSE(spans.Overlaps({2, 6}));
+}
+
+// The greedy placement with a std::set of the chosen indices ordered by their
+// start, which checks the neighbors of each candidate.
+std::vector<int> ChooseWithSet(const std::vector<Candidate>& candidates) {
+  auto start_less = [&candidates](int a, int b) {
+    return candidates[a].span.first < candidates[b].span.first;
+  };
+  std::set<int, decltype(start_less)> chosen(start_less);
+  std::vector<int> result;
+  for (int i = 0; i < candidates.size(); ++i) {
+    auto it = chosen.lower_bound(i);
+    if (it != chosen.end() &&
+        SpansOverlap(candidates[i].span, candidates[*it].span)) {
+      continue;
+    }
+    if (it != chosen.begin() &&
+        SpansOverlap(candidates[i].span, candidates[*std::prev(it)].span)) {
+      continue;
+    }
+    if (chosen.insert(i).second) {
+      result.push_back(i);
+    }
+  }
+  return result;
+}
+
+TEST(NonOverlappingSpansTest, SameAsSetOfChosenSpans) {
+  std::mt19937 random(1234);
+  for (int round = 0; round < 200; ++round) {
+    std::vector<Candidate> candidates;
+    const int num_candidates = random() % 50;
+    for (int i = 0; i < num_candidates; ++i) {
+      const int start = random() % 100;
+      candidates.push_back({{start, start + static_cast<int>(random() % 8)}});
+    }
+
+    NonOverlappingSpans<> spans;
+    spans.Reset(candidates.begin(), candidates.end());
+    std::vector<int> result;
+    for (int i = 0; i < candidates.size(); ++i) {
+      if (!spans.Overlaps(candidates[i].span) &&
+          spans.Add(candidates[i].span)) {
+        result.push_back(i);
+      }
+    }
+    EXPECT_EQ(result, ChooseWithSet(candidates)) << round;
+  }
+}
+
+}  // namespace
+}  // namespace libtextclassifier2
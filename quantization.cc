@@ -16,8 +16,21 @@
 
 #include "quantization.h"
 
+#include <string.h>
+
+#include <algorithm>
+
 #include "util/base/logging.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define LIBTEXTCLASSIFIER_QUANTIZATION_NEON
+#endif
+
 namespace libtextclassifier2 {
 namespace {
 float DequantizeValue(int num_sparse_features, int quantization_bias,
@@ -25,10 +38,11 @@ float DequantizeValue(int num_sparse_features, int quantization_bias,
   return 1.0 / num_sparse_features * (value - quantization_bias) * multiplier;
 }
 
+const int kQuantizationBias8bit = 128;
+
 void DequantizeAdd8bit(const float* scales, const uint8* embeddings,
                        int bytes_per_embedding, const int num_sparse_features,
                        const int bucket_id, float* dest, int dest_size) {
-  static const int kQuantizationBias8bit = 128;
   const float multiplier = scales[bucket_id];
   for (int k = 0; k < dest_size; ++k) {
     dest[k] +=
@@ -37,28 +51,190 @@ void DequantizeAdd8bit(const float* scales, const uint8* embeddings,
   }
 }
 
+// Reads the i-th 'quantization_bits' wide value from the embedding row.
+inline int ReadNBitValue(const uint8* row, int bytes_per_embedding,
+                         int quantization_bits, int i) {
+  const int bit_offset = i * quantization_bits;
+  const int read16_offset = bit_offset / 8;
+
+  uint16 data = row[read16_offset];
+  // If we are not at the end of the embedding row, we can read 2-byte uint16,
+  // but if we are, we need to only read uint8.
+  if (read16_offset < bytes_per_embedding - 1) {
+    data |= row[read16_offset + 1] << 8;
+  }
+  return (data >> (bit_offset % 8)) & ((1 << quantization_bits) - 1);
+}
+
 void DequantizeAddNBit(const float* scales, const uint8* embeddings,
                        int bytes_per_embedding, int num_sparse_features,
                        int quantization_bits, int bucket_id, float* dest,
                        int dest_size) {
   const int quantization_bias = 1 << (quantization_bits - 1);
   const float multiplier = scales[bucket_id];
+  const uint8* row = embeddings + bucket_id * bytes_per_embedding;
   for (int i = 0; i < dest_size; ++i) {
-    const int bit_offset = i * quantization_bits;
-    const int read16_offset = bit_offset / 8;
-
-    uint16 data = embeddings[bucket_id * bytes_per_embedding + read16_offset];
-    // If we are not at the end of the embedding row, we can read 2-byte uint16,
-    // but if we are, we need to only read uint8.
-    if (read16_offset < bytes_per_embedding - 1) {
-      data |= embeddings[bucket_id * bytes_per_embedding + read16_offset + 1]
-              << 8;
-    }
-    int value = (data >> (bit_offset % 8)) & ((1 << quantization_bits) - 1);
+    const int value =
+        ReadNBitValue(row, bytes_per_embedding, quantization_bits, i);
     dest[i] += DequantizeValue(num_sparse_features, quantization_bias,
                                multiplier, value);
   }
 }
+
+// Vectorized kernels. They compute dest[k] += (values[k] - bias) * factor,
+// and return the number of leading elements they processed; the rest is
+// left to the scalar tail loops of the callers.
+#if defined(__AVX2__)
+int AddScaled8bitVectorized(const uint8* values, int bias, float factor,
+                            float* dest, int size) {
+  const __m256i bias_v = _mm256_set1_epi32(bias);
+  const __m256 factor_v = _mm256_set1_ps(factor);
+  int k = 0;
+  for (; k + 8 <= size; k += 8) {
+    const __m256i ints = _mm256_cvtepu8_epi32(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(values + k)));
+    const __m256 scaled = _mm256_mul_ps(
+        _mm256_cvtepi32_ps(_mm256_sub_epi32(ints, bias_v)), factor_v);
+    _mm256_storeu_ps(dest + k,
+                     _mm256_add_ps(_mm256_loadu_ps(dest + k), scaled));
+  }
+  return k;
+}
+
+int AddScaledInt32Vectorized(const int32* values, int bias, float factor,
+                             float* dest, int size) {
+  const __m256i bias_v = _mm256_set1_epi32(bias);
+  const __m256 factor_v = _mm256_set1_ps(factor);
+  int k = 0;
+  for (; k + 8 <= size; k += 8) {
+    const __m256i ints =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + k));
+    const __m256 scaled = _mm256_mul_ps(
+        _mm256_cvtepi32_ps(_mm256_sub_epi32(ints, bias_v)), factor_v);
+    _mm256_storeu_ps(dest + k,
+                     _mm256_add_ps(_mm256_loadu_ps(dest + k), scaled));
+  }
+  return k;
+}
+#elif defined(__SSE4_1__)
+int AddScaled8bitVectorized(const uint8* values, int bias, float factor,
+                            float* dest, int size) {
+  const __m128i bias_v = _mm_set1_epi32(bias);
+  const __m128 factor_v = _mm_set1_ps(factor);
+  int k = 0;
+  for (; k + 4 <= size; k += 4) {
+    int32 word;
+    memcpy(&word, values + k, sizeof(word));
+    const __m128i ints = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(word));
+    const __m128 scaled =
+        _mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(ints, bias_v)), factor_v);
+    _mm_storeu_ps(dest + k, _mm_add_ps(_mm_loadu_ps(dest + k), scaled));
+  }
+  return k;
+}
+
+int AddScaledInt32Vectorized(const int32* values, int bias, float factor,
+                             float* dest, int size) {
+  const __m128i bias_v = _mm_set1_epi32(bias);
+  const __m128 factor_v = _mm_set1_ps(factor);
+  int k = 0;
+  for (; k + 4 <= size; k += 4) {
+    const __m128i ints =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + k));
+    const __m128 scaled =
+        _mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(ints, bias_v)), factor_v);
+    _mm_storeu_ps(dest + k, _mm_add_ps(_mm_loadu_ps(dest + k), scaled));
+  }
+  return k;
+}
+#elif defined(LIBTEXTCLASSIFIER_QUANTIZATION_NEON)
+int AddScaled8bitVectorized(const uint8* values, int bias, float factor,
+                            float* dest, int size) {
+  const int32x4_t bias_v = vdupq_n_s32(bias);
+  const float32x4_t factor_v = vdupq_n_f32(factor);
+  int k = 0;
+  for (; k + 8 <= size; k += 8) {
+    const uint16x8_t shorts = vmovl_u8(vld1_u8(values + k));
+    const int32x4_t ints_low = vsubq_s32(
+        vreinterpretq_s32_u32(vmovl_u16(vget_low_u16(shorts))), bias_v);
+    const int32x4_t ints_high = vsubq_s32(
+        vreinterpretq_s32_u32(vmovl_u16(vget_high_u16(shorts))), bias_v);
+    vst1q_f32(dest + k,
+              vaddq_f32(vld1q_f32(dest + k),
+                        vmulq_f32(vcvtq_f32_s32(ints_low), factor_v)));
+    vst1q_f32(dest + k + 4,
+              vaddq_f32(vld1q_f32(dest + k + 4),
+                        vmulq_f32(vcvtq_f32_s32(ints_high), factor_v)));
+  }
+  return k;
+}
+
+int AddScaledInt32Vectorized(const int32* values, int bias, float factor,
+                             float* dest, int size) {
+  const int32x4_t bias_v = vdupq_n_s32(bias);
+  const float32x4_t factor_v = vdupq_n_f32(factor);
+  int k = 0;
+  for (; k + 4 <= size; k += 4) {
+    const int32x4_t ints = vsubq_s32(vld1q_s32(values + k), bias_v);
+    vst1q_f32(dest + k, vaddq_f32(vld1q_f32(dest + k),
+                                  vmulq_f32(vcvtq_f32_s32(ints), factor_v)));
+  }
+  return k;
+}
+#else
+int AddScaled8bitVectorized(const uint8* values, int bias, float factor,
+                            float* dest, int size) {
+  return 0;
+}
+
+int AddScaledInt32Vectorized(const int32* values, int bias, float factor,
+                             float* dest, int size) {
+  return 0;
+}
+#endif
+
+void DequantizeAdd8bitVectorized(const float* scales, const uint8* embeddings,
+                                 int bytes_per_embedding,
+                                 int num_sparse_features, int bucket_id,
+                                 float* dest, int dest_size) {
+  const float factor =
+      1.0 / num_sparse_features * static_cast<double>(scales[bucket_id]);
+  const uint8* row = embeddings + bucket_id * bytes_per_embedding;
+  int k = AddScaled8bitVectorized(row, kQuantizationBias8bit, factor, dest,
+                                  dest_size);
+  for (; k < dest_size; ++k) {
+    dest[k] += (row[k] - kQuantizationBias8bit) * factor;
+  }
+}
+
+void DequantizeAddNBitVectorized(const float* scales, const uint8* embeddings,
+                                 int bytes_per_embedding,
+                                 int num_sparse_features,
+                                 int quantization_bits, int bucket_id,
+                                 float* dest, int dest_size) {
+  const int quantization_bias = 1 << (quantization_bits - 1);
+  const float factor =
+      1.0 / num_sparse_features * static_cast<double>(scales[bucket_id]);
+  const uint8* row = embeddings + bucket_id * bytes_per_embedding;
+
+  // Unpack the values in chunks, and dequantize each chunk at once.
+  static const int kChunkSize = 64;
+  int32 values[kChunkSize];
+  for (int chunk_start = 0; chunk_start < dest_size;
+       chunk_start += kChunkSize) {
+    const int chunk_size = std::min(kChunkSize, dest_size - chunk_start);
+    for (int i = 0; i < chunk_size; ++i) {
+      values[i] = ReadNBitValue(row, bytes_per_embedding, quantization_bits,
+                                chunk_start + i);
+    }
+    float* chunk_dest = dest + chunk_start;
+    int k = AddScaledInt32Vectorized(values, quantization_bias, factor,
+                                     chunk_dest, chunk_size);
+    for (; k < chunk_size; ++k) {
+      chunk_dest[k] += (values[k] - quantization_bias) * factor;
+    }
+  }
+}
 }  // namespace
 
 bool CheckQuantizationParams(int bytes_per_embedding, int quantization_bits,
@@ -74,10 +250,32 @@ bool DequantizeAdd(const float* scales, const uint8* embeddings,
                    int bytes_per_embedding, int num_sparse_features,
                    int quantization_bits, int bucket_id, float* dest,
                    int dest_size) {
+  if (quantization_bits == 8) {
+    DequantizeAdd8bitVectorized(scales, embeddings, bytes_per_embedding,
+                                num_sparse_features, bucket_id, dest,
+                                dest_size);
+  } else if (quantization_bits > 0 && quantization_bits < 8) {
+    DequantizeAddNBitVectorized(scales, embeddings, bytes_per_embedding,
+                                num_sparse_features, quantization_bits,
+                                bucket_id, dest, dest_size);
+  } else {
+    TC_LOG(ERROR) << "Unsupported quantization_bits: " << quantization_bits;
+    return false;
+  }
+
+  return true;
+}
+
+namespace internal {
+
+bool DequantizeAddScalar(const float* scales, const uint8* embeddings,
+                         int bytes_per_embedding, int num_sparse_features,
+                         int quantization_bits, int bucket_id, float* dest,
+                         int dest_size) {
   if (quantization_bits == 8) {
     DequantizeAdd8bit(scales, embeddings, bytes_per_embedding,
                       num_sparse_features, bucket_id, dest, dest_size);
-  } else if (quantization_bits != 8) {
+  } else if (quantization_bits > 0 && quantization_bits < 8) {
     DequantizeAddNBit(scales, embeddings, bytes_per_embedding,
                       num_sparse_features, quantization_bits, bucket_id, dest,
                       dest_size);
@@ -89,4 +287,5 @@ bool DequantizeAdd(const float* scales, const uint8* embeddings,
   return true;
 }
 
+}  // namespace internal
 }  // namespace libtextclassifier2
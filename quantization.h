@@ -26,14 +26,28 @@ bool CheckQuantizationParams(int bytes_per_embedding, int quantization_bits,
                              int output_embedding_size);
 
 // Dequantizes embeddings (quantized to 1 to 8 bits) into the floats they
-// represent. The algorithm proceeds by reading 2-byte words from the embedding
-// storage to handle well the cases when the quantized value crosses the byte-
-// boundary.
+// represent, and adds them to 'dest'. The algorithm proceeds by reading 2-byte
+// words from the embedding storage to handle well the cases when the quantized
+// value crosses the byte-boundary.
 bool DequantizeAdd(const float* scales, const uint8* embeddings,
                    int bytes_per_embedding, int num_sparse_features,
                    int quantization_bits, int bucket_id, float* dest,
                    int dest_size);
 
+// NOTE: DequantizeAdd() uses vector instructions where the target supports
+// them (AVX2, SSE4.1 or NEON), which can make its results differ from the
+// scalar computation in the last bits.
+
+namespace internal {
+
+// Scalar reference implementation of DequantizeAdd(), with the same interface.
+bool DequantizeAddScalar(const float* scales, const uint8* embeddings,
+                         int bytes_per_embedding, int num_sparse_features,
+                         int quantization_bits, int bucket_id, float* dest,
+                         int dest_size);
+
+}  // namespace internal
+
 }  // namespace libtextclassifier2
 
 #endif  // LIBTEXTCLASSIFIER_QUANTIZATION_H_
@@ -159,5 +159,50 @@ TEST(QuantizationTest, DequantizeAdd3bit) {
   EXPECT_THAT(dest, ElementsAreFloat(expected));
 }
 
+TEST(QuantizationTest, DequantizeAddMatchesScalar) {
+  const int num_buckets = 5;
+  const int num_sparse_features = 3;
+  for (int quantization_bits = 1; quantization_bits <= 8;
+       ++quantization_bits) {
+    for (const int dest_size : {1, 3, 4, 7, 8, 15, 16, 33, 64, 70}) {
+      const int bytes_per_embedding =
+          (dest_size * quantization_bits + 7) / 8;
+      std::vector<float> scales(num_buckets);
+      for (int i = 0; i < num_buckets; ++i) {
+        scales[i] = 0.5 + i;
+      }
+      std::vector<uint8> embeddings(bytes_per_embedding * num_buckets);
+      for (int i = 0; i < embeddings.size(); ++i) {
+        embeddings[i] = (i * 37 + 11) & 0xFF;
+      }
+
+      for (int bucket_id = 0; bucket_id < num_buckets; ++bucket_id) {
+        std::vector<float> dest(dest_size, 0.25);
+        std::vector<float> expected(dest_size, 0.25);
+        EXPECT_TRUE(DequantizeAdd(scales.data(), embeddings.data(),
+                                  bytes_per_embedding, num_sparse_features,
+                                  quantization_bits, bucket_id, dest.data(),
+                                  dest.size()));
+        EXPECT_TRUE(internal::DequantizeAddScalar(
+            scales.data(), embeddings.data(), bytes_per_embedding,
+            num_sparse_features, quantization_bits, bucket_id,
+            expected.data(), expected.size()));
+        EXPECT_THAT(dest, ElementsAreFloat(expected));
+      }
+    }
+  }
+}
+
+TEST(QuantizationTest, DequantizeAddUnsupportedBits) {
+  std::vector<float> scales(1, 1.0);
+  std::vector<uint8> embeddings(4, 0);
+  std::vector<float> dest(2);
+  EXPECT_FALSE(DequantizeAdd(scales.data(), embeddings.data(),
+                             /*bytes_per_embedding=*/4,
+                             /*num_sparse_features=*/1,
+                             /*quantization_bits=*/0, /*bucket_id=*/0,
+                             dest.data(), dest.size()));
+}
+
 }  // namespace
 }  // namespace libtextclassifier2
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "request-tracer.h"
+
+#include <chrono>  // NOLINT
+#include <cstdio>
+
+#ifdef __ANDROID__
+#define ATRACE_TAG ATRACE_TAG_APP
+#include <cutils/trace.h>
+#endif  // __ANDROID__
+
+namespace libtextclassifier2 {
+namespace {
+thread_local PhaseCounters* traced_phase_counters = nullptr;
+
+// The start of the phases traced on the calling thread by any aggregating
+// tracer, which is enough because the phases of a request don't overlap.
+thread_local std::chrono::steady_clock::time_point
+    aggregated_phase_starts[static_cast<int>(TracedPhase::NUM_PHASES)];
+
+void AddCounters(const PhaseCounters& from, PhaseCounters* to) {
+  to->tokens += from.tokens;
+  to->model_batches += from.model_batches;
+  to->rules += from.rules;
+  to->conflicts += from.conflicts;
+  to->gated_lines += from.gated_lines;
+  to->avoided_classifications += from.avoided_classifications;
+  to->results += from.results;
+}
+}  // namespace
+
+const char* TracedPhaseName(TracedPhase phase) {
+  switch (phase) {
+    case TracedPhase::MODEL_ANNOTATE:
+      return "model_annotate";
+    case TracedPhase::MODEL_SUGGEST_SELECTION:
+      return "model_suggest_selection";
+    case TracedPhase::MODEL_CLASSIFY_TEXT:
+      return "model_classify_text";
+    case TracedPhase::REGEX:
+      return "regex";
+    case TracedPhase::DATETIME:
+      return "datetime";
+    case TracedPhase::RESOLVE_CONFLICTS:
+      return "resolve_conflicts";
+    default:
+      return "unknown";
+  }
+}
+
+PhaseCounters* TracedPhaseCounters() { return traced_phase_counters; }
+
+void ScopedPhaseTrace::Begin() {
+  enclosing_counters_ = traced_phase_counters;
+  traced_phase_counters = &counters_;
+  tracer_->BeginPhase(phase_);
+}
+
+void ScopedPhaseTrace::End() {
+  traced_phase_counters = enclosing_counters_;
+  tracer_->EndPhase(phase_, counters_);
+}
+
+void AggregatingRequestTracer::BeginPhase(TracedPhase phase) {
+  aggregated_phase_starts[static_cast<int>(phase)] =
+      std::chrono::steady_clock::now();
+}
+
+void AggregatingRequestTracer::EndPhase(TracedPhase phase,
+                                        const PhaseCounters& counters) {
+  const int64 micros =
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() -
+          aggregated_phase_starts[static_cast<int>(phase)])
+          .count();
+  int bucket = 0;
+  while (bucket < kNumLatencyBuckets - 1 && (int64{1} << bucket) <= micros) {
+    ++bucket;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  PhaseStats* stats = &stats_[static_cast<int>(phase)];
+  ++stats->runs;
+  stats->total_micros += micros;
+  ++stats->latency_buckets[bucket];
+  AddCounters(counters, &stats->counters);
+}
+
+AggregatingRequestTracer::PhaseStats AggregatingRequestTracer::GetStats(
+    TracedPhase phase) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_[static_cast<int>(phase)];
+}
+
+void AggregatingRequestTracer::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (PhaseStats& stats : stats_) {
+    stats = PhaseStats();
+  }
+}
+
+#ifdef __ANDROID__
+void ATraceRequestTracer::BeginPhase(TracedPhase phase) {
+  char name[64];
+  snprintf(name, sizeof(name), "TextClassifier:%s", TracedPhaseName(phase));
+  ATRACE_BEGIN(name);
+}
+
+void ATraceRequestTracer::EndPhase(TracedPhase phase,
+                                   const PhaseCounters& counters) {
+  ATRACE_END();
+}
+#endif  // __ANDROID__
+
+}  // namespace libtextclassifier2
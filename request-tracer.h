@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Opt-in tracing of the phases of single requests, e.g. to find out in
+// production where a slow request spent its time.
+
+#ifndef LIBTEXTCLASSIFIER_REQUEST_TRACER_H_
+#define LIBTEXTCLASSIFIER_REQUEST_TRACER_H_
+
+#include <mutex>  // NOLINT
+
+#include "util/base/integral_types.h"
+#include "util/base/macros.h"
+
+namespace libtextclassifier2 {
+
+enum class TracedPhase {
+  // The selection and classification models over the context in Annotate().
+  MODEL_ANNOTATE = 0,
+  // The selection model around the click in SuggestSelection().
+  MODEL_SUGGEST_SELECTION,
+  // The classification model in ClassifyText().
+  MODEL_CLASSIFY_TEXT,
+  REGEX,
+  DATETIME,
+  RESOLVE_CONFLICTS,
+  NUM_PHASES,
+};
+
+// Returns a human readable name of the phase.
+const char* TracedPhaseName(TracedPhase phase);
+
+// What a phase did. Only the counters that make sense for the phase are set.
+struct PhaseCounters {
+  int64 tokens = 0;
+  int64 model_batches = 0;
+  int64 rules = 0;
+  int64 conflicts = 0;
+  // The lines that the model gate kept from the selection model, see
+  // ModelGateOptions.
+  int64 gated_lines = 0;
+  // The model classifications that the conflict resolution didn't need to
+  // run, as the candidates with the same span were merged.
+  int64 avoided_classifications = 0;
+  // The spans or classifications that the phase produced.
+  int64 results = 0;
+};
+
+// Receives the phases of the requests that it's set for in their options.
+// The phases of one request don't overlap, and run on the calling thread,
+// except the lines with AnnotationOptions::num_line_threads > 1, whose counters
+// are not accounted, and the annotation phases with
+// AnnotationOptions::task_runner, which overlap and run on its threads. A
+// tracer shared by concurrent requests, or used with a task runner, must be
+// thread-safe.
+class RequestTracer {
+ public:
+  virtual ~RequestTracer() {}
+
+  virtual void BeginPhase(TracedPhase phase) = 0;
+  virtual void EndPhase(TracedPhase phase, const PhaseCounters& counters) = 0;
+};
+
+// Returns the counters of the phase traced on the calling thread, or nullptr
+// if none is.
+PhaseCounters* TracedPhaseCounters();
+
+// Traces a phase between its construction and destruction, if 'tracer' is not
+// nullptr, and otherwise does nothing.
+class ScopedPhaseTrace {
+ public:
+  ScopedPhaseTrace(RequestTracer* tracer, TracedPhase phase)
+      : tracer_(tracer), phase_(phase) {
+    if (tracer_ != nullptr) {
+      Begin();
+    }
+  }
+
+  ~ScopedPhaseTrace() {
+    if (tracer_ != nullptr) {
+      End();
+    }
+  }
+
+  // Sets the number of results of the phase.
+  void SetResults(int64 num_results) {
+    if (tracer_ != nullptr) {
+      counters_.results = num_results;
+    }
+  }
+
+ private:
+  void Begin();
+  void End();
+
+  RequestTracer* const tracer_;
+  const TracedPhase phase_;
+  PhaseCounters counters_;
+  PhaseCounters* enclosing_counters_ = nullptr;
+
+  TC_DISALLOW_COPY_AND_ASSIGN(ScopedPhaseTrace);
+};
+
+// Aggregates the phases of all requests into totals and latency histograms.
+// Thread-safe.
+class AggregatingRequestTracer : public RequestTracer {
+ public:
+  // Bucket i counts the phases that took [2^(i-1), 2^i) microseconds, the
+  // first one those under a microsecond and the last one all longer ones.
+  static const int kNumLatencyBuckets = 24;
+
+  struct PhaseStats {
+    int64 runs = 0;
+    int64 total_micros = 0;
+    int64 latency_buckets[kNumLatencyBuckets] = {};
+    PhaseCounters counters;
+  };
+
+  AggregatingRequestTracer() {}
+
+  void BeginPhase(TracedPhase phase) override;
+  void EndPhase(TracedPhase phase, const PhaseCounters& counters) override;
+
+  PhaseStats GetStats(TracedPhase phase) const;
+  void Clear();
+
+ private:
+  static const int kNumPhases = static_cast<int>(TracedPhase::NUM_PHASES);
+
+  mutable std::mutex mutex_;
+  PhaseStats stats_[kNumPhases];
+
+  TC_DISALLOW_COPY_AND_ASSIGN(AggregatingRequestTracer);
+};
+
+#ifdef __ANDROID__
+// Emits the phases as ATrace sections of the app tag, e.g. for Perfetto or
+// systrace, named "TextClassifier:<phase>".
+class ATraceRequestTracer : public RequestTracer {
+ public:
+  ATraceRequestTracer() {}
+
+  void BeginPhase(TracedPhase phase) override;
+  void EndPhase(TracedPhase phase, const PhaseCounters& counters) override;
+
+ private:
+  TC_DISALLOW_COPY_AND_ASSIGN(ATraceRequestTracer);
+};
+#endif  // __ANDROID__
+
+}  // namespace libtextclassifier2
+
+#endif  // LIBTEXTCLASSIFIER_REQUEST_TRACER_H_
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "request-tracer.h"
+
+#include <utility>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+class RecordingTracer : public RequestTracer {
+ public:
+  void BeginPhase(TracedPhase phase) override {
+    events.push_back({phase, -1});
+  }
+  void EndPhase(TracedPhase phase, const PhaseCounters& counters) override {
+    events.push_back({phase, counters.rules});
+  }
+
+  std::vector<std::pair<TracedPhase, int64>> events;
+};
+
+TEST(RequestTracerTest, TracesPhasesWithTheirCounters) {
+  RecordingTracer tracer;
+  EXPECT_EQ(TracedPhaseCounters(), nullptr);
+  {
+    ScopedPhaseTrace trace(&tracer, TracedPhase::REGEX);
+    ASSERT_NE(TracedPhaseCounters(), nullptr);
+    TracedPhaseCounters()->rules += 3;
+  }
+  EXPECT_EQ(TracedPhaseCounters(), nullptr);
+  EXPECT_THAT(tracer.events,
+              testing::ElementsAre(std::make_pair(TracedPhase::REGEX, -1),
+                                   std::make_pair(TracedPhase::REGEX, 3)));
+}
+
+TEST(RequestTracerTest, DoesNothingWithoutTracer) {
+  ScopedPhaseTrace trace(nullptr, TracedPhase::REGEX);
+  trace.SetResults(5);
+  EXPECT_EQ(TracedPhaseCounters(), nullptr);
+}
+
+TEST(RequestTracerTest, Aggregates) {
+  AggregatingRequestTracer tracer;
+  for (int i = 0; i < 3; ++i) {
+    ScopedPhaseTrace trace(&tracer, TracedPhase::DATETIME);
+    trace.SetResults(2);
+  }
+  const AggregatingRequestTracer::PhaseStats stats =
+      tracer.GetStats(TracedPhase::DATETIME);
+  EXPECT_EQ(stats.runs, 3);
+  EXPECT_EQ(stats.counters.results, 6);
+  int64 num_bucketed = 0;
+  for (const int64 bucket : stats.latency_buckets) {
+    num_bucketed += bucket;
+  }
+  EXPECT_EQ(num_bucketed, 3);
+  EXPECT_EQ(tracer.GetStats(TracedPhase::REGEX).runs, 0);
+
+  tracer.Clear();
+  EXPECT_EQ(tracer.GetStats(TracedPhase::DATETIME).runs, 0);
+}
+
+}  // namespace
+}  // namespace libtextclassifier2
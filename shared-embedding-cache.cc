@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shared-embedding-cache.h"
+
+#include <algorithm>
+
+#include "util/hash/farmhash.h"
+
+namespace libtextclassifier2 {
+
+SharedEmbeddingCache::SharedEmbeddingCache(int embedding_size,
+                                           int64 max_memory_bytes,
+                                           int num_shards)
+    : embedding_size_(embedding_size), num_hits_(0), num_misses_(0) {
+  num_shards = std::max(1, num_shards);
+  const int64 entries_per_shard =
+      std::max<int64>(1, max_memory_bytes / EntryBytes() / num_shards);
+  for (int i = 0; i < num_shards; ++i) {
+    shards_.emplace_back(new Shard(entries_per_shard));
+  }
+}
+
+uint64 SharedEmbeddingCache::TokenKey(const Token& token, uint64 salt) {
+  // The padding token has its own features, unlike the empty token.
+  return tc2farmhash::Fingerprint64(token.value) ^
+         (salt * 0x9E3779B97F4A7C15ULL) ^ (token.is_padding ? 1 : 0);
+}
+
+bool SharedEmbeddingCache::Find(uint64 key, float* embedding) const {
+  Shard* shard = ShardOf(key);
+  {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    const std::vector<float>* cached = shard->embeddings.Get(key);
+    if (cached != nullptr) {
+      std::copy(cached->begin(), cached->end(), embedding);
+      ++num_hits_;
+      return true;
+    }
+  }
+  ++num_misses_;
+  return false;
+}
+
+void SharedEmbeddingCache::Insert(uint64 key, const float* embedding) const {
+  // Copies outside of the lock.
+  std::vector<float> value(embedding, embedding + embedding_size_);
+  Shard* shard = ShardOf(key);
+  std::lock_guard<std::mutex> lock(shard->mutex);
+  shard->embeddings.Put(key, std::move(value));
+}
+
+void SharedEmbeddingCache::Clear() const {
+  for (const std::unique_ptr<Shard>& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    shard->embeddings.Clear();
+  }
+}
+
+SharedEmbeddingCache::Stats SharedEmbeddingCache::GetStats() const {
+  Stats stats;
+  stats.num_hits = num_hits_;
+  stats.num_misses = num_misses_;
+  for (const std::unique_ptr<Shard>& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    stats.num_entries += shard->embeddings.size();
+  }
+  stats.memory_bytes = stats.num_entries * EntryBytes();
+  return stats;
+}
+
+int64 SharedEmbeddingCache::EntryBytes() const {
+  // The values, and roughly a list node, a vector and a hash node.
+  return embedding_size_ * sizeof(float) + 96;
+}
+
+}  // namespace libtextclassifier2
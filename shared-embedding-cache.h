@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBTEXTCLASSIFIER_SHARED_EMBEDDING_CACHE_H_
+#define LIBTEXTCLASSIFIER_SHARED_EMBEDDING_CACHE_H_
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "types.h"
+#include "util/base/integral_types.h"
+#include "util/base/lru-cache.h"
+#include "util/base/macros.h"
+
+namespace libtextclassifier2 {
+
+// A cache of token embeddings shared by the requests of a model. Unlike
+// FeatureProcessor::EmbeddingCache, which maps the codepoint spans of one
+// context, it maps the token texts, because the embedding of a token only
+// depends on its text: the embeddings of the common tokens are computed once
+// instead of once per request.
+// The entries are split into shards by key, each with its own lock, so that
+// concurrent requests rarely wait for each other, and each shard evicts its
+// least recently used embeddings to stay within its share of the memory cap.
+// NOTE: This class is thread-safe.
+class SharedEmbeddingCache {
+ public:
+  // Caches embeddings of 'embedding_size' values in up to about
+  // 'max_memory_bytes', including the bookkeeping of the entries.
+  SharedEmbeddingCache(int embedding_size, int64 max_memory_bytes,
+                       int num_shards = 16);
+
+  // Returns the key of the token's embedding. Tokens of feature processors
+  // with different feature options have different embeddings, so they need
+  // different 'salt'.
+  static uint64 TokenKey(const Token& token, uint64 salt);
+
+  // Copies the cached embedding into 'embedding', which has room for
+  // embedding_size() values. Returns false if it's not cached. Counts the
+  // lookup as a hit or a miss.
+  bool Find(uint64 key, float* embedding) const;
+
+  // Caches the embedding of embedding_size() values, as the most recently
+  // used one of its shard.
+  void Insert(uint64 key, const float* embedding) const;
+
+  // Removes all the embeddings, but keeps the counters.
+  void Clear() const;
+
+  struct Stats {
+    int64 num_hits = 0;
+    int64 num_misses = 0;
+    int64 num_entries = 0;
+    int64 memory_bytes = 0;
+  };
+
+  Stats GetStats() const;
+
+  int embedding_size() const { return embedding_size_; }
+
+ private:
+  struct Shard {
+    explicit Shard(int capacity) : embeddings(capacity) {}
+
+    std::mutex mutex;
+    LruCache<uint64, std::vector<float>> embeddings;
+  };
+
+  Shard* ShardOf(uint64 key) const {
+    return shards_[(key >> 32) % shards_.size()].get();
+  }
+
+  // The estimated memory of an entry.
+  int64 EntryBytes() const;
+
+  const int embedding_size_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+
+  mutable std::atomic<int64> num_hits_;
+  mutable std::atomic<int64> num_misses_;
+
+  TC_DISALLOW_COPY_AND_ASSIGN(SharedEmbeddingCache);
+};
+
+}  // namespace libtextclassifier2
+
+#endif  // LIBTEXTCLASSIFIER_SHARED_EMBEDDING_CACHE_H_
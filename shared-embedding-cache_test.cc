@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shared-embedding-cache.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+using testing::ElementsAre;
+
+TEST(SharedEmbeddingCacheTest, FindsInsertedEmbeddings) {
+  SharedEmbeddingCache cache(/*embedding_size=*/2, /*max_memory_bytes=*/1000,
+                             /*num_shards=*/1);
+  const uint64 key = SharedEmbeddingCache::TokenKey(Token("the", 0, 3), 0);
+  std::vector<float> embedding(2);
+  EXPECT_FALSE(cache.Find(key, embedding.data()));
+
+  const std::vector<float> the_embedding = {0.5, -1.0};
+  cache.Insert(key, the_embedding.data());
+  EXPECT_TRUE(cache.Find(key, embedding.data()));
+  EXPECT_THAT(embedding, ElementsAre(0.5, -1.0));
+
+  // The key only depends on the text of the token.
+  EXPECT_TRUE(cache.Find(
+      SharedEmbeddingCache::TokenKey(Token("the", 10, 13), 0),
+      embedding.data()));
+  EXPECT_FALSE(cache.Find(
+      SharedEmbeddingCache::TokenKey(Token("the", 0, 3), 1),
+      embedding.data()));
+
+  const SharedEmbeddingCache::Stats stats = cache.GetStats();
+  EXPECT_EQ(stats.num_hits, 2);
+  EXPECT_EQ(stats.num_misses, 2);
+  EXPECT_EQ(stats.num_entries, 1);
+  EXPECT_GT(stats.memory_bytes, 0);
+
+  cache.Clear();
+  EXPECT_FALSE(cache.Find(key, embedding.data()));
+  EXPECT_EQ(cache.GetStats().num_entries, 0);
+}
+
+TEST(SharedEmbeddingCacheTest, PaddingTokenHasItsOwnKey) {
+  EXPECT_NE(SharedEmbeddingCache::TokenKey(Token(), 0),
+            SharedEmbeddingCache::TokenKey(Token("", 0, 0), 0));
+}
+
+TEST(SharedEmbeddingCacheTest, StaysWithinMemoryCap) {
+  const int64 max_memory_bytes = 10000;
+  SharedEmbeddingCache cache(/*embedding_size=*/16, max_memory_bytes,
+                             /*num_shards=*/4);
+  const std::vector<float> embedding(16, 1.0);
+  for (int i = 0; i < 1000; ++i) {
+    cache.Insert(SharedEmbeddingCache::TokenKey(
+                     Token(std::to_string(i), 0, 1), 0),
+                 embedding.data());
+  }
+  const SharedEmbeddingCache::Stats stats = cache.GetStats();
+  EXPECT_GT(stats.num_entries, 0);
+  EXPECT_LE(stats.memory_bytes, max_memory_bytes);
+
+  // The most recently inserted embedding is kept.
+  std::vector<float> found(16);
+  EXPECT_TRUE(cache.Find(
+      SharedEmbeddingCache::TokenKey(Token("999", 0, 1), 0), found.data()));
+}
+
+TEST(SharedEmbeddingCacheTest, ConcurrentUse) {
+  SharedEmbeddingCache cache(/*embedding_size=*/4, /*max_memory_bytes=*/100000);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&cache]() {
+      std::vector<float> embedding(4, 2.0);
+      for (int i = 0; i < 1000; ++i) {
+        const uint64 key = SharedEmbeddingCache::TokenKey(
+            Token(std::to_string(i % 50), 0, 1), 0);
+        if (!cache.Find(key, embedding.data())) {
+          cache.Insert(key, embedding.data());
+        }
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  const SharedEmbeddingCache::Stats stats = cache.GetStats();
+  EXPECT_EQ(stats.num_hits + stats.num_misses, 4000);
+  EXPECT_EQ(stats.num_entries, 50);
+}
+
+}  // namespace
+}  // namespace libtextclassifier2
@@ -0,0 +1,229 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shared-model-data.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "model-executor.h"
+#include "model-precompute.h"
+#include "util/base/logging.h"
+#include "util/memory/mmap.h"
+#include "zlib-utils.h"
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS 1033
+#define F_GET_SEALS 1034
+#define F_SEAL_SEAL 0x0001
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW 0x0004
+#define F_SEAL_WRITE 0x0008
+#endif
+
+namespace libtextclassifier2 {
+
+namespace {
+
+// The alignment of the embedding table in the region.
+const int kEmbeddingsAlignment = 64;
+
+const int kSeals = F_SEAL_SEAL | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE;
+
+// Returns the model with the lookup tables precomputed and the patterns
+// decompressed, or an empty string on error.
+std::string ExpandModel(const std::string& model) {
+  const std::string precomputed_model =
+      PrecomputeLookupTablesInSerializedModel(model);
+  if (precomputed_model.empty()) {
+    return "";
+  }
+  std::unique_ptr<ModelT> unpacked_model =
+      UnPackModel(precomputed_model.c_str());
+  if (unpacked_model == nullptr || !DecompressModel(unpacked_model.get())) {
+    return "";
+  }
+  flatbuffers::FlatBufferBuilder builder;
+  FinishModelBuffer(builder, Model::Pack(builder, unpacked_model.get()));
+  return std::string(reinterpret_cast<const char*>(builder.GetBufferPointer()),
+                     builder.GetSize());
+}
+
+// Appends the dequantized embedding table of the model, aligned, and sets its
+// offset and size in the trailer. Returns false on error.
+bool AppendDequantizedEmbeddings(const Model* model, std::string* data,
+                                 SharedModelDataTrailer* trailer) {
+  if (model->embedding_model() == nullptr ||
+      model->classification_feature_options() == nullptr) {
+    return true;
+  }
+  const std::unique_ptr<TFLiteEmbeddingExecutor> executor =
+      TFLiteEmbeddingExecutor::Instance(
+          model->embedding_model(),
+          model->classification_feature_options()->embedding_size(),
+          model->classification_feature_options()
+              ->embedding_quantization_bits(),
+          /*dequantize_embeddings=*/true);
+  if (executor == nullptr) {
+    return false;
+  }
+  data->resize((data->size() + kEmbeddingsAlignment - 1) /
+               kEmbeddingsAlignment * kEmbeddingsAlignment);
+  trailer->embeddings_offset = data->size();
+  trailer->embeddings_size = executor->NumDequantizedEmbeddingValues();
+  data->append(reinterpret_cast<const char*>(executor->DequantizedEmbeddings()),
+               trailer->embeddings_size * sizeof(float));
+  return true;
+}
+
+// Writes all of the data to the file descriptor. Returns false on error.
+bool WriteFully(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    const ssize_t written = write(fd, data, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += written;
+    size -= written;
+  }
+  return true;
+}
+
+}  // namespace
+
+std::string BuildSharedModelData(const std::string& model,
+                                 bool dequantize_embeddings) {
+  if (ViewModel(model.data(), model.size()) == nullptr) {
+    TC_LOG(ERROR) << "Model verification failed.";
+    return "";
+  }
+  std::string data = ExpandModel(model);
+  if (data.empty()) {
+    TC_LOG(ERROR) << "Could not expand the model.";
+    return "";
+  }
+
+  SharedModelDataTrailer trailer;
+  memset(&trailer, 0, sizeof(trailer));
+  trailer.magic = kSharedModelDataMagic;
+  trailer.version = kSharedModelDataVersion;
+  trailer.model_size = data.size();
+  if (dequantize_embeddings &&
+      !AppendDequantizedEmbeddings(GetModel(data.data()), &data, &trailer)) {
+    TC_LOG(ERROR) << "Could not dequantize the embeddings.";
+    return "";
+  }
+  trailer.fingerprint = ModelFingerprint(data.data(), data.size());
+  data.append(reinterpret_cast<const char*>(&trailer), sizeof(trailer));
+  return data;
+}
+
+int PublishSharedModelData(const std::string& model,
+                           bool dequantize_embeddings, uint64* fingerprint) {
+#ifdef __NR_memfd_create
+  const std::string data = BuildSharedModelData(model, dequantize_embeddings);
+  if (data.empty()) {
+    return -1;
+  }
+  const int fd = syscall(__NR_memfd_create, "libtextclassifier-model",
+                         MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0) {
+    TC_LOG(ERROR) << "Unable to create a memfd.";
+    return -1;
+  }
+  if (!WriteFully(fd, data.data(), data.size()) ||
+      fcntl(fd, F_ADD_SEALS, kSeals) != 0) {
+    TC_LOG(ERROR) << "Unable to write and seal the memfd.";
+    close(fd);
+    return -1;
+  }
+  if (fingerprint != nullptr) {
+    SharedModelDataTrailer trailer;
+    memcpy(&trailer, data.data() + data.size() - sizeof(trailer),
+           sizeof(trailer));
+    *fingerprint = trailer.fingerprint;
+  }
+  return fd;
+#else
+  TC_LOG(ERROR) << "memfd is not supported.";
+  return -1;
+#endif
+}
+
+std::unique_ptr<TextClassifier> FromSharedModelData(
+    int fd, const UniLib* unilib, const LoadOptions& load_options) {
+  // Only a sealed region can't change under the trusted model.
+  const int seals = fcntl(fd, F_GET_SEALS);
+  if (seals < 0 || (seals & kSeals) != kSeals) {
+    TC_LOG(ERROR) << "The shared model data is not sealed.";
+    return nullptr;
+  }
+  struct stat sb;
+  SharedModelDataTrailer trailer;
+  if (fstat(fd, &sb) != 0 || sb.st_size < sizeof(trailer) ||
+      pread(fd, &trailer, sizeof(trailer), sb.st_size - sizeof(trailer)) !=
+          sizeof(trailer) ||
+      trailer.magic != kSharedModelDataMagic ||
+      trailer.version != kSharedModelDataVersion) {
+    TC_LOG(ERROR) << "Not a shared model data region.";
+    return nullptr;
+  }
+  const uint64 data_size = sb.st_size - sizeof(trailer);
+  if (trailer.model_size > data_size ||
+      trailer.embeddings_offset % kEmbeddingsAlignment != 0 ||
+      trailer.embeddings_offset + trailer.embeddings_size * sizeof(float) >
+          data_size) {
+    TC_LOG(ERROR) << "Invalid shared model data trailer.";
+    return nullptr;
+  }
+
+  // The model is followed by its embeddings in one mapping, which the
+  // classifier keeps. The mapping is verified by the load unless it matches
+  // the trusted fingerprint of the caller, as the trailer's own is written by
+  // the publisher.
+  std::unique_ptr<ScopedMmap> mmap(
+      new ScopedMmap(fd, /*segment_offset=*/0, data_size));
+  if (!mmap->handle().ok()) {
+    TC_LOG(ERROR) << "Unable to map the shared model data.";
+    return nullptr;
+  }
+  LoadOptions shared_load_options = load_options;
+  if (trailer.embeddings_size > 0) {
+    shared_load_options.dequantize_embeddings = false;
+    shared_load_options.shared_dequantized_embeddings =
+        reinterpret_cast<const float*>(
+            static_cast<const char*>(mmap->handle().start()) +
+            trailer.embeddings_offset);
+    shared_load_options.shared_dequantized_embeddings_size =
+        trailer.embeddings_size;
+  }
+  return TextClassifier::FromScopedMmap(&mmap, unilib, shared_load_options);
+}
+
+}  // namespace libtextclassifier2
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Sharing of the data that a model expands to at load time across the
+// processes of a device. The mapped model file is shared through the page
+// cache, but what each process derives from it is private: the decompressed
+// patterns, the lookup tables and the dequantized embeddings. A host process
+// publishes all of it once, in a sealed memfd region, and hands the file
+// descriptor to the client processes, e.g. over Binder, which map the region
+// instead of loading the model.
+
+#ifndef LIBTEXTCLASSIFIER_SHARED_MODEL_DATA_H_
+#define LIBTEXTCLASSIFIER_SHARED_MODEL_DATA_H_
+
+#include <memory>
+#include <string>
+
+#include "text-classifier.h"
+#include "util/base/integral_types.h"
+#include "util/utf8/unilib.h"
+
+namespace libtextclassifier2 {
+
+// The trailer at the end of the shared region. The region starts with the
+// expanded model, optionally followed by its dequantized embedding table.
+struct SharedModelDataTrailer {
+  // See kSharedModelDataMagic and kSharedModelDataVersion.
+  uint64 magic;
+  uint32 version;
+  uint32 reserved;
+
+  // The size of the expanded model at the start of the region.
+  uint64 model_size;
+
+  // The offset and number of floats of the dequantized embedding table, or 0
+  // if the embeddings are not dequantized.
+  uint64 embeddings_offset;
+  uint64 embeddings_size;
+
+  // ModelFingerprint() of the region before the trailer. Written by the
+  // publisher, so it only detects corruption; the clients get the fingerprint
+  // they trust separately, see FromSharedModelData().
+  uint64 fingerprint;
+};
+
+const uint64 kSharedModelDataMagic = 0x4154414444454d53ULL;  // "SMEDDATA"
+const uint32 kSharedModelDataVersion = 1;
+
+// Builds the content of the shared region for a serialized model: the model
+// with the precomputed lookup tables and the decompressed patterns, and, if
+// 'dequantize_embeddings' is set, the dequantized embedding table. Returns an
+// empty string on error.
+std::string BuildSharedModelData(const std::string& model,
+                                 bool dequantize_embeddings);
+
+// Publishes the shared region of a serialized model, as above, in a new memfd
+// that is sealed against any change. Returns the file descriptor, which the
+// caller owns, or -1 on error, e.g. on kernels without memfd.
+// If 'fingerprint' is not null, sets it to the fingerprint of the region, to
+// be handed to the clients along with the file descriptor.
+int PublishSharedModelData(const std::string& model,
+                           bool dequantize_embeddings,
+                           uint64* fingerprint = nullptr);
+
+// Loads a classifier from a shared region published by
+// PublishSharedModelData(). The region is mapped privately, so its pages stay
+// shared with the other processes as nothing writes to them. Any process can
+// publish a region, so it is verified like a model file, unless
+// LoadOptions::trusted_model_fingerprint is the fingerprint that the publisher
+// handed over with the file descriptor, and matches the region. The
+// dequantized embeddings in it replace LoadOptions::dequantize_embeddings. The file descriptor can be closed after
+// the call. Returns nullptr if the region is not sealed, not valid or the
+// model can't be loaded.
+std::unique_ptr<TextClassifier> FromSharedModelData(
+    int fd, const UniLib* unilib = nullptr,
+    const LoadOptions& load_options = LoadOptions::Default());
+
+}  // namespace libtextclassifier2
+
+#endif  // LIBTEXTCLASSIFIER_SHARED_MODEL_DATA_H_
@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shared-model-data.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+std::string ReadFile(const std::string& file_name) {
+  std::ifstream file_stream(file_name);
+  return std::string(std::istreambuf_iterator<char>(file_stream), {});
+}
+
+std::string GetModelPath() {
+  return LIBTEXTCLASSIFIER_TEST_DATA_DIR;
+}
+
+TEST(SharedModelDataTest, BuildsExpandedModelAndEmbeddings) {
+  const std::string model = ReadFile(GetModelPath() + "test_model.fb");
+  const std::string data =
+      BuildSharedModelData(model, /*dequantize_embeddings=*/true);
+  ASSERT_GT(data.size(), sizeof(SharedModelDataTrailer));
+
+  SharedModelDataTrailer trailer;
+  memcpy(&trailer, data.data() + data.size() - sizeof(trailer),
+         sizeof(trailer));
+  EXPECT_EQ(trailer.magic, kSharedModelDataMagic);
+  EXPECT_GT(trailer.embeddings_size, 0);
+  EXPECT_EQ(trailer.embeddings_offset % 64, 0);
+  EXPECT_EQ(trailer.embeddings_offset + trailer.embeddings_size * sizeof(float),
+            data.size() - sizeof(trailer));
+  EXPECT_EQ(trailer.fingerprint,
+            ModelFingerprint(data.data(), data.size() - sizeof(trailer)));
+
+  // The patterns are decompressed.
+  const Model* expanded_model = ViewModel(data.data(), trailer.model_size);
+  ASSERT_TRUE(expanded_model != nullptr);
+  ASSERT_TRUE(expanded_model->regex_model() != nullptr);
+  for (const auto* pattern : *expanded_model->regex_model()->patterns()) {
+    EXPECT_TRUE(pattern->compressed_pattern() == nullptr);
+    EXPECT_TRUE(pattern->pattern() != nullptr);
+  }
+
+  const std::string data_without_embeddings =
+      BuildSharedModelData(model, /*dequantize_embeddings=*/false);
+  memcpy(&trailer,
+         data_without_embeddings.data() + data_without_embeddings.size() -
+             sizeof(trailer),
+         sizeof(trailer));
+  EXPECT_EQ(trailer.embeddings_size, 0);
+  EXPECT_EQ(trailer.model_size,
+            data_without_embeddings.size() - sizeof(trailer));
+}
+
+TEST(SharedModelDataTest, SharedModelGivesSameResults) {
+  CREATE_UNILIB_FOR_TESTING;
+  const std::string model = ReadFile(GetModelPath() + "test_model.fb");
+  uint64 fingerprint = 0;
+  const int fd = PublishSharedModelData(model, /*dequantize_embeddings=*/true,
+                                        &fingerprint);
+  ASSERT_GE(fd, 0);
+  EXPECT_NE(fingerprint, 0);
+
+  // The region is sealed.
+  EXPECT_LT(write(fd, "x", 1), 0);
+  EXPECT_NE(ftruncate(fd, 0), 0);
+
+  // Verified without the fingerprint of the publisher, trusted with it.
+  EXPECT_TRUE(FromSharedModelData(fd, &unilib));
+  LoadOptions load_options;
+  load_options.trusted_model_fingerprint = fingerprint;
+  std::unique_ptr<TextClassifier> shared_classifier =
+      FromSharedModelData(fd, &unilib, load_options);
+  close(fd);
+  ASSERT_TRUE(shared_classifier);
+  EXPECT_EQ(shared_classifier->GetMemoryStats().embedding_bytes, 0);
+
+  std::unique_ptr<TextClassifier> classifier =
+      TextClassifier::FromUnownedBuffer(model.data(), model.size(), &unilib);
+  ASSERT_TRUE(classifier);
+  for (const std::string& text :
+       {"call me at 857 225 3556 today", "visit www.google.com today"}) {
+    EXPECT_EQ(shared_classifier->SuggestSelection(text, {11, 14}),
+              classifier->SuggestSelection(text, {11, 14}));
+    const std::vector<ClassificationResult> shared_results =
+        shared_classifier->ClassifyText(text, {11, 23});
+    const std::vector<ClassificationResult> results =
+        classifier->ClassifyText(text, {11, 23});
+    ASSERT_EQ(shared_results.size(), results.size());
+    for (int i = 0; i < results.size(); ++i) {
+      EXPECT_EQ(shared_results[i].collection, results[i].collection);
+      EXPECT_NEAR(shared_results[i].score, results[i].score, 1e-6);
+    }
+  }
+}
+
+TEST(SharedModelDataTest, VerifiesRegionsWithMatchingTrailer) {
+  CREATE_UNILIB_FOR_TESTING;
+  const std::string model = ReadFile(GetModelPath() + "test_model.fb");
+  std::string data =
+      BuildSharedModelData(model, /*dequantize_embeddings=*/false);
+  ASSERT_GT(data.size(), sizeof(SharedModelDataTrailer));
+
+  // A crafted model, whose trailer has the fingerprint to match.
+  const int data_size = data.size() - sizeof(SharedModelDataTrailer);
+  memset(&data[0], 0xff, sizeof(uint32));
+  SharedModelDataTrailer trailer;
+  memcpy(&trailer, data.data() + data_size, sizeof(trailer));
+  trailer.fingerprint = ModelFingerprint(data.data(), data_size);
+  memcpy(&data[data_size], &trailer, sizeof(trailer));
+
+  const int fd = syscall(__NR_memfd_create, "crafted",
+                         MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(write(fd, data.data(), data.size()), data.size());
+  ASSERT_EQ(fcntl(fd, F_ADD_SEALS,
+                  F_SEAL_SEAL | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE),
+            0);
+
+  EXPECT_FALSE(FromSharedModelData(fd, &unilib));
+  close(fd);
+}
+
+TEST(SharedModelDataTest, RejectsUnsealedRegions) {
+  CREATE_UNILIB_FOR_TESTING;
+  const std::string model = ReadFile(GetModelPath() + "test_model.fb");
+  const std::string data =
+      BuildSharedModelData(model, /*dequantize_embeddings=*/false);
+  std::string path = testing::TempDir() + "/shared_XXXXXX";
+  const int fd = mkstemp(&path[0]);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(write(fd, data.data(), data.size()), data.size());
+
+  EXPECT_FALSE(FromSharedModelData(fd, &unilib));
+  close(fd);
+  unlink(path.c_str());
+}
+
+}  // namespace
+}  // namespace libtextclassifier2
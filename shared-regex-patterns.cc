@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shared-regex-patterns.h"
+
+#include "util/hash/farmhash.h"
+#include "zlib-utils.h"
+
+namespace libtextclassifier2 {
+
+SharedRegexPatterns* SharedRegexPatterns::Instance() {
+  static SharedRegexPatterns* instance = new SharedRegexPatterns();
+  return instance;
+}
+
+std::shared_ptr<const UniLib::RegexPattern> SharedRegexPatterns::Get(
+    const UniLib& unilib, const std::string& pattern_text, bool lazy_compile) {
+  const uint64 fingerprint = Fingerprint(pattern_text, lazy_compile);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = entries_.find(fingerprint);
+    if (it != entries_.end()) {
+      std::shared_ptr<const UniLib::RegexPattern> pattern =
+          FindLocked(it->second, pattern_text, lazy_compile);
+      if (pattern != nullptr) {
+        return pattern;
+      }
+    }
+  }
+
+  // Compiles outside of the lock, so that the patterns of a model can compile
+  // in parallel. If another load compiled the same pattern meanwhile, its
+  // copy wins.
+  std::shared_ptr<const UniLib::RegexPattern> pattern =
+      MakeRegexPattern(unilib, pattern_text, lazy_compile);
+  if (pattern == nullptr) {
+    return nullptr;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<Entry>& entries = entries_[fingerprint];
+  std::shared_ptr<const UniLib::RegexPattern> existing_pattern =
+      FindLocked(entries, pattern_text, lazy_compile);
+  if (existing_pattern != nullptr) {
+    return existing_pattern;
+  }
+  entries.push_back({pattern_text, lazy_compile, pattern});
+  ++num_entries_;
+  if (num_entries_ > 2 * num_entries_after_sweep_) {
+    SweepLocked();
+  }
+  return pattern;
+}
+
+int SharedRegexPatterns::NumPatterns() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  int num_patterns = 0;
+  for (const auto& fingerprint_entries : entries_) {
+    for (const Entry& entry : fingerprint_entries.second) {
+      if (!entry.pattern.expired()) {
+        ++num_patterns;
+      }
+    }
+  }
+  return num_patterns;
+}
+
+uint64 SharedRegexPatterns::Fingerprint(const std::string& pattern_text,
+                                        bool lazy_compile) {
+  return tc2farmhash::Fingerprint64(pattern_text) ^ (lazy_compile ? 1 : 0);
+}
+
+std::shared_ptr<const UniLib::RegexPattern> SharedRegexPatterns::FindLocked(
+    const std::vector<Entry>& entries, const std::string& pattern_text,
+    bool lazy_compile) {
+  for (const Entry& entry : entries) {
+    if (entry.lazy_compile == lazy_compile &&
+        entry.pattern_text == pattern_text) {
+      std::shared_ptr<const UniLib::RegexPattern> pattern =
+          entry.pattern.lock();
+      if (pattern != nullptr) {
+        return pattern;
+      }
+    }
+  }
+  return nullptr;
+}
+
+void SharedRegexPatterns::SweepLocked() {
+  for (auto it = entries_.begin(); it != entries_.end();) {
+    std::vector<Entry>& entries = it->second;
+    for (auto entry = entries.begin(); entry != entries.end();) {
+      if (entry->pattern.expired()) {
+        entry = entries.erase(entry);
+        --num_entries_;
+      } else {
+        ++entry;
+      }
+    }
+    if (entries.empty()) {
+      it = entries_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  num_entries_after_sweep_ = num_entries_;
+}
+
+}  // namespace libtextclassifier2
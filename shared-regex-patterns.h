@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBTEXTCLASSIFIER_SHARED_REGEX_PATTERNS_H_
+#define LIBTEXTCLASSIFIER_SHARED_REGEX_PATTERNS_H_
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "util/base/integral_types.h"
+#include "util/base/macros.h"
+#include "util/utf8/unilib.h"
+
+namespace libtextclassifier2 {
+
+// Interns the regex patterns of the models by their text, so that the models
+// loaded in the same process, e.g. the per-language models of a
+// TextClassifierRouter, share one compiled copy of the patterns they have in
+// common, like the email, URL and phone patterns and the datetime extractor
+// rules. A pattern is released when the last model that uses it is unloaded.
+// The patterns are looked up by a fingerprint of their text, and compared in
+// full on a hit.
+// NOTE: This class is thread-safe.
+class SharedRegexPatterns {
+ public:
+  SharedRegexPatterns() {}
+
+  // Returns the patterns of the process. Never destroyed.
+  static SharedRegexPatterns* Instance();
+
+  // Returns the pattern of 'pattern_text', as MakeRegexPattern() creates it
+  // with 'unilib', or the already created one if it's still used. The
+  // patterns of all UniLib instances are the same. Returns nullptr if the
+  // pattern doesn't compile.
+  std::shared_ptr<const UniLib::RegexPattern> Get(
+      const UniLib& unilib, const std::string& pattern_text, bool lazy_compile);
+
+  // Returns the number of patterns that are currently in use.
+  int NumPatterns();
+
+ private:
+  struct Entry {
+    std::string pattern_text;
+    bool lazy_compile;
+    std::weak_ptr<const UniLib::RegexPattern> pattern;
+  };
+
+  static uint64 Fingerprint(const std::string& pattern_text,
+                            bool lazy_compile);
+
+  // Returns the live pattern of the entries of a fingerprint, or nullptr.
+  static std::shared_ptr<const UniLib::RegexPattern> FindLocked(
+      const std::vector<Entry>& entries, const std::string& pattern_text,
+      bool lazy_compile);
+
+  // Drops the entries of the released patterns.
+  void SweepLocked();
+
+  std::mutex mutex_;
+  std::unordered_map<uint64, std::vector<Entry>> entries_;
+  int num_entries_ = 0;
+
+  // The number of entries after the last sweep. Sweeps again once it doubles,
+  // which keeps the amortized cost per load constant.
+  int num_entries_after_sweep_ = 0;
+
+  TC_DISALLOW_COPY_AND_ASSIGN(SharedRegexPatterns);
+};
+
+}  // namespace libtextclassifier2
+
+#endif  // LIBTEXTCLASSIFIER_SHARED_REGEX_PATTERNS_H_
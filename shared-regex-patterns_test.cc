@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shared-regex-patterns.h"
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+TEST(SharedRegexPatternsTest, SharesPatternsWithSameText) {
+  CREATE_UNILIB_FOR_TESTING;
+  SharedRegexPatterns shared_patterns;
+  std::shared_ptr<const UniLib::RegexPattern> pattern =
+      shared_patterns.Get(unilib, "[a-z]+@[a-z]+", /*lazy_compile=*/false);
+  ASSERT_TRUE(pattern);
+  EXPECT_EQ(shared_patterns.Get(unilib, "[a-z]+@[a-z]+",
+                                /*lazy_compile=*/false),
+            pattern);
+  EXPECT_NE(shared_patterns.Get(unilib, "[a-z]+", /*lazy_compile=*/false),
+            pattern);
+
+  // Lazy patterns are kept apart.
+  EXPECT_NE(shared_patterns.Get(unilib, "[a-z]+@[a-z]+",
+                                /*lazy_compile=*/true),
+            pattern);
+
+  int status;
+  std::unique_ptr<UniLib::RegexMatcher> matcher =
+      pattern->Matcher(UTF8ToUnicodeText("write to me@home", false));
+  ASSERT_TRUE(matcher->Find(&status));
+  EXPECT_EQ(matcher->Start(&status), 9);
+}
+
+TEST(SharedRegexPatternsTest, ReleasesUnusedPatterns) {
+  CREATE_UNILIB_FOR_TESTING;
+  SharedRegexPatterns shared_patterns;
+  std::shared_ptr<const UniLib::RegexPattern> pattern =
+      shared_patterns.Get(unilib, "a+", /*lazy_compile=*/false);
+  ASSERT_TRUE(pattern);
+  EXPECT_EQ(shared_patterns.NumPatterns(), 1);
+  pattern.reset();
+  EXPECT_EQ(shared_patterns.NumPatterns(), 0);
+
+  // Compiles it again.
+  EXPECT_TRUE(shared_patterns.Get(unilib, "a+", /*lazy_compile=*/false));
+
+  for (int i = 0; i < 100; ++i) {
+    shared_patterns.Get(unilib, "a{" + std::to_string(i) + "}",
+                        /*lazy_compile=*/false);
+  }
+  EXPECT_EQ(shared_patterns.NumPatterns(), 0);
+}
+
+TEST(SharedRegexPatternsTest, FailsOnInvalidPattern) {
+  CREATE_UNILIB_FOR_TESTING;
+  SharedRegexPatterns shared_patterns;
+  EXPECT_FALSE(shared_patterns.Get(unilib, "a{", /*lazy_compile=*/false));
+  EXPECT_EQ(shared_patterns.NumPatterns(), 0);
+}
+
+TEST(SharedRegexPatternsTest, ConcurrentGetsShare) {
+  CREATE_UNILIB_FOR_TESTING;
+  SharedRegexPatterns shared_patterns;
+  std::vector<std::shared_ptr<const UniLib::RegexPattern>> patterns(8);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < patterns.size(); ++i) {
+    threads.emplace_back([&shared_patterns, &unilib, &patterns, i]() {
+      patterns[i] = shared_patterns.Get(unilib, "(\\d+)-(\\d+)",
+                                        /*lazy_compile=*/false);
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  ASSERT_TRUE(patterns[0]);
+  for (const auto& pattern : patterns) {
+    EXPECT_EQ(pattern, patterns[0]);
+  }
+  EXPECT_EQ(shared_patterns.NumPatterns(), 1);
+}
+
+}  // namespace
+}  // namespace libtextclassifier2
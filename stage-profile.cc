@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "stage-profile.h"
+
+namespace libtextclassifier2 {
+namespace {
+thread_local StageProfile* thread_stage_profile = nullptr;
+}  // namespace
+
+const char* ProfiledStageName(ProfiledStage stage) {
+  switch (stage) {
+    case ProfiledStage::TOKENIZE:
+      return "tokenize";
+    case ProfiledStage::FEATURES:
+      return "features";
+    case ProfiledStage::SELECTION_MODEL:
+      return "selection_model";
+    case ProfiledStage::CLASSIFICATION_MODEL:
+      return "classification_model";
+    case ProfiledStage::REGEX:
+      return "regex";
+    case ProfiledStage::DATETIME:
+      return "datetime";
+    default:
+      return "unknown";
+  }
+}
+
+void StageProfile::Clear() {
+  for (int i = 0; i < kNumStages; ++i) {
+    stage_nanos[i] = 0;
+    stage_runs[i] = 0;
+  }
+}
+
+void StageProfile::Add(const StageProfile& other) {
+  for (int i = 0; i < kNumStages; ++i) {
+    stage_nanos[i] += other.stage_nanos[i];
+    stage_runs[i] += other.stage_runs[i];
+  }
+}
+
+void SetThreadStageProfile(StageProfile* profile) {
+  thread_stage_profile = profile;
+}
+
+StageProfile* ThreadStageProfile() { return thread_stage_profile; }
+
+}  // namespace libtextclassifier2
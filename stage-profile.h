@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Opt-in accounting of the time spent in the stages of the text classifier,
+// used by the benchmarks.
+
+#ifndef LIBTEXTCLASSIFIER_STAGE_PROFILE_H_
+#define LIBTEXTCLASSIFIER_STAGE_PROFILE_H_
+
+#include <chrono>
+
+#include "util/base/integral_types.h"
+#include "util/base/macros.h"
+
+namespace libtextclassifier2 {
+
+enum class ProfiledStage {
+  TOKENIZE = 0,
+  FEATURES,
+  SELECTION_MODEL,
+  CLASSIFICATION_MODEL,
+  REGEX,
+  DATETIME,
+  NUM_STAGES,
+};
+
+// Returns a human readable name of the stage.
+const char* ProfiledStageName(ProfiledStage stage);
+
+// Accumulated wall time and number of runs per stage.
+struct StageProfile {
+  static const int kNumStages = static_cast<int>(ProfiledStage::NUM_STAGES);
+
+  int64 stage_nanos[kNumStages] = {};
+  int64 stage_runs[kNumStages] = {};
+
+  void Clear();
+
+  // Adds the numbers from 'other' to this profile.
+  void Add(const StageProfile& other);
+};
+
+// Sets the profile that the stages run on the calling thread are accounted
+// to, or nullptr (the default) to disable the accounting. The profile must
+// outlive its use. Stages run on other threads, e.g. with
+// AnnotationOptions::num_line_threads > 1, are not accounted.
+void SetThreadStageProfile(StageProfile* profile);
+
+// Returns the profile of the calling thread, or nullptr.
+StageProfile* ThreadStageProfile();
+
+// Accounts the time between its construction and destruction to the given
+// stage in the profile of the calling thread, if there is one. Only looks up
+// the thread-local profile when profiling is disabled. Must not be nested for
+// the same stage.
+class ScopedStageTimer {
+ public:
+  explicit ScopedStageTimer(ProfiledStage stage)
+      : profile_(ThreadStageProfile()), stage_(static_cast<int>(stage)) {
+    if (profile_ != nullptr) {
+      start_ = std::chrono::steady_clock::now();
+    }
+  }
+
+  ~ScopedStageTimer() {
+    if (profile_ != nullptr) {
+      profile_->stage_nanos[stage_] +=
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - start_)
+              .count();
+      ++profile_->stage_runs[stage_];
+    }
+  }
+
+ private:
+  StageProfile* const profile_;
+  const int stage_;
+  std::chrono::steady_clock::time_point start_;
+
+  TC_DISALLOW_COPY_AND_ASSIGN(ScopedStageTimer);
+};
+
+}  // namespace libtextclassifier2
+
+#endif  // LIBTEXTCLASSIFIER_STAGE_PROFILE_H_
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "stage-profile.h"
+
+#include <thread>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+const int kTokenize = static_cast<int>(ProfiledStage::TOKENIZE);
+const int kRegex = static_cast<int>(ProfiledStage::REGEX);
+
+TEST(StageProfileTest, AccountsToThreadProfile) {
+  StageProfile profile;
+  SetThreadStageProfile(&profile);
+  {
+    ScopedStageTimer timer(ProfiledStage::TOKENIZE);
+  }
+  {
+    ScopedStageTimer timer(ProfiledStage::TOKENIZE);
+  }
+  SetThreadStageProfile(nullptr);
+  {
+    ScopedStageTimer timer(ProfiledStage::TOKENIZE);
+  }
+
+  EXPECT_EQ(profile.stage_runs[kTokenize], 2);
+  EXPECT_GE(profile.stage_nanos[kTokenize], 0);
+  EXPECT_EQ(profile.stage_runs[kRegex], 0);
+  EXPECT_EQ(profile.stage_nanos[kRegex], 0);
+}
+
+TEST(StageProfileTest, IgnoresOtherThreads) {
+  StageProfile profile;
+  SetThreadStageProfile(&profile);
+  std::thread thread([]() {
+    EXPECT_EQ(ThreadStageProfile(), nullptr);
+    ScopedStageTimer timer(ProfiledStage::REGEX);
+  });
+  thread.join();
+  SetThreadStageProfile(nullptr);
+
+  EXPECT_EQ(profile.stage_runs[kRegex], 0);
+}
+
+TEST(StageProfileTest, AddAndClear) {
+  StageProfile profile;
+  profile.stage_nanos[kRegex] = 10;
+  profile.stage_runs[kRegex] = 1;
+  StageProfile total;
+  total.Add(profile);
+  total.Add(profile);
+  EXPECT_EQ(total.stage_nanos[kRegex], 20);
+  EXPECT_EQ(total.stage_runs[kRegex], 2);
+
+  total.Clear();
+  EXPECT_EQ(total.stage_nanos[kRegex], 0);
+  EXPECT_EQ(total.stage_runs[kRegex], 0);
+}
+
+TEST(StageProfileTest, StageNames) {
+  EXPECT_STREQ(ProfiledStageName(ProfiledStage::TOKENIZE), "tokenize");
+  EXPECT_STREQ(ProfiledStageName(ProfiledStage::CLASSIFICATION_MODEL),
+               "classification_model");
+}
+
+}  // namespace
+}  // namespace libtextclassifier2
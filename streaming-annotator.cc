@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "streaming-annotator.h"
+
+#include <algorithm>
+
+#include "util/strings/utf8.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+// Returns the number of bytes of 'text' without its last character if that
+// one is incomplete.
+int CompleteUTF8Bytes(const std::string& text) {
+  const int size = text.size();
+  for (int i = size - 1; i >= 0 && i >= size - 4; --i) {
+    if (!IsTrailByte(text[i])) {
+      return i + GetNumBytesForNonZeroUTF8Char(&text[i]) > size ? i : size;
+    }
+  }
+  return size;
+}
+
+// Returns the number of codepoints of text[begin, end).
+int CountCodepoints(const std::string& text, int begin, int end) {
+  int num_codepoints = 0;
+  for (int i = begin; i < end; ++i) {
+    if (!IsTrailByte(text[i])) {
+      ++num_codepoints;
+    }
+  }
+  return num_codepoints;
+}
+
+// Returns the byte offset of the given codepoint of 'text'.
+int CodepointToByteOffset(const std::string& text, int codepoint) {
+  int num_codepoints = 0;
+  for (int i = 0; i < text.size(); ++i) {
+    if (!IsTrailByte(text[i]) && num_codepoints++ == codepoint) {
+      return i;
+    }
+  }
+  return text.size();
+}
+
+}  // namespace
+
+StreamingAnnotator::StreamingAnnotator(const TextClassifier* classifier,
+                                       const AnnotationOptions& options,
+                                       int window_codepoints,
+                                       int margin_codepoints)
+    : classifier_(classifier),
+      options_(options),
+      margin_codepoints_(std::max(0, margin_codepoints)),
+      window_codepoints_(
+          std::max({1, window_codepoints, 2 * margin_codepoints_})) {}
+
+std::vector<AnnotatedSpan> StreamingAnnotator::Append(
+    const std::string& chunk) {
+  const int complete_bytes = CompleteUTF8Bytes(buffer_);
+  buffer_ += chunk;
+  buffer_codepoints_ +=
+      CountCodepoints(buffer_, complete_bytes, CompleteUTF8Bytes(buffer_));
+
+  std::vector<AnnotatedSpan> result;
+  while (buffer_codepoints_ >= window_codepoints_ + margin_codepoints_) {
+    AnnotateWindow(/*is_last=*/false, &result);
+  }
+  return result;
+}
+
+std::vector<AnnotatedSpan> StreamingAnnotator::Finish() {
+  std::vector<AnnotatedSpan> result;
+  AnnotateWindow(/*is_last=*/true, &result);
+  buffer_.clear();
+  buffer_codepoints_ = 0;
+  buffer_start_ = 0;
+  returned_end_ = 0;
+  return result;
+}
+
+void StreamingAnnotator::AnnotateWindow(bool is_last,
+                                        std::vector<AnnotatedSpan>* result) {
+  const int window_bytes = CompleteUTF8Bytes(buffer_);
+  std::vector<AnnotatedSpan> annotations = classifier_->Annotate(
+      is_last ? buffer_ : buffer_.substr(0, window_bytes), options_);
+
+  // The annotations that end before the margin are final. The first one that
+  // doesn't is found again by the next window, so that one starts before it.
+  const int final_end =
+      is_last ? buffer_codepoints_ : buffer_codepoints_ - margin_codepoints_;
+  int first_pending_start = final_end;
+  for (AnnotatedSpan& annotation : annotations) {
+    if (annotation.span.second > final_end) {
+      first_pending_start =
+          std::min(first_pending_start, annotation.span.first);
+      continue;
+    }
+    if (buffer_start_ + annotation.span.first < returned_end_) {
+      continue;
+    }
+    annotation.span.first += buffer_start_;
+    annotation.span.second += buffer_start_;
+    returned_end_ = annotation.span.second;
+    result->push_back(std::move(annotation));
+  }
+  if (is_last) {
+    return;
+  }
+
+  // Keeps the left context of the next window, but moves forward by at least
+  // half a window.
+  const int next_start = std::max(first_pending_start - margin_codepoints_,
+                                  window_codepoints_ / 2);
+  buffer_.erase(0, CodepointToByteOffset(buffer_, next_start));
+  buffer_codepoints_ -= next_start;
+  buffer_start_ += next_start;
+}
+
+}  // namespace libtextclassifier2
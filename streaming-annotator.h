@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Annotation of texts that arrive in chunks, with bounded memory.
+
+#ifndef LIBTEXTCLASSIFIER_STREAMING_ANNOTATOR_H_
+#define LIBTEXTCLASSIFIER_STREAMING_ANNOTATOR_H_
+
+#include <string>
+#include <vector>
+
+#include "text-classifier.h"
+#include "types.h"
+#include "util/base/integral_types.h"
+#include "util/base/macros.h"
+
+namespace libtextclassifier2 {
+
+// Annotates a text of any length that arrives in chunks, e.g. a multi-megabyte
+// document or a log, and returns the annotations as soon as they are final.
+// Keeps a window of at most window_codepoints + margin_codepoints codepoints
+// of the text, plus the last chunk, and annotates it with
+// TextClassifier::Annotate() whenever it's full. The annotations that end
+// more than margin_codepoints before the end of the window are final, the
+// rest of the window is kept for the next one, with margin_codepoints of left
+// context. So the margin should cover the longest annotation and the context
+// of the models; with it, the annotations are those of Annotate() on the whole
+// text, except next to the window boundaries where a conflict or the context
+// of the models can reach beyond the margin.
+// NOTE: This class is not thread-safe. The classifier must outlive it.
+class StreamingAnnotator {
+ public:
+  // 'window_codepoints' is raised to at least twice 'margin_codepoints', so
+  // that each window moves the stream forward.
+  StreamingAnnotator(
+      const TextClassifier* classifier,
+      const AnnotationOptions& options = AnnotationOptions::Default(),
+      int window_codepoints = 4096, int margin_codepoints = 256);
+
+  // Appends a chunk of the text, which can end in the middle of a UTF8
+  // character. Returns the annotations that became final, sorted and in
+  // codepoint offsets from the start of the text.
+  std::vector<AnnotatedSpan> Append(const std::string& chunk);
+
+  // Ends the text, and returns the remaining annotations. The annotator can
+  // then be used for a new text.
+  std::vector<AnnotatedSpan> Finish();
+
+  // Returns the number of codepoints of the text so far.
+  int64 NumCodepoints() const { return buffer_start_ + buffer_codepoints_; }
+
+ private:
+  // Annotates the window, appends its final annotations to 'result', and drops
+  // the text that the next window doesn't need.
+  void AnnotateWindow(bool is_last, std::vector<AnnotatedSpan>* result);
+
+  const TextClassifier* classifier_;
+  const AnnotationOptions options_;
+  const int margin_codepoints_;
+  const int window_codepoints_;
+
+  // The text from codepoint buffer_start_ on. Can end with an incomplete UTF8
+  // character, which buffer_codepoints_ doesn't count.
+  std::string buffer_;
+  int buffer_codepoints_ = 0;
+  int64 buffer_start_ = 0;
+
+  // The end of the last returned annotation. The annotations of the next
+  // windows that start before it are dropped.
+  int64 returned_end_ = 0;
+
+  TC_DISALLOW_COPY_AND_ASSIGN(StreamingAnnotator);
+};
+
+}  // namespace libtextclassifier2
+
+#endif  // LIBTEXTCLASSIFIER_STREAMING_ANNOTATOR_H_
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "streaming-annotator.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "types-test-util.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+std::string GetModelPath() {
+  return LIBTEXTCLASSIFIER_TEST_DATA_DIR;
+}
+
+void ExpectSameAnnotations(const std::vector<AnnotatedSpan>& a,
+                           const std::vector<AnnotatedSpan>& b) {
+  ASSERT_EQ(a.size(), b.size());
+  for (int i = 0; i < a.size(); ++i) {
+    EXPECT_EQ(a[i].span, b[i].span) << i;
+    ASSERT_FALSE(a[i].classification.empty());
+    ASSERT_FALSE(b[i].classification.empty());
+    EXPECT_EQ(a[i].classification[0].collection,
+              b[i].classification[0].collection)
+        << i;
+  }
+}
+
+TEST(StreamingAnnotatorTest, AnnotatesLikeTheWholeText) {
+  CREATE_UNILIB_FOR_TESTING;
+  std::unique_ptr<TextClassifier> classifier =
+      TextClassifier::FromPath(GetModelPath() + "test_model.fb", &unilib);
+  ASSERT_TRUE(classifier);
+
+  std::string text;
+  for (int i = 0; i < 20; ++i) {
+    text += "Héllo, call me at 853 225 3556 or visit 350 Third Street, "
+            "Cambridge.\n";
+  }
+  const std::vector<AnnotatedSpan> expected = classifier->Annotate(text);
+  ASSERT_FALSE(expected.empty());
+
+  // The chunks split the UTF8 characters.
+  StreamingAnnotator annotator(classifier.get(), AnnotationOptions::Default(),
+                               /*window_codepoints=*/300,
+                               /*margin_codepoints=*/80);
+  std::vector<AnnotatedSpan> annotations;
+  for (int i = 0; i < text.size(); i += 7) {
+    for (AnnotatedSpan& annotation : annotator.Append(text.substr(i, 7))) {
+      annotations.push_back(std::move(annotation));
+    }
+  }
+  EXPECT_EQ(annotator.NumCodepoints(), 20 * 69);
+  EXPECT_FALSE(annotations.empty());
+  for (AnnotatedSpan& annotation : annotator.Finish()) {
+    annotations.push_back(std::move(annotation));
+  }
+  ExpectSameAnnotations(annotations, expected);
+
+  // The annotator can be reused.
+  EXPECT_EQ(annotator.NumCodepoints(), 0);
+  annotator.Append(text.substr(0, 70));
+  ExpectSameAnnotations(annotator.Finish(),
+                        classifier->Annotate(text.substr(0, 70)));
+}
+
+}  // namespace
+}  // namespace libtextclassifier2
@@ -16,6 +16,7 @@
 
 #include "strip-unpaired-brackets.h"
 
+#include <algorithm>
 #include <iterator>
 
 #include "util/base/logging.h"
@@ -25,56 +26,25 @@ namespace libtextclassifier2 {
 namespace {
 
 // Returns true if given codepoint is contained in the given span in context.
-bool IsCodepointInSpan(const char32 codepoint,
-                       const UnicodeText& context_unicode,
+template <typename SeekFn>
+bool IsCodepointInSpan(const char32 codepoint, const SeekFn& seek,
                        const CodepointSpan span) {
-  auto begin_it = context_unicode.begin();
-  std::advance(begin_it, span.first);
-  auto end_it = context_unicode.begin();
-  std::advance(end_it, span.second);
-
+  const UnicodeText::const_iterator begin_it = seek(span.first);
+  const UnicodeText::const_iterator end_it = seek(span.second);
   return std::find(begin_it, end_it, codepoint) != end_it;
 }
 
-// Returns the first codepoint of the span.
-char32 FirstSpanCodepoint(const UnicodeText& context_unicode,
-                          const CodepointSpan span) {
-  auto it = context_unicode.begin();
-  std::advance(it, span.first);
-  return *it;
-}
-
-// Returns the last codepoint of the span.
-char32 LastSpanCodepoint(const UnicodeText& context_unicode,
-                         const CodepointSpan span) {
-  auto it = context_unicode.begin();
-  std::advance(it, span.second - 1);
-  return *it;
-}
-
-}  // namespace
-
-CodepointSpan StripUnpairedBrackets(const std::string& context,
-                                    CodepointSpan span, const UniLib& unilib) {
-  const UnicodeText context_unicode =
-      UTF8ToUnicodeText(context, /*do_copy=*/false);
-  return StripUnpairedBrackets(context_unicode, span, unilib);
-}
-
-// If the first or the last codepoint of the given span is a bracket, the
-// bracket is stripped if the span does not contain its corresponding paired
-// version.
-CodepointSpan StripUnpairedBrackets(const UnicodeText& context_unicode,
-                                    CodepointSpan span, const UniLib& unilib) {
-  if (context_unicode.empty() || !ValidNonEmptySpan(span)) {
-    return span;
-  }
-
-  const char32 begin_char = FirstSpanCodepoint(context_unicode, span);
+// Strips the unpaired brackets of the span, where seek(i) returns the iterator
+// at codepoint i of the context.
+template <typename SeekFn>
+CodepointSpan StripUnpairedBracketsWithSeek(const SeekFn& seek,
+                                            CodepointSpan span,
+                                            const UniLib& unilib) {
+  const char32 begin_char = *seek(span.first);
   const char32 paired_begin_char = unilib.GetPairedBracket(begin_char);
   if (paired_begin_char != begin_char) {
     if (!unilib.IsOpeningBracket(begin_char) ||
-        !IsCodepointInSpan(paired_begin_char, context_unicode, span)) {
+        !IsCodepointInSpan(paired_begin_char, seek, span)) {
       ++span.first;
     }
   }
@@ -83,11 +53,11 @@ CodepointSpan StripUnpairedBrackets(const UnicodeText& context_unicode,
     return span;
   }
 
-  const char32 end_char = LastSpanCodepoint(context_unicode, span);
+  const char32 end_char = *seek(span.second - 1);
   const char32 paired_end_char = unilib.GetPairedBracket(end_char);
   if (paired_end_char != end_char) {
     if (!unilib.IsClosingBracket(end_char) ||
-        !IsCodepointInSpan(paired_end_char, context_unicode, span)) {
+        !IsCodepointInSpan(paired_end_char, seek, span)) {
       --span.second;
     }
   }
@@ -102,4 +72,44 @@ CodepointSpan StripUnpairedBrackets(const UnicodeText& context_unicode,
   return span;
 }
 
+}  // namespace
+
+CodepointSpan StripUnpairedBrackets(const std::string& context,
+                                    CodepointSpan span, const UniLib& unilib) {
+  const UnicodeText context_unicode =
+      UTF8ToUnicodeText(context, /*do_copy=*/false);
+  return StripUnpairedBrackets(context_unicode, span, unilib);
+}
+
+// If the first or the last codepoint of the given span is a bracket, the
+// bracket is stripped if the span does not contain its corresponding paired
+// version.
+CodepointSpan StripUnpairedBrackets(const UnicodeText& context_unicode,
+                                    CodepointSpan span, const UniLib& unilib) {
+  if (context_unicode.empty() || !ValidNonEmptySpan(span)) {
+    return span;
+  }
+
+  return StripUnpairedBracketsWithSeek(
+      [&context_unicode](int codepoint_index) {
+        auto it = context_unicode.begin();
+        std::advance(it, codepoint_index);
+        return it;
+      },
+      span, unilib);
+}
+
+CodepointSpan StripUnpairedBrackets(const UnicodeTextIndex& context_index,
+                                    CodepointSpan span, const UniLib& unilib) {
+  if (context_index.NumCodepoints() == 0 || !ValidNonEmptySpan(span)) {
+    return span;
+  }
+
+  return StripUnpairedBracketsWithSeek(
+      [&context_index](int codepoint_index) {
+        return context_index.IteratorAt(codepoint_index);
+      },
+      span, unilib);
+}
+
 }  // namespace libtextclassifier2
@@ -20,6 +20,7 @@
 #include <string>
 
 #include "types.h"
+#include "util/utf8/unicodetext-index.h"
 #include "util/utf8/unilib.h"
 
 namespace libtextclassifier2 {
@@ -33,6 +34,11 @@ CodepointSpan StripUnpairedBrackets(const std::string& context,
 CodepointSpan StripUnpairedBrackets(const UnicodeText& context_unicode,
                                     CodepointSpan span, const UniLib& unilib);
 
+// Same as above but seeks the span through an index of the context, for
+// callers that strip many spans of the same context.
+CodepointSpan StripUnpairedBrackets(const UnicodeTextIndex& context_index,
+                                    CodepointSpan span, const UniLib& unilib);
+
 }  // namespace libtextclassifier2
 
 #endif  // LIBTEXTCLASSIFIER_STRIP_UNPAIRED_BRACKETS_H_
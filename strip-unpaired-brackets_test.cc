@@ -57,5 +57,18 @@ TEST(StripUnpairedBracketsTest, StripUnpairedBrackets) {
             std::make_pair(-1, -1));
 }
 
+TEST(StripUnpairedBracketsTest, StripUnpairedBracketsWithIndex) {
+  CREATE_UNILIB_FOR_TESTING
+  const UnicodeText context_unicode =
+      UTF8ToUnicodeText("call me (123) 456 (today", /*do_copy=*/false);
+  const UnicodeTextIndex context_index(context_unicode);
+  EXPECT_EQ(StripUnpairedBrackets(context_index, {8, 13}, unilib),
+            std::make_pair(8, 13));
+  EXPECT_EQ(StripUnpairedBrackets(context_index, {18, 24}, unilib),
+            std::make_pair(19, 24));
+  EXPECT_EQ(StripUnpairedBrackets(context_index, {18, 18}, unilib),
+            std::make_pair(18, 18));
+}
+
 }  // namespace
 }  // namespace libtextclassifier2
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "text-classifier-async.h"
+
+namespace libtextclassifier2 {
+
+AsyncTextClassifier::AsyncTextClassifier(
+    std::shared_ptr<const TextClassifier> classifier, Executor* executor)
+    : classifier_(std::move(classifier)), executor_(executor) {}
+
+AsyncTextClassifier::AsyncTextClassifier(
+    std::shared_ptr<const TextClassifier> classifier, int num_threads)
+    : classifier_(std::move(classifier)),
+      owned_thread_pool_(new ThreadPool(num_threads)),
+      executor_(owned_thread_pool_.get()) {}
+
+AsyncTextClassifier::~AsyncTextClassifier() {
+  // Runs the pending requests before the threads stop.
+  owned_thread_pool_.reset();
+}
+
+void AsyncTextClassifier::SuggestSelectionAsync(
+    std::string context, CodepointSpan click_indices, SelectionOptions options,
+    std::function<void(CodepointSpan)> done) const {
+  // The lambdas can't move-capture in C++11, so the arguments are bound.
+  const std::shared_ptr<const TextClassifier> classifier = classifier_;
+  executor_->Schedule(std::bind(
+      [classifier, click_indices](
+          const std::string& context, const SelectionOptions& options,
+          const std::function<void(CodepointSpan)>& done) {
+        done(classifier->SuggestSelection(context, click_indices, options));
+      },
+      std::move(context), std::move(options), std::move(done)));
+}
+
+void AsyncTextClassifier::ClassifyTextAsync(
+    std::string context, CodepointSpan selection_indices,
+    ClassificationOptions options,
+    std::function<void(std::vector<ClassificationResult>)> done) const {
+  const std::shared_ptr<const TextClassifier> classifier = classifier_;
+  executor_->Schedule(std::bind(
+      [classifier, selection_indices](
+          const std::string& context, const ClassificationOptions& options,
+          const std::function<void(std::vector<ClassificationResult>)>& done) {
+        done(classifier->ClassifyText(context, selection_indices, options));
+      },
+      std::move(context), std::move(options), std::move(done)));
+}
+
+void AsyncTextClassifier::AnnotateAsync(
+    std::string context, AnnotationOptions options,
+    std::function<void(std::vector<AnnotatedSpan>)> done) const {
+  const std::shared_ptr<const TextClassifier> classifier = classifier_;
+  executor_->Schedule(std::bind(
+      [classifier](
+          const std::string& context, const AnnotationOptions& options,
+          const std::function<void(std::vector<AnnotatedSpan>)>& done) {
+        done(classifier->Annotate(context, options));
+      },
+      std::move(context), std::move(options), std::move(done)));
+}
+
+}  // namespace libtextclassifier2
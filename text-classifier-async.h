@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Asynchronous requests to a TextClassifier.
+
+#ifndef LIBTEXTCLASSIFIER_TEXT_CLASSIFIER_ASYNC_H_
+#define LIBTEXTCLASSIFIER_TEXT_CLASSIFIER_ASYNC_H_
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "text-classifier.h"
+#include "util/base/macros.h"
+#include "util/base/thread-pool.h"
+
+namespace libtextclassifier2 {
+
+// Runs the requests to a classifier with an executor and calls back with
+// their results, so the calling threads, e.g. the I/O threads of a server,
+// don't wait for them. The interpreter pools of the classifier grow to one
+// interpreter per concurrent request, i.e. per worker of the executor.
+// NOTE: All methods are thread-safe. The callbacks run on the threads of the
+// executor.
+class AsyncTextClassifier {
+ public:
+  // Runs the requests with 'executor', which is not owned and must run all
+  // the scheduled tasks.
+  AsyncTextClassifier(std::shared_ptr<const TextClassifier> classifier,
+                      Executor* executor);
+
+  // Runs the requests with a ThreadPool of num_threads threads.
+  AsyncTextClassifier(std::shared_ptr<const TextClassifier> classifier,
+                      int num_threads);
+
+  // Waits for the requests that are still pending on the own thread pool.
+  // The requests on an executor keep the classifier alive until they're done.
+  ~AsyncTextClassifier();
+
+  void SuggestSelectionAsync(
+      std::string context, CodepointSpan click_indices,
+      SelectionOptions options, std::function<void(CodepointSpan)> done) const;
+
+  void ClassifyTextAsync(
+      std::string context, CodepointSpan selection_indices,
+      ClassificationOptions options,
+      std::function<void(std::vector<ClassificationResult>)> done) const;
+
+  void AnnotateAsync(
+      std::string context, AnnotationOptions options,
+      std::function<void(std::vector<AnnotatedSpan>)> done) const;
+
+ private:
+  const std::shared_ptr<const TextClassifier> classifier_;
+  std::unique_ptr<ThreadPool> owned_thread_pool_;
+  Executor* executor_;
+
+  TC_DISALLOW_COPY_AND_ASSIGN(AsyncTextClassifier);
+};
+
+}  // namespace libtextclassifier2
+
+#endif  // LIBTEXTCLASSIFIER_TEXT_CLASSIFIER_ASYNC_H_
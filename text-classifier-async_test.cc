@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "text-classifier-async.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+std::string GetModelPath() {
+  return LIBTEXTCLASSIFIER_TEST_DATA_DIR;
+}
+
+TEST(AsyncTextClassifierTest, CallsBackWithResults) {
+  CREATE_UNILIB_FOR_TESTING;
+  std::shared_ptr<const TextClassifier> classifier =
+      TextClassifier::FromPath(GetModelPath() + "test_model.fb", &unilib);
+  ASSERT_TRUE(classifier);
+
+  const std::string text = "call me at 857 225 3556 today";
+  std::atomic<int> num_done(0);
+  {
+    AsyncTextClassifier async_classifier(classifier, /*num_threads=*/4);
+    for (int i = 0; i < 10; ++i) {
+      async_classifier.SuggestSelectionAsync(
+          text, {11, 14}, SelectionOptions::Default(),
+          [&num_done](CodepointSpan selection) {
+            EXPECT_EQ(selection, std::make_pair(11, 23));
+            ++num_done;
+          });
+      async_classifier.ClassifyTextAsync(
+          text, {11, 23}, ClassificationOptions::Default(),
+          [&num_done](std::vector<ClassificationResult> results) {
+            ASSERT_FALSE(results.empty());
+            EXPECT_EQ(results[0].collection, "phone");
+            ++num_done;
+          });
+      async_classifier.AnnotateAsync(
+          text, AnnotationOptions::Default(),
+          [&num_done](std::vector<AnnotatedSpan> annotations) {
+            ASSERT_EQ(annotations.size(), 1);
+            EXPECT_EQ(annotations[0].span, std::make_pair(11, 23));
+            ++num_done;
+          });
+    }
+  }
+  EXPECT_EQ(num_done, 30);
+}
+
+TEST(AsyncTextClassifierTest, RunsOnExecutor) {
+  CREATE_UNILIB_FOR_TESTING;
+  std::shared_ptr<const TextClassifier> classifier =
+      TextClassifier::FromPath(GetModelPath() + "test_model.fb", &unilib);
+  ASSERT_TRUE(classifier);
+
+  std::atomic<int> num_done(0);
+  {
+    ThreadPool executor(2);
+    AsyncTextClassifier async_classifier(classifier, &executor);
+    async_classifier.AnnotateAsync(
+        "hello world", AnnotationOptions::Default(),
+        [&num_done](std::vector<AnnotatedSpan> annotations) { ++num_done; });
+  }
+  EXPECT_EQ(num_done, 1);
+}
+
+}  // namespace
+}  // namespace libtextclassifier2
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "text-classifier-handle.h"
+
+#include "util/base/logging.h"
+
+namespace libtextclassifier2 {
+
+TextClassifierHandle::~TextClassifierHandle() { WaitForReplacement(); }
+
+std::shared_ptr<const TextClassifier> TextClassifierHandle::Get() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return classifier_;
+}
+
+void TextClassifierHandle::Replace(
+    std::shared_ptr<const TextClassifier> classifier) {
+  std::shared_ptr<const TextClassifier> old_classifier;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    old_classifier = std::move(classifier_);
+    classifier_ = std::move(classifier);
+  }
+  // If no request holds the old model anymore, it is destroyed here, outside
+  // of the lock.
+}
+
+void TextClassifierHandle::ReplaceInBackground(
+    std::function<std::unique_ptr<TextClassifier>()> factory,
+    std::function<void(bool)> done) {
+  std::lock_guard<std::mutex> lock(replacement_mutex_);
+  if (replacement_thread_.joinable()) {
+    replacement_thread_.join();
+  }
+  replacement_thread_ = std::thread([this, factory, done]() {
+    std::shared_ptr<const TextClassifier> classifier = factory();
+    const bool replaced = (classifier != nullptr);
+    if (replaced) {
+      Replace(std::move(classifier));
+    } else {
+      TC_LOG(ERROR) << "Could not load the replacement model.";
+    }
+    if (done) {
+      done(replaced);
+    }
+  });
+}
+
+void TextClassifierHandle::WaitForReplacement() {
+  std::lock_guard<std::mutex> lock(replacement_mutex_);
+  if (replacement_thread_.joinable()) {
+    replacement_thread_.join();
+  }
+}
+
+}  // namespace libtextclassifier2
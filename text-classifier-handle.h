@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Replacement of a serving model without stopping the requests.
+
+#ifndef LIBTEXTCLASSIFIER_TEXT_CLASSIFIER_HANDLE_H_
+#define LIBTEXTCLASSIFIER_TEXT_CLASSIFIER_HANDLE_H_
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>  // NOLINT
+
+#include "text-classifier.h"
+#include "util/base/macros.h"
+
+namespace libtextclassifier2 {
+
+// Holds the current model of a server and replaces it atomically. Each
+// request takes the current model with Get() and uses it until it's done, so
+// the requests in flight during a replacement finish on the old model while
+// the new requests see the new one. The old model, and with it its mmap, is
+// released when the last request that uses it is done.
+// NOTE: All methods are thread-safe.
+class TextClassifierHandle {
+ public:
+  // Creates a handle with the given model, which can be nullptr.
+  explicit TextClassifierHandle(
+      std::shared_ptr<const TextClassifier> classifier = nullptr)
+      : classifier_(std::move(classifier)) {}
+
+  // Waits for the replacement in the background, if any.
+  ~TextClassifierHandle();
+
+  // Returns the current model, or nullptr if there is none. Hold on to the
+  // result for the whole request.
+  std::shared_ptr<const TextClassifier> Get() const;
+
+  // Makes 'classifier' the current model.
+  void Replace(std::shared_ptr<const TextClassifier> classifier);
+
+  // Loads a model with 'factory' on a background thread, and makes it the
+  // current model once it's loaded, unless the load fails. Then calls 'done',
+  // if given, with whether the model was replaced. Waits for the previous
+  // background replacement first, so the replacements happen in call order.
+  void ReplaceInBackground(
+      std::function<std::unique_ptr<TextClassifier>()> factory,
+      std::function<void(bool)> done = nullptr);
+
+  // Waits until the background replacement, if any, is done.
+  void WaitForReplacement();
+
+ private:
+  mutable std::mutex mutex_;
+  std::shared_ptr<const TextClassifier> classifier_;
+
+  // Serializes the background replacements.
+  std::mutex replacement_mutex_;
+  std::thread replacement_thread_;
+
+  TC_DISALLOW_COPY_AND_ASSIGN(TextClassifierHandle);
+};
+
+}  // namespace libtextclassifier2
+
+#endif  // LIBTEXTCLASSIFIER_TEXT_CLASSIFIER_HANDLE_H_
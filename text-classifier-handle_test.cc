@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "text-classifier-handle.h"
+
+#include <memory>
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+std::string GetModelPath() {
+  return LIBTEXTCLASSIFIER_TEST_DATA_DIR;
+}
+
+TEST(TextClassifierHandleTest, RequestsKeepTheirModel) {
+  CREATE_UNILIB_FOR_TESTING;
+  std::shared_ptr<const TextClassifier> old_classifier =
+      TextClassifier::FromPath(GetModelPath() + "test_model.fb", &unilib);
+  ASSERT_TRUE(old_classifier);
+  TextClassifierHandle handle(old_classifier);
+  std::weak_ptr<const TextClassifier> old_weak(old_classifier);
+  old_classifier.reset();
+
+  std::shared_ptr<const TextClassifier> in_flight = handle.Get();
+  EXPECT_EQ(in_flight, old_weak.lock());
+
+  std::shared_ptr<const TextClassifier> new_classifier =
+      TextClassifier::FromPath(GetModelPath() + "test_model.fb", &unilib);
+  handle.Replace(new_classifier);
+  EXPECT_EQ(handle.Get(), new_classifier);
+
+  // The request in flight still works on the old model.
+  EXPECT_FALSE(old_weak.expired());
+  EXPECT_EQ(in_flight->SuggestSelection("call me at 857 225 3556 today",
+                                        {11, 14}),
+            std::make_pair(11, 23));
+  in_flight.reset();
+  EXPECT_TRUE(old_weak.expired());
+}
+
+TEST(TextClassifierHandleTest, ReplacesInBackground) {
+  CREATE_UNILIB_FOR_TESTING;
+  TextClassifierHandle handle;
+  EXPECT_EQ(handle.Get(), nullptr);
+
+  bool replaced = false;
+  handle.ReplaceInBackground(
+      [&unilib]() {
+        return TextClassifier::FromPath(GetModelPath() + "test_model.fb",
+                                        &unilib);
+      },
+      [&replaced](bool success) { replaced = success; });
+  handle.WaitForReplacement();
+  EXPECT_TRUE(replaced);
+  std::shared_ptr<const TextClassifier> classifier = handle.Get();
+  EXPECT_NE(classifier, nullptr);
+
+  // A failed load keeps the current model.
+  handle.ReplaceInBackground(
+      [&unilib]() {
+        return TextClassifier::FromPath(GetModelPath() + "no_such_model.fb",
+                                        &unilib);
+      },
+      [&replaced](bool success) { replaced = success; });
+  handle.WaitForReplacement();
+  EXPECT_FALSE(replaced);
+  EXPECT_EQ(handle.Get(), classifier);
+}
+
+}  // namespace
+}  // namespace libtextclassifier2
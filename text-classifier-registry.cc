@@ -0,0 +1,281 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "text-classifier-registry.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <thread>  // NOLINT
+
+#include "util/base/logging.h"
+#include "util/base/numa.h"
+
+namespace libtextclassifier2 {
+
+namespace {
+
+// A classifier with the copy of the model that it was loaded from.
+struct ModelReplica {
+  std::unique_ptr<char[]> buffer;
+  std::unique_ptr<TextClassifier> classifier;
+};
+
+// Reads the segment of the file into the buffer. Returns false on error.
+bool ReadFully(int fd, int64 offset, int64 size, char* buffer) {
+  while (size > 0) {
+    const ssize_t num_read = pread(fd, buffer, size, offset);
+    if (num_read <= 0) {
+      if (num_read < 0 && errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    buffer += num_read;
+    offset += num_read;
+    size -= num_read;
+  }
+  return true;
+}
+
+// Loads a replica of the model in the file on a thread pinned to the node,
+// so that the memory of the replica is allocated on the node. If the thread
+// can't be pinned, e.g. in a container with fewer CPUs, the replica is loaded
+// anyway, wherever its memory ends up.
+std::shared_ptr<const TextClassifier> LoadOnNumaNode(
+    int fd, int offset, int size, int numa_node, const UniLib* unilib,
+    const LoadOptions& load_options) {
+  std::shared_ptr<const TextClassifier> result;
+  std::thread thread([&]() {
+    if (!PinCurrentThreadToNumaNode(numa_node)) {
+      TC_LOG(WARNING) << "Loading the replica for NUMA node " << numa_node
+                      << " on an unpinned thread.";
+    }
+    std::shared_ptr<ModelReplica> replica(new ModelReplica);
+    // Aligned like malloc, which covers the 16-byte alignment of the TFLite
+    // models in the buffer.
+    replica->buffer.reset(new char[size]);
+    if (!ReadFully(fd, offset, size, replica->buffer.get())) {
+      TC_LOG(ERROR) << "Unable to read the model.";
+      return;
+    }
+    replica->classifier = TextClassifier::FromUnownedBuffer(
+        replica->buffer.get(), size, unilib, load_options);
+    if (replica->classifier != nullptr) {
+      result = std::shared_ptr<const TextClassifier>(
+          replica, replica->classifier.get());
+    }
+  });
+  thread.join();
+  return result;
+}
+
+// Appends the value to the key of the load options.
+template <typename T>
+void AppendToKey(T value, std::string* key) {
+  key->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Returns the load options that the classifier is built with, serialized, so
+// that callers with different options get different classifiers.
+std::string LoadOptionsKey(const LoadOptions& load_options) {
+  std::string key;
+  AppendToKey(load_options.dequantize_embeddings, &key);
+  AppendToKey(load_options.multi_pattern_annotation_regex, &key);
+  AppendToKey(load_options.lazy_regex_compilation, &key);
+  const ExecutorOptions& executor_options = load_options.executor_options;
+  AppendToKey(executor_options.num_threads, &key);
+  AppendToKey(executor_options.use_nnapi, &key);
+  AppendToKey(executor_options.enable_operator_profiling, &key);
+  AppendToKey(load_options.trusted_model_fingerprint, &key);
+  AppendToKey(load_options.model_gate.enabled, &key);
+  AppendToKey(load_options.model_gate.min_signal_codepoints, &key);
+  AppendToKey(load_options.model_gate.min_signal_ratio, &key);
+  AppendToKey(load_options.classification_cache_size, &key);
+  AppendToKey(load_options.classification_cache_time_tolerance_ms, &key);
+  AppendToKey(load_options.shared_embedding_cache_bytes, &key);
+  AppendToKey(load_options.collect_metrics, &key);
+  AppendToKey(load_options.adaptive_annotation_quality, &key);
+  AppendToKey(load_options.annotation_latency_target_micros, &key);
+  AppendToKey(load_options.classification_batching_wait_micros, &key);
+  AppendToKey(load_options.classification_batching_max_rows, &key);
+  AppendToKey(load_options.regex_time_limit_millis, &key);
+  return key;
+}
+
+}  // namespace
+
+TextClassifierRegistry* TextClassifierRegistry::Instance() {
+  static TextClassifierRegistry* instance = new TextClassifierRegistry();
+  return instance;
+}
+
+std::shared_ptr<const TextClassifier> TextClassifierRegistry::GetOrLoad(
+    int fd, int offset, int size, int numa_node, const UniLib* unilib,
+    const LoadOptions& load_options,
+    const std::function<std::shared_ptr<const TextClassifier>()>& load) {
+  // The delegate factories can't be told apart, so the classifiers that use
+  // one are not shared.
+  if (load_options.executor_options.delegate_factory) {
+    return load();
+  }
+
+  struct stat sb;
+  if (fstat(fd, &sb) != 0) {
+    TC_LOG(ERROR) << "Unable to stat fd.";
+    return nullptr;
+  }
+  const Key key(sb.st_dev, sb.st_ino, offset, size, numa_node, unilib,
+                LoadOptionsKey(load_options));
+
+  const std::shared_ptr<Entry> entry = GetEntry(key);
+  std::lock_guard<std::mutex> lock(entry->mutex);
+  std::shared_ptr<const TextClassifier> classifier = entry->classifier.lock();
+  if (classifier == nullptr) {
+    classifier = load();
+    entry->classifier = classifier;
+  }
+  return classifier;
+}
+
+std::shared_ptr<const TextClassifier>
+TextClassifierRegistry::FromFileDescriptor(int fd, int offset, int size,
+                                           const UniLib* unilib,
+                                           const LoadOptions& load_options) {
+  return GetOrLoad(fd, offset, size, /*numa_node=*/-1, unilib, load_options,
+                   [=]() -> std::shared_ptr<const TextClassifier> {
+                     return TextClassifier::FromFileDescriptor(
+                         fd, offset, size, unilib, load_options);
+                   });
+}
+
+std::shared_ptr<const TextClassifier>
+TextClassifierRegistry::FromFileDescriptorOnNumaNode(
+    int fd, int offset, int size, int numa_node, const UniLib* unilib,
+    const LoadOptions& load_options) {
+  return GetOrLoad(fd, offset, size, numa_node, unilib, load_options, [=]() {
+    return LoadOnNumaNode(fd, offset, size, numa_node, unilib, load_options);
+  });
+}
+
+std::shared_ptr<const TextClassifier>
+TextClassifierRegistry::FromFileDescriptor(int fd, const UniLib* unilib,
+                                           const LoadOptions& load_options) {
+  struct stat sb;
+  if (fstat(fd, &sb) != 0) {
+    TC_LOG(ERROR) << "Unable to stat fd.";
+    return nullptr;
+  }
+  return FromFileDescriptor(fd, /*offset=*/0, sb.st_size, unilib,
+                            load_options);
+}
+
+std::shared_ptr<const TextClassifier> TextClassifierRegistry::FromPath(
+    const std::string& path, const UniLib* unilib,
+    const LoadOptions& load_options) {
+  // Identifies and maps the same file even if the path is replaced meanwhile.
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    TC_LOG(ERROR) << "Unable to open " << path;
+    return nullptr;
+  }
+  std::shared_ptr<const TextClassifier> classifier =
+      FromFileDescriptor(fd, unilib, load_options);
+  close(fd);
+  return classifier;
+}
+
+int TextClassifierRegistry::NumLoadedModels() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  int num_loaded_models = 0;
+  for (const auto& key_entry : entries_) {
+    if (!key_entry.second->classifier.expired()) {
+      ++num_loaded_models;
+    }
+  }
+  return num_loaded_models;
+}
+
+std::shared_ptr<TextClassifierRegistry::Entry> TextClassifierRegistry::GetEntry(
+    const Key& key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::shared_ptr<Entry>& entry = entries_[key];
+  if (entry == nullptr) {
+    // Entries only get copied under the lock, so an entry that nobody else
+    // holds is not being loaded, and it can go once its model is unloaded.
+    for (auto it = entries_.begin(); it != entries_.end();) {
+      if (it->second != nullptr && it->second.use_count() == 1 &&
+          it->second->classifier.expired()) {
+        it = entries_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    entry.reset(new Entry());
+  }
+  return entry;
+}
+
+std::unique_ptr<NumaReplicatedClassifier> NumaReplicatedClassifier::FromPath(
+    const std::string& path, const UniLib* unilib,
+    const LoadOptions& load_options, TextClassifierRegistry* registry) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    TC_LOG(ERROR) << "Unable to open " << path;
+    return nullptr;
+  }
+  std::unique_ptr<NumaReplicatedClassifier> replicated(
+      new NumaReplicatedClassifier());
+  const NumaTopology& topology = NumaTopology::Instance();
+  struct stat sb;
+  if (fstat(fd, &sb) != 0) {
+    TC_LOG(ERROR) << "Unable to stat fd.";
+  } else if (topology.NumNodes() == 1) {
+    replicated->replicas_.push_back(
+        registry->FromFileDescriptor(fd, unilib, load_options));
+  } else {
+    for (int node = 0; node < topology.NumNodes(); ++node) {
+      // No requests run on the nodes without CPUs, which only get the
+      // classifier of the mapped model.
+      replicated->replicas_.push_back(
+          topology.NodeCpus(node).empty()
+              ? registry->FromFileDescriptor(fd, unilib, load_options)
+              : registry->FromFileDescriptorOnNumaNode(
+                    fd, /*offset=*/0, sb.st_size, node, unilib,
+                    load_options));
+    }
+  }
+  close(fd);
+
+  if (replicated->replicas_.empty()) {
+    return nullptr;
+  }
+  for (const auto& replica : replicated->replicas_) {
+    if (replica == nullptr) {
+      return nullptr;
+    }
+  }
+  return replicated;
+}
+
+const TextClassifier& NumaReplicatedClassifier::Local() const {
+  const int node = NumaTopology::Instance().CurrentNode();
+  return *replicas_[node < replicas_.size() ? node : 0];
+}
+
+}  // namespace libtextclassifier2
@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Process-wide sharing of the loaded models.
+
+#ifndef LIBTEXTCLASSIFIER_TEXT_CLASSIFIER_REGISTRY_H_
+#define LIBTEXTCLASSIFIER_TEXT_CLASSIFIER_REGISTRY_H_
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "text-classifier.h"
+#include "util/base/integral_types.h"
+#include "util/base/macros.h"
+#include "util/utf8/unilib.h"
+
+namespace libtextclassifier2 {
+
+// Hands out one shared TextClassifier per model file, so that all the users
+// of a model in the process share its mmap, executors, compiled patterns and
+// feature processors instead of loading their own copy. Models are
+// identified by the device and inode of the file and the offset and size of
+// the model in it, plus the load options that change the loaded state.
+// Classifiers whose executors use a delegate factory are not shared, as the
+// factories can't be compared. A model is unloaded when the last of its users
+// releases it.
+// NOTE: All methods are thread-safe. The returned classifiers can be used
+// from many threads at once, see TextClassifier.
+class TextClassifierRegistry {
+ public:
+  TextClassifierRegistry() {}
+
+  // Returns the registry of the process. Never destroyed.
+  static TextClassifierRegistry* Instance();
+
+  // Like the TextClassifier factories of the same name, but returns the
+  // already loaded classifier for the model if there is one. Returns nullptr
+  // if the model can't be loaded.
+  std::shared_ptr<const TextClassifier> FromFileDescriptor(
+      int fd, int offset, int size, const UniLib* unilib = nullptr,
+      const LoadOptions& load_options = LoadOptions::Default());
+  std::shared_ptr<const TextClassifier> FromFileDescriptor(
+      int fd, const UniLib* unilib = nullptr,
+      const LoadOptions& load_options = LoadOptions::Default());
+  std::shared_ptr<const TextClassifier> FromPath(
+      const std::string& path, const UniLib* unilib = nullptr,
+      const LoadOptions& load_options = LoadOptions::Default());
+
+  // Like FromFileDescriptor(), but returns the replica of the model whose
+  // memory is on the given NUMA node: a thread pinned to the node copies the
+  // model into memory that it first touches, and loads it from there, so that
+  // the embeddings, the TFLite weights and the tables built at load time are
+  // all local to the node. If the thread can't be pinned, the replica is
+  // loaded anyway. See NumaReplicatedClassifier.
+  std::shared_ptr<const TextClassifier> FromFileDescriptorOnNumaNode(
+      int fd, int offset, int size, int numa_node,
+      const UniLib* unilib = nullptr,
+      const LoadOptions& load_options = LoadOptions::Default());
+
+  // Returns the number of models that are currently loaded.
+  int NumLoadedModels();
+
+ private:
+  // Device, inode, offset, size, NUMA node of the replica or -1, unilib and
+  // the load options that the classifier is built with, see LoadOptionsKey()
+  // in the .cc file.
+  typedef std::tuple<uint64, uint64, int64, int64, int, const UniLib*,
+                     std::string>
+      Key;
+
+  // Returns the classifier of the model in the file for the key, loaded with
+  // 'load' if needed.
+  std::shared_ptr<const TextClassifier> GetOrLoad(
+      int fd, int offset, int size, int numa_node, const UniLib* unilib,
+      const LoadOptions& load_options,
+      const std::function<std::shared_ptr<const TextClassifier>()>& load);
+
+  struct Entry {
+    // Held while the model is being loaded, so that concurrent requests for
+    // the same model wait for the one load.
+    std::mutex mutex;
+    std::weak_ptr<const TextClassifier> classifier;
+  };
+
+  // The entry of the key, created if needed. Drops the unused entries of
+  // unloaded models.
+  std::shared_ptr<Entry> GetEntry(const Key& key);
+
+  std::mutex mutex_;
+  std::map<Key, std::shared_ptr<Entry>> entries_;
+
+  TC_DISALLOW_COPY_AND_ASSIGN(TextClassifierRegistry);
+};
+
+// One replica of a model per NUMA node of the machine, so that each request
+// reads the model from the memory of the node it runs on instead of from
+// across the sockets. Worth it for servers with several sockets, at the cost
+// of one copy of the model per node. On machines with one node, holds the one
+// classifier of the registry for the model. The calling threads should stay
+// on their nodes, see PinCurrentThreadToNumaNode().
+// NOTE: All methods are thread-safe.
+class NumaReplicatedClassifier {
+ public:
+  // Loads the replicas from the registry. Returns nullptr if any of them
+  // can't be loaded.
+  static std::unique_ptr<NumaReplicatedClassifier> FromPath(
+      const std::string& path, const UniLib* unilib = nullptr,
+      const LoadOptions& load_options = LoadOptions::Default(),
+      TextClassifierRegistry* registry = TextClassifierRegistry::Instance());
+
+  // The replica on the node of the calling thread.
+  const TextClassifier& Local() const;
+
+  // The replica on the given node.
+  const TextClassifier& OnNode(int numa_node) const {
+    return *replicas_[numa_node];
+  }
+
+  int NumReplicas() const { return replicas_.size(); }
+
+ private:
+  NumaReplicatedClassifier() {}
+
+  std::vector<std::shared_ptr<const TextClassifier>> replicas_;
+
+  TC_DISALLOW_COPY_AND_ASSIGN(NumaReplicatedClassifier);
+};
+
+}  // namespace libtextclassifier2
+
+#endif  // LIBTEXTCLASSIFIER_TEXT_CLASSIFIER_REGISTRY_H_
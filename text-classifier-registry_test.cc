@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "text-classifier-registry.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "util/base/numa.h"
+#include "gtest/gtest.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+std::string GetModelPath() {
+  return LIBTEXTCLASSIFIER_TEST_DATA_DIR;
+}
+
+TEST(TextClassifierRegistryTest, SharesLoadedModel) {
+  CREATE_UNILIB_FOR_TESTING;
+  TextClassifierRegistry registry;
+  const std::string path = GetModelPath() + "test_model.fb";
+
+  std::shared_ptr<const TextClassifier> classifier =
+      registry.FromPath(path, &unilib);
+  ASSERT_TRUE(classifier);
+  EXPECT_EQ(registry.NumLoadedModels(), 1);
+
+  const int fd = open(path.c_str(), O_RDONLY);
+  ASSERT_GE(fd, 0);
+  EXPECT_EQ(registry.FromFileDescriptor(fd, &unilib), classifier);
+  close(fd);
+  EXPECT_EQ(registry.NumLoadedModels(), 1);
+
+  // Different load options need their own instance.
+  LoadOptions load_options;
+  load_options.dequantize_embeddings = true;
+  std::shared_ptr<const TextClassifier> dequantized =
+      registry.FromPath(path, &unilib, load_options);
+  ASSERT_TRUE(dequantized);
+  EXPECT_NE(dequantized, classifier);
+  EXPECT_EQ(registry.NumLoadedModels(), 2);
+
+  EXPECT_EQ(classifier->SuggestSelection("call me at 857 225 3556 today",
+                                         {11, 14}),
+            std::make_pair(11, 23));
+}
+
+TEST(TextClassifierRegistryTest, DifferentLoadOptionsGetDifferentModels) {
+  CREATE_UNILIB_FOR_TESTING;
+  TextClassifierRegistry registry;
+  const std::string path = GetModelPath() + "test_model.fb";
+  std::shared_ptr<const TextClassifier> classifier =
+      registry.FromPath(path, &unilib);
+  ASSERT_TRUE(classifier);
+
+  const std::vector<std::function<void(LoadOptions*)>> changes = {
+      [](LoadOptions* options) { options->executor_options.num_threads = 2; },
+      [](LoadOptions* options) { options->executor_options.use_nnapi = true; },
+      [](LoadOptions* options) {
+        options->executor_options.enable_operator_profiling = true;
+      },
+      [](LoadOptions* options) {
+        options->trusted_model_fingerprint = 1;
+      },
+      [](LoadOptions* options) { options->model_gate.enabled = true; },
+      [](LoadOptions* options) { options->classification_cache_size = 10; },
+      [](LoadOptions* options) {
+        options->shared_embedding_cache_bytes = 1 << 20;
+      },
+      [](LoadOptions* options) { options->collect_metrics = false; },
+      [](LoadOptions* options) { options->adaptive_annotation_quality = true; },
+      [](LoadOptions* options) {
+        options->classification_batching_wait_micros = 100;
+      },
+      [](LoadOptions* options) { options->regex_time_limit_millis = 10; },
+  };
+  for (int i = 0; i < changes.size(); ++i) {
+    LoadOptions load_options;
+    changes[i](&load_options);
+    std::shared_ptr<const TextClassifier> other =
+        registry.FromPath(path, &unilib, load_options);
+    ASSERT_TRUE(other) << i;
+    EXPECT_NE(other, classifier) << i;
+    EXPECT_EQ(registry.FromPath(path, &unilib, load_options), other) << i;
+  }
+
+  // A delegate factory is never shared.
+  LoadOptions load_options;
+  load_options.executor_options.delegate_factory = []() {
+    return DelegatePtr(nullptr, [](TfLiteDelegate*) {});
+  };
+  std::shared_ptr<const TextClassifier> with_delegate =
+      registry.FromPath(path, &unilib, load_options);
+  EXPECT_NE(with_delegate, classifier);
+  EXPECT_NE(registry.FromPath(path, &unilib, load_options), with_delegate);
+}
+
+TEST(TextClassifierRegistryTest, UnloadsReleasedModel) {
+  CREATE_UNILIB_FOR_TESTING;
+  TextClassifierRegistry registry;
+  const std::string path = GetModelPath() + "test_model.fb";
+
+  std::shared_ptr<const TextClassifier> classifier =
+      registry.FromPath(path, &unilib);
+  ASSERT_TRUE(classifier);
+  classifier.reset();
+  EXPECT_EQ(registry.NumLoadedModels(), 0);
+
+  EXPECT_TRUE(registry.FromPath(path, &unilib));
+}
+
+TEST(TextClassifierRegistryTest, ConcurrentLoadsShareModel) {
+  CREATE_UNILIB_FOR_TESTING;
+  TextClassifierRegistry registry;
+  const std::string path = GetModelPath() + "test_model.fb";
+
+  std::vector<std::shared_ptr<const TextClassifier>> classifiers(4);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < classifiers.size(); ++i) {
+    threads.emplace_back([&registry, &unilib, &path, &classifiers, i]() {
+      classifiers[i] = registry.FromPath(path, &unilib);
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  ASSERT_TRUE(classifiers[0]);
+  for (const auto& classifier : classifiers) {
+    EXPECT_EQ(classifier, classifiers[0]);
+  }
+  EXPECT_EQ(registry.NumLoadedModels(), 1);
+}
+
+TEST(TextClassifierRegistryTest, FailsOnMissingFile) {
+  CREATE_UNILIB_FOR_TESTING;
+  TextClassifierRegistry registry;
+  EXPECT_FALSE(registry.FromPath(GetModelPath() + "no_such_model.fb", &unilib));
+  EXPECT_EQ(registry.NumLoadedModels(), 0);
+}
+
+TEST(TextClassifierRegistryTest, LoadsReplicaOnNumaNode) {
+  CREATE_UNILIB_FOR_TESTING;
+  TextClassifierRegistry registry;
+  const std::string path = GetModelPath() + "test_model.fb";
+  const int fd = open(path.c_str(), O_RDONLY);
+  ASSERT_GE(fd, 0);
+  const int size = lseek(fd, 0, SEEK_END);
+
+  std::shared_ptr<const TextClassifier> classifier =
+      registry.FromFileDescriptor(fd, &unilib);
+  std::shared_ptr<const TextClassifier> replica =
+      registry.FromFileDescriptorOnNumaNode(fd, /*offset=*/0, size,
+                                            /*numa_node=*/0, &unilib);
+  ASSERT_TRUE(classifier);
+  ASSERT_TRUE(replica);
+  EXPECT_NE(replica, classifier);
+  EXPECT_EQ(registry.FromFileDescriptorOnNumaNode(fd, /*offset=*/0, size,
+                                                  /*numa_node=*/0, &unilib),
+            replica);
+  EXPECT_EQ(registry.NumLoadedModels(), 2);
+  close(fd);
+
+  EXPECT_EQ(replica->SuggestSelection("call me at 857 225 3556 today",
+                                      {11, 14}),
+            std::make_pair(11, 23));
+}
+
+TEST(TextClassifierRegistryTest, ReplicatesModelPerNumaNode) {
+  CREATE_UNILIB_FOR_TESTING;
+  TextClassifierRegistry registry;
+  std::unique_ptr<NumaReplicatedClassifier> replicated =
+      NumaReplicatedClassifier::FromPath(GetModelPath() + "test_model.fb",
+                                         &unilib, LoadOptions::Default(),
+                                         &registry);
+  ASSERT_TRUE(replicated);
+  EXPECT_EQ(replicated->NumReplicas(), NumaTopology::Instance().NumNodes());
+  EXPECT_EQ(replicated->Local().SuggestSelection(
+                "call me at 857 225 3556 today", {11, 14}),
+            std::make_pair(11, 23));
+  EXPECT_FALSE(NumaReplicatedClassifier::FromPath(
+      GetModelPath() + "no_such_model.fb", &unilib, LoadOptions::Default(),
+      &registry));
+}
+
+}  // namespace
+}  // namespace libtextclassifier2
@@ -0,0 +1,255 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "text-classifier-router.h"
+
+#include <dirent.h>
+
+#include <algorithm>
+
+#include "util/base/logging.h"
+#include "util/memory/mmap.h"
+#include "util/strings/split.h"
+
+namespace libtextclassifier2 {
+
+namespace {
+
+// The number of locales strings whose chosen model is remembered.
+const int kMaxCachedLocales = 1024;
+
+// Returns how well a model locale serves a requested one: 0 if it doesn't,
+// otherwise higher for more specific model locales.
+int LocaleMatchScore(const Locale& model_locale,
+                     const Locale& requested_locale) {
+  if (model_locale.Language() != requested_locale.Language()) {
+    return 0;
+  }
+  int score = 1;
+  if (!model_locale.Script().empty()) {
+    if (model_locale.Script() != requested_locale.Script()) {
+      return 0;
+    }
+    ++score;
+  }
+  if (!model_locale.Region().empty()) {
+    if (model_locale.Region() != requested_locale.Region()) {
+      return 0;
+    }
+    ++score;
+  }
+  return score;
+}
+
+}  // namespace
+
+std::unique_ptr<TextClassifierRouter> TextClassifierRouter::FromDirectory(
+    const std::string& directory, int64 memory_budget_bytes,
+    const UniLib* unilib, const LoadOptions& load_options) {
+  DIR* dir = opendir(directory.c_str());
+  if (dir == nullptr) {
+    TC_LOG(ERROR) << "Unable to open " << directory;
+    return nullptr;
+  }
+  std::vector<std::string> paths;
+  while (const dirent* file = readdir(dir)) {
+    const std::string name = file->d_name;
+    if (name != "." && name != "..") {
+      paths.push_back(directory + "/" + name);
+    }
+  }
+  closedir(dir);
+  std::sort(paths.begin(), paths.end());
+
+  std::unique_ptr<TextClassifierRouter> router(
+      new TextClassifierRouter(memory_budget_bytes, unilib, load_options));
+  for (const std::string& path : paths) {
+    ScopedMmap mmap(path);
+    if (!mmap.handle().ok()) {
+      continue;
+    }
+    const Model* model =
+        ViewModel(mmap.handle().start(), mmap.handle().num_bytes());
+    if (model == nullptr) {
+      TC_VLOG(1) << "Skipping " << path << ", which is not a model.";
+      continue;
+    }
+
+    std::unique_ptr<ModelEntry> entry(new ModelEntry());
+    entry->path = path;
+    entry->version = model->version();
+    if (model->locales() != nullptr) {
+      const std::string model_locales = model->locales()->str();
+      for (const StringPiece tag : strings::Split(model_locales, ',')) {
+        if (tag.ToString() == "*") {
+          entry->any_locale = true;
+          continue;
+        }
+        const Locale locale = Locale::FromBCP47(tag.ToString());
+        if (locale.IsValid()) {
+          entry->locales.push_back(locale);
+        }
+      }
+    }
+    router->models_.push_back(std::move(entry));
+  }
+  if (router->models_.empty()) {
+    TC_LOG(ERROR) << "No models in " << directory;
+    return nullptr;
+  }
+  return router;
+}
+
+std::shared_ptr<const TextClassifier> TextClassifierRouter::Get(
+    const std::string& locales) {
+  const int index = FindModel(locales);
+  if (index < 0) {
+    return nullptr;
+  }
+  ModelEntry* entry = models_[index].get();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (entry->classifier != nullptr) {
+      entry->last_use = ++use_counter_;
+      return entry->classifier;
+    }
+  }
+
+  std::lock_guard<std::mutex> load_lock(entry->load_mutex);
+  {
+    // Another request may have loaded the model meanwhile.
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (entry->classifier != nullptr) {
+      entry->last_use = ++use_counter_;
+      return entry->classifier;
+    }
+  }
+  std::shared_ptr<const TextClassifier> classifier =
+      TextClassifier::FromPath(entry->path, unilib_, load_options_);
+  if (classifier == nullptr) {
+    TC_LOG(ERROR) << "Unable to load " << entry->path;
+    return nullptr;
+  }
+  const MemoryStats stats = classifier->GetMemoryStats();
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  entry->classifier = classifier;
+  entry->bytes = stats.model_bytes + stats.AllocatedBytes();
+  entry->last_use = ++use_counter_;
+  loaded_bytes_ += entry->bytes;
+  EvictLocked(entry);
+  return classifier;
+}
+
+std::string TextClassifierRouter::ModelPath(const std::string& locales) {
+  const int index = FindModel(locales);
+  return index >= 0 ? models_[index]->path : "";
+}
+
+int TextClassifierRouter::NumLoadedModels() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  int num_loaded_models = 0;
+  for (const auto& entry : models_) {
+    if (entry->classifier != nullptr) {
+      ++num_loaded_models;
+    }
+  }
+  return num_loaded_models;
+}
+
+int64 TextClassifierRouter::LoadedBytes() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return loaded_bytes_;
+}
+
+int TextClassifierRouter::FindModel(const std::string& locales) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = model_for_locales_.find(locales);
+    if (it != model_for_locales_.end()) {
+      return it->second;
+    }
+  }
+  const int index = ChooseModel(locales);
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (model_for_locales_.size() >= kMaxCachedLocales) {
+    model_for_locales_.clear();
+  }
+  model_for_locales_[locales] = index;
+  return index;
+}
+
+int TextClassifierRouter::ChooseModel(const std::string& locales) const {
+  // The first requested locale that any model supports decides, then the most
+  // specific match and the newest version.
+  for (const StringPiece tag : strings::Split(locales, ',')) {
+    const Locale requested_locale = Locale::FromBCP47(tag.ToString());
+    if (!requested_locale.IsValid()) {
+      continue;
+    }
+    int best_index = -1;
+    int best_score = 0;
+    for (int i = 0; i < models_.size(); ++i) {
+      int score = 0;
+      for (const Locale& model_locale : models_[i]->locales) {
+        score =
+            std::max(score, LocaleMatchScore(model_locale, requested_locale));
+      }
+      if (score > best_score ||
+          (score > 0 && score == best_score &&
+           models_[i]->version > models_[best_index]->version)) {
+        best_index = i;
+        best_score = score;
+      }
+    }
+    if (best_index >= 0) {
+      return best_index;
+    }
+  }
+
+  // Falls back to the newest model that supports any locale.
+  int best_index = -1;
+  for (int i = 0; i < models_.size(); ++i) {
+    if (models_[i]->any_locale &&
+        (best_index < 0 ||
+         models_[i]->version > models_[best_index]->version)) {
+      best_index = i;
+    }
+  }
+  return best_index;
+}
+
+void TextClassifierRouter::EvictLocked(const ModelEntry* keep) {
+  while (loaded_bytes_ > memory_budget_bytes_) {
+    ModelEntry* least_recently_used = nullptr;
+    for (const auto& entry : models_) {
+      if (entry.get() != keep && entry->classifier != nullptr &&
+          (least_recently_used == nullptr ||
+           entry->last_use < least_recently_used->last_use)) {
+        least_recently_used = entry.get();
+      }
+    }
+    if (least_recently_used == nullptr) {
+      return;
+    }
+    TC_VLOG(1) << "Unloading " << least_recently_used->path;
+    least_recently_used->classifier.reset();
+    loaded_bytes_ -= least_recently_used->bytes;
+    least_recently_used->bytes = 0;
+  }
+}
+
+}  // namespace libtextclassifier2
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Routing of the requests to the models of their locales.
+
+#ifndef LIBTEXTCLASSIFIER_TEXT_CLASSIFIER_ROUTER_H_
+#define LIBTEXTCLASSIFIER_TEXT_CLASSIFIER_ROUTER_H_
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "text-classifier.h"
+#include "util/base/integral_types.h"
+#include "util/base/macros.h"
+#include "util/i18n/locale.h"
+#include "util/utf8/unilib.h"
+
+namespace libtextclassifier2 {
+
+// Serves the requests of many locales from a directory of models, one or more
+// per language. Only the locales and the version of each model are read
+// upfront, the same way as nativeGetLocales and nativeGetVersion do. A model is
+// loaded on the first request it's chosen for, and the least recently used
+// models are unloaded once the loaded ones take more than the memory budget.
+// Requests in flight keep their model alive until they're done.
+// NOTE: All methods are thread-safe.
+class TextClassifierRouter {
+ public:
+  // Reads the models in 'directory'. Files that aren't models are skipped.
+  // Returns nullptr if there are no models. 'memory_budget_bytes' bounds the
+  // memory of the loaded models, see MemoryStats, except that the model of
+  // the latest request always stays loaded.
+  static std::unique_ptr<TextClassifierRouter> FromDirectory(
+      const std::string& directory, int64 memory_budget_bytes,
+      const UniLib* unilib = nullptr,
+      const LoadOptions& load_options = LoadOptions::Default());
+
+  // Returns the model for 'locales', a comma-separated list of BCP47 tags in
+  // the order of preference as in the options of the requests, and loads it if
+  // needed. Returns nullptr if no model supports the locales, or if the model
+  // can't be loaded. Hold on to the result for the whole request.
+  std::shared_ptr<const TextClassifier> Get(const std::string& locales);
+
+  // Returns the path of the model that Get() uses for 'locales', or an empty
+  // string if there is none. Doesn't load the model.
+  std::string ModelPath(const std::string& locales);
+
+  int NumModels() const { return models_.size(); }
+
+  // Returns the number of models that are currently loaded, and their memory.
+  int NumLoadedModels();
+  int64 LoadedBytes();
+
+ private:
+  struct ModelEntry {
+    std::string path;
+    int version = 0;
+    std::vector<Locale> locales;
+
+    // Whether the model supports any locale, as the universal model does with
+    // the locale "*".
+    bool any_locale = false;
+
+    // Held while the model is being loaded, so that concurrent requests for
+    // the same model wait for the one load.
+    std::mutex load_mutex;
+
+    // The loaded model, its memory and the time of its last use. Guarded by
+    // mutex_.
+    std::shared_ptr<const TextClassifier> classifier;
+    int64 bytes = 0;
+    uint64 last_use = 0;
+  };
+
+  TextClassifierRouter(int64 memory_budget_bytes, const UniLib* unilib,
+                       const LoadOptions& load_options)
+      : memory_budget_bytes_(memory_budget_bytes),
+        unilib_(unilib),
+        load_options_(load_options) {}
+
+  // Returns the index of the model for 'locales', or -1 if there is none.
+  int FindModel(const std::string& locales);
+
+  // Chooses the model for 'locales' out of all the models.
+  int ChooseModel(const std::string& locales) const;
+
+  // Unloads the least recently used models other than 'keep' until the loaded
+  // ones fit into the memory budget.
+  void EvictLocked(const ModelEntry* keep);
+
+  const int64 memory_budget_bytes_;
+  const UniLib* const unilib_;
+  const LoadOptions load_options_;
+  std::vector<std::unique_ptr<ModelEntry>> models_;
+
+  std::mutex mutex_;
+  int64 loaded_bytes_ = 0;
+  uint64 use_counter_ = 0;
+
+  // The chosen model for each of the recently seen locales strings.
+  std::unordered_map<std::string, int> model_for_locales_;
+
+  TC_DISALLOW_COPY_AND_ASSIGN(TextClassifierRouter);
+};
+
+}  // namespace libtextclassifier2
+
+#endif  // LIBTEXTCLASSIFIER_TEXT_CLASSIFIER_ROUTER_H_
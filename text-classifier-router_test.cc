@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "text-classifier-router.h"
+
+#include <stdlib.h>
+
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+std::string ReadFile(const std::string& file_name) {
+  std::ifstream file_stream(file_name);
+  return std::string(std::istreambuf_iterator<char>(file_stream), {});
+}
+
+std::string GetModelPath() {
+  return LIBTEXTCLASSIFIER_TEST_DATA_DIR;
+}
+
+class TextClassifierRouterTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    std::string directory = testing::TempDir() + "/router_XXXXXX";
+    ASSERT_NE(mkdtemp(&directory[0]), nullptr);
+    directory_ = directory;
+  }
+
+  // Writes the test model with the given locales and version.
+  void WriteModel(const std::string& name, const std::string& locales,
+                  int version) {
+    const std::string test_model =
+        ReadFile(GetModelPath() + "test_model.fb");
+    std::unique_ptr<ModelT> unpacked_model = UnPackModel(test_model.c_str());
+    unpacked_model->locales = locales;
+    unpacked_model->version = version;
+
+    flatbuffers::FlatBufferBuilder builder;
+    builder.Finish(Model::Pack(builder, unpacked_model.get()));
+    std::ofstream file(directory_ + "/" + name);
+    file.write(reinterpret_cast<const char*>(builder.GetBufferPointer()),
+               builder.GetSize());
+  }
+
+  std::string directory_;
+};
+
+TEST_F(TextClassifierRouterTest, ChoosesModelByLocales) {
+  CREATE_UNILIB_FOR_TESTING;
+  WriteModel("en.model", "en", 1);
+  WriteModel("en2.model", "en", 2);
+  WriteModel("zh.model", "zh", 1);
+  WriteModel("zh-Hant.model", "zh-Hant", 1);
+  WriteModel("de.model", "de,de-CH", 1);
+  WriteModel("universal.model", "*", 1);
+  std::ofstream(directory_ + "/README") << "not a model";
+
+  std::unique_ptr<TextClassifierRouter> router =
+      TextClassifierRouter::FromDirectory(directory_,
+                                          /*memory_budget_bytes=*/1 << 30,
+                                          &unilib);
+  ASSERT_TRUE(router);
+  EXPECT_EQ(router->NumModels(), 6);
+  EXPECT_EQ(router->NumLoadedModels(), 0);
+
+  // The newest version of the language.
+  EXPECT_EQ(router->ModelPath("en-US"), directory_ + "/en2.model");
+  // The most specific locale.
+  EXPECT_EQ(router->ModelPath("zh-Hant-TW"), directory_ + "/zh-Hant.model");
+  EXPECT_EQ(router->ModelPath("zh-TW"), directory_ + "/zh.model");
+  EXPECT_EQ(router->ModelPath("de-CH"), directory_ + "/de.model");
+  // The first supported locale in the order of preference.
+  EXPECT_EQ(router->ModelPath("xx,fr-FR,de"), directory_ + "/de.model");
+  // The model for any locale otherwise.
+  EXPECT_EQ(router->ModelPath("fr"), directory_ + "/universal.model");
+  EXPECT_EQ(router->ModelPath(""), directory_ + "/universal.model");
+  EXPECT_EQ(router->NumLoadedModels(), 0);
+}
+
+TEST_F(TextClassifierRouterTest, LoadsLazily) {
+  CREATE_UNILIB_FOR_TESTING;
+  WriteModel("en.model", "en", 1);
+  WriteModel("de.model", "de", 1);
+
+  std::unique_ptr<TextClassifierRouter> router =
+      TextClassifierRouter::FromDirectory(directory_,
+                                          /*memory_budget_bytes=*/1 << 30,
+                                          &unilib);
+  ASSERT_TRUE(router);
+  std::shared_ptr<const TextClassifier> classifier = router->Get("en");
+  ASSERT_TRUE(classifier);
+  EXPECT_EQ(router->NumLoadedModels(), 1);
+  EXPECT_GT(router->LoadedBytes(), 0);
+  EXPECT_EQ(router->Get("en-GB"), classifier);
+  EXPECT_EQ(classifier->SuggestSelection("call me at 857 225 3556 today",
+                                         {11, 14}),
+            std::make_pair(11, 23));
+
+  EXPECT_FALSE(router->Get("fr"));
+  EXPECT_TRUE(router->Get("de"));
+  EXPECT_EQ(router->NumLoadedModels(), 2);
+}
+
+TEST_F(TextClassifierRouterTest, EvictsLeastRecentlyUsed) {
+  CREATE_UNILIB_FOR_TESTING;
+  WriteModel("de.model", "de", 1);
+  WriteModel("en.model", "en", 1);
+  WriteModel("fr.model", "fr", 1);
+
+  // Room for a single model.
+  std::unique_ptr<TextClassifierRouter> router =
+      TextClassifierRouter::FromDirectory(directory_,
+                                          /*memory_budget_bytes=*/1, &unilib);
+  ASSERT_TRUE(router);
+  std::shared_ptr<const TextClassifier> english = router->Get("en");
+  ASSERT_TRUE(english);
+  const int64 model_bytes = router->LoadedBytes();
+  EXPECT_TRUE(router->Get("de"));
+  EXPECT_EQ(router->NumLoadedModels(), 1);
+  EXPECT_EQ(router->LoadedBytes(), model_bytes);
+
+  // The unloaded model stays usable by those who hold it.
+  EXPECT_EQ(english->SuggestSelection("call me at 857 225 3556 today",
+                                      {11, 14}),
+            std::make_pair(11, 23));
+  EXPECT_NE(router->Get("en"), nullptr);
+  EXPECT_EQ(router->NumLoadedModels(), 1);
+
+  // With room for two models, the least recently used one goes.
+  router = TextClassifierRouter::FromDirectory(directory_, 2 * model_bytes,
+                                               &unilib);
+  ASSERT_TRUE(router);
+  std::shared_ptr<const TextClassifier> german = router->Get("de");
+  EXPECT_TRUE(router->Get("en"));
+  EXPECT_EQ(router->Get("de"), german);
+  EXPECT_TRUE(router->Get("fr"));
+  EXPECT_EQ(router->NumLoadedModels(), 2);
+  EXPECT_EQ(router->Get("de"), german);
+  EXPECT_EQ(router->NumLoadedModels(), 2);
+}
+
+TEST_F(TextClassifierRouterTest, FailsWithoutModels) {
+  CREATE_UNILIB_FOR_TESTING;
+  EXPECT_FALSE(TextClassifierRouter::FromDirectory(directory_, 1 << 30,
+                                                   &unilib));
+  EXPECT_FALSE(TextClassifierRouter::FromDirectory(
+      directory_ + "/no_such_directory", 1 << 30, &unilib));
+}
+
+}  // namespace
+}  // namespace libtextclassifier2
@@ -17,13 +17,24 @@
 #include "text-classifier.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cctype>
+#include <chrono>
 #include <cmath>
+#include <cstdlib>
 #include <iterator>
 #include <numeric>
+#include <thread>
 
+#include "non-overlapping-spans.h"
+#include "shared-regex-patterns.h"
+#include "stage-profile.h"
 #include "util/base/logging.h"
+#include "util/hash/farmhash.h"
 #include "util/math/softmax.h"
+#include "util/memory/arena.h"
+#include "util/strings/utf8.h"
+#include "util/utf8/unicodetext-index.h"
 #include "util/utf8/unicodetext.h"
 
 namespace libtextclassifier2 {
@@ -47,12 +58,108 @@ const Model* LoadAndVerifyModel(const void* addr, int size) {
     return nullptr;
   }
 }
+
+// Same as above, but skips the verification of a trusted model, see
+// LoadOptions::trusted_model_fingerprint. Clears the fingerprint in
+// 'load_options' if it doesn't match, so that the models inside are verified,
+// too, or fails if LoadOptions::require_trusted_model.
+const Model* LoadAndVerifyModel(const void* addr, int size,
+                                LoadOptions* load_options) {
+  if (load_options->trusted_model_fingerprint != 0) {
+    if (ModelFingerprint(addr, size) ==
+        load_options->trusted_model_fingerprint) {
+      return GetModel(addr);
+    }
+    if (load_options->require_trusted_model) {
+      TC_LOG(ERROR) << "Mismatching trusted model fingerprint.";
+      return nullptr;
+    }
+    TC_LOG(WARNING) << "Mismatching trusted model fingerprint, verifying the "
+                       "model.";
+    load_options->trusted_model_fingerprint = 0;
+  }
+  return LoadAndVerifyModel(addr, size);
+}
+
+// Applies the page residency options to the mapped model. Failures only cost
+// performance, so they are logged and otherwise ignored.
+void ApplyResidencyOptions(const MmapHandle& handle, const Model* model,
+                           const LoadOptions& load_options) {
+  if (load_options.prefault_model) {
+    AdviseMmapRange(handle.start(), handle.num_bytes(), MmapAdvice::WILLNEED);
+    PrefaultMmapRange(handle.start(), handle.num_bytes());
+  }
+  if (load_options.model_advice != MmapAdvice::NORMAL) {
+    AdviseMmapRange(handle.start(), handle.num_bytes(),
+                    load_options.model_advice);
+  }
+  const flatbuffers::Vector<uint8_t>* embeddings = model->embedding_model();
+  if (embeddings == nullptr) {
+    return;
+  }
+  if (load_options.embeddings_advice != load_options.model_advice) {
+    AdviseMmapRange(embeddings->data(), embeddings->size(),
+                    load_options.embeddings_advice);
+  }
+  if (load_options.lock_embeddings) {
+    LockMmapRange(embeddings->data(), embeddings->size());
+  }
+}
+
+// Runs the model and accounts the time to 'stage'.
+TensorView<float> ComputeLogitsForStage(ProfiledStage stage,
+                                        const ModelExecutor& executor,
+                                        const TensorView<float>& features,
+                                        tflite::Interpreter* interpreter) {
+  ScopedStageTimer timer(stage);
+  if (PhaseCounters* counters = TracedPhaseCounters()) {
+    ++counters->model_batches;
+  }
+  return executor.ComputeLogits(features, interpreter);
+}
+
+// Same as above, with the rows of the concurrent calls batched by 'batcher'.
+// The logits are stored in 'logits_buffer'.
+TensorView<float> ComputeBatchedLogitsForStage(
+    ProfiledStage stage, const InferenceBatcher& batcher,
+    const TensorView<float>& features, std::vector<float>* logits_buffer) {
+  ScopedStageTimer timer(stage);
+  const int num_rows = features.dim(0);
+  if (!batcher.ComputeLogits(features, logits_buffer) || num_rows == 0 ||
+      logits_buffer->size() % num_rows != 0) {
+    return TensorView<float>::Invalid();
+  }
+  return TensorView<float>(
+      logits_buffer->data(),
+      {num_rows, static_cast<int>(logits_buffer->size()) / num_rows});
+}
+
+// Same as ComputeLogitsForStage, for a batch of features that
+// ModelExecutor::PrepareFeaturesInput already put in the interpreter's input.
+TensorView<float> ComputeLogitsFromInputForStage(
+    ProfiledStage stage, const ModelExecutor& executor, int batch_size,
+    tflite::Interpreter* interpreter) {
+  ScopedStageTimer timer(stage);
+  if (PhaseCounters* counters = TracedPhaseCounters()) {
+    ++counters->model_batches;
+  }
+  return executor.ComputeLogitsFromInput(batch_size, interpreter);
+}
 }  // namespace
 
+InterpreterManager::~InterpreterManager() {
+  if (selection_pool_) {
+    selection_pool_->Release(std::move(selection_interpreter_));
+  }
+  if (classification_pool_) {
+    classification_pool_->Release(std::move(classification_interpreter_));
+  }
+}
+
 tflite::Interpreter* InterpreterManager::SelectionInterpreter() {
   if (!selection_interpreter_) {
-    TC_CHECK(selection_executor_);
-    selection_interpreter_ = selection_executor_->CreateInterpreter();
+    TC_CHECK(selection_pool_);
+    selection_interpreter_ = selection_pool_->Acquire();
     if (!selection_interpreter_) {
       TC_LOG(ERROR) << "Could not build TFLite interpreter.";
     }
@@ -62,8 +169,8 @@ tflite::Interpreter* InterpreterManager::SelectionInterpreter() {
 
 tflite::Interpreter* InterpreterManager::ClassificationInterpreter() {
   if (!classification_interpreter_) {
-    TC_CHECK(classification_executor_);
-    classification_interpreter_ = classification_executor_->CreateInterpreter();
+    TC_CHECK(classification_pool_);
+    classification_interpreter_ = classification_pool_->Acquire();
     if (!classification_interpreter_) {
       TC_LOG(ERROR) << "Could not build TFLite interpreter.";
     }
@@ -72,37 +179,47 @@ tflite::Interpreter* InterpreterManager::ClassificationInterpreter() {
 }
 
 std::unique_ptr<TextClassifier> TextClassifier::FromUnownedBuffer(
-    const char* buffer, int size, const UniLib* unilib) {
-  const Model* model = LoadAndVerifyModel(buffer, size);
+    const char* buffer, int size, const UniLib* unilib,
+    const LoadOptions& load_options) {
+  LoadOptions verified_load_options = load_options;
+  const Model* model =
+      LoadAndVerifyModel(buffer, size, &verified_load_options);
   if (model == nullptr) {
     return nullptr;
   }
 
-  auto classifier =
-      std::unique_ptr<TextClassifier>(new TextClassifier(model, unilib));
+  auto classifier = std::unique_ptr<TextClassifier>(
+      new TextClassifier(model, unilib, verified_load_options));
   if (!classifier->IsInitialized()) {
     return nullptr;
   }
+  classifier->unowned_buffer_ = buffer;
+  classifier->unowned_buffer_size_ = size;
 
   return classifier;
 }
 
 std::unique_ptr<TextClassifier> TextClassifier::FromScopedMmap(
-    std::unique_ptr<ScopedMmap>* mmap, const UniLib* unilib) {
+    std::unique_ptr<ScopedMmap>* mmap, const UniLib* unilib,
+    const LoadOptions& load_options) {
   if (!(*mmap)->handle().ok()) {
     TC_VLOG(1) << "Mmap failed.";
     return nullptr;
   }
 
-  const Model* model = LoadAndVerifyModel((*mmap)->handle().start(),
-                                          (*mmap)->handle().num_bytes());
+  LoadOptions verified_load_options = load_options;
+  const Model* model =
+      LoadAndVerifyModel((*mmap)->handle().start(),
+                         (*mmap)->handle().num_bytes(), &verified_load_options);
   if (!model) {
     TC_LOG(ERROR) << "Model verification failed.";
     return nullptr;
   }
 
-  auto classifier =
-      std::unique_ptr<TextClassifier>(new TextClassifier(mmap, model, unilib));
+  ApplyResidencyOptions((*mmap)->handle(), model, load_options);
+
+  auto classifier = std::unique_ptr<TextClassifier>(
+      new TextClassifier(mmap, model, unilib, verified_load_options));
   if (!classifier->IsInitialized()) {
     return nullptr;
   }
@@ -111,24 +228,26 @@ std::unique_ptr<TextClassifier> TextClassifier::FromScopedMmap(
 }
 
 std::unique_ptr<TextClassifier> TextClassifier::FromFileDescriptor(
-    int fd, int offset, int size, const UniLib* unilib) {
+    int fd, int offset, int size, const UniLib* unilib,
+    const LoadOptions& load_options) {
   std::unique_ptr<ScopedMmap> mmap(new ScopedMmap(fd, offset, size));
-  return FromScopedMmap(&mmap, unilib);
+  return FromScopedMmap(&mmap, unilib, load_options);
 }
 
 std::unique_ptr<TextClassifier> TextClassifier::FromFileDescriptor(
-    int fd, const UniLib* unilib) {
+    int fd, const UniLib* unilib, const LoadOptions& load_options) {
   std::unique_ptr<ScopedMmap> mmap(new ScopedMmap(fd));
-  return FromScopedMmap(&mmap, unilib);
+  return FromScopedMmap(&mmap, unilib, load_options);
 }
 
 std::unique_ptr<TextClassifier> TextClassifier::FromPath(
-    const std::string& path, const UniLib* unilib) {
+    const std::string& path, const UniLib* unilib,
+    const LoadOptions& load_options) {
   std::unique_ptr<ScopedMmap> mmap(new ScopedMmap(path));
-  return FromScopedMmap(&mmap, unilib);
+  return FromScopedMmap(&mmap, unilib, load_options);
 }
 
-void TextClassifier::ValidateAndInitialize() {
+void TextClassifier::ValidateAndInitialize(const LoadOptions& load_options) {
   initialized_ = false;
 
   if (model_ == nullptr) {
@@ -136,6 +255,18 @@ void TextClassifier::ValidateAndInitialize() {
     return;
   }
 
+  // The factories only keep the trusted fingerprint if it matched the model,
+  // which then covers the TFLite models in it as well.
+  const bool verify_nested_models = load_options.trusted_model_fingerprint == 0;
+
+  model_gate_ = load_options.model_gate;
+  if (load_options.classification_cache_size > 0) {
+    classification_cache_.reset(new LruCache<uint64, CachedClassification>(
+        load_options.classification_cache_size));
+    classification_cache_time_tolerance_ms_ =
+        load_options.classification_cache_time_tolerance_ms;
+  }
+
   const bool model_enabled_for_annotation =
       (model_->triggering_options() != nullptr &&
        (model_->triggering_options()->enabled_modes() & ModeFlag_ANNOTATION));
@@ -147,6 +278,29 @@ void TextClassifier::ValidateAndInitialize() {
       (model_->triggering_options() != nullptr &&
        (model_->triggering_options()->enabled_modes() & ModeFlag_SELECTION));
 
+  // The inference runs in batches of up to the selection batch size. Padding
+  // them to a few fixed sizes keeps the interpreters from re-planning their
+  // tensors for every batch.
+  std::vector<int> batch_size_buckets;
+  if (model_->selection_options() != nullptr) {
+    max_batch_size_ = std::max(1, model_->selection_options()->batch_size());
+    for (const int bucket : {1, 8, 32}) {
+      if (bucket < max_batch_size_) {
+        batch_size_buckets.push_back(bucket);
+      }
+    }
+    batch_size_buckets.push_back(max_batch_size_);
+  }
+
+  // Created before the feature processors, which use it. Both use the same
+  // embeddings, see the check of their sizes below.
+  if (load_options.shared_embedding_cache_bytes > 0 &&
+      model_->classification_feature_options() != nullptr) {
+    shared_embedding_cache_.reset(new SharedEmbeddingCache(
+        model_->classification_feature_options()->embedding_size(),
+        load_options.shared_embedding_cache_bytes));
+  }
+
   // Annotation requires the selection model.
   if (model_enabled_for_annotation || model_enabled_for_selection) {
     if (!model_->selection_options()) {
@@ -165,13 +319,22 @@ void TextClassifier::ValidateAndInitialize() {
       TC_LOG(ERROR) << "No selection model.";
       return;
     }
-    selection_executor_ = ModelExecutor::Instance(model_->selection_model());
+    selection_executor_ = ModelExecutor::Instance(
+        model_->selection_model(), verify_nested_models, batch_size_buckets,
+        load_options.executor_options);
     if (!selection_executor_) {
       TC_LOG(ERROR) << "Could not initialize selection executor.";
       return;
     }
-    selection_feature_processor_.reset(
+    selection_interpreter_pool_.reset(
+        new InterpreterPool(selection_executor_.get()));
+    std::unique_ptr<FeatureProcessor> selection_feature_processor(
         new FeatureProcessor(model_->selection_feature_options(), unilib_));
+    if (shared_embedding_cache_) {
+      selection_feature_processor->SetSharedEmbeddingCache(
+          shared_embedding_cache_.get(), /*salt=*/0);
+    }
+    selection_feature_processor_ = std::move(selection_feature_processor);
   }
 
   // Annotation requires the classification model for conflict resolution and
@@ -200,14 +363,57 @@ void TextClassifier::ValidateAndInitialize() {
     }
 
     classification_executor_ =
-        ModelExecutor::Instance(model_->classification_model());
+        ModelExecutor::Instance(model_->classification_model(),
+                                verify_nested_models, batch_size_buckets,
+                                load_options.executor_options);
     if (!classification_executor_) {
       TC_LOG(ERROR) << "Could not initialize classification executor.";
       return;
     }
-
-    classification_feature_processor_.reset(new FeatureProcessor(
-        model_->classification_feature_options(), unilib_));
+    classification_interpreter_pool_.reset(
+        new InterpreterPool(classification_executor_.get()));
+    if (load_options.classification_batching_wait_micros > 0) {
+      const ModelExecutor* executor = classification_executor_.get();
+      InterpreterPool* pool = classification_interpreter_pool_.get();
+      classification_batcher_.reset(new InferenceBatcher(
+          [executor, pool](const TensorView<float>& features,
+                           std::vector<float>* logits) {
+            std::unique_ptr<tflite::Interpreter> interpreter = pool->Acquire();
+            if (!interpreter) {
+              return false;
+            }
+            if (PhaseCounters* counters = TracedPhaseCounters()) {
+              ++counters->model_batches;
+            }
+            const TensorView<float> batch_logits =
+                executor->ComputeLogits(features, interpreter.get());
+            if (batch_logits.is_valid()) {
+              logits->assign(batch_logits.data(),
+                             batch_logits.data() + batch_logits.size());
+            }
+            pool->Release(std::move(interpreter));
+            return batch_logits.is_valid();
+          },
+          load_options.classification_batching_max_rows,
+          load_options.classification_batching_wait_micros));
+    }
+
+    // The two processors may extract different features from a token, in
+    // which case their embeddings get different keys in the shared cache.
+    std::unique_ptr<FeatureProcessor> classification_feature_processor(
+        new FeatureProcessor(model_->classification_feature_options(),
+                             unilib_));
+    shares_token_embeddings_ =
+        selection_feature_processor_ != nullptr &&
+        classification_feature_processor->HasSameTokenEmbeddingsAs(
+            *selection_feature_processor_);
+    if (shared_embedding_cache_) {
+      classification_feature_processor->SetSharedEmbeddingCache(
+          shared_embedding_cache_.get(),
+          /*salt=*/shares_token_embeddings_ ? 0 : 1);
+    }
+    classification_feature_processor_ =
+        std::move(classification_feature_processor);
   }
 
   // The embeddings need to be specified if the model is to be used for
@@ -235,73 +441,145 @@ void TextClassifier::ValidateAndInitialize() {
         model_->embedding_model(),
         model_->classification_feature_options()->embedding_size(),
         model_->classification_feature_options()
-            ->embedding_quantization_bits());
+            ->embedding_quantization_bits(),
+        load_options.dequantize_embeddings, verify_nested_models,
+        load_options.shared_dequantized_embeddings,
+        load_options.shared_dequantized_embeddings_size);
     if (!embedding_executor_) {
       TC_LOG(ERROR) << "Could not initialize embedding executor.";
       return;
     }
+    if (load_options.dequantize_embeddings) {
+      TC_LOG(INFO) << "Dequantized embeddings use "
+                   << embedding_executor_->ExtraMemoryBytes()
+                   << " bytes of extra memory.";
+    }
   }
 
+  regex_time_limit_millis_ = load_options.regex_time_limit_millis;
   std::unique_ptr<ZlibDecompressor> decompressor = ZlibDecompressor::Instance();
   if (model_->regex_model()) {
-    if (!InitializeRegexModel(decompressor.get())) {
+    if (!InitializeRegexModel(decompressor.get(), load_options)) {
       TC_LOG(ERROR) << "Could not initialize regex model.";
       return;
     }
   }
 
   if (model_->datetime_model()) {
-    datetime_parser_ = DatetimeParser::Instance(model_->datetime_model(),
-                                                *unilib_, decompressor.get());
-    if (!datetime_parser_) {
+    std::unique_ptr<DatetimeParser> datetime_parser = DatetimeParser::Instance(
+        model_->datetime_model(), *unilib_, decompressor.get(),
+        load_options.lazy_regex_compilation, load_options.task_runner,
+        load_options.share_regex_patterns ? SharedRegexPatterns::Instance()
+                                          : nullptr);
+    if (!datetime_parser) {
       TC_LOG(ERROR) << "Could not initialize datetime parser.";
       return;
     }
+    if (regex_time_limit_millis_ > 0) {
+      datetime_parser->SetRegexTimeLimit(regex_time_limit_millis_,
+                                         [this]() { RecordRegexTimeout(); });
+    }
+    datetime_parser_ = std::move(datetime_parser);
   }
 
-  if (model_->output_options()) {
-    if (model_->output_options()->filtered_collections_annotation()) {
-      for (const auto collection :
-           *model_->output_options()->filtered_collections_annotation()) {
-        filtered_collections_annotation_.insert(collection->str());
-      }
-    }
-    if (model_->output_options()->filtered_collections_classification()) {
-      for (const auto collection :
-           *model_->output_options()->filtered_collections_classification()) {
-        filtered_collections_classification_.insert(collection->str());
-      }
-    }
-    if (model_->output_options()->filtered_collections_selection()) {
-      for (const auto collection :
-           *model_->output_options()->filtered_collections_selection()) {
-        filtered_collections_selection_.insert(collection->str());
-      }
+  collections_.push_back(kOtherCollection);
+  if (classification_feature_processor_) {
+    for (int i = 0; i < classification_feature_processor_->NumCollections();
+         ++i) {
+      collections_.push_back(
+          classification_feature_processor_->LabelToCollection(i));
     }
   }
+  for (const CompiledRegexPattern& regex_pattern : regex_patterns_) {
+    collections_.push_back(regex_pattern.collection_name);
+  }
+  if (datetime_parser_) {
+    collections_.push_back(kDateCollection);
+  }
+  std::sort(collections_.begin(), collections_.end());
+  collections_.erase(std::unique(collections_.begin(), collections_.end()),
+                     collections_.end());
+
+  collection_filters_.assign(collections_.size(), 0);
+  if (model_->output_options()) {
+    AddCollectionFilter(
+        model_->output_options()->filtered_collections_annotation(),
+        FILTERED_FOR_ANNOTATION);
+    AddCollectionFilter(
+        model_->output_options()->filtered_collections_classification(),
+        FILTERED_FOR_CLASSIFICATION);
+    AddCollectionFilter(
+        model_->output_options()->filtered_collections_selection(),
+        FILTERED_FOR_SELECTION);
+  }
+
+  if (load_options.collect_metrics) {
+    metrics_.reset(new ClassifierMetrics(collections_));
+  }
+  if (load_options.adaptive_annotation_quality) {
+    quality_controller_.reset(new AnnotationQualityController());
+    annotation_latency_target_micros_ =
+        load_options.annotation_latency_target_micros;
+  }
 
   initialized_ = true;
 }
 
-bool TextClassifier::InitializeRegexModel(ZlibDecompressor* decompressor) {
+int TextClassifier::CollectionId(const std::string& collection) const {
+  const auto it =
+      std::lower_bound(collections_.begin(), collections_.end(), collection);
+  if (it == collections_.end() || *it != collection) {
+    return -1;
+  }
+  return it - collections_.begin();
+}
+
+bool TextClassifier::InitializeRegexModel(ZlibDecompressor* decompressor,
+                                          const LoadOptions& load_options) {
   if (!model_->regex_model()->patterns()) {
     return true;
   }
 
-  // Initialize pattern recognizers.
-  int regex_pattern_id = 0;
+  // Decompress the patterns. They share one decompression stream, so this
+  // needs to happen in order.
+  std::vector<std::string> pattern_texts;
   for (const auto& regex_pattern : *model_->regex_model()->patterns()) {
-    std::unique_ptr<UniLib::RegexPattern> compiled_pattern =
-        UncompressMakeRegexPattern(*unilib_, regex_pattern->pattern(),
-                                   regex_pattern->compressed_pattern(),
-                                   decompressor);
-    if (!compiled_pattern) {
+    pattern_texts.emplace_back();
+    if (!UncompressRegexPatternText(regex_pattern->pattern(),
+                                    regex_pattern->compressed_pattern(),
+                                    decompressor, &pattern_texts.back())) {
       TC_LOG(INFO) << "Failed to load regex pattern";
       return false;
     }
+  }
+
+  // Compile them, possibly in parallel.
+  std::vector<std::shared_ptr<const UniLib::RegexPattern>> compiled_patterns;
+  if (!MakeRegexPatterns(
+          *unilib_, pattern_texts, load_options.lazy_regex_compilation,
+          load_options.task_runner,
+          load_options.share_regex_patterns ? SharedRegexPatterns::Instance()
+                                            : nullptr,
+          &compiled_patterns)) {
+    TC_LOG(INFO) << "Failed to load regex pattern";
+    return false;
+  }
 
+  // Initialize pattern recognizers.
+  int regex_pattern_id = 0;
+  std::vector<std::string> annotation_pattern_texts;
+  std::vector<StringPiece> annotation_serialized_programs;
+  for (const auto& regex_pattern : *model_->regex_model()->patterns()) {
     if (regex_pattern->enabled_modes() & ModeFlag_ANNOTATION) {
       annotation_regex_patterns_.push_back(regex_pattern_id);
+      annotation_pattern_texts.push_back(
+          std::move(pattern_texts[regex_pattern_id]));
+      const auto* program = regex_pattern->multi_regex_program();
+      annotation_serialized_programs.push_back(
+          program == nullptr
+              ? StringPiece()
+              : StringPiece(reinterpret_cast<const char*>(program->data()),
+                            program->size()));
     }
     if (regex_pattern->enabled_modes() & ModeFlag_CLASSIFICATION) {
       classification_regex_patterns_.push_back(regex_pattern_id);
@@ -312,19 +590,29 @@ bool TextClassifier::InitializeRegexModel(ZlibDecompressor* decompressor) {
     regex_patterns_.push_back({regex_pattern->collection_name()->str(),
                                regex_pattern->target_classification_score(),
                                regex_pattern->priority_score(),
-                               std::move(compiled_pattern)});
+                               std::move(compiled_patterns[regex_pattern_id])});
     if (regex_pattern->use_approximate_matching()) {
       regex_approximate_match_pattern_ids_.insert(regex_pattern_id);
     }
     ++regex_pattern_id;
   }
 
+  if (load_options.multi_pattern_annotation_regex &&
+      !annotation_pattern_texts.empty()) {
+    annotation_multi_regex_ = MultiRegex::Create(
+        annotation_pattern_texts, annotation_serialized_programs);
+    TC_VLOG(1) << "Multi-pattern engine supports "
+               << annotation_multi_regex_->NumSupported() << " of "
+               << annotation_pattern_texts.size() << " annotation patterns, "
+               << annotation_multi_regex_->NumLoaded() << " precompiled.";
+  }
+
   return true;
 }
 
 namespace {
 
-int CountDigits(const std::string& str, CodepointSpan selection_indices) {
+int CountDigits(StringPiece str, CodepointSpan selection_indices) {
   int count = 0;
   int i = 0;
   const UnicodeText unicode_str = UTF8ToUnicodeText(str, /*do_copy=*/false);
@@ -337,7 +625,7 @@ int CountDigits(const std::string& str, CodepointSpan selection_indices) {
   return count;
 }
 
-std::string ExtractSelection(const std::string& context,
+std::string ExtractSelection(StringPiece context,
                              CodepointSpan selection_indices) {
   const UnicodeText context_unicode =
       UTF8ToUnicodeText(context, /*do_copy=*/false);
@@ -347,6 +635,26 @@ std::string ExtractSelection(const std::string& context,
   std::advance(selection_end, selection_indices.second);
   return UnicodeText::UTF8Substring(selection_begin, selection_end);
 }
+
+// Returns the annotators that run at the quality.
+int AnnotatorsForQuality(AnnotationQuality quality) {
+  switch (quality) {
+    case AnnotationQuality::NO_MODEL:
+      return ANNOTATOR_REGEX | ANNOTATOR_DATETIME;
+    case AnnotationQuality::REGEX_ONLY:
+      return ANNOTATOR_REGEX;
+    default:
+      return ANNOTATOR_ALL;
+  }
+}
+
+// Returns whether Annotate() is to return the collection with 'options'.
+bool WantsCollection(const AnnotationOptions& options,
+                     const std::string& collection) {
+  return options.collections.empty() ||
+         std::find(options.collections.begin(), options.collections.end(),
+                   collection) != options.collections.end();
+}
 }  // namespace
 
 namespace internal {
@@ -390,29 +698,72 @@ CodepointSpan SnapLeftIfWhitespaceSelection(CodepointSpan span,
 }
 }  // namespace internal
 
+void TextClassifier::AddCollectionFilter(
+    const flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>*
+        collections,
+    CollectionFilter filter) {
+  if (collections == nullptr) {
+    return;
+  }
+  for (const flatbuffers::String* collection : *collections) {
+    // The classifier never returns the other collections, so they need no
+    // filtering.
+    const int id = CollectionId(collection->str());
+    if (id >= 0) {
+      collection_filters_[id] |= filter;
+      used_collection_filters_ |= filter;
+    }
+  }
+}
+
+bool TextClassifier::IsFilteredCollection(const std::string& collection,
+                                          CollectionFilter filter) const {
+  if ((used_collection_filters_ & filter) == 0) {
+    return false;
+  }
+  const int id = CollectionId(collection);
+  return id >= 0 && (collection_filters_[id] & filter) != 0;
+}
+
 bool TextClassifier::FilteredForAnnotation(const AnnotatedSpan& span) const {
   return !span.classification.empty() &&
-         filtered_collections_annotation_.find(
-             span.classification[0].collection) !=
-             filtered_collections_annotation_.end();
+         IsFilteredCollection(span.classification[0].collection,
+                              FILTERED_FOR_ANNOTATION);
 }
 
 bool TextClassifier::FilteredForClassification(
     const ClassificationResult& classification) const {
-  return filtered_collections_classification_.find(classification.collection) !=
-         filtered_collections_classification_.end();
+  return IsFilteredCollection(classification.collection,
+                              FILTERED_FOR_CLASSIFICATION);
 }
 
 bool TextClassifier::FilteredForSelection(const AnnotatedSpan& span) const {
   return !span.classification.empty() &&
-         filtered_collections_selection_.find(
-             span.classification[0].collection) !=
-             filtered_collections_selection_.end();
+         IsFilteredCollection(span.classification[0].collection,
+                              FILTERED_FOR_SELECTION);
 }
 
 CodepointSpan TextClassifier::SuggestSelection(
-    const std::string& context, CodepointSpan click_indices,
+    StringPiece context, CodepointSpan click_indices,
     const SelectionOptions& options) const {
+  InterpreterManager interpreter_manager(
+      selection_interpreter_pool_.get(),
+      classification_interpreter_pool_.get());
+  ScopedRequestMetrics request_metrics(
+      metrics_.get(), MetricsMode::SUGGEST_SELECTION, context.size());
+  ScopedRequestArena request_arena;
+  FeatureProcessor::EmbeddingCache embedding_cache;
+  std::vector<Token> tokens;
+  return SuggestSelectionInternal(context, click_indices, options,
+                                  &interpreter_manager, &embedding_cache,
+                                  /*selection_cache=*/nullptr, &tokens);
+}
+
+CodepointSpan TextClassifier::SuggestSelectionInternal(
+    StringPiece context, CodepointSpan click_indices,
+    const SelectionOptions& options, InterpreterManager* interpreter_manager,
+    FeatureProcessor::EmbeddingCache* embedding_cache,
+    SelectionCache* selection_cache, std::vector<Token>* tokens) const {
   CodepointSpan original_click_indices = click_indices;
   if (!initialized_) {
     TC_LOG(ERROR) << "Not initialized";
@@ -425,12 +776,13 @@ CodepointSpan TextClassifier::SuggestSelection(
   const UnicodeText context_unicode = UTF8ToUnicodeText(context,
                                                         /*do_copy=*/false);
 
-  if (!context_unicode.is_valid()) {
+  int context_codepoint_size = 0;
+  if (!ValidateAndCountUTF8(context.data(), context.size(),
+                            &context_codepoint_size,
+                            /*num_supplementary_codepoints=*/nullptr)) {
     return original_click_indices;
   }
 
-  const int context_codepoint_size = context_unicode.size_codepoints();
-
   if (click_indices.first < 0 || click_indices.second < 0 ||
       click_indices.first >= context_codepoint_size ||
       click_indices.second > context_codepoint_size ||
@@ -458,38 +810,64 @@ CodepointSpan TextClassifier::SuggestSelection(
   }
 
   std::vector<AnnotatedSpan> candidates;
-  InterpreterManager interpreter_manager(selection_executor_.get(),
-                                         classification_executor_.get());
-  std::vector<Token> tokens;
-  if (!ModelSuggestSelection(context_unicode, click_indices,
-                             &interpreter_manager, &tokens, &candidates)) {
-    TC_LOG(ERROR) << "Model suggest selection failed.";
-    return original_click_indices;
-  }
-  if (!RegexChunk(context_unicode, selection_regex_patterns_, &candidates)) {
-    TC_LOG(ERROR) << "Regex suggest selection failed.";
-    return original_click_indices;
-  }
-  if (!DatetimeChunk(UTF8ToUnicodeText(context, /*do_copy=*/false),
-                     /*reference_time_ms_utc=*/0, /*reference_timezone=*/"",
-                     options.locales, ModeFlag_SELECTION, &candidates)) {
-    TC_LOG(ERROR) << "Datetime suggest selection failed.";
-    return original_click_indices;
-  }
-
-  // Sort candidates according to their position in the input, so that the next
-  // code can assume that any connected component of overlapping spans forms a
-  // contiguous block.
-  std::sort(candidates.begin(), candidates.end(),
-            [](const AnnotatedSpan& a, const AnnotatedSpan& b) {
-              return a.span.first < b.span.first;
-            });
-
+  {
+    ScopedPhaseTrace trace(options.tracer,
+                           TracedPhase::MODEL_SUGGEST_SELECTION);
+    if (!ModelSuggestSelection(context_unicode, click_indices,
+                               interpreter_manager, selection_cache, tokens,
+                               &candidates)) {
+      TC_LOG(ERROR) << "Model suggest selection failed.";
+      return original_click_indices;
+    }
+    trace.SetResults(candidates.size());
+  }
+  // The regex and datetime models share the input converted for the regex
+  // matchers.
+  const std::unique_ptr<UniLib::RegexInput> context_regex_input =
+      unilib_->CreateRegexInput(context_unicode);
+  {
+    ScopedPhaseTrace trace(options.tracer, TracedPhase::REGEX);
+    const int num_candidates = candidates.size();
+    if (!RegexChunk(*context_regex_input, selection_regex_patterns_,
+                    /*deadline=*/nullptr, &candidates)) {
+      TC_LOG(ERROR) << "Regex suggest selection failed.";
+      return original_click_indices;
+    }
+    trace.SetResults(candidates.size() - num_candidates);
+  }
+  {
+    ScopedPhaseTrace trace(options.tracer, TracedPhase::DATETIME);
+    const int num_candidates = candidates.size();
+    if (!DatetimeChunk(*context_regex_input,
+                       /*reference_time_ms_utc=*/0, /*reference_timezone=*/"",
+                       options.locales, ModeFlag_SELECTION, &candidates)) {
+      TC_LOG(ERROR) << "Datetime suggest selection failed.";
+      return original_click_indices;
+    }
+    trace.SetResults(candidates.size() - num_candidates);
+  }
+
+
+  // The conflict resolution and the classification below run on the same
+  // context, so they share the token embeddings.
   std::vector<int> candidate_indices;
-  if (!ResolveConflicts(candidates, context, tokens, &interpreter_manager,
-                        &candidate_indices)) {
-    TC_LOG(ERROR) << "Couldn't resolve conflicts.";
-    return original_click_indices;
+  {
+    ScopedPhaseTrace trace(options.tracer, TracedPhase::RESOLVE_CONFLICTS);
+    // Sort candidates according to their position in the input, so that the
+    // next code can assume that any connected component of overlapping spans
+    // forms a contiguous block.
+    int num_avoided_classifications = 0;
+    internal::SortAndMergeDuplicateCandidates(&candidates,
+                                              &num_avoided_classifications);
+    if (PhaseCounters* counters = TracedPhaseCounters()) {
+      counters->avoided_classifications += num_avoided_classifications;
+    }
+    if (!ResolveConflicts(candidates, context, *tokens, interpreter_manager,
+                          embedding_cache, &candidate_indices)) {
+      TC_LOG(ERROR) << "Couldn't resolve conflicts.";
+      return original_click_indices;
+    }
+    trace.SetResults(candidate_indices.size());
   }
 
   for (const int i : candidate_indices) {
@@ -499,10 +877,10 @@ CodepointSpan TextClassifier::SuggestSelection(
       // classification collection filter specified.
       if (candidates[i].classification.empty() &&
           model_->selection_options()->always_classify_suggested_selection() &&
-          !filtered_collections_selection_.empty()) {
+          (used_collection_filters_ & FILTERED_FOR_SELECTION) != 0) {
         if (!ModelClassifyText(
-                context, candidates[i].span, &interpreter_manager,
-                /*embedding_cache=*/nullptr, &candidates[i].classification)) {
+                context, candidates[i].span, interpreter_manager,
+                embedding_cache, &candidates[i].classification)) {
           return original_click_indices;
         }
       }
@@ -542,25 +920,35 @@ int FirstNonOverlappingSpanIndex(const std::vector<AnnotatedSpan>& candidates,
 }  // namespace
 
 bool TextClassifier::ResolveConflicts(
-    const std::vector<AnnotatedSpan>& candidates, const std::string& context,
+    const std::vector<AnnotatedSpan>& candidates, StringPiece context,
     const std::vector<Token>& cached_tokens,
-    InterpreterManager* interpreter_manager, std::vector<int>* result) const {
+    InterpreterManager* interpreter_manager,
+    FeatureProcessor::EmbeddingCache* embedding_cache,
+    std::vector<int>* result) const {
   result->clear();
   result->reserve(candidates.size());
+  std::vector<int> candidate_indices;
   for (int i = 0; i < candidates.size();) {
     int first_non_overlapping =
         FirstNonOverlappingSpanIndex(candidates, /*start_index=*/i);
 
     const bool conflict_found = first_non_overlapping != (i + 1);
     if (conflict_found) {
-      std::vector<int> candidate_indices;
+      if (PhaseCounters* counters = TracedPhaseCounters()) {
+        ++counters->conflicts;
+      }
       if (!ResolveConflict(context, cached_tokens, candidates, i,
                            first_non_overlapping, interpreter_manager,
-                           &candidate_indices)) {
+                           embedding_cache, &candidate_indices)) {
         return false;
       }
       result->insert(result->end(), candidate_indices.begin(),
                      candidate_indices.end());
+      if (metrics_ != nullptr) {
+        for (const int chosen : candidate_indices) {
+          metrics_->RecordConflictWin(candidates[chosen].source);
+        }
+      }
     } else {
       result->push_back(i);
     }
@@ -586,19 +974,109 @@ float GetPriorityScore(
     return -1.0;
   }
 }
+
+// The highest priority score of a classification by the model, whose scores
+// are probabilities.
+const float kMaxModelPriorityScore = 1.0f;
 }  // namespace
 
+namespace internal {
+
+void SortAndMergeDuplicateCandidates(std::vector<AnnotatedSpan>* candidates,
+                                     int* num_avoided_classifications) {
+  std::sort(candidates->begin(), candidates->end(),
+            [](const AnnotatedSpan& a, const AnnotatedSpan& b) {
+              return a.span < b.span;
+            });
+
+  // Moves the kept candidates to the front, in order.
+  int num_kept = 0;
+  const auto keep = [candidates, &num_kept](int index) {
+    if (index != num_kept) {
+      (*candidates)[num_kept] = std::move((*candidates)[index]);
+    }
+    ++num_kept;
+  };
+  for (int begin = 0; begin < candidates->size();) {
+    const CodepointSpan span = (*candidates)[begin].span;
+    int end = begin + 1;
+    while (end < candidates->size() && (*candidates)[end].span == span) {
+      ++end;
+    }
+
+    // Empty spans don't conflict, so they are all kept.
+    if (span.first == span.second) {
+      for (int i = begin; i < end; ++i) {
+        keep(i);
+      }
+      begin = end;
+      continue;
+    }
+
+    // The conflict resolution chooses at most one candidate of a span, the
+    // one with the highest priority, so the others can be dropped. The
+    // unclassified model candidates all get the same classification, and
+    // need it only if it could win over the classified ones.
+    int best_classified = -1;
+    float best_priority_score = 0.f;
+    int num_unclassified = 0;
+    AnnotatedSpan::Source unclassified_source = AnnotatedSpan::Source::OTHER;
+    for (int i = begin; i < end; ++i) {
+      const AnnotatedSpan& candidate = (*candidates)[i];
+      if (candidate.classification.empty()) {
+        if (num_unclassified++ == 0) {
+          unclassified_source = candidate.source;
+        }
+        continue;
+      }
+      const float priority_score = GetPriorityScore(candidate.classification);
+      if (best_classified < 0 || priority_score > best_priority_score) {
+        best_classified = i;
+        best_priority_score = priority_score;
+      }
+    }
+    if (best_classified >= 0) {
+      keep(best_classified);
+    }
+    if (num_unclassified > 0) {
+      if (best_classified >= 0 &&
+          best_priority_score >= kMaxModelPriorityScore) {
+        *num_avoided_classifications += num_unclassified;
+      } else {
+        AnnotatedSpan* unclassified = &(*candidates)[num_kept++];
+        unclassified->span = span;
+        unclassified->classification.clear();
+        unclassified->source = unclassified_source;
+        *num_avoided_classifications += num_unclassified - 1;
+      }
+    }
+    begin = end;
+  }
+  candidates->erase(candidates->begin() + num_kept, candidates->end());
+}
+
+}  // namespace internal
+
 bool TextClassifier::ResolveConflict(
-    const std::string& context, const std::vector<Token>& cached_tokens,
+    StringPiece context, const std::vector<Token>& cached_tokens,
     const std::vector<AnnotatedSpan>& candidates, int start_index,
     int end_index, InterpreterManager* interpreter_manager,
+    FeatureProcessor::EmbeddingCache* embedding_cache,
     std::vector<int>* chosen_indices) const {
-  std::vector<int> conflicting_indices;
-  std::unordered_map<int, float> scores;
+  // The scratch space comes from the arena of the request, as conflicts are
+  // resolved many times per call.
+  Arena* const arena = CurrentRequestArena();
+  const int num_conflicting = end_index - start_index;
+  ArenaVector<int> conflicting_indices{ArenaAllocator<int>(arena)};
+  conflicting_indices.reserve(num_conflicting);
+
+  // The priority scores by the index relative to 'start_index', zero for the
+  // candidates without a classification.
+  ArenaVector<float> scores(num_conflicting, 0.f, ArenaAllocator<float>(arena));
   for (int i = start_index; i < end_index; ++i) {
     conflicting_indices.push_back(i);
     if (!candidates[i].classification.empty()) {
-      scores[i] = GetPriorityScore(candidates[i].classification);
+      scores[i - start_index] = GetPriorityScore(candidates[i].classification);
       continue;
     }
 
@@ -609,53 +1087,101 @@ bool TextClassifier::ResolveConflict(
     // classification to determine its priority:
     std::vector<ClassificationResult> classification;
     if (!ModelClassifyText(context, cached_tokens, candidates[i].span,
-                           interpreter_manager,
-                           /*embedding_cache=*/nullptr, &classification)) {
+                           interpreter_manager, embedding_cache,
+                           &classification)) {
       return false;
     }
 
     if (!classification.empty()) {
-      scores[i] = GetPriorityScore(classification);
+      scores[i - start_index] = GetPriorityScore(classification);
     }
   }
 
   std::sort(conflicting_indices.begin(), conflicting_indices.end(),
-            [&scores](int i, int j) { return scores[i] > scores[j]; });
+            [&scores, start_index](int i, int j) {
+              return scores[i - start_index] > scores[j - start_index];
+            });
 
-  // Keeps the candidates sorted by their position in the text (their left span
-  // index) for fast retrieval down.
-  std::set<int, std::function<bool(int, int)>> chosen_indices_set(
-      [&candidates](int a, int b) {
-        return candidates[a].span.first < candidates[b].span.first;
-      });
+  NonOverlappingSpans<ArenaAllocator<CodepointIndex>> chosen_spans{
+      ArenaAllocator<CodepointIndex>(arena)};
+  chosen_spans.Reset(candidates.begin() + start_index,
+                     candidates.begin() + end_index);
 
   // Greedily place the candidates if they don't conflict with the already
   // placed ones.
+  ArenaVector<char> chosen(num_conflicting, 0, ArenaAllocator<char>(arena));
   for (int i = 0; i < conflicting_indices.size(); ++i) {
     const int considered_candidate = conflicting_indices[i];
-    if (!DoesCandidateConflict(considered_candidate, candidates,
-                               chosen_indices_set)) {
-      chosen_indices_set.insert(considered_candidate);
+    const CodepointSpan& span = candidates[considered_candidate].span;
+    if (!chosen_spans.Overlaps(span) && chosen_spans.Add(span)) {
+      chosen[considered_candidate - start_index] = 1;
     }
   }
 
-  *chosen_indices =
-      std::vector<int>(chosen_indices_set.begin(), chosen_indices_set.end());
+  // The candidates are sorted by their position in the text, and no two
+  // chosen ones start at the same position.
+  chosen_indices->clear();
+  for (int i = 0; i < num_conflicting; ++i) {
+    if (chosen[i]) {
+      chosen_indices->push_back(start_index + i);
+    }
+  }
 
   return true;
 }
 
 bool TextClassifier::ModelSuggestSelection(
     const UnicodeText& context_unicode, CodepointSpan click_indices,
-    InterpreterManager* interpreter_manager, std::vector<Token>* tokens,
-    std::vector<AnnotatedSpan>* result) const {
+    InterpreterManager* interpreter_manager, SelectionCache* selection_cache,
+    std::vector<Token>* tokens, std::vector<AnnotatedSpan>* result) const {
   if (model_->triggering_options() == nullptr ||
       !(model_->triggering_options()->enabled_modes() & ModeFlag_SELECTION)) {
     return true;
   }
 
+  const int symmetry_context_size =
+      model_->selection_options()->symmetry_context_size();
+  const FeatureProcessorOptions_::BoundsSensitiveFeatures*
+      bounds_sensitive_features = selection_feature_processor_->GetOptions()
+                                      ->bounds_sensitive_features();
+
+  // Tokenizes only the part of the context that the extraction span below can
+  // reach, plus the tokens the classification of the suggested spans needs, as
+  // the tokens are reused for it.
+  int num_tokens_around = symmetry_context_size;
+  if (bounds_sensitive_features && bounds_sensitive_features->enabled()) {
+    num_tokens_around +=
+        selection_feature_processor_->GetOptions()->max_selection_span() +
+        std::max(bounds_sensitive_features->num_tokens_before(),
+                 bounds_sensitive_features->num_tokens_after());
+  } else {
+    num_tokens_around +=
+        selection_feature_processor_->GetOptions()->context_size();
+  }
+  const TokenSpan num_classification_tokens =
+      ClassifyTextUpperBoundNeededTokens();
+
   int click_pos;
-  *tokens = selection_feature_processor_->Tokenize(context_unicode);
+  if (selection_cache == nullptr) {
+    *tokens = selection_feature_processor_->TokenizeAroundSpan(
+        UnicodeTextIndex(context_unicode), click_indices,
+        {num_tokens_around + num_classification_tokens.first,
+         num_tokens_around + num_classification_tokens.second});
+    if (PhaseCounters* counters = TracedPhaseCounters()) {
+      counters->tokens += tokens->size();
+    }
+  } else {
+    // The tokens around the click are the ones that the whole context has
+    // there, so the later clicks copy them.
+    if (selection_cache->tokens.empty()) {
+      selection_cache->tokens =
+          selection_feature_processor_->Tokenize(context_unicode);
+      if (PhaseCounters* counters = TracedPhaseCounters()) {
+        counters->tokens += selection_cache->tokens.size();
+      }
+    }
+    *tokens = selection_cache->tokens;
+  }
   selection_feature_processor_->RetokenizeAndFindClick(
       context_unicode, click_indices,
       selection_feature_processor_->GetOptions()->only_use_line_with_click(),
@@ -665,12 +1191,6 @@ bool TextClassifier::ModelSuggestSelection(
     return false;
   }
 
-  const int symmetry_context_size =
-      model_->selection_options()->symmetry_context_size();
-  const FeatureProcessorOptions_::BoundsSensitiveFeatures*
-      bounds_sensitive_features = selection_feature_processor_->GetOptions()
-                                      ->bounds_sensitive_features();
-
   // The symmetry context span is the clicked token with symmetry_context_size
   // tokens on either side.
   const TokenSpan symmetry_context_span = IntersectTokenSpans(
@@ -715,7 +1235,9 @@ bool TextClassifier::ModelSuggestSelection(
           *tokens, extraction_span,
           /*selection_span_for_feature=*/{kInvalidIndex, kInvalidIndex},
           embedding_executor_.get(),
-          /*embedding_cache=*/nullptr,
+          selection_cache != nullptr
+              ? &selection_cache->selection_embedding_cache
+              : nullptr,
           selection_feature_processor_->EmbeddingSize() +
               selection_feature_processor_->DenseFeaturesCount(),
           &cached_features)) {
@@ -725,20 +1247,31 @@ bool TextClassifier::ModelSuggestSelection(
 
   // Produce selection model candidates.
   std::vector<TokenSpan> chunks;
-  if (!ModelChunk(tokens->size(), /*span_of_interest=*/symmetry_context_span,
-                  interpreter_manager->SelectionInterpreter(), *cached_features,
-                  &chunks)) {
+  if (selection_cache != nullptr) {
+    if (!ModelChunkWithSelectionCache(
+            *tokens, /*span_of_interest=*/symmetry_context_span,
+            interpreter_manager->SelectionInterpreter(), *cached_features,
+            selection_cache, &chunks)) {
+      TC_LOG(ERROR) << "Could not chunk.";
+      return false;
+    }
+  } else if (!ModelChunk(tokens->size(),
+                         /*span_of_interest=*/symmetry_context_span,
+                         interpreter_manager->SelectionInterpreter(),
+                         *cached_features, &chunks)) {
     TC_LOG(ERROR) << "Could not chunk.";
     return false;
   }
 
+  const UnicodeTextIndex context_index(context_unicode);
   for (const TokenSpan& chunk : chunks) {
     AnnotatedSpan candidate;
+    candidate.source = AnnotatedSpan::Source::MODEL;
     candidate.span = selection_feature_processor_->StripBoundaryCodepoints(
-        context_unicode, TokenSpanToCodepointSpan(*tokens, chunk));
+        context_index, TokenSpanToCodepointSpan(*tokens, chunk));
     if (model_->selection_options()->strip_unpaired_brackets()) {
       candidate.span =
-          StripUnpairedBrackets(context_unicode, candidate.span, *unilib_);
+          StripUnpairedBrackets(context_index, candidate.span, *unilib_);
     }
 
     // Only output non-empty spans.
@@ -750,7 +1283,7 @@ bool TextClassifier::ModelSuggestSelection(
 }
 
 bool TextClassifier::ModelClassifyText(
-    const std::string& context, CodepointSpan selection_indices,
+    StringPiece context, CodepointSpan selection_indices,
     InterpreterManager* interpreter_manager,
     FeatureProcessor::EmbeddingCache* embedding_cache,
     std::vector<ClassificationResult>* classification_results) const {
@@ -764,9 +1297,11 @@ bool TextClassifier::ModelClassifyText(
 }
 
 namespace internal {
-std::vector<Token> CopyCachedTokens(const std::vector<Token>& cached_tokens,
-                                    CodepointSpan selection_indices,
-                                    TokenSpan tokens_around_selection_to_copy) {
+namespace {
+// Finds the first token that ends after the start of the selection, and the
+// first token that starts at or after its end.
+std::pair<int, int> FindSelectionTokens(const std::vector<Token>& cached_tokens,
+                                        CodepointSpan selection_indices) {
   const auto first_selection_token = std::upper_bound(
       cached_tokens.begin(), cached_tokens.end(), selection_indices.first,
       [](int selection_start, const Token& token) {
@@ -777,22 +1312,45 @@ std::vector<Token> CopyCachedTokens(const std::vector<Token>& cached_tokens,
       [](const Token& token, int selection_end) {
         return token.start < selection_end;
       });
+  return {first_selection_token - cached_tokens.begin(),
+          last_selection_token - cached_tokens.begin()};
+}
+}  // namespace
 
-  const int64 first_token = std::max(
-      static_cast<int64>(0),
-      static_cast<int64>((first_selection_token - cached_tokens.begin()) -
-                         tokens_around_selection_to_copy.first));
-  const int64 last_token = std::min(
-      static_cast<int64>(cached_tokens.size()),
-      static_cast<int64>((last_selection_token - cached_tokens.begin()) +
-                         tokens_around_selection_to_copy.second));
+TokenSpan CachedTokensAroundSelection(const std::vector<Token>& cached_tokens,
+                                      CodepointSpan selection_indices,
+                                      TokenSpan tokens_around_selection) {
+  const std::pair<int, int> selection_tokens =
+      FindSelectionTokens(cached_tokens, selection_indices);
+
+  const int64 first_token =
+      std::max(static_cast<int64>(0),
+               static_cast<int64>(selection_tokens.first) -
+                   tokens_around_selection.first);
+  const int64 last_token =
+      std::min(static_cast<int64>(cached_tokens.size()),
+               static_cast<int64>(selection_tokens.second) +
+                   tokens_around_selection.second);
+  return {static_cast<int>(first_token), static_cast<int>(last_token)};
+}
 
-  std::vector<Token> tokens;
-  tokens.reserve(last_token - first_token);
-  for (int i = first_token; i < last_token; ++i) {
-    tokens.push_back(cached_tokens[i]);
-  }
-  return tokens;
+std::vector<Token> CopyCachedTokens(const std::vector<Token>& cached_tokens,
+                                    CodepointSpan selection_indices,
+                                    TokenSpan tokens_around_selection_to_copy) {
+  const TokenSpan window = CachedTokensAroundSelection(
+      cached_tokens, selection_indices, tokens_around_selection_to_copy);
+  return std::vector<Token>(cached_tokens.begin() + window.first,
+                            cached_tokens.begin() + window.second);
+}
+
+bool HasCachedTokensAroundSelection(const std::vector<Token>& cached_tokens,
+                                    CodepointSpan selection_indices,
+                                    TokenSpan num_tokens_around) {
+  const std::pair<int, int> selection_tokens =
+      FindSelectionTokens(cached_tokens, selection_indices);
+  return selection_tokens.first >= num_tokens_around.first &&
+         cached_tokens.size() - selection_tokens.second >=
+             num_tokens_around.second;
 }
 }  // namespace internal
 
@@ -808,38 +1366,148 @@ TokenSpan TextClassifier::ClassifyTextUpperBoundNeededTokens() const {
             bounds_sensitive_features->num_tokens_after()};
   } else {
     // The extraction span is the clicked token with context_size tokens on
-    // either side.
-    const int context_size =
-        selection_feature_processor_->GetOptions()->context_size();
+    // either side. The click can be the first or the last token of the
+    // selection, and the cached tokens may come from the selection model, if
+    // there is one.
+    int context_size =
+        classification_feature_processor_->GetOptions()->context_size();
+    if (selection_feature_processor_ != nullptr) {
+      context_size = std::max(
+          context_size,
+          selection_feature_processor_->GetOptions()->context_size());
+    }
     return {context_size, context_size};
   }
 }
 
 bool TextClassifier::ModelClassifyText(
-    const std::string& context, const std::vector<Token>& cached_tokens,
+    StringPiece context, const std::vector<Token>& cached_tokens,
     CodepointSpan selection_indices, InterpreterManager* interpreter_manager,
     FeatureProcessor::EmbeddingCache* embedding_cache,
     std::vector<ClassificationResult>* classification_results) const {
-  std::vector<Token> tokens;
-  if (cached_tokens.empty()) {
-    tokens = classification_feature_processor_->Tokenize(context);
-  } else {
-    tokens = internal::CopyCachedTokens(cached_tokens, selection_indices,
-                                        ClassifyTextUpperBoundNeededTokens());
+  std::vector<std::vector<ClassificationResult>> batch_results;
+  if (!ModelClassifyTexts(context, cached_tokens, {selection_indices},
+                          interpreter_manager, embedding_cache,
+                          &batch_results)) {
+    return false;
+  }
+  *classification_results = std::move(batch_results[0]);
+  return true;
+}
+
+bool TextClassifier::ModelClassifyTexts(
+    StringPiece context, const std::vector<Token>& cached_tokens,
+    const std::vector<CodepointSpan>& selections,
+    InterpreterManager* interpreter_manager,
+    FeatureProcessor::EmbeddingCache* embedding_cache,
+    std::vector<std::vector<ClassificationResult>>* classification_results)
+    const {
+  classification_results->clear();
+  classification_results->resize(selections.size());
+
+  // Selections that need to go through the classification model, and the
+  // number of tokens of each.
+  std::vector<int> pending_selections;
+  std::vector<int> selection_num_tokens(selections.size());
+  std::vector<float> all_features;
+  std::vector<float> features;
+  int features_size = -1;
+  for (int i = 0; i < selections.size(); ++i) {
+    if (!ModelClassifyTextFeatures(context, cached_tokens, selections[i],
+                                   embedding_cache, &features,
+                                   &selection_num_tokens[i],
+                                   &(*classification_results)[i])) {
+      return false;
+    }
+    if (features.empty()) {
+      // Decided without the model.
+      continue;
+    }
+    if (features_size == -1) {
+      features_size = features.size();
+      all_features.reserve(std::min(static_cast<int>(selections.size()),
+                                    max_batch_size_) *
+                           features_size);
+    } else if (features_size != features.size()) {
+      TC_LOG(ERROR) << "Mismatching feature sizes.";
+      return false;
+    }
+    pending_selections.push_back(i);
+    all_features.insert(all_features.end(), features.begin(), features.end());
+
+    if (pending_selections.size() == max_batch_size_) {
+      if (!ModelClassifyTextBatch(context, selections, selection_num_tokens,
+                                  pending_selections, all_features,
+                                  interpreter_manager,
+                                  classification_results)) {
+        return false;
+      }
+      pending_selections.clear();
+      all_features.clear();
+    }
   }
+  if (!pending_selections.empty()) {
+    return ModelClassifyTextBatch(context, selections, selection_num_tokens,
+                                  pending_selections, all_features,
+                                  interpreter_manager, classification_results);
+  }
+  return true;
+}
+
+bool TextClassifier::ModelClassifyTextFeatures(
+    StringPiece context, const std::vector<Token>& cached_tokens,
+    CodepointSpan selection_indices,
+    FeatureProcessor::EmbeddingCache* embedding_cache,
+    std::vector<float>* features, int* selection_num_tokens,
+    std::vector<ClassificationResult>* classification_results) const {
+  features->clear();
 
+  // The features read a window of the cached tokens in place, unless the
+  // retokenization changes them, in which case they read a retokenized copy.
+  std::vector<Token> copied_tokens;
+  VectorSpan<Token> tokens;
+  bool retokenize = true;
   int click_pos;
-  classification_feature_processor_->RetokenizeAndFindClick(
-      context, selection_indices,
+  const bool only_use_line_with_click =
       classification_feature_processor_->GetOptions()
-          ->only_use_line_with_click(),
-      &tokens, &click_pos);
+          ->only_use_line_with_click();
+  if (cached_tokens.empty()) {
+    // Tokenizes only the part of the context that the extraction span below
+    // can reach, which matters for long contexts.
+    const UnicodeText context_unicode =
+        UTF8ToUnicodeText(context, /*do_copy=*/false);
+    copied_tokens = classification_feature_processor_->TokenizeAroundSpan(
+        UnicodeTextIndex(context_unicode), selection_indices,
+        ClassifyTextUpperBoundNeededTokens());
+    if (PhaseCounters* counters = TracedPhaseCounters()) {
+      counters->tokens += copied_tokens.size();
+    }
+  } else {
+    const TokenSpan window = internal::CachedTokensAroundSelection(
+        cached_tokens, selection_indices, ClassifyTextUpperBoundNeededTokens());
+    tokens = VectorSpan<Token>(cached_tokens.begin() + window.first,
+                               cached_tokens.begin() + window.second);
+    retokenize = !classification_feature_processor_->RetokenizationKeepsTokens(
+        tokens, selection_indices, only_use_line_with_click);
+    if (retokenize) {
+      copied_tokens.assign(tokens.begin(), tokens.end());
+    }
+  }
+  if (retokenize) {
+    classification_feature_processor_->RetokenizeAndFindClick(
+        UTF8ToUnicodeText(context, /*do_copy=*/false), selection_indices,
+        only_use_line_with_click, &copied_tokens, &click_pos);
+    tokens = copied_tokens;
+  } else {
+    click_pos =
+        classification_feature_processor_->FindClick(selection_indices, tokens);
+  }
   const TokenSpan selection_token_span =
       CodepointSpanToTokenSpan(tokens, selection_indices);
-  const int selection_num_tokens = TokenSpanSize(selection_token_span);
+  *selection_num_tokens = TokenSpanSize(selection_token_span);
   if (model_->classification_options()->max_num_tokens() > 0 &&
       model_->classification_options()->max_num_tokens() <
-          selection_num_tokens) {
+          *selection_num_tokens) {
     *classification_results = {{kOtherCollection, 1.0}};
     return true;
   }
@@ -895,61 +1563,87 @@ bool TextClassifier::ModelClassifyText(
     return false;
   }
 
-  std::vector<float> features;
-  features.reserve(cached_features->OutputFeaturesSize());
+  features->reserve(cached_features->OutputFeaturesSize());
   if (bounds_sensitive_features && bounds_sensitive_features->enabled()) {
     cached_features->AppendBoundsSensitiveFeaturesForSpan(selection_token_span,
-                                                          &features);
+                                                          features);
   } else {
-    cached_features->AppendClickContextFeaturesForClick(click_pos, &features);
+    cached_features->AppendClickContextFeaturesForClick(click_pos, features);
   }
+  return true;
+}
 
-  TensorView<float> logits = classification_executor_->ComputeLogits(
-      TensorView<float>(features.data(),
-                        {1, static_cast<int>(features.size())}),
-      interpreter_manager->ClassificationInterpreter());
+bool TextClassifier::ModelClassifyTextBatch(
+    StringPiece context, const std::vector<CodepointSpan>& selections,
+    const std::vector<int>& selection_num_tokens,
+    const std::vector<int>& batch_selections,
+    const std::vector<float>& batch_features,
+    InterpreterManager* interpreter_manager,
+    std::vector<std::vector<ClassificationResult>>* classification_results)
+    const {
+  const int batch_size = batch_selections.size();
+  const int features_size = batch_features.size() / batch_size;
+  const TensorView<float> features(batch_features.data(),
+                                   {batch_size, features_size});
+  std::vector<float> batched_logits;
+  TensorView<float> logits =
+      classification_batcher_ != nullptr
+          ? ComputeBatchedLogitsForStage(ProfiledStage::CLASSIFICATION_MODEL,
+                                         *classification_batcher_, features,
+                                         &batched_logits)
+          : ComputeLogitsForStage(
+                ProfiledStage::CLASSIFICATION_MODEL, *classification_executor_,
+                features, interpreter_manager->ClassificationInterpreter());
   if (!logits.is_valid()) {
     TC_LOG(ERROR) << "Couldn't compute logits.";
     return false;
   }
 
-  if (logits.dims() != 2 || logits.dim(0) != 1 ||
+  if (logits.dims() != 2 || logits.dim(0) != batch_size ||
       logits.dim(1) != classification_feature_processor_->NumCollections()) {
     TC_LOG(ERROR) << "Mismatching output";
     return false;
   }
 
-  const std::vector<float> scores =
-      ComputeSoftmax(logits.data(), logits.dim(1));
-
-  classification_results->resize(scores.size());
-  for (int i = 0; i < scores.size(); i++) {
-    (*classification_results)[i] = {
-        classification_feature_processor_->LabelToCollection(i), scores[i]};
-  }
-  std::sort(classification_results->begin(), classification_results->end(),
-            [](const ClassificationResult& a, const ClassificationResult& b) {
-              return a.score > b.score;
-            });
-
-  // Phone class sanity check.
-  if (!classification_results->empty() &&
-      classification_results->begin()->collection == kPhoneCollection) {
-    const int digit_count = CountDigits(context, selection_indices);
-    if (digit_count <
-            model_->classification_options()->phone_min_num_digits() ||
-        digit_count >
-            model_->classification_options()->phone_max_num_digits()) {
-      *classification_results = {{kOtherCollection, 1.0}};
+  // Buffers for the labels of each row sorted by their softmax scores.
+  const int num_labels = logits.dim(1);
+  std::vector<int> labels(num_labels);
+  std::vector<float> scores(num_labels);
+  for (int row = 0; row < batch_size; ++row) {
+    const int i = batch_selections[row];
+    const CodepointSpan selection_indices = selections[i];
+    std::vector<ClassificationResult>* row_results =
+        &(*classification_results)[i];
+
+    ComputeSoftmaxTopK(logits.data() + row * num_labels, num_labels,
+                       num_labels, labels.data(), scores.data());
+
+    row_results->resize(num_labels);
+    for (int j = 0; j < num_labels; j++) {
+      (*row_results)[j] = {
+          classification_feature_processor_->LabelToCollection(labels[j]),
+          scores[j]};
+    }
+
+    // Phone class sanity check.
+    if (!row_results->empty() &&
+        row_results->begin()->collection == kPhoneCollection) {
+      const int digit_count = CountDigits(context, selection_indices);
+      if (digit_count <
+              model_->classification_options()->phone_min_num_digits() ||
+          digit_count >
+              model_->classification_options()->phone_max_num_digits()) {
+        *row_results = {{kOtherCollection, 1.0}};
+      }
     }
-  }
 
-  // Address class sanity check.
-  if (!classification_results->empty() &&
-      classification_results->begin()->collection == kAddressCollection) {
-    if (selection_num_tokens <
-        model_->classification_options()->address_min_num_tokens()) {
-      *classification_results = {{kOtherCollection, 1.0}};
+    // Address class sanity check.
+    if (!row_results->empty() &&
+        row_results->begin()->collection == kAddressCollection) {
+      if (selection_num_tokens[i] <
+          model_->classification_options()->address_min_num_tokens()) {
+        *row_results = {{kOtherCollection, 1.0}};
+      }
     }
   }
 
@@ -957,18 +1651,32 @@ bool TextClassifier::ModelClassifyText(
 }
 
 bool TextClassifier::RegexClassifyText(
-    const std::string& context, CodepointSpan selection_indices,
+    StringPiece context, CodepointSpan selection_indices,
     ClassificationResult* classification_result) const {
+  ScopedStageTimer timer(ProfiledStage::REGEX);
   const std::string selection_text =
       ExtractSelection(context, selection_indices);
   const UnicodeText selection_text_unicode(
       UTF8ToUnicodeText(selection_text, /*do_copy=*/false));
+  const std::unique_ptr<UniLib::RegexInput> selection_input =
+      unilib_->CreateRegexInput(selection_text_unicode);
 
   // Check whether any of the regular expressions match.
   for (const int pattern_id : classification_regex_patterns_) {
     const CompiledRegexPattern& regex_pattern = regex_patterns_[pattern_id];
+    // Both kinds of matching need a match that spans the whole selection.
+    if (!regex_pattern.pattern->MayMatchWhole(*selection_input)) {
+      continue;
+    }
+    if (PhaseCounters* counters = TracedPhaseCounters()) {
+      ++counters->rules;
+    }
     const std::unique_ptr<UniLib::RegexMatcher> matcher =
-        regex_pattern.pattern->Matcher(selection_text_unicode);
+        regex_pattern.pattern->Matcher(*selection_input);
+    if (!matcher) {
+      return false;
+    }
+    LimitRegexMatcher(matcher.get());
     int status = UniLib::RegexMatcher::kNoError;
     bool matches;
     if (regex_approximate_match_pattern_ids_.find(pattern_id) !=
@@ -977,6 +1685,10 @@ bool TextClassifier::RegexClassifyText(
     } else {
       matches = matcher->Matches(&status);
     }
+    if (status == UniLib::RegexMatcher::kTimeout) {
+      RecordRegexTimeout();
+      continue;
+    }
     if (status != UniLib::RegexMatcher::kNoError) {
       return false;
     }
@@ -995,9 +1707,10 @@ bool TextClassifier::RegexClassifyText(
 }
 
 bool TextClassifier::DatetimeClassifyText(
-    const std::string& context, CodepointSpan selection_indices,
+    StringPiece context, CodepointSpan selection_indices,
     const ClassificationOptions& options,
     ClassificationResult* classification_result) const {
+  ScopedStageTimer timer(ProfiledStage::DATETIME);
   if (!datetime_parser_) {
     return false;
   }
@@ -1029,42 +1742,241 @@ bool TextClassifier::DatetimeClassifyText(
 }
 
 std::vector<ClassificationResult> TextClassifier::ClassifyText(
-    const std::string& context, CodepointSpan selection_indices,
+    StringPiece context, CodepointSpan selection_indices,
     const ClassificationOptions& options) const {
-  if (!initialized_) {
-    TC_LOG(ERROR) << "Not initialized";
-    return {};
-  }
+  ScopedRequestMetrics request_metrics(
+      metrics_.get(), MetricsMode::CLASSIFY_TEXT, context.size());
+  std::vector<ClassificationResult> results =
+      ClassifyTextWithCache(context, selection_indices, options);
+  RecordResultMetrics(MetricsMode::CLASSIFY_TEXT, results);
+  return results;
+}
 
-  if (!(model_->enabled_modes() & ModeFlag_CLASSIFICATION)) {
-    return {};
+void TextClassifier::LimitRegexMatcher(UniLib::RegexMatcher* matcher) const {
+  if (regex_time_limit_millis_ > 0) {
+    matcher->SetTimeLimit(regex_time_limit_millis_);
   }
+}
 
-  if (!UTF8ToUnicodeText(context, /*do_copy=*/false).is_valid()) {
-    return {};
+void TextClassifier::RecordRegexTimeout() const {
+  if (metrics_ != nullptr) {
+    metrics_->RecordRegexTimeout();
   }
+}
 
-  if (std::get<0>(selection_indices) >= std::get<1>(selection_indices)) {
-    TC_VLOG(1) << "Trying to run ClassifyText with invalid indices: "
-               << std::get<0>(selection_indices) << " "
-               << std::get<1>(selection_indices);
-    return {};
+void TextClassifier::RecordResultMetrics(
+    MetricsMode mode,
+    const std::vector<ClassificationResult>& classification) const {
+  if (metrics_ != nullptr && !classification.empty()) {
+    metrics_->RecordResult(mode, CollectionId(classification[0].collection));
   }
+}
 
-  // Try the regular expression models.
-  ClassificationResult regex_result;
-  if (RegexClassifyText(context, selection_indices, &regex_result)) {
-    if (!FilteredForClassification(regex_result)) {
-      return {regex_result};
+std::vector<ClassificationResult> TextClassifier::ClassifyTextWithCache(
+    StringPiece context, CodepointSpan selection_indices,
+    const ClassificationOptions& options) const {
+  InterpreterManager interpreter_manager(
+      selection_interpreter_pool_.get(),
+      classification_interpreter_pool_.get());
+  uint64 key;
+  if (classification_cache_ == nullptr ||
+      !ClassificationCacheKey(context, selection_indices, options, &key)) {
+    return ClassifyTextInternal(context, selection_indices, options,
+                                &interpreter_manager,
+                                /*embedding_cache=*/nullptr,
+                                /*cached_tokens=*/{});
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(classification_cache_mutex_);
+    const CachedClassification* cached = classification_cache_->Get(key);
+    if (cached != nullptr &&
+        (!cached->depends_on_reference_time ||
+         std::abs(cached->reference_time_ms_utc -
+                  options.reference_time_ms_utc) <=
+             classification_cache_time_tolerance_ms_)) {
+      if (options.partial_result != nullptr) {
+        *options.partial_result = false;
+      }
+      return cached->results;
+    }
+  }
+
+  // The results cut short by the deadline are not cached.
+  bool partial_result = false;
+  ClassificationOptions uncached_options = options;
+  uncached_options.partial_result = &partial_result;
+  std::vector<ClassificationResult> results = ClassifyTextInternal(
+      context, selection_indices, uncached_options, &interpreter_manager,
+      /*embedding_cache=*/nullptr, /*cached_tokens=*/{});
+  if (options.partial_result != nullptr) {
+    *options.partial_result = partial_result;
+  }
+  if (!partial_result) {
+    CachedClassification cached;
+    cached.results = results;
+    cached.depends_on_reference_time =
+        !results.empty() && results[0].datetime_parse_result.IsSet();
+    cached.reference_time_ms_utc = options.reference_time_ms_utc;
+    std::lock_guard<std::mutex> lock(classification_cache_mutex_);
+    classification_cache_->Put(key, std::move(cached));
+  }
+  return results;
+}
+
+bool TextClassifier::ClassificationCacheKey(
+    StringPiece context, CodepointSpan selection_indices,
+    const ClassificationOptions& options, uint64* key) const {
+  const UnicodeText context_unicode =
+      UTF8ToUnicodeText(context, /*do_copy=*/false);
+  if (!initialized_ || classification_feature_processor_ == nullptr ||
+      selection_indices.first < 0 ||
+      selection_indices.first >= selection_indices.second ||
+      !context_unicode.is_valid()) {
+    return false;
+  }
+
+  // The window of the context that the result depends on: the tokens that
+  // overlap the selection, and the tokens around them that the model reads.
+  // One more token on each side covers the tokens that the retokenization of
+  // the selection may add. Only that window is tokenized, as for the
+  // classification itself.
+  const TokenSpan num_needed_tokens = ClassifyTextUpperBoundNeededTokens();
+  const std::vector<Token> tokens =
+      classification_feature_processor_->TokenizeAroundSpan(
+          UnicodeTextIndex(context_unicode), selection_indices,
+          {num_needed_tokens.first + 1, num_needed_tokens.second + 1});
+  int first_token = 0;
+  while (first_token < tokens.size() &&
+         tokens[first_token].end <= selection_indices.first) {
+    ++first_token;
+  }
+  int end_token = first_token;
+  while (end_token < tokens.size() &&
+         tokens[end_token].start < selection_indices.second) {
+    ++end_token;
+  }
+  first_token = std::max(0, first_token - num_needed_tokens.first - 1);
+  end_token = std::min(static_cast<int>(tokens.size()),
+                       end_token + num_needed_tokens.second + 1);
+  CodepointSpan window = selection_indices;
+  if (first_token < end_token) {
+    window.first = std::min(window.first, tokens[first_token].start);
+    window.second = std::max(window.second, tokens[end_token - 1].end);
+  }
+
+  std::string key_text = ExtractSelection(context, window);
+  key_text.push_back('\0');
+  key_text += std::to_string(selection_indices.first - window.first);
+  key_text.push_back(':');
+  key_text += std::to_string(selection_indices.second - window.first);
+  key_text.push_back('\0');
+  key_text += options.locales;
+  key_text.push_back('\0');
+  key_text += options.reference_timezone;
+  *key = tc2farmhash::Fingerprint64(key_text);
+  return true;
+}
+
+AnnotatedSpan TextClassifier::SuggestAndClassify(
+    StringPiece context, CodepointSpan click_indices,
+    const SelectionOptions& selection_options,
+    const ClassificationOptions& classification_options) const {
+  ScopedRequestMetrics request_metrics(
+      metrics_.get(), MetricsMode::SUGGEST_AND_CLASSIFY, context.size());
+  InterpreterManager interpreter_manager(
+      selection_interpreter_pool_.get(),
+      classification_interpreter_pool_.get());
+  FeatureProcessor::EmbeddingCache embedding_cache;
+  std::vector<Token> tokens;
+  AnnotatedSpan result;
+  result.span = SuggestSelectionInternal(
+      context, click_indices, selection_options, &interpreter_manager,
+      &embedding_cache, /*selection_cache=*/nullptr, &tokens);
+  // The selection model tokenized only around the click, so the tokens are
+  // reused only if they reach far enough around the suggested span.
+  if (!internal::HasCachedTokensAroundSelection(
+          tokens, result.span, ClassifyTextUpperBoundNeededTokens())) {
+    tokens.clear();
+  }
+  result.classification = ClassifyTextInternal(
+      context, result.span, classification_options, &interpreter_manager,
+      &embedding_cache, tokens);
+  RecordResultMetrics(MetricsMode::SUGGEST_AND_CLASSIFY,
+                      result.classification);
+  return result;
+}
+
+std::vector<ClassificationResult> TextClassifier::ClassifyTextInternal(
+    StringPiece context, CodepointSpan selection_indices,
+    const ClassificationOptions& options,
+    InterpreterManager* interpreter_manager,
+    FeatureProcessor::EmbeddingCache* embedding_cache,
+    const std::vector<Token>& cached_tokens) const {
+  if (options.partial_result != nullptr) {
+    *options.partial_result = false;
+  }
+  if (!initialized_) {
+    TC_LOG(ERROR) << "Not initialized";
+    return {};
+  }
+
+  if (!(model_->enabled_modes() & ModeFlag_CLASSIFICATION)) {
+    return {};
+  }
+
+  if (!UTF8ToUnicodeText(context, /*do_copy=*/false).is_valid()) {
+    return {};
+  }
+
+  if (std::get<0>(selection_indices) >= std::get<1>(selection_indices)) {
+    TC_VLOG(1) << "Trying to run ClassifyText with invalid indices: "
+               << std::get<0>(selection_indices) << " "
+               << std::get<1>(selection_indices);
+    return {};
+  }
+
+  DeadlineCheck deadline(options.deadline);
+  const auto stopped = [&options]() -> std::vector<ClassificationResult> {
+    if (options.partial_result != nullptr) {
+      *options.partial_result = true;
+    }
+    return {};
+  };
+
+  // Try the regular expression models.
+  if (deadline.Expired()) {
+    return stopped();
+  }
+  ClassificationResult regex_result;
+  bool regex_matched;
+  {
+    ScopedPhaseTrace trace(options.tracer, TracedPhase::REGEX);
+    regex_matched =
+        RegexClassifyText(context, selection_indices, &regex_result);
+    trace.SetResults(regex_matched ? 1 : 0);
+  }
+  if (regex_matched) {
+    if (!FilteredForClassification(regex_result)) {
+      return {regex_result};
     } else {
       return {{kOtherCollection, 1.0}};
     }
   }
 
   // Try the date model.
+  if (deadline.Expired()) {
+    return stopped();
+  }
   ClassificationResult datetime_result;
-  if (DatetimeClassifyText(context, selection_indices, options,
-                           &datetime_result)) {
+  bool datetime_matched;
+  {
+    ScopedPhaseTrace trace(options.tracer, TracedPhase::DATETIME);
+    datetime_matched = DatetimeClassifyText(context, selection_indices,
+                                            options, &datetime_result);
+    trace.SetResults(datetime_matched ? 1 : 0);
+  }
+  if (datetime_matched) {
     if (!FilteredForClassification(datetime_result)) {
       return {datetime_result};
     } else {
@@ -1072,192 +1984,1278 @@ std::vector<ClassificationResult> TextClassifier::ClassifyText(
     }
   }
 
-  // Fallback to the model.
-  std::vector<ClassificationResult> model_result;
+  // Fallback to the model.
+  if (deadline.Expired()) {
+    return stopped();
+  }
+  if (model_->triggering_options() == nullptr ||
+      !(model_->triggering_options()->enabled_modes() &
+        ModeFlag_CLASSIFICATION)) {
+    return {};
+  }
+  std::vector<ClassificationResult> model_result;
+  bool model_classified;
+  {
+    ScopedPhaseTrace trace(options.tracer, TracedPhase::MODEL_CLASSIFY_TEXT);
+    model_classified =
+        ModelClassifyText(context, cached_tokens, selection_indices,
+                          interpreter_manager, embedding_cache,
+                          &model_result) &&
+        !model_result.empty();
+    trace.SetResults(model_result.size());
+  }
+  if (model_classified) {
+    if (!FilteredForClassification(model_result[0])) {
+      return model_result;
+    } else {
+      return {{kOtherCollection, 1.0}};
+    }
+  }
+
+  // No classifications.
+  return {};
+}
+
+bool TextClassifier::ModelAnnotate(StringPiece context,
+                                   const AnnotationOptions& options,
+                                   InterpreterManager* interpreter_manager,
+                                   FeatureProcessor::EmbeddingCache*
+                                       embedding_cache,
+                                   LineAnnotationCache* line_cache,
+                                   DeadlineCheck* deadline,
+                                   std::vector<Token>* tokens,
+                                   std::vector<AnnotatedSpan>* result) const {
+  if (model_->triggering_options() == nullptr ||
+      !(model_->triggering_options()->enabled_modes() & ModeFlag_ANNOTATION)) {
+    return true;
+  }
+
+  const UnicodeText context_unicode = UTF8ToUnicodeText(context,
+                                                        /*do_copy=*/false);
+  std::vector<UnicodeTextRange> lines;
+  if (!selection_feature_processor_->GetOptions()->only_use_line_with_click()) {
+    lines.push_back({context_unicode.begin(), context_unicode.end()});
+  } else {
+    lines = selection_feature_processor_->SplitContext(context_unicode);
+  }
+
+  if (line_cache != nullptr) {
+    return ModelAnnotateCachedLines(context_unicode, lines,
+                                    interpreter_manager, embedding_cache,
+                                    line_cache, deadline, tokens, result);
+  }
+
+  // The cache is keyed by codepoint spans relative to the line, so the
+  // request-wide cache can only be used when the line is the whole context.
+  // Otherwise every line gets a cache of its own.
+  if (lines.size() == 1 && lines[0].first == context_unicode.begin() &&
+      lines[0].second == context_unicode.end()) {
+    if (deadline->Expired()) {
+      return true;
+    }
+    if (options.task_runner != nullptr && options.max_shards > 1) {
+      return ModelAnnotateLineSharded(
+          context_unicode, lines[0], options.task_runner, options.max_shards,
+          interpreter_manager, embedding_cache, tokens, result);
+    }
+    return ModelAnnotateLine(context_unicode, lines[0], interpreter_manager,
+                             embedding_cache, tokens, result);
+  }
+
+  const int num_threads =
+      std::min(options.num_line_threads, static_cast<int>(lines.size()));
+  if (num_threads <= 1 && UsesBoundsSensitiveSelection()) {
+    // Many short lines would each make a tiny batch for the selection model,
+    // so their candidates share the batches instead.
+    std::vector<LineToAnnotate> lines_to_annotate;
+    lines_to_annotate.reserve(lines.size());
+    for (const UnicodeTextRange& line : lines) {
+      lines_to_annotate.push_back(
+          {&context_unicode, line, /*embedding_cache=*/nullptr});
+    }
+    std::vector<std::vector<Token>> line_tokens;
+    std::vector<std::vector<AnnotatedSpan>> line_results;
+    if (!ModelAnnotateLinesBatched(lines_to_annotate, interpreter_manager,
+                                   deadline, &line_tokens, &line_results)) {
+      return false;
+    }
+    for (std::vector<AnnotatedSpan>& line_result : line_results) {
+      std::move(line_result.begin(), line_result.end(),
+                std::back_inserter(*result));
+    }
+    if (!line_tokens.empty()) {
+      *tokens = std::move(line_tokens.back());
+    }
+    return true;
+  }
+  if (num_threads <= 1) {
+    for (const UnicodeTextRange& line : lines) {
+      if (deadline->Expired()) {
+        break;
+      }
+      FeatureProcessor::EmbeddingCache line_embedding_cache;
+      if (!ModelAnnotateLine(context_unicode, line, interpreter_manager,
+                             &line_embedding_cache, tokens, result)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Fan the lines out to worker threads. Each worker owns its interpreters, and
+  // writes to per-line outputs, so that the results can be merged in the line
+  // order afterwards.
+  std::vector<std::vector<AnnotatedSpan>> line_results(lines.size());
+  std::vector<Token> last_line_tokens;
+  std::atomic<int> next_line(0);
+  std::atomic<bool> success(true);
+  const auto worker = [&](InterpreterManager* worker_interpreter_manager) {
+    std::vector<Token> line_tokens;
+    for (int i = next_line++; i < lines.size() && success; i = next_line++) {
+      if (deadline->Expired()) {
+        break;
+      }
+      FeatureProcessor::EmbeddingCache line_embedding_cache;
+      if (!ModelAnnotateLine(context_unicode, lines[i],
+                             worker_interpreter_manager, &line_embedding_cache,
+                             &line_tokens, &line_results[i])) {
+        success = false;
+      }
+      if (i == lines.size() - 1) {
+        last_line_tokens = std::move(line_tokens);
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (int i = 1; i < num_threads; ++i) {
+    threads.emplace_back([this, &worker]() {
+      InterpreterManager worker_interpreter_manager(
+          selection_interpreter_pool_.get(),
+          classification_interpreter_pool_.get());
+      worker(&worker_interpreter_manager);
+    });
+  }
+  worker(interpreter_manager);
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  if (!success) {
+    return false;
+  }
+  for (std::vector<AnnotatedSpan>& line_result : line_results) {
+    std::move(line_result.begin(), line_result.end(),
+              std::back_inserter(*result));
+  }
+  *tokens = std::move(last_line_tokens);
+  return true;
+}
+
+bool TextClassifier::ModelAnnotateCachedLines(
+    const UnicodeText& context_unicode,
+    const std::vector<UnicodeTextRange>& lines,
+    InterpreterManager* interpreter_manager,
+    FeatureProcessor::EmbeddingCache* embedding_cache,
+    LineAnnotationCache* line_cache, DeadlineCheck* deadline,
+    std::vector<Token>* tokens, std::vector<AnnotatedSpan>* result) const {
+  const bool is_whole_context = lines.size() == 1 &&
+                                lines[0].first == context_unicode.begin() &&
+                                lines[0].second == context_unicode.end();
+
+  // The lines of this context. Replaces the cache only when all went well,
+  // so that a failed call does not lose the cached lines.
+  std::unordered_map<std::string, LineAnnotations> context_lines;
+  int num_annotated_lines = 0;
+  for (const UnicodeTextRange& line : lines) {
+    std::string line_str = UnicodeText::UTF8Substring(line.first, line.second);
+    const int offset = std::distance(context_unicode.begin(), line.first);
+
+    auto it = context_lines.find(line_str);
+    if (it == context_lines.end()) {
+      auto cached_it = line_cache->lines.find(line_str);
+      if (cached_it != line_cache->lines.end()) {
+        it = context_lines
+                 .emplace(std::move(line_str), std::move(cached_it->second))
+                 .first;
+        line_cache->lines.erase(cached_it);
+      } else if (deadline->Expired()) {
+        // Keeps the cached lines of the previous version for the next call,
+        // together with the ones done so far.
+        for (auto& context_line : context_lines) {
+          line_cache->lines.insert(std::move(context_line));
+        }
+        line_cache->num_annotated_lines = num_annotated_lines;
+        return true;
+      } else {
+        LineAnnotations line_annotations;
+        FeatureProcessor::EmbeddingCache line_embedding_cache;
+        if (!ModelAnnotateLine(
+                context_unicode, line, interpreter_manager,
+                is_whole_context ? embedding_cache : &line_embedding_cache,
+                &line_annotations.tokens, &line_annotations.annotations)) {
+          return false;
+        }
+        for (AnnotatedSpan& annotation : line_annotations.annotations) {
+          annotation.span.first -= offset;
+          annotation.span.second -= offset;
+        }
+        ++num_annotated_lines;
+        it = context_lines
+                 .emplace(std::move(line_str), std::move(line_annotations))
+                 .first;
+      }
+    }
+
+    for (const AnnotatedSpan& annotation : it->second.annotations) {
+      result->push_back(annotation);
+      result->back().span.first += offset;
+      result->back().span.second += offset;
+    }
+    *tokens = it->second.tokens;
+  }
+
+  line_cache->lines = std::move(context_lines);
+  line_cache->num_annotated_lines = num_annotated_lines;
+  return true;
+}
+
+bool TextClassifier::ModelAnnotateLine(
+    const UnicodeText& context_unicode, const UnicodeTextRange& line,
+    InterpreterManager* interpreter_manager,
+    FeatureProcessor::EmbeddingCache* embedding_cache,
+    std::vector<Token>* tokens, std::vector<AnnotatedSpan>* result) const {
+  std::string line_str;
+  std::unique_ptr<CachedFeatures> cached_features;
+  if (!PrepareLineForModel(line, embedding_cache, &line_str, tokens,
+                           &cached_features)) {
+    return false;
+  }
+  if (cached_features == nullptr) {
+    return true;
+  }
+
+  std::vector<TokenSpan> local_chunks;
+  if (!ModelChunk(tokens->size(), /*span_of_interest=*/{0, tokens->size()},
+                  interpreter_manager->SelectionInterpreter(),
+                  *cached_features, &local_chunks)) {
+    TC_LOG(ERROR) << "Could not chunk.";
+    return false;
+  }
+
+  return ClassifyLineChunks(
+      line_str, std::distance(context_unicode.begin(), line.first), *tokens,
+      local_chunks, interpreter_manager, embedding_cache, result);
+}
+
+namespace {
+
+// Splits [0, size) into at most 'max_shards' consecutive ranges, whose sizes
+// are multiples of 'granularity' except for the last one's.
+std::vector<std::pair<int, int>> ShardRanges(int size, int granularity,
+                                             int max_shards) {
+  const int num_units = (size + granularity - 1) / granularity;
+  const int units_per_shard =
+      std::max(1, (num_units + max_shards - 1) / std::max(1, max_shards));
+  std::vector<std::pair<int, int>> ranges;
+  for (int begin = 0; begin < size;
+       begin += units_per_shard * granularity) {
+    ranges.push_back(
+        {begin, std::min(size, begin + units_per_shard * granularity)});
+  }
+  return ranges;
+}
+
+}  // namespace
+
+bool TextClassifier::RunShards(
+    TaskRunner* task_runner, int num_shards,
+    InterpreterManager* interpreter_manager,
+    FeatureProcessor::EmbeddingCache* embedding_cache,
+    const std::function<bool(int, InterpreterManager*,
+                             FeatureProcessor::EmbeddingCache*)>& shard_fn)
+    const {
+  if (num_shards == 1) {
+    return shard_fn(0, interpreter_manager, embedding_cache);
+  }
+  std::atomic<bool> success(true);
+  std::vector<std::function<void()>> tasks;
+  tasks.reserve(num_shards);
+  for (int i = 0; i < num_shards; ++i) {
+    tasks.push_back([this, i, interpreter_manager, embedding_cache, &shard_fn,
+                     &success]() {
+      if (i == 0) {
+        if (!shard_fn(i, interpreter_manager, embedding_cache)) {
+          success = false;
+        }
+        return;
+      }
+      InterpreterManager shard_interpreter_manager(
+          selection_interpreter_pool_.get(),
+          classification_interpreter_pool_.get());
+      FeatureProcessor::EmbeddingCache shard_embedding_cache;
+      if (!shard_fn(i, &shard_interpreter_manager, &shard_embedding_cache)) {
+        success = false;
+      }
+    });
+  }
+  RunAll(task_runner, tasks);
+  return success;
+}
+
+bool TextClassifier::ModelAnnotateLineSharded(
+    const UnicodeText& context_unicode, const UnicodeTextRange& line,
+    TaskRunner* task_runner, int max_shards,
+    InterpreterManager* interpreter_manager,
+    FeatureProcessor::EmbeddingCache* embedding_cache,
+    std::vector<Token>* tokens, std::vector<AnnotatedSpan>* result) const {
+  std::string line_str;
+  std::unique_ptr<CachedFeatures> cached_features;
+  if (!PrepareLineForModel(line, embedding_cache, &line_str, tokens,
+                           &cached_features)) {
+    return false;
+  }
+  if (cached_features == nullptr) {
+    return true;
+  }
+
+  // The quantized token features are computed lazily, so they are computed
+  // here, before the shards share them.
+  const FeaturesInput input = selection_executor_->PrepareFeaturesInput(
+      {1, cached_features->OutputFeaturesSize()},
+      interpreter_manager->SelectionInterpreter());
+  if (!input.is_valid()) {
+    TC_LOG(ERROR) << "Couldn't prepare the model input.";
+    return false;
+  }
+  cached_features->PrepareInput(input);
+
+  // The shards of the selection model start at multiples of the batch size,
+  // so that their batches are those of ModelChunk(), and their scored chunks
+  // are put together in its order.
+  const int num_tokens = tokens->size();
+  const TokenSpan full_line_span = {0, num_tokens};
+  const TokenSpan inference_span =
+      ModelInferenceSpan(num_tokens, full_line_span);
+  const int max_batch_size =
+      std::max(1, model_->selection_options()->batch_size());
+  std::vector<ScoredChunk> scored_chunks;
+  if (UsesBoundsSensitiveSelection()) {
+    std::vector<TokenSpan> candidate_spans;
+    BoundsSensitiveCandidateSpans(full_line_span, inference_span,
+                                  &candidate_spans, &scored_chunks);
+    const std::vector<std::pair<int, int>> shards =
+        ShardRanges(candidate_spans.size(), max_batch_size, max_shards);
+    std::vector<std::vector<ScoredChunk>> shard_scored_chunks(shards.size());
+    if (!RunShards(task_runner, shards.size(), interpreter_manager,
+                   embedding_cache,
+                   [&](int i, InterpreterManager* shard_interpreter_manager,
+                       FeatureProcessor::EmbeddingCache*) {
+                     return ScoreBoundsSensitiveCandidateSpans(
+                         candidate_spans, shards[i].first, shards[i].second,
+                         *cached_features,
+                         shard_interpreter_manager->SelectionInterpreter(),
+                         &shard_scored_chunks[i]);
+                   })) {
+      return false;
+    }
+    for (const std::vector<ScoredChunk>& shard : shard_scored_chunks) {
+      scored_chunks.insert(scored_chunks.end(), shard.begin(), shard.end());
+    }
+  } else {
+    // A chunk gets the max score of the clicks that propose it, over all the
+    // shards of clicks.
+    const std::vector<std::pair<int, int>> shards =
+        ShardRanges(num_tokens, max_batch_size, max_shards);
+    std::vector<std::vector<ScoredChunk>> shard_scored_chunks(shards.size());
+    if (!RunShards(task_runner, shards.size(), interpreter_manager,
+                   embedding_cache,
+                   [&](int i, InterpreterManager* shard_interpreter_manager,
+                       FeatureProcessor::EmbeddingCache*) {
+                     return ModelClickContextScoreChunks(
+                         num_tokens, shards[i], *cached_features,
+                         shard_interpreter_manager->SelectionInterpreter(),
+                         &shard_scored_chunks[i]);
+                   })) {
+      return false;
+    }
+    for (const std::vector<ScoredChunk>& shard : shard_scored_chunks) {
+      scored_chunks.insert(scored_chunks.end(), shard.begin(), shard.end());
+    }
+    std::stable_sort(scored_chunks.begin(), scored_chunks.end(),
+                     [](const ScoredChunk& a, const ScoredChunk& b) {
+                       return a.token_span < b.token_span;
+                     });
+    int num_chunks = 0;
+    for (int i = 0; i < scored_chunks.size(); ++i) {
+      if (num_chunks > 0 && scored_chunks[num_chunks - 1].token_span ==
+                                scored_chunks[i].token_span) {
+        scored_chunks[num_chunks - 1].score = std::max(
+            scored_chunks[num_chunks - 1].score, scored_chunks[i].score);
+      } else {
+        scored_chunks[num_chunks++] = scored_chunks[i];
+      }
+    }
+    scored_chunks.resize(num_chunks);
+  }
+  std::vector<TokenSpan> local_chunks;
+  SelectNonOverlappingChunks(inference_span, &scored_chunks, &local_chunks);
+
+  // The chunks are classified in shards, whose results are appended in the
+  // order of the chunks.
+  const std::vector<std::pair<int, int>> shards =
+      ShardRanges(local_chunks.size(), /*granularity=*/1, max_shards);
+  std::vector<std::vector<AnnotatedSpan>> shard_results(shards.size());
+  const int offset = std::distance(context_unicode.begin(), line.first);
+  if (!RunShards(
+          task_runner, shards.size(), interpreter_manager, embedding_cache,
+          [&](int i, InterpreterManager* shard_interpreter_manager,
+              FeatureProcessor::EmbeddingCache* shard_embedding_cache) {
+            return ClassifyLineChunks(
+                line_str, offset, *tokens,
+                std::vector<TokenSpan>(local_chunks.begin() + shards[i].first,
+                                       local_chunks.begin() + shards[i].second),
+                shard_interpreter_manager, shard_embedding_cache,
+                &shard_results[i]);
+          })) {
+    return false;
+  }
+  for (std::vector<AnnotatedSpan>& shard_result : shard_results) {
+    std::move(shard_result.begin(), shard_result.end(),
+              std::back_inserter(*result));
+  }
+  return true;
+}
+
+bool TextClassifier::ModelAnnotateLinesBatched(
+    const std::vector<LineToAnnotate>& lines,
+    InterpreterManager* interpreter_manager, DeadlineCheck* deadline,
+    std::vector<std::vector<Token>>* tokens,
+    std::vector<std::vector<AnnotatedSpan>>* results) const {
+  // A line between the steps: its candidate spans wait for the selection
+  // model, and its scored chunks for the classification.
+  struct PendingLine {
+    int index;
+    std::string line_str;
+    std::unique_ptr<CachedFeatures> cached_features;
+    TokenSpan inference_span;
+    std::vector<TokenSpan> candidate_spans;
+    std::vector<ScoredChunk> scored_chunks;
+
+    // Holds the embeddings of the line's tokens between the steps, unless the
+    // line comes with its own embedding cache.
+    FeatureProcessor::EmbeddingCache line_embedding_cache;
+  };
+
+  tokens->resize(lines.size());
+  results->resize(lines.size());
+  const int max_batch_size =
+      std::max(1, model_->selection_options()->batch_size());
+  tflite::Interpreter* selection_interpreter =
+      interpreter_manager->SelectionInterpreter();
+
+  int next_line = 0;
+  while (next_line < lines.size()) {
+    // Takes lines until they have a full batch of candidates, so that only the
+    // features of a few lines are held at a time.
+    std::vector<PendingLine> group;
+    int num_candidates = 0;
+    for (; next_line < lines.size() && num_candidates < max_batch_size;
+         ++next_line) {
+      if (deadline->Expired()) {
+        // Finishes the lines taken so far, but takes no new ones.
+        next_line = lines.size();
+        break;
+      }
+      PendingLine pending;
+      pending.index = next_line;
+      std::vector<Token>* line_tokens = &(*tokens)[next_line];
+      const LineToAnnotate& line = lines[next_line];
+      if (!PrepareLineForModel(line.line,
+                               line.embedding_cache != nullptr
+                                   ? line.embedding_cache
+                                   : &pending.line_embedding_cache,
+                               &pending.line_str, line_tokens,
+                               &pending.cached_features)) {
+        return false;
+      }
+      if (pending.cached_features == nullptr) {
+        continue;
+      }
+      const TokenSpan full_line_span = {0, line_tokens->size()};
+      pending.inference_span =
+          ModelInferenceSpan(line_tokens->size(), full_line_span);
+      BoundsSensitiveCandidateSpans(full_line_span, pending.inference_span,
+                                    &pending.candidate_spans,
+                                    &pending.scored_chunks);
+      num_candidates += pending.candidate_spans.size();
+      group.push_back(std::move(pending));
+    }
+    if (group.empty()) {
+      continue;
+    }
+
+    // Runs the candidates of all the lines of the group through the model
+    // together, remembering which line and candidate each row comes from.
+    const int features_size = group[0].cached_features->OutputFeaturesSize();
+    std::vector<std::pair<int, int>> batch_sources;
+    batch_sources.reserve(max_batch_size);
+    int group_line = 0;
+    int line_candidate = 0;
+    for (int batch_start = 0; batch_start < num_candidates;
+         batch_start += max_batch_size) {
+      const int batch_size =
+          std::min(max_batch_size, num_candidates - batch_start);
+      const FeaturesInput batch_input =
+          selection_executor_->PrepareFeaturesInput(
+              {batch_size, features_size}, selection_interpreter);
+      if (!batch_input.is_valid()) {
+        TC_LOG(ERROR) << "Couldn't prepare the model input.";
+        return false;
+      }
+      batch_sources.clear();
+      for (int row = 0; row < batch_size; ++row) {
+        while (line_candidate == group[group_line].candidate_spans.size()) {
+          ++group_line;
+          line_candidate = 0;
+        }
+        const PendingLine& pending = group[group_line];
+        pending.cached_features->AppendBoundsSensitiveFeaturesForSpan(
+            pending.candidate_spans[line_candidate], batch_input, row);
+        batch_sources.push_back({group_line, line_candidate});
+        ++line_candidate;
+      }
+
+      TensorView<float> logits = ComputeLogitsFromInputForStage(
+          ProfiledStage::SELECTION_MODEL, *selection_executor_, batch_size,
+          selection_interpreter);
+      if (!logits.is_valid()) {
+        TC_LOG(ERROR) << "Couldn't compute logits.";
+        return false;
+      }
+      if (logits.dims() != 2 || logits.dim(0) != batch_size ||
+          logits.dim(1) != 1) {
+        TC_LOG(ERROR) << "Mismatching output.";
+        return false;
+      }
+
+      // Hands the scores back to the lines.
+      for (int row = 0; row < batch_size; ++row) {
+        PendingLine* pending = &group[batch_sources[row].first];
+        pending->scored_chunks.push_back(ScoredChunk{
+            pending->candidate_spans[batch_sources[row].second],
+            logits.data()[row]});
+      }
+    }
+
+    for (PendingLine& pending : group) {
+      const LineToAnnotate& line = lines[pending.index];
+      std::vector<TokenSpan> local_chunks;
+      SelectNonOverlappingChunks(pending.inference_span,
+                                 &pending.scored_chunks, &local_chunks);
+      if (!ClassifyLineChunks(
+              pending.line_str,
+              std::distance(line.context_unicode->begin(), line.line.first),
+              (*tokens)[pending.index], local_chunks, interpreter_manager,
+              line.embedding_cache != nullptr ? line.embedding_cache
+                                              : &pending.line_embedding_cache,
+              &(*results)[pending.index])) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool TextClassifier::UsesBoundsSensitiveSelection() const {
+  const FeatureProcessorOptions* options =
+      selection_feature_processor_->GetOptions();
+  return options->bounds_sensitive_features() != nullptr &&
+         options->bounds_sensitive_features()->enabled();
+}
+
+bool TextClassifier::PassesModelGate(const UnicodeTextRange& line) const {
+  int num_signal_codepoints = 0;
+  int num_codepoints = 0;
+  for (auto it = line.first; it != line.second; ++it) {
+    const char32 codepoint = *it;
+    if (unilib_->IsWhitespace(codepoint)) {
+      continue;
+    }
+    ++num_codepoints;
+    if (unilib_->IsDigit(codepoint) || unilib_->IsUpper(codepoint)) {
+      ++num_signal_codepoints;
+    } else if (!unilib_->IsLetterOrDigit(codepoint)) {
+      switch (codepoint) {
+        case '.':
+        case ',':
+        case ';':
+        case '!':
+        case '?':
+        case '\'':
+        case '"':
+        case '(':
+        case ')':
+          break;
+        default:
+          ++num_signal_codepoints;
+      }
+    }
+  }
+  return num_signal_codepoints >= model_gate_.min_signal_codepoints &&
+         num_signal_codepoints >= model_gate_.min_signal_ratio * num_codepoints;
+}
+
+bool TextClassifier::PrepareLineForModel(
+    const UnicodeTextRange& line,
+    FeatureProcessor::EmbeddingCache* embedding_cache, std::string* line_str,
+    std::vector<Token>* tokens,
+    std::unique_ptr<CachedFeatures>* cached_features) const {
+  cached_features->reset();
+  *line_str = UnicodeText::UTF8Substring(line.first, line.second);
+  *tokens = selection_feature_processor_->Tokenize(*line_str);
+  if (PhaseCounters* counters = TracedPhaseCounters()) {
+    counters->tokens += tokens->size();
+  }
+  selection_feature_processor_->RetokenizeAndFindClick(
+      *line_str, {0, std::distance(line.first, line.second)},
+      selection_feature_processor_->GetOptions()->only_use_line_with_click(),
+      tokens,
+      /*click_pos=*/nullptr);
+  const TokenSpan full_line_span = {0, tokens->size()};
+
+  // TODO(zilka): Add support for greater granularity of this check.
+  if (!selection_feature_processor_->HasEnoughSupportedCodepoints(
+          *tokens, full_line_span)) {
+    return true;
+  }
+  if (model_gate_.enabled && !PassesModelGate(line)) {
+    if (PhaseCounters* counters = TracedPhaseCounters()) {
+      ++counters->gated_lines;
+    }
+    return true;
+  }
+
+  if (!selection_feature_processor_->ExtractFeatures(
+          *tokens, full_line_span,
+          /*selection_span_for_feature=*/{kInvalidIndex, kInvalidIndex},
+          embedding_executor_.get(),
+          shares_token_embeddings_ ? embedding_cache : nullptr,
+          selection_feature_processor_->EmbeddingSize() +
+              selection_feature_processor_->DenseFeaturesCount(),
+          cached_features)) {
+    TC_LOG(ERROR) << "Could not extract features.";
+    return false;
+  }
+  return true;
+}
+
+bool TextClassifier::ClassifyLineChunks(
+    const std::string& line_str, int offset, const std::vector<Token>& tokens,
+    const std::vector<TokenSpan>& local_chunks,
+    InterpreterManager* interpreter_manager,
+    FeatureProcessor::EmbeddingCache* embedding_cache,
+    std::vector<AnnotatedSpan>* result) const {
+  const float min_annotate_confidence =
+      (model_->triggering_options() != nullptr
+           ? model_->triggering_options()->min_annotate_confidence()
+           : 0.f);
+
+  // Classify all the non-empty chunks of the line in batches.
+  std::vector<CodepointSpan> chunk_codepoint_spans;
+  chunk_codepoint_spans.reserve(local_chunks.size());
+  const UnicodeText line_unicode =
+      UTF8ToUnicodeText(line_str, /*do_copy=*/false);
+  const UnicodeTextIndex line_index(line_unicode);
+  for (const TokenSpan& chunk : local_chunks) {
+    const CodepointSpan codepoint_span =
+        selection_feature_processor_->StripBoundaryCodepoints(
+            line_index, TokenSpanToCodepointSpan(tokens, chunk));
+
+    // Skip empty spans.
+    if (codepoint_span.first != codepoint_span.second) {
+      chunk_codepoint_spans.push_back(codepoint_span);
+    }
+  }
+
+  std::vector<std::vector<ClassificationResult>> classifications;
+  if (!ModelClassifyTexts(line_str, tokens, chunk_codepoint_spans,
+                          interpreter_manager, embedding_cache,
+                          &classifications)) {
+    TC_LOG(ERROR) << "Could not classify text on line at: " << offset;
+    return false;
+  }
+
+  for (int i = 0; i < chunk_codepoint_spans.size(); ++i) {
+    const CodepointSpan& codepoint_span = chunk_codepoint_spans[i];
+    std::vector<ClassificationResult>& classification = classifications[i];
+
+    // Do not include the span if it's classified as "other".
+    if (!classification.empty() && !ClassifiedAsOther(classification) &&
+        classification[0].score >= min_annotate_confidence) {
+      AnnotatedSpan result_span;
+      result_span.span = {codepoint_span.first + offset,
+                          codepoint_span.second + offset};
+      result_span.classification = std::move(classification);
+      result_span.source = AnnotatedSpan::Source::MODEL;
+      result->push_back(std::move(result_span));
+    }
+  }
+  return true;
+}
+
+const FeatureProcessor* TextClassifier::SelectionFeatureProcessorForTests()
+    const {
+  return selection_feature_processor_.get();
+}
+
+const FeatureProcessor* TextClassifier::ClassificationFeatureProcessorForTests()
+    const {
+  return classification_feature_processor_.get();
+}
+
+const DatetimeParser* TextClassifier::DatetimeParserForTests() const {
+  return datetime_parser_.get();
+}
+
+int64 TextClassifier::ExtraEmbeddingMemoryBytes() const {
+  if (!embedding_executor_) {
+    return 0;
+  }
+  return embedding_executor_->ExtraMemoryBytes();
+}
+
+std::vector<OperatorProfile> TextClassifier::GetSelectionOperatorProfile()
+    const {
+  if (!selection_executor_) {
+    return {};
+  }
+  return selection_executor_->GetOperatorProfile();
+}
+
+SharedEmbeddingCache::Stats TextClassifier::GetSharedEmbeddingCacheStats()
+    const {
+  if (!shared_embedding_cache_) {
+    return SharedEmbeddingCache::Stats();
+  }
+  return shared_embedding_cache_->GetStats();
+}
+
+MetricsSnapshot TextClassifier::GetMetrics() const {
+  if (!metrics_) {
+    return MetricsSnapshot();
+  }
+  return metrics_->Snapshot();
+}
+
+std::vector<OperatorProfile>
+TextClassifier::GetClassificationOperatorProfile() const {
+  if (!classification_executor_) {
+    return {};
+  }
+  return classification_executor_->GetOperatorProfile();
+}
+
+bool TextClassifier::Warmup(const WarmupOptions& options) const {
+  bool success = true;
+  if (options.compile_patterns) {
+    for (const CompiledRegexPattern& regex_pattern : regex_patterns_) {
+      success &= regex_pattern.pattern->Compile();
+    }
+    if (datetime_parser_) {
+      success &= datetime_parser_->Warmup();
+    }
+  }
+
+  for (InterpreterPool* pool : {selection_interpreter_pool_.get(),
+                                classification_interpreter_pool_.get()}) {
+    if (pool != nullptr) {
+      success &= pool->Reserve(options.num_interpreters);
+    }
+  }
+
+  if (options.prefault_embeddings && model_->embedding_model() != nullptr) {
+    PrefaultMmapRange(model_->embedding_model()->data(),
+                      model_->embedding_model()->size());
+  }
+
+  if (options.run_models && !options.text.empty()) {
+    // Selects and classifies the first word.
+    const UnicodeText text_unicode =
+        UTF8ToUnicodeText(options.text, /*do_copy=*/false);
+    const int first_word_end =
+        std::distance(text_unicode.begin(),
+                      std::find(text_unicode.begin(), text_unicode.end(), ' '));
+    SuggestSelection(options.text, {0, first_word_end});
+    ClassifyText(options.text, {0, first_word_end});
+    Annotate(options.text);
+  }
+  return success;
+}
+
+void TextClassifier::Trim(TrimLevel level) const {
+  if (shared_embedding_cache_ != nullptr) {
+    shared_embedding_cache_->Clear();
+  }
+  if (classification_cache_ != nullptr) {
+    std::lock_guard<std::mutex> lock(classification_cache_mutex_);
+    classification_cache_->Clear();
+  }
+  for (InterpreterPool* pool : {selection_interpreter_pool_.get(),
+                                classification_interpreter_pool_.get()}) {
+    if (pool != nullptr) {
+      pool->ReleaseFreeInterpreters();
+    }
+  }
+  for (const FeatureProcessor* feature_processor :
+       {selection_feature_processor_.get(),
+        classification_feature_processor_.get()}) {
+    if (feature_processor != nullptr) {
+      feature_processor->ReleaseBreakIterators();
+    }
+  }
+
+  if (level == TrimLevel::PATTERNS) {
+    for (const CompiledRegexPattern& regex_pattern : regex_patterns_) {
+      regex_pattern.pattern->ReleaseCompiled();
+    }
+    if (datetime_parser_) {
+      datetime_parser_->ReleaseCompiledPatterns();
+    }
+  }
+}
+
+MemoryStats TextClassifier::GetMemoryStats() const {
+  MemoryStats stats;
+
+  const void* buffer = unowned_buffer_;
+  stats.model_bytes = unowned_buffer_size_;
+  if (mmap_ != nullptr) {
+    buffer = mmap_->handle().start();
+    stats.model_bytes = mmap_->handle().num_bytes();
+  }
+  if (buffer != nullptr) {
+    // Counts whole pages, which may go a bit beyond the buffer.
+    stats.model_resident_bytes = std::min(
+        GetResidentMmapBytes(buffer, stats.model_bytes), stats.model_bytes);
+  }
+
+  stats.embedding_bytes = ExtraEmbeddingMemoryBytes();
+  if (shared_embedding_cache_ != nullptr) {
+    stats.embedding_cache_bytes =
+        shared_embedding_cache_->GetStats().memory_bytes;
+  }
+
+  for (const InterpreterPool* pool : {selection_interpreter_pool_.get(),
+                                      classification_interpreter_pool_.get()}) {
+    if (pool != nullptr) {
+      stats.num_interpreters += pool->NumInterpreters();
+      stats.interpreter_bytes += pool->EstimateMemoryBytes();
+    }
+  }
+
+  for (const CompiledRegexPattern& regex_pattern : regex_patterns_) {
+    stats.regex_bytes += sizeof(CompiledRegexPattern) +
+                         regex_pattern.collection_name.capacity() +
+                         regex_pattern.pattern->EstimateMemoryBytes();
+  }
+  if (annotation_multi_regex_ != nullptr) {
+    stats.regex_bytes += annotation_multi_regex_->EstimateMemoryBytes();
+  }
+
+  if (selection_feature_processor_ != nullptr) {
+    stats.feature_processor_bytes +=
+        selection_feature_processor_->EstimateMemoryBytes();
+  }
+  if (classification_feature_processor_ != nullptr) {
+    stats.feature_processor_bytes +=
+        classification_feature_processor_->EstimateMemoryBytes();
+  }
 
-  InterpreterManager interpreter_manager(selection_executor_.get(),
-                                         classification_executor_.get());
-  if (ModelClassifyText(context, selection_indices, &interpreter_manager,
-                        /*embedding_cache=*/nullptr, &model_result) &&
-      !model_result.empty()) {
-    if (!FilteredForClassification(model_result[0])) {
-      return model_result;
-    } else {
-      return {{kOtherCollection, 1.0}};
-    }
+  if (datetime_parser_ != nullptr) {
+    stats.datetime_bytes = datetime_parser_->EstimateMemoryBytes();
   }
+  return stats;
+}
 
-  // No classifications.
-  return {};
+AnnotationQuality TextClassifier::ChooseAnnotationQuality(
+    const AnnotationOptions& options, int64 input_bytes) const {
+  if (quality_controller_ == nullptr) {
+    return AnnotationQuality::FULL;
+  }
+  int64 budget_micros = 0;
+  const auto tighten_budget = [&budget_micros](int64 micros) {
+    if (micros > 0 && (budget_micros == 0 || micros < budget_micros)) {
+      budget_micros = micros;
+    }
+  };
+  tighten_budget(annotation_latency_target_micros_);
+  tighten_budget(options.latency_budget_micros);
+  if (options.deadline.time != std::chrono::steady_clock::time_point::max()) {
+    // At least a microsecond, so that an expired deadline is a budget too.
+    tighten_budget(std::max<int64>(
+        1, std::chrono::duration_cast<std::chrono::microseconds>(
+               options.deadline.time - std::chrono::steady_clock::now())
+               .count()));
+  }
+  return quality_controller_->Choose(input_bytes, budget_micros,
+                                     options.lowest_quality);
 }
 
-bool TextClassifier::ModelAnnotate(const std::string& context,
-                                   InterpreterManager* interpreter_manager,
-                                   std::vector<Token>* tokens,
-                                   std::vector<AnnotatedSpan>* result) const {
-  if (model_->triggering_options() == nullptr ||
-      !(model_->triggering_options()->enabled_modes() & ModeFlag_ANNOTATION)) {
-    return true;
+std::vector<AnnotatedSpan> TextClassifier::Annotate(
+    StringPiece context, const AnnotationOptions& options) const {
+  ScopedRequestMetrics request_metrics(metrics_.get(), MetricsMode::ANNOTATE,
+                                       context.size());
+  if (options.partial_result != nullptr) {
+    *options.partial_result = false;
+  }
+  const AnnotationQuality quality =
+      ChooseAnnotationQuality(options, context.size());
+  if (options.quality != nullptr) {
+    *options.quality = quality;
   }
+  if (!(model_->enabled_modes() & ModeFlag_ANNOTATION)) {
+    return {};
+  }
+  const auto start = std::chrono::steady_clock::now();
 
-  const UnicodeText context_unicode = UTF8ToUnicodeText(context,
-                                                        /*do_copy=*/false);
-  std::vector<UnicodeTextRange> lines;
-  if (!selection_feature_processor_->GetOptions()->only_use_line_with_click()) {
-    lines.push_back({context_unicode.begin(), context_unicode.end()});
+  InterpreterManager interpreter_manager(
+      selection_interpreter_pool_.get(),
+      classification_interpreter_pool_.get());
+
+  // The scratch objects of the request are allocated from one arena, and
+  // freed together at the end.
+  ScopedRequestArena request_arena;
+  std::vector<AnnotatedSpan> result;
+  if (quality == AnnotationQuality::FULL) {
+    result = AnnotateInternal(context, options, &interpreter_manager,
+                              /*line_cache=*/nullptr);
   } else {
-    lines = selection_feature_processor_->SplitContext(context_unicode);
+    AnnotationOptions degraded_options = options;
+    degraded_options.annotators &= AnnotatorsForQuality(quality);
+    result = AnnotateInternal(context, degraded_options, &interpreter_manager,
+                              /*line_cache=*/nullptr);
+  }
+  if (quality_controller_ != nullptr) {
+    quality_controller_->Record(
+        quality, context.size(),
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start)
+            .count());
   }
+  for (const AnnotatedSpan& span : result) {
+    RecordResultMetrics(MetricsMode::ANNOTATE, span.classification);
+  }
+  return result;
+}
 
-  const float min_annotate_confidence =
-      (model_->triggering_options() != nullptr
-           ? model_->triggering_options()->min_annotate_confidence()
-           : 0.f);
+std::vector<std::vector<AnnotatedSpan>> TextClassifier::AnnotateBatch(
+    const std::vector<std::string>& contexts,
+    const AnnotationOptions& options) const {
+  std::vector<std::vector<AnnotatedSpan>> results(contexts.size());
+  if (options.partial_result != nullptr) {
+    *options.partial_result = false;
+  }
+  if (options.quality != nullptr) {
+    *options.quality = AnnotationQuality::FULL;
+  }
+  if (!(model_->enabled_modes() & ModeFlag_ANNOTATION)) {
+    return results;
+  }
+  const auto batch_start = std::chrono::steady_clock::now();
+
+  // One set of interpreters serves the whole batch, so that the checkout and
+  // the tensor allocations are paid once, not once per document.
+  InterpreterManager interpreter_manager(
+      selection_interpreter_pool_.get(),
+      classification_interpreter_pool_.get());
+  ScopedRequestArena request_arena;
+
+  // The lines of all the documents share the selection model batches.
+  std::vector<LineAnnotations> model_annotations;
+  if (AnnotatesWithModel(options) && UsesBoundsSensitiveSelection() &&
+      !ModelAnnotateBatch(contexts, options, &interpreter_manager,
+                          &model_annotations)) {
+    TC_LOG(ERROR) << "Couldn't run ModelAnnotateBatch.";
+    return results;
+  }
+
+  for (int i = 0; i < contexts.size(); ++i) {
+    results[i] = AnnotateInternal(
+        contexts[i], options, &interpreter_manager,
+        /*line_cache=*/nullptr,
+        model_annotations.empty() ? nullptr : &model_annotations[i]);
+  }
+
+  // Each document counts as an annotation request, which takes its share of
+  // the batch.
+  if (metrics_ != nullptr && !contexts.empty()) {
+    const int64 latency_micros =
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - batch_start)
+            .count() /
+        static_cast<int64>(contexts.size());
+    for (int i = 0; i < contexts.size(); ++i) {
+      metrics_->RecordRequest(MetricsMode::ANNOTATE, contexts[i].size(),
+                              latency_micros);
+      for (const AnnotatedSpan& span : results[i]) {
+        RecordResultMetrics(MetricsMode::ANNOTATE, span.classification);
+      }
+    }
+  }
+  return results;
+}
 
-  FeatureProcessor::EmbeddingCache embedding_cache;
-  for (const UnicodeTextRange& line : lines) {
-    const std::string line_str =
-        UnicodeText::UTF8Substring(line.first, line.second);
-
-    *tokens = selection_feature_processor_->Tokenize(line_str);
-    selection_feature_processor_->RetokenizeAndFindClick(
-        line_str, {0, std::distance(line.first, line.second)},
-        selection_feature_processor_->GetOptions()->only_use_line_with_click(),
-        tokens,
-        /*click_pos=*/nullptr);
-    const TokenSpan full_line_span = {0, tokens->size()};
-
-    // TODO(zilka): Add support for greater granularity of this check.
-    if (!selection_feature_processor_->HasEnoughSupportedCodepoints(
-            *tokens, full_line_span)) {
+bool TextClassifier::ModelAnnotateBatch(
+    const std::vector<std::string>& contexts, const AnnotationOptions& options,
+    InterpreterManager* interpreter_manager,
+    std::vector<LineAnnotations>* model_annotations) const {
+  std::vector<UnicodeText> contexts_unicode;
+  contexts_unicode.reserve(contexts.size());
+  std::vector<LineToAnnotate> lines;
+  std::vector<int> line_contexts;
+  for (int i = 0; i < contexts.size(); ++i) {
+    contexts_unicode.push_back(
+        UTF8ToUnicodeText(contexts[i], /*do_copy=*/false));
+  }
+  for (int i = 0; i < contexts.size(); ++i) {
+    const UnicodeText& context_unicode = contexts_unicode[i];
+    if (!context_unicode.is_valid()) {
       continue;
     }
-
-    std::unique_ptr<CachedFeatures> cached_features;
-    if (!selection_feature_processor_->ExtractFeatures(
-            *tokens, full_line_span,
-            /*selection_span_for_feature=*/{kInvalidIndex, kInvalidIndex},
-            embedding_executor_.get(),
-            /*embedding_cache=*/nullptr,
-            selection_feature_processor_->EmbeddingSize() +
-                selection_feature_processor_->DenseFeaturesCount(),
-            &cached_features)) {
-      TC_LOG(ERROR) << "Could not extract features.";
-      return false;
+    std::vector<UnicodeTextRange> context_lines;
+    if (!selection_feature_processor_->GetOptions()
+             ->only_use_line_with_click()) {
+      context_lines.push_back({context_unicode.begin(), context_unicode.end()});
+    } else {
+      context_lines = selection_feature_processor_->SplitContext(
+          context_unicode);
+    }
+    for (const UnicodeTextRange& line : context_lines) {
+      lines.push_back({&context_unicode, line, /*embedding_cache=*/nullptr});
+      line_contexts.push_back(i);
     }
+  }
 
-    std::vector<TokenSpan> local_chunks;
-    if (!ModelChunk(tokens->size(), /*span_of_interest=*/full_line_span,
-                    interpreter_manager->SelectionInterpreter(),
-                    *cached_features, &local_chunks)) {
-      TC_LOG(ERROR) << "Could not chunk.";
+  DeadlineCheck deadline(options.deadline);
+  std::vector<std::vector<Token>> line_tokens;
+  std::vector<std::vector<AnnotatedSpan>> line_results;
+  {
+    ScopedPhaseTrace trace(options.tracer, TracedPhase::MODEL_ANNOTATE);
+    if (!ModelAnnotateLinesBatched(lines, interpreter_manager, &deadline,
+                                   &line_tokens, &line_results)) {
       return false;
     }
+  }
+  if (deadline.StoppedEarly() && options.partial_result != nullptr) {
+    *options.partial_result = true;
+  }
 
-    const int offset = std::distance(context_unicode.begin(), line.first);
-    for (const TokenSpan& chunk : local_chunks) {
-      const CodepointSpan codepoint_span =
-          selection_feature_processor_->StripBoundaryCodepoints(
-              line_str, TokenSpanToCodepointSpan(*tokens, chunk));
-
-      // Skip empty spans.
-      if (codepoint_span.first != codepoint_span.second) {
-        std::vector<ClassificationResult> classification;
-        if (!ModelClassifyText(line_str, *tokens, codepoint_span,
-                               interpreter_manager, &embedding_cache,
-                               &classification)) {
-          TC_LOG(ERROR) << "Could not classify text: "
-                        << (codepoint_span.first + offset) << " "
-                        << (codepoint_span.second + offset);
-          return false;
-        }
-
-        // Do not include the span if it's classified as "other".
-        if (!classification.empty() && !ClassifiedAsOther(classification) &&
-            classification[0].score >= min_annotate_confidence) {
-          AnnotatedSpan result_span;
-          result_span.span = {codepoint_span.first + offset,
-                              codepoint_span.second + offset};
-          result_span.classification = std::move(classification);
-          result->push_back(std::move(result_span));
-        }
-      }
-    }
+  // As ModelAnnotate() does, keeps the tokens of the last line of each
+  // context.
+  model_annotations->clear();
+  model_annotations->resize(contexts.size());
+  for (int i = 0; i < lines.size(); ++i) {
+    LineAnnotations* context_annotations =
+        &(*model_annotations)[line_contexts[i]];
+    std::move(line_results[i].begin(), line_results[i].end(),
+              std::back_inserter(context_annotations->annotations));
+    context_annotations->tokens = std::move(line_tokens[i]);
   }
   return true;
 }
 
-const FeatureProcessor* TextClassifier::SelectionFeatureProcessorForTests()
-    const {
-  return selection_feature_processor_.get();
-}
-
-const FeatureProcessor* TextClassifier::ClassificationFeatureProcessorForTests()
-    const {
-  return classification_feature_processor_.get();
-}
-
-const DatetimeParser* TextClassifier::DatetimeParserForTests() const {
-  return datetime_parser_.get();
+bool TextClassifier::AnnotatesWithModel(
+    const AnnotationOptions& options) const {
+  if (!(options.annotators & ANNOTATOR_MODEL) ||
+      model_->triggering_options() == nullptr ||
+      !(model_->triggering_options()->enabled_modes() & ModeFlag_ANNOTATION)) {
+    return false;
+  }
+  if (options.collections.empty()) {
+    return true;
+  }
+  if (classification_feature_processor_ == nullptr) {
+    return false;
+  }
+  // The spans that the classification model puts into the other collection
+  // are dropped anyway.
+  for (int i = 0; i < classification_feature_processor_->NumCollections();
+       ++i) {
+    const std::string& collection =
+        classification_feature_processor_->LabelToCollection(i);
+    if (collection != kOtherCollection &&
+        WantsCollection(options, collection)) {
+      return true;
+    }
+  }
+  return false;
 }
 
-std::vector<AnnotatedSpan> TextClassifier::Annotate(
-    const std::string& context, const AnnotationOptions& options) const {
+std::vector<AnnotatedSpan> TextClassifier::AnnotateInternal(
+    StringPiece context, const AnnotationOptions& options,
+    InterpreterManager* interpreter_manager, LineAnnotationCache* line_cache,
+    LineAnnotations* model_annotations) const {
   std::vector<AnnotatedSpan> candidates;
 
-  if (!(model_->enabled_modes() & ModeFlag_ANNOTATION)) {
-    return {};
-  }
-
   if (!UTF8ToUnicodeText(context, /*do_copy=*/false).is_valid()) {
     return {};
   }
 
-  InterpreterManager interpreter_manager(selection_executor_.get(),
-                                         classification_executor_.get());
+  // Shared by the model annotation and the conflict resolution below.
+  FeatureProcessor::EmbeddingCache embedding_cache;
+
+  DeadlineCheck deadline(options.deadline);
+
   // Annotate with the selection model.
   std::vector<Token> tokens;
-  if (!ModelAnnotate(context, &interpreter_manager, &tokens, &candidates)) {
-    TC_LOG(ERROR) << "Couldn't run ModelAnnotate.";
-    return {};
-  }
-
-  // Annotate with the regular expression models.
-  if (!RegexChunk(UTF8ToUnicodeText(context, /*do_copy=*/false),
-                  annotation_regex_patterns_, &candidates)) {
-    TC_LOG(ERROR) << "Couldn't run RegexChunk.";
-    return {};
+  const bool run_model = AnnotatesWithModel(options);
+  const auto annotate_with_model = [&]() {
+    if (!run_model) {
+      return true;
+    }
+    ScopedPhaseTrace trace(options.tracer, TracedPhase::MODEL_ANNOTATE);
+    if (model_annotations != nullptr) {
+      candidates = std::move(model_annotations->annotations);
+      tokens = std::move(model_annotations->tokens);
+    } else if (!ModelAnnotate(context, options, interpreter_manager,
+                              &embedding_cache, line_cache, &deadline, &tokens,
+                              &candidates)) {
+      TC_LOG(ERROR) << "Couldn't run ModelAnnotate.";
+      return false;
+    }
+    trace.SetResults(candidates.size());
+    return true;
+  };
+
+  // The regex and datetime models share the input converted for the regex
+  // matchers.
+  const std::unique_ptr<UniLib::RegexInput> context_regex_input =
+      unilib_->CreateRegexInput(UTF8ToUnicodeText(context, /*do_copy=*/false));
+
+  // Annotate with the regular expression models, restricted to the rules of
+  // the wanted collections.
+  std::vector<int> wanted_rules;
+  if (!options.collections.empty()) {
+    for (int i = 0; i < annotation_regex_patterns_.size(); ++i) {
+      if (WantsCollection(
+              options,
+              regex_patterns_[annotation_regex_patterns_[i]].collection_name)) {
+        wanted_rules.push_back(i);
+      }
+    }
   }
+  const bool run_regex = (options.annotators & ANNOTATOR_REGEX) &&
+                         (options.collections.empty() || !wanted_rules.empty());
+  std::vector<AnnotatedSpan> regex_candidates;
+  const auto annotate_with_regex = [&]() {
+    if (!run_regex) {
+      return true;
+    }
+    ScopedPhaseTrace trace(options.tracer, TracedPhase::REGEX);
+    if (!AnnotationRegexChunk(UTF8ToUnicodeText(context, /*do_copy=*/false),
+                              *context_regex_input,
+                              options.collections.empty() ? nullptr
+                                                          : &wanted_rules,
+                              options.task_runner,
+                              options.max_shards, &deadline,
+                              &regex_candidates)) {
+      TC_LOG(ERROR) << "Couldn't run RegexChunk.";
+      return false;
+    }
+    trace.SetResults(regex_candidates.size());
+    return true;
+  };
 
   // Annotate with the datetime model.
-  if (!DatetimeChunk(UTF8ToUnicodeText(context, /*do_copy=*/false),
-                     options.reference_time_ms_utc, options.reference_timezone,
-                     options.locales, ModeFlag_ANNOTATION, &candidates)) {
-    TC_LOG(ERROR) << "Couldn't run RegexChunk.";
-    return {};
-  }
+  const bool run_datetime = (options.annotators & ANNOTATOR_DATETIME) &&
+                            WantsCollection(options, kDateCollection);
+  std::vector<AnnotatedSpan> datetime_candidates;
+  const auto annotate_with_datetime = [&]() {
+    if (!run_datetime || deadline.Expired()) {
+      return true;
+    }
+    ScopedPhaseTrace trace(options.tracer, TracedPhase::DATETIME);
+    if (!DatetimeChunk(*context_regex_input, options.reference_time_ms_utc,
+                       options.reference_timezone, options.locales,
+                       ModeFlag_ANNOTATION, &datetime_candidates)) {
+      TC_LOG(ERROR) << "Couldn't run RegexChunk.";
+      return false;
+    }
+    trace.SetResults(datetime_candidates.size());
+    return true;
+  };
 
-  // Sort candidates according to their position in the input, so that the next
-  // code can assume that any connected component of overlapping spans forms a
-  // contiguous block.
-  std::sort(candidates.begin(), candidates.end(),
-            [](const AnnotatedSpan& a, const AnnotatedSpan& b) {
-              return a.span.first < b.span.first;
-            });
+  if (options.task_runner == nullptr) {
+    if (!annotate_with_model() || !annotate_with_regex() ||
+        !annotate_with_datetime()) {
+      return {};
+    }
+  } else {
+    // The candidates are put together in the serial order below, so the
+    // order of the tasks doesn't change the result.
+    std::atomic<bool> success(true);
+    options.task_runner->RunAll({
+        [&]() {
+          if (!annotate_with_model()) {
+            success = false;
+          }
+        },
+        [&]() {
+          if (!annotate_with_regex()) {
+            success = false;
+          }
+        },
+        [&]() {
+          if (!annotate_with_datetime()) {
+            success = false;
+          }
+        },
+    });
+    if (!success) {
+      return {};
+    }
+  }
+  candidates.reserve(candidates.size() + regex_candidates.size() +
+                     datetime_candidates.size());
+  std::move(regex_candidates.begin(), regex_candidates.end(),
+            std::back_inserter(candidates));
+  std::move(datetime_candidates.begin(), datetime_candidates.end(),
+            std::back_inserter(candidates));
+  if (deadline.StoppedEarly() && options.partial_result != nullptr) {
+    *options.partial_result = true;
+  }
 
   std::vector<int> candidate_indices;
-  if (!ResolveConflicts(candidates, context, tokens, &interpreter_manager,
-                        &candidate_indices)) {
-    TC_LOG(ERROR) << "Couldn't resolve conflicts.";
-    return {};
-  }
+  {
+    ScopedPhaseTrace trace(options.tracer, TracedPhase::RESOLVE_CONFLICTS);
+    // Sort candidates according to their position in the input, so that the
+    // next code can assume that any connected component of overlapping spans
+    // forms a contiguous block.
+    int num_avoided_classifications = 0;
+    internal::SortAndMergeDuplicateCandidates(&candidates,
+                                              &num_avoided_classifications);
+    if (PhaseCounters* counters = TracedPhaseCounters()) {
+      counters->avoided_classifications += num_avoided_classifications;
+    }
+    if (!ResolveConflicts(candidates, context, tokens, interpreter_manager,
+                          &embedding_cache, &candidate_indices)) {
+      TC_LOG(ERROR) << "Couldn't resolve conflicts.";
+      return {};
+    }
+    trace.SetResults(candidate_indices.size());
+  }
+  TC_VLOG(1) << "Embedding cache hits: " << embedding_cache.num_hits()
+             << ", misses: " << embedding_cache.num_misses();
 
   std::vector<AnnotatedSpan> result;
   result.reserve(candidate_indices.size());
   for (const int i : candidate_indices) {
     if (!candidates[i].classification.empty() &&
         !ClassifiedAsOther(candidates[i].classification) &&
-        !FilteredForAnnotation(candidates[i])) {
+        !FilteredForAnnotation(candidates[i]) &&
+        WantsCollection(options,
+                        candidates[i].classification[0].collection)) {
       result.push_back(std::move(candidates[i]));
     }
   }
@@ -1265,55 +3263,231 @@ std::vector<AnnotatedSpan> TextClassifier::Annotate(
   return result;
 }
 
-bool TextClassifier::RegexChunk(const UnicodeText& context_unicode,
+std::vector<AnnotatedSpan> AnnotationSession::Annotate(
+    StringPiece context, const AnnotationOptions& options) {
+  if (options.partial_result != nullptr) {
+    *options.partial_result = false;
+  }
+  if (options.quality != nullptr) {
+    *options.quality = AnnotationQuality::FULL;
+  }
+  if (!(classifier_->model_->enabled_modes() & ModeFlag_ANNOTATION)) {
+    return {};
+  }
+
+  InterpreterManager interpreter_manager(
+      classifier_->selection_interpreter_pool_.get(),
+      classifier_->classification_interpreter_pool_.get());
+  ScopedRequestArena request_arena;
+  return classifier_->AnnotateInternal(context, options, &interpreter_manager,
+                                       &line_cache_);
+}
+
+CodepointSpan SelectionSession::SuggestSelection(
+    StringPiece context, CodepointSpan click_indices,
+    const SelectionOptions& options) {
+  const uint64 context_fingerprint = tc2farmhash::Fingerprint64(context);
+  if (context_fingerprint != cache_.context_fingerprint ||
+      context.size() != cache_.context_size) {
+    cache_.context_fingerprint = context_fingerprint;
+    cache_.context_size = context.size();
+    cache_.tokens.clear();
+    cache_.selection_embedding_cache.clear();
+    cache_.classification_embedding_cache.clear();
+    cache_.chunk_scores.clear();
+  }
+  cache_.num_scored_chunks = 0;
+  cache_.num_reused_chunks = 0;
+
+  InterpreterManager interpreter_manager(
+      classifier_->selection_interpreter_pool_.get(),
+      classifier_->classification_interpreter_pool_.get());
+  ScopedRequestMetrics request_metrics(classifier_->metrics_.get(),
+                                       MetricsMode::SUGGEST_SELECTION,
+                                       context.size());
+  ScopedRequestArena request_arena;
+  std::vector<Token> tokens;
+  return classifier_->SuggestSelectionInternal(
+      context, click_indices, options, &interpreter_manager,
+      &cache_.classification_embedding_cache, &cache_, &tokens);
+}
+
+bool TextClassifier::RegexChunk(const UniLib::RegexInput& context_input,
                                 const std::vector<int>& rules,
+                                DeadlineCheck* deadline,
                                 std::vector<AnnotatedSpan>* result) const {
+  ScopedStageTimer timer(ProfiledStage::REGEX);
   for (int pattern_id : rules) {
-    const CompiledRegexPattern& regex_pattern = regex_patterns_[pattern_id];
-    const auto matcher = regex_pattern.pattern->Matcher(context_unicode);
-    if (!matcher) {
-      TC_LOG(ERROR) << "Could not get regex matcher for pattern: "
-                    << pattern_id;
+    if (deadline != nullptr && deadline->Expired()) {
+      return true;
+    }
+    if (!RegexChunkForPattern(context_input, pattern_id, result)) {
       return false;
     }
+  }
+  return true;
+}
 
-    int status = UniLib::RegexMatcher::kNoError;
-    while (matcher->Find(&status) && status == UniLib::RegexMatcher::kNoError) {
+bool TextClassifier::RegexChunkForPattern(
+    const UniLib::RegexInput& context_input, int pattern_id,
+    std::vector<AnnotatedSpan>* result) const {
+  const CompiledRegexPattern& regex_pattern = regex_patterns_[pattern_id];
+  if (!regex_pattern.pattern->MayMatch(context_input)) {
+    return true;
+  }
+  if (PhaseCounters* counters = TracedPhaseCounters()) {
+    ++counters->rules;
+  }
+  const auto matcher = regex_pattern.pattern->Matcher(context_input);
+  if (!matcher) {
+    TC_LOG(ERROR) << "Could not get regex matcher for pattern: " << pattern_id;
+    return false;
+  }
+  LimitRegexMatcher(matcher.get());
+
+  int status = UniLib::RegexMatcher::kNoError;
+  while (matcher->Find(&status) && status == UniLib::RegexMatcher::kNoError) {
+    result->emplace_back();
+    // Selection/annotation regular expressions need to specify a capturing
+    // group specifying the selection.
+    result->back().span = {matcher->Start(1, &status),
+                           matcher->End(1, &status)};
+    result->back().classification = {
+        {regex_pattern.collection_name,
+         regex_pattern.target_classification_score,
+         regex_pattern.priority_score}};
+    result->back().source = AnnotatedSpan::Source::REGEX;
+  }
+  // The matches before the one that timed out are kept.
+  if (status == UniLib::RegexMatcher::kTimeout) {
+    RecordRegexTimeout();
+  }
+  return true;
+}
+
+bool TextClassifier::AnnotationRegexChunk(
+    const UnicodeText& context_unicode, const UniLib::RegexInput& context_input,
+    const std::vector<int>* rules, TaskRunner* task_runner, int max_shards,
+    DeadlineCheck* deadline, std::vector<AnnotatedSpan>* result) const {
+  const int num_rules =
+      rules != nullptr ? rules->size() : annotation_regex_patterns_.size();
+  const auto rule_at = [rules](int i) {
+    return rules != nullptr ? (*rules)[i] : i;
+  };
+  if (annotation_multi_regex_ == nullptr && task_runner != nullptr &&
+      max_shards > 1 && num_rules > 1) {
+    // Consecutive groups of the rules, whose matches are appended in the
+    // order of the rules.
+    const std::vector<std::pair<int, int>> shards =
+        ShardRanges(num_rules, /*granularity=*/1, max_shards);
+    std::vector<std::vector<AnnotatedSpan>> shard_results(shards.size());
+    std::atomic<bool> success(true);
+    std::vector<std::function<void()>> tasks;
+    for (int i = 0; i < shards.size(); ++i) {
+      tasks.push_back([&, i]() {
+        std::vector<int> shard_rules;
+        for (int j = shards[i].first; j < shards[i].second; ++j) {
+          shard_rules.push_back(annotation_regex_patterns_[rule_at(j)]);
+        }
+        if (!RegexChunk(context_input, shard_rules, deadline,
+                        &shard_results[i])) {
+          success = false;
+        }
+      });
+    }
+    task_runner->RunAll(tasks);
+    for (std::vector<AnnotatedSpan>& shard_result : shard_results) {
+      std::move(shard_result.begin(), shard_result.end(),
+                std::back_inserter(*result));
+    }
+    return success;
+  }
+  if (annotation_multi_regex_ == nullptr) {
+    if (rules == nullptr) {
+      return RegexChunk(context_input, annotation_regex_patterns_, deadline,
+                        result);
+    }
+    std::vector<int> pattern_ids;
+    for (const int i : *rules) {
+      pattern_ids.push_back(annotation_regex_patterns_[i]);
+    }
+    return RegexChunk(context_input, pattern_ids, deadline, result);
+  }
+  // The patterns run together in one pass, so the deadline is only checked
+  // before the pass and before the patterns that the engine doesn't support.
+  if (deadline->Expired()) {
+    return true;
+  }
+
+  ScopedStageTimer timer(ProfiledStage::REGEX);
+  std::vector<int> multi_regex_patterns;
+  for (int k = 0; k < num_rules; ++k) {
+    const int i = rule_at(k);
+    if (annotation_multi_regex_->Supports(i) &&
+        regex_patterns_[annotation_regex_patterns_[i]].pattern->MayMatch(
+            context_input)) {
+      multi_regex_patterns.push_back(i);
+    }
+  }
+  if (PhaseCounters* counters = TracedPhaseCounters()) {
+    counters->rules += multi_regex_patterns.size();
+  }
+  std::vector<MultiRegex::Match> matches;
+  annotation_multi_regex_->FindAll(context_unicode, multi_regex_patterns,
+                                   &matches);
+
+  // Keep the order of RegexChunk(): by pattern, then by position.
+  auto match_it = matches.begin();
+  for (int k = 0; k < num_rules; ++k) {
+    const int i = rule_at(k);
+    const int pattern_id = annotation_regex_patterns_[i];
+    if (!annotation_multi_regex_->Supports(i)) {
+      if (deadline->Expired()) {
+        continue;
+      }
+      if (!RegexChunkForPattern(context_input, pattern_id, result)) {
+        return false;
+      }
+      continue;
+    }
+    const CompiledRegexPattern& regex_pattern = regex_patterns_[pattern_id];
+    for (; match_it != matches.end() && match_it->pattern == i; ++match_it) {
       result->emplace_back();
-      // Selection/annotation regular expressions need to specify a capturing
-      // group specifying the selection.
-      result->back().span = {matcher->Start(1, &status),
-                             matcher->End(1, &status)};
+      result->back().span = {match_it->group_start, match_it->group_end};
       result->back().classification = {
           {regex_pattern.collection_name,
            regex_pattern.target_classification_score,
            regex_pattern.priority_score}};
+      result->back().source = AnnotatedSpan::Source::REGEX;
     }
   }
   return true;
 }
 
-bool TextClassifier::ModelChunk(int num_tokens,
-                                const TokenSpan& span_of_interest,
-                                tflite::Interpreter* selection_interpreter,
-                                const CachedFeatures& cached_features,
-                                std::vector<TokenSpan>* chunks) const {
+TokenSpan TextClassifier::ModelInferenceSpan(
+    int num_tokens, const TokenSpan& span_of_interest) const {
   const int max_selection_span =
       selection_feature_processor_->GetOptions()->max_selection_span();
   // The inference span is the span of interest expanded to include
   // max_selection_span tokens on either side, which is how far a selection can
   // stretch from the click.
-  const TokenSpan inference_span = IntersectTokenSpans(
+  return IntersectTokenSpans(
       ExpandTokenSpan(span_of_interest,
                       /*num_tokens_left=*/max_selection_span,
                       /*num_tokens_right=*/max_selection_span),
       {0, num_tokens});
+}
+
+bool TextClassifier::ModelChunk(int num_tokens,
+                                const TokenSpan& span_of_interest,
+                                tflite::Interpreter* selection_interpreter,
+                                const CachedFeatures& cached_features,
+                                std::vector<TokenSpan>* chunks) const {
+  const TokenSpan inference_span =
+      ModelInferenceSpan(num_tokens, span_of_interest);
 
   std::vector<ScoredChunk> scored_chunks;
-  if (selection_feature_processor_->GetOptions()->bounds_sensitive_features() &&
-      selection_feature_processor_->GetOptions()
-          ->bounds_sensitive_features()
-          ->enabled()) {
+  if (UsesBoundsSensitiveSelection()) {
     if (!ModelBoundsSensitiveScoreChunks(
             num_tokens, span_of_interest, inference_span, cached_features,
             selection_interpreter, &scored_chunks)) {
@@ -1326,7 +3500,102 @@ bool TextClassifier::ModelChunk(int num_tokens,
       return false;
     }
   }
-  std::sort(scored_chunks.rbegin(), scored_chunks.rend(),
+  SelectNonOverlappingChunks(inference_span, &scored_chunks, chunks);
+  return true;
+}
+
+namespace {
+// Returns the key of the tokens that the bounds-sensitive features of 'span'
+// read, from 'num_tokens_before' tokens before it to 'num_tokens_after' after
+// it, with the ones outside of the extraction span as padding. Uses 'buffer'
+// as scratch space.
+uint64 BoundsSensitiveFeaturesKey(const std::vector<Token>& tokens,
+                                  const TokenSpan& extraction_span,
+                                  const TokenSpan& span, int num_tokens_before,
+                                  int num_tokens_after,
+                                  std::vector<CodepointIndex>* buffer) {
+  buffer->clear();
+  buffer->push_back(TokenSpanSize(span));
+  for (int i = span.first - num_tokens_before;
+       i < span.second + num_tokens_after; ++i) {
+    if (i >= extraction_span.first && i < extraction_span.second) {
+      buffer->push_back(tokens[i].start);
+      buffer->push_back(tokens[i].end);
+    } else {
+      buffer->push_back(kInvalidIndex);
+      buffer->push_back(kInvalidIndex);
+    }
+  }
+  return tc2farmhash::Fingerprint64(
+      reinterpret_cast<const char*>(buffer->data()),
+      buffer->size() * sizeof(CodepointIndex));
+}
+}  // namespace
+
+bool TextClassifier::ModelChunkWithSelectionCache(
+    const std::vector<Token>& tokens, const TokenSpan& span_of_interest,
+    tflite::Interpreter* selection_interpreter,
+    const CachedFeatures& cached_features, SelectionCache* selection_cache,
+    std::vector<TokenSpan>* chunks) const {
+  if (!UsesBoundsSensitiveSelection()) {
+    return ModelChunk(tokens.size(), span_of_interest, selection_interpreter,
+                      cached_features, chunks);
+  }
+
+  const TokenSpan inference_span =
+      ModelInferenceSpan(tokens.size(), span_of_interest);
+  std::vector<TokenSpan> candidate_spans;
+  std::vector<ScoredChunk> scored_chunks;
+  BoundsSensitiveCandidateSpans(span_of_interest, inference_span,
+                                &candidate_spans, &scored_chunks);
+
+  const FeatureProcessorOptions_::BoundsSensitiveFeatures* config =
+      selection_feature_processor_->GetOptions()->bounds_sensitive_features();
+  std::vector<CodepointIndex> key_buffer;
+  std::vector<uint64> keys;
+  keys.reserve(candidate_spans.size());
+  std::vector<TokenSpan> unscored_spans;
+  for (const TokenSpan& candidate_span : candidate_spans) {
+    keys.push_back(BoundsSensitiveFeaturesKey(
+        tokens, cached_features.ExtractionSpan(), candidate_span,
+        config->num_tokens_before(), config->num_tokens_after(), &key_buffer));
+    if (selection_cache->chunk_scores.find(keys.back()) ==
+        selection_cache->chunk_scores.end()) {
+      unscored_spans.push_back(candidate_span);
+    }
+  }
+
+  std::vector<ScoredChunk> new_scored_chunks;
+  if (!ScoreBoundsSensitiveCandidateSpans(
+          unscored_spans, /*begin=*/0, /*end=*/unscored_spans.size(),
+          cached_features, selection_interpreter, &new_scored_chunks)) {
+    return false;
+  }
+  selection_cache->num_scored_chunks += new_scored_chunks.size();
+  selection_cache->num_reused_chunks +=
+      candidate_spans.size() - new_scored_chunks.size();
+
+  // In the order of ModelBoundsSensitiveScoreChunks(), for the same choice
+  // between equal scores.
+  scored_chunks.reserve(scored_chunks.size() + candidate_spans.size());
+  int next_new_scored_chunk = 0;
+  for (int i = 0; i < candidate_spans.size(); ++i) {
+    auto it = selection_cache->chunk_scores.find(keys[i]);
+    if (it == selection_cache->chunk_scores.end()) {
+      const float score = new_scored_chunks[next_new_scored_chunk++].score;
+      it = selection_cache->chunk_scores.emplace(keys[i], score).first;
+    }
+    scored_chunks.push_back(ScoredChunk{candidate_spans[i], it->second});
+  }
+
+  SelectNonOverlappingChunks(inference_span, &scored_chunks, chunks);
+  return true;
+}
+
+void TextClassifier::SelectNonOverlappingChunks(
+    const TokenSpan& inference_span, std::vector<ScoredChunk>* scored_chunks,
+    std::vector<TokenSpan>* chunks) {
+  std::sort(scored_chunks->rbegin(), scored_chunks->rend(),
             [](const ScoredChunk& lhs, const ScoredChunk& rhs) {
               return lhs.score < rhs.score;
             });
@@ -1336,7 +3605,7 @@ bool TextClassifier::ModelChunk(int num_tokens,
   // chunks.
   std::vector<bool> token_used(TokenSpanSize(inference_span));
   chunks->clear();
-  for (const ScoredChunk& scored_chunk : scored_chunks) {
+  for (const ScoredChunk& scored_chunk : *scored_chunks) {
     bool feasible = true;
     for (int i = scored_chunk.token_span.first;
          i < scored_chunk.token_span.second; ++i) {
@@ -1359,25 +3628,8 @@ bool TextClassifier::ModelChunk(int num_tokens,
   }
 
   std::sort(chunks->begin(), chunks->end());
-
-  return true;
 }
 
-namespace {
-// Updates the value at the given key in the map to maximum of the current value
-// and the given value, or simply inserts the value if the key is not yet there.
-template <typename Map>
-void UpdateMax(Map* map, typename Map::key_type key,
-               typename Map::mapped_type value) {
-  const auto it = map->find(key);
-  if (it != map->end()) {
-    it->second = std::max(it->second, value);
-  } else {
-    (*map)[key] = value;
-  }
-}
-}  // namespace
-
 bool TextClassifier::ModelClickContextScoreChunks(
     int num_tokens, const TokenSpan& span_of_interest,
     const CachedFeatures& cached_features,
@@ -1385,26 +3637,49 @@ bool TextClassifier::ModelClickContextScoreChunks(
     std::vector<ScoredChunk>* scored_chunks) const {
   const int max_batch_size = model_->selection_options()->batch_size();
 
-  std::vector<float> all_features;
-  std::map<TokenSpan, float> chunk_scores;
+  const int features_size = cached_features.OutputFeaturesSize();
+  const std::vector<TokenSpan>& label_spans =
+      selection_feature_processor_->GetSelectionLabelSpans();
+  std::vector<float> scores(label_spans.size());
+
+  // The max score of each candidate chunk, in a dense grid indexed by the
+  // start of the chunk relative to 'min_start' and its length minus one. The
+  // chunks around a click are at most max_selection_span + 1 tokens long with
+  // the reduced output space, 2 * max_selection_span + 1 otherwise, and start
+  // at most max_selection_span tokens before it. The scores are
+  // probabilities, so a negative one marks a chunk that was not seen.
+  const int max_selection_span =
+      selection_feature_processor_->GetOptions()->max_selection_span();
+  const int num_lengths = selection_feature_processor_->GetOptions()
+                                  ->selection_reduced_output_space()
+                              ? max_selection_span + 1
+                              : 2 * max_selection_span + 1;
+  const int min_start =
+      std::max(0, span_of_interest.first - max_selection_span);
+  const int num_starts = std::max(0, span_of_interest.second - min_start);
+  std::vector<float> chunk_scores(num_starts * num_lengths, -1.0f);
+  int num_chunks = 0;
   for (int batch_start = span_of_interest.first;
        batch_start < span_of_interest.second; batch_start += max_batch_size) {
     const int batch_end =
         std::min(batch_start + max_batch_size, span_of_interest.second);
+    const int batch_size = batch_end - batch_start;
 
-    // Prepare features for the whole batch.
-    all_features.clear();
-    all_features.reserve(max_batch_size * cached_features.OutputFeaturesSize());
+    // Prepare features for the whole batch, directly in the input tensor.
+    const FeaturesInput batch_input = selection_executor_->PrepareFeaturesInput(
+        {batch_size, features_size}, selection_interpreter);
+    if (!batch_input.is_valid()) {
+      TC_LOG(ERROR) << "Couldn't prepare the model input.";
+      return false;
+    }
     for (int click_pos = batch_start; click_pos < batch_end; ++click_pos) {
-      cached_features.AppendClickContextFeaturesForClick(click_pos,
-                                                         &all_features);
+      cached_features.AppendClickContextFeaturesForClick(
+          click_pos, batch_input, click_pos - batch_start);
     }
 
     // Run batched inference.
-    const int batch_size = batch_end - batch_start;
-    const int features_size = cached_features.OutputFeaturesSize();
-    TensorView<float> logits = selection_executor_->ComputeLogits(
-        TensorView<float>(all_features.data(), {batch_size, features_size}),
+    TensorView<float> logits = ComputeLogitsFromInputForStage(
+        ProfiledStage::SELECTION_MODEL, *selection_executor_, batch_size,
         selection_interpreter);
     if (!logits.is_valid()) {
       TC_LOG(ERROR) << "Couldn't compute logits.";
@@ -1419,40 +3694,47 @@ bool TextClassifier::ModelClickContextScoreChunks(
 
     // Save results.
     for (int click_pos = batch_start; click_pos < batch_end; ++click_pos) {
-      const std::vector<float> scores = ComputeSoftmax(
-          logits.data() + logits.dim(1) * (click_pos - batch_start),
-          logits.dim(1));
-      for (int j = 0;
-           j < selection_feature_processor_->GetSelectionLabelCount(); ++j) {
-        TokenSpan relative_token_span;
-        if (!selection_feature_processor_->LabelToTokenSpan(
-                j, &relative_token_span)) {
+      ComputeSoftmax(logits.data() + logits.dim(1) * (click_pos - batch_start),
+                     logits.dim(1), scores.data());
+      for (int j = 0; j < label_spans.size(); ++j) {
+        const int start = click_pos - label_spans[j].first;
+        const int length = label_spans[j].first + label_spans[j].second + 1;
+        if (start < 0 || start + length > num_tokens) {
+          continue;
+        }
+        if (start < min_start || length > num_lengths) {
           TC_LOG(ERROR) << "Couldn't map the label to a token span.";
           return false;
         }
-        const TokenSpan candidate_span = ExpandTokenSpan(
-            SingleTokenSpan(click_pos), relative_token_span.first,
-            relative_token_span.second);
-        if (candidate_span.first >= 0 && candidate_span.second <= num_tokens) {
-          UpdateMax(&chunk_scores, candidate_span, scores[j]);
+        float* chunk_score =
+            &chunk_scores[(start - min_start) * num_lengths + length - 1];
+        if (*chunk_score < 0) {
+          ++num_chunks;
         }
+        *chunk_score = std::max(*chunk_score, scores[j]);
       }
     }
   }
 
+  // In the order of the spans, as for a map keyed by them.
   scored_chunks->clear();
-  scored_chunks->reserve(chunk_scores.size());
-  for (const auto& entry : chunk_scores) {
-    scored_chunks->push_back(ScoredChunk{entry.first, entry.second});
+  scored_chunks->reserve(num_chunks);
+  for (int i = 0; i < num_starts; ++i) {
+    for (int k = 0; k < num_lengths; ++k) {
+      const float chunk_score = chunk_scores[i * num_lengths + k];
+      if (chunk_score >= 0) {
+        scored_chunks->push_back(ScoredChunk{
+            {min_start + i, min_start + i + k + 1}, chunk_score});
+      }
+    }
   }
 
   return true;
 }
 
-bool TextClassifier::ModelBoundsSensitiveScoreChunks(
-    int num_tokens, const TokenSpan& span_of_interest,
-    const TokenSpan& inference_span, const CachedFeatures& cached_features,
-    tflite::Interpreter* selection_interpreter,
+void TextClassifier::BoundsSensitiveCandidateSpans(
+    const TokenSpan& span_of_interest, const TokenSpan& inference_span,
+    std::vector<TokenSpan>* candidate_spans,
     std::vector<ScoredChunk>* scored_chunks) const {
   const int max_selection_span =
       selection_feature_processor_->GetOptions()->max_selection_span();
@@ -1470,12 +3752,11 @@ bool TextClassifier::ModelBoundsSensitiveScoreChunks(
     scored_chunks->reserve(TokenSpanSize(span_of_interest));
   }
 
-  // Prepare all chunk candidates into one batch:
+  // The chunk candidates:
   //   - Are contained in the inference span
   //   - Have a non-empty intersection with the span of interest
   //   - Are at least one token long
   //   - Are not longer than the maximum chunk length
-  std::vector<TokenSpan> candidate_spans;
   for (int start = inference_span.first; start < span_of_interest.second;
        ++start) {
     const int leftmost_end_index = std::max(start, span_of_interest.first) + 1;
@@ -1489,33 +3770,54 @@ bool TextClassifier::ModelBoundsSensitiveScoreChunks(
         // for it directly to the output.
         scored_chunks->push_back(ScoredChunk{candidate_span, 0.0f});
       } else {
-        candidate_spans.push_back(candidate_span);
+        candidate_spans->push_back(candidate_span);
       }
     }
   }
+}
+
+bool TextClassifier::ModelBoundsSensitiveScoreChunks(
+    int num_tokens, const TokenSpan& span_of_interest,
+    const TokenSpan& inference_span, const CachedFeatures& cached_features,
+    tflite::Interpreter* selection_interpreter,
+    std::vector<ScoredChunk>* scored_chunks) const {
+  std::vector<TokenSpan> candidate_spans;
+  BoundsSensitiveCandidateSpans(span_of_interest, inference_span,
+                                &candidate_spans, scored_chunks);
+  return ScoreBoundsSensitiveCandidateSpans(
+      candidate_spans, /*begin=*/0, /*end=*/candidate_spans.size(),
+      cached_features, selection_interpreter, scored_chunks);
+}
 
+bool TextClassifier::ScoreBoundsSensitiveCandidateSpans(
+    const std::vector<TokenSpan>& candidate_spans, int begin, int end,
+    const CachedFeatures& cached_features,
+    tflite::Interpreter* selection_interpreter,
+    std::vector<ScoredChunk>* scored_chunks) const {
   const int max_batch_size = model_->selection_options()->batch_size();
 
-  std::vector<float> all_features;
-  scored_chunks->reserve(scored_chunks->size() + candidate_spans.size());
-  for (int batch_start = 0; batch_start < candidate_spans.size();
+  const int features_size = cached_features.OutputFeaturesSize();
+  scored_chunks->reserve(scored_chunks->size() + end - begin);
+  for (int batch_start = begin; batch_start < end;
        batch_start += max_batch_size) {
-    const int batch_end = std::min(batch_start + max_batch_size,
-                                   static_cast<int>(candidate_spans.size()));
+    const int batch_end = std::min(batch_start + max_batch_size, end);
+    const int batch_size = batch_end - batch_start;
 
-    // Prepare features for the whole batch.
-    all_features.clear();
-    all_features.reserve(max_batch_size * cached_features.OutputFeaturesSize());
+    // Prepare features for the whole batch, directly in the input tensor.
+    const FeaturesInput batch_input = selection_executor_->PrepareFeaturesInput(
+        {batch_size, features_size}, selection_interpreter);
+    if (!batch_input.is_valid()) {
+      TC_LOG(ERROR) << "Couldn't prepare the model input.";
+      return false;
+    }
     for (int i = batch_start; i < batch_end; ++i) {
-      cached_features.AppendBoundsSensitiveFeaturesForSpan(candidate_spans[i],
-                                                           &all_features);
+      cached_features.AppendBoundsSensitiveFeaturesForSpan(
+          candidate_spans[i], batch_input, i - batch_start);
     }
 
     // Run batched inference.
-    const int batch_size = batch_end - batch_start;
-    const int features_size = cached_features.OutputFeaturesSize();
-    TensorView<float> logits = selection_executor_->ComputeLogits(
-        TensorView<float>(all_features.data(), {batch_size, features_size}),
+    TensorView<float> logits = ComputeLogitsFromInputForStage(
+        ProfiledStage::SELECTION_MODEL, *selection_executor_, batch_size,
         selection_interpreter);
     if (!logits.is_valid()) {
       TC_LOG(ERROR) << "Couldn't compute logits.";
@@ -1537,17 +3839,18 @@ bool TextClassifier::ModelBoundsSensitiveScoreChunks(
   return true;
 }
 
-bool TextClassifier::DatetimeChunk(const UnicodeText& context_unicode,
+bool TextClassifier::DatetimeChunk(const UniLib::RegexInput& context_input,
                                    int64 reference_time_ms_utc,
                                    const std::string& reference_timezone,
                                    const std::string& locales, ModeFlag mode,
                                    std::vector<AnnotatedSpan>* result) const {
+  ScopedStageTimer timer(ProfiledStage::DATETIME);
   if (!datetime_parser_) {
     return true;
   }
 
   std::vector<DatetimeParseResultSpan> datetime_spans;
-  if (!datetime_parser_->Parse(context_unicode, reference_time_ms_utc,
+  if (!datetime_parser_->Parse(context_input, reference_time_ms_utc,
                                reference_timezone, locales, mode,
                                /*anchor_start_end=*/false, &datetime_spans)) {
     return false;
@@ -1559,6 +3862,7 @@ bool TextClassifier::DatetimeChunk(const UnicodeText& context_unicode,
                                       datetime_span.target_classification_score,
                                       datetime_span.priority_score}};
     annotated_span.classification[0].datetime_parse_result = datetime_span.data;
+    annotated_span.source = AnnotatedSpan::Source::DATETIME;
 
     result->push_back(std::move(annotated_span));
   }
@@ -1573,4 +3877,10 @@ const Model* ViewModel(const void* buffer, int size) {
   return LoadAndVerifyModel(buffer, size);
 }
 
+uint64 ModelFingerprint(const void* buffer, int size) {
+  const uint64 fingerprint =
+      tc2farmhash::Fingerprint64(static_cast<const char*>(buffer), size);
+  return fingerprint != 0 ? fingerprint : 1;
+}
+
 }  // namespace libtextclassifier2
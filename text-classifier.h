@@ -19,18 +19,31 @@
 #ifndef LIBTEXTCLASSIFIER_TEXT_CLASSIFIER_H_
 #define LIBTEXTCLASSIFIER_TEXT_CLASSIFIER_H_
 
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+#include "annotation-quality.h"
+#include "classifier-metrics.h"
 #include "datetime/parser.h"
 #include "feature-processor.h"
+#include "inference-batcher.h"
 #include "model-executor.h"
 #include "model_generated.h"
+#include "request-tracer.h"
 #include "strip-unpaired-brackets.h"
 #include "types.h"
+#include "util/base/deadline.h"
+#include "util/base/lru-cache.h"
+#include "util/base/macros.h"
+#include "util/base/task-runner.h"
 #include "util/memory/mmap.h"
+#include "util/strings/stringpiece.h"
+#include "util/utf8/multi-regex.h"
 #include "util/utf8/unilib.h"
 #include "zlib-utils.h"
 
@@ -41,6 +54,9 @@ struct SelectionOptions {
   // tags).
   std::string locales;
 
+  // If not nullptr, receives the phases of the call. Not owned.
+  RequestTracer* tracer = nullptr;
+
   static SelectionOptions Default() { return SelectionOptions(); }
 };
 
@@ -57,9 +73,30 @@ struct ClassificationOptions {
   // tags).
   std::string locales;
 
+  // Bounds the time of the call. Once the deadline expires, the call skips
+  // its remaining steps, i.e. the regex, datetime and model classification,
+  // and returns no classification. Checked between the steps, so a step that
+  // has started runs to its end.
+  Deadline deadline;
+
+  // If not nullptr, set to whether the deadline stopped the call, i.e. whether
+  // its result is partial. Not owned.
+  bool* partial_result = nullptr;
+
+  // If not nullptr, receives the phases of the call. Not owned.
+  RequestTracer* tracer = nullptr;
+
   static ClassificationOptions Default() { return ClassificationOptions(); }
 };
 
+// The annotators of Annotate(), as bits of AnnotationOptions::annotators.
+enum AnnotatorFlag {
+  ANNOTATOR_MODEL = 1,
+  ANNOTATOR_REGEX = 2,
+  ANNOTATOR_DATETIME = 4,
+  ANNOTATOR_ALL = ANNOTATOR_MODEL | ANNOTATOR_REGEX | ANNOTATOR_DATETIME,
+};
+
 struct AnnotationOptions {
   // For parsing relative datetimes, the reference now time against which the
   // relative datetimes get resolved.
@@ -73,56 +110,387 @@ struct AnnotationOptions {
   // tags).
   std::string locales;
 
+  // Number of threads used to run the selection and classification models on
+  // the lines of the context in parallel, when the model splits the context
+  // into lines. The calling thread is one of them. Values <= 1 process the
+  // lines sequentially on the calling thread.
+  int num_line_threads = 1;
+
+  // If not nullptr, runs the annotation of a context in parallel tasks, with
+  // the same results as serially, e.g. for the bulk annotation of large
+  // documents. The model, regex and datetime annotators run concurrently,
+  // the regex rules in groups, and when the model takes the whole context as
+  // one line (see FeatureProcessorOptions::only_use_line_with_click), its
+  // selection model and classification run in shards of the line. The
+  // runner must allow RunAll() calls from its tasks. Not owned.
+  TaskRunner* task_runner = nullptr;
+
+  // The most tasks into which the regex rules, and the model annotation of a
+  // line, are split with 'task_runner'. A model shard has at least one
+  // selection model batch.
+  int max_shards = 8;
+
+  // Bounds the time of the call. Once the deadline expires, the call skips
+  // its remaining steps and returns what it has produced so far. Checked
+  // between the lines of the model annotation, the regex rules and the
+  // datetime parsing, so a step that has started runs to its end. The
+  // conflicts between the annotations found so far are still resolved.
+  Deadline deadline;
+
+  // If not nullptr, set to whether the deadline stopped the call, i.e. whether
+  // its result is partial. Not owned.
+  bool* partial_result = nullptr;
+
+  // If not nullptr, receives the phases of the call. Not owned.
+  RequestTracer* tracer = nullptr;
+
+  // The annotators to run, as a combination of AnnotatorFlag bits.
+  int annotators = ANNOTATOR_ALL;
+
+  // With LoadOptions::adaptive_annotation_quality, the latency that Annotate()
+  // aims for, on top of LoadOptions::annotation_latency_target_micros and the
+  // time left until 'deadline'. The tightest of them wins. 0 for none.
+  int64 latency_budget_micros = 0;
+
+  // The cheapest quality that the adaptive quality may pick for the call.
+  // AnnotationQuality::FULL opts out of the degradation.
+  AnnotationQuality lowest_quality = AnnotationQuality::REGEX_ONLY;
+
+  // If not nullptr, set to the quality at which the call ran, see
+  // LoadOptions::adaptive_annotation_quality. AnnotateBatch() and
+  // AnnotationSession always run at the full quality. Not owned.
+  AnnotationQuality* quality = nullptr;
+
+  // If not empty, the only collections to return. The annotators and the
+  // regex rules that can't produce any of them are skipped, e.g. the
+  // selection and classification models when none of their collections is
+  // wanted, or all but the datetime parser for just "date". As the skipped
+  // annotators don't take part in the conflict resolution, a wanted span that
+  // would have lost against an unwanted one is returned.
+  std::vector<std::string> collections;
+
   static AnnotationOptions Default() { return AnnotationOptions(); }
 };
 
-// Holds TFLite interpreters for selection and classification models.
-// NOTE: his class is not thread-safe, thus should NOT be re-used across
-// threads.
+// A cheap test of whether the selection model can find anything in a line,
+// see LoadOptions::model_gate. What the model finds, e.g. phone numbers,
+// addresses, URLs or emails, has digits, capitals or symbols, which lines of
+// plain prose mostly lack.
+struct ModelGateOptions {
+  // Runs the selection model for the annotation only on the lines that pass
+  // the gate. The other lines get no model annotations, but the regex and
+  // datetime rules still run on them. The lines skipped are counted in
+  // PhaseCounters::gated_lines.
+  bool enabled = false;
+
+  // A line passes with at least this many digits, capitals and symbols other
+  // than sentence punctuation...
+  int min_signal_codepoints = 2;
+
+  // ...that are at least this fraction of its non-whitespace codepoints.
+  float min_signal_ratio = 0.0f;
+};
+
+struct LoadOptions {
+  // Dequantizes the embedding table into floats once at load time, so that
+  // the embedding lookups are plain vector additions. Costs
+  // num_buckets * embedding_size * sizeof(float) bytes of extra memory, see
+  // TextClassifier::ExtraEmbeddingMemoryBytes(). The quantized table is used
+  // directly by default.
+  bool dequantize_embeddings = false;
+
+  // The dequantized embedding table of the model, of num_buckets *
+  // embedding_size values, e.g. published in memory shared by the processes
+  // of the device, see FromSharedModelData(). Read instead of dequantizing
+  // the embeddings in each process. Not owned, and must outlive the
+  // classifier.
+  const float* shared_dequantized_embeddings = nullptr;
+  int64 shared_dequantized_embeddings_size = 0;
+
+  // Matches the annotation regex patterns together in one pass over the
+  // context, instead of one after the other with ICU. The patterns that need
+  // features the multi-pattern engine doesn't have, e.g. \b or lookaround,
+  // still run with ICU. The results are the same.
+  bool multi_pattern_annotation_regex = false;
+
+  // Compiles the regex and datetime patterns on first use instead of at load
+  // time, which makes loading much faster, e.g. for short-lived processes
+  // that only use a few of the patterns. The patterns are still decompressed
+  // at load time. Invalid patterns then fail when used instead of failing the
+  // load. See TextClassifier::Warmup().
+  bool lazy_regex_compilation = false;
+
+  // If set, the regex and datetime patterns are compiled in parallel with the
+  // runner during the load. Not owned, and not used after the load.
+  TaskRunner* task_runner = nullptr;
+
+  // Shares the compiled regex and datetime patterns with the other models in
+  // the process that were loaded with this option and have the same
+  // patterns, e.g. the per-language models, see SharedRegexPatterns. Each
+  // model still counts the shared patterns in its MemoryStats.
+  bool share_regex_patterns = false;
+
+  // Page residency of the model file, for the factories that map it. By
+  // default the pages are faulted in by the requests that first read them,
+  // e.g. deep inside the embedding lookups of the first requests.
+  // Reads the whole model at load time so that it is resident.
+  bool prefault_model = false;
+  // Advice for the kernel about the accesses to the embedding table, which
+  // are random, and to the rest of the model, respectively.
+  MmapAdvice embeddings_advice = MmapAdvice::NORMAL;
+  MmapAdvice model_advice = MmapAdvice::NORMAL;
+  // Locks the embedding table in memory, so that it is never evicted. Needs a
+  // big enough RLIMIT_MEMLOCK, a failure is logged and otherwise ignored.
+  bool lock_embeddings = false;
+
+  // ModelFingerprint() of a trusted model buffer, e.g. stored in a sidecar
+  // file when the model is deployed. If it matches the buffer, the load skips
+  // the flatbuffer verification of the model and of the TFLite models in it,
+  // which walks the whole multi-megabyte buffer. On a mismatch the model is
+  // fully verified as usual. 0 always verifies the model.
+  uint64 trusted_model_fingerprint = 0;
+
+  // Fails the load when trusted_model_fingerprint doesn't match the buffer,
+  // instead of verifying the model, e.g. for files derived from a model that
+  // are rebuilt when they are corrupted.
+  bool require_trusted_model = false;
+
+  // Threads, delegates and profiling of the selection and classification
+  // model interpreters, e.g. several threads per inference for batched
+  // annotation on servers, or NNAPI on devices.
+  ExecutorOptions executor_options;
+
+  // If > 0, the classification model runs the rows of the concurrent requests
+  // together, see InferenceBatcher: a request waits up to this long for
+  // others to join its batch of up to 'classification_batching_max_rows'
+  // rows. Trades this much latency for the throughput of fuller batches on
+  // servers with many concurrent ClassifyText() calls. 0 disables it.
+  int64 classification_batching_wait_micros = 0;
+  int classification_batching_max_rows = 32;
+
+  // Gates the selection model per line in Annotate().
+  ModelGateOptions model_gate;
+
+  // Keeps the results of the last this many distinct ClassifyText() calls,
+  // so that repeated calls for the same selection in the same surroundings,
+  // e.g. on re-renders, are served from memory. 0 disables the cache.
+  int classification_cache_size = 0;
+
+  // The datetime results depend on the reference time of the call. A cached
+  // one is served to the calls with a reference time up to this far from its
+  // own, e.g. so that the calls that each pass the current time still share
+  // the result. The other results don't depend on the reference time.
+  int64 classification_cache_time_tolerance_ms = 0;
+
+  // Caches the token embeddings across the requests in up to this many
+  // bytes, so that the common tokens are embedded once instead of once per
+  // request, see SharedEmbeddingCache. 0 disables the cache.
+  int64 shared_embedding_cache_bytes = 0;
+
+  // Counts the requests per mode, their input sizes and latencies, their
+  // results per collection and the winners of the conflicts, see
+  // TextClassifier::GetMetrics(). Costs a few uncontended atomic increments
+  // per request, so it's on by default.
+  bool collect_metrics = true;
+
+  // Degrades Annotate() under load rather than letting it time out: from the
+  // recent latencies, picks the best AnnotationQuality whose latency fits into
+  // the budget of the call, see AnnotationQualityController. Without a budget,
+  // the calls run at the full quality. Only applies to Annotate().
+  bool adaptive_annotation_quality = false;
+
+  // The default latency budget of Annotate() with adaptive quality. 0 for
+  // none, in which case only the budgets of the calls apply, see
+  // AnnotationOptions::latency_budget_micros.
+  int64 annotation_latency_target_micros = 0;
+
+  // Limits each match of a regex or datetime rule to about this many
+  // milliseconds, so that an input on which a pattern backtracks badly costs
+  // the results of that rule instead of stalling the request. The timeouts
+  // are counted in the metrics. 0 for no limit. Only the ICU regexes can
+  // time out, the others take linear time.
+  int regex_time_limit_millis = 0;
+
+  static LoadOptions Default() { return LoadOptions(); }
+};
+
+// Break-down of the memory used by a TextClassifier, in bytes. Apart from the
+// model buffer, the sizes are estimates, see TextClassifier::GetMemoryStats().
+struct MemoryStats {
+  // The model buffer, and the part of it that is resident in memory, or -1 if
+  // unknown.
+  int64 model_bytes = 0;
+  int64 model_resident_bytes = -1;
+
+  // The embeddings allocated on top of the model buffer, see
+  // LoadOptions::dequantize_embeddings.
+  int64 embedding_bytes = 0;
+
+  // The embeddings cached across the requests, see
+  // LoadOptions::shared_embedding_cache_bytes.
+  int64 embedding_cache_bytes = 0;
+
+  // The TFLite interpreters of the selection and classification models, which
+  // are created as needed for the concurrent requests.
+  int num_interpreters = 0;
+  int64 interpreter_bytes = 0;
+
+  // The compiled regex patterns of the regex model, including the
+  // multi-pattern program for the annotation.
+  int64 regex_bytes = 0;
+
+  // The selection and classification feature processors, mostly their label
+  // maps, allowed charactergrams and tokenizer tables.
+  int64 feature_processor_bytes = 0;
+
+  // The datetime rules and their tables and caches.
+  int64 datetime_bytes = 0;
+
+  // Returns the estimated bytes on top of the model buffer.
+  int64 AllocatedBytes() const {
+    return embedding_bytes + embedding_cache_bytes + interpreter_bytes +
+           regex_bytes + feature_processor_bytes + datetime_bytes;
+  }
+};
+
+// What TextClassifier::Warmup() prepares ahead of the first requests.
+struct WarmupOptions {
+  // Compiles the patterns left for later by
+  // LoadOptions::lazy_regex_compilation.
+  bool compile_patterns = true;
+
+  // Runs the enabled modes (selection, classification and annotation, which
+  // includes the datetime parsing) on 'text'. This sets up the interpreters
+  // and loads the ICU data of the break iterators, regexes and calendars.
+  bool run_models = true;
+  std::string text =
+      "Call me at (800) 123-4567 tomorrow at 5pm or visit www.google.com, "
+      "350 Third Street, Cambridge.";
+
+  // Creates this many interpreters for each of the selection and the
+  // classification model, e.g. one per serving thread, so that no request
+  // has to create one.
+  int num_interpreters = 1;
+
+  // Reads the embedding table so that its pages are resident.
+  bool prefault_embeddings = false;
+
+  static WarmupOptions Default() { return WarmupOptions(); }
+};
+
+// How much memory TextClassifier::Trim() releases.
+enum class TrimLevel {
+  // The scratch memory of the requests, which the next requests re-create:
+  // the idle interpreters and their tensor arenas, the pooled break
+  // iterators, and the cached classifications and embeddings.
+  SCRATCH,
+
+  // Also the compiled regex and datetime patterns, if they are compiled on
+  // use with LoadOptions::lazy_regex_compilation. The next requests that use
+  // them compile them again.
+  PATTERNS,
+};
+
+// Holds TFLite interpreters for selection and classification models for the
+// duration of a single request. The interpreters are checked out of the given
+// pools on first use and returned to them on destruction.
+// NOTE: This class is not thread-safe, thus should NOT be re-used across
+// threads. The pools, however, can be shared by many managers.
 class InterpreterManager {
  public:
-  // The constructor can be called with nullptr for any of the executors, and is
+  // The constructor can be called with nullptr for any of the pools, and is
   // a defined behavior, as long as the corresponding *Interpreter() method is
-  // not called when the executor is null.
-  InterpreterManager(const ModelExecutor* selection_executor,
-                     const ModelExecutor* classification_executor)
-      : selection_executor_(selection_executor),
-        classification_executor_(classification_executor) {}
+  // not called when the pool is null.
+  InterpreterManager(InterpreterPool* selection_pool,
+                     InterpreterPool* classification_pool)
+      : selection_pool_(selection_pool),
+        classification_pool_(classification_pool) {}
+
+  ~InterpreterManager();
 
-  // Gets or creates and caches an interpreter for the selection model.
+  // Gets or checks out an interpreter for the selection model.
   tflite::Interpreter* SelectionInterpreter();
 
-  // Gets or creates and caches an interpreter for the classification model.
+  // Gets or checks out an interpreter for the classification model.
   tflite::Interpreter* ClassificationInterpreter();
 
  private:
-  const ModelExecutor* selection_executor_;
-  const ModelExecutor* classification_executor_;
+  InterpreterPool* selection_pool_;
+  InterpreterPool* classification_pool_;
 
   std::unique_ptr<tflite::Interpreter> selection_interpreter_;
   std::unique_ptr<tflite::Interpreter> classification_interpreter_;
+
+  TC_DISALLOW_COPY_AND_ASSIGN(InterpreterManager);
 };
 
 // A text processing model that provides text classification, annotation,
 // selection suggestion for various types.
-// NOTE: This class is not thread-safe.
+// NOTE: Once initialized, the const methods of this class are thread-safe, so
+// one instance can be shared by many threads.
 class TextClassifier {
  public:
   static std::unique_ptr<TextClassifier> FromUnownedBuffer(
-      const char* buffer, int size, const UniLib* unilib = nullptr);
+      const char* buffer, int size, const UniLib* unilib = nullptr,
+      const LoadOptions& load_options = LoadOptions::Default());
   // Takes ownership of the mmap.
   static std::unique_ptr<TextClassifier> FromScopedMmap(
-      std::unique_ptr<ScopedMmap>* mmap, const UniLib* unilib = nullptr);
+      std::unique_ptr<ScopedMmap>* mmap, const UniLib* unilib = nullptr,
+      const LoadOptions& load_options = LoadOptions::Default());
   static std::unique_ptr<TextClassifier> FromFileDescriptor(
-      int fd, int offset, int size, const UniLib* unilib = nullptr);
+      int fd, int offset, int size, const UniLib* unilib = nullptr,
+      const LoadOptions& load_options = LoadOptions::Default());
   static std::unique_ptr<TextClassifier> FromFileDescriptor(
-      int fd, const UniLib* unilib = nullptr);
+      int fd, const UniLib* unilib = nullptr,
+      const LoadOptions& load_options = LoadOptions::Default());
   static std::unique_ptr<TextClassifier> FromPath(
-      const std::string& path, const UniLib* unilib = nullptr);
+      const std::string& path, const UniLib* unilib = nullptr,
+      const LoadOptions& load_options = LoadOptions::Default());
 
   // Returns true if the model is ready for use.
   bool IsInitialized() { return initialized_; }
 
+  // Returns the number of bytes allocated for the embeddings on top of the
+  // model buffer, e.g. with LoadOptions::dequantize_embeddings.
+  int64 ExtraEmbeddingMemoryBytes() const;
+
+  // Returns the memory used by the model, for capacity planning. The sizes
+  // are estimated from the sizes of the data structures, so they are cheap to
+  // compute but approximate, except for the model buffer ones. Thread-safe.
+  MemoryStats GetMemoryStats() const;
+
+  // Returns the time spent in each operator of the selection and the
+  // classification models, with ExecutorOptions::enable_operator_profiling.
+  std::vector<OperatorProfile> GetSelectionOperatorProfile() const;
+  std::vector<OperatorProfile> GetClassificationOperatorProfile() const;
+
+  // Returns the hit rate and size of the embedding cache of
+  // LoadOptions::shared_embedding_cache_bytes, or all zeros when disabled.
+  SharedEmbeddingCache::Stats GetSharedEmbeddingCacheStats() const;
+
+  // Returns the metrics counted since the load with
+  // LoadOptions::collect_metrics, or an empty snapshot when disabled.
+  // Thread-safe.
+  MetricsSnapshot GetMetrics() const;
+
+  // Does the one-time work of the first requests ahead of time, e.g. before
+  // the instance reports ready to serve: compiles the patterns that
+  // LoadOptions::lazy_regex_compilation left for later, creates interpreters
+  // and exercises the enabled modes, see WarmupOptions. Thread-safe, and
+  // cheap to repeat. Returns false if some pattern doesn't compile or an
+  // interpreter could not be created.
+  bool Warmup(const WarmupOptions& options = WarmupOptions::Default()) const;
+
+  // Releases memory that later requests can re-create, e.g. when the model
+  // is idle and the system is low on memory, without unloading the model.
+  // The opposite of Warmup(). Thread-safe, also with concurrent requests,
+  // which keep what they are using.
+  void Trim(TrimLevel level) const;
+
+  // The methods below take the context as a StringPiece, which they only read
+  // during the call, so callers can pass text from mapped files or network
+  // buffers without copying it into a std::string.
+
   // Runs inference for given a context and current selection (i.e. index
   // of the first and one past last selected characters (utf8 codepoint
   // offsets)). Returns the indices (utf8 codepoint offsets) of the selection
@@ -132,22 +500,48 @@ class TextClassifier {
   // UTF8 codepoints (not bytes).
   // Requires that the model is a smart selection model.
   CodepointSpan SuggestSelection(
-      const std::string& context, CodepointSpan click_indices,
+      StringPiece context, CodepointSpan click_indices,
       const SelectionOptions& options = SelectionOptions::Default()) const;
 
   // Classifies the selected text given the context string.
-  // Returns an empty result if an error occurs.
+  // Returns an empty result if an error occurs. Served from the cache of
+  // LoadOptions::classification_cache_size when enabled.
   std::vector<ClassificationResult> ClassifyText(
-      const std::string& context, CodepointSpan selection_indices,
+      StringPiece context, CodepointSpan selection_indices,
       const ClassificationOptions& options =
           ClassificationOptions::Default()) const;
 
+  // Suggests the selection for the click as SuggestSelection() does, and
+  // classifies the suggested selection as ClassifyText() does. Shares the
+  // interpreters, the tokens and the token embeddings of the context between
+  // the two, so it's cheaper than the two calls, as on a tap.
+  AnnotatedSpan SuggestAndClassify(
+      StringPiece context, CodepointSpan click_indices,
+      const SelectionOptions& selection_options = SelectionOptions::Default(),
+      const ClassificationOptions& classification_options =
+          ClassificationOptions::Default()) const;
+
   // Annotates given input text. The annotations are sorted by their position
   // in the context string and exclude spans classified as 'other'.
   std::vector<AnnotatedSpan> Annotate(
-      const std::string& context,
+      StringPiece context,
       const AnnotationOptions& options = AnnotationOptions::Default()) const;
 
+  // Annotates each of the given input texts, as Annotate() would. Returns one
+  // vector of annotations per input text, in the same order. Amortizes the
+  // per-call setup over the batch, so prefer this for many short texts.
+  std::vector<std::vector<AnnotatedSpan>> AnnotateBatch(
+      const std::vector<std::string>& contexts,
+      const AnnotationOptions& options = AnnotationOptions::Default()) const;
+
+  // Returns the names of all the collections that the classifier can return,
+  // sorted. The index of a name is its collection id.
+  const std::vector<std::string>& Collections() const { return collections_; }
+
+  // Returns the collection id of the given name, or -1 if the classifier never
+  // returns it.
+  int CollectionId(const std::string& collection) const;
+
   // Exposes the feature processor for tests and evaluations.
   const FeatureProcessor* SelectionFeatureProcessorForTests() const;
   const FeatureProcessor* ClassificationFeatureProcessorForTests() const;
@@ -167,59 +561,103 @@ class TextClassifier {
     float score;
   };
 
+  // The selection model annotations of a line and its tokens, with spans
+  // relative to the start of the line.
+  struct LineAnnotations {
+    std::vector<Token> tokens;
+    std::vector<AnnotatedSpan> annotations;
+  };
+
+  // Model annotations of the lines of the last annotated text, keyed by the
+  // UTF8 text of the line, for AnnotationSession.
+  struct LineAnnotationCache {
+    std::unordered_map<std::string, LineAnnotations> lines;
+
+    // Number of lines that were not in the cache and had to be run through
+    // the models in the last annotation.
+    int num_annotated_lines = 0;
+  };
+
+  // What a SelectionSession keeps of its current context: the tokens of the
+  // whole context, the token embeddings of the two models, and the
+  // bounds-sensitive selection model scores of the candidate spans scored so
+  // far, keyed by the tokens that their features read.
+  struct SelectionCache {
+    uint64 context_fingerprint = 0;
+    int context_size = -1;
+
+    // Empty until the first click on the context.
+    std::vector<Token> tokens;
+
+    FeatureProcessor::EmbeddingCache selection_embedding_cache;
+    FeatureProcessor::EmbeddingCache classification_embedding_cache;
+    std::unordered_map<uint64, float> chunk_scores;
+
+    // Numbers of candidate spans that the last click ran through the
+    // selection model, and that it found in 'chunk_scores'.
+    int num_scored_chunks = 0;
+    int num_reused_chunks = 0;
+  };
+
   // Constructs and initializes text classifier from given model.
   // Takes ownership of 'mmap', and thus owns the buffer that backs 'model'.
   TextClassifier(std::unique_ptr<ScopedMmap>* mmap, const Model* model,
-                 const UniLib* unilib)
+                 const UniLib* unilib, const LoadOptions& load_options)
       : model_(model),
         mmap_(std::move(*mmap)),
         owned_unilib_(nullptr),
         unilib_(internal::MaybeCreateUnilib(unilib, &owned_unilib_)) {
-    ValidateAndInitialize();
+    ValidateAndInitialize(load_options);
   }
 
   // Constructs, validates and initializes text classifier from given model.
   // Does not own the buffer that backs 'model'.
-  explicit TextClassifier(const Model* model, const UniLib* unilib)
+  TextClassifier(const Model* model, const UniLib* unilib,
+                 const LoadOptions& load_options)
       : model_(model),
         owned_unilib_(nullptr),
         unilib_(internal::MaybeCreateUnilib(unilib, &owned_unilib_)) {
-    ValidateAndInitialize();
+    ValidateAndInitialize(load_options);
   }
 
   // Checks that model contains all required fields, and initializes internal
   // datastructures.
-  void ValidateAndInitialize();
+  void ValidateAndInitialize(const LoadOptions& load_options);
 
   // Initializes regular expressions for the regex model.
-  bool InitializeRegexModel(ZlibDecompressor* decompressor);
+  bool InitializeRegexModel(ZlibDecompressor* decompressor,
+                            const LoadOptions& load_options);
 
   // Resolves conflicts in the list of candidates by removing some overlapping
   // ones. Returns indices of the surviving ones.
   // NOTE: Assumes that the candidates are sorted according to their position in
   // the span.
   bool ResolveConflicts(const std::vector<AnnotatedSpan>& candidates,
-                        const std::string& context,
+                        StringPiece context,
                         const std::vector<Token>& cached_tokens,
                         InterpreterManager* interpreter_manager,
+                        FeatureProcessor::EmbeddingCache* embedding_cache,
                         std::vector<int>* result) const;
 
   // Resolves one conflict between candidates on indices 'start_index'
   // (inclusive) and 'end_index' (exclusive). Assigns the winning candidate
   // indices to 'chosen_indices'. Returns false if a problem arises.
-  bool ResolveConflict(const std::string& context,
+  bool ResolveConflict(StringPiece context,
                        const std::vector<Token>& cached_tokens,
                        const std::vector<AnnotatedSpan>& candidates,
                        int start_index, int end_index,
                        InterpreterManager* interpreter_manager,
+                       FeatureProcessor::EmbeddingCache* embedding_cache,
                        std::vector<int>* chosen_indices) const;
 
   // Gets selection candidates from the ML model.
   // Provides the tokens produced during tokenization of the context string for
   // reuse.
+  // Uses and fills 'selection_cache', if not nullptr, for the context.
   bool ModelSuggestSelection(const UnicodeText& context_unicode,
                              CodepointSpan click_indices,
                              InterpreterManager* interpreter_manager,
+                             SelectionCache* selection_cache,
                              std::vector<Token>* tokens,
                              std::vector<AnnotatedSpan>* result) const;
 
@@ -227,17 +665,50 @@ class TextClassifier {
   // classification model.
   // Returns true if no error occurred.
   bool ModelClassifyText(
-      const std::string& context, const std::vector<Token>& cached_tokens,
+      StringPiece context, const std::vector<Token>& cached_tokens,
       CodepointSpan selection_indices, InterpreterManager* interpreter_manager,
       FeatureProcessor::EmbeddingCache* embedding_cache,
       std::vector<ClassificationResult>* classification_results) const;
 
   bool ModelClassifyText(
-      const std::string& context, CodepointSpan selection_indices,
+      StringPiece context, CodepointSpan selection_indices,
       InterpreterManager* interpreter_manager,
       FeatureProcessor::EmbeddingCache* embedding_cache,
       std::vector<ClassificationResult>* classification_results) const;
 
+  // Classifies multiple selections in the same context string with the
+  // classification model, running the model on batches of selections.
+  // Fills one vector of results per selection, in the same order.
+  // Returns true if no error occurred.
+  bool ModelClassifyTexts(
+      StringPiece context, const std::vector<Token>& cached_tokens,
+      const std::vector<CodepointSpan>& selections,
+      InterpreterManager* interpreter_manager,
+      FeatureProcessor::EmbeddingCache* embedding_cache,
+      std::vector<std::vector<ClassificationResult>>* classification_results)
+      const;
+
+  // Computes the classification model features for one selection. If the
+  // result can be decided without running the model, sets
+  // 'classification_results' and leaves 'features' empty.
+  bool ModelClassifyTextFeatures(
+      StringPiece context, const std::vector<Token>& cached_tokens,
+      CodepointSpan selection_indices,
+      FeatureProcessor::EmbeddingCache* embedding_cache,
+      std::vector<float>* features, int* selection_num_tokens,
+      std::vector<ClassificationResult>* classification_results) const;
+
+  // Runs the classification model on one batch of features for the
+  // 'batch_selections' indices into 'selections', and sets their results.
+  bool ModelClassifyTextBatch(
+      StringPiece context, const std::vector<CodepointSpan>& selections,
+      const std::vector<int>& selection_num_tokens,
+      const std::vector<int>& batch_selections,
+      const std::vector<float>& batch_features,
+      InterpreterManager* interpreter_manager,
+      std::vector<std::vector<ClassificationResult>>* classification_results)
+      const;
+
   // Returns a relative token span that represents how many tokens on the left
   // from the selection and right from the selection are needed for the
   // classifier input.
@@ -245,28 +716,213 @@ class TextClassifier {
 
   // Classifies the selected text with the regular expressions models.
   // Returns true if any regular expression matched and the result was set.
-  bool RegexClassifyText(const std::string& context,
+  bool RegexClassifyText(StringPiece context,
                          CodepointSpan selection_indices,
                          ClassificationResult* classification_result) const;
 
   // Classifies the selected text with the date time model.
   // Returns true if there was a match and the result was set.
-  bool DatetimeClassifyText(const std::string& context,
+  bool DatetimeClassifyText(StringPiece context,
                             CodepointSpan selection_indices,
                             const ClassificationOptions& options,
                             ClassificationResult* classification_result) const;
 
+  // Implements SuggestSelection() with the given interpreters and embedding
+  // cache, and the cache of a SelectionSession, which can be nullptr.
+  // Provides the tokens of the context, if the model got to them.
+  CodepointSpan SuggestSelectionInternal(
+      StringPiece context, CodepointSpan click_indices,
+      const SelectionOptions& options, InterpreterManager* interpreter_manager,
+      FeatureProcessor::EmbeddingCache* embedding_cache,
+      SelectionCache* selection_cache, std::vector<Token>* tokens) const;
+
+  // Implements ClassifyText() with the given interpreters and embedding cache,
+  // which can be nullptr. The model reuses 'cached_tokens' of the context, if
+  // not empty, instead of tokenizing it.
+  std::vector<ClassificationResult> ClassifyTextInternal(
+      StringPiece context, CodepointSpan selection_indices,
+      const ClassificationOptions& options,
+      InterpreterManager* interpreter_manager,
+      FeatureProcessor::EmbeddingCache* embedding_cache,
+      const std::vector<Token>& cached_tokens) const;
+
+  // Implements ClassifyText() with the classification cache.
+  std::vector<ClassificationResult> ClassifyTextWithCache(
+      StringPiece context, CodepointSpan selection_indices,
+      const ClassificationOptions& options) const;
+
+  // Sets LoadOptions::regex_time_limit_millis on the matcher.
+  void LimitRegexMatcher(UniLib::RegexMatcher* matcher) const;
+
+  // Counts a regex match that ran out of the time limit in the metrics.
+  void RecordRegexTimeout() const;
+
+  // Counts the top classification of a request in the metrics.
+  void RecordResultMetrics(
+      MetricsMode mode,
+      const std::vector<ClassificationResult>& classification) const;
+
+  // Computes the key of a ClassifyText() call in the classification cache
+  // from what its result depends on: the selected text, the tokens around it
+  // that the model reads, and the locales and timezone. Returns false if the
+  // call is not to be cached, e.g. for an invalid selection.
+  bool ClassificationCacheKey(StringPiece context,
+                              CodepointSpan selection_indices,
+                              const ClassificationOptions& options,
+                              uint64* key) const;
+
+  // Returns the quality at which Annotate() runs a call with 'options' on an
+  // input of 'input_bytes', see LoadOptions::adaptive_annotation_quality.
+  AnnotationQuality ChooseAnnotationQuality(const AnnotationOptions& options,
+                                            int64 input_bytes) const;
+
+  // Returns whether Annotate() runs the selection and classification models
+  // with 'options', i.e. whether they're enabled and can produce one of the
+  // wanted collections.
+  bool AnnotatesWithModel(const AnnotationOptions& options) const;
+
+  // Implements Annotate() with the interpreters from 'interpreter_manager'.
+  // If 'line_cache' is not nullptr, takes the model annotations of the lines
+  // from it when possible, and replaces its contents with the lines of
+  // 'context'. Sets *options.partial_result if the deadline stops it, but
+  // doesn't reset it. If 'model_annotations' is not nullptr, takes the model
+  // annotations of the whole context, and the tokens that go with them, from
+  // it instead of running the selection and classification models.
+  std::vector<AnnotatedSpan> AnnotateInternal(
+      StringPiece context, const AnnotationOptions& options,
+      InterpreterManager* interpreter_manager, LineAnnotationCache* line_cache,
+      LineAnnotations* model_annotations = nullptr) const;
+
+  // Runs ModelAnnotate() for all the contexts of AnnotateBatch() at once, with
+  // the lines of all of them in ModelAnnotateLinesBatched(). Sets
+  // (*model_annotations)[i] to the annotations of contexts[i] in context
+  // codepoint offsets, with the tokens of its last line.
+  bool ModelAnnotateBatch(
+      const std::vector<std::string>& contexts,
+      const AnnotationOptions& options,
+      InterpreterManager* interpreter_manager,
+      std::vector<LineAnnotations>* model_annotations) const;
+
   // Chunks given input text with the selection model and classifies the spans
   // with the classification model.
   // The annotations are sorted by their position in the context string and
   // exclude spans classified as 'other'.
   // Provides the tokens produced during tokenization of the context string for
-  // reuse.
-  bool ModelAnnotate(const std::string& context,
+  // reuse. Uses 'embedding_cache' when its codepoint spans are valid for the
+  // whole context. Uses 'line_cache' as AnnotateInternal() does, if it is not
+  // nullptr; the lines are then processed sequentially. Skips the remaining
+  // lines once 'deadline' expires.
+  bool ModelAnnotate(StringPiece context,
+                     const AnnotationOptions& options,
                      InterpreterManager* interpreter_manager,
+                     FeatureProcessor::EmbeddingCache* embedding_cache,
+                     LineAnnotationCache* line_cache, DeadlineCheck* deadline,
                      std::vector<Token>* tokens,
                      std::vector<AnnotatedSpan>* result) const;
 
+  // Implements ModelAnnotate() for the given lines with a line cache.
+  bool ModelAnnotateCachedLines(
+      const UnicodeText& context_unicode,
+      const std::vector<UnicodeTextRange>& lines,
+      InterpreterManager* interpreter_manager,
+      FeatureProcessor::EmbeddingCache* embedding_cache,
+      LineAnnotationCache* line_cache, DeadlineCheck* deadline,
+      std::vector<Token>* tokens, std::vector<AnnotatedSpan>* result) const;
+
+  // Chunks and classifies a single line of the context for ModelAnnotate().
+  // Appends the annotations of the line, in context codepoint offsets, to
+  // 'result', and sets 'tokens' to the tokens of the line.
+  bool ModelAnnotateLine(const UnicodeText& context_unicode,
+                         const UnicodeTextRange& line,
+                         InterpreterManager* interpreter_manager,
+                         FeatureProcessor::EmbeddingCache* embedding_cache,
+                         std::vector<Token>* tokens,
+                         std::vector<AnnotatedSpan>* result) const;
+
+  // Same as ModelAnnotateLine(), with the selection model and the
+  // classification of the line split into at most 'max_shards' shards that
+  // run with 'task_runner'. The line is tokenized and its features extracted
+  // once, and the shards of the selection model are whole batches of the
+  // serial order, so the results are the same as ModelAnnotateLine()'s.
+  bool ModelAnnotateLineSharded(
+      const UnicodeText& context_unicode, const UnicodeTextRange& line,
+      TaskRunner* task_runner, int max_shards,
+      InterpreterManager* interpreter_manager,
+      FeatureProcessor::EmbeddingCache* embedding_cache,
+      std::vector<Token>* tokens, std::vector<AnnotatedSpan>* result) const;
+
+  // Runs 'shard_fn(i, interpreter_manager, embedding_cache)' for each of the
+  // 'num_shards' shards with 'task_runner'. The first shard gets the given
+  // interpreters and embedding cache, the others their own. Returns false if
+  // any shard failed.
+  bool RunShards(
+      TaskRunner* task_runner, int num_shards,
+      InterpreterManager* interpreter_manager,
+      FeatureProcessor::EmbeddingCache* embedding_cache,
+      const std::function<bool(int, InterpreterManager*,
+                               FeatureProcessor::EmbeddingCache*)>& shard_fn)
+      const;
+
+  // A line for ModelAnnotateLinesBatched(). Its 'embedding_cache' must be
+  // valid for the codepoint spans relative to the line; if nullptr, the line
+  // gets a cache of its own.
+  struct LineToAnnotate {
+    const UnicodeText* context_unicode;
+    UnicodeTextRange line;
+    FeatureProcessor::EmbeddingCache* embedding_cache;
+  };
+
+  // Same as ModelAnnotateLine() for several lines, possibly of different
+  // contexts, when UsesBoundsSensitiveSelection(). Fills the selection model
+  // batches with the candidate spans of several lines, instead of running at
+  // least one batch per line, and hands the scores back to the lines. Sets
+  // (*tokens)[i] and (*results)[i] for lines[i]. Skips the remaining lines
+  // once 'deadline' expires.
+  bool ModelAnnotateLinesBatched(
+      const std::vector<LineToAnnotate>& lines,
+      InterpreterManager* interpreter_manager, DeadlineCheck* deadline,
+      std::vector<std::vector<Token>>* tokens,
+      std::vector<std::vector<AnnotatedSpan>>* results) const;
+
+  // Returns whether the selection model scores the candidate spans with
+  // bounds-sensitive features, rather than the clicks with context features.
+  bool UsesBoundsSensitiveSelection() const;
+
+  // Whether the line passes the model gate, see LoadOptions::model_gate.
+  bool PassesModelGate(const UnicodeTextRange& line) const;
+
+  // Tokenizes the line for the selection model into 'tokens' and extracts its
+  // features. Leaves 'cached_features' empty if the line doesn't have enough
+  // supported codepoints to be annotated, or doesn't pass the model gate.
+  // When shares_token_embeddings_, puts the embeddings of the tokens in
+  // 'embedding_cache', for the classification of the line's chunks.
+  bool PrepareLineForModel(
+      const UnicodeTextRange& line,
+      FeatureProcessor::EmbeddingCache* embedding_cache,
+      std::string* line_str, std::vector<Token>* tokens,
+      std::unique_ptr<CachedFeatures>* cached_features) const;
+
+  // Classifies the chunks of the line and appends those that are not "other"
+  // to 'result', moved by 'offset' codepoints.
+  bool ClassifyLineChunks(const std::string& line_str, int offset,
+                          const std::vector<Token>& tokens,
+                          const std::vector<TokenSpan>& local_chunks,
+                          InterpreterManager* interpreter_manager,
+                          FeatureProcessor::EmbeddingCache* embedding_cache,
+                          std::vector<AnnotatedSpan>* result) const;
+
+  // Returns the span of tokens that the selection model looks at for the
+  // chunks of the span of interest.
+  TokenSpan ModelInferenceSpan(int num_tokens,
+                               const TokenSpan& span_of_interest) const;
+
+  // Picks the chunks greedily from the highest-scoring scored chunk, as long
+  // as they don't overlap with the chunks picked before, and sorts them.
+  // Reorders 'scored_chunks'.
+  static void SelectNonOverlappingChunks(
+      const TokenSpan& inference_span, std::vector<ScoredChunk>* scored_chunks,
+      std::vector<TokenSpan>* chunks);
+
   // Groups the tokens into chunks. A chunk is a token span that should be the
   // suggested selection when any of its contained tokens is clicked. The chunks
   // are non-overlapping and are sorted by their position in the context string.
@@ -281,6 +937,18 @@ class TextClassifier {
                   const CachedFeatures& cached_features,
                   std::vector<TokenSpan>* chunks) const;
 
+  // Same as ModelChunk() for the 'tokens' of the context of
+  // 'selection_cache'. Looks up the scores of the bounds-sensitive candidate
+  // spans in the cache, and runs the model only on the others. The score of a
+  // span depends only on the tokens its features read, as the batch rows are
+  // independent.
+  bool ModelChunkWithSelectionCache(const std::vector<Token>& tokens,
+                                    const TokenSpan& span_of_interest,
+                                    tflite::Interpreter* selection_interpreter,
+                                    const CachedFeatures& cached_features,
+                                    SelectionCache* selection_cache,
+                                    std::vector<TokenSpan>* chunks) const;
+
   // A helper method for ModelChunk(). It generates scored chunk candidates for
   // a click context model.
   // NOTE: The returned chunks can (and most likely do) overlap.
@@ -299,18 +967,69 @@ class TextClassifier {
       tflite::Interpreter* selection_interpreter,
       std::vector<ScoredChunk>* scored_chunks) const;
 
-  // Produces chunks isolated by a set of regular expressions.
-  bool RegexChunk(const UnicodeText& context_unicode,
-                  const std::vector<int>& rules,
+  // Collects the candidate spans that ModelBoundsSensitiveScoreChunks() runs
+  // through the model into 'candidate_spans', and sets 'scored_chunks' to
+  // those that get a score without it.
+  void BoundsSensitiveCandidateSpans(
+      const TokenSpan& span_of_interest, const TokenSpan& inference_span,
+      std::vector<TokenSpan>* candidate_spans,
+      std::vector<ScoredChunk>* scored_chunks) const;
+
+  // Runs the candidate spans [begin, end) through the bounds-sensitive
+  // selection model in batches, and appends their scores to 'scored_chunks'.
+  bool ScoreBoundsSensitiveCandidateSpans(
+      const std::vector<TokenSpan>& candidate_spans, int begin, int end,
+      const CachedFeatures& cached_features,
+      tflite::Interpreter* selection_interpreter,
+      std::vector<ScoredChunk>* scored_chunks) const;
+
+  // Produces chunks isolated by a set of regular expressions. Skips the
+  // remaining rules once 'deadline' expires, if it's not nullptr.
+  bool RegexChunk(const UniLib::RegexInput& context_input,
+                  const std::vector<int>& rules, DeadlineCheck* deadline,
                   std::vector<AnnotatedSpan>* result) const;
 
+  // Same as RegexChunk() for a single pattern, without profiling.
+  bool RegexChunkForPattern(const UniLib::RegexInput& context_input,
+                            int pattern_id,
+                            std::vector<AnnotatedSpan>* result) const;
+
+  // Same as RegexChunk() with the annotation patterns, using the
+  // multi-pattern engine when it was enabled at load time. Otherwise runs
+  // the patterns in at most 'max_shards' groups with 'task_runner', if it's
+  // not nullptr. If 'rules' is not nullptr, only runs these annotation
+  // patterns, as ascending indices into annotation_regex_patterns_.
+  bool AnnotationRegexChunk(const UnicodeText& context_unicode,
+                            const UniLib::RegexInput& context_input,
+                            const std::vector<int>* rules,
+                            TaskRunner* task_runner, int max_shards,
+                            DeadlineCheck* deadline,
+                            std::vector<AnnotatedSpan>* result) const;
+
   // Produces chunks from the datetime parser.
-  bool DatetimeChunk(const UnicodeText& context_unicode,
+  bool DatetimeChunk(const UniLib::RegexInput& context_input,
                      int64 reference_time_ms_utc,
                      const std::string& reference_timezone,
                      const std::string& locales, ModeFlag mode,
                      std::vector<AnnotatedSpan>* result) const;
 
+  // The output filters a collection can be in, as bits.
+  enum CollectionFilter {
+    FILTERED_FOR_ANNOTATION = 1,
+    FILTERED_FOR_CLASSIFICATION = 2,
+    FILTERED_FOR_SELECTION = 4,
+  };
+
+  // Adds the filter to the given collections of the model.
+  void AddCollectionFilter(
+      const flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>*
+          collections,
+      CollectionFilter filter);
+
+  // Returns whether the collection is in the filter.
+  bool IsFilteredCollection(const std::string& collection,
+                            CollectionFilter filter) const;
+
   // Returns whether a classification should be filtered.
   bool FilteredForAnnotation(const AnnotatedSpan& span) const;
   bool FilteredForClassification(
@@ -322,6 +1041,21 @@ class TextClassifier {
   std::unique_ptr<const ModelExecutor> selection_executor_;
   std::unique_ptr<const ModelExecutor> classification_executor_;
   std::unique_ptr<const EmbeddingExecutor> embedding_executor_;
+  std::unique_ptr<const SharedEmbeddingCache> shared_embedding_cache_;
+
+  // Whether the selection and classification feature processors embed the
+  // tokens the same, so that the classification of the annotated chunks
+  // reuses the embeddings of the selection step, and the shared embedding
+  // cache holds them once.
+  bool shares_token_embeddings_ = false;
+
+  // Pools of interpreters for the executors above, shared by all requests.
+  std::unique_ptr<InterpreterPool> selection_interpreter_pool_;
+  std::unique_ptr<InterpreterPool> classification_interpreter_pool_;
+
+  // See LoadOptions::classification_batching_wait_micros. Runs the batches
+  // on interpreters of the pool above. nullptr when disabled.
+  std::unique_ptr<const InferenceBatcher> classification_batcher_;
 
   std::unique_ptr<const FeatureProcessor> selection_feature_processor_;
   std::unique_ptr<const FeatureProcessor> classification_feature_processor_;
@@ -333,27 +1067,138 @@ class TextClassifier {
     std::string collection_name;
     float target_classification_score;
     float priority_score;
-    std::unique_ptr<UniLib::RegexPattern> pattern;
+    std::shared_ptr<const UniLib::RegexPattern> pattern;
   };
 
   std::unique_ptr<ScopedMmap> mmap_;
+
+  // The buffer that backs 'model_' if it's not owned, for GetMemoryStats().
+  const void* unowned_buffer_ = nullptr;
+  int64 unowned_buffer_size_ = 0;
+
   bool initialized_ = false;
   bool enabled_for_annotation_ = false;
   bool enabled_for_classification_ = false;
   bool enabled_for_selection_ = false;
-  std::unordered_set<std::string> filtered_collections_annotation_;
-  std::unordered_set<std::string> filtered_collections_classification_;
-  std::unordered_set<std::string> filtered_collections_selection_;
+
+  // See Collections().
+  std::vector<std::string> collections_;
+
+  // The CollectionFilter bits of each collection, by collection id, and all
+  // the bits that any collection has, to skip the lookup of the unused ones.
+  std::vector<uint8> collection_filters_;
+  int used_collection_filters_ = 0;
+
+  // See LoadOptions::collect_metrics. nullptr when disabled.
+  std::unique_ptr<const ClassifierMetrics> metrics_;
+
+  // See LoadOptions::adaptive_annotation_quality. nullptr when disabled.
+  std::unique_ptr<AnnotationQualityController> quality_controller_;
+  int64 annotation_latency_target_micros_ = 0;
+
+  // The selection batch size of the model, which also caps the batches of the
+  // classification model, or 1 without selection options.
+  int max_batch_size_ = 1;
+
+  // See LoadOptions::regex_time_limit_millis.
+  int regex_time_limit_millis_ = 0;
 
   std::vector<CompiledRegexPattern> regex_patterns_;
   std::unordered_set<int> regex_approximate_match_pattern_ids_;
 
+  // See LoadOptions::model_gate.
+  ModelGateOptions model_gate_;
+
+  // A ClassifyText() result in the classification cache, and the reference
+  // time it was computed for if it depends on it.
+  struct CachedClassification {
+    std::vector<ClassificationResult> results;
+    bool depends_on_reference_time;
+    int64 reference_time_ms_utc;
+  };
+
+  // See LoadOptions::classification_cache_size. nullptr when disabled.
+  mutable std::mutex classification_cache_mutex_;
+  mutable std::unique_ptr<LruCache<uint64, CachedClassification>>
+      classification_cache_;
+  int64 classification_cache_time_tolerance_ms_ = 0;
+
   // Indices into regex_patterns_ for the different modes.
   std::vector<int> annotation_regex_patterns_, classification_regex_patterns_,
       selection_regex_patterns_;
 
+  // The annotation patterns compiled together, indexed like
+  // annotation_regex_patterns_, or nullptr if not enabled with
+  // LoadOptions::multi_pattern_annotation_regex.
+  std::unique_ptr<const MultiRegex> annotation_multi_regex_;
+
   std::unique_ptr<UniLib> owned_unilib_;
   const UniLib* unilib_;
+
+  friend class AnnotationSession;
+  friend class SelectionSession;
+};
+
+// Annotates successive versions of a text, e.g. after each edit in an editor.
+// Keeps the selection model annotations of the lines of the last version, and
+// runs the selection and classification models only on the lines that are
+// new or changed. The regular expression and datetime models, and the
+// conflict resolution still see the whole text, so the results are the same
+// as those of TextClassifier::Annotate(). The per-call cost of the models is
+// proportional to the edited lines, when the model splits the context into
+// lines (FeatureProcessorOptions::only_use_line_with_click).
+// NOTE: This class is not thread-safe. The classifier must outlive it.
+class AnnotationSession {
+ public:
+  explicit AnnotationSession(const TextClassifier* classifier)
+      : classifier_(classifier) {}
+
+  // Annotates the current version of the text, as TextClassifier::Annotate()
+  // would. AnnotationOptions::num_line_threads is ignored.
+  std::vector<AnnotatedSpan> Annotate(
+      StringPiece context,
+      const AnnotationOptions& options = AnnotationOptions::Default());
+
+  // Returns the number of lines that the last Annotate() call ran through the
+  // models, i.e. that were not the same in the previous version of the text.
+  int NumAnnotatedLines() const { return line_cache_.num_annotated_lines; }
+
+ private:
+  const TextClassifier* classifier_;
+  TextClassifier::LineAnnotationCache line_cache_;
+
+  TC_DISALLOW_COPY_AND_ASSIGN(AnnotationSession);
+};
+
+// Suggests the selections for successive clicks on the same text, e.g. as the
+// user taps several words of a message. Keeps the tokens of the text, their
+// embeddings, and the selection model scores of the candidate spans until the
+// text changes, so a click near an earlier one runs the selection model only
+// on the candidates that weren't scored yet. The results are the same as
+// those of TextClassifier::SuggestSelection(). The model scores are reused
+// only for the bounds-sensitive selection models.
+// NOTE: This class is not thread-safe. The classifier must outlive it.
+class SelectionSession {
+ public:
+  explicit SelectionSession(const TextClassifier* classifier)
+      : classifier_(classifier) {}
+
+  // Suggests the selection for the click on the current text, as
+  // TextClassifier::SuggestSelection() would.
+  CodepointSpan SuggestSelection(
+      StringPiece context, CodepointSpan click_indices,
+      const SelectionOptions& options = SelectionOptions::Default());
+
+  // Returns the numbers of candidate spans that the last SuggestSelection()
+  // call ran through the selection model, and that it reused the scores of.
+  int NumScoredChunks() const { return cache_.num_scored_chunks; }
+  int NumReusedChunks() const { return cache_.num_reused_chunks; }
+
+ private:
+  const TextClassifier* classifier_;
+  TextClassifier::SelectionCache cache_;
+
+  TC_DISALLOW_COPY_AND_ASSIGN(SelectionSession);
 };
 
 namespace internal {
@@ -365,17 +1210,43 @@ CodepointSpan SnapLeftIfWhitespaceSelection(CodepointSpan span,
                                             const UnicodeText& context_unicode,
                                             const UniLib& unilib);
 
-// Copies tokens from 'cached_tokens' that are
-// 'tokens_around_selection_to_copy' (on the left, and right) tokens distant
-// from the tokens that correspond to 'selection_indices'.
+// Returns the span of the tokens of 'cached_tokens' that are up to
+// 'tokens_around_selection' (on the left, and right) tokens distant from the
+// tokens that correspond to 'selection_indices'.
+TokenSpan CachedTokensAroundSelection(const std::vector<Token>& cached_tokens,
+                                      CodepointSpan selection_indices,
+                                      TokenSpan tokens_around_selection);
+
+// Copies the tokens of CachedTokensAroundSelection() from 'cached_tokens'.
 std::vector<Token> CopyCachedTokens(const std::vector<Token>& cached_tokens,
                                     CodepointSpan selection_indices,
                                     TokenSpan tokens_around_selection_to_copy);
+
+// Returns whether 'cached_tokens' has at least 'num_tokens_around' (on the
+// left, and right) tokens around the tokens that correspond to
+// 'selection_indices'.
+bool HasCachedTokensAroundSelection(const std::vector<Token>& cached_tokens,
+                                    CodepointSpan selection_indices,
+                                    TokenSpan num_tokens_around);
+
+// Sorts the candidates by their span and merges the ones with the same
+// non-empty span, keeping the classified one with the highest priority and
+// one of the unclassified model candidates, unless the classified one has a
+// priority that the model can't exceed. Merging doesn't change the result of
+// the conflict resolution, up to the arbitrary choice between ties. Adds the
+// number of model classifications that the conflict resolution won't need to
+// run to 'num_avoided_classifications'.
+void SortAndMergeDuplicateCandidates(std::vector<AnnotatedSpan>* candidates,
+                                     int* num_avoided_classifications);
 }  // namespace internal
 
 // Interprets the buffer as a Model flatbuffer and returns it for reading.
 const Model* ViewModel(const void* buffer, int size);
 
+// Returns the fingerprint of a model buffer for
+// LoadOptions::trusted_model_fingerprint. Never 0.
+uint64 ModelFingerprint(const void* buffer, int size);
+
 }  // namespace libtextclassifier2
 
 #endif  // LIBTEXTCLASSIFIER_TEXT_CLASSIFIER_H_
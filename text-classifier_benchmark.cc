@@ -0,0 +1,344 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Benchmark of the public TextClassifier APIs.
+//
+// Loads every model in a directory and runs SuggestSelection, ClassifyText
+// and Annotate over a set of corpora, reporting the throughput, the latency
+// percentiles and the time spent in each stage.
+//
+// Usage:
+//   libtextclassifier_benchmark [--model_dir=DIR] [--model=PATH]...
+//       [--corpus=PATH[:LOCALES]]... [--iterations=N] [--threads=N]
+//
+// A corpus file contains one input text per line. Without --corpus, a
+// built-in set of short, medium and long texts in several languages is used.
+
+#include <dirent.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "stage-profile.h"
+#include "text-classifier.h"
+#include "util/utf8/unicodetext.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+const char kDefaultModelDir[] = "/etc/textclassifier/";
+
+struct Corpus {
+  std::string name;
+  std::string locales;
+  std::vector<std::string> texts;
+};
+
+struct BenchmarkFlags {
+  std::string model_dir = kDefaultModelDir;
+  std::vector<std::string> models;
+  std::vector<Corpus> corpora;
+  int iterations = 10;
+  int threads = 1;
+};
+
+// Results of running one API over one corpus.
+struct ApiResult {
+  std::vector<int64> latencies_nanos;
+  int64 wall_nanos = 0;
+  int64 processed_bytes = 0;
+  StageProfile profile;
+};
+
+Corpus BuiltinCorpus(const std::string& name, const std::string& locales,
+                     const std::vector<std::string>& texts) {
+  Corpus corpus;
+  corpus.name = name;
+  corpus.locales = locales;
+  corpus.texts = texts;
+  return corpus;
+}
+
+std::vector<Corpus> BuiltinCorpora() {
+  const std::string en_long =
+      "Hi Tom, thanks for the note. The offsite is on March 4th, 2018 at 9am "
+      "in 1600 Amphitheatre Parkway, Mountain View, CA 94043. Please call "
+      "me at (650) 253-0000 or email me at tom@example.com if you cannot "
+      "make it. The agenda is at http://www.example.com/agenda, and the "
+      "flight leaves tomorrow at 5:30pm.|See you there!";
+  std::vector<Corpus> corpora;
+  corpora.push_back(BuiltinCorpus(
+      "en_short", "en",
+      {"Call me at (800) 123-456 today", "Visit www.google.com",
+       "See you tomorrow at 3pm", "Barack Obama gave a speech"}));
+  corpora.push_back(BuiltinCorpus(
+      "en_medium", "en",
+      {"this afternoon Barack Obama gave a speech at|Visit www.google.com "
+       "every today!|Call me at (800) 123-456 today.",
+       "The meeting is at 350 Third Street, Cambridge MA on January 1, 2018 "
+       "at 10:30am, call 617-555-0123 to reschedule."}));
+  corpora.push_back(BuiltinCorpus("en_long", "en",
+                                  {en_long + " " + en_long + " " + en_long}));
+  corpora.push_back(BuiltinCorpus(
+      "multilingual", "de,fr,es,ja,zh",
+      {"Ruf mich morgen um 15 Uhr unter 030 1234567 an.",
+       "Rendez-vous le 3 mars à 10h, 12 rue de Rivoli, Paris.",
+       "Llámame al 91 123 45 67 mañana por la tarde.",
+       "明日の午後3時に03-1234-5678まで電話してください。",
+       "请在明天下午三点给我打电话 010-12345678。"}));
+  return corpora;
+}
+
+bool ReadCorpus(const std::string& spec, Corpus* corpus) {
+  const size_t colon = spec.find(':');
+  const std::string path = spec.substr(0, colon);
+  corpus->name = path.substr(path.rfind('/') + 1);
+  corpus->locales = colon == std::string::npos ? "" : spec.substr(colon + 1);
+  std::ifstream file(path);
+  if (!file) {
+    fprintf(stderr, "Could not open corpus %s\n", path.c_str());
+    return false;
+  }
+  std::string line;
+  while (std::getline(file, line)) {
+    if (!line.empty()) {
+      corpus->texts.push_back(line);
+    }
+  }
+  return !corpus->texts.empty();
+}
+
+bool StartsWith(const std::string& s, const std::string& prefix) {
+  return s.compare(0, prefix.size(), prefix) == 0;
+}
+
+bool ParseFlags(int argc, char** argv, BenchmarkFlags* flags) {
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const std::string value = arg.substr(arg.find('=') + 1);
+    if (StartsWith(arg, "--model_dir=")) {
+      flags->model_dir = value;
+    } else if (StartsWith(arg, "--model=")) {
+      flags->models.push_back(value);
+    } else if (StartsWith(arg, "--corpus=")) {
+      Corpus corpus;
+      if (!ReadCorpus(value, &corpus)) {
+        return false;
+      }
+      flags->corpora.push_back(corpus);
+    } else if (StartsWith(arg, "--iterations=")) {
+      flags->iterations = std::max(1, atoi(value.c_str()));
+    } else if (StartsWith(arg, "--threads=")) {
+      flags->threads = std::max(1, atoi(value.c_str()));
+    } else {
+      fprintf(stderr, "Unknown flag: %s\n", arg.c_str());
+      return false;
+    }
+  }
+
+  if (flags->models.empty()) {
+    DIR* dir = opendir(flags->model_dir.c_str());
+    if (dir == nullptr) {
+      fprintf(stderr, "Could not open model dir %s\n",
+              flags->model_dir.c_str());
+      return false;
+    }
+    std::string dir_path = flags->model_dir;
+    if (dir_path.back() != '/') {
+      dir_path += '/';
+    }
+    while (const dirent* entry = readdir(dir)) {
+      const std::string name = entry->d_name;
+      if (name.size() > 6 && name.substr(name.size() - 6) == ".model") {
+        flags->models.push_back(dir_path + name);
+      }
+    }
+    closedir(dir);
+    std::sort(flags->models.begin(), flags->models.end());
+  }
+  if (flags->corpora.empty()) {
+    flags->corpora = BuiltinCorpora();
+  }
+  return true;
+}
+
+// Returns the codepoint span of the middle codepoint of the text.
+CodepointSpan MiddleClick(const std::string& text) {
+  const int num_codepoints =
+      UTF8ToUnicodeText(text, /*do_copy=*/false).size_codepoints();
+  const int middle = num_codepoints / 2;
+  return {middle, std::min(middle + 1, num_codepoints)};
+}
+
+int64 NanosSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+// Runs 'api' on every text of the corpus, 'iterations' times, on each of
+// 'num_threads' threads.
+template <typename Api>
+ApiResult RunApi(const Corpus& corpus, int iterations, int num_threads,
+                 const Api& api) {
+  std::vector<ApiResult> thread_results(num_threads);
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; ++t) {
+    threads.emplace_back([&corpus, &api, &thread_results, iterations, t]() {
+      ApiResult* result = &thread_results[t];
+      SetThreadStageProfile(&result->profile);
+      for (int i = 0; i < iterations; ++i) {
+        for (int j = 0; j < corpus.texts.size(); ++j) {
+          const auto call_start = std::chrono::steady_clock::now();
+          api(j);
+          result->latencies_nanos.push_back(NanosSince(call_start));
+          result->processed_bytes += corpus.texts[j].size();
+        }
+      }
+      SetThreadStageProfile(nullptr);
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  ApiResult result;
+  result.wall_nanos = NanosSince(start);
+  for (const ApiResult& thread_result : thread_results) {
+    result.latencies_nanos.insert(result.latencies_nanos.end(),
+                                  thread_result.latencies_nanos.begin(),
+                                  thread_result.latencies_nanos.end());
+    result.processed_bytes += thread_result.processed_bytes;
+    result.profile.Add(thread_result.profile);
+  }
+  std::sort(result.latencies_nanos.begin(), result.latencies_nanos.end());
+  return result;
+}
+
+double Percentile(const std::vector<int64>& sorted_values, double percentile) {
+  if (sorted_values.empty()) {
+    return 0.0;
+  }
+  const int index = std::min<int>(sorted_values.size() - 1,
+                                  percentile / 100.0 * sorted_values.size());
+  return sorted_values[index];
+}
+
+void PrintResult(const std::string& api_name, const ApiResult& result) {
+  const double wall_seconds = result.wall_nanos / 1e9;
+  printf("  %-16s calls/s %9.1f  KB/s %9.1f  latency us p50 %9.1f  "
+         "p90 %9.1f  p99 %9.1f  max %9.1f\n",
+         api_name.c_str(), result.latencies_nanos.size() / wall_seconds,
+         result.processed_bytes / 1024.0 / wall_seconds,
+         Percentile(result.latencies_nanos, 50) / 1e3,
+         Percentile(result.latencies_nanos, 90) / 1e3,
+         Percentile(result.latencies_nanos, 99) / 1e3,
+         Percentile(result.latencies_nanos, 100) / 1e3);
+
+  int64 total_nanos = 0;
+  for (const int64 latency : result.latencies_nanos) {
+    total_nanos += latency;
+  }
+  for (int i = 0; i < StageProfile::kNumStages; ++i) {
+    if (result.profile.stage_runs[i] == 0) {
+      continue;
+    }
+    printf("    %-22s %6.1f%%  runs %8lld  us/call %9.1f\n",
+           ProfiledStageName(static_cast<ProfiledStage>(i)),
+           100.0 * result.profile.stage_nanos[i] / std::max<int64>(
+                                                       total_nanos, 1),
+           static_cast<long long>(result.profile.stage_runs[i]),
+           result.profile.stage_nanos[i] / 1e3 /
+               std::max<size_t>(result.latencies_nanos.size(), 1));
+  }
+}
+
+void BenchmarkModel(const std::string& model_path,
+                    const BenchmarkFlags& flags) {
+  const auto load_start = std::chrono::steady_clock::now();
+  std::unique_ptr<TextClassifier> classifier =
+      TextClassifier::FromPath(model_path);
+  if (!classifier) {
+    fprintf(stderr, "Could not load model %s\n", model_path.c_str());
+    return;
+  }
+  printf("Model %s (loaded in %.1f ms)\n", model_path.c_str(),
+         NanosSince(load_start) / 1e6);
+
+  for (const Corpus& corpus : flags.corpora) {
+    printf(" Corpus %s (%zu texts, locales '%s', %d threads)\n",
+           corpus.name.c_str(), corpus.texts.size(), corpus.locales.c_str(),
+           flags.threads);
+
+    SelectionOptions selection_options;
+    selection_options.locales = corpus.locales;
+    ClassificationOptions classification_options;
+    classification_options.locales = corpus.locales;
+    AnnotationOptions annotation_options;
+    annotation_options.locales = corpus.locales;
+
+    // Classify what SuggestSelection suggests for a click into the middle of
+    // each text.
+    std::vector<CodepointSpan> clicks;
+    std::vector<CodepointSpan> selections;
+    for (const std::string& text : corpus.texts) {
+      clicks.push_back(MiddleClick(text));
+      selections.push_back(classifier->SuggestSelection(text, clicks.back(),
+                                                         selection_options));
+    }
+
+    PrintResult("SuggestSelection",
+                RunApi(corpus, flags.iterations, flags.threads, [&](int i) {
+                  classifier->SuggestSelection(corpus.texts[i], clicks[i],
+                                               selection_options);
+                }));
+    PrintResult("ClassifyText",
+                RunApi(corpus, flags.iterations, flags.threads, [&](int i) {
+                  classifier->ClassifyText(corpus.texts[i], selections[i],
+                                           classification_options);
+                }));
+    PrintResult("Annotate",
+                RunApi(corpus, flags.iterations, flags.threads, [&](int i) {
+                  classifier->Annotate(corpus.texts[i], annotation_options);
+                }));
+  }
+}
+
+}  // namespace
+}  // namespace libtextclassifier2
+
+int main(int argc, char** argv) {
+  libtextclassifier2::BenchmarkFlags flags;
+  if (!libtextclassifier2::ParseFlags(argc, argv, &flags)) {
+    return 1;
+  }
+  if (flags.models.empty()) {
+    fprintf(stderr, "No models found.\n");
+    return 1;
+  }
+  for (const std::string& model_path : flags.models) {
+    libtextclassifier2::BenchmarkModel(model_path, flags);
+  }
+  return 0;
+}
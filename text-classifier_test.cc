@@ -16,10 +16,13 @@
 
 #include "text-classifier.h"
 
+#include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <iostream>
 #include <memory>
 #include <string>
+#include <thread>
 
 #include "model_generated.h"
 #include "types-test-util.h"
@@ -109,6 +112,155 @@ TEST_P(TextClassifierTest, ClassifyText) {
                                      "\xf0\x9f\x98\x8b\x8b", {0, 0})));
 }
 
+TEST_P(TextClassifierTest, ClassifyTextFromMultipleThreads) {
+  CREATE_UNILIB_FOR_TESTING;
+  std::unique_ptr<TextClassifier> classifier =
+      TextClassifier::FromPath(GetModelPath() + GetParam(), &unilib);
+  ASSERT_TRUE(classifier);
+
+  const int kNumThreads = 4;
+  const int kNumIterations = 10;
+  std::vector<std::string> results(kNumThreads * kNumIterations);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads.emplace_back([&classifier, &results, i]() {
+      for (int j = 0; j < kNumIterations; ++j) {
+        results[i * kNumIterations + j] = FirstResult(classifier->ClassifyText(
+            "Call me at (800) 123-456 today", {11, 24}));
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  for (const std::string& result : results) {
+    EXPECT_EQ("phone", result);
+  }
+}
+
+TEST_P(TextClassifierTest, ClassifyTextWithCrossRequestBatching) {
+  CREATE_UNILIB_FOR_TESTING;
+  LoadOptions load_options;
+  load_options.classification_batching_wait_micros = 1000;
+  load_options.classification_batching_max_rows = 4;
+  std::unique_ptr<TextClassifier> classifier = TextClassifier::FromPath(
+      GetModelPath() + GetParam(), &unilib, load_options);
+  ASSERT_TRUE(classifier);
+  std::unique_ptr<TextClassifier> unbatched_classifier =
+      TextClassifier::FromPath(GetModelPath() + GetParam(), &unilib);
+  ASSERT_TRUE(unbatched_classifier);
+
+  const std::vector<std::pair<std::string, CodepointSpan>> requests = {
+      {"Call me at (800) 123-456 today", {11, 24}},
+      {"Visit www.google.com every today!", {6, 20}},
+      {"350 Third Street, Cambridge", {0, 27}},
+      {"hello world", {0, 5}},
+  };
+  const int kNumIterations = 10;
+  std::vector<std::vector<ClassificationResult>> results(requests.size() *
+                                                         kNumIterations);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < requests.size(); ++i) {
+    threads.emplace_back([&classifier, &requests, &results, i]() {
+      for (int j = 0; j < kNumIterations; ++j) {
+        results[i * kNumIterations + j] = classifier->ClassifyText(
+            requests[i].first, requests[i].second);
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  for (int i = 0; i < requests.size(); ++i) {
+    const std::vector<ClassificationResult> expected =
+        unbatched_classifier->ClassifyText(requests[i].first,
+                                           requests[i].second);
+    for (int j = 0; j < kNumIterations; ++j) {
+      const std::vector<ClassificationResult>& result =
+          results[i * kNumIterations + j];
+      ASSERT_EQ(result.size(), expected.size());
+      for (int k = 0; k < result.size(); ++k) {
+        EXPECT_EQ(result[k].collection, expected[k].collection);
+        EXPECT_NEAR(result[k].score, expected[k].score, 1e-5);
+      }
+    }
+  }
+}
+
+TEST_P(TextClassifierTest, ClassifyTextWithDequantizedEmbeddings) {
+  CREATE_UNILIB_FOR_TESTING;
+  LoadOptions load_options;
+  load_options.dequantize_embeddings = true;
+  std::unique_ptr<TextClassifier> classifier = TextClassifier::FromPath(
+      GetModelPath() + GetParam(), &unilib, load_options);
+  ASSERT_TRUE(classifier);
+  EXPECT_GT(classifier->ExtraEmbeddingMemoryBytes(), 0);
+
+  std::unique_ptr<TextClassifier> quantized_classifier =
+      TextClassifier::FromPath(GetModelPath() + GetParam(), &unilib);
+  ASSERT_TRUE(quantized_classifier);
+  EXPECT_EQ(quantized_classifier->ExtraEmbeddingMemoryBytes(), 0);
+  EXPECT_EQ(classifier->GetMemoryStats().embedding_bytes,
+            classifier->ExtraEmbeddingMemoryBytes());
+
+  const std::string context =
+      "this afternoon Barack Obama gave a speech at|Visit "
+      "www.google.com every today!|Call me at (800) 123-456 today.";
+  for (const CodepointSpan& selection :
+       std::vector<CodepointSpan>{{15, 27}, {90, 103}}) {
+    const std::vector<ClassificationResult> results =
+        classifier->ClassifyText(context, selection);
+    const std::vector<ClassificationResult> quantized_results =
+        quantized_classifier->ClassifyText(context, selection);
+    ASSERT_EQ(results.size(), quantized_results.size());
+    for (int i = 0; i < results.size(); ++i) {
+      EXPECT_EQ(results[i].collection, quantized_results[i].collection);
+      EXPECT_NEAR(results[i].score, quantized_results[i].score, 1e-4);
+    }
+  }
+}
+
+TEST_P(TextClassifierTest, ExecutorOptionsFallBackToCpu) {
+  CREATE_UNILIB_FOR_TESTING;
+  LoadOptions load_options;
+  load_options.executor_options.num_threads = 2;
+  load_options.executor_options.use_nnapi = true;
+  int num_delegates_requested = 0;
+  load_options.executor_options.delegate_factory =
+      [&num_delegates_requested]() {
+        // No delegate is available, so the interpreters run on the next
+        // option.
+        ++num_delegates_requested;
+        return DelegatePtr(nullptr, [](TfLiteDelegate*) {});
+      };
+  std::unique_ptr<TextClassifier> classifier = TextClassifier::FromPath(
+      GetModelPath() + GetParam(), &unilib, load_options);
+  ASSERT_TRUE(classifier);
+  std::unique_ptr<TextClassifier> default_classifier =
+      TextClassifier::FromPath(GetModelPath() + GetParam(), &unilib);
+  ASSERT_TRUE(default_classifier);
+
+  const std::string context = "Call me at (800) 123-456 today.";
+  EXPECT_EQ(classifier->SuggestSelection(context, {11, 14}),
+            default_classifier->SuggestSelection(context, {11, 14}));
+  const std::vector<ClassificationResult> results =
+      classifier->ClassifyText(context, {11, 24});
+  const std::vector<ClassificationResult> default_results =
+      default_classifier->ClassifyText(context, {11, 24});
+  ASSERT_EQ(results.size(), default_results.size());
+  for (int i = 0; i < results.size(); ++i) {
+    EXPECT_EQ(results[i].collection, default_results[i].collection);
+    EXPECT_NEAR(results[i].score, default_results[i].score, 1e-4);
+  }
+  EXPECT_GT(num_delegates_requested, 0);
+
+  // Profiling is off.
+  EXPECT_TRUE(classifier->GetSelectionOperatorProfile().empty());
+  EXPECT_TRUE(classifier->GetClassificationOperatorProfile().empty());
+}
+
 TEST_P(TextClassifierTest, ClassifyTextDisabledFail) {
   CREATE_UNILIB_FOR_TESTING;
   const std::string test_model = ReadFile(GetModelPath() + GetParam());
@@ -389,8 +541,288 @@ TEST_P(TextClassifierTest, AnnotateRegex) {
                   IsAnnotatedSpan(79, 91, "phone"),
               }));
 }
+
+#ifdef LIBTEXTCLASSIFIER_UNILIB_ICU
+TEST_P(TextClassifierTest, AnnotateRegexWithTimeLimit) {
+  CREATE_UNILIB_FOR_TESTING;
+  const std::string test_model = ReadFile(GetModelPath() + GetParam());
+  std::unique_ptr<ModelT> unpacked_model = UnPackModel(test_model.c_str());
+
+  // Backtracks exponentially on a long run of 'a's without a 'b'.
+  unpacked_model->regex_model->patterns.push_back(MakePattern(
+      "slow", "\\b((a+)+b)", /*enabled_for_classification=*/false,
+      /*enabled_for_selection=*/false, /*enabled_for_annotation=*/true, 1.0));
+  flatbuffers::FlatBufferBuilder builder;
+  builder.Finish(Model::Pack(builder, unpacked_model.get()));
+
+  LoadOptions load_options;
+  load_options.regex_time_limit_millis = 1;
+  std::unique_ptr<TextClassifier> classifier =
+      TextClassifier::FromUnownedBuffer(
+          reinterpret_cast<const char*>(builder.GetBufferPointer()),
+          builder.GetSize(), &unilib, load_options);
+  ASSERT_TRUE(classifier);
+
+  // The slow rule is skipped, the others still run.
+  EXPECT_THAT(
+      classifier->Annotate(std::string(40, 'a') + " call 853 225 3556"),
+      ElementsAreArray({IsAnnotatedSpan(46, 58, "phone")}));
+  EXPECT_GE(classifier->GetMetrics().regex_timeouts, 1);
+
+  // The rule still matches where it doesn't backtrack.
+  EXPECT_THAT(classifier->Annotate("aab"),
+              ElementsAreArray({IsAnnotatedSpan(0, 3, "slow")}));
+}
+#endif  // LIBTEXTCLASSIFIER_UNILIB_ICU
+
+TEST_P(TextClassifierTest, AnnotateSelectedAnnotatorsAndCollections) {
+  CREATE_UNILIB_FOR_TESTING;
+  const std::string test_model = ReadFile(GetModelPath() + GetParam());
+  std::unique_ptr<ModelT> unpacked_model = UnPackModel(test_model.c_str());
+  unpacked_model->regex_model->patterns.push_back(MakePattern(
+      "person", " (Barack Obama) ", /*enabled_for_classification=*/false,
+      /*enabled_for_selection=*/false, /*enabled_for_annotation=*/true, 1.0));
+  flatbuffers::FlatBufferBuilder builder;
+  builder.Finish(Model::Pack(builder, unpacked_model.get()));
+
+  std::unique_ptr<TextClassifier> classifier =
+      TextClassifier::FromUnownedBuffer(
+          reinterpret_cast<const char*>(builder.GetBufferPointer()),
+          builder.GetSize(), &unilib);
+  ASSERT_TRUE(classifier);
+
+  const std::string test_string =
+      "& saw Barack Obama today .. 350 Third Street, Cambridge\nand my phone "
+      "number is 853 225 3556";
+  AnnotationOptions options;
+  options.collections = {"date"};
+  EXPECT_THAT(classifier->Annotate(test_string, options),
+              ElementsAreArray({IsAnnotatedSpan(19, 24, "date")}));
+
+  options.collections = {"person", "phone"};
+  EXPECT_THAT(classifier->Annotate(test_string, options),
+              ElementsAreArray({
+                  IsAnnotatedSpan(6, 18, "person"),
+                  IsAnnotatedSpan(79, 91, "phone"),
+              }));
+  EXPECT_THAT(classifier->AnnotateBatch({test_string}, options),
+              ElementsAreArray({ElementsAreArray({
+                  IsAnnotatedSpan(6, 18, "person"),
+                  IsAnnotatedSpan(79, 91, "phone"),
+              })}));
+
+  options.collections.clear();
+  options.annotators = ANNOTATOR_REGEX;
+  EXPECT_THAT(classifier->Annotate(test_string, options),
+              ElementsAreArray({IsAnnotatedSpan(6, 18, "person")}));
+
+  options.annotators = ANNOTATOR_MODEL | ANNOTATOR_DATETIME;
+  EXPECT_THAT(classifier->Annotate(test_string, options),
+              ElementsAreArray({
+                  IsAnnotatedSpan(19, 24, "date"),
+                  IsAnnotatedSpan(28, 55, "address"),
+                  IsAnnotatedSpan(79, 91, "phone"),
+              }));
+
+  options.annotators = ANNOTATOR_ALL;
+  options.collections = {"no such collection"};
+  EXPECT_TRUE(classifier->Annotate(test_string, options).empty());
+}
+
+TEST_P(TextClassifierTest, AnnotateRegexWithMultiPatternEngine) {
+  CREATE_UNILIB_FOR_TESTING;
+  const std::string test_model = ReadFile(GetModelPath() + GetParam());
+  std::unique_ptr<ModelT> unpacked_model = UnPackModel(test_model.c_str());
+
+  // Add test regex models, the last one not supported by the engine.
+  unpacked_model->regex_model->patterns.push_back(MakePattern(
+      "person", " (Barack Obama) ", /*enabled_for_classification=*/false,
+      /*enabled_for_selection=*/false, /*enabled_for_annotation=*/true, 1.0));
+  unpacked_model->regex_model->patterns.push_back(MakePattern(
+      "flight", "([a-zA-Z]{2} ?\\d{2,4})", /*enabled_for_classification=*/false,
+      /*enabled_for_selection=*/false, /*enabled_for_annotation=*/true, 0.5));
+  unpacked_model->regex_model->patterns.push_back(MakePattern(
+      "street", "\\b(\\w+ Street)\\b", /*enabled_for_classification=*/false,
+      /*enabled_for_selection=*/false, /*enabled_for_annotation=*/true, 0.5));
+  flatbuffers::FlatBufferBuilder builder;
+  builder.Finish(Model::Pack(builder, unpacked_model.get()));
+
+  std::unique_ptr<TextClassifier> classifier =
+      TextClassifier::FromUnownedBuffer(
+          reinterpret_cast<const char*>(builder.GetBufferPointer()),
+          builder.GetSize(), &unilib);
+  ASSERT_TRUE(classifier);
+  LoadOptions load_options;
+  load_options.multi_pattern_annotation_regex = true;
+  std::unique_ptr<TextClassifier> multi_pattern_classifier =
+      TextClassifier::FromUnownedBuffer(
+          reinterpret_cast<const char*>(builder.GetBufferPointer()),
+          builder.GetSize(), &unilib, load_options);
+  ASSERT_TRUE(multi_pattern_classifier);
+
+  for (const std::string& test_string : std::vector<std::string>{
+           "& saw Barack Obama today .. 350 Third Street, Cambridge\nand my "
+           "phone number is 853 225 3556",
+           "flights LX 38 and UA1234 ✈ Barack Obama ",
+           ""}) {
+    const std::vector<AnnotatedSpan> results =
+        classifier->Annotate(test_string);
+    const std::vector<AnnotatedSpan> multi_pattern_results =
+        multi_pattern_classifier->Annotate(test_string);
+    ASSERT_EQ(results.size(), multi_pattern_results.size()) << test_string;
+    for (int i = 0; i < results.size(); ++i) {
+      EXPECT_EQ(results[i].span, multi_pattern_results[i].span);
+      EXPECT_EQ(results[i].classification[0].collection,
+                multi_pattern_results[i].classification[0].collection);
+    }
+  }
+}
 #endif  // LIBTEXTCLASSIFIER_UNILIB_ICU
 
+TEST_P(TextClassifierTest, LazyRegexCompilation) {
+  CREATE_UNILIB_FOR_TESTING;
+  std::unique_ptr<TextClassifier> classifier =
+      TextClassifier::FromPath(GetModelPath() + GetParam(), &unilib);
+  ASSERT_TRUE(classifier);
+  LoadOptions load_options;
+  load_options.lazy_regex_compilation = true;
+  std::unique_ptr<TextClassifier> lazy_classifier = TextClassifier::FromPath(
+      GetModelPath() + GetParam(), &unilib, load_options);
+  ASSERT_TRUE(lazy_classifier);
+
+  const std::string test_string =
+      "& saw Barack Obama today .. 350 Third Street, Cambridge\nand my phone "
+      "number is 853 225 3556, call me tomorrow at 5pm";
+  const std::vector<AnnotatedSpan> results = classifier->Annotate(test_string);
+  const std::vector<AnnotatedSpan> lazy_results =
+      lazy_classifier->Annotate(test_string);
+  ASSERT_EQ(results.size(), lazy_results.size());
+  for (int i = 0; i < results.size(); ++i) {
+    EXPECT_EQ(results[i].span, lazy_results[i].span);
+    EXPECT_EQ(results[i].classification[0].collection,
+              lazy_results[i].classification[0].collection);
+  }
+
+  EXPECT_TRUE(lazy_classifier->Warmup());
+  EXPECT_TRUE(classifier->Warmup());
+}
+
+TEST_P(TextClassifierTest, Warmup) {
+  CREATE_UNILIB_FOR_TESTING;
+  std::unique_ptr<TextClassifier> classifier =
+      TextClassifier::FromPath(GetModelPath() + GetParam(), &unilib);
+  ASSERT_TRUE(classifier);
+  EXPECT_EQ(classifier->GetMemoryStats().num_interpreters, 0);
+
+  WarmupOptions warmup_options;
+  warmup_options.num_interpreters = 3;
+  warmup_options.prefault_embeddings = true;
+  EXPECT_TRUE(classifier->Warmup(warmup_options));
+  const MemoryStats stats = classifier->GetMemoryStats();
+  EXPECT_EQ(stats.num_interpreters, 6);
+  EXPECT_GT(stats.interpreter_bytes, 0);
+
+  // The requests use the interpreters created by the warmup.
+  classifier->Annotate("call me at (800) 123-456 tomorrow at 5pm");
+  EXPECT_EQ(classifier->GetMemoryStats().num_interpreters, 6);
+  EXPECT_TRUE(classifier->Warmup(warmup_options));
+  EXPECT_EQ(classifier->GetMemoryStats().num_interpreters, 6);
+}
+
+TEST_P(TextClassifierTest, Trim) {
+  CREATE_UNILIB_FOR_TESTING;
+  LoadOptions load_options;
+  load_options.lazy_regex_compilation = true;
+  std::unique_ptr<TextClassifier> classifier = TextClassifier::FromPath(
+      GetModelPath() + GetParam(), &unilib, load_options);
+  ASSERT_TRUE(classifier);
+  const int64 uncompiled_regex_bytes =
+      classifier->GetMemoryStats().regex_bytes;
+
+  const std::string test_string =
+      "call me at (800) 123-456 tomorrow at 5pm, www.google.com";
+  const std::vector<AnnotatedSpan> results = classifier->Annotate(test_string);
+  EXPECT_GT(classifier->GetMemoryStats().num_interpreters, 0);
+  EXPECT_GT(classifier->GetMemoryStats().regex_bytes, uncompiled_regex_bytes);
+
+  classifier->Trim(TrimLevel::SCRATCH);
+  EXPECT_EQ(classifier->GetMemoryStats().num_interpreters, 0);
+  EXPECT_GT(classifier->GetMemoryStats().regex_bytes, uncompiled_regex_bytes);
+
+  classifier->Trim(TrimLevel::PATTERNS);
+  EXPECT_EQ(classifier->GetMemoryStats().regex_bytes, uncompiled_regex_bytes);
+
+  // The trimmed classifier still works the same.
+  const std::vector<AnnotatedSpan> trimmed_results =
+      classifier->Annotate(test_string);
+  ASSERT_EQ(trimmed_results.size(), results.size());
+  for (int i = 0; i < results.size(); ++i) {
+    EXPECT_EQ(trimmed_results[i].span, results[i].span);
+    EXPECT_EQ(trimmed_results[i].classification[0].collection,
+              results[i].classification[0].collection);
+  }
+}
+
+TEST_P(TextClassifierTest, TrustedModelFingerprint) {
+  CREATE_UNILIB_FOR_TESTING;
+  const std::string model = ReadFile(GetModelPath() + GetParam());
+  LoadOptions load_options;
+  load_options.trusted_model_fingerprint =
+      ModelFingerprint(model.data(), model.size());
+  std::unique_ptr<TextClassifier> trusted_classifier =
+      TextClassifier::FromUnownedBuffer(model.data(), model.size(), &unilib,
+                                        load_options);
+  ASSERT_TRUE(trusted_classifier);
+  EXPECT_EQ("phone", FirstResult(trusted_classifier->ClassifyText(
+                         "Call me at (800) 123-456 today", {11, 24})));
+
+  // A corrupted model doesn't match the fingerprint and is verified.
+  std::string corrupted_model = model;
+  corrupted_model[0] = '\xff';
+  corrupted_model[1] = '\xff';
+  EXPECT_FALSE(TextClassifier::FromUnownedBuffer(corrupted_model.data(),
+                                                 corrupted_model.size(),
+                                                 &unilib, load_options));
+
+  // A valid model that doesn't match fails when the fingerprint is required.
+  load_options.trusted_model_fingerprint += 1;
+  EXPECT_TRUE(TextClassifier::FromUnownedBuffer(model.data(), model.size(),
+                                                &unilib, load_options));
+  load_options.require_trusted_model = true;
+  EXPECT_FALSE(TextClassifier::FromUnownedBuffer(model.data(), model.size(),
+                                                 &unilib, load_options));
+}
+
+TEST_P(TextClassifierTest, MemoryStats) {
+  CREATE_UNILIB_FOR_TESTING;
+  std::unique_ptr<TextClassifier> classifier =
+      TextClassifier::FromPath(GetModelPath() + GetParam(), &unilib);
+  ASSERT_TRUE(classifier);
+
+  MemoryStats stats = classifier->GetMemoryStats();
+  EXPECT_GT(stats.model_bytes, 0);
+  EXPECT_GE(stats.model_resident_bytes, 0);
+  EXPECT_LE(stats.model_resident_bytes, stats.model_bytes);
+  EXPECT_EQ(stats.num_interpreters, 0);
+  EXPECT_GT(stats.regex_bytes, 0);
+  EXPECT_GT(stats.feature_processor_bytes, 0);
+  EXPECT_GT(stats.datetime_bytes, 0);
+
+  // The interpreters and caches are created by the requests.
+  classifier->Annotate("call me at (800) 123-456 tomorrow at 5pm");
+  const MemoryStats used_stats = classifier->GetMemoryStats();
+  EXPECT_GT(used_stats.num_interpreters, 0);
+  EXPECT_GT(used_stats.interpreter_bytes, 0);
+  EXPECT_GE(used_stats.datetime_bytes, stats.datetime_bytes);
+  EXPECT_GT(used_stats.AllocatedBytes(), stats.AllocatedBytes());
+
+  const std::string model = ReadFile(GetModelPath() + GetParam());
+  std::unique_ptr<TextClassifier> unowned_classifier =
+      TextClassifier::FromUnownedBuffer(model.data(), model.size(), &unilib);
+  ASSERT_TRUE(unowned_classifier);
+  EXPECT_EQ(unowned_classifier->GetMemoryStats().model_bytes, model.size());
+}
+
 TEST_P(TextClassifierTest, PhoneFiltering) {
   CREATE_UNILIB_FOR_TESTING;
   std::unique_ptr<TextClassifier> classifier =
@@ -542,6 +974,35 @@ TEST_P(TextClassifierTest, SuggestSelectionFilteredCollections) {
             std::make_pair(0, 27));
 }
 
+TEST_P(TextClassifierTest, SuggestAndClassify) {
+  CREATE_UNILIB_FOR_TESTING;
+  std::unique_ptr<TextClassifier> classifier =
+      TextClassifier::FromPath(GetModelPath() + GetParam(), &unilib);
+  ASSERT_TRUE(classifier);
+
+  for (const std::string& text :
+       {"call me at 857 225 3556 today", "350 Third Street, Cambridge",
+        "visit www.google.com today", "hello world"}) {
+    for (const CodepointSpan click : {std::make_pair(0, 1),
+                                      std::make_pair(11, 14)}) {
+      const CodepointSpan selection =
+          classifier->SuggestSelection(text, click);
+      const std::vector<ClassificationResult> classification =
+          classifier->ClassifyText(text, selection);
+
+      const AnnotatedSpan result = classifier->SuggestAndClassify(text, click);
+      EXPECT_EQ(result.span, selection) << text;
+      ASSERT_EQ(result.classification.size(), classification.size()) << text;
+      for (int i = 0; i < classification.size(); ++i) {
+        EXPECT_EQ(result.classification[i].collection,
+                  classification[i].collection);
+        EXPECT_NEAR(result.classification[i].score, classification[i].score,
+                    1e-6);
+      }
+    }
+  }
+}
+
 TEST_P(TextClassifierTest, SuggestSelectionsAreSymmetric) {
   CREATE_UNILIB_FOR_TESTING;
   std::unique_ptr<TextClassifier> classifier =
@@ -677,6 +1138,31 @@ TEST_P(TextClassifierTest, SuggestSelectionSelectSpace) {
             std::make_pair(5, 6));
 }
 
+TEST(TextClassifierTest, ClickContextSelectionWithFullOutputSpace) {
+  CREATE_UNILIB_FOR_TESTING;
+  const std::string test_model = ReadFile(GetModelPath() + "test_model_cc.fb");
+  std::unique_ptr<ModelT> unpacked_model = UnPackModel(test_model.c_str());
+
+  // Without the reduced output space, the labels reach up to
+  // 2 * max_selection_span + 1 tokens around the click.
+  unpacked_model->selection_feature_options->selection_reduced_output_space =
+      false;
+  flatbuffers::FlatBufferBuilder builder;
+  builder.Finish(Model::Pack(builder, unpacked_model.get()));
+
+  std::unique_ptr<TextClassifier> classifier =
+      TextClassifier::FromUnownedBuffer(
+          reinterpret_cast<const char*>(builder.GetBufferPointer()),
+          builder.GetSize(), &unilib);
+  ASSERT_TRUE(classifier);
+
+  EXPECT_EQ(
+      classifier->SuggestSelection("call me at 857 225 3556 today", {11, 14}),
+      std::make_pair(11, 23));
+  EXPECT_THAT(classifier->Annotate("call me at 857 225 3556 today"),
+              ElementsAreArray({IsAnnotatedSpan(11, 23, "phone")}));
+}
+
 TEST(TextClassifierTest, SnapLeftIfWhitespaceSelection) {
   CREATE_UNILIB_FOR_TESTING;
   UnicodeText text;
@@ -737,6 +1223,411 @@ TEST_P(TextClassifierTest, Annotate) {
           .empty());
 }
 
+TEST_P(TextClassifierTest, AnnotatePieceOfLargerBuffer) {
+  CREATE_UNILIB_FOR_TESTING;
+  std::unique_ptr<TextClassifier> classifier =
+      TextClassifier::FromPath(GetModelPath() + GetParam(), &unilib);
+  ASSERT_TRUE(classifier);
+
+  // The record is in the middle of the buffer, without a terminating zero.
+  const std::string buffer = "853 225 3556|call me at 853 225 3556 today|x";
+  const StringPiece record(buffer.data() + 13, 29);
+  const std::string record_string = record.ToString();
+  EXPECT_THAT(classifier->Annotate(record),
+              ElementsAreArray({IsAnnotatedSpan(11, 23, "phone")}));
+  EXPECT_EQ(classifier->SuggestSelection(record, {11, 14}),
+            classifier->SuggestSelection(record_string, {11, 14}));
+  EXPECT_EQ(FirstResult(classifier->ClassifyText(record, {11, 23})), "phone");
+}
+
+TEST_P(TextClassifierTest, Collections) {
+  CREATE_UNILIB_FOR_TESTING;
+  std::unique_ptr<TextClassifier> classifier =
+      TextClassifier::FromPath(GetModelPath() + GetParam(), &unilib);
+  ASSERT_TRUE(classifier);
+
+  const std::vector<std::string>& collections = classifier->Collections();
+  EXPECT_TRUE(std::is_sorted(collections.begin(), collections.end()));
+  for (const std::string& collection : {"other", "phone", "address"}) {
+    const int id = classifier->CollectionId(collection);
+    ASSERT_GE(id, 0) << collection;
+    EXPECT_EQ(collections[id], collection);
+  }
+  EXPECT_EQ(classifier->CollectionId("no such collection"), -1);
+
+  for (const AnnotatedSpan& annotation :
+       classifier->Annotate("call me at 853 225 3556 today")) {
+    for (const ClassificationResult& classification :
+         annotation.classification) {
+      EXPECT_GE(classifier->CollectionId(classification.collection), 0);
+    }
+  }
+}
+
+TEST_P(TextClassifierTest, AnnotateWithDeadline) {
+  CREATE_UNILIB_FOR_TESTING;
+  std::unique_ptr<TextClassifier> classifier =
+      TextClassifier::FromPath(GetModelPath() + GetParam(), &unilib);
+  ASSERT_TRUE(classifier);
+
+  const std::string test_string =
+      "& saw Barack Obama today .. 350 Third Street, Cambridge\nand my phone "
+      "number is 853 225 3556";
+  bool partial_result = true;
+  AnnotationOptions options;
+  options.deadline = Deadline::InMs(60 * 1000);
+  options.partial_result = &partial_result;
+  EXPECT_EQ(classifier->Annotate(test_string, options).size(),
+            classifier->Annotate(test_string).size());
+  EXPECT_FALSE(partial_result);
+
+  // Cancelled before it started, nothing is annotated.
+  const std::atomic<bool> cancelled(true);
+  options.deadline = Deadline();
+  options.deadline.cancelled = &cancelled;
+  EXPECT_THAT(classifier->Annotate(test_string, options), IsEmpty());
+  EXPECT_TRUE(partial_result);
+
+  options.deadline = Deadline::InMs(-1);
+  EXPECT_THAT(classifier->AnnotateBatch({test_string, test_string}, options),
+              ElementsAreArray({IsEmpty(), IsEmpty()}));
+  EXPECT_TRUE(partial_result);
+
+  ClassificationOptions classification_options;
+  classification_options.deadline = Deadline::InMs(-1);
+  classification_options.partial_result = &partial_result;
+  EXPECT_THAT(classifier->ClassifyText("853 225 3556", {0, 12},
+                                       classification_options),
+              IsEmpty());
+  EXPECT_TRUE(partial_result);
+  classification_options.deadline = Deadline();
+  EXPECT_EQ(FirstResult(classifier->ClassifyText("853 225 3556", {0, 12},
+                                                 classification_options)),
+            "phone");
+  EXPECT_FALSE(partial_result);
+}
+
+TEST_P(TextClassifierTest, AnnotateWithAdaptiveQuality) {
+  CREATE_UNILIB_FOR_TESTING;
+  LoadOptions load_options;
+  load_options.adaptive_annotation_quality = true;
+  std::unique_ptr<TextClassifier> classifier = TextClassifier::FromPath(
+      GetModelPath() + GetParam(), &unilib, load_options);
+  ASSERT_TRUE(classifier);
+
+  const std::string test_string =
+      "& saw Barack Obama today .. 350 Third Street, Cambridge\nand my phone "
+      "number is 853 225 3556";
+  AnnotationQuality quality = AnnotationQuality::NUM_LEVELS;
+  AnnotationOptions options;
+  options.quality = &quality;
+
+  // Without a budget, the calls run at the full quality.
+  const std::vector<AnnotatedSpan> full_result =
+      classifier->Annotate(test_string, options);
+  EXPECT_EQ(quality, AnnotationQuality::FULL);
+
+  // No call fits into a microsecond, so each call degrades one step further,
+  // as far as allowed.
+  options.latency_budget_micros = 1;
+  options.lowest_quality = AnnotationQuality::NO_MODEL;
+  classifier->Annotate(test_string, options);
+  EXPECT_EQ(quality, AnnotationQuality::NO_MODEL);
+  for (const AnnotatedSpan& span : classifier->Annotate(test_string, options)) {
+    EXPECT_NE(span.source, AnnotatedSpan::Source::MODEL);
+  }
+  EXPECT_EQ(quality, AnnotationQuality::NO_MODEL);
+
+  options.lowest_quality = AnnotationQuality::REGEX_ONLY;
+  classifier->Annotate(test_string, options);
+  EXPECT_EQ(quality, AnnotationQuality::REGEX_ONLY);
+
+  // Callers can opt out.
+  options.lowest_quality = AnnotationQuality::FULL;
+  EXPECT_EQ(classifier->Annotate(test_string, options).size(),
+            full_result.size());
+  EXPECT_EQ(quality, AnnotationQuality::FULL);
+}
+
+TEST_P(TextClassifierTest, AnnotateWithTracer) {
+  CREATE_UNILIB_FOR_TESTING;
+  std::unique_ptr<TextClassifier> classifier =
+      TextClassifier::FromPath(GetModelPath() + GetParam(), &unilib);
+  ASSERT_TRUE(classifier);
+
+  AggregatingRequestTracer tracer;
+  AnnotationOptions options;
+  options.tracer = &tracer;
+  EXPECT_THAT(classifier->Annotate("call me at 853 225 3556 today", options),
+              ElementsAreArray({IsAnnotatedSpan(11, 23, "phone")}));
+
+  const AggregatingRequestTracer::PhaseStats model_stats =
+      tracer.GetStats(TracedPhase::MODEL_ANNOTATE);
+  EXPECT_EQ(model_stats.runs, 1);
+  EXPECT_GT(model_stats.counters.tokens, 0);
+  EXPECT_GT(model_stats.counters.model_batches, 0);
+  EXPECT_EQ(tracer.GetStats(TracedPhase::REGEX).runs, 1);
+  EXPECT_EQ(tracer.GetStats(TracedPhase::DATETIME).runs, 1);
+  EXPECT_EQ(tracer.GetStats(TracedPhase::RESOLVE_CONFLICTS).runs, 1);
+  EXPECT_GE(tracer.GetStats(TracedPhase::RESOLVE_CONFLICTS).counters.results,
+            1);
+  EXPECT_EQ(tracer.GetStats(TracedPhase::MODEL_CLASSIFY_TEXT).runs, 0);
+}
+
+TEST_P(TextClassifierTest, SharedEmbeddingCache) {
+  CREATE_UNILIB_FOR_TESTING;
+  LoadOptions load_options;
+  load_options.shared_embedding_cache_bytes = 1 << 20;
+  std::unique_ptr<TextClassifier> classifier = TextClassifier::FromPath(
+      GetModelPath() + GetParam(), &unilib, load_options);
+  ASSERT_TRUE(classifier);
+  std::unique_ptr<TextClassifier> uncached_classifier =
+      TextClassifier::FromPath(GetModelPath() + GetParam(), &unilib);
+  ASSERT_TRUE(uncached_classifier);
+  EXPECT_EQ(uncached_classifier->GetSharedEmbeddingCacheStats().num_entries,
+            0);
+
+  const std::string context = "Call me at (800) 123-456 today";
+  for (int i = 0; i < 2; ++i) {
+    const std::vector<ClassificationResult> results =
+        classifier->ClassifyText(context, {11, 24});
+    const std::vector<ClassificationResult> uncached_results =
+        uncached_classifier->ClassifyText(context, {11, 24});
+    ASSERT_EQ(results.size(), uncached_results.size());
+    for (int j = 0; j < results.size(); ++j) {
+      EXPECT_EQ(results[j].collection, uncached_results[j].collection);
+      EXPECT_FLOAT_EQ(results[j].score, uncached_results[j].score);
+    }
+    EXPECT_EQ(classifier->SuggestSelection(context, {11, 14}),
+              uncached_classifier->SuggestSelection(context, {11, 14}));
+  }
+
+  // The second round found the embeddings of the first.
+  const SharedEmbeddingCache::Stats stats =
+      classifier->GetSharedEmbeddingCacheStats();
+  EXPECT_GT(stats.num_hits, 0);
+  EXPECT_GT(stats.num_entries, 0);
+  EXPECT_EQ(classifier->GetMemoryStats().embedding_cache_bytes,
+            stats.memory_bytes);
+
+  classifier->Trim(TrimLevel::SCRATCH);
+  EXPECT_EQ(classifier->GetSharedEmbeddingCacheStats().num_entries, 0);
+}
+
+TEST_P(TextClassifierTest, Metrics) {
+  CREATE_UNILIB_FOR_TESTING;
+  std::unique_ptr<TextClassifier> classifier =
+      TextClassifier::FromPath(GetModelPath() + GetParam(), &unilib);
+  ASSERT_TRUE(classifier);
+
+  const std::string context = "Call me at (800) 123-456 today";
+  classifier->SuggestSelection(context, {11, 14});
+  const std::vector<ClassificationResult> classification =
+      classifier->ClassifyText(context, {11, 24});
+  ASSERT_FALSE(classification.empty());
+  classifier->Annotate(context);
+
+  const MetricsSnapshot metrics = classifier->GetMetrics();
+  const int classify_text = static_cast<int>(MetricsMode::CLASSIFY_TEXT);
+  EXPECT_EQ(metrics.modes[static_cast<int>(MetricsMode::SUGGEST_SELECTION)]
+                .requests,
+            1);
+  EXPECT_EQ(metrics.modes[classify_text].requests, 1);
+  EXPECT_EQ(metrics.modes[classify_text].input_bytes.TotalCount(), 1);
+  EXPECT_EQ(metrics.modes[classify_text].latency_micros.TotalCount(), 1);
+  EXPECT_EQ(metrics.modes[classify_text].results_by_collection
+                [classifier->CollectionId(classification[0].collection)],
+            1);
+  EXPECT_EQ(metrics.modes[static_cast<int>(MetricsMode::ANNOTATE)].requests,
+            1);
+
+  LoadOptions load_options;
+  load_options.collect_metrics = false;
+  classifier = TextClassifier::FromPath(GetModelPath() + GetParam(), &unilib,
+                                        load_options);
+  ASSERT_TRUE(classifier);
+  classifier->ClassifyText(context, {11, 24});
+  EXPECT_EQ(classifier->GetMetrics().modes[classify_text].requests, 0);
+}
+
+TEST_P(TextClassifierTest, ClassifyTextFromCache) {
+  CREATE_UNILIB_FOR_TESTING;
+  LoadOptions load_options;
+  load_options.classification_cache_size = 2;
+  std::unique_ptr<TextClassifier> classifier = TextClassifier::FromPath(
+      GetModelPath() + GetParam(), &unilib, load_options);
+  ASSERT_TRUE(classifier);
+
+  AggregatingRequestTracer tracer;
+  ClassificationOptions options;
+  options.tracer = &tracer;
+  const std::string context = "Call me at (800) 123-456 today";
+  EXPECT_EQ(FirstResult(classifier->ClassifyText(context, {11, 24}, options)),
+            "phone");
+  EXPECT_EQ(tracer.GetStats(TracedPhase::REGEX).runs, 1);
+
+  // The same selection in the same surroundings is served from the cache.
+  EXPECT_EQ(FirstResult(classifier->ClassifyText(context, {11, 24}, options)),
+            "phone");
+  EXPECT_EQ(tracer.GetStats(TracedPhase::REGEX).runs, 1);
+
+  // Other locales make another entry.
+  options.locales = "de";
+  EXPECT_EQ(FirstResult(classifier->ClassifyText(context, {11, 24}, options)),
+            "phone");
+  EXPECT_EQ(tracer.GetStats(TracedPhase::REGEX).runs, 2);
+
+  classifier->Trim(TrimLevel::SCRATCH);
+  EXPECT_EQ(FirstResult(classifier->ClassifyText(context, {11, 24}, options)),
+            "phone");
+  EXPECT_EQ(tracer.GetStats(TracedPhase::REGEX).runs, 3);
+}
+
+TEST_P(TextClassifierTest, AnnotateWithModelGate) {
+  CREATE_UNILIB_FOR_TESTING;
+  LoadOptions load_options;
+  load_options.model_gate.enabled = true;
+  std::unique_ptr<TextClassifier> classifier = TextClassifier::FromPath(
+      GetModelPath() + GetParam(), &unilib, load_options);
+  ASSERT_TRUE(classifier);
+
+  AggregatingRequestTracer tracer;
+  AnnotationOptions options;
+  options.tracer = &tracer;
+  EXPECT_THAT(classifier->Annotate("call me at 853 225 3556 today", options),
+              ElementsAreArray({IsAnnotatedSpan(11, 23, "phone")}));
+  EXPECT_EQ(
+      tracer.GetStats(TracedPhase::MODEL_ANNOTATE).counters.gated_lines, 0);
+
+  EXPECT_THAT(classifier->Annotate("see you there, my friend", options),
+              IsEmpty());
+  EXPECT_EQ(
+      tracer.GetStats(TracedPhase::MODEL_ANNOTATE).counters.gated_lines, 1);
+}
+
+TEST_P(TextClassifierTest, AnnotateWithLineThreads) {
+  CREATE_UNILIB_FOR_TESTING;
+  std::unique_ptr<TextClassifier> classifier =
+      TextClassifier::FromPath(GetModelPath() + GetParam(), &unilib);
+  ASSERT_TRUE(classifier);
+
+  const std::string test_string =
+      "& saw Barack Obama today .. 350 Third Street, Cambridge\nand my phone "
+      "number is 853 225 3556\nCall me at (800) 123-456 today\nasdf";
+  AnnotationOptions options;
+  const std::vector<AnnotatedSpan> expected =
+      classifier->Annotate(test_string, options);
+  ASSERT_FALSE(expected.empty());
+
+  options.num_line_threads = 3;
+  const std::vector<AnnotatedSpan> result =
+      classifier->Annotate(test_string, options);
+  ASSERT_EQ(result.size(), expected.size());
+  for (int i = 0; i < result.size(); ++i) {
+    EXPECT_THAT(result[i], IsAnnotatedSpan(expected[i].span.first,
+                                           expected[i].span.second,
+                                           FirstResult(
+                                               expected[i].classification)));
+  }
+}
+
+TEST_P(TextClassifierTest, AnnotationSession) {
+  CREATE_UNILIB_FOR_TESTING;
+  std::unique_ptr<TextClassifier> classifier =
+      TextClassifier::FromPath(GetModelPath() + GetParam(), &unilib);
+  ASSERT_TRUE(classifier);
+
+  const std::vector<std::string> versions = {
+      "& saw Barack Obama today .. 350 Third Street, Cambridge\nand my phone "
+      "number is 853 225 3556",
+      "& saw Barack Obama today .. 350 Third Street, Cambridge\nand my phone "
+      "number is 853 225 3556\nCall me at (800) 123-456 today",
+      "Ok\n& saw Barack Obama today .. 350 Third Street, Cambridge\nand my "
+      "phone number is 853 225 3556\nCall me at (800) 123-456 today",
+      "Ok\n& saw Barack Obama today .. 350 Third Street, Cambridge\nand my "
+      "phone number is 853 225 3556\nCall me at (800) 123-456 today"};
+
+  AnnotationSession session(classifier.get());
+  std::vector<int> num_annotated_lines;
+  for (const std::string& version : versions) {
+    const std::vector<AnnotatedSpan> expected = classifier->Annotate(version);
+    const std::vector<AnnotatedSpan> result = session.Annotate(version);
+    num_annotated_lines.push_back(session.NumAnnotatedLines());
+    ASSERT_EQ(result.size(), expected.size());
+    for (int i = 0; i < result.size(); ++i) {
+      EXPECT_THAT(result[i], IsAnnotatedSpan(expected[i].span.first,
+                                             expected[i].span.second,
+                                             FirstResult(
+                                                 expected[i].classification)));
+    }
+  }
+
+  if (classifier->SelectionFeatureProcessorForTests()
+          ->GetOptions()
+          ->only_use_line_with_click()) {
+    // Only the added lines are run through the models.
+    EXPECT_THAT(num_annotated_lines, ElementsAreArray({2, 1, 1, 0}));
+  }
+}
+
+TEST_P(TextClassifierTest, SelectionSession) {
+  CREATE_UNILIB_FOR_TESTING;
+  std::unique_ptr<TextClassifier> classifier =
+      TextClassifier::FromPath(GetModelPath() + GetParam(), &unilib);
+  ASSERT_TRUE(classifier);
+
+  const std::string context =
+      "call me at 857 225 3556 today or visit 350 Third Street, Cambridge";
+  const std::vector<CodepointSpan> clicks = {
+      {11, 14}, {15, 18}, {11, 14}, {39, 42}, {5, 7}};
+  SelectionSession session(classifier.get());
+  std::vector<int> num_scored_chunks;
+  for (const CodepointSpan& click : clicks) {
+    EXPECT_EQ(session.SuggestSelection(context, click),
+              classifier->SuggestSelection(context, click));
+    num_scored_chunks.push_back(session.NumScoredChunks());
+  }
+
+  // Another text starts over.
+  const std::string other_context = "call me at (800) 123-456 today";
+  EXPECT_EQ(session.SuggestSelection(other_context, {11, 16}),
+            classifier->SuggestSelection(other_context, {11, 16}));
+
+  const FeatureProcessorOptions_::BoundsSensitiveFeatures*
+      bounds_sensitive_features =
+          classifier->SelectionFeatureProcessorForTests()
+              ->GetOptions()
+              ->bounds_sensitive_features();
+  if (bounds_sensitive_features != nullptr &&
+      bounds_sensitive_features->enabled()) {
+    // The repeated click runs no model, and the neighboring ones less of it.
+    EXPECT_GT(num_scored_chunks[0], 0);
+    EXPECT_LT(num_scored_chunks[1], num_scored_chunks[0]);
+    EXPECT_EQ(num_scored_chunks[2], 0);
+    EXPECT_GT(session.NumScoredChunks(), 0);
+  }
+}
+
+TEST_P(TextClassifierTest, AnnotateBatch) {
+  CREATE_UNILIB_FOR_TESTING;
+  std::unique_ptr<TextClassifier> classifier =
+      TextClassifier::FromPath(GetModelPath() + GetParam(), &unilib);
+  ASSERT_TRUE(classifier);
+
+  const std::vector<std::vector<AnnotatedSpan>> results =
+      classifier->AnnotateBatch({"853 225 3556", "853 225\n3556",
+                                 "853 225 3556\n\xf0\x9f\x98\x8b\x8b",
+                                 "and my phone number is 853 225 3556"});
+  ASSERT_EQ(results.size(), 4);
+  EXPECT_THAT(results[0], ElementsAreArray({IsAnnotatedSpan(0, 12, "phone")}));
+  EXPECT_TRUE(results[1].empty());
+  EXPECT_TRUE(results[2].empty());
+  EXPECT_THAT(results[3],
+              ElementsAreArray({IsAnnotatedSpan(23, 35, "phone")}));
+
+  EXPECT_TRUE(classifier->AnnotateBatch({}).empty());
+}
+
 TEST_P(TextClassifierTest, AnnotateSmallBatches) {
   CREATE_UNILIB_FOR_TESTING;
   const std::string test_model = ReadFile(GetModelPath() + GetParam());
@@ -771,6 +1662,104 @@ TEST_P(TextClassifierTest, AnnotateSmallBatches) {
   EXPECT_TRUE(classifier->Annotate("853 225\n3556", options).empty());
 }
 
+TEST_P(TextClassifierTest, AnnotateLinesSharingBatches) {
+  CREATE_UNILIB_FOR_TESTING;
+  const std::string test_model = ReadFile(GetModelPath() + GetParam());
+  std::unique_ptr<ModelT> unpacked_model = UnPackModel(test_model.c_str());
+
+  // A batch size that makes the batches span several lines and documents.
+  unpacked_model->selection_options->batch_size = 7;
+  flatbuffers::FlatBufferBuilder builder;
+  builder.Finish(Model::Pack(builder, unpacked_model.get()));
+
+  std::unique_ptr<TextClassifier> classifier =
+      TextClassifier::FromUnownedBuffer(
+          reinterpret_cast<const char*>(builder.GetBufferPointer()),
+          builder.GetSize(), &unilib);
+  ASSERT_TRUE(classifier);
+
+  const std::vector<std::string> test_strings = {
+      "& saw Barack Obama today .. 350 Third Street, Cambridge\nand my phone "
+      "number is 853 225 3556\nCall me at (800) 123-456 today\nasdf",
+      "ok\n853 225 3556\nhi",
+      "and my phone number is 853 225 3556"};
+
+  // The lines annotated one by one on several threads don't share batches.
+  AnnotationOptions per_line_options;
+  per_line_options.num_line_threads = 2;
+  std::vector<std::vector<AnnotatedSpan>> expected;
+  for (const std::string& test_string : test_strings) {
+    expected.push_back(classifier->Annotate(test_string, per_line_options));
+  }
+  ASSERT_FALSE(expected[0].empty());
+
+  const auto expect_same = [](const std::vector<AnnotatedSpan>& result,
+                              const std::vector<AnnotatedSpan>& expected) {
+    ASSERT_EQ(result.size(), expected.size());
+    for (int i = 0; i < result.size(); ++i) {
+      EXPECT_THAT(result[i], IsAnnotatedSpan(expected[i].span.first,
+                                             expected[i].span.second,
+                                             FirstResult(
+                                                 expected[i].classification)));
+    }
+  };
+  for (int i = 0; i < test_strings.size(); ++i) {
+    expect_same(classifier->Annotate(test_strings[i]), expected[i]);
+  }
+  const std::vector<std::vector<AnnotatedSpan>> results =
+      classifier->AnnotateBatch(test_strings);
+  ASSERT_EQ(results.size(), expected.size());
+  for (int i = 0; i < results.size(); ++i) {
+    expect_same(results[i], expected[i]);
+  }
+}
+
+TEST_P(TextClassifierTest, AnnotateWithTaskRunner) {
+  CREATE_UNILIB_FOR_TESTING;
+  const std::string test_model = ReadFile(GetModelPath() + GetParam());
+  std::unique_ptr<ModelT> unpacked_model = UnPackModel(test_model.c_str());
+
+  // The whole context is one line, and has several selection model batches.
+  unpacked_model->selection_feature_options->only_use_line_with_click = false;
+  unpacked_model->selection_options->batch_size = 5;
+  flatbuffers::FlatBufferBuilder builder;
+  builder.Finish(Model::Pack(builder, unpacked_model.get()));
+
+  std::unique_ptr<TextClassifier> classifier =
+      TextClassifier::FromUnownedBuffer(
+          reinterpret_cast<const char*>(builder.GetBufferPointer()),
+          builder.GetSize(), &unilib);
+  ASSERT_TRUE(classifier);
+
+  std::string test_string;
+  for (int i = 0; i < 5; ++i) {
+    test_string +=
+        "& saw Barack Obama today .. 350 Third Street, Cambridge\nand my "
+        "phone number is 853 225 3556\nCall me at (800) 123-456 today\n";
+  }
+  const std::vector<AnnotatedSpan> expected =
+      classifier->Annotate(test_string);
+  ASSERT_FALSE(expected.empty());
+
+  ThreadTaskRunner task_runner(/*num_threads=*/3);
+  for (const int max_shards : {1, 2, 7}) {
+    AnnotationOptions options;
+    options.task_runner = &task_runner;
+    options.max_shards = max_shards;
+    const std::vector<AnnotatedSpan> result =
+        classifier->Annotate(test_string, options);
+    ASSERT_EQ(result.size(), expected.size());
+    for (int i = 0; i < result.size(); ++i) {
+      EXPECT_THAT(result[i], IsAnnotatedSpan(expected[i].span.first,
+                                             expected[i].span.second,
+                                             FirstResult(
+                                                 expected[i].classification)));
+      EXPECT_FLOAT_EQ(result[i].classification[0].score,
+                      expected[i].classification[0].score);
+    }
+  }
+}
+
 #ifdef LIBTEXTCLASSIFIER_UNILIB_ICU
 TEST_P(TextClassifierTest, AnnotateFilteringDiscardAll) {
   CREATE_UNILIB_FOR_TESTING;
@@ -1062,7 +2051,8 @@ TEST_P(TextClassifierTest, SuggestTextDateDisabled) {
 class TestingTextClassifier : public TextClassifier {
  public:
   TestingTextClassifier(const std::string& model, const UniLib* unilib)
-      : TextClassifier(ViewModel(model.data(), model.size()), unilib) {}
+      : TextClassifier(ViewModel(model.data(), model.size()), unilib,
+                       LoadOptions::Default()) {}
 
   using TextClassifier::ResolveConflicts;
 };
@@ -1085,7 +2075,8 @@ TEST(TextClassifierTest, ResolveConflictsTrivial) {
 
   std::vector<int> chosen;
   classifier.ResolveConflicts(candidates, /*context=*/"", /*cached_tokens=*/{},
-                              /*interpreter_manager=*/nullptr, &chosen);
+                              /*interpreter_manager=*/nullptr,
+                              /*embedding_cache=*/nullptr, &chosen);
   EXPECT_THAT(chosen, ElementsAreArray({0}));
 }
 
@@ -1103,7 +2094,8 @@ TEST(TextClassifierTest, ResolveConflictsSequence) {
 
   std::vector<int> chosen;
   classifier.ResolveConflicts(candidates, /*context=*/"", /*cached_tokens=*/{},
-                              /*interpreter_manager=*/nullptr, &chosen);
+                              /*interpreter_manager=*/nullptr,
+                              /*embedding_cache=*/nullptr, &chosen);
   EXPECT_THAT(chosen, ElementsAreArray({0, 1, 2, 3, 4}));
 }
 
@@ -1119,7 +2111,8 @@ TEST(TextClassifierTest, ResolveConflictsThreeSpans) {
 
   std::vector<int> chosen;
   classifier.ResolveConflicts(candidates, /*context=*/"", /*cached_tokens=*/{},
-                              /*interpreter_manager=*/nullptr, &chosen);
+                              /*interpreter_manager=*/nullptr,
+                              /*embedding_cache=*/nullptr, &chosen);
   EXPECT_THAT(chosen, ElementsAreArray({0, 2}));
 }
 
@@ -1135,7 +2128,8 @@ TEST(TextClassifierTest, ResolveConflictsThreeSpansReversed) {
 
   std::vector<int> chosen;
   classifier.ResolveConflicts(candidates, /*context=*/"", /*cached_tokens=*/{},
-                              /*interpreter_manager=*/nullptr, &chosen);
+                              /*interpreter_manager=*/nullptr,
+                              /*embedding_cache=*/nullptr, &chosen);
   EXPECT_THAT(chosen, ElementsAreArray({1}));
 }
 
@@ -1153,10 +2147,45 @@ TEST(TextClassifierTest, ResolveConflictsFiveSpans) {
 
   std::vector<int> chosen;
   classifier.ResolveConflicts(candidates, /*context=*/"", /*cached_tokens=*/{},
-                              /*interpreter_manager=*/nullptr, &chosen);
+                              /*interpreter_manager=*/nullptr,
+                              /*embedding_cache=*/nullptr, &chosen);
   EXPECT_THAT(chosen, ElementsAreArray({0, 2, 4}));
 }
 
+TEST(TextClassifierTest, SortAndMergeDuplicateCandidates) {
+  AnnotatedSpan unclassified;
+  unclassified.span = {0, 3};
+  unclassified.source = AnnotatedSpan::Source::MODEL;
+
+  std::vector<AnnotatedSpan> candidates{{
+      MakeAnnotatedSpan({4, 7}, "phone", 0.5),
+      unclassified,
+      MakeAnnotatedSpan({0, 3}, "phone", 0.5),
+      MakeAnnotatedSpan({0, 3}, "address", 0.7),
+      unclassified,
+      MakeAnnotatedSpan({0, 5}, "phone", 0.5),
+      MakeAnnotatedSpan({4, 7}, "date", 1.0),
+      unclassified,
+  }};
+  candidates.back().span = {4, 7};
+
+  int num_avoided_classifications = 0;
+  internal::SortAndMergeDuplicateCandidates(&candidates,
+                                            &num_avoided_classifications);
+
+  // The model could still win over the address, but not over the date.
+  ASSERT_EQ(candidates.size(), 4);
+  EXPECT_EQ(candidates[0].span, CodepointSpan(0, 3));
+  EXPECT_EQ(candidates[0].classification[0].collection, "address");
+  EXPECT_EQ(candidates[1].span, CodepointSpan(0, 3));
+  EXPECT_TRUE(candidates[1].classification.empty());
+  EXPECT_EQ(candidates[1].source, AnnotatedSpan::Source::MODEL);
+  EXPECT_EQ(candidates[2].span, CodepointSpan(0, 5));
+  EXPECT_EQ(candidates[3].span, CodepointSpan(4, 7));
+  EXPECT_EQ(candidates[3].classification[0].collection, "date");
+  EXPECT_EQ(num_avoided_classifications, 2);
+}
+
 #ifdef LIBTEXTCLASSIFIER_UNILIB_ICU
 TEST_P(TextClassifierTest, LongInput) {
   CREATE_UNILIB_FOR_TESTING;
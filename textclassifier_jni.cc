@@ -19,15 +19,18 @@
 #include "textclassifier_jni.h"
 
 #include <jni.h>
+#include <memory>
 #include <type_traits>
 #include <vector>
 
 #include "text-classifier.h"
 #include "util/base/integral_types.h"
+#include "util/java/scoped_global_ref.h"
 #include "util/java/scoped_local_ref.h"
 #include "util/java/string_utils.h"
 #include "util/memory/mmap.h"
 #include "util/utf8/unilib.h"
+#include "util/utf8/utf16-index-mapper.h"
 
 using libtextclassifier2::AnnotatedSpan;
 using libtextclassifier2::AnnotationOptions;
@@ -39,6 +42,8 @@ using libtextclassifier2::Model;
 using libtextclassifier2::ScopedLocalRef;
 using libtextclassifier2::SelectionOptions;
 using libtextclassifier2::TextClassifier;
+using libtextclassifier2::TrimLevel;
+using libtextclassifier2::UTF16IndexMapper;
 #ifdef LIBTEXTCLASSIFIER_UNILIB_JAVAICU
 using libtextclassifier2::UniLib;
 #endif
@@ -55,180 +60,290 @@ std::string ToStlString(JNIEnv* env, const jstring& str) {
   return result;
 }
 
+// The getters of the Java classification and annotation options.
+struct JniOptionsMethods {
+  jmethodID get_locale = nullptr;
+  jmethodID get_reference_timezone = nullptr;
+  jmethodID get_reference_time_ms_utc = nullptr;
+};
+
+// The Java classes and their members used by the wrapper, looked up once
+// instead of on every call, which goes through the class loader.
+struct JniCache {
+  explicit JniCache(JavaVM* jvm)
+      : classification_result_class(nullptr, jvm),
+        datetime_result_class(nullptr, jvm),
+        annotated_span_class(nullptr, jvm),
+        object_class(nullptr, jvm),
+        string_class(nullptr, jvm) {}
+
+  ScopedGlobalRef<jclass> classification_result_class;
+  jmethodID classification_result_init = nullptr;
+  ScopedGlobalRef<jclass> datetime_result_class;
+  jmethodID datetime_result_init = nullptr;
+  ScopedGlobalRef<jclass> annotated_span_class;
+  jmethodID annotated_span_init = nullptr;
+  ScopedGlobalRef<jclass> object_class;
+  ScopedGlobalRef<jclass> string_class;
+
+  jmethodID selection_options_get_locales = nullptr;
+  JniOptionsMethods classification_options;
+  JniOptionsMethods annotation_options;
+
+  jmethodID afd_get_file_descriptor = nullptr;
+  jfieldID file_descriptor_descriptor = nullptr;
+};
+
+// Returns the global reference of a class, or nullptr if it doesn't exist.
+ScopedGlobalRef<jclass> FindGlobalClass(JNIEnv* env, JavaVM* jvm,
+                                        const char* name) {
+  const ScopedLocalRef<jclass> local_class(env->FindClass(name), env);
+  if (!local_class) {
+    env->ExceptionClear();
+    TC_LOG(ERROR) << "Couldn't find class: " << name;
+    return ScopedGlobalRef<jclass>(nullptr, jvm);
+  }
+  return MakeGlobalRef(local_class.get(), env, jvm);
+}
+
+jmethodID FindMethod(JNIEnv* env, jclass clazz, const char* name,
+                     const char* signature) {
+  if (!clazz) {
+    return nullptr;
+  }
+  const jmethodID method = env->GetMethodID(clazz, name, signature);
+  if (!method) {
+    env->ExceptionClear();
+    TC_LOG(ERROR) << "Couldn't find method: " << name;
+  }
+  return method;
+}
+
+JniOptionsMethods FindOptionsMethods(JNIEnv* env, const char* class_name) {
+  JniOptionsMethods methods;
+  const ScopedLocalRef<jclass> options_class(env->FindClass(class_name), env);
+  if (!options_class) {
+    env->ExceptionClear();
+    TC_LOG(ERROR) << "Couldn't find class: " << class_name;
+    return methods;
+  }
+  methods.get_locale = FindMethod(env, options_class.get(), "getLocale",
+                                  "()Ljava/lang/String;");
+  methods.get_reference_timezone =
+      FindMethod(env, options_class.get(), "getReferenceTimezone",
+                 "()Ljava/lang/String;");
+  methods.get_reference_time_ms_utc =
+      FindMethod(env, options_class.get(), "getReferenceTimeMsUtc", "()J");
+  return methods;
+}
+
+std::unique_ptr<JniCache> CreateJniCache(JNIEnv* env) {
+  JavaVM* jvm = nullptr;
+  if (env->GetJavaVM(&jvm) != JNI_OK) {
+    TC_LOG(ERROR) << "Couldn't get the Java VM.";
+  }
+  std::unique_ptr<JniCache> cache(new JniCache(jvm));
+
+  cache->classification_result_class = FindGlobalClass(
+      env, jvm, TC_PACKAGE_PATH TC_CLASS_NAME_STR "$ClassificationResult");
+  cache->classification_result_init =
+      FindMethod(env, cache->classification_result_class.get(), "<init>",
+                 "(Ljava/lang/String;FL" TC_PACKAGE_PATH TC_CLASS_NAME_STR
+                 "$DatetimeResult;)V");
+  cache->datetime_result_class = FindGlobalClass(
+      env, jvm, TC_PACKAGE_PATH TC_CLASS_NAME_STR "$DatetimeResult");
+  cache->datetime_result_init = FindMethod(
+      env, cache->datetime_result_class.get(), "<init>", "(JI)V");
+  cache->annotated_span_class = FindGlobalClass(
+      env, jvm, TC_PACKAGE_PATH TC_CLASS_NAME_STR "$AnnotatedSpan");
+  cache->annotated_span_init = FindMethod(
+      env, cache->annotated_span_class.get(), "<init>",
+      "(II[L" TC_PACKAGE_PATH TC_CLASS_NAME_STR "$ClassificationResult;)V");
+  cache->object_class = FindGlobalClass(env, jvm, "java/lang/Object");
+  cache->string_class = FindGlobalClass(env, jvm, "java/lang/String");
+
+  {
+    const ScopedLocalRef<jclass> options_class(
+        env->FindClass(TC_PACKAGE_PATH TC_CLASS_NAME_STR "$SelectionOptions"),
+        env);
+    if (!options_class) {
+      env->ExceptionClear();
+    }
+    cache->selection_options_get_locales = FindMethod(
+        env, options_class.get(), "getLocales", "()Ljava/lang/String;");
+  }
+  cache->classification_options = FindOptionsMethods(
+      env, TC_PACKAGE_PATH TC_CLASS_NAME_STR "$ClassificationOptions");
+  cache->annotation_options = FindOptionsMethods(
+      env, TC_PACKAGE_PATH TC_CLASS_NAME_STR "$AnnotationOptions");
+
+  {
+    const ScopedLocalRef<jclass> afd_class(
+        env->FindClass("android/content/res/AssetFileDescriptor"), env);
+    if (!afd_class) {
+      env->ExceptionClear();
+    }
+    cache->afd_get_file_descriptor =
+        FindMethod(env, afd_class.get(), "getFileDescriptor",
+                   "()Ljava/io/FileDescriptor;");
+    const ScopedLocalRef<jclass> fd_class(
+        env->FindClass("java/io/FileDescriptor"), env);
+    if (fd_class) {
+      cache->file_descriptor_descriptor =
+          env->GetFieldID(fd_class.get(), "descriptor", "I");
+    }
+    if (!cache->file_descriptor_descriptor) {
+      env->ExceptionClear();
+    }
+  }
+  return cache;
+}
+
+// Returns the cache, which JNI_OnLoad normally created. Otherwise it's created
+// on first use, from a thread that came from Java, which can find the classes.
+const JniCache& GetJniCache(JNIEnv* env) {
+  static const JniCache* const cache = CreateJniCache(env).release();
+  return *cache;
+}
+
 jobjectArray ClassificationResultsToJObjectArray(
     JNIEnv* env,
     const std::vector<ClassificationResult>& classification_result) {
-  const ScopedLocalRef<jclass> result_class(
-      env->FindClass(TC_PACKAGE_PATH TC_CLASS_NAME_STR "$ClassificationResult"),
-      env);
-  if (!result_class) {
+  const JniCache& cache = GetJniCache(env);
+  if (!cache.classification_result_class || !cache.datetime_result_class) {
     TC_LOG(ERROR) << "Couldn't find ClassificationResult class.";
     return nullptr;
   }
-  const ScopedLocalRef<jclass> datetime_parse_class(
-      env->FindClass(TC_PACKAGE_PATH TC_CLASS_NAME_STR "$DatetimeResult"), env);
-  if (!datetime_parse_class) {
-    TC_LOG(ERROR) << "Couldn't find DatetimeResult class.";
-    return nullptr;
-  }
 
-  const jmethodID result_class_constructor =
-      env->GetMethodID(result_class.get(), "<init>",
-                       "(Ljava/lang/String;FL" TC_PACKAGE_PATH TC_CLASS_NAME_STR
-                       "$DatetimeResult;)V");
-  const jmethodID datetime_parse_class_constructor =
-      env->GetMethodID(datetime_parse_class.get(), "<init>", "(JI)V");
-
-  const jobjectArray results = env->NewObjectArray(classification_result.size(),
-                                                   result_class.get(), nullptr);
+  const jobjectArray results =
+      env->NewObjectArray(classification_result.size(),
+                          cache.classification_result_class.get(), nullptr);
   for (int i = 0; i < classification_result.size(); i++) {
     jstring row_string =
         env->NewStringUTF(classification_result[i].collection.c_str());
     jobject row_datetime_parse = nullptr;
     if (classification_result[i].datetime_parse_result.IsSet()) {
       row_datetime_parse = env->NewObject(
-          datetime_parse_class.get(), datetime_parse_class_constructor,
+          cache.datetime_result_class.get(), cache.datetime_result_init,
           classification_result[i].datetime_parse_result.time_ms_utc,
           classification_result[i].datetime_parse_result.granularity);
     }
-    jobject result =
-        env->NewObject(result_class.get(), result_class_constructor, row_string,
-                       static_cast<jfloat>(classification_result[i].score),
-                       row_datetime_parse);
+    jobject result = env->NewObject(
+        cache.classification_result_class.get(),
+        cache.classification_result_init, row_string,
+        static_cast<jfloat>(classification_result[i].score),
+        row_datetime_parse);
     env->SetObjectArrayElement(results, i, result);
     env->DeleteLocalRef(result);
+    env->DeleteLocalRef(row_string);
+    if (row_datetime_parse != nullptr) {
+      env->DeleteLocalRef(row_datetime_parse);
+    }
   }
   return results;
 }
 
-template <typename T, typename F>
-std::pair<bool, T> CallJniMethod0(JNIEnv* env, jobject object,
-                                  jclass class_object, F function,
-                                  const std::string& method_name,
-                                  const std::string& return_java_type) {
-  const jmethodID method = env->GetMethodID(class_object, method_name.c_str(),
-                                            ("()" + return_java_type).c_str());
-  if (!method) {
-    return std::make_pair(false, T());
-  }
-  return std::make_pair(true, (env->*function)(object, method));
-}
-
 SelectionOptions FromJavaSelectionOptions(JNIEnv* env, jobject joptions) {
-  if (!joptions) {
+  const jmethodID get_locales = GetJniCache(env).selection_options_get_locales;
+  if (!joptions || !get_locales) {
     return {};
   }
 
-  const ScopedLocalRef<jclass> options_class(
-      env->FindClass(TC_PACKAGE_PATH TC_CLASS_NAME_STR "$SelectionOptions"),
+  const ScopedLocalRef<jstring> locales(
+      reinterpret_cast<jstring>(env->CallObjectMethod(joptions, get_locales)),
       env);
-  const std::pair<bool, jobject> status_or_locales = CallJniMethod0<jobject>(
-      env, joptions, options_class.get(), &JNIEnv::CallObjectMethod,
-      "getLocales", "Ljava/lang/String;");
-  if (!status_or_locales.first) {
-    return {};
-  }
-
   SelectionOptions options;
-  options.locales =
-      ToStlString(env, reinterpret_cast<jstring>(status_or_locales.second));
+  options.locales = ToStlString(env, locales.get());
 
   return options;
 }
 
 template <typename T>
 T FromJavaOptionsInternal(JNIEnv* env, jobject joptions,
-                          const std::string& class_name) {
-  if (!joptions) {
-    return {};
-  }
-
-  const ScopedLocalRef<jclass> options_class(env->FindClass(class_name.c_str()),
-                                             env);
-  if (!options_class) {
+                          const JniOptionsMethods& methods) {
+  if (!joptions || !methods.get_locale || !methods.get_reference_timezone ||
+      !methods.get_reference_time_ms_utc) {
     return {};
   }
 
-  const std::pair<bool, jobject> status_or_locales = CallJniMethod0<jobject>(
-      env, joptions, options_class.get(), &JNIEnv::CallObjectMethod,
-      "getLocale", "Ljava/lang/String;");
-  const std::pair<bool, jobject> status_or_reference_timezone =
-      CallJniMethod0<jobject>(env, joptions, options_class.get(),
-                              &JNIEnv::CallObjectMethod, "getReferenceTimezone",
-                              "Ljava/lang/String;");
-  const std::pair<bool, int64> status_or_reference_time_ms_utc =
-      CallJniMethod0<int64>(env, joptions, options_class.get(),
-                            &JNIEnv::CallLongMethod, "getReferenceTimeMsUtc",
-                            "J");
-
-  if (!status_or_locales.first || !status_or_reference_timezone.first ||
-      !status_or_reference_time_ms_utc.first) {
-    return {};
-  }
+  const ScopedLocalRef<jstring> locales(
+      reinterpret_cast<jstring>(
+          env->CallObjectMethod(joptions, methods.get_locale)),
+      env);
+  const ScopedLocalRef<jstring> reference_timezone(
+      reinterpret_cast<jstring>(
+          env->CallObjectMethod(joptions, methods.get_reference_timezone)),
+      env);
+  const int64 reference_time_ms_utc =
+      env->CallLongMethod(joptions, methods.get_reference_time_ms_utc);
 
   T options;
-  options.locales =
-      ToStlString(env, reinterpret_cast<jstring>(status_or_locales.second));
-  options.reference_timezone = ToStlString(
-      env, reinterpret_cast<jstring>(status_or_reference_timezone.second));
-  options.reference_time_ms_utc = status_or_reference_time_ms_utc.second;
+  options.locales = ToStlString(env, locales.get());
+  options.reference_timezone = ToStlString(env, reference_timezone.get());
+  options.reference_time_ms_utc = reference_time_ms_utc;
   return options;
 }
 
 ClassificationOptions FromJavaClassificationOptions(JNIEnv* env,
                                                     jobject joptions) {
   return FromJavaOptionsInternal<ClassificationOptions>(
-      env, joptions,
-      TC_PACKAGE_PATH TC_CLASS_NAME_STR "$ClassificationOptions");
+      env, joptions, GetJniCache(env).classification_options);
 }
 
 AnnotationOptions FromJavaAnnotationOptions(JNIEnv* env, jobject joptions) {
   return FromJavaOptionsInternal<AnnotationOptions>(
-      env, joptions, TC_PACKAGE_PATH TC_CLASS_NAME_STR "$AnnotationOptions");
+      env, joptions, GetJniCache(env).annotation_options);
 }
 
-CodepointSpan ConvertIndicesBMPUTF8(const std::string& utf8_str,
-                                    CodepointSpan orig_indices,
-                                    bool from_utf8) {
-  const libtextclassifier2::UnicodeText unicode_str =
-      libtextclassifier2::UTF8ToUnicodeText(utf8_str, /*do_copy=*/false);
-
-  int unicode_index = 0;
-  int bmp_index = 0;
-
-  const int* source_index;
-  const int* target_index;
-  if (from_utf8) {
-    source_index = &unicode_index;
-    target_index = &bmp_index;
-  } else {
-    source_index = &bmp_index;
-    target_index = &unicode_index;
-  }
-
-  CodepointSpan result{-1, -1};
-  std::function<void()> assign_indices_fn = [&result, &orig_indices,
-                                             &source_index, &target_index]() {
-    if (orig_indices.first == *source_index) {
-      result.first = *target_index;
-    }
-
-    if (orig_indices.second == *source_index) {
-      result.second = *target_index;
+// Appends the annotations in the packed format of nativeAnnotatePacked: a
+// (start, end, collection id) triple per classification result, so the
+// results of one span follow each other with the same start and end.
+void AppendPackedAnnotations(const TextClassifier& model,
+                             const std::vector<AnnotatedSpan>& annotations,
+                             const UTF16IndexMapper& index_mapper,
+                             std::vector<jint>* packed_spans,
+                             std::vector<jfloat>* scores) {
+  for (const AnnotatedSpan& annotation : annotations) {
+    const CodepointSpan span_bmp =
+        index_mapper.CodepointToUTF16(annotation.span);
+    for (const ClassificationResult& classification :
+         annotation.classification) {
+      packed_spans->push_back(span_bmp.first);
+      packed_spans->push_back(span_bmp.second);
+      packed_spans->push_back(model.CollectionId(classification.collection));
+      scores->push_back(classification.score);
     }
-  };
-
-  for (auto it = unicode_str.begin(); it != unicode_str.end();
-       ++it, ++unicode_index, ++bmp_index) {
-    assign_indices_fn();
+  }
+}
 
-    // There is 1 extra character in the input for each UTF8 character > 0xFFFF.
-    if (*it > 0xFFFF) {
-      ++bmp_index;
+// Returns {int[]..., float[]} made of the given int arrays and scores.
+jobjectArray PackedArraysToJObjectArray(
+    JNIEnv* env, const std::vector<const std::vector<jint>*>& int_arrays,
+    const std::vector<jfloat>& scores) {
+  const JniCache& cache = GetJniCache(env);
+  if (!cache.object_class) {
+    return nullptr;
+  }
+  jobjectArray result = env->NewObjectArray(int_arrays.size() + 1,
+                                            cache.object_class.get(), nullptr);
+  for (int i = 0; i < int_arrays.size(); ++i) {
+    const ScopedLocalRef<jintArray> array(
+        env->NewIntArray(int_arrays[i]->size()), env);
+    if (!array) {
+      return nullptr;
     }
+    env->SetIntArrayRegion(array.get(), 0, int_arrays[i]->size(),
+                           int_arrays[i]->data());
+    env->SetObjectArrayElement(result, i, array.get());
   }
-  assign_indices_fn();
-
+  const ScopedLocalRef<jfloatArray> scores_array(
+      env->NewFloatArray(scores.size()), env);
+  if (!scores_array) {
+    return nullptr;
+  }
+  env->SetFloatArrayRegion(scores_array.get(), 0, scores.size(),
+                           scores.data());
+  env->SetObjectArrayElement(result, int_arrays.size(), scores_array.get());
   return result;
 }
 
@@ -236,44 +351,29 @@ CodepointSpan ConvertIndicesBMPUTF8(const std::string& utf8_str,
 
 CodepointSpan ConvertIndicesBMPToUTF8(const std::string& utf8_str,
                                       CodepointSpan bmp_indices) {
-  return ConvertIndicesBMPUTF8(utf8_str, bmp_indices, /*from_utf8=*/false);
+  return UTF16IndexMapper(utf8_str).UTF16ToCodepoint(bmp_indices);
 }
 
 CodepointSpan ConvertIndicesUTF8ToBMP(const std::string& utf8_str,
                                       CodepointSpan utf8_indices) {
-  return ConvertIndicesBMPUTF8(utf8_str, utf8_indices, /*from_utf8=*/true);
+  return UTF16IndexMapper(utf8_str).CodepointToUTF16(utf8_indices);
 }
 
 jint GetFdFromAssetFileDescriptor(JNIEnv* env, jobject afd) {
   // Get system-level file descriptor from AssetFileDescriptor.
-  ScopedLocalRef<jclass> afd_class(
-      env->FindClass("android/content/res/AssetFileDescriptor"), env);
-  if (afd_class == nullptr) {
-    TC_LOG(ERROR) << "Couldn't find AssetFileDescriptor.";
-    return reinterpret_cast<jlong>(nullptr);
-  }
-  jmethodID afd_class_getFileDescriptor = env->GetMethodID(
-      afd_class.get(), "getFileDescriptor", "()Ljava/io/FileDescriptor;");
-  if (afd_class_getFileDescriptor == nullptr) {
+  const JniCache& cache = GetJniCache(env);
+  if (cache.afd_get_file_descriptor == nullptr) {
     TC_LOG(ERROR) << "Couldn't find getFileDescriptor.";
     return reinterpret_cast<jlong>(nullptr);
   }
-
-  ScopedLocalRef<jclass> fd_class(env->FindClass("java/io/FileDescriptor"),
-                                  env);
-  if (fd_class == nullptr) {
-    TC_LOG(ERROR) << "Couldn't find FileDescriptor.";
-    return reinterpret_cast<jlong>(nullptr);
-  }
-  jfieldID fd_class_descriptor =
-      env->GetFieldID(fd_class.get(), "descriptor", "I");
-  if (fd_class_descriptor == nullptr) {
+  if (cache.file_descriptor_descriptor == nullptr) {
     TC_LOG(ERROR) << "Couldn't find descriptor.";
     return reinterpret_cast<jlong>(nullptr);
   }
 
-  jobject bundle_jfd = env->CallObjectMethod(afd, afd_class_getFileDescriptor);
-  return env->GetIntField(bundle_jfd, fd_class_descriptor);
+  const ScopedLocalRef<jobject> bundle_jfd(
+      env->CallObjectMethod(afd, cache.afd_get_file_descriptor), env);
+  return env->GetIntField(bundle_jfd.get(), cache.file_descriptor_descriptor);
 }
 
 jstring GetLocalesFromMmap(JNIEnv* env, libtextclassifier2::ScopedMmap* mmap) {
@@ -315,13 +415,22 @@ jstring GetNameFromMmap(JNIEnv* env, libtextclassifier2::ScopedMmap* mmap) {
 }  // namespace libtextclassifier2
 
 using libtextclassifier2::ClassificationResultsToJObjectArray;
-using libtextclassifier2::ConvertIndicesBMPToUTF8;
-using libtextclassifier2::ConvertIndicesUTF8ToBMP;
 using libtextclassifier2::FromJavaAnnotationOptions;
 using libtextclassifier2::FromJavaClassificationOptions;
 using libtextclassifier2::FromJavaSelectionOptions;
 using libtextclassifier2::ToStlString;
 
+JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM* vm, void* reserved) {
+  JNIEnv* env = nullptr;
+  if (vm->GetEnv(reinterpret_cast<void**>(&env), JNI_VERSION_1_4) != JNI_OK) {
+    return JNI_ERR;
+  }
+  // Called from the thread that loads the library, whose class loader finds
+  // the classes of the package, unlike native threads attached later.
+  libtextclassifier2::GetJniCache(env);
+  return JNI_VERSION_1_4;
+}
+
 JNI_METHOD(jlong, TC_CLASS_NAME, nativeNew)
 (JNIEnv* env, jobject thiz, jint fd) {
 #ifdef LIBTEXTCLASSIFIER_UNILIB_JAVAICU
@@ -366,12 +475,14 @@ JNI_METHOD(jintArray, TC_CLASS_NAME, nativeSuggestSelection)
 
   TextClassifier* model = reinterpret_cast<TextClassifier*>(ptr);
 
-  const std::string context_utf8 = ToStlString(env, context);
+  std::string context_utf8;
+  UTF16IndexMapper index_mapper;
+  JStringToUtf8String(env, context, &context_utf8, &index_mapper);
   CodepointSpan input_indices =
-      ConvertIndicesBMPToUTF8(context_utf8, {selection_begin, selection_end});
+      index_mapper.UTF16ToCodepoint({selection_begin, selection_end});
   CodepointSpan selection = model->SuggestSelection(
       context_utf8, input_indices, FromJavaSelectionOptions(env, options));
-  selection = ConvertIndicesUTF8ToBMP(context_utf8, selection);
+  selection = index_mapper.CodepointToUTF16(selection);
 
   jintArray result = env->NewIntArray(2);
   env->SetIntArrayRegion(result, 0, 1, &(std::get<0>(selection)));
@@ -387,9 +498,11 @@ JNI_METHOD(jobjectArray, TC_CLASS_NAME, nativeClassifyText)
   }
   TextClassifier* ff_model = reinterpret_cast<TextClassifier*>(ptr);
 
-  const std::string context_utf8 = ToStlString(env, context);
+  std::string context_utf8;
+  UTF16IndexMapper index_mapper;
+  JStringToUtf8String(env, context, &context_utf8, &index_mapper);
   const CodepointSpan input_indices =
-      ConvertIndicesBMPToUTF8(context_utf8, {selection_begin, selection_end});
+      index_mapper.UTF16ToCodepoint({selection_begin, selection_end});
   const std::vector<ClassificationResult> classification_result =
       ff_model->ClassifyText(context_utf8, input_indices,
                              FromJavaClassificationOptions(env, options));
@@ -403,47 +516,139 @@ JNI_METHOD(jobjectArray, TC_CLASS_NAME, nativeAnnotate)
     return nullptr;
   }
   TextClassifier* model = reinterpret_cast<TextClassifier*>(ptr);
-  std::string context_utf8 = ToStlString(env, context);
+  std::string context_utf8;
+  UTF16IndexMapper index_mapper;
+  JStringToUtf8String(env, context, &context_utf8, &index_mapper);
   std::vector<AnnotatedSpan> annotations =
       model->Annotate(context_utf8, FromJavaAnnotationOptions(env, options));
 
-  jclass result_class =
-      env->FindClass(TC_PACKAGE_PATH TC_CLASS_NAME_STR "$AnnotatedSpan");
-  if (!result_class) {
+  const libtextclassifier2::JniCache& cache =
+      libtextclassifier2::GetJniCache(env);
+  if (!cache.annotated_span_class || !cache.annotated_span_init) {
     TC_LOG(ERROR) << "Couldn't find result class: "
                   << TC_PACKAGE_PATH TC_CLASS_NAME_STR "$AnnotatedSpan";
     return nullptr;
   }
 
-  jmethodID result_class_constructor = env->GetMethodID(
-      result_class, "<init>",
-      "(II[L" TC_PACKAGE_PATH TC_CLASS_NAME_STR "$ClassificationResult;)V");
-
-  jobjectArray results =
-      env->NewObjectArray(annotations.size(), result_class, nullptr);
+  jobjectArray results = env->NewObjectArray(
+      annotations.size(), cache.annotated_span_class.get(), nullptr);
 
   for (int i = 0; i < annotations.size(); ++i) {
-    CodepointSpan span_bmp =
-        ConvertIndicesUTF8ToBMP(context_utf8, annotations[i].span);
+    CodepointSpan span_bmp = index_mapper.CodepointToUTF16(annotations[i].span);
+    const ScopedLocalRef<jobjectArray> classification(
+        ClassificationResultsToJObjectArray(env,
+                                            annotations[i].classification),
+        env);
     jobject result = env->NewObject(
-        result_class, result_class_constructor,
+        cache.annotated_span_class.get(), cache.annotated_span_init,
         static_cast<jint>(span_bmp.first), static_cast<jint>(span_bmp.second),
-        ClassificationResultsToJObjectArray(env,
-
-                                            annotations[i].classification));
+        classification.get());
     env->SetObjectArrayElement(results, i, result);
     env->DeleteLocalRef(result);
   }
-  env->DeleteLocalRef(result_class);
   return results;
 }
 
+JNI_METHOD(jobjectArray, TC_CLASS_NAME, nativeAnnotatePacked)
+(JNIEnv* env, jobject thiz, jlong ptr, jstring context, jobject options) {
+  if (!ptr) {
+    return nullptr;
+  }
+  TextClassifier* model = reinterpret_cast<TextClassifier*>(ptr);
+  std::string context_utf8;
+  UTF16IndexMapper index_mapper;
+  JStringToUtf8String(env, context, &context_utf8, &index_mapper);
+  const std::vector<AnnotatedSpan> annotations =
+      model->Annotate(context_utf8, FromJavaAnnotationOptions(env, options));
+
+  std::vector<jint> packed_spans;
+  std::vector<jfloat> scores;
+  libtextclassifier2::AppendPackedAnnotations(
+      *model, annotations, index_mapper, &packed_spans, &scores);
+  return libtextclassifier2::PackedArraysToJObjectArray(
+      env, {&packed_spans}, scores);
+}
+
+JNI_METHOD(jobjectArray, TC_CLASS_NAME, nativeAnnotateBatch)
+(JNIEnv* env, jobject thiz, jlong ptr, jobjectArray texts, jobject options) {
+  if (!ptr || !texts) {
+    return nullptr;
+  }
+  TextClassifier* model = reinterpret_cast<TextClassifier*>(ptr);
+  const int num_texts = env->GetArrayLength(texts);
+  std::vector<std::string> contexts_utf8(num_texts);
+  std::vector<UTF16IndexMapper> index_mappers(num_texts);
+  for (int i = 0; i < num_texts; ++i) {
+    const ScopedLocalRef<jstring> text(
+        reinterpret_cast<jstring>(env->GetObjectArrayElement(texts, i)), env);
+    JStringToUtf8String(env, text.get(), &contexts_utf8[i], &index_mappers[i]);
+  }
+  const std::vector<std::vector<AnnotatedSpan>> annotations =
+      model->AnnotateBatch(contexts_utf8,
+                           FromJavaAnnotationOptions(env, options));
+
+  std::vector<jint> packed_spans;
+  std::vector<jfloat> scores;
+  std::vector<jint> text_ends;
+  for (int i = 0; i < num_texts; ++i) {
+    libtextclassifier2::AppendPackedAnnotations(
+        *model, annotations[i], index_mappers[i], &packed_spans, &scores);
+    text_ends.push_back(scores.size());
+  }
+  return libtextclassifier2::PackedArraysToJObjectArray(
+      env, {&packed_spans, &text_ends}, scores);
+}
+
+JNI_METHOD(jobjectArray, TC_CLASS_NAME, nativeGetCollections)
+(JNIEnv* env, jobject thiz, jlong ptr) {
+  if (!ptr) {
+    return nullptr;
+  }
+  TextClassifier* model = reinterpret_cast<TextClassifier*>(ptr);
+  const libtextclassifier2::JniCache& cache =
+      libtextclassifier2::GetJniCache(env);
+  if (!cache.string_class) {
+    return nullptr;
+  }
+  const std::vector<std::string>& collections = model->Collections();
+  jobjectArray result = env->NewObjectArray(
+      collections.size(), cache.string_class.get(), nullptr);
+  for (int i = 0; i < collections.size(); ++i) {
+    const ScopedLocalRef<jstring> collection(
+        env->NewStringUTF(collections[i].c_str()), env);
+    env->SetObjectArrayElement(result, i, collection.get());
+  }
+  return result;
+}
+
+JNI_METHOD(jstring, TC_CLASS_NAME, nativeGetMetrics)
+(JNIEnv* env, jobject thiz, jlong ptr) {
+  if (!ptr) {
+    return nullptr;
+  }
+  TextClassifier* model = reinterpret_cast<TextClassifier*>(ptr);
+  return env->NewStringUTF(model->GetMetrics().ToString().c_str());
+}
+
 JNI_METHOD(void, TC_CLASS_NAME, nativeClose)
 (JNIEnv* env, jobject thiz, jlong ptr) {
   TextClassifier* model = reinterpret_cast<TextClassifier*>(ptr);
   delete model;
 }
 
+JNI_METHOD(void, TC_CLASS_NAME, nativeTrimMemory)
+(JNIEnv* env, jobject thiz, jlong ptr, jint level) {
+  if (!ptr) {
+    return;
+  }
+  // ComponentCallbacks2.TRIM_MEMORY_BACKGROUND: the process is in the
+  // background LRU list, so the patterns are unlikely to be needed soon.
+  const int kTrimMemoryBackground = 40;
+  TextClassifier* model = reinterpret_cast<TextClassifier*>(ptr);
+  model->Trim(level >= kTrimMemoryBackground ? TrimLevel::PATTERNS
+                                             : TrimLevel::SCRATCH);
+}
+
 JNI_METHOD(jstring, TC_CLASS_NAME, nativeGetLanguage)
 (JNIEnv* env, jobject clazz, jint fd) {
   TC_LOG(WARNING) << "Using deprecated getLanguage().";
@@ -66,6 +66,10 @@
 extern "C" {
 #endif
 
+// Looks up the Java classes and members used by the native methods once, when
+// the library is loaded.
+JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM* vm, void* reserved);
+
 // SmartSelection.
 JNI_METHOD(jlong, TC_CLASS_NAME, nativeNew)
 (JNIEnv* env, jobject thiz, jint fd);
@@ -87,9 +91,36 @@ JNI_METHOD(jobjectArray, TC_CLASS_NAME, nativeClassifyText)
 JNI_METHOD(jobjectArray, TC_CLASS_NAME, nativeAnnotate)
 (JNIEnv* env, jobject thiz, jlong ptr, jstring context, jobject options);
 
+// Same as nativeAnnotate, without creating an object per annotation. Returns
+// {int[] spans, float[] scores}, where spans holds a (start, end, collection
+// id) triple per classification result and scores its score. The collection
+// ids index the array returned by nativeGetCollections.
+JNI_METHOD(jobjectArray, TC_CLASS_NAME, nativeAnnotatePacked)
+(JNIEnv* env, jobject thiz, jlong ptr, jstring context, jobject options);
+
+// Annotates each of the texts, as nativeAnnotatePacked would, in one call.
+// Returns {int[] spans, int[] text ends, float[] scores}, where the results of
+// the i-th text are the entries from text ends[i - 1] (or 0) to text ends[i].
+JNI_METHOD(jobjectArray, TC_CLASS_NAME, nativeAnnotateBatch)
+(JNIEnv* env, jobject thiz, jlong ptr, jobjectArray texts, jobject options);
+
+// Returns the names of the collections of the model, indexed by collection id.
+JNI_METHOD(jobjectArray, TC_CLASS_NAME, nativeGetCollections)
+(JNIEnv* env, jobject thiz, jlong ptr);
+
+// Returns the metrics of the model in the text format of
+// MetricsSnapshot::ToString(), one "name{labels} count" line per counter.
+JNI_METHOD(jstring, TC_CLASS_NAME, nativeGetMetrics)
+(JNIEnv* env, jobject thiz, jlong ptr);
+
 JNI_METHOD(void, TC_CLASS_NAME, nativeClose)
 (JNIEnv* env, jobject thiz, jlong ptr);
 
+// Releases memory of an idle model, for ComponentCallbacks2.onTrimMemory()
+// with the given level.
+JNI_METHOD(void, TC_CLASS_NAME, nativeTrimMemory)
+(JNIEnv* env, jobject thiz, jlong ptr, jint level);
+
 // DEPRECATED. Use nativeGetLocales instead.
 JNI_METHOD(jstring, TC_CLASS_NAME, nativeGetLanguage)
 (JNIEnv* env, jobject clazz, jint fd);
@@ -118,6 +149,9 @@ JNI_METHOD(jstring, TC_CLASS_NAME, nativeGetNameFromAssetFileDescriptor)
 
 namespace libtextclassifier2 {
 
+// NOTE: Each of these maps the whole string, so use one UTF16IndexMapper
+// instead to convert several spans of the same string.
+
 // Given a utf8 string and a span expressed in Java BMP (basic multilingual
 // plane) codepoints, converts it to a span expressed in utf8 codepoints.
 libtextclassifier2::CodepointSpan ConvertIndicesBMPToUTF8(
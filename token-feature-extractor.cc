@@ -16,10 +16,14 @@
 
 #include "token-feature-extractor.h"
 
+#include <algorithm>
+#include <string.h>
+
 #include <cctype>
 #include <string>
 
 #include "util/base/logging.h"
+#include "util/gtl/stl_util.h"
 #include "util/hash/farmhash.h"
 #include "util/strings/stringpiece.h"
 #include "util/utf8/unicodetext.h"
@@ -67,16 +71,274 @@ void RemapTokenUnicode(const std::string& token,
   }
 }
 
+template <bool kRemapDigits, bool kLowercase>
+char RemapAsciiChar(char c) {
+  // Same as isdigit() and tolower() in the "C" locale.
+  if (kRemapDigits && c >= '0' && c <= '9') {
+    c = '0';
+  }
+  if (kLowercase && c >= 'A' && c <= 'Z') {
+    c += 'a' - 'A';
+  }
+  return c;
+}
+
+// Appends the hashes of the charactergrams of the given order. Unigrams do
+// not include the prefix and suffix markers at the ends of the feature word.
+// The i-th character spans bytes [offsets[i], offsets[i + 1]) of the word, or
+// just byte i without offsets.
+template <int kOrder, typename Hasher>
+void AppendChargrams(const char* feature_word, const int* offsets,
+                     int num_chars, const Hasher& hash,
+                     std::vector<int>* result) {
+  const int first = kOrder == 1 ? 1 : 0;
+  const int last = kOrder == 1 ? num_chars - 1 : num_chars;
+  for (int i = first; i + kOrder <= last; ++i) {
+    if (offsets == nullptr) {
+      result->push_back(hash(StringPiece(feature_word + i, kOrder)));
+    } else {
+      result->push_back(hash(StringPiece(feature_word + offsets[i],
+                                         offsets[i + kOrder] - offsets[i])));
+    }
+  }
+}
+
+// Builds the feature word of a token for the unicode-aware features: the
+// remapped word, trimmed if needed, between a prefix and a suffix marker.
+std::string UnicodeFeatureWord(const Token& token,
+                               const TokenFeatureExtractorOptions& options,
+                               const UniLib& unilib) {
+  UnicodeText word = UTF8ToUnicodeText(token.value, /*do_copy=*/false);
+  RemapTokenUnicode(token.value, options, unilib, &word);
+
+  // Trim the word if needed by finding a left-cut point and right-cut point.
+  auto left_cut = word.begin();
+  auto right_cut = word.end();
+  for (int i = 0; i < options.max_word_length / 2; i++) {
+    if (left_cut < right_cut) {
+      ++left_cut;
+    }
+    if (left_cut < right_cut) {
+      --right_cut;
+    }
+  }
+
+  // Build the feature word by appending the UTF-8 bytes of the cut points
+  // directly, without intermediate strings.
+  std::string feature_word;
+  feature_word.reserve(word.size_bytes() + 3);
+  feature_word += '^';
+  if (left_cut == right_cut) {
+    feature_word.append(word.data(), word.size_bytes());
+  } else {
+    feature_word.append(word.begin().utf8_data(), left_cut.utf8_data());
+    feature_word += '\1';
+    feature_word.append(right_cut.utf8_data(), word.end().utf8_data());
+  }
+  feature_word += '$';
+  return feature_word;
+}
+
+bool IsAsciiAlnum(char c) {
+  return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+         (c >= 'A' && c <= 'Z');
+}
+
+void AddAsciiChar(char c, uint64* chars) {
+  chars[c / 64] |= 1ULL << (c % 64);
+}
+
 }  // namespace
 
+namespace internal {
+
+bool AsciiClassRegex::Parse(const std::string& pattern) {
+  atoms_.clear();
+  int begin = 0;
+  int end = pattern.size();
+  if (begin < end && pattern[begin] == '^') {
+    ++begin;
+  }
+  if (begin < end && pattern[end - 1] == '$') {
+    --end;
+  }
+
+  for (int i = begin; i < end;) {
+    Atom atom = {{0, 0}, false, false};
+    if (IsAsciiAlnum(pattern[i])) {
+      AddAsciiChar(pattern[i], atom.chars);
+      ++i;
+    } else if (pattern[i] == '[') {
+      ++i;
+      bool empty = true;
+      while (i < end && pattern[i] != ']') {
+        const char first = pattern[i];
+        if (!IsAsciiAlnum(first)) {
+          return false;
+        }
+        char last = first;
+        if (i + 2 < end && pattern[i + 1] == '-' && pattern[i + 2] != ']') {
+          last = pattern[i + 2];
+          if (!IsAsciiAlnum(last) || last < first) {
+            return false;
+          }
+          i += 3;
+        } else {
+          ++i;
+        }
+        for (char c = first; c <= last; ++c) {
+          AddAsciiChar(c, atom.chars);
+        }
+        empty = false;
+      }
+      if (i >= end || empty) {
+        return false;
+      }
+      ++i;  // The closing ']'.
+    } else {
+      return false;
+    }
+
+    if (i < end && pattern[i] == '?') {
+      atom.optional = true;
+      ++i;
+    } else if (i < end && pattern[i] == '*') {
+      atom.optional = true;
+      atom.repeated = true;
+      ++i;
+    } else if (i < end && pattern[i] == '+') {
+      // X+ is matched as XX*.
+      atoms_.push_back(atom);
+      atom.optional = true;
+      atom.repeated = true;
+      ++i;
+    }
+    atoms_.push_back(atom);
+    if (atoms_.size() > 63) {
+      return false;
+    }
+  }
+  return true;
+}
+
+uint64 AsciiClassRegex::Closure(uint64 states) const {
+  for (int i = 0; i < atoms_.size(); ++i) {
+    if ((states & (1ULL << i)) && atoms_[i].optional) {
+      states |= 1ULL << (i + 1);
+    }
+  }
+  return states;
+}
+
+bool AsciiClassRegex::Matches(StringPiece input) const {
+  uint64 states = Closure(1);
+  for (int i = 0; i < input.size() && states != 0; ++i) {
+    const unsigned char c = input[i];
+    if (c >= 128) {
+      return false;
+    }
+    uint64 next_states = 0;
+    for (int j = 0; j < atoms_.size(); ++j) {
+      if ((states & (1ULL << j)) &&
+          (atoms_[j].chars[c / 64] & (1ULL << (c % 64)))) {
+        next_states |= 1ULL << (j + 1);
+        if (atoms_[j].repeated) {
+          next_states |= 1ULL << j;
+        }
+      }
+    }
+    states = Closure(next_states);
+  }
+  return states & (1ULL << atoms_.size());
+}
+
+}  // namespace internal
+
 TokenFeatureExtractor::TokenFeatureExtractor(
     const TokenFeatureExtractorOptions& options, const UniLib& unilib)
     : options_(options), unilib_(unilib) {
+  allowed_chargram_fingerprints_ = options.allowed_chargram_fingerprints;
+  for (const std::string& chargram : options.allowed_chargrams) {
+    allowed_chargram_fingerprints_.push_back(
+        tc2farmhash::Fingerprint64(chargram));
+  }
+  // Precomputed fingerprints from the model are sorted already.
+  if (!std::is_sorted(allowed_chargram_fingerprints_.begin(),
+                      allowed_chargram_fingerprints_.end())) {
+    std::sort(allowed_chargram_fingerprints_.begin(),
+              allowed_chargram_fingerprints_.end());
+  }
+  allowed_chargram_fingerprints_.erase(
+      std::unique(allowed_chargram_fingerprints_.begin(),
+                  allowed_chargram_fingerprints_.end()),
+      allowed_chargram_fingerprints_.end());
+  // Only the fingerprints are needed from now on.
+  options_.allowed_chargrams.clear();
+  options_.allowed_chargram_fingerprints.clear();
+
+  if (options_.embedding_bucket_remap_from.size() !=
+          options_.embedding_bucket_remap_to.size() ||
+      !std::is_sorted(options_.embedding_bucket_remap_from.begin(),
+                      options_.embedding_bucket_remap_from.end())) {
+    TC_LOG(ERROR) << "Invalid embedding bucket remap, ignoring it.";
+    options_.embedding_bucket_remap_from.clear();
+    options_.embedding_bucket_remap_to.clear();
+  }
+
   for (const std::string& pattern : options.regexp_features) {
+    internal::AsciiClassRegex ascii_pattern;
+    if (ascii_pattern.Parse(pattern)) {
+      ascii_regex_index_.push_back(ascii_regex_patterns_.size());
+      ascii_regex_patterns_.push_back(ascii_pattern);
+      regex_patterns_.emplace_back(nullptr);
+      continue;
+    }
+    ascii_regex_index_.push_back(-1);
+    has_icu_regex_features_ = true;
     regex_patterns_.push_back(std::unique_ptr<UniLib::RegexPattern>(
         unilib_.CreateRegexPattern(UTF8ToUnicodeText(
             pattern.c_str(), pattern.size(), /*do_copy=*/false))));
   }
+
+  chargram_extractor_ = SelectChargramExtractor();
+}
+
+TokenFeatureExtractor::ChargramExtractor
+TokenFeatureExtractor::SelectChargramExtractor() const {
+  // The option combinations of the bundled models.
+  const std::vector<int> kOrders12345 = {1, 2, 3, 4, 5};
+  const std::vector<int> kOrders123 = {1, 2, 3};
+  if (options_.max_word_length <= kMaxFixedWordLength) {
+    if (options_.unicode_aware_features) {
+      if (options_.chargram_orders == kOrders12345) {
+        return &TokenFeatureExtractor::
+            ExtractCharactergramFeaturesUnicodeFixed<1, 2, 3, 4, 5>;
+      }
+      if (options_.chargram_orders == kOrders123) {
+        return &TokenFeatureExtractor::
+            ExtractCharactergramFeaturesUnicodeFixed<1, 2, 3>;
+      }
+    } else if (options_.remap_digits && options_.lowercase_tokens) {
+      if (options_.chargram_orders == kOrders12345) {
+        return &TokenFeatureExtractor::
+            ExtractCharactergramFeaturesAsciiFixed<true, true, 1, 2, 3, 4, 5>;
+      }
+      if (options_.chargram_orders == kOrders123) {
+        return &TokenFeatureExtractor::
+            ExtractCharactergramFeaturesAsciiFixed<true, true, 1, 2, 3>;
+      }
+    } else if (!options_.remap_digits && !options_.lowercase_tokens) {
+      if (options_.chargram_orders == kOrders123) {
+        return &TokenFeatureExtractor::
+            ExtractCharactergramFeaturesAsciiFixed<false, false, 1, 2, 3>;
+      }
+    }
+  }
+  if (options_.unicode_aware_features) {
+    return &TokenFeatureExtractor::ExtractCharactergramFeaturesUnicode;
+  } else {
+    return &TokenFeatureExtractor::ExtractCharactergramFeaturesAscii;
+  }
 }
 
 bool TokenFeatureExtractor::Extract(const Token& token, bool is_in_span,
@@ -94,11 +356,7 @@ bool TokenFeatureExtractor::Extract(const Token& token, bool is_in_span,
 
 std::vector<int> TokenFeatureExtractor::ExtractCharactergramFeatures(
     const Token& token) const {
-  if (options_.unicode_aware_features) {
-    return ExtractCharactergramFeaturesUnicode(token);
-  } else {
-    return ExtractCharactergramFeaturesAscii(token);
-  }
+  return (this->*chargram_extractor_)(token);
 }
 
 std::vector<float> TokenFeatureExtractor::ExtractDenseFeatures(
@@ -138,9 +396,18 @@ std::vector<float> TokenFeatureExtractor::ExtractDenseFeatures(
 
   // Add regexp features.
   if (!regex_patterns_.empty()) {
-    UnicodeText token_unicode =
-        UTF8ToUnicodeText(token.value, /*do_copy=*/false);
+    UnicodeText token_unicode;
+    if (has_icu_regex_features_) {
+      token_unicode = UTF8ToUnicodeText(token.value, /*do_copy=*/false);
+    }
     for (int i = 0; i < regex_patterns_.size(); ++i) {
+      if (ascii_regex_index_[i] >= 0) {
+        dense_features.push_back(
+            ascii_regex_patterns_[ascii_regex_index_[i]].Matches(token.value)
+                ? 1.0
+                : -1.0);
+        continue;
+      }
       if (!regex_patterns_[i].get()) {
         dense_features.push_back(-1.0);
         continue;
@@ -159,23 +426,39 @@ std::vector<float> TokenFeatureExtractor::ExtractDenseFeatures(
 }
 
 int TokenFeatureExtractor::HashToken(StringPiece token) const {
-  if (options_.allowed_chargrams.empty()) {
-    return tc2farmhash::Fingerprint64(token) % options_.num_buckets;
+  const int bucket = HashTokenToOriginalBucket(token);
+  const std::vector<int>& remap_from = options_.embedding_bucket_remap_from;
+  if (remap_from.empty()) {
+    return bucket;
+  }
+  const auto it =
+      std::lower_bound(remap_from.begin(), remap_from.end(), bucket);
+  if (it == remap_from.end() || *it != bucket) {
+    return bucket;
+  }
+  return options_.embedding_bucket_remap_to[it - remap_from.begin()];
+}
+
+int TokenFeatureExtractor::HashTokenToOriginalBucket(StringPiece token) const {
+  const uint64 fingerprint = tc2farmhash::Fingerprint64(token);
+  if (allowed_chargram_fingerprints_.empty()) {
+    return fingerprint % options_.num_buckets;
   } else {
     // Padding and out-of-vocabulary tokens have extra buckets reserved because
     // they are special and important tokens, and we don't want them to share
     // embedding with other charactergrams.
     // TODO(zilka): Experimentally verify.
     const int kNumExtraBuckets = 2;
-    const std::string token_string = token.ToString();
-    if (token_string == "<PAD>") {
+    static const char kPadToken[] = "<PAD>";
+    if (token.size() == sizeof(kPadToken) - 1 &&
+        memcmp(token.data(), kPadToken, token.size()) == 0) {
       return 1;
-    } else if (options_.allowed_chargrams.find(token_string) ==
-               options_.allowed_chargrams.end()) {
+    } else if (!std::binary_search(allowed_chargram_fingerprints_.begin(),
+                                   allowed_chargram_fingerprints_.end(),
+                                   fingerprint)) {
       return 0;  // Out-of-vocabulary.
     } else {
-      return (tc2farmhash::Fingerprint64(token) %
-              (options_.num_buckets - kNumExtraBuckets)) +
+      return (fingerprint % (options_.num_buckets - kNumExtraBuckets)) +
              kNumExtraBuckets;
     }
   }
@@ -189,18 +472,21 @@ std::vector<int> TokenFeatureExtractor::ExtractCharactergramFeaturesAscii(
   } else {
     const std::string word = RemapTokenAscii(token.value, options_);
 
-    // Trim words that are over max_word_length characters.
+    // Trim words that are over max_word_length characters, and add a prefix
+    // and suffix to the word.
     const int max_word_length = options_.max_word_length;
     std::string feature_word;
+    feature_word.reserve(std::min<int>(word.size(), max_word_length) + 3);
+    feature_word += '^';
     if (word.size() > max_word_length) {
-      feature_word =
-          "^" + word.substr(0, max_word_length / 2) + "\1" +
-          word.substr(word.size() - max_word_length / 2, max_word_length / 2) +
-          "$";
+      feature_word.append(word, 0, max_word_length / 2);
+      feature_word += '\1';
+      feature_word.append(word, word.size() - max_word_length / 2,
+                          max_word_length / 2);
     } else {
-      // Add a prefix and suffix to the word.
-      feature_word = "^" + word + "$";
+      feature_word += word;
     }
+    feature_word += '$';
 
     // Upper-bound the number of charactergram extracted to avoid resizing.
     result.reserve(options_.chargram_orders.size() * feature_word.size());
@@ -235,36 +521,8 @@ std::vector<int> TokenFeatureExtractor::ExtractCharactergramFeaturesUnicode(
   if (token.is_padding || token.value.empty()) {
     result.push_back(HashToken("<PAD>"));
   } else {
-    UnicodeText word = UTF8ToUnicodeText(token.value, /*do_copy=*/false);
-    RemapTokenUnicode(token.value, options_, unilib_, &word);
-
-    // Trim the word if needed by finding a left-cut point and right-cut point.
-    auto left_cut = word.begin();
-    auto right_cut = word.end();
-    for (int i = 0; i < options_.max_word_length / 2; i++) {
-      if (left_cut < right_cut) {
-        ++left_cut;
-      }
-      if (left_cut < right_cut) {
-        --right_cut;
-      }
-    }
-
-    std::string feature_word;
-    if (left_cut == right_cut) {
-      feature_word = "^" + word.UTF8Substring(word.begin(), word.end()) + "$";
-    } else {
-      // clang-format off
-      feature_word = "^" +
-                     word.UTF8Substring(word.begin(), left_cut) +
-                     "\1" +
-                     word.UTF8Substring(right_cut, word.end()) +
-                     "$";
-      // clang-format on
-    }
-
-    const UnicodeText feature_word_unicode =
-        UTF8ToUnicodeText(feature_word, /*do_copy=*/false);
+    const std::string feature_word =
+        UnicodeFeatureWord(token, options_, unilib_);
 
     // Upper-bound the number of charactergram extracted to avoid resizing.
     result.reserve(options_.chargram_orders.size() * feature_word.size());
@@ -272,40 +530,154 @@ std::vector<int> TokenFeatureExtractor::ExtractCharactergramFeaturesUnicode(
     if (options_.chargram_orders.empty()) {
       result.push_back(HashToken(feature_word));
     } else {
+      // Find the byte offsets of the codepoints once, so that the chargrams of
+      // all orders are just slices of the feature word.
+      const UnicodeText feature_word_unicode =
+          UTF8ToUnicodeText(feature_word, /*do_copy=*/false);
+      std::vector<int> codepoint_offsets;
+      codepoint_offsets.reserve(feature_word.size() + 1);
+      for (auto it = feature_word_unicode.begin();
+           it != feature_word_unicode.end(); ++it) {
+        codepoint_offsets.push_back(it.utf8_data() - feature_word.data());
+      }
+      codepoint_offsets.push_back(feature_word.size());
+      const int num_codepoints = codepoint_offsets.size() - 1;
+
       // Generate the character-grams.
       for (int chargram_order : options_.chargram_orders) {
-        UnicodeText::const_iterator it_start = feature_word_unicode.begin();
-        UnicodeText::const_iterator it_end = feature_word_unicode.end();
-        if (chargram_order == 1) {
-          ++it_start;
-          --it_end;
+        // Unigrams do not include the prefix and suffix markers.
+        const int first = chargram_order == 1 ? 1 : 0;
+        const int last = chargram_order == 1 ? num_codepoints - 1
+                                             : num_codepoints;
+        for (int i = first; i + chargram_order <= last; ++i) {
+          result.push_back(HashToken(StringPiece(
+              feature_word.data() + codepoint_offsets[i],
+              codepoint_offsets[i + chargram_order] - codepoint_offsets[i])));
         }
+      }
+    }
+  }
+  return result;
+}
 
-        UnicodeText::const_iterator it_chargram_start = it_start;
-        UnicodeText::const_iterator it_chargram_end = it_start;
-        bool chargram_is_complete = true;
-        for (int i = 0; i < chargram_order; ++i) {
-          if (it_chargram_end == it_end) {
-            chargram_is_complete = false;
-            break;
-          }
-          ++it_chargram_end;
-        }
-        if (!chargram_is_complete) {
-          continue;
-        }
+template <bool kRemapDigits, bool kLowercase, int... kOrders>
+std::vector<int> TokenFeatureExtractor::ExtractCharactergramFeaturesAsciiFixed(
+    const Token& token) const {
+  std::vector<int> result;
+  if (token.is_padding || token.value.empty()) {
+    result.push_back(HashToken("<PAD>"));
+    return result;
+  }
 
-        for (; it_chargram_end <= it_end;
-             ++it_chargram_start, ++it_chargram_end) {
-          const int length_bytes =
-              it_chargram_end.utf8_data() - it_chargram_start.utf8_data();
-          result.push_back(HashToken(
-              StringPiece(it_chargram_start.utf8_data(), length_bytes)));
-        }
-      }
+  // The trimmed word with the prefix and suffix markers takes at most
+  // max_word_length + 3 bytes.
+  char feature_word[kMaxFixedWordLength + 3];
+  const std::string& word = token.value;
+  const int size = word.size();
+  const int half_length = options_.max_word_length / 2;
+  int length = 0;
+  feature_word[length++] = '^';
+  if (size > options_.max_word_length) {
+    for (int i = 0; i < half_length; ++i) {
+      feature_word[length++] =
+          RemapAsciiChar<kRemapDigits, kLowercase>(word[i]);
+    }
+    feature_word[length++] = '\1';
+    for (int i = size - half_length; i < size; ++i) {
+      feature_word[length++] =
+          RemapAsciiChar<kRemapDigits, kLowercase>(word[i]);
+    }
+  } else {
+    for (int i = 0; i < size; ++i) {
+      feature_word[length++] =
+          RemapAsciiChar<kRemapDigits, kLowercase>(word[i]);
     }
   }
+  feature_word[length++] = '$';
+
+  result.reserve(sizeof...(kOrders) * length);
+  const auto hash = [this](StringPiece chargram) {
+    return HashToken(chargram);
+  };
+  // Expands to one loop per order, in the order of the template arguments.
+  const int unused[] = {(AppendChargrams<kOrders>(feature_word,
+                                                  /*offsets=*/nullptr, length,
+                                                  hash, &result),
+                         0)...};
+  (void)unused;
   return result;
 }
 
+template <int... kOrders>
+std::vector<int>
+TokenFeatureExtractor::ExtractCharactergramFeaturesUnicodeFixed(
+    const Token& token) const {
+  std::vector<int> result;
+  if (token.is_padding || token.value.empty()) {
+    result.push_back(HashToken("<PAD>"));
+    return result;
+  }
+
+  const std::string feature_word =
+      UnicodeFeatureWord(token, options_, unilib_);
+
+  // The trimmed word with the prefix and suffix markers has at most
+  // max_word_length + 3 codepoints.
+  int codepoint_offsets[kMaxFixedWordLength + 4];
+  int num_codepoints = 0;
+  const UnicodeText feature_word_unicode =
+      UTF8ToUnicodeText(feature_word, /*do_copy=*/false);
+  for (auto it = feature_word_unicode.begin(); it != feature_word_unicode.end();
+       ++it) {
+    if (num_codepoints == kMaxFixedWordLength + 3) {
+      // Only possible with invalid UTF-8, which the generic path handles.
+      return ExtractCharactergramFeaturesUnicode(token);
+    }
+    codepoint_offsets[num_codepoints++] = it.utf8_data() - feature_word.data();
+  }
+  codepoint_offsets[num_codepoints] = feature_word.size();
+
+  result.reserve(sizeof...(kOrders) * num_codepoints);
+  const auto hash = [this](StringPiece chargram) {
+    return HashToken(chargram);
+  };
+  const int unused[] = {(AppendChargrams<kOrders>(feature_word.data(),
+                                                  codepoint_offsets,
+                                                  num_codepoints, hash,
+                                                  &result),
+                         0)...};
+  (void)unused;
+  return result;
+}
+
+bool TokenFeatureExtractor::HasSameSparseFeaturesAs(
+    const TokenFeatureExtractor& other) const {
+  return options_.num_buckets == other.options_.num_buckets &&
+         options_.chargram_orders == other.options_.chargram_orders &&
+         options_.unicode_aware_features ==
+             other.options_.unicode_aware_features &&
+         options_.remap_digits == other.options_.remap_digits &&
+         options_.lowercase_tokens == other.options_.lowercase_tokens &&
+         options_.max_word_length == other.options_.max_word_length &&
+         allowed_chargram_fingerprints_ ==
+             other.allowed_chargram_fingerprints_ &&
+         options_.embedding_bucket_remap_from ==
+             other.options_.embedding_bucket_remap_from &&
+         options_.embedding_bucket_remap_to ==
+             other.options_.embedding_bucket_remap_to;
+}
+
+int64 TokenFeatureExtractor::EstimateMemoryBytes() const {
+  int64 bytes = STLVectorMemoryBytes(allowed_chargram_fingerprints_) +
+                STLVectorMemoryBytes(ascii_regex_patterns_) +
+                STLVectorMemoryBytes(ascii_regex_index_) +
+                STLVectorMemoryBytes(regex_patterns_) +
+                STLVectorMemoryBytes(options_.embedding_bucket_remap_from) +
+                STLVectorMemoryBytes(options_.embedding_bucket_remap_to);
+  for (const auto& regex_pattern : regex_patterns_) {
+    bytes += regex_pattern->EstimateMemoryBytes();
+  }
+  return bytes;
+}
+
 }  // namespace libtextclassifier2
@@ -22,6 +22,7 @@
 #include <vector>
 
 #include "types.h"
+#include "util/base/integral_types.h"
 #include "util/strings/stringpiece.h"
 #include "util/utf8/unilib.h"
 
@@ -59,10 +60,58 @@ struct TokenFeatureExtractorOptions {
   // List of allowed charactergrams. The extracted charactergrams are filtered
   // using this list, and charactergrams that are not present are interpreted as
   // out-of-vocabulary.
-  // If no allowed_chargrams are specified, all charactergrams are allowed.
+  // If neither allowed_chargrams nor allowed_chargram_fingerprints are
+  // specified, all charactergrams are allowed.
   std::unordered_set<std::string> allowed_chargrams;
+
+  // Fingerprint64 of further allowed charactergrams, e.g. precomputed in the
+  // model. Combined with allowed_chargrams.
+  std::vector<uint64> allowed_chargram_fingerprints;
+
+  // Renumbering of the embedding buckets, e.g. so that frequently hit buckets
+  // are contiguous (see embedding-layout.h). Bucket embedding_bucket_remap_from
+  // [i] is replaced by embedding_bucket_remap_to[i]; buckets that are not
+  // listed are kept. The from list must be sorted.
+  std::vector<int> embedding_bucket_remap_from;
+  std::vector<int> embedding_bucket_remap_to;
+};
+
+namespace internal {
+
+// A regular expression that only consists of a sequence of ASCII character
+// classes (e.g. "^[A-Z][a-z]*$"), which can be matched without ICU. Supports
+// alphanumeric literals, bracket expressions of alphanumeric literals and
+// ranges, the quantifiers '?', '*' and '+', and '^' and '$' anchors at the
+// ends of the pattern.
+class AsciiClassRegex {
+ public:
+  // Parses the pattern. Returns false if the pattern uses any other syntax,
+  // in which case it needs to be evaluated with a full regex engine.
+  bool Parse(const std::string& pattern);
+
+  // Returns true if the whole input matches, like
+  // UniLib::RegexMatcher::Matches() would.
+  bool Matches(StringPiece input) const;
+
+ private:
+  struct Atom {
+    // Bitmask over the 128 ASCII characters.
+    uint64 chars[2];
+    bool optional;
+    bool repeated;
+  };
+
+  // Returns the set of atom positions reachable from 'states' without
+  // consuming input.
+  uint64 Closure(uint64 states) const;
+
+  // At most 63 atoms, so that a set of atom positions (including the final
+  // one) fits into a uint64 bitmask.
+  std::vector<Atom> atoms_;
 };
 
+}  // namespace internal
+
 class TokenFeatureExtractor {
  public:
   TokenFeatureExtractor(const TokenFeatureExtractorOptions& options,
@@ -92,10 +141,24 @@ class TokenFeatureExtractor {
     return feature_count;
   }
 
+  // Whether the extractor gives the same sparse features as 'other' for every
+  // token, so that the embeddings of the tokens can be shared. The dense
+  // features may differ.
+  bool HasSameSparseFeaturesAs(const TokenFeatureExtractor& other) const;
+
+  // Returns an estimate of the memory held by the extractor, mostly the
+  // allowed charactergrams and the regexp features.
+  int64 EstimateMemoryBytes() const;
+
  protected:
-  // Hashes given token to given number of buckets.
+  // Hashes given token to given number of buckets, and applies the bucket
+  // remap.
   int HashToken(StringPiece token) const;
 
+  // Hashes given token to given number of buckets, in the original bucket
+  // numbering.
+  int HashTokenToOriginalBucket(StringPiece token) const;
+
   // Extracts the charactergram features from the token in a non-unicode-aware
   // way.
   std::vector<int> ExtractCharactergramFeaturesAscii(const Token& token) const;
@@ -104,10 +167,60 @@ class TokenFeatureExtractor {
   std::vector<int> ExtractCharactergramFeaturesUnicode(
       const Token& token) const;
 
+  // Same as ExtractCharactergramFeaturesAscii, with the remapping options and
+  // the charactergram orders fixed at compile time. Requires a
+  // max_word_length of at most kMaxFixedWordLength.
+  template <bool kRemapDigits, bool kLowercase, int... kOrders>
+  std::vector<int> ExtractCharactergramFeaturesAsciiFixed(
+      const Token& token) const;
+
+  // Same as ExtractCharactergramFeaturesUnicode, with the charactergram orders
+  // fixed at compile time. Requires a max_word_length of at most
+  // kMaxFixedWordLength.
+  template <int... kOrders>
+  std::vector<int> ExtractCharactergramFeaturesUnicodeFixed(
+      const Token& token) const;
+
+  // Whether ExtractCharactergramFeatures uses one of the fixed variants above
+  // for the options.
+  bool HasFixedChargramExtractor() const {
+    return chargram_extractor_ !=
+               &TokenFeatureExtractor::ExtractCharactergramFeaturesAscii &&
+           chargram_extractor_ !=
+               &TokenFeatureExtractor::ExtractCharactergramFeaturesUnicode;
+  }
+
+  // Longest max_word_length supported by the fixed variants, which keep the
+  // feature word on the stack.
+  static const int kMaxFixedWordLength = 60;
+
  private:
+  using ChargramExtractor =
+      std::vector<int> (TokenFeatureExtractor::*)(const Token& token) const;
+
+  // Picks the charactergram extractor for the options: a fixed variant if one
+  // is instantiated for them, the generic ones otherwise.
+  ChargramExtractor SelectChargramExtractor() const;
+
   TokenFeatureExtractorOptions options_;
   std::vector<std::unique_ptr<UniLib::RegexPattern>> regex_patterns_;
+
+  // Regexp features that can be matched without ICU, and for each regexp
+  // feature the index into 'ascii_regex_patterns_', or -1 if it needs ICU.
+  // The ICU matching is skipped altogether when all the features are simple.
+  std::vector<internal::AsciiClassRegex> ascii_regex_patterns_;
+  std::vector<int> ascii_regex_index_;
+  bool has_icu_regex_features_ = false;
+
+  // Sorted fingerprints of all the allowed charactergrams. The charactergrams
+  // are filtered by binary search on their fingerprint, without keeping or
+  // building their strings.
+  std::vector<uint64> allowed_chargram_fingerprints_;
   const UniLib& unilib_;
+
+  // Picked once at construction, so that the options are not branched on for
+  // every token.
+  ChargramExtractor chargram_extractor_;
 };
 
 }  // namespace libtextclassifier2
@@ -16,6 +16,7 @@
 
 #include "token-feature-extractor.h"
 
+#include "util/hash/farmhash.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
@@ -24,6 +25,9 @@ namespace {
 
 class TestingTokenFeatureExtractor : public TokenFeatureExtractor {
  public:
+  using TokenFeatureExtractor::ExtractCharactergramFeaturesAscii;
+  using TokenFeatureExtractor::ExtractCharactergramFeaturesUnicode;
+  using TokenFeatureExtractor::HasFixedChargramExtractor;
   using TokenFeatureExtractor::HashToken;
   using TokenFeatureExtractor::TokenFeatureExtractor;
 };
@@ -363,7 +367,85 @@ TEST(TokenFeatureExtractorTest, LowercaseUnicode) {
 }
 #endif
 
+TEST(AsciiClassRegexTest, Parse) {
+  internal::AsciiClassRegex regex;
+  EXPECT_TRUE(regex.Parse("^[a-z]+$"));
+  EXPECT_TRUE(regex.Parse("[A-Z][a-z0-9]*"));
+  EXPECT_FALSE(regex.Parse("[A-Z][a-z_]*"));
+  EXPECT_FALSE(regex.Parse("^\\d+$"));
+  EXPECT_FALSE(regex.Parse("^[^a-z]+$"));
+  EXPECT_FALSE(regex.Parse("^(ab)+$"));
+  EXPECT_FALSE(regex.Parse("^a.b$"));
+  EXPECT_FALSE(regex.Parse("^[a-]$"));
+  EXPECT_FALSE(regex.Parse("^[]$"));
+  EXPECT_FALSE(regex.Parse("^[z-a]$"));
+  EXPECT_FALSE(regex.Parse("^[a-z$"));
+}
+
+TEST(AsciiClassRegexTest, Matches) {
+  internal::AsciiClassRegex lowercase;
+  ASSERT_TRUE(lowercase.Parse("^[a-z]+$"));
+  EXPECT_TRUE(lowercase.Matches("abc"));
+  EXPECT_FALSE(lowercase.Matches("abC"));
+  EXPECT_FALSE(lowercase.Matches(""));
+  EXPECT_FALSE(lowercase.Matches("ab\n"));
+  EXPECT_FALSE(lowercase.Matches("ab\xc4\x9b"));
+
+  internal::AsciiClassRegex capitalized;
+  ASSERT_TRUE(capitalized.Parse("^[A-Z][a-z]*$"));
+  EXPECT_TRUE(capitalized.Matches("A"));
+  EXPECT_TRUE(capitalized.Matches("Hello"));
+  EXPECT_FALSE(capitalized.Matches("HEllo"));
+  EXPECT_FALSE(capitalized.Matches("hello"));
+
+  internal::AsciiClassRegex digits;
+  ASSERT_TRUE(digits.Parse("^[0-9]?[0-9]a?x*[0-9]+$"));
+  EXPECT_TRUE(digits.Matches("11"));
+  EXPECT_TRUE(digits.Matches("1a1"));
+  EXPECT_TRUE(digits.Matches("12axxx345"));
+  EXPECT_TRUE(digits.Matches("1x1"));
+  EXPECT_FALSE(digits.Matches("1"));
+  EXPECT_FALSE(digits.Matches("123a"));
+  EXPECT_FALSE(digits.Matches("1aa1"));
+
+  internal::AsciiClassRegex empty;
+  ASSERT_TRUE(empty.Parse("^$"));
+  EXPECT_TRUE(empty.Matches(""));
+  EXPECT_FALSE(empty.Matches("a"));
+}
+
 #ifdef LIBTEXTCLASSIFIER_TEST_ICU
+TEST(TokenFeatureExtractorTest, AsciiRegexFeaturesMatchICU) {
+  const std::vector<std::string> patterns = {
+      "^[a-z]+$", "^[A-Z][a-z]*$", "^[0-9]+$", "[a-zA-Z0-9]*[0-9]",
+      "^[A-Z]+$", "^[a-z]+.$"};
+  TokenFeatureExtractorOptions options;
+  options.num_buckets = 1000;
+  options.chargram_orders = std::vector<int>{1};
+  options.regexp_features = patterns;
+  CREATE_UNILIB_FOR_TESTING
+  TestingTokenFeatureExtractor extractor(options, unilib);
+
+  for (const std::string& input :
+       {"", "abc", "Abc", "ABC", "123", "ab1", "abc.", "h\xc4\x9bllo", "a b"}) {
+    std::vector<float> dense_features = extractor.ExtractDenseFeatures(
+        Token{input, 0, 0}, /*is_in_span=*/false);
+    ASSERT_EQ(dense_features.size(), patterns.size());
+    for (int i = 0; i < patterns.size(); ++i) {
+      const UnicodeText pattern_unicode =
+          UTF8ToUnicodeText(patterns[i], /*do_copy=*/false);
+      const UnicodeText input_unicode =
+          UTF8ToUnicodeText(input, /*do_copy=*/false);
+      int status;
+      const bool matches = unilib.CreateRegexPattern(pattern_unicode)
+                               ->Matcher(input_unicode)
+                               ->Matches(&status);
+      EXPECT_EQ(dense_features[i], matches ? 1.0 : -1.0)
+          << patterns[i] << " " << input;
+    }
+  }
+}
+
 TEST(TokenFeatureExtractorTest, RegexFeatures) {
   TokenFeatureExtractorOptions options;
   options.num_buckets = 1000;
@@ -423,6 +505,37 @@ TEST(TokenFeatureExtractorTest, ExtractTooLongWord) {
               }));
 }
 
+TEST(TokenFeatureExtractorTest, ExtractTooLongWordAllOrders) {
+  TokenFeatureExtractorOptions options;
+  options.num_buckets = 1000;
+  options.chargram_orders = std::vector<int>{1, 3};
+  options.max_word_length = 4;
+  options.unicode_aware_features = true;
+  CREATE_UNILIB_FOR_TESTING
+  TestingTokenFeatureExtractor extractor(options, unilib);
+
+  std::vector<int> sparse_features;
+  std::vector<float> dense_features;
+  extractor.Extract(Token{"ěščřžý", 0, 0}, true, &sparse_features,
+                    &dense_features);
+
+  EXPECT_THAT(sparse_features,
+              testing::ElementsAreArray({
+                  // clang-format off
+                  extractor.HashToken("ě"),
+                  extractor.HashToken("š"),
+                  extractor.HashToken("\1"),
+                  extractor.HashToken("ž"),
+                  extractor.HashToken("ý"),
+                  extractor.HashToken("^ěš"),
+                  extractor.HashToken("ěš\1"),
+                  extractor.HashToken("š\1ž"),
+                  extractor.HashToken("\1žý"),
+                  extractor.HashToken("žý$"),
+                  // clang-format on
+              }));
+}
+
 TEST(TokenFeatureExtractorTest, ExtractAsciiUnicodeMatches) {
   TokenFeatureExtractorOptions options;
   options.num_buckets = 1000;
@@ -560,5 +673,165 @@ TEST(TokenFeatureExtractorTest, ExtractFiltered) {
   EXPECT_EQ(extractor.HashToken("<PAD>"), 1);
 }
 
+TEST(TokenFeatureExtractorTest, ExtractFilteredByFingerprints) {
+  TokenFeatureExtractorOptions options;
+  options.num_buckets = 1000;
+  options.chargram_orders = std::vector<int>{1, 2, 3};
+  options.allowed_chargrams.insert("^H");
+  options.allowed_chargrams.insert("llo");
+
+  CREATE_UNILIB_FOR_TESTING
+  TestingTokenFeatureExtractor extractor_strings(options, unilib);
+
+  options.allowed_chargrams.clear();
+  options.allowed_chargram_fingerprints.push_back(
+      tc2farmhash::Fingerprint64(std::string("llo")));
+  options.allowed_chargram_fingerprints.push_back(
+      tc2farmhash::Fingerprint64(std::string("^H")));
+  TestingTokenFeatureExtractor extractor_fingerprints(options, unilib);
+
+  for (const std::string& input : {"Hello", "Hi", "world"}) {
+    std::vector<int> sparse_features_strings;
+    std::vector<float> dense_features_strings;
+    extractor_strings.Extract(Token{input, 0, 0}, true,
+                              &sparse_features_strings,
+                              &dense_features_strings);
+
+    std::vector<int> sparse_features_fingerprints;
+    std::vector<float> dense_features_fingerprints;
+    extractor_fingerprints.Extract(Token{input, 0, 0}, true,
+                                   &sparse_features_fingerprints,
+                                   &dense_features_fingerprints);
+
+    EXPECT_THAT(sparse_features_fingerprints, sparse_features_strings)
+        << input;
+  }
+  EXPECT_NE(extractor_fingerprints.HashToken("llo"), 0);
+  EXPECT_EQ(extractor_fingerprints.HashToken("ll"), 0);
+  EXPECT_EQ(extractor_fingerprints.HashToken("<PAD>"), 1);
+}
+
+TEST(TokenFeatureExtractorTest, HasSameSparseFeaturesAs) {
+  TokenFeatureExtractorOptions options;
+  options.num_buckets = 1000;
+  options.chargram_orders = std::vector<int>{1, 2, 3};
+  options.allowed_chargrams.insert("^H");
+
+  CREATE_UNILIB_FOR_TESTING
+  const TestingTokenFeatureExtractor extractor(options, unilib);
+
+  // The dense features don't matter, and neither does the form of the
+  // allowed charactergrams.
+  TokenFeatureExtractorOptions other_options = options;
+  other_options.extract_case_feature = true;
+  other_options.extract_selection_mask_feature = true;
+  other_options.regexp_features.push_back("^[a-z]+$");
+  other_options.allowed_chargrams.clear();
+  other_options.allowed_chargram_fingerprints.push_back(
+      tc2farmhash::Fingerprint64(std::string("^H")));
+  EXPECT_TRUE(extractor.HasSameSparseFeaturesAs(
+      TestingTokenFeatureExtractor(other_options, unilib)));
+
+  other_options = options;
+  other_options.lowercase_tokens = true;
+  EXPECT_FALSE(extractor.HasSameSparseFeaturesAs(
+      TestingTokenFeatureExtractor(other_options, unilib)));
+
+  other_options = options;
+  other_options.chargram_orders = std::vector<int>{1, 2};
+  EXPECT_FALSE(extractor.HasSameSparseFeaturesAs(
+      TestingTokenFeatureExtractor(other_options, unilib)));
+
+  other_options = options;
+  other_options.allowed_chargrams.insert("llo");
+  EXPECT_FALSE(extractor.HasSameSparseFeaturesAs(
+      TestingTokenFeatureExtractor(other_options, unilib)));
+}
+
+TEST(TokenFeatureExtractorTest, RemapsEmbeddingBuckets) {
+  TokenFeatureExtractorOptions options;
+  options.num_buckets = 1000;
+  options.chargram_orders = std::vector<int>{1, 2, 3};
+  options.allowed_chargrams.insert("^H");
+  options.allowed_chargrams.insert("llo");
+
+  CREATE_UNILIB_FOR_TESTING
+  TestingTokenFeatureExtractor extractor(options, unilib);
+  const int llo_bucket = extractor.HashToken("llo");
+
+  // Swap the "llo" bucket with the out-of-vocabulary one.
+  options.embedding_bucket_remap_from = {0, llo_bucket};
+  options.embedding_bucket_remap_to = {llo_bucket, 0};
+  TestingTokenFeatureExtractor remapped_extractor(options, unilib);
+  EXPECT_EQ(remapped_extractor.HashToken("llo"), 0);
+  EXPECT_EQ(remapped_extractor.HashToken("ll"), llo_bucket);
+  EXPECT_EQ(remapped_extractor.HashToken("^H"), extractor.HashToken("^H"));
+  EXPECT_EQ(remapped_extractor.HashToken("<PAD>"), 1);
+
+  // An inconsistent remap is ignored.
+  options.embedding_bucket_remap_to.pop_back();
+  TestingTokenFeatureExtractor invalid_extractor(options, unilib);
+  EXPECT_EQ(invalid_extractor.HashToken("llo"), llo_bucket);
+}
+
+TEST(TokenFeatureExtractorTest, FixedChargramExtractorsMatchGeneric) {
+  CREATE_UNILIB_FOR_TESTING
+  struct FixedOptions {
+    bool unicode_aware_features;
+    bool remap_digits;
+    bool lowercase_tokens;
+    std::vector<int> chargram_orders;
+  };
+  for (const FixedOptions& fixed_options : std::vector<FixedOptions>{
+           {false, true, true, {1, 2, 3, 4, 5}},
+           {false, true, true, {1, 2, 3}},
+           {false, false, false, {1, 2, 3}},
+           {true, true, true, {1, 2, 3, 4, 5}},
+           {true, false, false, {1, 2, 3}}}) {
+    for (const int max_word_length : {20, 7, 1, 0}) {
+      TokenFeatureExtractorOptions options;
+      options.num_buckets = 1000;
+      options.unicode_aware_features = fixed_options.unicode_aware_features;
+      options.remap_digits = fixed_options.remap_digits;
+      options.lowercase_tokens = fixed_options.lowercase_tokens;
+      options.chargram_orders = fixed_options.chargram_orders;
+      options.max_word_length = max_word_length;
+      TestingTokenFeatureExtractor extractor(options, unilib);
+      ASSERT_TRUE(extractor.HasFixedChargramExtractor());
+
+      for (const std::string& input :
+           {"Hello", "x", "Hi", "CALL", "857-225-3556",
+            "https://www.abcdefgh.com/in/xxxkkkvayio", "Zürich", "ŘŠŤ12",
+            "\xff\xfeinvalid", ""}) {
+        const Token token(input, 0, 0);
+        if (options.unicode_aware_features) {
+          EXPECT_EQ(extractor.ExtractCharactergramFeatures(token),
+                    extractor.ExtractCharactergramFeaturesUnicode(token))
+              << input;
+        } else {
+          EXPECT_EQ(extractor.ExtractCharactergramFeatures(token),
+                    extractor.ExtractCharactergramFeaturesAscii(token))
+              << input;
+        }
+      }
+      Token padding;
+      padding.is_padding = true;
+      EXPECT_THAT(extractor.ExtractCharactergramFeatures(padding),
+                  testing::ElementsAreArray({extractor.HashToken("<PAD>")}));
+    }
+  }
+
+  // Other options use the generic extractors.
+  TokenFeatureExtractorOptions options;
+  options.num_buckets = 1000;
+  options.chargram_orders = {1, 2};
+  EXPECT_FALSE(TestingTokenFeatureExtractor(options, unilib)
+                   .HasFixedChargramExtractor());
+  options.chargram_orders = {1, 2, 3};
+  options.max_word_length = 100;
+  EXPECT_FALSE(TestingTokenFeatureExtractor(options, unilib)
+                   .HasFixedChargramExtractor());
+}
+
 }  // namespace
 }  // namespace libtextclassifier2
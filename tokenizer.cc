@@ -17,15 +17,19 @@
 #include "tokenizer.h"
 
 #include <algorithm>
+#include <map>
+#include <utility>
 
 #include "util/base/logging.h"
+#include "util/gtl/stl_util.h"
 #include "util/strings/utf8.h"
 
 namespace libtextclassifier2 {
 
 Tokenizer::Tokenizer(
     const std::vector<const TokenizationCodepointRange*>& codepoint_ranges,
-    bool split_on_script_change)
+    bool split_on_script_change,
+    const FeatureProcessorOptions_::CodepointPageTable* codepoint_page_table)
     : split_on_script_change_(split_on_script_change) {
   for (const TokenizationCodepointRange* range : codepoint_ranges) {
     codepoint_ranges_.emplace_back(range->UnPack());
@@ -36,6 +40,145 @@ Tokenizer::Tokenizer(
                const std::unique_ptr<const TokenizationCodepointRangeT>& b) {
               return a->start < b->start;
             });
+
+  if (codepoint_page_table != nullptr &&
+      UseCodepointPageTable(*codepoint_page_table)) {
+    return;
+  }
+  BuildCodepointPageTable();
+}
+
+bool Tokenizer::UseCodepointPageTable(
+    const FeatureProcessorOptions_::CodepointPageTable& table) {
+  const auto* roles = table.class_roles();
+  const auto* scripts = table.class_script_ids();
+  const auto* page_index = table.page_index();
+  const auto* pages = table.pages();
+  if (table.page_bits() != kCodepointPageBits || roles == nullptr ||
+      scripts == nullptr || page_index == nullptr || pages == nullptr ||
+      roles->size() == 0 || roles->size() > 0x100 ||
+      roles->size() != scripts->size() ||
+      page_index->size() != kNumCodepoints / kCodepointPageSize ||
+      pages->size() == 0 || pages->size() % kCodepointPageSize != 0) {
+    TC_LOG(ERROR) << "Invalid codepoint page table, ignoring it.";
+    return false;
+  }
+
+  // The table is read in place, so all its entries need to be in range.
+  const int num_pages = pages->size() / kCodepointPageSize;
+  for (const uint16 page : *page_index) {
+    if (page >= num_pages) {
+      TC_LOG(ERROR) << "Invalid codepoint page table, ignoring it.";
+      return false;
+    }
+  }
+  for (const uint8 codepoint_class : *pages) {
+    if (codepoint_class >= roles->size()) {
+      TC_LOG(ERROR) << "Invalid codepoint page table, ignoring it.";
+      return false;
+    }
+  }
+
+  codepoint_classes_.clear();
+  codepoint_classes_.reserve(roles->size());
+  for (int i = 0; i < roles->size(); ++i) {
+    codepoint_classes_.push_back(
+        {static_cast<TokenizationCodepointRange_::Role>(roles->Get(i)),
+         scripts->Get(i)});
+  }
+  codepoint_page_index_ = page_index->data();
+  codepoint_pages_ = pages->data();
+  num_codepoint_pages_ = num_pages;
+  return true;
+}
+
+bool Tokenizer::GetCodepointPageTable(
+    FeatureProcessorOptions_::CodepointPageTableT* table) const {
+  if (codepoint_page_index_ == nullptr) {
+    return false;
+  }
+  table->page_bits = kCodepointPageBits;
+  table->class_roles.clear();
+  table->class_script_ids.clear();
+  for (const CodepointClass& codepoint_class : codepoint_classes_) {
+    table->class_roles.push_back(codepoint_class.role);
+    table->class_script_ids.push_back(codepoint_class.script);
+  }
+  table->page_index.assign(
+      codepoint_page_index_,
+      codepoint_page_index_ + kNumCodepoints / kCodepointPageSize);
+  table->pages.assign(
+      codepoint_pages_,
+      codepoint_pages_ + num_codepoint_pages_ * kCodepointPageSize);
+  return true;
+}
+
+void Tokenizer::BuildCodepointPageTable() {
+  codepoint_classes_.clear();
+  codepoint_page_index_ = nullptr;
+  codepoint_pages_ = nullptr;
+  num_codepoint_pages_ = 0;
+  owned_codepoint_page_index_.clear();
+  owned_codepoint_pages_.clear();
+
+  std::vector<CodepointClass> classes;
+  classes.push_back({TokenizationCodepointRange_::Role_DEFAULT_ROLE,
+                     kUnknownScript});
+  std::map<std::pair<int, int>, int> class_ids;
+  class_ids[{classes[0].role, classes[0].script}] = 0;
+
+  const int num_pages = kNumCodepoints / kCodepointPageSize;
+  std::vector<uint16> page_index(num_pages);
+  std::vector<uint8> pages;
+  std::map<std::string, int> page_ids;
+  std::string page(kCodepointPageSize, 0);
+  int first_range = 0;
+  for (int page_id = 0; page_id < num_pages; ++page_id) {
+    const int page_start = page_id * kCodepointPageSize;
+    const int page_end = page_start + kCodepointPageSize;
+    while (first_range < codepoint_ranges_.size() &&
+           codepoint_ranges_[first_range]->end <= page_start) {
+      ++first_range;
+    }
+
+    std::fill(page.begin(), page.end(), 0);
+    for (int i = first_range; i < codepoint_ranges_.size() &&
+                              codepoint_ranges_[i]->start < page_end;
+         ++i) {
+      const TokenizationCodepointRangeT& range = *codepoint_ranges_[i];
+      const auto class_it =
+          class_ids
+              .insert({{range.role, range.script_id},
+                       static_cast<int>(classes.size())})
+              .first;
+      if (class_it->second == classes.size()) {
+        if (classes.size() > 0xff) {
+          TC_VLOG(1) << "Too many codepoint classes for the page table.";
+          return;
+        }
+        classes.push_back({range.role, range.script_id});
+      }
+      const int start = std::max(range.start, page_start);
+      const int end = std::min(range.end, page_end);
+      for (int codepoint = start; codepoint < end; ++codepoint) {
+        page[codepoint - page_start] = class_it->second;
+      }
+    }
+
+    const auto page_it =
+        page_ids.insert({page, static_cast<int>(page_ids.size())}).first;
+    if (page_it->second == pages.size() / kCodepointPageSize) {
+      pages.insert(pages.end(), page.begin(), page.end());
+    }
+    page_index[page_id] = page_it->second;
+  }
+
+  codepoint_classes_ = std::move(classes);
+  owned_codepoint_page_index_ = std::move(page_index);
+  owned_codepoint_pages_ = std::move(pages);
+  codepoint_page_index_ = owned_codepoint_page_index_.data();
+  codepoint_pages_ = owned_codepoint_pages_.data();
+  num_codepoint_pages_ = owned_codepoint_pages_.size() / kCodepointPageSize;
 }
 
 const TokenizationCodepointRangeT* Tokenizer::FindTokenizationRange(
@@ -66,6 +209,18 @@ const TokenizationCodepointRangeT* Tokenizer::FindTokenizationRange(
 void Tokenizer::GetScriptAndRole(char32 codepoint,
                                  TokenizationCodepointRange_::Role* role,
                                  int* script) const {
+  if (codepoint_page_index_ != nullptr && codepoint >= 0 &&
+      codepoint < kNumCodepoints) {
+    const int page = codepoint_page_index_[codepoint >> kCodepointPageBits];
+    const CodepointClass& codepoint_class =
+        codepoint_classes_[codepoint_pages_[page * kCodepointPageSize +
+                                            (codepoint &
+                                             (kCodepointPageSize - 1))]];
+    *role = codepoint_class.role;
+    *script = codepoint_class.script;
+    return;
+  }
+
   const TokenizationCodepointRangeT* range = FindTokenizationRange(codepoint);
   if (range) {
     *role = range->role;
@@ -76,6 +231,13 @@ void Tokenizer::GetScriptAndRole(char32 codepoint,
   }
 }
 
+bool Tokenizer::SplitsAfter(char32 codepoint) const {
+  TokenizationCodepointRange_::Role role;
+  int script;
+  GetScriptAndRole(codepoint, &role, &script);
+  return role & TokenizationCodepointRange_::Role_SPLIT_AFTER;
+}
+
 std::vector<Token> Tokenizer::Tokenize(const std::string& text) const {
   UnicodeText text_unicode = UTF8ToUnicodeText(text, /*do_copy=*/false);
   return Tokenize(text_unicode);
@@ -86,6 +248,27 @@ std::vector<Token> Tokenizer::Tokenize(const UnicodeText& text_unicode) const {
   Token new_token("", 0, 0);
   int codepoint_index = 0;
 
+  // The UTF-8 bytes of the codepoints of new_token that were not appended to
+  // its value yet. Consecutive codepoints are appended in one go, which
+  // typically amounts to a single allocation (or none, for short tokens) per
+  // token.
+  const char* pending_begin = nullptr;
+  const char* pending_end = nullptr;
+  const auto append_pending = [&new_token, &pending_begin, &pending_end]() {
+    if (pending_begin != pending_end) {
+      new_token.value.append(pending_begin, pending_end);
+    }
+    pending_begin = pending_end = nullptr;
+  };
+  const auto finish_token = [&result, &new_token, &append_pending](
+                                int next_token_start) {
+    append_pending();
+    if (!new_token.value.empty()) {
+      result.push_back(std::move(new_token));
+    }
+    new_token = Token("", next_token_start, next_token_start);
+  };
+
   int last_script = kInvalidScript;
   for (auto it = text_unicode.begin(); it != text_unicode.end();
        ++it, ++codepoint_index) {
@@ -96,31 +279,38 @@ std::vector<Token> Tokenizer::Tokenize(const UnicodeText& text_unicode) const {
     if (role & TokenizationCodepointRange_::Role_SPLIT_BEFORE ||
         (split_on_script_change_ && last_script != kInvalidScript &&
          last_script != script)) {
-      if (!new_token.value.empty()) {
-        result.push_back(new_token);
-      }
-      new_token = Token("", codepoint_index, codepoint_index);
+      finish_token(codepoint_index);
     }
     if (!(role & TokenizationCodepointRange_::Role_DISCARD_CODEPOINT)) {
-      new_token.value += std::string(
-          it.utf8_data(),
-          it.utf8_data() + GetNumBytesForNonZeroUTF8Char(it.utf8_data()));
+      const char* codepoint_data = it.utf8_data();
+      if (codepoint_data != pending_end) {
+        append_pending();
+        pending_begin = codepoint_data;
+      }
+      pending_end =
+          codepoint_data + GetNumBytesForNonZeroUTF8Char(codepoint_data);
       ++new_token.end;
     }
     if (role & TokenizationCodepointRange_::Role_SPLIT_AFTER) {
-      if (!new_token.value.empty()) {
-        result.push_back(new_token);
-      }
-      new_token = Token("", codepoint_index + 1, codepoint_index + 1);
+      finish_token(codepoint_index + 1);
     }
 
     last_script = script;
   }
+  append_pending();
   if (!new_token.value.empty()) {
-    result.push_back(new_token);
+    result.push_back(std::move(new_token));
   }
 
   return result;
 }
 
+int64 Tokenizer::EstimateMemoryBytes() const {
+  return codepoint_ranges_.size() * sizeof(TokenizationCodepointRangeT) +
+         STLVectorMemoryBytes(codepoint_ranges_) +
+         STLVectorMemoryBytes(codepoint_classes_) +
+         STLVectorMemoryBytes(owned_codepoint_page_index_) +
+         STLVectorMemoryBytes(owned_codepoint_pages_);
+}
+
 }  // namespace libtextclassifier2
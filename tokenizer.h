@@ -34,9 +34,14 @@ const int kUnknownScript = -2;
 // configuration.
 class Tokenizer {
  public:
+  // If given, the codepoint lookup uses the precomputed page table in place
+  // (it must outlive the tokenizer) instead of building one from the ranges.
+  // A table that does not fit the tokenizer is ignored.
   explicit Tokenizer(
       const std::vector<const TokenizationCodepointRange*>& codepoint_ranges,
-      bool split_on_script_change);
+      bool split_on_script_change,
+      const FeatureProcessorOptions_::CodepointPageTable* codepoint_page_table =
+          nullptr);
 
   // Tokenizes the input string using the selected tokenization method.
   std::vector<Token> Tokenize(const std::string& text) const;
@@ -44,6 +49,19 @@ class Tokenizer {
   // Same as above but takes UnicodeText.
   std::vector<Token> Tokenize(const UnicodeText& text_unicode) const;
 
+  // Returns whether a token always ends after the codepoint. Tokenizing a
+  // text from just after such a codepoint gives the same tokens there as
+  // tokenizing the whole text, so it can be tokenized in parts.
+  bool SplitsAfter(char32 codepoint) const;
+
+  // Returns an estimate of the memory held by the tokenizer.
+  int64 EstimateMemoryBytes() const;
+
+  // Copies the codepoint page table to be stored in a model. Returns false if
+  // the tokenizer has none, because it cannot represent the ranges.
+  bool GetCodepointPageTable(
+      FeatureProcessorOptions_::CodepointPageTableT* table) const;
+
  protected:
   // Finds the tokenization codepoint range config for given codepoint.
   // Internally uses binary search so should be O(log(# of codepoint_ranges)).
@@ -51,16 +69,53 @@ class Tokenizer {
 
   // Finds the role and script for given codepoint. If not found, DEFAULT_ROLE
   // and kUnknownScript are assigned.
+  // Uses the codepoint page table, so should be O(1).
   void GetScriptAndRole(char32 codepoint,
                         TokenizationCodepointRange_::Role* role,
                         int* script) const;
 
  private:
+  // Role and script shared by a class of codepoints.
+  struct CodepointClass {
+    TokenizationCodepointRange_::Role role;
+    int script;
+  };
+
+  // Codepoints are looked up in pages of 2^kCodepointPageBits codepoints.
+  static const int kCodepointPageBits = 8;
+  static const int kCodepointPageSize = 1 << kCodepointPageBits;
+  static const int kNumCodepoints = 0x110000;
+
+  // Builds the codepoint page table from codepoint_ranges_. Leaves the table
+  // empty if it cannot represent the ranges, in which case the lookups fall
+  // back to FindTokenizationRange().
+  void BuildCodepointPageTable();
+
+  // Uses the precomputed page table from the model. Returns false if it does
+  // not fit the tokenizer.
+  bool UseCodepointPageTable(
+      const FeatureProcessorOptions_::CodepointPageTable& table);
+
   // Codepoint ranges that determine how different codepoints are tokenized.
   // The ranges must not overlap.
   std::vector<std::unique_ptr<const TokenizationCodepointRangeT>>
       codepoint_ranges_;
 
+  // Two-level lookup table from codepoint to its class: the page of codepoint
+  // c is codepoint_page_index_[c >> kCodepointPageBits], and its class is
+  // codepoint_classes_[codepoint_pages_[page * kCodepointPageSize +
+  // (c & (kCodepointPageSize - 1))]]. Pages with the same content are stored
+  // once, so the table stays small for realistic configurations. Class 0 is
+  // the one of the codepoints not covered by any range.
+  // The index and the pages point either into the owned vectors below or
+  // into the model buffer; both stay in place when the tokenizer is moved.
+  std::vector<CodepointClass> codepoint_classes_;
+  const uint16* codepoint_page_index_ = nullptr;
+  const uint8* codepoint_pages_ = nullptr;
+  int num_codepoint_pages_ = 0;
+  std::vector<uint16> owned_codepoint_page_index_;
+  std::vector<uint8> owned_codepoint_pages_;
+
   // If true, tokens will be additionally split when the codepoint's script_id
   // changes.
   bool split_on_script_change_;
@@ -31,10 +31,14 @@ class TestingTokenizer : public Tokenizer {
   explicit TestingTokenizer(
       const std::vector<const TokenizationCodepointRange*>&
           codepoint_range_configs,
-      bool split_on_script_change)
-      : Tokenizer(codepoint_range_configs, split_on_script_change) {}
+      bool split_on_script_change,
+      const FeatureProcessorOptions_::CodepointPageTable*
+          codepoint_page_table = nullptr)
+      : Tokenizer(codepoint_range_configs, split_on_script_change,
+                  codepoint_page_table) {}
 
   using Tokenizer::FindTokenizationRange;
+  using Tokenizer::GetScriptAndRole;
 };
 
 class TestingTokenizerProxy {
@@ -55,6 +59,34 @@ class TestingTokenizerProxy {
     }
     tokenizer_ = std::unique_ptr<TestingTokenizer>(
         new TestingTokenizer(configs_fb, split_on_script_change));
+    configs_fb_ = configs_fb;
+    split_on_script_change_ = split_on_script_change;
+  }
+
+  // Replaces the tokenizer with one given the page table. Returns whether
+  // the new tokenizer uses it.
+  bool UseCodepointPageTable(
+      const FeatureProcessorOptions_::CodepointPageTableT& table) {
+    flatbuffers::FlatBufferBuilder builder;
+    builder.Finish(FeatureProcessorOptions_::CreateCodepointPageTable(
+        builder, &table));
+    page_table_buffer_ = builder.Release();
+    tokenizer_ = std::unique_ptr<TestingTokenizer>(new TestingTokenizer(
+        configs_fb_, split_on_script_change_,
+        flatbuffers::GetRoot<FeatureProcessorOptions_::CodepointPageTable>(
+            page_table_buffer_.data())));
+    FeatureProcessorOptions_::CodepointPageTableT used_table;
+    return tokenizer_->GetCodepointPageTable(&used_table) &&
+           used_table.page_bits == table.page_bits &&
+           used_table.class_roles == table.class_roles &&
+           used_table.class_script_ids == table.class_script_ids &&
+           used_table.page_index == table.page_index &&
+           used_table.pages == table.pages;
+  }
+
+  bool GetCodepointPageTable(
+      FeatureProcessorOptions_::CodepointPageTableT* table) const {
+    return tokenizer_->GetCodepointPageTable(table);
   }
 
   TokenizationCodepointRange_::Role TestFindTokenizationRole(int c) const {
@@ -67,12 +99,34 @@ class TestingTokenizerProxy {
     }
   }
 
+  // Checks that the codepoint lookup agrees with the tokenization ranges for
+  // every codepoint.
+  void ExpectLookupMatchesRanges() const {
+    for (int c = 0; c < 0x110000; ++c) {
+      const TokenizationCodepointRangeT* range =
+          tokenizer_->FindTokenizationRange(c);
+      TokenizationCodepointRange_::Role role;
+      int script;
+      tokenizer_->GetScriptAndRole(c, &role, &script);
+      if (range != nullptr) {
+        ASSERT_EQ(role, range->role) << c;
+        ASSERT_EQ(script, range->script_id) << c;
+      } else {
+        ASSERT_EQ(role, TokenizationCodepointRange_::Role_DEFAULT_ROLE) << c;
+        ASSERT_EQ(script, kUnknownScript) << c;
+      }
+    }
+  }
+
   std::vector<Token> Tokenize(const std::string& utf8_text) const {
     return tokenizer_->Tokenize(utf8_text);
   }
 
  private:
   std::vector<flatbuffers::DetachedBuffer> buffers_;
+  std::vector<const TokenizationCodepointRange*> configs_fb_;
+  bool split_on_script_change_;
+  flatbuffers::DetachedBuffer page_table_buffer_;
   std::unique_ptr<TestingTokenizer> tokenizer_;
 };
 
@@ -131,6 +185,84 @@ TEST(TokenizerTest, FindTokenizationRange) {
             TokenizationCodepointRange_::Role_DEFAULT_ROLE);
 }
 
+TEST(TokenizerTest, GetScriptAndRoleMatchesRanges) {
+  std::vector<TokenizationCodepointRangeT> configs;
+  TokenizationCodepointRangeT* config;
+
+  // Ranges that start and end inside, on and across page boundaries.
+  const std::vector<std::pair<int, int>> ranges = {
+      {0, 32},         {32, 33},         {100, 300},       {512, 768},
+      {1000, 1001},    {0x3000, 0x3400}, {0xFFFF, 0x10001}, {0x1F600, 0x1F650},
+      {0x10FFF0, 0x110000}};
+  for (int i = 0; i < ranges.size(); ++i) {
+    configs.emplace_back();
+    config = &configs.back();
+    config->start = ranges[i].first;
+    config->end = ranges[i].second;
+    config->role = i % 2 ? TokenizationCodepointRange_::Role_SPLIT_BEFORE
+                         : TokenizationCodepointRange_::Role_TOKEN_SEPARATOR;
+    config->script_id = i % 3;
+  }
+
+  TestingTokenizerProxy tokenizer(configs, /*split_on_script_change=*/false);
+  tokenizer.ExpectLookupMatchesRanges();
+}
+
+TEST(TokenizerTest, UsesPrecomputedCodepointPageTable) {
+  std::vector<TokenizationCodepointRangeT> configs;
+  const std::vector<std::pair<int, int>> ranges = {
+      {0, 32}, {32, 33}, {100, 300}, {0x3000, 0x3400}, {0x1F600, 0x1F650}};
+  for (int i = 0; i < ranges.size(); ++i) {
+    configs.emplace_back();
+    configs.back().start = ranges[i].first;
+    configs.back().end = ranges[i].second;
+    configs.back().role =
+        i % 2 ? TokenizationCodepointRange_::Role_SPLIT_BEFORE
+              : TokenizationCodepointRange_::Role_TOKEN_SEPARATOR;
+    configs.back().script_id = i;
+  }
+
+  TestingTokenizerProxy tokenizer(configs, /*split_on_script_change=*/false);
+  FeatureProcessorOptions_::CodepointPageTableT table;
+  ASSERT_TRUE(tokenizer.GetCodepointPageTable(&table));
+  ASSERT_TRUE(tokenizer.UseCodepointPageTable(table));
+  tokenizer.ExpectLookupMatchesRanges();
+
+  // Tables that do not fit are ignored, and the tokenizer builds its own.
+  FeatureProcessorOptions_::CodepointPageTableT invalid_table = table;
+  invalid_table.page_bits = 4;
+  EXPECT_FALSE(tokenizer.UseCodepointPageTable(invalid_table));
+  tokenizer.ExpectLookupMatchesRanges();
+
+  invalid_table = table;
+  invalid_table.pages[0] = invalid_table.class_roles.size();
+  EXPECT_FALSE(tokenizer.UseCodepointPageTable(invalid_table));
+  tokenizer.ExpectLookupMatchesRanges();
+
+  invalid_table = table;
+  invalid_table.page_index.pop_back();
+  EXPECT_FALSE(tokenizer.UseCodepointPageTable(invalid_table));
+  tokenizer.ExpectLookupMatchesRanges();
+}
+
+TEST(TokenizerTest, GetScriptAndRoleWithManyClasses) {
+  std::vector<TokenizationCodepointRangeT> configs;
+  TokenizationCodepointRangeT* config;
+
+  // More role/script combinations than fit the page table.
+  for (int i = 0; i < 300; ++i) {
+    configs.emplace_back();
+    config = &configs.back();
+    config->start = 2 * i;
+    config->end = 2 * i + 1;
+    config->role = TokenizationCodepointRange_::Role_WHITESPACE_SEPARATOR;
+    config->script_id = i;
+  }
+
+  TestingTokenizerProxy tokenizer(configs, /*split_on_script_change=*/false);
+  tokenizer.ExpectLookupMatchesRanges();
+}
+
 TEST(TokenizerTest, TokenizeOnSpace) {
   std::vector<TokenizationCodepointRangeT> configs;
   TokenizationCodepointRangeT* config;
@@ -52,38 +52,6 @@ inline bool ValidNonEmptySpan(const CodepointSpan& span) {
   return span.first < span.second && span.first >= 0 && span.second >= 0;
 }
 
-template <typename T>
-bool DoesCandidateConflict(
-    const int considered_candidate, const std::vector<T>& candidates,
-    const std::set<int, std::function<bool(int, int)>>& chosen_indices_set) {
-  if (chosen_indices_set.empty()) {
-    return false;
-  }
-
-  auto conflicting_it = chosen_indices_set.lower_bound(considered_candidate);
-  // Check conflict on the right.
-  if (conflicting_it != chosen_indices_set.end() &&
-      SpansOverlap(candidates[considered_candidate].span,
-                   candidates[*conflicting_it].span)) {
-    return true;
-  }
-
-  // Check conflict on the left.
-  // If we can't go more left, there can't be a conflict:
-  if (conflicting_it == chosen_indices_set.begin()) {
-    return false;
-  }
-  // Otherwise move one span left and insert if it doesn't overlap with the
-  // candidate.
-  --conflicting_it;
-  if (!SpansOverlap(candidates[considered_candidate].span,
-                    candidates[*conflicting_it].span)) {
-    return false;
-  }
-
-  return true;
-}
-
 // Marks a span in a sequence of tokens. The first element is the index of the
 // first token in the span, and the second element is the index of the token one
 // past the end of the span.
@@ -260,11 +228,22 @@ inline logging::LoggingStringStream& operator<<(
 
 // Represents a result of Annotate call.
 struct AnnotatedSpan {
+  // What found the span.
+  enum class Source {
+    OTHER = 0,
+    MODEL,
+    REGEX,
+    DATETIME,
+    NUM_SOURCES,
+  };
+
   // Unicode codepoint indices in the input string.
   CodepointSpan span = {kInvalidIndex, kInvalidIndex};
 
   // Classification result for the span.
   std::vector<ClassificationResult> classification;
+
+  Source source = Source::OTHER;
 };
 
 // Pretty-printing function for AnnotatedSpan.
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBTEXTCLASSIFIER_UTIL_BASE_DEADLINE_H_
+#define LIBTEXTCLASSIFIER_UTIL_BASE_DEADLINE_H_
+
+#include <atomic>
+#include <chrono>  // NOLINT
+
+#include "util/base/integral_types.h"
+#include "util/base/macros.h"
+
+namespace libtextclassifier2 {
+
+// When a call should stop: at a point in time, or once another thread sets a
+// cancellation flag. Never expires by default.
+struct Deadline {
+  std::chrono::steady_clock::time_point time =
+      std::chrono::steady_clock::time_point::max();
+
+  // Not owned. The call stops once it's true.
+  const std::atomic<bool>* cancelled = nullptr;
+
+  // Returns a deadline that expires 'timeout_ms' from now.
+  static Deadline InMs(int64 timeout_ms) {
+    Deadline deadline;
+    deadline.time = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(timeout_ms);
+    return deadline;
+  }
+
+  bool Expired() const {
+    if (cancelled != nullptr && cancelled->load(std::memory_order_relaxed)) {
+      return true;
+    }
+    return time != std::chrono::steady_clock::time_point::max() &&
+           std::chrono::steady_clock::now() >= time;
+  }
+};
+
+// Checks a deadline for the steps of one call, and remembers whether it
+// stopped some of them, i.e. whether the result of the call is partial.
+// NOTE: Thread-safe, so the parallel steps of a call can share it.
+class DeadlineCheck {
+ public:
+  explicit DeadlineCheck(const Deadline& deadline) : deadline_(deadline) {}
+
+  // Returns true if the next step should not run. Once the deadline has
+  // expired, keeps returning true without reading the clock.
+  bool Expired() {
+    if (expired_.load(std::memory_order_relaxed)) {
+      return true;
+    }
+    if (deadline_.Expired()) {
+      expired_ = true;
+      return true;
+    }
+    return false;
+  }
+
+  // Returns whether Expired() stopped some step.
+  bool StoppedEarly() const { return expired_; }
+
+ private:
+  const Deadline deadline_;
+  std::atomic<bool> expired_{false};
+
+  TC_DISALLOW_COPY_AND_ASSIGN(DeadlineCheck);
+};
+
+}  // namespace libtextclassifier2
+
+#endif  // LIBTEXTCLASSIFIER_UTIL_BASE_DEADLINE_H_
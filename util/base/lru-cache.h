@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBTEXTCLASSIFIER_UTIL_BASE_LRU_CACHE_H_
+#define LIBTEXTCLASSIFIER_UTIL_BASE_LRU_CACHE_H_
+
+#include <functional>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+#include "util/base/macros.h"
+
+namespace libtextclassifier2 {
+
+// A map of bounded size, which evicts its least recently used entry to make
+// room for a new one. Lookups and insertions take O(1). NOT thread-safe, not
+// even for concurrent lookups, which update the recency.
+template <typename K, typename V, typename Hash = std::hash<K>>
+class LruCache {
+ public:
+  // Holds up to 'capacity' entries, at least one.
+  explicit LruCache(int capacity) : capacity_(capacity > 0 ? capacity : 1) {}
+
+  // Returns the value of the key and makes it the most recently used entry,
+  // or nullptr if the key is not in the cache. The value stays valid until
+  // the next Put() or Clear().
+  const V* Get(const K& key) {
+    auto it = index_.find(key);
+    if (it == index_.end()) {
+      return nullptr;
+    }
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return &it->second->second;
+  }
+
+  // Sets the value of the key, as the most recently used entry. Evicts the
+  // least recently used entry if the cache is full.
+  void Put(const K& key, V value) {
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+      it->second->second = std::move(value);
+      entries_.splice(entries_.begin(), entries_, it->second);
+      return;
+    }
+    if (index_.size() >= capacity_) {
+      index_.erase(entries_.back().first);
+      entries_.pop_back();
+    }
+    entries_.emplace_front(key, std::move(value));
+    index_[key] = entries_.begin();
+  }
+
+  void Clear() {
+    index_.clear();
+    entries_.clear();
+  }
+
+  int size() const { return index_.size(); }
+  int capacity() const { return capacity_; }
+
+ private:
+  typedef std::list<std::pair<K, V>> EntryList;
+
+  const int capacity_;
+
+  // The most recently used entry first.
+  EntryList entries_;
+  std::unordered_map<K, typename EntryList::iterator, Hash> index_;
+
+  TC_DISALLOW_COPY_AND_ASSIGN(LruCache);
+};
+
+}  // namespace libtextclassifier2
+
+#endif  // LIBTEXTCLASSIFIER_UTIL_BASE_LRU_CACHE_H_
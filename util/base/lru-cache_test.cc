@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/base/lru-cache.h"
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+TEST(LruCacheTest, GetsWhatWasPut) {
+  LruCache<int, std::string> cache(2);
+  EXPECT_EQ(cache.Get(1), nullptr);
+  cache.Put(1, "one");
+  cache.Put(2, "two");
+  ASSERT_NE(cache.Get(1), nullptr);
+  EXPECT_EQ(*cache.Get(1), "one");
+  EXPECT_EQ(*cache.Get(2), "two");
+  EXPECT_EQ(cache.size(), 2);
+
+  cache.Put(1, "uno");
+  EXPECT_EQ(*cache.Get(1), "uno");
+  EXPECT_EQ(cache.size(), 2);
+}
+
+TEST(LruCacheTest, EvictsLeastRecentlyUsed) {
+  LruCache<int, std::string> cache(2);
+  cache.Put(1, "one");
+  cache.Put(2, "two");
+
+  // Using 1 makes 2 the least recently used entry.
+  EXPECT_NE(cache.Get(1), nullptr);
+  cache.Put(3, "three");
+  EXPECT_EQ(cache.Get(2), nullptr);
+  EXPECT_NE(cache.Get(1), nullptr);
+  EXPECT_NE(cache.Get(3), nullptr);
+  EXPECT_EQ(cache.size(), 2);
+
+  // Replacing a value makes it the most recently used, too.
+  cache.Put(1, "uno");
+  cache.Put(4, "four");
+  EXPECT_EQ(cache.Get(3), nullptr);
+  EXPECT_EQ(*cache.Get(1), "uno");
+
+  cache.Clear();
+  EXPECT_EQ(cache.size(), 0);
+  EXPECT_EQ(cache.Get(1), nullptr);
+}
+
+TEST(LruCacheTest, HoldsAtLeastOneEntry) {
+  LruCache<int, int> cache(0);
+  EXPECT_EQ(cache.capacity(), 1);
+  cache.Put(1, 10);
+  cache.Put(2, 20);
+  EXPECT_EQ(cache.Get(1), nullptr);
+  EXPECT_EQ(*cache.Get(2), 20);
+}
+
+}  // namespace
+}  // namespace libtextclassifier2
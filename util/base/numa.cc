@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/base/numa.h"
+
+#include <sched.h>
+
+#include <algorithm>
+#include <fstream>
+#include <thread>  // NOLINT
+
+#include "util/base/logging.h"
+#include "util/strings/numbers.h"
+#include "util/strings/split.h"
+
+namespace libtextclassifier2 {
+
+namespace {
+
+// Reads the CPU lists of the nodes from sysfs. Returns an empty list if there
+// are none. The nodes with only memory have empty lists.
+std::vector<std::string> ReadNodeCpuLists() {
+  std::vector<std::string> cpu_lists;
+  while (true) {
+    std::ifstream file("/sys/devices/system/node/node" +
+                       std::to_string(cpu_lists.size()) + "/cpulist");
+    if (!file) {
+      break;
+    }
+    std::string cpu_list;
+    std::getline(file, cpu_list);
+    cpu_lists.push_back(cpu_list);
+  }
+  return cpu_lists;
+}
+
+}  // namespace
+
+bool ParseCpuList(const std::string& cpu_list, std::vector<int>* cpus) {
+  cpus->clear();
+  const size_t end = cpu_list.find_last_not_of(" \t\n");
+  if (end == std::string::npos) {
+    return true;
+  }
+  for (const StringPiece& range :
+       strings::Split(StringPiece(cpu_list.data(), end + 1), ',')) {
+    const std::vector<StringPiece> ends = strings::Split(range, '-');
+    if (ends.empty() || ends.size() > 2) {
+      return false;
+    }
+    int32 first;
+    int32 last;
+    if (!ParseInt32(ends[0].ToString().c_str(), &first) ||
+        !ParseInt32(ends.back().ToString().c_str(), &last) || first < 0 ||
+        last < first) {
+      return false;
+    }
+    for (int cpu = first; cpu <= last; ++cpu) {
+      cpus->push_back(cpu);
+    }
+  }
+  return true;
+}
+
+const NumaTopology& NumaTopology::Instance() {
+  static const NumaTopology* instance =
+      new NumaTopology(FromCpuLists(ReadNodeCpuLists()));
+  return *instance;
+}
+
+NumaTopology NumaTopology::FromCpuLists(
+    const std::vector<std::string>& cpu_lists) {
+  NumaTopology topology;
+  for (const std::string& cpu_list : cpu_lists) {
+    std::vector<int> cpus;
+    if (!ParseCpuList(cpu_list, &cpus)) {
+      TC_LOG(WARNING) << "Invalid CPU list of NUMA node "
+                      << topology.node_cpus_.size() << ": " << cpu_list;
+      cpus.clear();
+    }
+    for (const int cpu : cpus) {
+      if (cpu >= topology.cpu_nodes_.size()) {
+        topology.cpu_nodes_.resize(cpu + 1, 0);
+      }
+      topology.cpu_nodes_[cpu] = topology.node_cpus_.size();
+    }
+    topology.node_cpus_.push_back(std::move(cpus));
+  }
+  if (topology.node_cpus_.empty()) {
+    std::vector<int> cpus;
+    const int num_cpus = std::max(1u, std::thread::hardware_concurrency());
+    for (int cpu = 0; cpu < num_cpus; ++cpu) {
+      cpus.push_back(cpu);
+    }
+    topology.cpu_nodes_.assign(num_cpus, 0);
+    topology.node_cpus_.push_back(std::move(cpus));
+  }
+  return topology;
+}
+
+int NumaTopology::NodeOfCpu(int cpu) const {
+  return cpu >= 0 && cpu < cpu_nodes_.size() ? cpu_nodes_[cpu] : 0;
+}
+
+int NumaTopology::CurrentNode() const {
+  if (node_cpus_.size() == 1) {
+    return 0;
+  }
+  return NodeOfCpu(sched_getcpu());
+}
+
+bool PinCurrentThreadToNumaNode(int node) {
+  const NumaTopology& topology = NumaTopology::Instance();
+  if (node < 0 || node >= topology.NumNodes() ||
+      topology.NodeCpus(node).empty()) {
+    TC_LOG(ERROR) << "Invalid NUMA node: " << node;
+    return false;
+  }
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (const int cpu : topology.NodeCpus(node)) {
+    if (cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &cpu_set);
+    }
+  }
+  if (sched_setaffinity(/*pid=*/0, sizeof(cpu_set), &cpu_set) != 0) {
+    TC_LOG(ERROR) << "Unable to pin the thread to NUMA node " << node;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace libtextclassifier2
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// NUMA topology of the machine and pinning of threads to its nodes, without
+// a dependency on libnuma.
+
+#ifndef LIBTEXTCLASSIFIER_UTIL_BASE_NUMA_H_
+#define LIBTEXTCLASSIFIER_UTIL_BASE_NUMA_H_
+
+#include <string>
+#include <vector>
+
+namespace libtextclassifier2 {
+
+// The NUMA nodes of the machine and their CPUs. Machines without NUMA, or
+// where the topology can't be read, have one node with all the CPUs.
+class NumaTopology {
+ public:
+  // The topology of the machine, read from sysfs once.
+  static const NumaTopology& Instance();
+
+  // The topology with the given CPU lists of the nodes, in the format of
+  // sysfs, e.g. "0-3,8-11". Nodes with invalid lists have no CPUs.
+  static NumaTopology FromCpuLists(const std::vector<std::string>& cpu_lists);
+
+  int NumNodes() const { return node_cpus_.size(); }
+
+  // The CPUs of the node.
+  const std::vector<int>& NodeCpus(int node) const { return node_cpus_[node]; }
+
+  // The node of the CPU, 0 for unknown CPUs.
+  int NodeOfCpu(int cpu) const;
+
+  // The node of the CPU that the calling thread runs on.
+  int CurrentNode() const;
+
+ private:
+  NumaTopology() {}
+
+  std::vector<std::vector<int>> node_cpus_;
+  std::vector<int> cpu_nodes_;
+};
+
+// Parses a CPU list in the format of sysfs, e.g. "0-3,8-11". An empty list,
+// as of a node with only memory, has no CPUs. Returns false if the list is
+// invalid.
+bool ParseCpuList(const std::string& cpu_list, std::vector<int>* cpus);
+
+// Restricts the calling thread to the CPUs of the node, so that it stays
+// there and the memory that it first touches is allocated on the node.
+// Returns false on error. To pin the workers of a ThreadPool, e.g.:
+//
+//   ThreadPool pool(num_threads, [](int index) {
+//     PinCurrentThreadToNumaNode(index % NumaTopology::Instance().NumNodes());
+//   });
+bool PinCurrentThreadToNumaNode(int node);
+
+}  // namespace libtextclassifier2
+
+#endif  // LIBTEXTCLASSIFIER_UTIL_BASE_NUMA_H_
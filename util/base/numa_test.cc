@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/base/numa.h"
+
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+using testing::ElementsAre;
+using testing::IsEmpty;
+
+TEST(NumaTest, ParsesCpuLists) {
+  std::vector<int> cpus;
+  EXPECT_TRUE(ParseCpuList("0-3,8,10-11", &cpus));
+  EXPECT_THAT(cpus, ElementsAre(0, 1, 2, 3, 8, 10, 11));
+  EXPECT_TRUE(ParseCpuList("5", &cpus));
+  EXPECT_THAT(cpus, ElementsAre(5));
+  EXPECT_TRUE(ParseCpuList("", &cpus));
+  EXPECT_THAT(cpus, IsEmpty());
+  EXPECT_TRUE(ParseCpuList("\n", &cpus));
+  EXPECT_THAT(cpus, IsEmpty());
+  EXPECT_TRUE(ParseCpuList("0-1\n", &cpus));
+  EXPECT_THAT(cpus, ElementsAre(0, 1));
+
+  EXPECT_FALSE(ParseCpuList("3-1", &cpus));
+  EXPECT_FALSE(ParseCpuList("1-2-3", &cpus));
+  EXPECT_FALSE(ParseCpuList("a", &cpus));
+}
+
+TEST(NumaTest, MapsCpusToNodes) {
+  const NumaTopology topology =
+      NumaTopology::FromCpuLists({"0-1,4-5", "2-3,6-7"});
+  EXPECT_EQ(topology.NumNodes(), 2);
+  EXPECT_THAT(topology.NodeCpus(1), ElementsAre(2, 3, 6, 7));
+  EXPECT_EQ(topology.NodeOfCpu(0), 0);
+  EXPECT_EQ(topology.NodeOfCpu(5), 0);
+  EXPECT_EQ(topology.NodeOfCpu(6), 1);
+  EXPECT_EQ(topology.NodeOfCpu(100), 0);
+
+  // Nodes with only memory don't have CPUs.
+  const NumaTopology memory_node_topology =
+      NumaTopology::FromCpuLists({"0-1", "", "2-3"});
+  EXPECT_EQ(memory_node_topology.NumNodes(), 3);
+  EXPECT_THAT(memory_node_topology.NodeCpus(1), IsEmpty());
+  EXPECT_EQ(memory_node_topology.NodeOfCpu(2), 2);
+}
+
+TEST(NumaTest, HasOneNodeWithoutTopology) {
+  const NumaTopology topology = NumaTopology::FromCpuLists({});
+  EXPECT_EQ(topology.NumNodes(), 1);
+  EXPECT_FALSE(topology.NodeCpus(0).empty());
+  EXPECT_EQ(topology.CurrentNode(), 0);
+}
+
+TEST(NumaTest, PinsToNodeOfMachine) {
+  const NumaTopology& topology = NumaTopology::Instance();
+  ASSERT_GE(topology.NumNodes(), 1);
+  // Pins another thread, to leave the test thread as it is.
+  std::thread thread([&topology]() {
+    EXPECT_TRUE(PinCurrentThreadToNumaNode(0));
+    EXPECT_EQ(topology.CurrentNode(), 0);
+    EXPECT_FALSE(PinCurrentThreadToNumaNode(topology.NumNodes()));
+  });
+  thread.join();
+}
+
+}  // namespace
+}  // namespace libtextclassifier2
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/base/task-runner.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>  // NOLINT
+
+namespace libtextclassifier2 {
+
+void ThreadTaskRunner::RunAll(
+    const std::vector<std::function<void()>>& tasks) {
+  std::atomic<int> next_task(0);
+  const auto run_tasks = [&tasks, &next_task]() {
+    for (int i = next_task++; i < tasks.size(); i = next_task++) {
+      tasks[i]();
+    }
+  };
+
+  std::vector<std::thread> threads;
+  const int num_threads =
+      std::min(num_threads_, static_cast<int>(tasks.size()));
+  for (int i = 1; i < num_threads; ++i) {
+    threads.emplace_back(run_tasks);
+  }
+  run_tasks();
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
+void RunAll(TaskRunner* runner,
+            const std::vector<std::function<void()>>& tasks) {
+  if (runner != nullptr) {
+    runner->RunAll(tasks);
+    return;
+  }
+  for (const std::function<void()>& task : tasks) {
+    task();
+  }
+}
+
+}  // namespace libtextclassifier2
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBTEXTCLASSIFIER_UTIL_BASE_TASK_RUNNER_H_
+#define LIBTEXTCLASSIFIER_UTIL_BASE_TASK_RUNNER_H_
+
+#include <functional>
+#include <vector>
+
+#include "util/base/macros.h"
+
+namespace libtextclassifier2 {
+
+// Runs batches of independent tasks, e.g. on a thread pool of the embedder.
+class TaskRunner {
+ public:
+  virtual ~TaskRunner() {}
+
+  // Runs all the tasks, in any order and possibly concurrently, and returns
+  // once all of them are done.
+  virtual void RunAll(const std::vector<std::function<void()>>& tasks) = 0;
+};
+
+// Runs each batch on the calling thread and on num_threads - 1 threads
+// started for the batch.
+class ThreadTaskRunner : public TaskRunner {
+ public:
+  explicit ThreadTaskRunner(int num_threads) : num_threads_(num_threads) {}
+
+  void RunAll(const std::vector<std::function<void()>>& tasks) override;
+
+ private:
+  const int num_threads_;
+
+  TC_DISALLOW_COPY_AND_ASSIGN(ThreadTaskRunner);
+};
+
+// Runs the tasks with the runner, or one after the other on the calling
+// thread if the runner is nullptr.
+void RunAll(TaskRunner* runner,
+            const std::vector<std::function<void()>>& tasks);
+
+}  // namespace libtextclassifier2
+
+#endif  // LIBTEXTCLASSIFIER_UTIL_BASE_TASK_RUNNER_H_
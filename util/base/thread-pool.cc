@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/base/thread-pool.h"
+
+#include <algorithm>
+
+namespace libtextclassifier2 {
+namespace {
+
+// The pool and worker index of the current thread, if it's a worker.
+thread_local const ThreadPool* current_pool = nullptr;
+thread_local int current_worker = -1;
+
+}  // namespace
+
+ThreadPool::ThreadPool(int num_threads) : ThreadPool(num_threads, nullptr) {}
+
+ThreadPool::ThreadPool(int num_threads,
+                       std::function<void(int)> on_thread_start) {
+  num_threads = std::max(1, num_threads);
+  for (int i = 0; i < num_threads; ++i) {
+    workers_.emplace_back(new Worker);
+  }
+  for (int i = 0; i < num_threads; ++i) {
+    threads_.emplace_back([this, i, on_thread_start]() {
+      if (on_thread_start) {
+        on_thread_start(i);
+      }
+      Run(i);
+    });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wakeup_.notify_all();
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+void ThreadPool::Schedule(std::function<void()> task) {
+  int index;
+  if (current_pool == this) {
+    index = current_worker;
+  } else {
+    std::lock_guard<std::mutex> lock(mutex_);
+    index = next_worker_;
+    next_worker_ = (next_worker_ + 1) % workers_.size();
+  }
+  {
+    std::lock_guard<std::mutex> lock(workers_[index]->mutex);
+    workers_[index]->tasks.push_back(std::move(task));
+  }
+
+  // The task is queued before it's counted, so each claimed task is in one of
+  // the queues.
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++num_pending_;
+  }
+  wakeup_.notify_one();
+}
+
+void ThreadPool::Run(int index) {
+  current_pool = this;
+  current_worker = index;
+  std::function<void()> task;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      wakeup_.wait(lock, [this]() { return num_pending_ > 0 || stopping_; });
+      if (num_pending_ == 0) {
+        return;
+      }
+      --num_pending_;
+    }
+    while (!TakeTask(index, &task)) {
+      std::this_thread::yield();
+    }
+    task();
+    task = nullptr;
+  }
+}
+
+bool ThreadPool::TakeTask(int index, std::function<void()>* task) {
+  // The own tasks are taken newest first, which are likely still in the
+  // cache, and the others' oldest first.
+  {
+    Worker* worker = workers_[index].get();
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    if (!worker->tasks.empty()) {
+      *task = std::move(worker->tasks.back());
+      worker->tasks.pop_back();
+      return true;
+    }
+  }
+  for (int i = 1; i < workers_.size(); ++i) {
+    Worker* worker = workers_[(index + i) % workers_.size()].get();
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    if (!worker->tasks.empty()) {
+      *task = std::move(worker->tasks.front());
+      worker->tasks.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace libtextclassifier2
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBTEXTCLASSIFIER_UTIL_BASE_THREAD_POOL_H_
+#define LIBTEXTCLASSIFIER_UTIL_BASE_THREAD_POOL_H_
+
+#include <condition_variable>  // NOLINT
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>   // NOLINT
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "util/base/macros.h"
+
+namespace libtextclassifier2 {
+
+// Runs single tasks asynchronously, e.g. on a thread pool of the embedder.
+class Executor {
+ public:
+  virtual ~Executor() {}
+
+  // Runs the task at some point, possibly on another thread, and returns
+  // without waiting for it.
+  virtual void Schedule(std::function<void()> task) = 0;
+};
+
+// A fixed number of threads with a work-stealing queue each. The tasks
+// scheduled from a worker go to its own queue, the others to the queues in
+// turn, and idle workers take the tasks from the other queues.
+// NOTE: All methods are thread-safe.
+class ThreadPool : public Executor {
+ public:
+  explicit ThreadPool(int num_threads);
+
+  // Runs 'on_thread_start' with the index of each thread when it starts,
+  // before any task, e.g. to pin the threads with
+  // PinCurrentThreadToNumaNode().
+  ThreadPool(int num_threads, std::function<void(int)> on_thread_start);
+
+  // Runs the scheduled tasks that are still pending, then stops the threads.
+  ~ThreadPool() override;
+
+  void Schedule(std::function<void()> task) override;
+
+  int NumThreads() const { return threads_.size(); }
+
+ private:
+  struct Worker {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  // The loop of the index-th thread.
+  void Run(int index);
+
+  // Takes a task from the index-th queue or, if it's empty, from another one.
+  bool TakeTask(int index, std::function<void()>* task);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::thread> threads_;
+
+  // Guards the number of scheduled tasks that no worker has claimed yet, which
+  // the workers wait for.
+  std::mutex mutex_;
+  std::condition_variable wakeup_;
+  int num_pending_ = 0;
+  bool stopping_ = false;
+  int next_worker_ = 0;
+
+  TC_DISALLOW_COPY_AND_ASSIGN(ThreadPool);
+};
+
+}  // namespace libtextclassifier2
+
+#endif  // LIBTEXTCLASSIFIER_UTIL_BASE_THREAD_POOL_H_
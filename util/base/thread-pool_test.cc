@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/base/thread-pool.h"
+
+#include <atomic>
+#include <memory>
+
+#include "gtest/gtest.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+TEST(ThreadPoolTest, RunsAllTasks) {
+  std::atomic<int> num_done(0);
+  {
+    ThreadPool pool(4);
+    EXPECT_EQ(pool.NumThreads(), 4);
+    for (int i = 0; i < 1000; ++i) {
+      pool.Schedule([&num_done]() { ++num_done; });
+    }
+  }
+  EXPECT_EQ(num_done, 1000);
+}
+
+TEST(ThreadPoolTest, RunsTasksScheduledFromWorkers) {
+  std::atomic<int> num_done(0);
+  {
+    ThreadPool pool(3);
+    for (int i = 0; i < 10; ++i) {
+      pool.Schedule([&pool, &num_done]() {
+        for (int j = 0; j < 10; ++j) {
+          pool.Schedule([&num_done]() { ++num_done; });
+        }
+        ++num_done;
+      });
+    }
+  }
+  EXPECT_EQ(num_done, 110);
+}
+
+TEST(ThreadPoolTest, RunsStartHookOnEachThread) {
+  std::atomic<int> started_mask(0);
+  {
+    ThreadPool pool(3, [&started_mask](int index) {
+      started_mask |= 1 << index;
+    });
+    EXPECT_EQ(pool.NumThreads(), 3);
+  }
+  EXPECT_EQ(started_mask, 7);
+}
+
+}  // namespace
+}  // namespace libtextclassifier2
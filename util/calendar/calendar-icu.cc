@@ -19,6 +19,8 @@
 #include <memory>
 
 #include "util/base/macros.h"
+#include "util/gtl/stl_util.h"
+#include "util/hash/farmhash.h"
 #include "unicode/gregocal.h"
 #include "unicode/timezone.h"
 #include "unicode/ucal.h"
@@ -285,23 +287,113 @@ bool RoundToGranularity(DatetimeGranularity granularity,
 
 }  // namespace
 
+std::unique_ptr<icu::Calendar> CalendarLib::CreateCalendar(
+    const std::string& locale, const std::string& timezone) const {
+  // Bounds the memory used for callers that pass many different timezones.
+  const int kMaxPrototypes = 32;
+
+  std::string key = locale;
+  key.push_back('\0');
+  key.append(timezone);
+
+  std::lock_guard<std::mutex> lock(prototypes_mutex_);
+  auto it = prototypes_.find(key);
+  if (it == prototypes_.end()) {
+    UErrorCode status = U_ZERO_ERROR;
+    std::unique_ptr<icu::Calendar> prototype(icu::Calendar::createInstance(
+        icu::Locale::createFromName(locale.c_str()), status));
+    if (U_FAILURE(status)) {
+      return nullptr;
+    }
+    prototype->adoptTimeZone(
+        icu::TimeZone::createTimeZone(icu::UnicodeString::fromUTF8(timezone)));
+
+    if (prototypes_.size() >= kMaxPrototypes) {
+      prototypes_.clear();
+    }
+    it = prototypes_.emplace(key, std::move(prototype)).first;
+  }
+  return std::unique_ptr<icu::Calendar>(it->second->clone());
+}
+
 bool CalendarLib::InterpretParseData(const DateParseData& parse_data,
                                      int64 reference_time_ms_utc,
                                      const std::string& reference_timezone,
                                      const std::string& reference_locale,
                                      DatetimeGranularity granularity,
                                      int64* interpreted_time_ms_utc) const {
+  const uint64 key = InterpretationKey(parse_data, reference_timezone,
+                                       reference_locale, granularity);
+  {
+    std::lock_guard<std::mutex> lock(interpretations_mutex_);
+    const Interpretation* interpretation = interpretations_.Get(key);
+    if (interpretation != nullptr &&
+        reference_time_ms_utc >= interpretation->day_start_ms_utc &&
+        reference_time_ms_utc < interpretation->day_end_ms_utc) {
+      *interpreted_time_ms_utc = interpretation->time_ms_utc;
+      return true;
+    }
+  }
+
+  Interpretation interpretation;
+  if (!ComputeInterpretation(parse_data, reference_time_ms_utc,
+                             reference_timezone, reference_locale, granularity,
+                             &interpretation)) {
+    return false;
+  }
+  *interpreted_time_ms_utc = interpretation.time_ms_utc;
+
+  std::lock_guard<std::mutex> lock(interpretations_mutex_);
+  interpretations_.Put(key, interpretation);
+  return true;
+}
+
+uint64 CalendarLib::InterpretationKey(const DateParseData& parse_data,
+                                      const std::string& reference_timezone,
+                                      const std::string& reference_locale,
+                                      DatetimeGranularity granularity) {
+  // Only the fields that are set are read.
+  const int mask = parse_data.field_set_mask;
+  const int fields[] = {
+      mask,
+      granularity,
+      mask & DateParseData::YEAR_FIELD ? parse_data.year : 0,
+      mask & DateParseData::MONTH_FIELD ? parse_data.month : 0,
+      mask & DateParseData::DAY_FIELD ? parse_data.day_of_month : 0,
+      mask & DateParseData::HOUR_FIELD ? parse_data.hour : 0,
+      mask & DateParseData::MINUTE_FIELD ? parse_data.minute : 0,
+      mask & DateParseData::SECOND_FIELD ? parse_data.second : 0,
+      mask & DateParseData::AMPM_FIELD ? parse_data.ampm : 0,
+      mask & DateParseData::ZONE_OFFSET_FIELD ? parse_data.zone_offset : 0,
+      mask & DateParseData::DST_OFFSET_FIELD ? parse_data.dst_offset : 0,
+      mask & DateParseData::RELATION_FIELD ? parse_data.relation : 0,
+      mask & DateParseData::RELATION_TYPE_FIELD ? parse_data.relation_type : 0,
+      mask & DateParseData::RELATION_DISTANCE_FIELD
+          ? parse_data.relation_distance
+          : 0,
+  };
+  std::string key(reinterpret_cast<const char*>(fields), sizeof(fields));
+  key.append(reference_timezone);
+  key.push_back('\0');
+  key.append(reference_locale);
+  return tc2farmhash::Fingerprint64(key);
+}
+
+bool CalendarLib::ComputeInterpretation(const DateParseData& parse_data,
+                                        int64 reference_time_ms_utc,
+                                        const std::string& reference_timezone,
+                                        const std::string& reference_locale,
+                                        DatetimeGranularity granularity,
+                                        Interpretation* interpretation) const {
   UErrorCode status = U_ZERO_ERROR;
 
-  std::unique_ptr<icu::Calendar> date(icu::Calendar::createInstance(
-      icu::Locale::createFromName(reference_locale.c_str()), status));
-  if (U_FAILURE(status)) {
+  std::unique_ptr<icu::Calendar> date =
+      CreateCalendar(reference_locale, reference_timezone);
+  if (date == nullptr) {
     TC_LOG(ERROR) << "error getting calendar instance";
     return false;
   }
 
-  date->adoptTimeZone(icu::TimeZone::createTimeZone(
-      icu::UnicodeString::fromUTF8(reference_timezone)));
   date->setTime(reference_time_ms_utc, status);
 
   // By default, the parsed time is interpreted to be on the reference day. But
@@ -311,6 +403,21 @@ bool CalendarLib::InterpretParseData(const DateParseData& parse_data,
   date->set(UCalendarDateFields::UCAL_SECOND, 0);
   date->set(UCalendarDateFields::UCAL_MILLISECOND, 0);
 
+  // From here on, the calendar only depends on the day of the reference time,
+  // which starts at the time above and ends when the next day starts.
+  {
+    const std::unique_ptr<icu::Calendar> day(date->clone());
+    interpretation->day_start_ms_utc = day->getTime(status);
+    day->add(UCalendarDateFields::UCAL_DAY_OF_MONTH, 1, status);
+    // The first hour of a day can be skipped by a DST shift.
+    day->set(UCalendarDateFields::UCAL_HOUR_OF_DAY, 0);
+    interpretation->day_end_ms_utc = day->getTime(status);
+    if (U_FAILURE(status)) {
+      TC_LOG(ERROR) << "error getting the reference day";
+      return false;
+    }
+  }
+
   static const int64 kMillisInHour = 1000 * 60 * 60;
   if (parse_data.field_set_mask & DateParseData::Fields::ZONE_OFFSET_FIELD) {
     date->set(UCalendarDateFields::UCAL_ZONE_OFFSET,
@@ -425,7 +532,7 @@ bool CalendarLib::InterpretParseData(const DateParseData& parse_data,
     return false;
   }
 
-  *interpreted_time_ms_utc = date->getTime(status);
+  interpretation->time_ms_utc = date->getTime(status);
   if (U_FAILURE(status)) {
     TC_LOG(ERROR) << "error getting time from instance";
     return false;
@@ -433,4 +540,24 @@ bool CalendarLib::InterpretParseData(const DateParseData& parse_data,
 
   return true;
 }
+
+int64 CalendarLib::EstimateMemoryBytes() const {
+  int64 bytes = 0;
+  {
+    // Each entry is a list node and a hash map node.
+    std::lock_guard<std::mutex> lock(interpretations_mutex_);
+    bytes += interpretations_.size() *
+             (sizeof(std::pair<uint64, Interpretation>) + 4 * sizeof(void*));
+  }
+  std::lock_guard<std::mutex> lock(prototypes_mutex_);
+  bytes += STLNodeContainerMemoryBytes(prototypes_);
+  for (const auto& key_prototype : prototypes_) {
+    // The calendars are Gregorian, each with its own time zone object, whose
+    // rules stay in the ICU data.
+    bytes += STLStringMemoryBytes(key_prototype.first) +
+             sizeof(icu::GregorianCalendar) + sizeof(icu::TimeZone);
+  }
+  return bytes;
+}
+
 }  // namespace libtextclassifier2
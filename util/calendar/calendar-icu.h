@@ -17,25 +17,84 @@
 #ifndef LIBTEXTCLASSIFIER_UTIL_CALENDAR_CALENDAR_ICU_H_
 #define LIBTEXTCLASSIFIER_UTIL_CALENDAR_CALENDAR_ICU_H_
 
+#include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 
 #include "types.h"
 #include "util/base/integral_types.h"
 #include "util/base/logging.h"
+#include "util/base/lru-cache.h"
+#include "util/base/macros.h"
+#include "unicode/calendar.h"
 
 namespace libtextclassifier2 {
 
 class CalendarLib {
  public:
+  // The number of memoized interpretations.
+  static const int kMaxInterpretations = 256;
+
+  CalendarLib() {}
+
   // Interprets parse_data as milliseconds since_epoch. Relative times are
   // resolved against the current time (reference_time_ms_utc). Returns true if
   // the interpratation was successful, false otherwise.
+  // The interpretation depends only on the day of the reference time in the
+  // reference timezone, so it's memoized for repeated expressions with a
+  // reference time on the same day, without any calendar arithmetic.
   bool InterpretParseData(const DateParseData& parse_data,
                           int64 reference_time_ms_utc,
                           const std::string& reference_timezone,
                           const std::string& reference_locale,
                           DatetimeGranularity granularity,
                           int64* interpreted_time_ms_utc) const;
+
+  // Returns an estimate of the memory held by the cached calendars.
+  int64 EstimateMemoryBytes() const;
+
+ private:
+  // Returns a new calendar for the locale and timezone. Clones a cached
+  // prototype, as creating calendars and time zones from scratch is
+  // expensive.
+  std::unique_ptr<icu::Calendar> CreateCalendar(
+      const std::string& locale, const std::string& timezone) const;
+
+  // Calendar prototypes by locale and timezone.
+  mutable std::mutex prototypes_mutex_;
+  mutable std::unordered_map<std::string, std::unique_ptr<const icu::Calendar>>
+      prototypes_;
+
+  // A memoized interpretation, valid for the reference times in
+  // [day_start_ms_utc, day_end_ms_utc).
+  struct Interpretation {
+    int64 day_start_ms_utc;
+    int64 day_end_ms_utc;
+    int64 time_ms_utc;
+  };
+
+  // Returns the key of the memoized interpretations of the arguments of
+  // InterpretParseData(), except the reference time.
+  static uint64 InterpretationKey(const DateParseData& parse_data,
+                                  const std::string& reference_timezone,
+                                  const std::string& reference_locale,
+                                  DatetimeGranularity granularity);
+
+  // Interprets the parse data with ICU, and sets the day of the reference
+  // time that the interpretation holds for.
+  bool ComputeInterpretation(const DateParseData& parse_data,
+                             int64 reference_time_ms_utc,
+                             const std::string& reference_timezone,
+                             const std::string& reference_locale,
+                             DatetimeGranularity granularity,
+                             Interpretation* interpretation) const;
+
+  mutable std::mutex interpretations_mutex_;
+  mutable LruCache<uint64, Interpretation> interpretations_{
+      kMaxInterpretations};
+
+  TC_DISALLOW_COPY_AND_ASSIGN(CalendarLib);
 };
 }  // namespace libtextclassifier2
 #endif  // LIBTEXTCLASSIFIER_UTIL_CALENDAR_CALENDAR_ICU_H_
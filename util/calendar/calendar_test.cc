@@ -123,6 +123,85 @@ TEST(CalendarTest, RoundingToGranularity) {
       /*granularity=*/GRANULARITY_SECOND, &time));
   EXPECT_EQ(time, 1524641639000 /* Apr 25 2018 09:33:59 */);
 }
+
+TEST(CalendarTest, ReusesCalendarsAcrossTimezones) {
+  CalendarLib calendar;
+  DateParseData data;
+  data.year = 2018;
+  data.month = 4;
+  data.day_of_month = 25;
+  data.field_set_mask = DateParseData::YEAR_FIELD | DateParseData::MONTH_FIELD |
+                        DateParseData::DAY_FIELD;
+  DateParseData tomorrow;
+  tomorrow.field_set_mask = DateParseData::RELATION_FIELD;
+  tomorrow.relation = DateParseData::TOMORROW;
+
+  for (int i = 0; i < 3; ++i) {
+    int64 time;
+    ASSERT_TRUE(calendar.InterpretParseData(
+        data, /*reference_time_ms_utc=*/0L,
+        /*reference_timezone=*/"Europe/Zurich", /*reference_locale=*/"en-CH",
+        /*granularity=*/GRANULARITY_DAY, &time));
+    EXPECT_EQ(time, 1524607200000L /* Apr 25 2018 00:00:00 CEST */);
+
+    ASSERT_TRUE(calendar.InterpretParseData(
+        tomorrow, /*reference_time_ms_utc=*/0L,
+        /*reference_timezone=*/"Europe/Zurich", /*reference_locale=*/"en-CH",
+        /*granularity=*/GRANULARITY_DAY, &time));
+    EXPECT_EQ(time, 82800000L /* Jan 02 1970 00:00:00 CET */);
+
+    ASSERT_TRUE(calendar.InterpretParseData(
+        data, /*reference_time_ms_utc=*/0L,
+        /*reference_timezone=*/"America/Los_Angeles",
+        /*reference_locale=*/"en-US",
+        /*granularity=*/GRANULARITY_DAY, &time));
+    EXPECT_EQ(time, 1524639600000L /* Apr 25 2018 00:00:00 PDT */);
+  }
+}
+
+TEST(CalendarTest, MemoizesWithinTheReferenceDay) {
+  DateParseData tomorrow;
+  tomorrow.field_set_mask = DateParseData::RELATION_FIELD;
+  tomorrow.relation = DateParseData::TOMORROW;
+  DateParseData next_friday_at_five;
+  next_friday_at_five.field_set_mask =
+      DateParseData::RELATION_FIELD | DateParseData::RELATION_TYPE_FIELD |
+      DateParseData::HOUR_FIELD;
+  next_friday_at_five.relation = DateParseData::NEXT;
+  next_friday_at_five.relation_type = DateParseData::FRIDAY;
+  next_friday_at_five.hour = 17;
+
+  // Every 20 minutes over the days around the DST shift of Mar 25 2018, as
+  // the memoized interpretations are reused, and without them.
+  CalendarLib calendar;
+  const int64 kStartMs = 1521846000000L; /* Mar 24 2018 00:00:00 CET */
+  for (int64 reference_time_ms_utc = kStartMs;
+       reference_time_ms_utc < kStartMs + 3 * 24 * 3600 * 1000L;
+       reference_time_ms_utc += 20 * 60 * 1000) {
+    for (const DateParseData& data : {tomorrow, next_friday_at_five}) {
+      int64 time;
+      ASSERT_TRUE(calendar.InterpretParseData(
+          data, reference_time_ms_utc, /*reference_timezone=*/"Europe/Zurich",
+          /*reference_locale=*/"en-CH", /*granularity=*/GRANULARITY_HOUR,
+          &time));
+      CalendarLib fresh_calendar;
+      int64 expected_time;
+      ASSERT_TRUE(fresh_calendar.InterpretParseData(
+          data, reference_time_ms_utc, /*reference_timezone=*/"Europe/Zurich",
+          /*reference_locale=*/"en-CH", /*granularity=*/GRANULARITY_HOUR,
+          &expected_time));
+      EXPECT_EQ(time, expected_time) << reference_time_ms_utc;
+    }
+  }
+
+  // Another timezone has its own interpretation.
+  int64 time;
+  ASSERT_TRUE(calendar.InterpretParseData(
+      tomorrow, /*reference_time_ms_utc=*/0L,
+      /*reference_timezone=*/"America/Los_Angeles",
+      /*reference_locale=*/"en-US", /*granularity=*/GRANULARITY_DAY, &time));
+  EXPECT_EQ(time, 28800000L /* Jan 01 1970 00:00:00 PST */);
+}
 #endif  // LIBTEXTCLASSIFIER_UNILIB_DUMMY
 
 }  // namespace
@@ -17,6 +17,11 @@
 #ifndef LIBTEXTCLASSIFIER_UTIL_GTL_STL_UTIL_H_
 #define LIBTEXTCLASSIFIER_UTIL_GTL_STL_UTIL_H_
 
+#include <string>
+#include <vector>
+
+#include "util/base/integral_types.h"
+
 namespace libtextclassifier2 {
 
 // Deletes all the elements in an STL container and clears the container. This
@@ -50,6 +55,26 @@ void STLDeleteValues(T *container) {
   container->clear();
 }
 
+// Estimates of the heap memory held by STL containers, for memory accounting.
+// They don't include the memory held by the elements themselves, e.g. the
+// characters of string elements.
+template <typename T>
+int64 STLVectorMemoryBytes(const std::vector<T> &container) {
+  return container.capacity() * sizeof(T);
+}
+
+inline int64 STLStringMemoryBytes(const std::string &str) {
+  return str.capacity() + 1;
+}
+
+// For sets and maps, ordered or not: one allocation per element, with the
+// tree or hash links.
+template <typename T>
+int64 STLNodeContainerMemoryBytes(const T &container) {
+  return container.size() *
+         (sizeof(typename T::value_type) + 4 * sizeof(void *));
+}
+
 }  // namespace libtextclassifier2
 
 #endif  // LIBTEXTCLASSIFIER_UTIL_GTL_STL_UTIL_H_
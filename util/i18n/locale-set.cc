@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/i18n/locale-set.h"
+
+#include <algorithm>
+
+#include "util/gtl/stl_util.h"
+#include "util/i18n/locale.h"
+#include "util/strings/split.h"
+
+namespace libtextclassifier2 {
+
+void LocaleSet::Add(int locale_id) {
+  if (locale_id < 0) {
+    return;
+  }
+  const int word = locale_id / 64;
+  if (word >= words_.size()) {
+    words_.resize(word + 1, 0);
+  }
+  words_[word] |= uint64{1} << (locale_id % 64);
+}
+
+bool LocaleSet::IsEmpty() const {
+  for (const uint64 word : words_) {
+    if (word != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool LocaleSet::Intersects(const LocaleSet& other) const {
+  const int num_words = std::min(words_.size(), other.words_.size());
+  for (int i = 0; i < num_words; ++i) {
+    if ((words_[i] & other.words_[i]) != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+LocaleSet& LocaleSet::operator|=(const LocaleSet& other) {
+  if (other.words_.size() > words_.size()) {
+    words_.resize(other.words_.size(), 0);
+  }
+  for (int i = 0; i < other.words_.size(); ++i) {
+    words_[i] |= other.words_[i];
+  }
+  return *this;
+}
+
+LocaleSet& LocaleSet::operator&=(const LocaleSet& other) {
+  if (words_.size() > other.words_.size()) {
+    words_.resize(other.words_.size());
+  }
+  for (int i = 0; i < words_.size(); ++i) {
+    words_[i] &= other.words_[i];
+  }
+  return *this;
+}
+
+int64 LocaleSet::EstimateMemoryBytes() const {
+  return STLVectorMemoryBytes(words_);
+}
+
+LocaleIndex::LocaleIndex(const std::vector<std::string>& tags)
+    : num_locales_(tags.size()) {
+  for (int i = 0; i < tags.size(); ++i) {
+    tag_to_id_[tags[i]] = i;
+  }
+}
+
+int LocaleIndex::LocaleId(const std::string& tag) const {
+  auto it = tag_to_id_.find(tag);
+  return it != tag_to_id_.end() ? it->second : -1;
+}
+
+void LocaleIndex::ExpandLocales(const std::string& locales,
+                                std::vector<int>* locale_ids,
+                                LocaleSet* locale_set,
+                                std::string* reference_locale) const {
+  const std::vector<StringPiece> split_locales = strings::Split(locales, ',');
+  if (reference_locale != nullptr) {
+    *reference_locale =
+        split_locales.empty() ? "" : split_locales[0].ToString();
+  }
+
+  LocaleSet added;
+  const auto add = [&](const std::string& tag) {
+    const int locale_id = LocaleId(tag);
+    if (locale_id == -1 || added.Contains(locale_id)) {
+      return;
+    }
+    added.Add(locale_id);
+    if (locale_ids != nullptr) {
+      locale_ids->push_back(locale_id);
+    }
+  };
+  for (const StringPiece& locale_str : split_locales) {
+    const std::string tag = locale_str.ToString();
+    add(tag);
+
+    const Locale locale = Locale::FromBCP47(tag);
+    if (!locale.IsValid()) {
+      continue;
+    }
+    const std::string language = locale.Language();
+    const std::string script = locale.Script();
+    const std::string region = locale.Region();
+    if (!region.empty()) {
+      add("*-" + region);
+    }
+    if (!script.empty()) {
+      add(language + "-" + script + "-*");
+    }
+    if (!language.empty()) {
+      add(language + "-*");
+    }
+  }
+  if (locale_set != nullptr) {
+    *locale_set |= added;
+  }
+}
+
+int64 LocaleIndex::EstimateMemoryBytes() const {
+  int64 bytes = STLNodeContainerMemoryBytes(tag_to_id_);
+  for (const auto& tag_id : tag_to_id_) {
+    bytes += STLStringMemoryBytes(tag_id.first);
+  }
+  return bytes;
+}
+
+}  // namespace libtextclassifier2
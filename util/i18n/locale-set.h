@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Locales interned to small integer ids, and sets of them as bitmasks, so that
+// locale decisions don't compare strings.
+
+#ifndef LIBTEXTCLASSIFIER_UTIL_I18N_LOCALE_SET_H_
+#define LIBTEXTCLASSIFIER_UTIL_I18N_LOCALE_SET_H_
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "util/base/integral_types.h"
+
+namespace libtextclassifier2 {
+
+// A set of locale ids.
+class LocaleSet {
+ public:
+  LocaleSet() {}
+
+  void Add(int locale_id);
+  bool Contains(int locale_id) const {
+    const int word = locale_id / 64;
+    return locale_id >= 0 && word < words_.size() &&
+           (words_[word] & (uint64{1} << (locale_id % 64))) != 0;
+  }
+
+  bool IsEmpty() const;
+  bool Intersects(const LocaleSet& other) const;
+
+  LocaleSet& operator|=(const LocaleSet& other);
+  LocaleSet& operator&=(const LocaleSet& other);
+
+  int64 EstimateMemoryBytes() const;
+
+ private:
+  std::vector<uint64> words_;
+};
+
+// The locales of a model, as BCP 47 tags with '*' wildcards, e.g. "de-CH",
+// "*-CH" or "de-*". Each tag's id is its index.
+class LocaleIndex {
+ public:
+  LocaleIndex() {}
+  explicit LocaleIndex(const std::vector<std::string>& tags);
+
+  int NumLocales() const { return num_locales_; }
+
+  // Returns the id of the tag, or -1 if it's not one of the locales.
+  int LocaleId(const std::string& tag) const;
+
+  // Expands a comma-separated list of requested locales to the ids of the
+  // locales that match them, in order and each once: for each requested
+  // locale the exact tag, then "*-<region>", "<language>-<script>-*" and
+  // "<language>-*". Adds them to 'locale_ids' and 'locale_set' if set.
+  // Assigns the first requested locale to 'reference_locale' if set.
+  void ExpandLocales(const std::string& locales, std::vector<int>* locale_ids,
+                     LocaleSet* locale_set,
+                     std::string* reference_locale) const;
+
+  int64 EstimateMemoryBytes() const;
+
+ private:
+  int num_locales_ = 0;
+  std::unordered_map<std::string, int> tag_to_id_;
+};
+
+}  // namespace libtextclassifier2
+
+#endif  // LIBTEXTCLASSIFIER_UTIL_I18N_LOCALE_SET_H_
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/i18n/locale-set.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+TEST(LocaleSetTest, SetOperations) {
+  LocaleSet a;
+  EXPECT_TRUE(a.IsEmpty());
+  a.Add(3);
+  a.Add(130);
+  EXPECT_TRUE(a.Contains(3));
+  EXPECT_TRUE(a.Contains(130));
+  EXPECT_FALSE(a.Contains(4));
+  EXPECT_FALSE(a.Contains(1000));
+  EXPECT_FALSE(a.Contains(-1));
+
+  LocaleSet b;
+  b.Add(4);
+  EXPECT_FALSE(a.Intersects(b));
+  b.Add(130);
+  EXPECT_TRUE(a.Intersects(b));
+
+  LocaleSet c = a;
+  c &= b;
+  EXPECT_FALSE(c.Contains(3));
+  EXPECT_TRUE(c.Contains(130));
+
+  c |= b;
+  EXPECT_TRUE(c.Contains(4));
+  EXPECT_FALSE(c.IsEmpty());
+}
+
+TEST(LocaleIndexTest, ExpandsLocales) {
+  const LocaleIndex index(
+      {"en-*", "de-CH", "*-CH", "de-*", "zh-Hant-*", "*-TW", "fr-*"});
+  EXPECT_EQ(index.NumLocales(), 7);
+  EXPECT_EQ(index.LocaleId("*-CH"), 2);
+  EXPECT_EQ(index.LocaleId("it-*"), -1);
+
+  std::vector<int> locale_ids;
+  LocaleSet locale_set;
+  std::string reference_locale;
+  index.ExpandLocales("de-CH,zh-Hant-TW,en-US,en-GB,xx", &locale_ids,
+                      &locale_set, &reference_locale);
+  EXPECT_THAT(locale_ids, testing::ElementsAre(1, 2, 3, 5, 4, 0));
+  EXPECT_EQ(reference_locale, "de-CH");
+  EXPECT_TRUE(locale_set.Contains(5));
+  EXPECT_FALSE(locale_set.Contains(6));
+
+  locale_ids.clear();
+  index.ExpandLocales("", &locale_ids, /*locale_set=*/nullptr,
+                      &reference_locale);
+  EXPECT_TRUE(locale_ids.empty());
+  EXPECT_EQ(reference_locale, "");
+}
+
+}  // namespace
+}  // namespace libtextclassifier2
@@ -20,37 +20,71 @@
 
 namespace libtextclassifier2 {
 
+namespace {
+
+// Appends the UTF8 encoding of the UTF16 text to 'result'.
+void AppendUTF16AsUTF8(const jchar* text, int length, std::string* result) {
+  for (int i = 0; i < length; ++i) {
+    uint32 codepoint = text[i];
+    if (codepoint >= 0xD800 && codepoint < 0xE000) {
+      if (codepoint < 0xDC00 && i + 1 < length && text[i + 1] >= 0xDC00 &&
+          text[i + 1] < 0xE000) {
+        codepoint =
+            0x10000 + ((codepoint - 0xD800) << 10) + (text[i + 1] - 0xDC00);
+        ++i;
+      } else {
+        codepoint = '?';
+      }
+    }
+    if (codepoint < 0x80) {
+      result->push_back(static_cast<char>(codepoint));
+    } else if (codepoint < 0x800) {
+      result->push_back(static_cast<char>(0xC0 | (codepoint >> 6)));
+      result->push_back(static_cast<char>(0x80 | (codepoint & 0x3F)));
+    } else if (codepoint < 0x10000) {
+      result->push_back(static_cast<char>(0xE0 | (codepoint >> 12)));
+      result->push_back(static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F)));
+      result->push_back(static_cast<char>(0x80 | (codepoint & 0x3F)));
+    } else {
+      result->push_back(static_cast<char>(0xF0 | (codepoint >> 18)));
+      result->push_back(static_cast<char>(0x80 | ((codepoint >> 12) & 0x3F)));
+      result->push_back(static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F)));
+      result->push_back(static_cast<char>(0x80 | (codepoint & 0x3F)));
+    }
+  }
+}
+
+}  // namespace
+
 bool JStringToUtf8String(JNIEnv* env, const jstring& jstr,
                          std::string* result) {
+  return JStringToUtf8String(env, jstr, result, /*index_mapper=*/nullptr);
+}
+
+bool JStringToUtf8String(JNIEnv* env, const jstring& jstr, std::string* result,
+                         UTF16IndexMapper* index_mapper) {
+  result->clear();
   if (jstr == nullptr) {
-    *result = std::string();
     return false;
   }
 
-  jclass string_class = env->FindClass("java/lang/String");
-  if (!string_class) {
-    TC_LOG(ERROR) << "Can't find String class";
+  const int length = env->GetStringLength(jstr);
+  // At most three UTF8 bytes per UTF16 character: the surrogate pairs take
+  // four bytes for two characters.
+  result->reserve(3 * length);
+
+  // No JNI calls are allowed until the characters are released.
+  const jchar* const chars = env->GetStringCritical(jstr, nullptr);
+  if (chars == nullptr) {
+    TC_LOG(ERROR) << "Can't get the string characters.";
     return false;
   }
-
-  jmethodID get_bytes_id =
-      env->GetMethodID(string_class, "getBytes", "(Ljava/lang/String;)[B");
-
-  jstring encoding = env->NewStringUTF("UTF-8");
-  jbyteArray array = reinterpret_cast<jbyteArray>(
-      env->CallObjectMethod(jstr, get_bytes_id, encoding));
-
-  jbyte* const array_bytes = env->GetByteArrayElements(array, JNI_FALSE);
-  int length = env->GetArrayLength(array);
-
-  *result = std::string(reinterpret_cast<char*>(array_bytes), length);
-
-  // Release the array.
-  env->ReleaseByteArrayElements(array, array_bytes, JNI_ABORT);
-  env->DeleteLocalRef(array);
-  env->DeleteLocalRef(string_class);
-  env->DeleteLocalRef(encoding);
-
+  AppendUTF16AsUTF8(chars, length, result);
+  if (index_mapper != nullptr) {
+    *index_mapper =
+        UTF16IndexMapper(reinterpret_cast<const uint16*>(chars), length);
+  }
+  env->ReleaseStringCritical(jstr, chars);
   return true;
 }
 
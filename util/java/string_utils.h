@@ -20,10 +20,20 @@
 #include <jni.h>
 #include <string>
 
+#include "util/utf8/utf16-index-mapper.h"
+
 namespace libtextclassifier2 {
 
+// Converts the Java string to UTF8 straight from its UTF16 characters,
+// without calls back into Java. Unpaired surrogates become '?', as with
+// String.getBytes("UTF-8"). Reuses the capacity of 'result'.
 bool JStringToUtf8String(JNIEnv* env, const jstring& jstr, std::string* result);
 
+// Same as above, and also maps the UTF16 indices of the string to its
+// codepoint indices.
+bool JStringToUtf8String(JNIEnv* env, const jstring& jstr, std::string* result,
+                         UTF16IndexMapper* index_mapper);
+
 }  // namespace libtextclassifier2
 
 #endif  // LIBTEXTCLASSIFIER_UTIL_JAVA_STRING_UTILS_H_
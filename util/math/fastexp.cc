@@ -16,6 +16,10 @@
 
 #include "util/math/fastexp.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
 namespace libtextclassifier2 {
 
 const int FastMathClass::kBits;
@@ -45,4 +49,37 @@ const FastMathClass::Table FastMathClass::cache_ = {
      7940441, 8029106, 8118253, 8207884, 8298001}
 };
 
+void FastMathClass::VeryFastExpInPlace(float* values, int size) const {
+  static const float kCutoff = -16.0f;
+  int k = 0;
+#if defined(__AVX2__)
+  // Same as VeryFastExp2 on 8 values at a time, with a gather for the table.
+  const __m256 cutoff_v = _mm256_set1_ps(kCutoff);
+  const __m256 log_base2_of_e_v = _mm256_set1_ps(kLogBase2OfE);
+  const __m256 offset_v = _mm256_set1_ps(127 + (1 << (23 - kBits)));
+  const __m256i mask1_v = _mm256_set1_epi32(kMask1);
+  const __m256i mask2_v = _mm256_set1_epi32(kMask2);
+  for (; k + 8 <= size; k += 8) {
+    const __m256 f = _mm256_loadu_ps(values + k);
+    const __m256 keep = _mm256_cmp_ps(f, cutoff_v, _CMP_GE_OQ);
+    // The values below the cutoff are clamped to keep the exponent in range,
+    // and masked out below.
+    const __m256 g = _mm256_add_ps(
+        _mm256_mul_ps(_mm256_max_ps(f, cutoff_v), log_base2_of_e_v), offset_v);
+    const __m256i x = _mm256_castps_si256(g);
+    const __m256i exponent =
+        _mm256_slli_epi32(_mm256_and_si256(x, mask2_v), 23 - kBits);
+    const __m256i mantissa = _mm256_i32gather_epi32(
+        cache_.exp1, _mm256_and_si256(x, mask1_v), sizeof(int32));
+    _mm256_storeu_ps(
+        values + k,
+        _mm256_and_ps(_mm256_castsi256_ps(_mm256_or_si256(exponent, mantissa)),
+                      keep));
+  }
+#endif
+  for (; k < size; ++k) {
+    values[k] = values[k] < kCutoff ? 0.0f : VeryFastExp(values[k]);
+  }
+}
+
 }  // namespace libtextclassifier2
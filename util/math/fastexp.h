@@ -54,6 +54,11 @@ class FastMathClass {
     return VeryFastExp2(f * kLogBase2OfE);
   }
 
+  // Replaces each of the 'size' values with its VeryFastExp, or with 0 if it
+  // is below -16 (the exp is then < 1.2e-7). Vectorized where the CPU can do
+  // the table lookups in vector registers.
+  void VeryFastExpInPlace(float* values, int size) const;
+
  private:
   static const Table cache_;
 };
@@ -62,6 +67,9 @@ extern FastMathClass FastMathInstance;
 
 inline float VeryFastExp2(float f) { return FastMathInstance.VeryFastExp2(f); }
 inline float VeryFastExp(float f) { return FastMathInstance.VeryFastExp(f); }
+inline void VeryFastExpInPlace(float* values, int size) {
+  FastMathInstance.VeryFastExpInPlace(values, size);
+}
 
 }  // namespace libtextclassifier2
 
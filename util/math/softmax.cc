@@ -16,12 +16,154 @@
 
 #include "util/math/softmax.h"
 
+#include <algorithm>
 #include <limits>
 
 #include "util/base/logging.h"
 #include "util/math/fastexp.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define LIBTEXTCLASSIFIER_SOFTMAX_NEON
+#endif
+
 namespace libtextclassifier2 {
+namespace {
+
+// Vectorized kernels. MaxScore returns the max of all the scores, the others
+// return the number of leading elements they processed; the rest is left to
+// the scalar tail loops of the callers.
+#if defined(__AVX2__)
+float MaxScore(const float *scores, int size) {
+  int i = 0;
+  float max = -std::numeric_limits<float>::infinity();
+  if (size >= 8) {
+    __m256 max_v = _mm256_loadu_ps(scores);
+    for (i = 8; i + 8 <= size; i += 8) {
+      max_v = _mm256_max_ps(max_v, _mm256_loadu_ps(scores + i));
+    }
+    float lanes[8];
+    _mm256_storeu_ps(lanes, max_v);
+    max = *std::max_element(lanes, lanes + 8);
+  }
+  for (; i < size; ++i) {
+    max = std::max(max, scores[i]);
+  }
+  return max;
+}
+
+int ShiftVectorized(const float *scores, float shift, float *dest, int size) {
+  const __m256 shift_v = _mm256_set1_ps(shift);
+  int i = 0;
+  for (; i + 8 <= size; i += 8) {
+    _mm256_storeu_ps(dest + i,
+                     _mm256_sub_ps(_mm256_loadu_ps(scores + i), shift_v));
+  }
+  return i;
+}
+
+int ScaleVectorized(float factor, float *values, int size) {
+  const __m256 factor_v = _mm256_set1_ps(factor);
+  int i = 0;
+  for (; i + 8 <= size; i += 8) {
+    _mm256_storeu_ps(values + i,
+                     _mm256_mul_ps(_mm256_loadu_ps(values + i), factor_v));
+  }
+  return i;
+}
+#elif defined(__SSE4_1__)
+float MaxScore(const float *scores, int size) {
+  int i = 0;
+  float max = -std::numeric_limits<float>::infinity();
+  if (size >= 4) {
+    __m128 max_v = _mm_loadu_ps(scores);
+    for (i = 4; i + 4 <= size; i += 4) {
+      max_v = _mm_max_ps(max_v, _mm_loadu_ps(scores + i));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, max_v);
+    max = *std::max_element(lanes, lanes + 4);
+  }
+  for (; i < size; ++i) {
+    max = std::max(max, scores[i]);
+  }
+  return max;
+}
+
+int ShiftVectorized(const float *scores, float shift, float *dest, int size) {
+  const __m128 shift_v = _mm_set1_ps(shift);
+  int i = 0;
+  for (; i + 4 <= size; i += 4) {
+    _mm_storeu_ps(dest + i, _mm_sub_ps(_mm_loadu_ps(scores + i), shift_v));
+  }
+  return i;
+}
+
+int ScaleVectorized(float factor, float *values, int size) {
+  const __m128 factor_v = _mm_set1_ps(factor);
+  int i = 0;
+  for (; i + 4 <= size; i += 4) {
+    _mm_storeu_ps(values + i, _mm_mul_ps(_mm_loadu_ps(values + i), factor_v));
+  }
+  return i;
+}
+#elif defined(LIBTEXTCLASSIFIER_SOFTMAX_NEON)
+float MaxScore(const float *scores, int size) {
+  int i = 0;
+  float max = -std::numeric_limits<float>::infinity();
+  if (size >= 4) {
+    float32x4_t max_v = vld1q_f32(scores);
+    for (i = 4; i + 4 <= size; i += 4) {
+      max_v = vmaxq_f32(max_v, vld1q_f32(scores + i));
+    }
+    float lanes[4];
+    vst1q_f32(lanes, max_v);
+    max = *std::max_element(lanes, lanes + 4);
+  }
+  for (; i < size; ++i) {
+    max = std::max(max, scores[i]);
+  }
+  return max;
+}
+
+int ShiftVectorized(const float *scores, float shift, float *dest, int size) {
+  const float32x4_t shift_v = vdupq_n_f32(shift);
+  int i = 0;
+  for (; i + 4 <= size; i += 4) {
+    vst1q_f32(dest + i, vsubq_f32(vld1q_f32(scores + i), shift_v));
+  }
+  return i;
+}
+
+int ScaleVectorized(float factor, float *values, int size) {
+  const float32x4_t factor_v = vdupq_n_f32(factor);
+  int i = 0;
+  for (; i + 4 <= size; i += 4) {
+    vst1q_f32(values + i, vmulq_f32(vld1q_f32(values + i), factor_v));
+  }
+  return i;
+}
+#else
+float MaxScore(const float *scores, int size) {
+  float max = -std::numeric_limits<float>::infinity();
+  for (int i = 0; i < size; ++i) {
+    max = std::max(max, scores[i]);
+  }
+  return max;
+}
+
+int ShiftVectorized(const float *scores, float shift, float *dest, int size) {
+  return 0;
+}
+
+int ScaleVectorized(float factor, float *values, int size) { return 0; }
+#endif
+
+}  // namespace
 
 float ComputeSoftmaxProbability(const std::vector<float> &scores, int label) {
   if ((label < 0) || (label >= scores.size())) {
@@ -74,31 +216,75 @@ std::vector<float> ComputeSoftmax(const std::vector<float> &scores) {
 }
 
 std::vector<float> ComputeSoftmax(const float *scores, int scores_size) {
-  std::vector<float> softmax;
-  std::vector<float> exp_scores;
-  exp_scores.reserve(scores_size);
-  softmax.reserve(scores_size);
+  std::vector<float> softmax(scores_size);
+  ComputeSoftmax(scores, scores_size, softmax.data());
+  return softmax;
+}
 
-  // Find max value in "scores" vector and rescale to avoid overflows.
-  float max = std::numeric_limits<float>::min();
-  for (int i = 0; i < scores_size; ++i) {
-    const float score = scores[i];
-    if (score > max) max = score;
+void ComputeSoftmax(const float *scores, int scores_size, float *softmax) {
+  if (scores_size <= 0) {
+    return;
   }
+
+  // Rescale by the max value in "scores" to avoid overflows.
+  const float max = MaxScore(scores, scores_size);
+  int i = ShiftVectorized(scores, max, softmax, scores_size);
+  for (; i < scores_size; ++i) {
+    softmax[i] = scores[i] - max;
+  }
+
+  // See comments above in ComputeSoftmaxProbability for the reasoning behind
+  // the approximation of the small exps with 0.
+  VeryFastExpInPlace(softmax, scores_size);
+
   float denominator = 0;
-  for (int i = 0; i < scores_size; ++i) {
-    const float score = scores[i];
-    // See comments above in ComputeSoftmaxProbability for the reasoning behind
-    // this approximation.
-    const float exp_score = score - max < -16.0f ? 0 : VeryFastExp(score - max);
-    exp_scores.push_back(exp_score);
-    denominator += exp_score;
+  for (i = 0; i < scores_size; ++i) {
+    denominator += softmax[i];
+  }
+  const float inverse_denominator = 1.0f / denominator;
+  i = ScaleVectorized(inverse_denominator, softmax, scores_size);
+  for (; i < scores_size; ++i) {
+    softmax[i] *= inverse_denominator;
+  }
+}
+
+int ComputeSoftmaxTopK(const float *scores, int scores_size, int k,
+                       int *labels, float *probabilities) {
+  k = std::max(0, std::min(k, scores_size));
+  if (k == 0) {
+    return 0;
+  }
+
+  // Insertion into the sorted top labels, which is cheaper than sorting all
+  // of them for the few labels that are usually asked for.
+  int num_top = 0;
+  for (int label = 0; label < scores_size; ++label) {
+    if (num_top == k && scores[label] <= scores[labels[k - 1]]) {
+      continue;
+    }
+    int j = (num_top < k) ? num_top++ : k - 1;
+    for (; j > 0 && scores[labels[j - 1]] < scores[label]; --j) {
+      labels[j] = labels[j - 1];
+    }
+    labels[j] = label;
   }
 
+  // The top score is the max, so the denominator doesn't need a pass of its
+  // own to find it.
+  const float max = scores[labels[0]];
+  float denominator = 0;
   for (int i = 0; i < scores_size; ++i) {
-    softmax.push_back(exp_scores[i] / denominator);
+    const float delta_score = scores[i] - max;
+    if (delta_score >= -16.0f) {
+      denominator += VeryFastExp(delta_score);
+    }
   }
-  return softmax;
+  for (int i = 0; i < k; ++i) {
+    const float delta_score = scores[labels[i]] - max;
+    probabilities[i] =
+        delta_score < -16.0f ? 0.0f : VeryFastExp(delta_score) / denominator;
+  }
+  return k;
 }
 
 }  // namespace libtextclassifier2
@@ -33,6 +33,19 @@ std::vector<float> ComputeSoftmax(const std::vector<float> &scores);
 // Same as above but operates on an array of floats.
 std::vector<float> ComputeSoftmax(const float *scores, int scores_size);
 
+// Same as above, but writes the softmax to the caller's "softmax" buffer of
+// "scores_size" floats instead of allocating, which may also be "scores" to
+// compute the softmax in place.
+void ComputeSoftmax(const float *scores, int scores_size, float *softmax);
+
+// Computes the softmax probabilities of only the "k" labels with the highest
+// scores, without allocating.  Writes the labels and their probabilities, in
+// decreasing order and with the lower label first on ties, to the "labels"
+// and "probabilities" buffers of at least "k" elements each.  Returns the
+// number of labels written: min(k, scores_size).
+int ComputeSoftmaxTopK(const float *scores, int scores_size, int k,
+                       int *labels, float *probabilities);
+
 }  // namespace libtextclassifier2
 
 #endif  // LIBTEXTCLASSIFIER_UTIL_MATH_SOFTMAX_H_
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "util/math/softmax.h"
+
+#include <cmath>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+std::vector<float> ExactSoftmax(const std::vector<float>& scores) {
+  float denominator = 0;
+  for (const float score : scores) {
+    denominator += std::exp(score);
+  }
+  std::vector<float> softmax;
+  for (const float score : scores) {
+    softmax.push_back(std::exp(score) / denominator);
+  }
+  return softmax;
+}
+
+TEST(SoftmaxTest, ComputeSoftmax) {
+  // Long enough for the vectorized kernels and their scalar tails.
+  const std::vector<float> scores = {0.1, 2.0,  -1.5, 0.7, 3.2, -0.4,
+                                     1.1, -2.2, 0.0,  2.9, 0.5};
+  const std::vector<float> expected = ExactSoftmax(scores);
+  const std::vector<float> softmax = ComputeSoftmax(scores);
+  ASSERT_EQ(softmax.size(), expected.size());
+  for (int i = 0; i < expected.size(); ++i) {
+    EXPECT_NEAR(softmax[i], expected[i], 1e-2) << i;
+  }
+
+  // In place.
+  std::vector<float> values = scores;
+  ComputeSoftmax(values.data(), values.size(), values.data());
+  EXPECT_THAT(values, testing::ElementsAreArray(softmax));
+}
+
+TEST(SoftmaxTest, ComputeSoftmaxOfNegativeScores) {
+  // With the max initialized to the smallest positive float, these would all
+  // be far below it.
+  const std::vector<float> softmax = ComputeSoftmax({-100.0, -101.0, -130.0});
+  EXPECT_NEAR(softmax[0], 0.731, 1e-2);
+  EXPECT_NEAR(softmax[1], 0.269, 1e-2);
+  EXPECT_EQ(softmax[2], 0.0);
+}
+
+TEST(SoftmaxTest, ComputeSoftmaxTopK) {
+  const std::vector<float> scores = {0.1, 2.0, -1.5, 2.0, 3.2, -40.0};
+  const std::vector<float> softmax = ComputeSoftmax(scores);
+
+  int labels[3];
+  float probabilities[3];
+  EXPECT_EQ(ComputeSoftmaxTopK(scores.data(), scores.size(), 3, labels,
+                               probabilities),
+            3);
+  EXPECT_THAT(labels, testing::ElementsAre(4, 1, 3));
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_NEAR(probabilities[i], softmax[labels[i]], 1e-6) << i;
+  }
+
+  // All the labels, sorted.
+  int all_labels[6];
+  float all_probabilities[6];
+  EXPECT_EQ(ComputeSoftmaxTopK(scores.data(), scores.size(), 10, all_labels,
+                               all_probabilities),
+            6);
+  EXPECT_THAT(all_labels, testing::ElementsAre(4, 1, 3, 0, 2, 5));
+  EXPECT_EQ(all_probabilities[5], 0.0);
+
+  EXPECT_EQ(ComputeSoftmaxTopK(scores.data(), scores.size(), 0, labels,
+                               probabilities),
+            0);
+}
+
+}  // namespace
+}  // namespace libtextclassifier2
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/memory/arena.h"
+
+#include <stdint.h>
+
+namespace libtextclassifier2 {
+namespace {
+
+// The arena of the request that runs on this thread, see ScopedRequestArena.
+thread_local Arena* request_arena = nullptr;
+
+char* AlignUp(char* p, size_t alignment) {
+  return reinterpret_cast<char*>(
+      (reinterpret_cast<uintptr_t>(p) + alignment - 1) & ~(alignment - 1));
+}
+
+}  // namespace
+
+void* Arena::Allocate(size_t size, size_t alignment) {
+  if (next_ != nullptr) {
+    char* const aligned = AlignUp(next_, alignment);
+    if (aligned + size <= end_) {
+      next_ = aligned + size;
+      bytes_allocated_ += size;
+      return aligned;
+    }
+  }
+  return AllocateInNewBlock(size, alignment);
+}
+
+void* Arena::AllocateInNewBlock(size_t size, size_t alignment) {
+  const size_t padded_size = size + alignment - 1;
+  if (padded_size > block_size_ / 4) {
+    // Large allocations get a block of their own, so that they don't waste
+    // the rest of the current block.
+    blocks_.emplace_back(new char[padded_size]);
+    bytes_allocated_ += size;
+    return AlignUp(blocks_.back().get(), alignment);
+  }
+
+  if (first_block_ == nullptr) {
+    first_block_.reset(new char[block_size_]);
+    next_ = first_block_.get();
+  } else {
+    blocks_.emplace_back(new char[block_size_]);
+    next_ = blocks_.back().get();
+  }
+  end_ = next_ + block_size_;
+  return Allocate(size, alignment);
+}
+
+void Arena::Reset() {
+  blocks_.clear();
+  next_ = first_block_.get();
+  end_ = (next_ != nullptr ? next_ + block_size_ : nullptr);
+  bytes_allocated_ = 0;
+}
+
+Arena* CurrentRequestArena() { return request_arena; }
+
+ScopedRequestArena::ScopedRequestArena() : enclosing_arena_(request_arena) {
+  if (enclosing_arena_ == nullptr) {
+    request_arena = &arena_;
+  }
+}
+
+ScopedRequestArena::~ScopedRequestArena() {
+  if (enclosing_arena_ == nullptr) {
+    request_arena = nullptr;
+  }
+}
+
+}  // namespace libtextclassifier2
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Bump allocation of the short-lived objects of a request, which are all
+// freed at once when the request ends.
+
+#ifndef LIBTEXTCLASSIFIER_UTIL_MEMORY_ARENA_H_
+#define LIBTEXTCLASSIFIER_UTIL_MEMORY_ARENA_H_
+
+#include <stddef.h>
+
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "util/base/integral_types.h"
+#include "util/base/macros.h"
+
+namespace libtextclassifier2 {
+
+// Allocates from large blocks, and frees all allocations at once. Not
+// thread-safe.
+class Arena {
+ public:
+  static const int kDefaultBlockSize = 16 * 1024;
+
+  explicit Arena(int block_size = kDefaultBlockSize)
+      : block_size_(block_size) {}
+
+  // Returns 'size' bytes aligned to 'alignment', a power of two, which stay
+  // valid until Reset() or the destruction of the arena.
+  void* Allocate(size_t size, size_t alignment);
+
+  // Frees all allocations. Keeps the first block for the next ones, so that a
+  // reused arena doesn't allocate for small requests at all.
+  void Reset();
+
+  // Returns the number of bytes handed out since the last Reset().
+  int64 BytesAllocated() const { return bytes_allocated_; }
+
+ private:
+  void* AllocateInNewBlock(size_t size, size_t alignment);
+
+  const int block_size_;
+
+  // The block that survives Reset(), and the others.
+  std::unique_ptr<char[]> first_block_;
+  std::vector<std::unique_ptr<char[]>> blocks_;
+
+  // The free end of the current block.
+  char* next_ = nullptr;
+  char* end_ = nullptr;
+  int64 bytes_allocated_ = 0;
+
+  TC_DISALLOW_COPY_AND_ASSIGN(Arena);
+};
+
+// STL allocator that allocates from an arena, or from the heap if the arena
+// is nullptr. Deallocation is a no-op for the arena.
+template <typename T>
+class ArenaAllocator {
+ public:
+  typedef T value_type;
+
+  explicit ArenaAllocator(Arena* arena) : arena_(arena) {}
+
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U>& other)  // NOLINT(runtime/explicit)
+      : arena_(other.arena()) {}
+
+  T* allocate(size_t n) {
+    if (arena_ == nullptr) {
+      return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+    return static_cast<T*>(arena_->Allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T* p, size_t n) {
+    if (arena_ == nullptr) {
+      ::operator delete(p);
+    }
+  }
+
+  Arena* arena() const { return arena_; }
+
+ private:
+  Arena* arena_;
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+  return a.arena() == b.arena();
+}
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+  return a.arena() != b.arena();
+}
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+// Returns the arena of the request running on the calling thread, or nullptr
+// if there is none, in which case the ArenaAllocators use the heap.
+Arena* CurrentRequestArena();
+
+// Makes its arena the one of the calling thread's request between its
+// construction and destruction, unless the thread already has one, e.g. for a
+// request made by another. The objects allocated from it must not outlive the
+// scope.
+class ScopedRequestArena {
+ public:
+  ScopedRequestArena();
+  ~ScopedRequestArena();
+
+ private:
+  Arena arena_;
+  Arena* enclosing_arena_;
+
+  TC_DISALLOW_COPY_AND_ASSIGN(ScopedRequestArena);
+};
+
+}  // namespace libtextclassifier2
+
+#endif  // LIBTEXTCLASSIFIER_UTIL_MEMORY_ARENA_H_
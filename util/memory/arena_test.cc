@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/memory/arena.h"
+
+#include <stdint.h>
+
+#include <set>
+
+#include "gtest/gtest.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+TEST(ArenaTest, AllocatesAligned) {
+  Arena arena(/*block_size=*/256);
+  char* a = static_cast<char*>(arena.Allocate(3, 1));
+  double* b = static_cast<double*>(arena.Allocate(sizeof(double), 8));
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(b) % 8, 0);
+  EXPECT_NE(a, reinterpret_cast<char*>(b));
+  EXPECT_EQ(arena.BytesAllocated(), 3 + sizeof(double));
+
+  // Larger than a block.
+  char* large = static_cast<char*>(arena.Allocate(1000, 16));
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(large) % 16, 0);
+  large[999] = 'x';
+
+  // Still allocates from the first block.
+  char* c = static_cast<char*>(arena.Allocate(1, 1));
+  EXPECT_LT(c - a, 256);
+}
+
+TEST(ArenaTest, ResetReusesFirstBlock) {
+  Arena arena(/*block_size=*/256);
+  void* first = arena.Allocate(16, 8);
+  for (int i = 0; i < 100; ++i) {
+    arena.Allocate(16, 8);
+  }
+  arena.Reset();
+  EXPECT_EQ(arena.BytesAllocated(), 0);
+  EXPECT_EQ(arena.Allocate(16, 8), first);
+}
+
+TEST(ArenaTest, AllocatorForContainers) {
+  Arena arena;
+  ArenaVector<int> values{ArenaAllocator<int>(&arena)};
+  for (int i = 0; i < 1000; ++i) {
+    values.push_back(i);
+  }
+  EXPECT_EQ(values[999], 999);
+
+  std::set<int, std::less<int>, ArenaAllocator<int>> ordered{
+      std::less<int>(), ArenaAllocator<int>(&arena)};
+  ordered.insert(3);
+  ordered.insert(1);
+  EXPECT_EQ(*ordered.begin(), 1);
+  EXPECT_GT(arena.BytesAllocated(), 1000 * sizeof(int));
+
+  // Without an arena, the heap.
+  ArenaVector<int> heap_values{ArenaAllocator<int>(nullptr)};
+  heap_values.assign(10, 1);
+  EXPECT_EQ(heap_values.size(), 10);
+}
+
+TEST(ArenaTest, ScopedRequestArena) {
+  EXPECT_EQ(CurrentRequestArena(), nullptr);
+  {
+    ScopedRequestArena request_arena;
+    Arena* arena = CurrentRequestArena();
+    ASSERT_NE(arena, nullptr);
+    {
+      // A nested request shares the arena.
+      ScopedRequestArena nested_request_arena;
+      EXPECT_EQ(CurrentRequestArena(), arena);
+    }
+    EXPECT_EQ(CurrentRequestArena(), arena);
+  }
+  EXPECT_EQ(CurrentRequestArena(), nullptr);
+}
+
+}  // namespace
+}  // namespace libtextclassifier2
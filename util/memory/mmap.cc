@@ -24,6 +24,8 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <vector>
+
 #include "util/base/logging.h"
 #include "util/base/macros.h"
 
@@ -51,6 +53,21 @@ class FileCloser {
   TC_DISALLOW_COPY_AND_ASSIGN(FileCloser);
 };
 
+int64 PageSize() {
+  static const int64 kPageSize = sysconf(_SC_PAGE_SIZE);
+  return kPageSize;
+}
+
+// Rounds [start, start + num_bytes) out to whole pages, as required by
+// madvise and friends.
+void GetPageRange(const void *start, size_t num_bytes, void **page_start,
+                  size_t *page_num_bytes) {
+  const uintptr_t begin = reinterpret_cast<uintptr_t>(start);
+  const uintptr_t page_begin = begin - begin % PageSize();
+  *page_start = reinterpret_cast<void *>(page_begin);
+  *page_num_bytes = num_bytes + (begin - page_begin);
+}
+
 }  // namespace
 
 MmapHandle MmapFile(const std::string &filename) {
@@ -83,7 +100,7 @@ MmapHandle MmapFile(int fd) {
 }
 
 MmapHandle MmapFile(int fd, int64 segment_offset, int64 segment_size) {
-  static const int64 kPageSize = sysconf(_SC_PAGE_SIZE);
+  const int64 kPageSize = PageSize();
   const int64 aligned_offset = (segment_offset / kPageSize) * kPageSize;
   const int64 alignment_shift = segment_offset - aligned_offset;
   const int64 aligned_length = segment_size + alignment_shift;
@@ -132,4 +149,81 @@ bool Unmap(MmapHandle mmap_handle) {
   return true;
 }
 
+bool AdviseMmapRange(const void *start, size_t num_bytes, MmapAdvice advice) {
+  int system_advice;
+  switch (advice) {
+    case MmapAdvice::NORMAL:
+      system_advice = MADV_NORMAL;
+      break;
+    case MmapAdvice::RANDOM:
+      system_advice = MADV_RANDOM;
+      break;
+    case MmapAdvice::SEQUENTIAL:
+      system_advice = MADV_SEQUENTIAL;
+      break;
+    case MmapAdvice::WILLNEED:
+      system_advice = MADV_WILLNEED;
+      break;
+    default:
+      TC_LOG(ERROR) << "Unknown advice.";
+      return false;
+  }
+  void *page_start;
+  size_t page_num_bytes;
+  GetPageRange(start, num_bytes, &page_start, &page_num_bytes);
+  if (madvise(page_start, page_num_bytes, system_advice) != 0) {
+    const std::string last_error = GetLastSystemError();
+    TC_LOG(ERROR) << "Error during madvise: " << last_error;
+    return false;
+  }
+  return true;
+}
+
+void PrefaultMmapRange(const void *start, size_t num_bytes) {
+  if (num_bytes == 0) {
+    return;
+  }
+  const volatile char *bytes = static_cast<const volatile char *>(start);
+  const size_t page_size = PageSize();
+  // The first byte of each page, and the last byte for the last page.
+  const size_t first_offset =
+      (page_size - reinterpret_cast<uintptr_t>(start) % page_size) % page_size;
+  bytes[0];
+  for (size_t offset = first_offset; offset < num_bytes; offset += page_size) {
+    bytes[offset];
+  }
+  bytes[num_bytes - 1];
+}
+
+bool LockMmapRange(const void *start, size_t num_bytes) {
+  void *page_start;
+  size_t page_num_bytes;
+  GetPageRange(start, num_bytes, &page_start, &page_num_bytes);
+  if (mlock(page_start, page_num_bytes) != 0) {
+    const std::string last_error = GetLastSystemError();
+    TC_LOG(ERROR) << "Error during mlock: " << last_error;
+    return false;
+  }
+  return true;
+}
+
+int64 GetResidentMmapBytes(const void *start, size_t num_bytes) {
+  void *page_start;
+  size_t page_num_bytes;
+  GetPageRange(start, num_bytes, &page_start, &page_num_bytes);
+  const size_t page_size = PageSize();
+  std::vector<unsigned char> residency((page_num_bytes + page_size - 1) /
+                                       page_size);
+  if (mincore(page_start, page_num_bytes, residency.data()) != 0) {
+    const std::string last_error = GetLastSystemError();
+    TC_LOG(ERROR) << "Error during mincore: " << last_error;
+    return -1;
+  }
+  int64 num_resident_pages = 0;
+  for (const unsigned char page_residency : residency) {
+    num_resident_pages += (page_residency & 1);
+  }
+  return num_resident_pages * page_size;
+}
+
 }  // namespace libtextclassifier2
@@ -112,6 +112,38 @@ MmapHandle MmapFile(int fd, int64 segment_offset, int64 segment_size);
 // otherwise.
 bool Unmap(MmapHandle mmap_handle);
 
+// How the pages of a mapped range are going to be used, see madvise(2).
+enum class MmapAdvice {
+  // No special treatment, the default.
+  NORMAL,
+  // Random accesses, so read-ahead is useless.
+  RANDOM,
+  // Sequential accesses, so read-ahead is aggressive.
+  SEQUENTIAL,
+  // The range is needed soon, so it is read ahead now.
+  WILLNEED,
+};
+
+// Gives the advice for the pages overlapping [start, start + num_bytes) of a
+// mapping. Returns true on success, false otherwise.
+bool AdviseMmapRange(const void *start, size_t num_bytes, MmapAdvice advice);
+
+// Makes the pages overlapping [start, start + num_bytes) of a mapping
+// resident by reading from each of them, so that later accesses don't take
+// major page faults. The pages can still be evicted under memory pressure.
+void PrefaultMmapRange(const void *start, size_t num_bytes);
+
+// Locks the pages overlapping [start, start + num_bytes) of a mapping in
+// memory (see mlock(2)), until they are unmapped. Subject to the
+// RLIMIT_MEMLOCK limit of the process. Returns true on success, false
+// otherwise.
+bool LockMmapRange(const void *start, size_t num_bytes);
+
+// Returns the number of bytes of the pages overlapping
+// [start, start + num_bytes) that are resident in memory (see mincore(2)), or
+// -1 on error.
+int64 GetResidentMmapBytes(const void *start, size_t num_bytes);
+
 // Scoped mmapping of a file.  Mmaps a file on construction, unmaps it on
 // destruction.
 class ScopedMmap {
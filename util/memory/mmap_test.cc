@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/memory/mmap.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+std::string GetModelPath() {
+  return std::string(LIBTEXTCLASSIFIER_TEST_DATA_DIR) + "test_model.fb";
+}
+
+TEST(MmapTest, MapsSegment) {
+  const int fd = open(GetModelPath().c_str(), O_RDONLY);
+  ASSERT_GE(fd, 0);
+  ScopedMmap whole(fd);
+  // An offset that is not a multiple of the page size.
+  ScopedMmap segment(fd, 5000, 100);
+  close(fd);
+  ASSERT_TRUE(whole.handle().ok());
+  ASSERT_TRUE(segment.handle().ok());
+  ASSERT_GT(whole.handle().num_bytes(), 5100);
+  EXPECT_EQ(segment.handle().to_stringpiece().ToString(),
+            whole.handle().to_stringpiece().ToString().substr(5000, 100));
+}
+
+TEST(MmapTest, ResidencyHints) {
+  ScopedMmap mmap(GetModelPath());
+  ASSERT_TRUE(mmap.handle().ok());
+  const char* start = static_cast<const char*>(mmap.handle().start());
+  const size_t num_bytes = mmap.handle().num_bytes();
+
+  // Unaligned ranges are rounded out to whole pages.
+  EXPECT_TRUE(AdviseMmapRange(start + 1, num_bytes - 2, MmapAdvice::WILLNEED));
+  EXPECT_TRUE(AdviseMmapRange(start, num_bytes, MmapAdvice::RANDOM));
+  EXPECT_TRUE(AdviseMmapRange(start + 3, 10, MmapAdvice::SEQUENTIAL));
+  EXPECT_TRUE(AdviseMmapRange(start, num_bytes, MmapAdvice::NORMAL));
+  PrefaultMmapRange(start + 1, num_bytes - 1);
+  PrefaultMmapRange(start, 0);
+
+  // A single page is within any sensible RLIMIT_MEMLOCK.
+  EXPECT_TRUE(LockMmapRange(start + 1, 1));
+
+  // All prefaulted, and counted in whole pages.
+  const int64 resident_bytes = GetResidentMmapBytes(start, num_bytes);
+  EXPECT_GE(resident_bytes, num_bytes);
+  EXPECT_LT(resident_bytes, num_bytes + 2 * sysconf(_SC_PAGE_SIZE));
+  EXPECT_EQ(GetResidentMmapBytes(start + 1, 1), sysconf(_SC_PAGE_SIZE));
+}
+
+}  // namespace
+}  // namespace libtextclassifier2
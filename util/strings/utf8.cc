@@ -16,9 +16,110 @@
 
 #include "util/strings/utf8.h"
 
+#include <string.h>
+
+#include "util/base/integral_types.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define LIBTEXTCLASSIFIER_UTF8_NEON
+#endif
+
 namespace libtextclassifier2 {
+namespace {
+
+// Returns the length of the run of ASCII bytes other than '\0' at the
+// beginning of src, rounded down to whole blocks; the rest is left to the
+// codepoint-by-codepoint loops of the callers.
+#if defined(__AVX2__)
+int AsciiRunLength(const char *src, int size) {
+  const __m256i zero = _mm256_setzero_si256();
+  int i = 0;
+  for (; i + 32 <= size; i += 32) {
+    const __m256i bytes =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+    // The high bit is set for non-ASCII bytes and for the zero bytes.
+    if (_mm256_movemask_epi8(
+            _mm256_or_si256(bytes, _mm256_cmpeq_epi8(bytes, zero))) != 0) {
+      break;
+    }
+  }
+  return i;
+}
+#elif defined(__SSE2__)
+int AsciiRunLength(const char *src, int size) {
+  const __m128i zero = _mm_setzero_si128();
+  int i = 0;
+  for (; i + 16 <= size; i += 16) {
+    const __m128i bytes =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    if (_mm_movemask_epi8(_mm_or_si128(bytes, _mm_cmpeq_epi8(bytes, zero))) !=
+        0) {
+      break;
+    }
+  }
+  return i;
+}
+#elif defined(LIBTEXTCLASSIFIER_UTF8_NEON)
+int AsciiRunLength(const char *src, int size) {
+  const uint8x16_t high_bit = vdupq_n_u8(0x80);
+  const uint8x16_t zero = vdupq_n_u8(0);
+  int i = 0;
+  for (; i + 16 <= size; i += 16) {
+    const uint8x16_t bytes =
+        vld1q_u8(reinterpret_cast<const uint8_t *>(src + i));
+    const uint8x16_t invalid =
+        vorrq_u8(vtstq_u8(bytes, high_bit), vceqq_u8(bytes, zero));
+    const uint8x8_t folded =
+        vorr_u8(vget_low_u8(invalid), vget_high_u8(invalid));
+    if (vget_lane_u64(vreinterpret_u64_u8(folded), 0) != 0) {
+      break;
+    }
+  }
+  return i;
+}
+#else
+int AsciiRunLength(const char *src, int size) {
+  const uint64 kOnes = 0x0101010101010101ULL;
+  const uint64 kHighBits = 0x8080808080808080ULL;
+  int i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64 word;
+    memcpy(&word, src + i, sizeof(word));
+    // Sets the high bit of non-ASCII bytes, and of the zero bytes.
+    if (((word | ((word - kOnes) & ~word)) & kHighBits) != 0) {
+      break;
+    }
+  }
+  return i;
+}
+#endif
+
+}  // namespace
+
 bool IsValidUTF8(const char *src, int size) {
+  return ValidateAndCountUTF8(src, size, /*num_codepoints=*/nullptr,
+                              /*num_supplementary_codepoints=*/nullptr);
+}
+
+bool ValidateAndCountUTF8(const char *src, int size, int *num_codepoints,
+                          int *num_supplementary_codepoints) {
+  int codepoints = 0;
+  int supplementary_codepoints = 0;
   for (int i = 0; i < size;) {
+    if (static_cast<unsigned char>(src[i]) < 0x80) {
+      const int ascii_run = AsciiRunLength(src + i, size - i);
+      if (ascii_run > 0) {
+        i += ascii_run;
+        codepoints += ascii_run;
+        continue;
+      }
+    }
+
     // Unexpected trail byte.
     if (IsTrailByte(src[i])) {
       return false;
@@ -36,7 +137,48 @@ bool IsValidUTF8(const char *src, int size) {
         return false;
       }
     }
+    ++codepoints;
+    if (num_codepoint_bytes == 4) {
+      ++supplementary_codepoints;
+    }
+  }
+  if (num_codepoints != nullptr) {
+    *num_codepoints = codepoints;
+  }
+  if (num_supplementary_codepoints != nullptr) {
+    *num_supplementary_codepoints = supplementary_codepoints;
   }
   return true;
 }
+
+void CountUTF8Codepoints(const char *src, int size, int *num_codepoints,
+                         int *num_supplementary_codepoints) {
+  int codepoints = 0;
+  int supplementary_codepoints = 0;
+  for (int i = 0; i < size;) {
+    if (static_cast<unsigned char>(src[i]) < 0x80) {
+      const int ascii_run = AsciiRunLength(src + i, size - i);
+      if (ascii_run > 0) {
+        i += ascii_run;
+        codepoints += ascii_run;
+        continue;
+      }
+    }
+    const char byte = src[i++];
+    if (IsTrailByte(byte)) {
+      continue;
+    }
+    ++codepoints;
+    if (static_cast<uint8>(byte) >= 0xF0) {
+      ++supplementary_codepoints;
+    }
+  }
+  if (num_codepoints != nullptr) {
+    *num_codepoints = codepoints;
+  }
+  if (num_supplementary_codepoints != nullptr) {
+    *num_supplementary_codepoints = supplementary_codepoints;
+  }
+}
+
 }  // namespace libtextclassifier2
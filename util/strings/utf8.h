@@ -47,6 +47,17 @@ static inline bool IsTrailByte(char x) {
 // Returns true iff src points to a well-formed UTF-8 string.
 bool IsValidUTF8(const char *src, int size);
 
+// Same as IsValidUTF8, and in the same pass counts the codepoints of the
+// string and how many of them are outside of the BMP, i.e. take a surrogate
+// pair in UTF16. The counts are only set for valid strings, and may be null.
+bool ValidateAndCountUTF8(const char *src, int size, int *num_codepoints,
+                          int *num_supplementary_codepoints);
+
+// Counts the codepoints of a string assumed to be valid UTF-8, and how many of
+// them are outside of the BMP. Either count may be null.
+void CountUTF8Codepoints(const char *src, int size, int *num_codepoints,
+                         int *num_supplementary_codepoints);
+
 }  // namespace libtextclassifier2
 
 #endif  // LIBTEXTCLASSIFIER_UTIL_STRINGS_UTF8_H_
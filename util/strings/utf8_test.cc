@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/strings/utf8.h"
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+bool IsValid(const std::string& text) {
+  return IsValidUTF8(text.data(), text.size());
+}
+
+TEST(UTF8Test, ValidatesShortAndLongTexts) {
+  EXPECT_TRUE(IsValid(""));
+  EXPECT_TRUE(IsValid("hello"));
+  EXPECT_TRUE(IsValid("hellö wörld 😁"));
+
+  // Long ASCII runs go through the block loops, with the invalid byte at
+  // every position of a block.
+  const std::string ascii(100, 'a');
+  EXPECT_TRUE(IsValid(ascii));
+  for (int i = 0; i < ascii.size(); ++i) {
+    std::string trail_byte = ascii;
+    trail_byte[i] = '\x80';
+    EXPECT_FALSE(IsValid(trail_byte)) << i;
+
+    std::string zero_byte = ascii;
+    zero_byte[i] = '\0';
+    EXPECT_FALSE(IsValid(zero_byte)) << i;
+
+    std::string two_bytes = ascii;
+    two_bytes.replace(i, 1, "ö");
+    EXPECT_TRUE(IsValid(two_bytes)) << i;
+  }
+
+  // Truncated sequences.
+  EXPECT_FALSE(IsValid(ascii + "\xC3"));
+  EXPECT_FALSE(IsValid(ascii + "\xF0\x9F\x98"));
+  EXPECT_FALSE(IsValid("\xC3" + ascii));
+}
+
+TEST(UTF8Test, ValidatesAndCounts) {
+  std::string text;
+  for (int i = 0; i < 20; ++i) {
+    text += "ab😁cdefghijklmnopqrstuvwxyzé";
+  }
+  int num_codepoints = -1;
+  int num_supplementary_codepoints = -1;
+  EXPECT_TRUE(ValidateAndCountUTF8(text.data(), text.size(), &num_codepoints,
+                                   &num_supplementary_codepoints));
+  EXPECT_EQ(num_codepoints, 20 * 28);
+  EXPECT_EQ(num_supplementary_codepoints, 20);
+
+  num_codepoints = -1;
+  num_supplementary_codepoints = -1;
+  CountUTF8Codepoints(text.data(), text.size(), &num_codepoints,
+                      &num_supplementary_codepoints);
+  EXPECT_EQ(num_codepoints, 20 * 28);
+  EXPECT_EQ(num_supplementary_codepoints, 20);
+
+  // The counts are optional, and untouched for invalid texts.
+  EXPECT_TRUE(ValidateAndCountUTF8(text.data(), text.size(), nullptr, nullptr));
+  num_codepoints = -1;
+  EXPECT_FALSE(ValidateAndCountUTF8("a\x80", 2, &num_codepoints, nullptr));
+  EXPECT_EQ(num_codepoints, -1);
+}
+
+}  // namespace
+}  // namespace libtextclassifier2
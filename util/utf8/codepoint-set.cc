@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/utf8/codepoint-set.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+
+#include "util/utf8/unicodetext.h"
+
+namespace libtextclassifier2 {
+
+constexpr char32 CodepointSet::kMaxCodepoint;
+constexpr int CodepointSet::kWordsPerBlock;
+
+CodepointSet::CodepointSet(
+    const std::vector<std::pair<char32, char32>>& ranges) {
+  constexpr int kNumBlocks = (kMaxCodepoint + 1) >> 8;
+  std::vector<uint64> full_bits(kNumBlocks * kWordsPerBlock, 0);
+  for (const std::pair<char32, char32>& range : ranges) {
+    const char32 first = std::max(range.first, 0);
+    const char32 end = std::min(range.second, kMaxCodepoint + 1);
+    for (char32 codepoint = first; codepoint < end; ++codepoint) {
+      full_bits[codepoint >> 6] |= uint64{1} << (codepoint & 63);
+    }
+  }
+
+  // Stores every distinct block once.
+  std::map<std::vector<uint64>, uint16> distinct_blocks;
+  block_index_.resize(kNumBlocks);
+  for (int i = 0; i < kNumBlocks; ++i) {
+    std::vector<uint64> block(full_bits.begin() + i * kWordsPerBlock,
+                              full_bits.begin() + (i + 1) * kWordsPerBlock);
+    auto it = distinct_blocks.find(block);
+    if (it == distinct_blocks.end()) {
+      it = distinct_blocks
+               .emplace(block,
+                        static_cast<uint16>(bits_.size() / kWordsPerBlock))
+               .first;
+      bits_.insert(bits_.end(), block.begin(), block.end());
+    }
+    block_index_[i] = it->second;
+  }
+  ascii_bits_[0] = full_bits[0];
+  ascii_bits_[1] = full_bits[1];
+}
+
+CodepointSet CodepointSet::FromCodepoints(
+    const std::vector<char32>& codepoints) {
+  std::vector<std::pair<char32, char32>> ranges;
+  ranges.reserve(codepoints.size());
+  for (const char32 codepoint : codepoints) {
+    ranges.push_back({codepoint, codepoint + 1});
+  }
+  return CodepointSet(ranges);
+}
+
+int CodepointSet::CountInUTF8(const std::string& text,
+                              int* num_codepoints) const {
+  const char* data = text.data();
+  const int size = text.size();
+  int num_in_set = 0;
+  int num_total = 0;
+  int i = 0;
+  while (i < size) {
+    // Eight ASCII bytes at a time.
+    if (i + 8 <= size) {
+      uint64 word;
+      memcpy(&word, data + i, sizeof(word));
+      if ((word & 0x8080808080808080ULL) == 0) {
+        for (int j = 0; j < 8; ++j) {
+          const uint8 byte = static_cast<uint8>(data[i + j]);
+          num_in_set += (ascii_bits_[byte >> 6] >> (byte & 63)) & 1;
+        }
+        num_total += 8;
+        i += 8;
+        continue;
+      }
+    }
+    const uint8 byte = static_cast<uint8>(data[i]);
+    if (byte < 0x80) {
+      num_in_set += (ascii_bits_[byte >> 6] >> (byte & 63)) & 1;
+      ++num_total;
+      ++i;
+      continue;
+    }
+
+    // Decodes the run up to the next ASCII byte.
+    int run_end = i + 1;
+    while (run_end < size && static_cast<uint8>(data[run_end]) >= 0x80) {
+      ++run_end;
+    }
+    const UnicodeText run =
+        UTF8ToUnicodeText(data + i, run_end - i, /*do_copy=*/false);
+    for (const char32 codepoint : run) {
+      num_in_set += Contains(codepoint);
+      ++num_total;
+    }
+    i = run_end;
+  }
+  if (num_codepoints != nullptr) {
+    *num_codepoints = num_total;
+  }
+  return num_in_set;
+}
+
+int64 CodepointSet::MemoryBytes() const {
+  return block_index_.capacity() * sizeof(uint16) +
+         bits_.capacity() * sizeof(uint64);
+}
+
+}  // namespace libtextclassifier2
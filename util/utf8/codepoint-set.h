@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBTEXTCLASSIFIER_UTIL_UTF8_CODEPOINT_SET_H_
+#define LIBTEXTCLASSIFIER_UTIL_UTF8_CODEPOINT_SET_H_
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "util/base/integral_types.h"
+
+namespace libtextclassifier2 {
+
+// A set of Unicode codepoints as a two-level bitmap: every block of 256
+// codepoints points to a 256-bit block of the bitmap, and the blocks with the
+// same bits, e.g. the empty and the full ones, are stored once. Looking up a
+// codepoint takes two loads, instead of a search over the ranges.
+class CodepointSet {
+ public:
+  static constexpr char32 kMaxCodepoint = 0x10FFFF;
+
+  // The empty set.
+  CodepointSet() : CodepointSet(std::vector<std::pair<char32, char32>>()) {}
+
+  // The union of the codepoint ranges [first, second). The parts of the
+  // ranges outside of [0, kMaxCodepoint] are ignored.
+  explicit CodepointSet(const std::vector<std::pair<char32, char32>>& ranges);
+
+  // The set of the given codepoints.
+  static CodepointSet FromCodepoints(const std::vector<char32>& codepoints);
+
+  bool Contains(char32 codepoint) const {
+    if (codepoint < 0 || codepoint > kMaxCodepoint) {
+      return false;
+    }
+    const uint64* block = &bits_[block_index_[codepoint >> 8] * kWordsPerBlock];
+    return (block[(codepoint >> 6) & (kWordsPerBlock - 1)] >>
+            (codepoint & 63)) &
+           1;
+  }
+
+  // Returns the number of codepoints of the UTF8 text in the set, and sets
+  // num_codepoints, if not null, to the number of codepoints of the text.
+  // Runs of ASCII are counted eight bytes at a time, without decoding.
+  int CountInUTF8(const std::string& text, int* num_codepoints) const;
+
+  // Returns the number of bytes allocated by the set.
+  int64 MemoryBytes() const;
+
+ private:
+  static constexpr int kWordsPerBlock = 4;
+
+  // Bitmap word of the codepoints [64 * i, 64 * i + 64) of the ASCII ones.
+  uint64 ascii_bits_[2];
+
+  // For every 256 codepoints, the index of their block in bits_.
+  std::vector<uint16> block_index_;
+
+  // The distinct blocks of the bitmap, kWordsPerBlock words each.
+  std::vector<uint64> bits_;
+};
+
+}  // namespace libtextclassifier2
+
+#endif  // LIBTEXTCLASSIFIER_UTIL_UTF8_CODEPOINT_SET_H_
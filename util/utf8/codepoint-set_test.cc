@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/utf8/codepoint-set.h"
+
+#include "gtest/gtest.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+TEST(CodepointSetTest, Contains) {
+  const CodepointSet set({{'a', 'z' + 1}, {0x400, 0x500}, {0x1F600, 0x1F650}});
+  EXPECT_TRUE(set.Contains('a'));
+  EXPECT_TRUE(set.Contains('z'));
+  EXPECT_FALSE(set.Contains('A'));
+  EXPECT_FALSE(set.Contains('z' + 1));
+  EXPECT_TRUE(set.Contains(0x4FF));
+  EXPECT_FALSE(set.Contains(0x500));
+  EXPECT_TRUE(set.Contains(0x1F601));
+  EXPECT_FALSE(set.Contains(0x1F650));
+  EXPECT_FALSE(set.Contains(-1));
+  EXPECT_FALSE(set.Contains(CodepointSet::kMaxCodepoint + 1));
+
+  EXPECT_FALSE(CodepointSet().Contains('a'));
+  EXPECT_FALSE(CodepointSet().Contains(0));
+}
+
+TEST(CodepointSetTest, ClipsRangesToUnicode) {
+  const CodepointSet set({{-10, 2}, {0x10FFF0, 0x7FFFFFFF}});
+  EXPECT_TRUE(set.Contains(0));
+  EXPECT_TRUE(set.Contains(1));
+  EXPECT_FALSE(set.Contains(2));
+  EXPECT_TRUE(set.Contains(CodepointSet::kMaxCodepoint));
+}
+
+TEST(CodepointSetTest, FromCodepoints) {
+  const CodepointSet set = CodepointSet::FromCodepoints({',', '.', 0x3002});
+  EXPECT_TRUE(set.Contains(','));
+  EXPECT_TRUE(set.Contains(0x3002));
+  EXPECT_FALSE(set.Contains('-'));
+  EXPECT_FALSE(set.Contains(0x3001));
+}
+
+TEST(CodepointSetTest, CountInUTF8) {
+  const CodepointSet set({{'a', 'z' + 1}, {0x100, 0x200}});
+  int num_codepoints = -1;
+  EXPECT_EQ(set.CountInUTF8("", &num_codepoints), 0);
+  EXPECT_EQ(num_codepoints, 0);
+
+  // Both the runs of eight ASCII bytes and the single ones.
+  EXPECT_EQ(set.CountInUTF8("hello WORLD, hello!", &num_codepoints), 10);
+  EXPECT_EQ(num_codepoints, 19);
+
+  // ř is U+0159, ö is U+00F6 and 😁 is U+1F601.
+  EXPECT_EQ(set.CountInUTF8("heře höw😁ř", &num_codepoints), 7);
+  EXPECT_EQ(num_codepoints, 10);
+  EXPECT_EQ(set.CountInUTF8("ř", nullptr), 1);
+}
+
+}  // namespace
+}  // namespace libtextclassifier2
@@ -0,0 +1,1243 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/utf8/multi-regex.h"
+
+#include <utility>
+
+#include "util/base/logging.h"
+#include "util/gtl/stl_util.h"
+#include "util/utf8/unicode-properties.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+// Programs with more instructions than this, e.g. because of large counted
+// repetitions, are not compiled.
+const int kMaxInstructions = 5000;
+
+// Patterns nested deeper than this are not compiled.
+const int kMaxDepth = 50;
+
+// Number of capture slots kept per thread: the start and end of the whole
+// match and of the first capturing group.
+const int kNumSlots = 4;
+
+// Properties of a character that the escapes and '.' depend on, as bits.
+enum CharProperty : uint8 {
+  kDigitProperty = 1,           // \d
+  kSpaceProperty = 2,           // \s
+  kWordProperty = 4,            // \w
+  kLineTerminatorProperty = 8,  // Not matched by '.', delimits '^' and '$'.
+};
+
+// Computes the properties the way ICU regular expressions define them.
+uint8 GetCharProperties(char32 c) {
+  const uint8 unicode_properties = GetUnicodeProperties(c);
+  uint8 properties = 0;
+  if (unicode_properties & kUnicodeDecimalDigit) {
+    properties |= kDigitProperty;
+  }
+  if (unicode_properties & kUnicodeWhiteSpaceProperty) {
+    properties |= kSpaceProperty;
+  }
+  if (unicode_properties & kUnicodeRegexWord) {
+    properties |= kWordProperty;
+  }
+  if ((c >= 0x0A && c <= 0x0D) || c == 0x85 || c == 0x2028 || c == 0x2029) {
+    properties |= kLineTerminatorProperty;
+  }
+  return properties;
+}
+
+struct CharClass {
+  // Inclusive ranges of codepoints.
+  std::vector<std::pair<char32, char32>> ranges;
+
+  // Matches the characters with any of these properties.
+  uint8 properties = 0;
+
+  // Matches the characters without some of these properties.
+  uint8 negated_properties = 0;
+
+  // Whether the class matches the characters that the above don't.
+  bool negated = false;
+
+  bool Matches(char32 c, uint8 char_properties) const {
+    bool matches = (properties & char_properties) != 0 ||
+                   (negated_properties & ~char_properties) != 0;
+    for (int i = 0; !matches && i < ranges.size(); ++i) {
+      matches = c >= ranges[i].first && c <= ranges[i].second;
+    }
+    return matches != negated;
+  }
+};
+
+// Node of the syntax tree of a pattern.
+struct Node {
+  enum Type {
+    EMPTY,
+    LITERAL,
+    CLASS,
+    CONCAT,
+    ALTERNATE,
+    REPEAT,
+    CAPTURE,
+    LINE_START,
+    LINE_END,
+  };
+
+  explicit Node(Type type) : type(type) {}
+
+  Type type;
+
+  // LITERAL: the codepoint. CLASS: the index of the class in the program.
+  // CAPTURE: the group number.
+  int arg = 0;
+
+  // REPEAT: the bounds, with max -1 for unbounded, and whether it is greedy.
+  int min = 0;
+  int max = 0;
+  bool greedy = true;
+
+  std::vector<std::unique_ptr<Node>> children;
+};
+
+bool IsNullable(const Node& node) {
+  switch (node.type) {
+    case Node::LITERAL:
+    case Node::CLASS:
+      return false;
+    case Node::CONCAT:
+      for (const std::unique_ptr<Node>& child : node.children) {
+        if (!IsNullable(*child)) {
+          return false;
+        }
+      }
+      return true;
+    case Node::ALTERNATE:
+      for (const std::unique_ptr<Node>& child : node.children) {
+        if (IsNullable(*child)) {
+          return true;
+        }
+      }
+      return false;
+    case Node::REPEAT:
+      return node.min == 0 || IsNullable(*node.children[0]);
+    case Node::CAPTURE:
+      return IsNullable(*node.children[0]);
+    default:
+      return true;
+  }
+}
+
+inline bool IsAsciiLetter(char32 c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+inline bool IsAsciiDigit(char32 c) { return c >= '0' && c <= '9'; }
+
+inline int HexDigitValue(char32 c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+// Parses a pattern into a syntax tree. All the Parse* methods return nullptr
+// or false on syntax that the engine does not support, which includes all
+// invalid syntax.
+class PatternParser {
+ public:
+  PatternParser(const std::string& pattern, std::vector<CharClass>* classes)
+      : classes_(classes) {
+    for (const char32 c : UTF8ToUnicodeText(pattern, /*do_copy=*/false)) {
+      pattern_.push_back(c);
+    }
+  }
+
+  std::unique_ptr<Node> Parse() {
+    std::unique_ptr<Node> root = ParseAlternation(/*depth=*/0);
+    // A closing parenthesis without an opening one.
+    if (root == nullptr || !AtEnd()) {
+      return nullptr;
+    }
+    return root;
+  }
+
+  int num_groups() const { return num_groups_; }
+
+ private:
+  bool AtEnd() const { return pos_ >= pattern_.size(); }
+  char32 Peek() const { return pattern_[pos_]; }
+  bool PeekIs(char32 c) const { return !AtEnd() && Peek() == c; }
+  bool PeekNextIs(char32 c) const {
+    return pos_ + 1 < pattern_.size() && pattern_[pos_ + 1] == c;
+  }
+
+  std::unique_ptr<Node> ParseAlternation(int depth);
+  std::unique_ptr<Node> ParseSequence(int depth);
+  std::unique_ptr<Node> ParseAtom(int depth);
+  std::unique_ptr<Node> ParseGroup(int depth);
+
+  // Parses a quantifier, if there is one, into 'repeat'.
+  bool ParseQuantifier(bool* has_quantifier, Node* repeat);
+
+  // Parses a character class after its opening bracket.
+  bool ParseClass(CharClass* chars);
+
+  // Parses an escape sequence after the backslash. Sets 'literal' to the
+  // escaped character, or to -1 if the escape stands for characters with
+  // some property, which are then added to 'chars'.
+  bool ParseEscape(int* literal, CharClass* chars);
+
+  // Parses a fixed number of hexadecimal digits, or any number in braces.
+  bool ParseHexDigits(int num_digits, bool allow_braces, int* value);
+
+  std::unique_ptr<Node> MakeClassNode(CharClass chars) {
+    std::unique_ptr<Node> node(new Node(Node::CLASS));
+    node->arg = classes_->size();
+    classes_->push_back(std::move(chars));
+    return node;
+  }
+
+  std::vector<char32> pattern_;
+  int pos_ = 0;
+  int num_groups_ = 0;
+  std::vector<CharClass>* classes_;
+};
+
+std::unique_ptr<Node> PatternParser::ParseAlternation(int depth) {
+  if (depth > kMaxDepth) {
+    return nullptr;
+  }
+  std::unique_ptr<Node> sequence = ParseSequence(depth);
+  if (sequence == nullptr || !PeekIs('|')) {
+    return sequence;
+  }
+  std::unique_ptr<Node> alternation(new Node(Node::ALTERNATE));
+  alternation->children.push_back(std::move(sequence));
+  while (PeekIs('|')) {
+    ++pos_;
+    sequence = ParseSequence(depth);
+    if (sequence == nullptr) {
+      return nullptr;
+    }
+    alternation->children.push_back(std::move(sequence));
+  }
+  return alternation;
+}
+
+std::unique_ptr<Node> PatternParser::ParseSequence(int depth) {
+  std::unique_ptr<Node> sequence(new Node(Node::CONCAT));
+  while (!AtEnd() && Peek() != '|' && Peek() != ')') {
+    std::unique_ptr<Node> atom = ParseAtom(depth);
+    if (atom == nullptr) {
+      return nullptr;
+    }
+
+    std::unique_ptr<Node> repeat(new Node(Node::REPEAT));
+    bool has_quantifier;
+    if (!ParseQuantifier(&has_quantifier, repeat.get())) {
+      return nullptr;
+    }
+    if (has_quantifier) {
+      // Repeating something that can match the empty string is handled
+      // specially by ICU, e.g. "(a?)*". Only '?' behaves the same here.
+      if ((repeat->min != 0 || repeat->max != 1) && IsNullable(*atom)) {
+        return nullptr;
+      }
+      repeat->children.push_back(std::move(atom));
+      atom = std::move(repeat);
+
+      // Stacked quantifiers, e.g. "a{2}{3}".
+      bool has_another_quantifier;
+      Node another_repeat(Node::REPEAT);
+      if (!ParseQuantifier(&has_another_quantifier, &another_repeat) ||
+          has_another_quantifier) {
+        return nullptr;
+      }
+    }
+    sequence->children.push_back(std::move(atom));
+  }
+  return sequence;
+}
+
+std::unique_ptr<Node> PatternParser::ParseAtom(int depth) {
+  const char32 c = Peek();
+  switch (c) {
+    case '(':
+      ++pos_;
+      return ParseGroup(depth);
+    case '[': {
+      ++pos_;
+      CharClass chars;
+      if (!ParseClass(&chars)) {
+        return nullptr;
+      }
+      return MakeClassNode(std::move(chars));
+    }
+    case '.': {
+      ++pos_;
+      CharClass chars;
+      chars.properties = kLineTerminatorProperty;
+      chars.negated = true;
+      return MakeClassNode(std::move(chars));
+    }
+    case '^':
+      ++pos_;
+      return std::unique_ptr<Node>(new Node(Node::LINE_START));
+    case '$':
+      ++pos_;
+      return std::unique_ptr<Node>(new Node(Node::LINE_END));
+    case '\\': {
+      ++pos_;
+      int literal;
+      CharClass chars;
+      if (!ParseEscape(&literal, &chars)) {
+        return nullptr;
+      }
+      if (literal < 0) {
+        return MakeClassNode(std::move(chars));
+      }
+      std::unique_ptr<Node> node(new Node(Node::LITERAL));
+      node->arg = literal;
+      return node;
+    }
+    case '*':
+    case '+':
+    case '?':
+    case '{':
+    case '}':
+    case ']':
+      return nullptr;
+    default: {
+      ++pos_;
+      std::unique_ptr<Node> node(new Node(Node::LITERAL));
+      node->arg = c;
+      return node;
+    }
+  }
+}
+
+std::unique_ptr<Node> PatternParser::ParseGroup(int depth) {
+  int group = -1;
+  if (PeekIs('?')) {
+    ++pos_;
+    if (PeekIs(':')) {
+      ++pos_;
+    } else if (PeekIs('<') && pos_ + 1 < pattern_.size() &&
+               IsAsciiLetter(pattern_[pos_ + 1])) {
+      // Named capturing group.
+      ++pos_;
+      while (!AtEnd() && (IsAsciiLetter(Peek()) || IsAsciiDigit(Peek()))) {
+        ++pos_;
+      }
+      if (!PeekIs('>')) {
+        return nullptr;
+      }
+      ++pos_;
+      group = ++num_groups_;
+    } else {
+      // Lookaround, atomic groups and flags.
+      return nullptr;
+    }
+  } else {
+    group = ++num_groups_;
+  }
+
+  std::unique_ptr<Node> body = ParseAlternation(depth + 1);
+  if (body == nullptr || !PeekIs(')')) {
+    return nullptr;
+  }
+  ++pos_;
+  if (group < 0) {
+    return body;
+  }
+  std::unique_ptr<Node> capture(new Node(Node::CAPTURE));
+  capture->arg = group;
+  capture->children.push_back(std::move(body));
+  return capture;
+}
+
+bool PatternParser::ParseQuantifier(bool* has_quantifier, Node* repeat) {
+  *has_quantifier = false;
+  if (AtEnd()) {
+    return true;
+  }
+  switch (Peek()) {
+    case '*':
+      repeat->min = 0;
+      repeat->max = -1;
+      ++pos_;
+      break;
+    case '+':
+      repeat->min = 1;
+      repeat->max = -1;
+      ++pos_;
+      break;
+    case '?':
+      repeat->min = 0;
+      repeat->max = 1;
+      ++pos_;
+      break;
+    case '{': {
+      ++pos_;
+      int* bound = &repeat->min;
+      *bound = 0;
+      repeat->max = 0;
+      bool has_digits = false;
+      bool has_comma = false;
+      while (!AtEnd() && Peek() != '}') {
+        if (IsAsciiDigit(Peek())) {
+          *bound = *bound * 10 + (Peek() - '0');
+          if (*bound > kMaxInstructions) {
+            return false;
+          }
+          has_digits = true;
+        } else if (Peek() == ',' && !has_comma && has_digits) {
+          has_comma = true;
+          bound = &repeat->max;
+          has_digits = false;
+        } else {
+          return false;
+        }
+        ++pos_;
+      }
+      if (AtEnd()) {
+        return false;
+      }
+      ++pos_;
+      if (!has_comma) {
+        if (!has_digits) {
+          return false;
+        }
+        repeat->max = repeat->min;
+      } else if (!has_digits) {
+        repeat->max = -1;
+      } else if (repeat->max < repeat->min) {
+        return false;
+      }
+      break;
+    }
+    default:
+      return true;
+  }
+  *has_quantifier = true;
+
+  if (PeekIs('?')) {
+    repeat->greedy = false;
+    ++pos_;
+  } else if (PeekIs('+')) {
+    // Possessive quantifiers need backtracking control.
+    return false;
+  }
+  return true;
+}
+
+bool PatternParser::ParseClass(CharClass* chars) {
+  if (PeekIs('^')) {
+    chars->negated = true;
+    ++pos_;
+  }
+  // "[]...]" and POSIX-like "[:alpha:]" classes.
+  if (AtEnd() || Peek() == ']' || Peek() == ':') {
+    return false;
+  }
+
+  bool first = true;
+  while (true) {
+    if (AtEnd()) {
+      return false;
+    }
+    const char32 c = Peek();
+    if (c == ']') {
+      ++pos_;
+      return true;
+    }
+    // Nested classes and set operations.
+    if (c == '[' || (c == '&' && PeekNextIs('&')) ||
+        (c == '-' && PeekNextIs('-'))) {
+      return false;
+    }
+    // A '-' is literal at the start and the end of the class.
+    if (c == '-' && !first && !PeekNextIs(']')) {
+      return false;
+    }
+    first = false;
+
+    int literal = c;
+    ++pos_;
+    if (c == '\\' && !ParseEscape(&literal, chars)) {
+      return false;
+    }
+    if (literal < 0) {
+      continue;
+    }
+
+    if (!PeekIs('-')) {
+      chars->ranges.push_back({literal, literal});
+      continue;
+    }
+    ++pos_;
+    if (PeekIs(']')) {
+      chars->ranges.push_back({literal, literal});
+      chars->ranges.push_back({'-', '-'});
+      continue;
+    }
+    if (AtEnd() || Peek() == '[') {
+      return false;
+    }
+    int last = Peek();
+    ++pos_;
+    if (last == '\\') {
+      CharClass ignored;
+      if (!ParseEscape(&last, &ignored) || last < 0) {
+        return false;
+      }
+    }
+    if (last < literal) {
+      return false;
+    }
+    chars->ranges.push_back({literal, last});
+  }
+}
+
+bool PatternParser::ParseEscape(int* literal, CharClass* chars) {
+  if (AtEnd()) {
+    return false;
+  }
+  const char32 c = Peek();
+  ++pos_;
+  *literal = -1;
+  switch (c) {
+    case 'd':
+      chars->properties |= kDigitProperty;
+      return true;
+    case 'D':
+      chars->negated_properties |= kDigitProperty;
+      return true;
+    case 's':
+      chars->properties |= kSpaceProperty;
+      return true;
+    case 'S':
+      chars->negated_properties |= kSpaceProperty;
+      return true;
+    case 'w':
+      chars->properties |= kWordProperty;
+      return true;
+    case 'W':
+      chars->negated_properties |= kWordProperty;
+      return true;
+    case 't':
+      *literal = '\t';
+      return true;
+    case 'n':
+      *literal = '\n';
+      return true;
+    case 'r':
+      *literal = '\r';
+      return true;
+    case 'f':
+      *literal = '\f';
+      return true;
+    case 'a':
+      *literal = 0x07;
+      return true;
+    case 'e':
+      *literal = 0x1B;
+      return true;
+    case 'x':
+      return ParseHexDigits(/*num_digits=*/2, /*allow_braces=*/true, literal);
+    case 'u':
+      return ParseHexDigits(/*num_digits=*/4, /*allow_braces=*/false, literal);
+    case 'U':
+      return ParseHexDigits(/*num_digits=*/8, /*allow_braces=*/false, literal);
+    default:
+      // Escaped ASCII punctuation stands for itself. Other escapes are either
+      // unsupported, e.g. \b, \p, \Q or back-references, or invalid.
+      if (c < 0x80 && !IsAsciiLetter(c) && !IsAsciiDigit(c)) {
+        *literal = c;
+        return true;
+      }
+      return false;
+  }
+}
+
+bool PatternParser::ParseHexDigits(int num_digits, bool allow_braces,
+                                   int* value) {
+  const bool braces = allow_braces && PeekIs('{');
+  if (braces) {
+    ++pos_;
+    num_digits = 6;
+  }
+  int64 result = 0;
+  int i = 0;
+  for (; i < num_digits && !AtEnd() && HexDigitValue(Peek()) >= 0; ++i) {
+    result = result * 16 + HexDigitValue(Peek());
+    ++pos_;
+  }
+  if (braces) {
+    if (i == 0 || !PeekIs('}')) {
+      return false;
+    }
+    ++pos_;
+  } else if (i != num_digits) {
+    return false;
+  }
+  if (result > 0x10FFFF || (result >= 0xD800 && result <= 0xDFFF)) {
+    return false;
+  }
+  *value = result;
+  return true;
+}
+
+}  // namespace
+
+namespace internal {
+
+// A pattern compiled into instructions for a Pike VM: the threads of the
+// simulation are kept in priority order, so the matches and groups are the
+// ones a backtracking matcher finds.
+struct MultiRegexProgram {
+  struct Inst {
+    enum Op {
+      LITERAL,     // Consumes the codepoint 'arg'.
+      CLASS,       // Consumes a character of classes[arg].
+      SPLIT,       // Continues at 'out' and, with lower priority, 'out1'.
+      JUMP,        // Continues at 'out'.
+      SAVE,        // Saves the position in slot 'arg'.
+      LINE_START,  // Asserts '^'.
+      LINE_END,    // Asserts '$'.
+      MATCH,
+    };
+
+    Op op;
+    int out;
+    int out1;
+    int arg;
+  };
+
+  // Appends an instruction that continues with the next one.
+  int Add(Inst::Op op, int arg = 0) {
+    const int index = insts.size();
+    insts.push_back({op, index + 1, -1, arg});
+    return index;
+  }
+
+  bool Emit(const Node& node);
+
+  std::vector<Inst> insts;
+  std::vector<CharClass> classes;
+
+  // Whether all matches start with '^'. ICU then only tries to match at the
+  // line starts that are not between the characters of a "\r\n".
+  bool starts_with_line_start = false;
+};
+
+bool MultiRegexProgram::Emit(const Node& node) {
+  if (insts.size() > kMaxInstructions) {
+    return false;
+  }
+  switch (node.type) {
+    case Node::EMPTY:
+      return true;
+    case Node::LITERAL:
+      Add(Inst::LITERAL, node.arg);
+      return true;
+    case Node::CLASS:
+      Add(Inst::CLASS, node.arg);
+      return true;
+    case Node::LINE_START:
+      Add(Inst::LINE_START);
+      return true;
+    case Node::LINE_END:
+      Add(Inst::LINE_END);
+      return true;
+    case Node::CONCAT:
+      for (const std::unique_ptr<Node>& child : node.children) {
+        if (!Emit(*child)) {
+          return false;
+        }
+      }
+      return true;
+    case Node::ALTERNATE: {
+      std::vector<int> jumps;
+      for (int i = 0; i < node.children.size(); ++i) {
+        const bool last = (i + 1 == node.children.size());
+        const int split = last ? -1 : Add(Inst::SPLIT);
+        if (!Emit(*node.children[i])) {
+          return false;
+        }
+        if (!last) {
+          jumps.push_back(Add(Inst::JUMP));
+          insts[split].out1 = insts.size();
+        }
+      }
+      for (const int jump : jumps) {
+        insts[jump].out = insts.size();
+      }
+      return true;
+    }
+    case Node::CAPTURE: {
+      // Only the first group is reported.
+      const bool saved = (node.arg == 1);
+      if (saved) {
+        Add(Inst::SAVE, 2);
+      }
+      if (!Emit(*node.children[0])) {
+        return false;
+      }
+      if (saved) {
+        Add(Inst::SAVE, 3);
+      }
+      return true;
+    }
+    case Node::REPEAT: {
+      const Node& body = *node.children[0];
+      for (int i = 0; i < node.min; ++i) {
+        if (!Emit(body)) {
+          return false;
+        }
+      }
+      std::vector<int> splits;
+      if (node.max < 0) {
+        const int split = Add(Inst::SPLIT);
+        splits.push_back(split);
+        if (!Emit(body)) {
+          return false;
+        }
+        insts[Add(Inst::JUMP)].out = split;
+      } else {
+        for (int i = node.min; i < node.max; ++i) {
+          splits.push_back(Add(Inst::SPLIT));
+          if (!Emit(body)) {
+            return false;
+          }
+        }
+      }
+      const int end = insts.size();
+      for (const int split : splits) {
+        if (node.greedy) {
+          insts[split].out1 = end;
+        } else {
+          insts[split].out1 = insts[split].out;
+          insts[split].out = end;
+        }
+      }
+      return insts.size() <= kMaxInstructions;
+    }
+  }
+  return false;
+}
+
+}  // namespace internal
+
+namespace {
+
+typedef internal::MultiRegexProgram::Inst Inst;
+
+// The text, decoded and classified once for all the patterns.
+struct DecodedText {
+  std::vector<char32> codepoints;
+  std::vector<uint8> properties;
+
+  int size() const { return codepoints.size(); }
+
+  // Whether the position is between the characters of a "\r\n".
+  bool InCrLf(int pos) const {
+    return pos > 0 && pos < size() && codepoints[pos - 1] == '\r' &&
+           codepoints[pos] == '\n';
+  }
+
+  // Whether '^' matches at the position. Unlike '$', it does between the
+  // characters of a "\r\n", like in ICU.
+  bool AtLineStart(int pos) const {
+    return pos == 0 ||
+           (pos < size() && (properties[pos - 1] & kLineTerminatorProperty));
+  }
+
+  // Whether ICU tries to match a pattern that starts with '^' at the
+  // position, when searching for a match.
+  bool IsLineStartCandidate(int pos) const {
+    return pos == 0 ||
+           ((properties[pos - 1] & kLineTerminatorProperty) && !InCrLf(pos));
+  }
+
+  bool AtLineEnd(int pos) const {
+    return pos == size() ||
+           ((properties[pos] & kLineTerminatorProperty) && !InCrLf(pos));
+  }
+};
+
+struct Thread {
+  int pc;
+  int slots[kNumSlots];
+};
+
+// The threads at one position of the text, in priority order, with at most
+// one thread per instruction.
+struct ThreadList {
+  explicit ThreadList(int num_insts) : added_in(num_insts, -1) {}
+
+  void Clear() {
+    threads.clear();
+    ++generation;
+  }
+
+  std::vector<Thread> threads;
+
+  // For each instruction, the generation in which it was last added.
+  std::vector<int> added_in;
+  int generation = 0;
+};
+
+// The simulation of one pattern.
+struct PatternState {
+  PatternState(int pattern, const internal::MultiRegexProgram* program)
+      : pattern(pattern),
+        program(program),
+        current(program->insts.size()),
+        next(program->insts.size()) {}
+
+  int pattern;
+  const internal::MultiRegexProgram* program;
+  ThreadList current;
+  ThreadList next;
+
+  // The position the threads in 'current' are at.
+  int pos = 0;
+
+  // Whether a thread has matched; the simulation then continues only with
+  // the threads of higher priority, which may find a longer match.
+  bool matched = false;
+  Thread match;
+
+  bool done = false;
+  std::vector<MultiRegex::Match> matches;
+};
+
+// Adds the thread to the list, following the instructions that do not
+// consume characters, in priority order.
+void AddThread(const internal::MultiRegexProgram& program,
+               const DecodedText& text, int pos, const Thread& thread,
+               ThreadList* list, std::vector<Thread>* stack) {
+  stack->push_back(thread);
+  while (!stack->empty()) {
+    Thread t = stack->back();
+    stack->pop_back();
+    while (list->added_in[t.pc] != list->generation) {
+      list->added_in[t.pc] = list->generation;
+      const Inst& inst = program.insts[t.pc];
+      if (inst.op == Inst::JUMP) {
+        t.pc = inst.out;
+      } else if (inst.op == Inst::SPLIT) {
+        stack->push_back(t);
+        stack->back().pc = inst.out1;
+        t.pc = inst.out;
+      } else if (inst.op == Inst::SAVE) {
+        t.slots[inst.arg] = pos;
+        t.pc = inst.out;
+      } else if (inst.op == Inst::LINE_START) {
+        if (!text.AtLineStart(pos)) {
+          break;
+        }
+        t.pc = inst.out;
+      } else if (inst.op == Inst::LINE_END) {
+        if (!text.AtLineEnd(pos)) {
+          break;
+        }
+        t.pc = inst.out;
+      } else {
+        list->threads.push_back(t);
+        break;
+      }
+    }
+  }
+}
+
+// Advances the simulation of the pattern by one position.
+void Step(const DecodedText& text, PatternState* state,
+          std::vector<Thread>* stack) {
+  const internal::MultiRegexProgram& program = *state->program;
+  const int pos = state->pos;
+
+  // Starts a new attempt at this position, with the lowest priority.
+  if (!state->matched &&
+      (!program.starts_with_line_start || text.IsLineStartCandidate(pos))) {
+    Thread start;
+    start.pc = 0;
+    for (int i = 0; i < kNumSlots; ++i) {
+      start.slots[i] = -1;
+    }
+    AddThread(program, text, pos, start, &state->current, stack);
+  }
+
+  for (const Thread& thread : state->current.threads) {
+    const Inst& inst = program.insts[thread.pc];
+    if (inst.op == Inst::MATCH) {
+      // The threads of lower priority can't produce the reported match.
+      state->matched = true;
+      state->match = thread;
+      break;
+    }
+    if (pos < text.size() &&
+        (inst.op == Inst::LITERAL
+             ? text.codepoints[pos] == inst.arg
+             : program.classes[inst.arg].Matches(text.codepoints[pos],
+                                                 text.properties[pos]))) {
+      Thread next = thread;
+      next.pc = inst.out;
+      AddThread(program, text, pos + 1, next, &state->next, stack);
+    }
+  }
+
+  std::swap(state->current, state->next);
+  state->next.Clear();
+  ++state->pos;
+
+  if (!state->current.threads.empty()) {
+    return;
+  }
+  if (state->matched) {
+    const Thread& match = state->match;
+    state->matches.push_back(
+        {state->pattern, match.slots[0], match.slots[1], match.slots[2],
+         match.slots[3]});
+    state->matched = false;
+
+    // The next attempt starts at the end of the match, or after it if the
+    // match was empty, like in ICU.
+    state->pos = match.slots[1];
+    if (match.slots[0] == match.slots[1]) {
+      ++state->pos;
+    }
+    state->current.Clear();
+  }
+  if (state->pos > text.size()) {
+    state->done = true;
+  }
+}
+
+void SetStartsWithLineStart(internal::MultiRegexProgram* program) {
+  int first = 0;
+  while (program->insts[first].op == Inst::SAVE) {
+    ++first;
+  }
+  program->starts_with_line_start =
+      (program->insts[first].op == Inst::LINE_START);
+}
+
+std::unique_ptr<internal::MultiRegexProgram> CompileProgram(
+    const std::string& pattern) {
+  std::unique_ptr<internal::MultiRegexProgram> program(
+      new internal::MultiRegexProgram());
+  PatternParser parser(pattern, &program->classes);
+  const std::unique_ptr<Node> root = parser.Parse();
+
+  // The matches are reported with the span of the first group, so patterns
+  // without groups are left to the callers' error handling.
+  if (root == nullptr || parser.num_groups() == 0) {
+    return nullptr;
+  }
+
+  program->Add(Inst::SAVE, 0);
+  const bool emitted = program->Emit(*root);
+  program->Add(Inst::SAVE, 1);
+  program->Add(Inst::MATCH);
+  if (!emitted || program->insts.size() > kMaxInstructions) {
+    return nullptr;
+  }
+  SetStartsWithLineStart(program.get());
+  return program;
+}
+
+// The serialized programs are sequences of little-endian int32 and uint8
+// values: the version, the instructions (op, out, out1, arg), and the
+// classes (properties, negated_properties, negated, and the ranges).
+void AppendInt32(int32 value, std::string* out) {
+  const uint32 bits = static_cast<uint32>(value);
+  for (int i = 0; i < 4; ++i) {
+    out->push_back(static_cast<char>((bits >> (8 * i)) & 0xFF));
+  }
+}
+
+class ProgramReader {
+ public:
+  explicit ProgramReader(StringPiece data) : data_(data) {}
+
+  bool ReadInt32(int32* value) {
+    if (data_.size() - pos_ < 4) {
+      return false;
+    }
+    uint32 bits = 0;
+    for (int i = 0; i < 4; ++i) {
+      bits |= static_cast<uint32>(static_cast<uint8>(data_[pos_ + i]))
+              << (8 * i);
+    }
+    *value = static_cast<int32>(bits);
+    pos_ += 4;
+    return true;
+  }
+
+  bool ReadUint8(uint8* value) {
+    if (data_.size() - pos_ < 1) {
+      return false;
+    }
+    *value = static_cast<uint8>(data_[pos_++]);
+    return true;
+  }
+
+  // Reads a count of elements that take at least 'min_element_bytes' each,
+  // which therefore can't exceed the remaining data.
+  bool ReadCount(int min_element_bytes, int32* count) {
+    return ReadInt32(count) && *count >= 0 &&
+           *count <= (data_.size() - pos_) / min_element_bytes;
+  }
+
+  bool AtEnd() const { return pos_ == data_.size(); }
+
+ private:
+  StringPiece data_;
+  size_t pos_ = 0;
+};
+
+// Checks that the simulation of the program stays in bounds, and that every
+// match goes through the final SAVE 1 after the initial SAVE 0, as in the
+// compiled programs.
+bool IsValidProgram(const internal::MultiRegexProgram& program) {
+  const int num_insts = program.insts.size();
+  if (num_insts < 3 || num_insts > kMaxInstructions ||
+      program.insts[0].op != Inst::SAVE || program.insts[0].arg != 0 ||
+      program.insts[num_insts - 2].op != Inst::SAVE ||
+      program.insts[num_insts - 2].arg != 1 ||
+      program.insts[num_insts - 2].out != num_insts - 1 ||
+      program.insts[num_insts - 1].op != Inst::MATCH) {
+    return false;
+  }
+  const auto valid_target = [num_insts](int index, int target) {
+    return target >= 0 && target < num_insts &&
+           (target != num_insts - 1 || index == num_insts - 2);
+  };
+  for (int i = 0; i < num_insts - 1; ++i) {
+    const Inst& inst = program.insts[i];
+    if (inst.op < Inst::LITERAL || inst.op >= Inst::MATCH ||
+        !valid_target(i, inst.out) ||
+        (inst.op == Inst::SPLIT && !valid_target(i, inst.out1)) ||
+        (inst.op == Inst::SAVE && (inst.arg < 0 || inst.arg >= kNumSlots)) ||
+        (inst.op == Inst::CLASS &&
+         (inst.arg < 0 || inst.arg >= program.classes.size()))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::unique_ptr<internal::MultiRegexProgram> LoadProgram(
+    StringPiece serialized_program) {
+  ProgramReader reader(serialized_program);
+  int32 version;
+  if (!reader.ReadInt32(&version) || version != MultiRegex::kProgramVersion) {
+    return nullptr;
+  }
+
+  std::unique_ptr<internal::MultiRegexProgram> program(
+      new internal::MultiRegexProgram());
+  int32 num_insts;
+  if (!reader.ReadCount(/*min_element_bytes=*/16, &num_insts)) {
+    return nullptr;
+  }
+  program->insts.resize(num_insts);
+  for (Inst& inst : program->insts) {
+    int32 op;
+    if (!reader.ReadInt32(&op) || !reader.ReadInt32(&inst.out) ||
+        !reader.ReadInt32(&inst.out1) || !reader.ReadInt32(&inst.arg)) {
+      return nullptr;
+    }
+    inst.op = static_cast<Inst::Op>(op);
+  }
+
+  int32 num_classes;
+  if (!reader.ReadCount(/*min_element_bytes=*/7, &num_classes)) {
+    return nullptr;
+  }
+  program->classes.resize(num_classes);
+  for (CharClass& char_class : program->classes) {
+    uint8 negated;
+    int32 num_ranges;
+    if (!reader.ReadUint8(&char_class.properties) ||
+        !reader.ReadUint8(&char_class.negated_properties) ||
+        !reader.ReadUint8(&negated) ||
+        !reader.ReadCount(/*min_element_bytes=*/8, &num_ranges)) {
+      return nullptr;
+    }
+    char_class.negated = negated != 0;
+    char_class.ranges.resize(num_ranges);
+    for (std::pair<char32, char32>& range : char_class.ranges) {
+      int32 first, last;
+      if (!reader.ReadInt32(&first) || !reader.ReadInt32(&last)) {
+        return nullptr;
+      }
+      range = {first, last};
+    }
+  }
+
+  if (!reader.AtEnd() || !IsValidProgram(*program)) {
+    return nullptr;
+  }
+  SetStartsWithLineStart(program.get());
+  return program;
+}
+
+}  // namespace
+
+std::unique_ptr<MultiRegex> MultiRegex::Create(
+    const std::vector<std::string>& patterns) {
+  return Create(patterns, /*serialized_programs=*/{});
+}
+
+std::unique_ptr<MultiRegex> MultiRegex::Create(
+    const std::vector<std::string>& patterns,
+    const std::vector<StringPiece>& serialized_programs) {
+  std::unique_ptr<MultiRegex> result(new MultiRegex());
+  for (int i = 0; i < patterns.size(); ++i) {
+    if (i < serialized_programs.size() && !serialized_programs[i].empty()) {
+      std::unique_ptr<internal::MultiRegexProgram> program =
+          LoadProgram(serialized_programs[i]);
+      if (program != nullptr) {
+        result->programs_.push_back(std::move(program));
+        ++result->num_loaded_;
+        continue;
+      }
+      TC_LOG(WARNING) << "Ignoring an incompatible serialized program.";
+    }
+    result->programs_.push_back(CompileProgram(patterns[i]));
+  }
+  return result;
+}
+
+bool MultiRegex::SerializeProgram(int pattern,
+                                  std::string* serialized_program) const {
+  if (!Supports(pattern)) {
+    return false;
+  }
+  const internal::MultiRegexProgram& program = *programs_[pattern];
+  serialized_program->clear();
+  AppendInt32(kProgramVersion, serialized_program);
+  AppendInt32(program.insts.size(), serialized_program);
+  for (const Inst& inst : program.insts) {
+    AppendInt32(inst.op, serialized_program);
+    AppendInt32(inst.out, serialized_program);
+    AppendInt32(inst.out1, serialized_program);
+    AppendInt32(inst.arg, serialized_program);
+  }
+  AppendInt32(program.classes.size(), serialized_program);
+  for (const CharClass& char_class : program.classes) {
+    serialized_program->push_back(static_cast<char>(char_class.properties));
+    serialized_program->push_back(
+        static_cast<char>(char_class.negated_properties));
+    serialized_program->push_back(char_class.negated ? 1 : 0);
+    AppendInt32(char_class.ranges.size(), serialized_program);
+    for (const std::pair<char32, char32>& range : char_class.ranges) {
+      AppendInt32(range.first, serialized_program);
+      AppendInt32(range.second, serialized_program);
+    }
+  }
+  return true;
+}
+
+MultiRegex::MultiRegex() {}
+
+MultiRegex::~MultiRegex() {}
+
+bool MultiRegex::Supports(int pattern) const {
+  return pattern >= 0 && pattern < programs_.size() &&
+         programs_[pattern] != nullptr;
+}
+
+int MultiRegex::NumSupported() const {
+  int num_supported = 0;
+  for (const std::unique_ptr<const internal::MultiRegexProgram>& program :
+       programs_) {
+    if (program != nullptr) {
+      ++num_supported;
+    }
+  }
+  return num_supported;
+}
+
+int64 MultiRegex::EstimateMemoryBytes() const {
+  int64 bytes = STLVectorMemoryBytes(programs_);
+  for (const std::unique_ptr<const internal::MultiRegexProgram>& program :
+       programs_) {
+    if (program == nullptr) {
+      continue;
+    }
+    bytes += sizeof(internal::MultiRegexProgram) +
+             STLVectorMemoryBytes(program->insts) +
+             STLVectorMemoryBytes(program->classes);
+    for (const CharClass& char_class : program->classes) {
+      bytes += STLVectorMemoryBytes(char_class.ranges);
+    }
+  }
+  return bytes;
+}
+
+void MultiRegex::FindAll(const UnicodeText& text,
+                         const std::vector<int>& patterns,
+                         std::vector<Match>* matches) const {
+  std::vector<PatternState> states;
+  states.reserve(patterns.size());
+  for (const int pattern : patterns) {
+    if (Supports(pattern)) {
+      states.emplace_back(pattern, programs_[pattern].get());
+    }
+  }
+  if (states.empty()) {
+    return;
+  }
+
+  DecodedText decoded_text;
+  for (const char32 codepoint : text) {
+    decoded_text.codepoints.push_back(codepoint);
+    decoded_text.properties.push_back(GetCharProperties(codepoint));
+  }
+
+  // All the patterns advance over each position before the next one. A
+  // pattern may need to step back to the end of its last match, by as many
+  // positions as it looked ahead for a longer match.
+  std::vector<Thread> stack;
+  for (int pos = 0; pos <= decoded_text.size(); ++pos) {
+    for (PatternState& state : states) {
+      while (!state.done && state.pos <= pos) {
+        Step(decoded_text, &state, &stack);
+      }
+    }
+  }
+
+  for (const PatternState& state : states) {
+    matches->insert(matches->end(), state.matches.begin(),
+                    state.matches.end());
+  }
+}
+
+}  // namespace libtextclassifier2
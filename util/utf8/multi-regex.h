@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Matches many regular expressions in one pass over a text, without
+// backtracking.
+
+#ifndef LIBTEXTCLASSIFIER_UTIL_UTF8_MULTI_REGEX_H_
+#define LIBTEXTCLASSIFIER_UTIL_UTF8_MULTI_REGEX_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "util/base/integral_types.h"
+#include "util/base/macros.h"
+#include "util/strings/stringpiece.h"
+#include "util/utf8/unicodetext.h"
+
+namespace libtextclassifier2 {
+
+namespace internal {
+struct MultiRegexProgram;
+}  // namespace internal
+
+// A set of regular expressions in ICU syntax, compiled for the subset of the
+// syntax that needs no backtracking: literals, character classes, '.', \d, \s,
+// \w and their negations, groups, alternation, greedy and lazy quantifiers,
+// and the '^' and '$' anchors (in multi-line mode, as
+// UniLib::CreateRegexPattern compiles them). Patterns that use anything else,
+// e.g. back-references, lookaround, word boundaries or flags, are left out,
+// see Supports(), and need to be matched with UniLib::RegexPattern instead.
+//
+// The supported patterns are simulated together over the text, so each
+// codepoint is decoded and classified once for all of them. The matches are
+// exactly those that successive UniLib::RegexMatcher::Find() calls return,
+// with the spans of the whole match and of the first capturing group.
+class MultiRegex {
+ public:
+  struct Match {
+    // Index of the pattern in the vector passed to Create().
+    int pattern;
+
+    // Codepoint span of the whole match.
+    int start;
+    int end;
+
+    // Codepoint span of the first capturing group, or -1, -1 if the group
+    // did not participate in the match or the pattern has no groups.
+    int group_start;
+    int group_end;
+  };
+
+  // Version of the serialized programs. Changes whenever the instructions or
+  // their serialization do.
+  static const int kProgramVersion = 1;
+
+  // Compiles the given patterns, UTF8 encoded. Never fails, but may support
+  // none of them.
+  static std::unique_ptr<MultiRegex> Create(
+      const std::vector<std::string>& patterns);
+
+  // Same as above, but loads the patterns from the programs serialized by
+  // SerializeProgram() where given, without parsing them. A program of
+  // another version, or one that is malformed, is ignored and the pattern is
+  // compiled instead. 'serialized_programs' may be shorter than 'patterns',
+  // and an empty program is not given.
+  static std::unique_ptr<MultiRegex> Create(
+      const std::vector<std::string>& patterns,
+      const std::vector<StringPiece>& serialized_programs);
+
+  ~MultiRegex();
+
+  // Returns whether the pattern with the given index was compiled.
+  bool Supports(int pattern) const;
+
+  // Returns the number of compiled patterns.
+  int NumSupported() const;
+
+  // Returns the number of patterns loaded from serialized programs.
+  int NumLoaded() const { return num_loaded_; }
+
+  // Serializes the compiled pattern with the given index, e.g. to store it in
+  // a model. Returns false if the pattern is not supported.
+  bool SerializeProgram(int pattern, std::string* serialized_program) const;
+
+  // Returns an estimate of the memory held by the compiled patterns.
+  int64 EstimateMemoryBytes() const;
+
+  // Finds the matches of the given compiled patterns in the text. The matches
+  // are appended grouped by pattern, in the order of 'patterns', and in text
+  // order for each pattern.
+  void FindAll(const UnicodeText& text, const std::vector<int>& patterns,
+               std::vector<Match>* matches) const;
+
+ private:
+  MultiRegex();
+
+  // The compiled patterns, indexed like the patterns passed to Create(), or
+  // nullptr for the ones that are not supported.
+  std::vector<std::unique_ptr<const internal::MultiRegexProgram>> programs_;
+  int num_loaded_ = 0;
+
+  TC_DISALLOW_COPY_AND_ASSIGN(MultiRegex);
+};
+
+}  // namespace libtextclassifier2
+
+#endif  // LIBTEXTCLASSIFIER_UTIL_UTF8_MULTI_REGEX_H_
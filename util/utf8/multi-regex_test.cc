@@ -0,0 +1,254 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/utf8/multi-regex.h"
+
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "util/utf8/unicodetext.h"
+#include "util/utf8/unilib.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+using testing::ElementsAre;
+
+// Whole match and first group spans.
+typedef std::tuple<int, int, int, int> Spans;
+
+std::vector<Spans> FindAll(const MultiRegex& regex, int pattern,
+                           const std::string& text) {
+  std::vector<MultiRegex::Match> matches;
+  regex.FindAll(UTF8ToUnicodeText(text, /*do_copy=*/false), {pattern},
+                &matches);
+  std::vector<Spans> result;
+  for (const MultiRegex::Match& match : matches) {
+    EXPECT_EQ(match.pattern, pattern);
+    result.emplace_back(match.start, match.end, match.group_start,
+                        match.group_end);
+  }
+  return result;
+}
+
+TEST(MultiRegexTest, Supports) {
+  const std::unique_ptr<MultiRegex> regex = MultiRegex::Create({
+      "([a-zA-Z]{2} ?\\d{2,4})",
+      "(\\d{3}) ?\\d{4}",
+      "(?:(a)|b)+?c$",
+      "(?<name>[^\\s@]+)@\\w+",
+      "^(\\x41|\\u00e9)",
+      // No groups.
+      "\\d+",
+      // Word boundaries, lookaround, back-references, flags.
+      "\\b(\\d+)\\b",
+      "(a)(?=b)",
+      "(a)\\1",
+      "(?i)(a)",
+      // Repeated nullable expression.
+      "(a*)*",
+      // Possessive quantifier.
+      "(a++)",
+      // Set operations.
+      "([[a-z]&&[^b]])",
+  });
+  EXPECT_TRUE(regex->Supports(0));
+  EXPECT_TRUE(regex->Supports(1));
+  EXPECT_TRUE(regex->Supports(2));
+  EXPECT_TRUE(regex->Supports(3));
+  EXPECT_TRUE(regex->Supports(4));
+  for (int i = 5; i <= 12; ++i) {
+    EXPECT_FALSE(regex->Supports(i)) << i;
+  }
+  EXPECT_FALSE(regex->Supports(13));
+  EXPECT_EQ(regex->NumSupported(), 5);
+}
+
+TEST(MultiRegexTest, FindsSuccessiveMatches) {
+  const std::unique_ptr<MultiRegex> regex = MultiRegex::Create({
+      "([a-zA-Z]{2} ?\\d{2,4})",
+      " (Barack Obama) ",
+      "(a*?)b",
+      "(x)?y",
+  });
+  EXPECT_THAT(FindAll(*regex, 0, "LX 38 and LX38, LX123456"),
+              ElementsAre(Spans(0, 5, 0, 5), Spans(10, 14, 10, 14),
+                          Spans(16, 22, 16, 22)));
+  EXPECT_THAT(FindAll(*regex, 1, "I saw Barack Obama today"),
+              ElementsAre(Spans(5, 19, 6, 18)));
+  EXPECT_THAT(FindAll(*regex, 2, "aab b"),
+              ElementsAre(Spans(0, 3, 0, 2), Spans(4, 5, 4, 4)));
+  EXPECT_THAT(FindAll(*regex, 3, "xy y"),
+              ElementsAre(Spans(0, 2, 0, 1), Spans(3, 4, -1, -1)));
+}
+
+TEST(MultiRegexTest, CountsCodepoints) {
+  const std::unique_ptr<MultiRegex> regex =
+      MultiRegex::Create({"(\\w+)", "\xF0\x9F\x98\x8B(.)"});
+  EXPECT_THAT(FindAll(*regex, 0, "\xF0\x9F\x98\x8B caf\xC3\xA9 \xD9\xA1"),
+              ElementsAre(Spans(2, 6, 2, 6), Spans(7, 8, 7, 8)));
+  EXPECT_THAT(FindAll(*regex, 1, "\xF0\x9F\x98\x8B\xF0\x9F\x98\x8B"),
+              ElementsAre(Spans(0, 2, 1, 2)));
+}
+
+TEST(MultiRegexTest, GroupsMatchesByPattern) {
+  const std::unique_ptr<MultiRegex> regex =
+      MultiRegex::Create({"(a)", "\\b(b)", "(b)"});
+  std::vector<MultiRegex::Match> matches;
+  regex->FindAll(UTF8ToUnicodeText("ab ba", /*do_copy=*/false), {2, 1, 0},
+                 &matches);
+  std::vector<std::pair<int, int>> patterns_and_starts;
+  for (const MultiRegex::Match& match : matches) {
+    patterns_and_starts.push_back({match.pattern, match.start});
+  }
+  // The unsupported pattern 1 is skipped.
+  EXPECT_THAT(patterns_and_starts,
+              ElementsAre(std::make_pair(2, 1), std::make_pair(2, 3),
+                          std::make_pair(0, 0), std::make_pair(0, 4)));
+}
+
+TEST(MultiRegexTest, LoadsSerializedPrograms) {
+  const std::vector<std::string> patterns = {
+      "([a-zA-Z]{2} ?\\d{2,4})", "^(\\s*)([^\\d\\s]+?)$", "\\b(b)",
+      "(\\d{1,2})[/.-](\\d{1,2})([/.-]\\d{2,4})?"};
+  const std::unique_ptr<MultiRegex> regex = MultiRegex::Create(patterns);
+  std::vector<std::string> serialized_programs(patterns.size());
+  for (int i = 0; i < patterns.size(); ++i) {
+    EXPECT_EQ(regex->SerializeProgram(i, &serialized_programs[i]),
+              regex->Supports(i));
+  }
+  EXPECT_TRUE(serialized_programs[2].empty());
+
+  // The loaded programs don't need the patterns.
+  const std::unique_ptr<MultiRegex> loaded_regex = MultiRegex::Create(
+      std::vector<std::string>(patterns.size()),
+      {serialized_programs.begin(), serialized_programs.end()});
+  EXPECT_EQ(loaded_regex->NumLoaded(), 3);
+  EXPECT_EQ(loaded_regex->NumSupported(), 3);
+  for (const std::string& text :
+       {"Flight LX38 to Zurich, or LX 1234", "  abc\n de\r\nf",
+        "on 12/31/2017 or 1.2.18", ""}) {
+    for (int i = 0; i < patterns.size(); ++i) {
+      EXPECT_EQ(FindAll(*loaded_regex, i, text), FindAll(*regex, i, text))
+          << patterns[i] << " " << text;
+    }
+  }
+}
+
+TEST(MultiRegexTest, CompilesPatternsOfInvalidPrograms) {
+  const std::vector<std::string> patterns = {"(a+)b", "(c)"};
+  const std::unique_ptr<MultiRegex> regex = MultiRegex::Create(patterns);
+  std::string serialized_program;
+  ASSERT_TRUE(regex->SerializeProgram(0, &serialized_program));
+
+  std::vector<std::string> invalid_programs;
+  // Another version.
+  invalid_programs.push_back(serialized_program);
+  invalid_programs.back()[0] ^= 0x7F;
+  // Truncated.
+  invalid_programs.push_back(
+      serialized_program.substr(0, serialized_program.size() - 1));
+  // A jump out of the program.
+  invalid_programs.push_back(serialized_program);
+  invalid_programs.back()[4 + 4 + 16 + 4] = 0x7F;
+  // Trailing data.
+  invalid_programs.push_back(serialized_program + "x");
+  for (const std::string& invalid_program : invalid_programs) {
+    const std::unique_ptr<MultiRegex> loaded_regex =
+        MultiRegex::Create(patterns, {invalid_program, serialized_program});
+    EXPECT_EQ(loaded_regex->NumLoaded(), 1);
+    ASSERT_TRUE(loaded_regex->Supports(0));
+    ASSERT_TRUE(loaded_regex->Supports(1));
+    EXPECT_THAT(FindAll(*loaded_regex, 0, "xaab"),
+                ElementsAre(Spans(1, 4, 1, 3)));
+
+    // The second pattern is now the one the first program was for.
+    EXPECT_THAT(FindAll(*loaded_regex, 1, "xaab"),
+                ElementsAre(Spans(1, 4, 1, 3)));
+  }
+}
+
+#ifdef LIBTEXTCLASSIFIER_UNILIB_ICU
+TEST(MultiRegexTest, SameMatchesAsIcu) {
+  CREATE_UNILIB_FOR_TESTING;
+  const std::vector<std::string> patterns = {
+      "([a-zA-Z]{2}\\d{2,4})",
+      "([a-zA-Z]{2} ?\\d{2,4})",
+      "(\\+?\\d{1,3}[ -])?(\\(?\\d{3}\\)?[ -]?\\d{3}[ -]?\\d{4})",
+      "([\\w.+-]+@[\\w-]+\\.[\\w.-]+)",
+      "(\\d{1,2})[/.-](\\d{1,2})([/.-]\\d{2,4})?",
+      "(.*?)\\.",
+      "(a|ab)(c|bcd)(d*)",
+      "(a+?)(a*)",
+      "^(\\s*)(\\S+)$",
+      "(^|\\s)(\\d+)",
+      "((?:ab)+|a)",
+      "([^\\d\\s]{2,}[$]?)",
+      "(\\W)",
+      "(\xC3\xA9|e)\\x{301}?",
+      "([\\u00e0-\\u00ff]+)",
+      "(x){0}a",
+      "(a{2,3}?)",
+  };
+  const std::vector<std::string> texts = {
+      "",
+      "Flight LX38 to Zurich, or LX 1234",
+      "call +1 (800) 123-4567 or 800 123 4567",
+      "mail john.doe+x@example.com.",
+      "on 12/31/2017 or 1.2.18",
+      "abcd abbcd aaaa",
+      "line one\nline two\r\n  three \r\n",
+      "  $$abc$ 12 x",
+      "caf\xC3\xA9 cafe\xCC\x81 \xD9\xA1\xD9\xA2 \xF0\x9F\x98\x8B!",
+      "\xE2\x80\xA8 two\xC2\x85three",
+      "xaaaaa",
+  };
+  const std::unique_ptr<MultiRegex> regex = MultiRegex::Create(patterns);
+  for (int i = 0; i < patterns.size(); ++i) {
+    ASSERT_TRUE(regex->Supports(i)) << patterns[i];
+    std::unique_ptr<UniLib::RegexPattern> icu_regex =
+        unilib.CreateRegexPattern(
+            UTF8ToUnicodeText(patterns[i], /*do_copy=*/false));
+    ASSERT_TRUE(icu_regex) << patterns[i];
+
+    for (const std::string& text : texts) {
+      const UnicodeText unicode_text =
+          UTF8ToUnicodeText(text, /*do_copy=*/false);
+      std::vector<Spans> icu_matches;
+      const std::unique_ptr<UniLib::RegexMatcher> matcher =
+          icu_regex->Matcher(unicode_text);
+      int status = UniLib::RegexMatcher::kNoError;
+      while (matcher->Find(&status) &&
+             status == UniLib::RegexMatcher::kNoError) {
+        icu_matches.emplace_back(matcher->Start(0, &status),
+                                 matcher->End(0, &status),
+                                 matcher->Start(1, &status),
+                                 matcher->End(1, &status));
+      }
+      EXPECT_EQ(FindAll(*regex, i, text), icu_matches)
+          << "Pattern: " << patterns[i] << " text: " << text;
+    }
+  }
+}
+#endif  // LIBTEXTCLASSIFIER_UNILIB_ICU
+
+}  // namespace
+}  // namespace libtextclassifier2
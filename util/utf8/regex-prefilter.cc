@@ -0,0 +1,825 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/utf8/regex-prefilter.h"
+
+#include <algorithm>
+
+#include "util/strings/utf8.h"
+
+namespace libtextclassifier2 {
+
+constexpr int RegexPrefilter::kUnboundedLength;
+
+void PrefilterCharSet::AddRange(int first, int last) {
+  for (int c = std::max(first, 0); c <= last && c < 0x80; ++c) {
+    Add(c);
+  }
+}
+
+PrefilterCharSet PrefilterCharSet::All() {
+  PrefilterCharSet result;
+  result.ascii[0] = ~uint64{0};
+  result.ascii[1] = ~uint64{0};
+  result.non_ascii = true;
+  return result;
+}
+
+namespace {
+
+// At most this many of the most selective required sets are kept for a
+// pattern.
+const int kMaxRequiredSets = 4;
+
+// Patterns nested deeper than this are not analyzed.
+const int kMaxDepth = 50;
+
+// Stands for any non-ASCII character in the analysis.
+const int kNonAsciiChar = 0x80;
+
+// Lengths are capped at this, which stands for unbounded.
+const int kUnbounded = RegexPrefilter::kUnboundedLength;
+
+inline int AddLengths(int a, int b) {
+  return std::min(static_cast<int64>(a) + b, static_cast<int64>(kUnbounded));
+}
+
+inline int MultiplyLength(int length, int count) {
+  if (length == 0 || count == 0) {
+    return 0;
+  }
+  if (length >= kUnbounded || count >= kUnbounded) {
+    return kUnbounded;
+  }
+  return std::min(static_cast<int64>(length) * count,
+                  static_cast<int64>(kUnbounded));
+}
+
+inline bool IsAsciiLetter(int c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+inline bool IsAsciiDigit(int c) { return c >= '0' && c <= '9'; }
+
+inline int HexDigitValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+// Number of characters in the set, counting the non-ASCII ones as many.
+int SetSize(const PrefilterCharSet& chars) {
+  int size = chars.non_ascii ? 64 : 0;
+  for (const uint64 bits : chars.ascii) {
+    for (uint64 b = bits; b != 0; b &= b - 1) {
+      ++size;
+    }
+  }
+  return size;
+}
+
+// Keeps the kMaxRequiredSets most selective distinct sets, dropping the ones
+// that do not restrict anything.
+void KeepMostSelective(std::vector<PrefilterCharSet>* sets) {
+  const PrefilterCharSet all = PrefilterCharSet::All();
+  std::vector<PrefilterCharSet> result;
+  std::stable_sort(sets->begin(), sets->end(),
+                   [](const PrefilterCharSet& a, const PrefilterCharSet& b) {
+                     return SetSize(a) < SetSize(b);
+                   });
+  for (const PrefilterCharSet& chars : *sets) {
+    if (result.size() >= kMaxRequiredSets) {
+      break;
+    }
+    if (chars == all ||
+        std::find(result.begin(), result.end(), chars) != result.end()) {
+      continue;
+    }
+    result.push_back(chars);
+  }
+  *sets = std::move(result);
+}
+
+// What the analysis knows about the matches of a part of a pattern.
+struct PatternPart {
+  // Every match contains a character of each of these sets.
+  std::vector<PrefilterCharSet> required;
+
+  // Bounds on the number of characters of a match. The minimum is counted in
+  // thirds of characters, because with case-insensitive matching one
+  // character can match up to three of the pattern, e.g. U+FB03 LATIN SMALL
+  // LIGATURE FFI matches "ffi".
+  int min_thirds = 0;
+  int max_length = 0;
+
+  // The characters that a non-empty match can start with.
+  PrefilterCharSet first_chars;
+
+  bool MayBeEmpty() const { return min_thirds == 0; }
+
+  // A part that matches a single character of the set.
+  void SetChar(const PrefilterCharSet& chars, bool case_insensitive) {
+    required.assign(1, chars);
+    first_chars = chars;
+    min_thirds = case_insensitive ? 1 : 3;
+    max_length = case_insensitive ? 3 : 1;
+  }
+
+  // A part that matches an unknown non-empty or empty string.
+  void SetAnything() {
+    required.clear();
+    first_chars = PrefilterCharSet::All();
+    min_thirds = 0;
+    max_length = kUnbounded;
+  }
+
+  // Appends a part that follows this one.
+  void Append(const PatternPart& next) {
+    required.insert(required.end(), next.required.begin(),
+                    next.required.end());
+    if (MayBeEmpty()) {
+      first_chars.AddAll(next.first_chars);
+    }
+    min_thirds = AddLengths(min_thirds, next.min_thirds);
+    max_length = AddLengths(max_length, next.max_length);
+  }
+};
+
+// Recursive descent over the pattern that computes, for each part of it, the
+// sets of characters that every match of the part contains a character of,
+// the bounds of the match length and the possible first characters.
+// All the Parse* methods return false on syntax the analysis does not handle.
+class PatternAnalyzer {
+ public:
+  explicit PatternAnalyzer(StringPiece pattern) : pattern_(pattern) {}
+
+  bool Analyze(PatternPart* part) {
+    if (!ParseAlternation(/*depth=*/0, part)) {
+      return false;
+    }
+    // A closing parenthesis without an opening one.
+    return AtEnd();
+  }
+
+ private:
+  bool AtEnd() const { return pos_ >= pattern_.size(); }
+  char Peek() const { return pattern_[pos_]; }
+  bool PeekIs(char c) const { return !AtEnd() && Peek() == c; }
+
+  // Parses alternatives up to a closing parenthesis or the end.
+  bool ParseAlternation(int depth, PatternPart* part);
+
+  // Parses a concatenation up to a '|', a closing parenthesis or the end.
+  bool ParseSequence(int depth, PatternPart* part);
+
+  // Parses an atom with its quantifiers.
+  bool ParseQuantifiedAtom(int depth, PatternPart* part);
+
+  // Parses a group after its opening parenthesis, including the closing one.
+  bool ParseGroup(int depth, PatternPart* part);
+
+  // Parses a character class after its opening bracket, including the closing
+  // one.
+  bool ParseClass(PrefilterCharSet* chars);
+
+  // Parses one member of a character class: a single character, set to
+  // 'literal', or a set of characters, set to 'chars' with 'literal' -1.
+  bool ParseClassMember(int* literal, PrefilterCharSet* chars);
+
+  // Parses an escape sequence after the backslash. Sets 'literal' to the
+  // escaped character, or to -1 if the escape stands for the set 'chars'.
+  // Sets 'zero_width' if it matches no characters at all, e.g. \b. Sets
+  // 'max_length' to the number of characters the escape can match.
+  bool ParseEscape(bool in_class, int* literal, PrefilterCharSet* chars,
+                   bool* zero_width, int* max_length);
+
+  // Parses the hexadecimal digits of a \x, \u or \U escape.
+  bool ParseHexEscape(int max_digits, bool allow_braces, int* value);
+
+  // Parses a quantifier into its minimum and maximum number of repetitions.
+  bool ParseQuantifier(int* min_count, int* max_count);
+
+  // Parses the decimal repetition count of a {n,m} quantifier.
+  bool ParseCount(int* count) {
+    *count = 0;
+    int num_digits = 0;
+    while (!AtEnd() && IsAsciiDigit(Peek())) {
+      *count = std::min(*count * 10 + (Peek() - '0'),
+                        static_cast<int>(kUnbounded));
+      ++num_digits;
+      ++pos_;
+    }
+    return num_digits > 0;
+  }
+
+  // Skips a UTF8 encoded non-ASCII character.
+  void SkipNonAsciiChar() {
+    pos_ += GetNumBytesForNonZeroUTF8Char(pattern_.data() + pos_);
+  }
+
+  // Adds a single literal character to 'chars', taking case-insensitive
+  // matching into account.
+  void AddLiteral(int literal, PrefilterCharSet* chars) const;
+
+  // Extends the set for case-insensitive matching.
+  void CaseFold(PrefilterCharSet* chars) const;
+
+  const StringPiece pattern_;
+  int pos_ = 0;
+  bool case_insensitive_ = false;
+};
+
+bool PatternAnalyzer::ParseAlternation(int depth, PatternPart* part) {
+  if (depth > kMaxDepth) {
+    return false;
+  }
+
+  std::vector<PatternPart> branches(1);
+  if (!ParseSequence(depth, &branches.back())) {
+    return false;
+  }
+  while (PeekIs('|')) {
+    ++pos_;
+    branches.emplace_back();
+    if (!ParseSequence(depth, &branches.back())) {
+      return false;
+    }
+  }
+
+  if (branches.size() == 1) {
+    *part = std::move(branches[0]);
+    return true;
+  }
+
+  *part = PatternPart();
+  part->min_thirds = kUnbounded;
+  bool all_require = true;
+  PrefilterCharSet branch_union;
+  for (const PatternPart& branch : branches) {
+    part->min_thirds = std::min(part->min_thirds, branch.min_thirds);
+    part->max_length = std::max(part->max_length, branch.max_length);
+    part->first_chars.AddAll(branch.first_chars);
+    if (branch.required.empty()) {
+      all_require = false;
+    } else {
+      branch_union.AddAll(branch.required[0]);
+    }
+  }
+
+  // Every match contains a character of the union of one set of each branch,
+  // if every branch requires something.
+  if (all_require) {
+    part->required.push_back(branch_union);
+    KeepMostSelective(&part->required);
+  }
+  return true;
+}
+
+bool PatternAnalyzer::ParseSequence(int depth, PatternPart* part) {
+  *part = PatternPart();
+  while (!AtEnd() && Peek() != '|' && Peek() != ')') {
+    PatternPart atom;
+    if (!ParseQuantifiedAtom(depth, &atom)) {
+      return false;
+    }
+    part->Append(atom);
+  }
+  KeepMostSelective(&part->required);
+  return true;
+}
+
+bool PatternAnalyzer::ParseQuantifiedAtom(int depth, PatternPart* part) {
+  *part = PatternPart();
+  const char c = Peek();
+  if (c == '(') {
+    ++pos_;
+    if (!ParseGroup(depth + 1, part)) {
+      return false;
+    }
+  } else if (c == '[') {
+    ++pos_;
+    PrefilterCharSet chars;
+    if (!ParseClass(&chars)) {
+      return false;
+    }
+    part->SetChar(chars, case_insensitive_);
+  } else if (c == '\\') {
+    ++pos_;
+    int literal;
+    PrefilterCharSet chars;
+    bool zero_width;
+    int max_length;
+    if (!ParseEscape(/*in_class=*/false, &literal, &chars, &zero_width,
+                     &max_length)) {
+      return false;
+    }
+    if (zero_width) {
+      if (max_length > 0) {
+        // A back reference.
+        part->SetAnything();
+      }
+    } else {
+      if (literal >= 0) {
+        AddLiteral(literal, &chars);
+      }
+      part->SetChar(chars, case_insensitive_ && literal >= 0);
+      part->max_length = std::max(part->max_length, max_length);
+    }
+  } else if (c == '^' || c == '$') {
+    ++pos_;
+  } else if (c == '.') {
+    ++pos_;
+    part->SetChar(PrefilterCharSet::All(), /*case_insensitive=*/false);
+  } else if (c == '*' || c == '+' || c == '?' || c == '{' || c == ']' ||
+             c == '}') {
+    // A quantifier without an atom, or a stray bracket.
+    return false;
+  } else if (static_cast<unsigned char>(c) >= 0x80) {
+    SkipNonAsciiChar();
+    PrefilterCharSet chars;
+    AddLiteral(kNonAsciiChar, &chars);
+    part->SetChar(chars, case_insensitive_);
+  } else {
+    ++pos_;
+    PrefilterCharSet chars;
+    AddLiteral(c, &chars);
+    part->SetChar(chars, case_insensitive_);
+  }
+
+  while (!AtEnd() && (Peek() == '*' || Peek() == '+' || Peek() == '?' ||
+                      Peek() == '{')) {
+    int min_count;
+    int max_count;
+    if (!ParseQuantifier(&min_count, &max_count)) {
+      return false;
+    }
+    // An atom that may be repeated zero times requires nothing.
+    if (min_count == 0) {
+      part->required.clear();
+    }
+    if (max_count == 0) {
+      part->first_chars = PrefilterCharSet();
+    }
+    part->min_thirds = MultiplyLength(part->min_thirds, min_count);
+    part->max_length = MultiplyLength(part->max_length, max_count);
+  }
+  return true;
+}
+
+bool PatternAnalyzer::ParseQuantifier(int* min_count, int* max_count) {
+  const char c = Peek();
+  ++pos_;
+  if (c == '*') {
+    *min_count = 0;
+    *max_count = kUnbounded;
+  } else if (c == '?') {
+    *min_count = 0;
+    *max_count = 1;
+  } else if (c == '+') {
+    *min_count = 1;
+    *max_count = kUnbounded;
+  } else {
+    // {n}, {n,} or {n,m}.
+    if (!ParseCount(min_count)) {
+      return false;
+    }
+    *max_count = *min_count;
+    if (PeekIs(',')) {
+      ++pos_;
+      if (PeekIs('}')) {
+        *max_count = kUnbounded;
+      } else if (!ParseCount(max_count)) {
+        return false;
+      }
+    }
+    if (!PeekIs('}')) {
+      return false;
+    }
+    ++pos_;
+  }
+
+  // Lazy and possessive modifiers.
+  if (PeekIs('?') || PeekIs('+')) {
+    ++pos_;
+  }
+  return true;
+}
+
+bool PatternAnalyzer::ParseGroup(int depth, PatternPart* part) {
+  // Flags set inside the group, e.g. with (?i), apply until its end.
+  const bool saved_case_insensitive = case_insensitive_;
+  bool is_lookaround = false;
+
+  if (PeekIs('?')) {
+    ++pos_;
+    if (AtEnd()) {
+      return false;
+    }
+    const char c = Peek();
+    if (c == ':' || c == '>') {
+      ++pos_;
+    } else if (c == '=' || c == '!') {
+      ++pos_;
+      is_lookaround = true;
+    } else if (c == '<') {
+      ++pos_;
+      if (PeekIs('=') || PeekIs('!')) {
+        ++pos_;
+        is_lookaround = true;
+      } else {
+        // Named capturing group.
+        while (!AtEnd() && Peek() != '>') {
+          ++pos_;
+        }
+        if (AtEnd()) {
+          return false;
+        }
+        ++pos_;
+      }
+    } else if (c == '#') {
+      // Comment.
+      while (!AtEnd() && Peek() != ')') {
+        ++pos_;
+      }
+      if (AtEnd()) {
+        return false;
+      }
+      ++pos_;
+      return true;
+    } else {
+      // Flags, either for the rest of the enclosing group, e.g. (?i), or for
+      // this group, e.g. (?i:...).
+      bool set_flags = true;
+      while (!AtEnd() && Peek() != ')' && Peek() != ':') {
+        switch (Peek()) {
+          case '-':
+            set_flags = false;
+            break;
+          case 'i':
+            case_insensitive_ = set_flags;
+            break;
+          case 'm':
+          case 's':
+          case 'w':
+            break;
+          default:
+            // E.g. 'x', which changes how the pattern is parsed.
+            return false;
+        }
+        ++pos_;
+      }
+      if (AtEnd()) {
+        return false;
+      }
+      if (Peek() == ')') {
+        ++pos_;
+        return true;
+      }
+      ++pos_;
+    }
+  }
+
+  if (!ParseAlternation(depth, part)) {
+    return false;
+  }
+  if (!PeekIs(')')) {
+    return false;
+  }
+  ++pos_;
+  case_insensitive_ = saved_case_insensitive;
+
+  // Lookarounds do not consume characters. What a lookahead requires is in the
+  // text, but not necessarily in the match, so this is conservative.
+  if (is_lookaround) {
+    *part = PatternPart();
+  }
+  return true;
+}
+
+bool PatternAnalyzer::ParseClass(PrefilterCharSet* chars) {
+  *chars = PrefilterCharSet();
+  bool negated = false;
+  if (PeekIs('^')) {
+    negated = true;
+    ++pos_;
+  }
+  if (PeekIs(']')) {
+    return false;
+  }
+
+  while (true) {
+    if (AtEnd()) {
+      return false;
+    }
+    const char c = Peek();
+    if (c == ']') {
+      ++pos_;
+      break;
+    }
+    // Nested sets, POSIX classes and set operations.
+    if (c == '[' ||
+        ((c == '&' || c == '-') && pos_ + 1 < pattern_.size() &&
+         pattern_[pos_ + 1] == c)) {
+      return false;
+    }
+
+    int first;
+    PrefilterCharSet member_chars;
+    if (!ParseClassMember(&first, &member_chars)) {
+      return false;
+    }
+    if (first >= 0 && PeekIs('-') && pos_ + 1 < pattern_.size() &&
+        pattern_[pos_ + 1] != ']') {
+      ++pos_;
+      int last;
+      if (!ParseClassMember(&last, &member_chars) || last < 0) {
+        return false;
+      }
+      if (last >= kNonAsciiChar) {
+        member_chars.non_ascii = true;
+      }
+      member_chars.AddRange(first, last);
+    } else if (first >= 0) {
+      member_chars.Add(first);
+    }
+    chars->AddAll(member_chars);
+  }
+
+  if (negated) {
+    *chars = PrefilterCharSet::All();
+  } else {
+    CaseFold(chars);
+  }
+  return true;
+}
+
+bool PatternAnalyzer::ParseClassMember(int* literal, PrefilterCharSet* chars) {
+  *chars = PrefilterCharSet();
+  const char c = Peek();
+  if (c == '\\') {
+    ++pos_;
+    bool zero_width;
+    int max_length;
+    if (!ParseEscape(/*in_class=*/true, literal, chars, &zero_width,
+                     &max_length)) {
+      return false;
+    }
+    return !zero_width;
+  }
+  if (static_cast<unsigned char>(c) >= 0x80) {
+    SkipNonAsciiChar();
+    *literal = kNonAsciiChar;
+    return true;
+  }
+  ++pos_;
+  *literal = c;
+  return true;
+}
+
+bool PatternAnalyzer::ParseEscape(bool in_class, int* literal,
+                                  PrefilterCharSet* chars, bool* zero_width,
+                                  int* max_length) {
+  *literal = -1;
+  *chars = PrefilterCharSet();
+  *zero_width = false;
+  *max_length = 1;
+  if (AtEnd()) {
+    return false;
+  }
+  const char c = Peek();
+  ++pos_;
+  if (static_cast<unsigned char>(c) >= 0x80) {
+    --pos_;
+    SkipNonAsciiChar();
+    *literal = kNonAsciiChar;
+    return true;
+  }
+  switch (c) {
+    case 'd':
+      // Also matches non-ASCII decimal digits.
+      chars->AddRange('0', '9');
+      chars->non_ascii = true;
+      return true;
+    case 's':
+      chars->AddRange(0x09, 0x0d);
+      chars->AddRange(0x1c, 0x20);
+      chars->non_ascii = true;
+      return true;
+    case 'w':
+      chars->AddRange('a', 'z');
+      chars->AddRange('A', 'Z');
+      chars->AddRange('0', '9');
+      chars->Add('_');
+      chars->non_ascii = true;
+      return true;
+    case 'p':
+    case 'P':
+    case 'N':
+      // Property or named character, e.g. \p{L}, \pL, \N{SPACE}.
+      if (PeekIs('{')) {
+        while (!AtEnd() && Peek() != '}') {
+          ++pos_;
+        }
+        if (AtEnd()) {
+          return false;
+        }
+      }
+      if (AtEnd()) {
+        return false;
+      }
+      ++pos_;
+      *chars = PrefilterCharSet::All();
+      return true;
+    case 'D':
+    case 'S':
+    case 'W':
+    case 'h':
+    case 'H':
+    case 'v':
+    case 'V':
+      *chars = PrefilterCharSet::All();
+      return true;
+    case 'R':
+      // Also matches "\r\n".
+      *chars = PrefilterCharSet::All();
+      *max_length = 2;
+      return !in_class;
+    case 'X':
+      // A grapheme cluster.
+      *chars = PrefilterCharSet::All();
+      *max_length = kUnbounded;
+      return !in_class;
+    case 'b':
+    case 'B':
+    case 'A':
+    case 'z':
+    case 'Z':
+    case 'G':
+      if (in_class) {
+        return false;
+      }
+      *zero_width = true;
+      *max_length = 0;
+      return true;
+    case 't':
+      *literal = '\t';
+      return true;
+    case 'n':
+      *literal = '\n';
+      return true;
+    case 'r':
+      *literal = '\r';
+      return true;
+    case 'f':
+      *literal = '\f';
+      return true;
+    case 'a':
+      *literal = 0x07;
+      return true;
+    case 'e':
+      *literal = 0x1b;
+      return true;
+    case 'x':
+      return ParseHexEscape(/*max_digits=*/2, /*allow_braces=*/true, literal);
+    case 'u':
+      return ParseHexEscape(/*max_digits=*/4, /*allow_braces=*/false, literal);
+    case 'U':
+      return ParseHexEscape(/*max_digits=*/8, /*allow_braces=*/false, literal);
+    case 'c':
+      if (AtEnd()) {
+        return false;
+      }
+      *literal = Peek() & 0x1f;
+      ++pos_;
+      return true;
+    case '0': {
+      int value = 0;
+      for (int i = 0; i < 3 && !AtEnd() && Peek() >= '0' && Peek() <= '7';
+           ++i) {
+        value = value * 8 + (Peek() - '0');
+        ++pos_;
+      }
+      *literal = value;
+      return true;
+    }
+    default:
+      break;
+  }
+  if (IsAsciiDigit(c)) {
+    // A back reference, which may match the empty string, and which is
+    // reported as zero-width with an unbounded length.
+    if (in_class) {
+      return false;
+    }
+    while (!AtEnd() && IsAsciiDigit(Peek())) {
+      ++pos_;
+    }
+    *zero_width = true;
+    *max_length = kUnbounded;
+    return true;
+  }
+  if (IsAsciiLetter(c)) {
+    // Including \Q...\E quoting and \k<name> back references.
+    return false;
+  }
+  *literal = c;
+  return true;
+}
+
+bool PatternAnalyzer::ParseHexEscape(int max_digits, bool allow_braces,
+                                     int* value) {
+  *value = 0;
+  if (allow_braces && PeekIs('{')) {
+    ++pos_;
+    int num_digits = 0;
+    while (!AtEnd() && HexDigitValue(Peek()) >= 0) {
+      *value = std::min(*value * 16 + HexDigitValue(Peek()), 0x110000);
+      ++num_digits;
+      ++pos_;
+    }
+    if (num_digits == 0 || !PeekIs('}')) {
+      return false;
+    }
+    ++pos_;
+  } else {
+    for (int i = 0; i < max_digits; ++i) {
+      if (AtEnd() || HexDigitValue(Peek()) < 0) {
+        return false;
+      }
+      *value = std::min(*value * 16 + HexDigitValue(Peek()), 0x110000);
+      ++pos_;
+    }
+  }
+  *value = std::min(*value, kNonAsciiChar);
+  return true;
+}
+
+void PatternAnalyzer::AddLiteral(int literal, PrefilterCharSet* chars) const {
+  chars->Add(literal);
+  CaseFold(chars);
+}
+
+void PatternAnalyzer::CaseFold(PrefilterCharSet* chars) const {
+  if (!case_insensitive_) {
+    return;
+  }
+
+  // Non-ASCII characters can fold to ASCII ones (e.g. KELVIN SIGN to 'k'), and
+  // ASCII letters to non-ASCII ones (e.g. "ss" to U+00DF).
+  if (chars->non_ascii) {
+    *chars = PrefilterCharSet::All();
+    return;
+  }
+  bool has_letters = false;
+  for (int c = 'a'; c <= 'z'; ++c) {
+    const int upper = c - 'a' + 'A';
+    PrefilterCharSet lower_set, upper_set;
+    lower_set.Add(c);
+    upper_set.Add(upper);
+    if (chars->Intersects(lower_set) || chars->Intersects(upper_set)) {
+      chars->Add(c);
+      chars->Add(upper);
+      has_letters = true;
+    }
+  }
+  if (has_letters) {
+    chars->non_ascii = true;
+  }
+}
+
+}  // namespace
+
+RegexPrefilter RegexPrefilter::ForPattern(StringPiece pattern) {
+  RegexPrefilter result;
+  PatternAnalyzer analyzer(pattern);
+  PatternPart part;
+  if (analyzer.Analyze(&part)) {
+    result.required_sets_ = std::move(part.required);
+    result.min_length_ = (part.min_thirds + 2) / 3;
+    result.max_length_ = part.max_length;
+    result.first_chars_ = part.first_chars;
+  }
+  return result;
+}
+
+}  // namespace libtextclassifier2
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Cheap necessary conditions for regular expressions to match, used to skip
+// running them on texts they cannot match in.
+
+#ifndef LIBTEXTCLASSIFIER_UTIL_UTF8_REGEX_PREFILTER_H_
+#define LIBTEXTCLASSIFIER_UTIL_UTF8_REGEX_PREFILTER_H_
+
+#include <vector>
+
+#include "util/base/integral_types.h"
+#include "util/strings/stringpiece.h"
+
+namespace libtextclassifier2 {
+
+// A set of characters: the ASCII characters individually, and the non-ASCII
+// ones all together.
+struct PrefilterCharSet {
+  uint64 ascii[2] = {0, 0};
+  bool non_ascii = false;
+
+  // Adds a character, given as a codepoint or a UTF16 code unit.
+  void Add(int codepoint) {
+    if (codepoint < 0x80) {
+      ascii[codepoint >> 6] |= uint64{1} << (codepoint & 63);
+    } else {
+      non_ascii = true;
+    }
+  }
+
+  // Adds the ASCII characters 'first' to 'last', inclusive.
+  void AddRange(int first, int last);
+
+  void AddAll(const PrefilterCharSet& other) {
+    ascii[0] |= other.ascii[0];
+    ascii[1] |= other.ascii[1];
+    non_ascii |= other.non_ascii;
+  }
+
+  bool Intersects(const PrefilterCharSet& other) const {
+    return (ascii[0] & other.ascii[0]) != 0 ||
+           (ascii[1] & other.ascii[1]) != 0 ||
+           (non_ascii && other.non_ascii);
+  }
+
+  bool operator==(const PrefilterCharSet& other) const {
+    return ascii[0] == other.ascii[0] && ascii[1] == other.ascii[1] &&
+           non_ascii == other.non_ascii;
+  }
+
+  // Returns the set of all characters.
+  static PrefilterCharSet All();
+};
+
+// A necessary condition for a regular expression to find a match in a text:
+// for each of its required sets, the text contains a character of the set.
+// E.g. "[a-z]+@[a-z]+" requires a '@' and an ASCII letter or a non-ASCII
+// character. The condition is derived conservatively from the pattern, so it
+// never rejects a text that the pattern would match in.
+//
+// For matching a whole text, there are also bounds on its length and its
+// possible first characters, see MayMatchWhole().
+class RegexPrefilter {
+ public:
+  // Stands for no upper bound on the match length.
+  static constexpr int kUnboundedLength = 1 << 30;
+
+  // Creates a prefilter that accepts all texts.
+  RegexPrefilter() : first_chars_(PrefilterCharSet::All()) {}
+
+  // Analyzes the pattern in ICU regex syntax, given as UTF8. Patterns, or
+  // parts of them, that use syntax the analysis does not handle contribute no
+  // requirements.
+  static RegexPrefilter ForPattern(StringPiece pattern);
+
+  // Returns whether the pattern may match in a text that contains exactly the
+  // characters of 'text_chars'.
+  bool MayMatch(const PrefilterCharSet& text_chars) const {
+    for (const PrefilterCharSet& required : required_sets_) {
+      if (!required.Intersects(text_chars)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Returns whether the pattern may match the whole of a text with
+  // 'num_codepoints' codepoints and the given first codepoint, which is
+  // ignored for empty texts. Does not check the required sets.
+  bool MayMatchWhole(int num_codepoints, int first_codepoint) const {
+    if (num_codepoints < min_length_ || num_codepoints > max_length_) {
+      return false;
+    }
+    if (num_codepoints == 0) {
+      return true;
+    }
+    PrefilterCharSet first;
+    first.Add(first_codepoint);
+    return first.Intersects(first_chars_);
+  }
+
+  // Returns whether the prefilter rejects any texts at all.
+  bool IsRestrictive() const { return !required_sets_.empty(); }
+
+  const std::vector<PrefilterCharSet>& required_sets() const {
+    return required_sets_;
+  }
+
+  // Bounds on the number of codepoints of a match.
+  int min_length() const { return min_length_; }
+  int max_length() const { return max_length_; }
+
+  // The characters that a non-empty match can start with.
+  const PrefilterCharSet& first_chars() const { return first_chars_; }
+
+ private:
+  std::vector<PrefilterCharSet> required_sets_;
+  int min_length_ = 0;
+  int max_length_ = kUnboundedLength;
+  PrefilterCharSet first_chars_;
+};
+
+}  // namespace libtextclassifier2
+
+#endif  // LIBTEXTCLASSIFIER_UTIL_UTF8_REGEX_PREFILTER_H_
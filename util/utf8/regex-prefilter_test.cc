@@ -0,0 +1,241 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/utf8/regex-prefilter.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "util/utf8/unicodetext.h"
+#include "util/utf8/unilib.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+PrefilterCharSet CharsOf(const std::string& text) {
+  PrefilterCharSet chars;
+  for (const char32 codepoint : UTF8ToUnicodeText(text, /*do_copy=*/false)) {
+    chars.Add(codepoint);
+  }
+  return chars;
+}
+
+bool MayMatch(const std::string& pattern, const std::string& text) {
+  return RegexPrefilter::ForPattern(pattern).MayMatch(CharsOf(text));
+}
+
+TEST(RegexPrefilterTest, RequiresLiterals) {
+  EXPECT_TRUE(MayMatch("[a-z]+@[a-z]+", "mail me at a@b"));
+  EXPECT_FALSE(MayMatch("[a-z]+@[a-z]+", "mail me at home"));
+  EXPECT_FALSE(MayMatch("[a-z]+@[a-z]+", "@@@"));
+  EXPECT_TRUE(MayMatch("Obama", "ab Om"));
+  EXPECT_FALSE(MayMatch("Obama", "Oba"));
+}
+
+TEST(RegexPrefilterTest, RequiresDigits) {
+  const std::string phone = "(\\+?\\d{1,3}[ -])?\\(?\\d{3}\\)?[ -]?\\d{4}";
+  EXPECT_TRUE(MayMatch(phone, "call 555 1234"));
+  EXPECT_FALSE(MayMatch(phone, "call me later"));
+  // \d also matches non-ASCII digits.
+  EXPECT_TRUE(MayMatch(phone, "call ١٢٣٤"));
+}
+
+TEST(RegexPrefilterTest, OptionalPartsRequireNothing) {
+  EXPECT_TRUE(MayMatch("a?b*c{0,2}(de)*", ""));
+  EXPECT_FALSE(RegexPrefilter::ForPattern("a?b*(x|y)?").IsRestrictive());
+  EXPECT_FALSE(MayMatch("a?b+", "aaa"));
+  EXPECT_FALSE(MayMatch("a{2,}", "bbb"));
+}
+
+TEST(RegexPrefilterTest, Alternation) {
+  const std::string pattern = "(jan|feb|mar)\\.? \\d+";
+  EXPECT_TRUE(MayMatch(pattern, "feb 2"));
+  EXPECT_FALSE(MayMatch(pattern, "see you soon"));
+  EXPECT_FALSE(MayMatch(pattern, "jan ."));
+  // A branch that requires nothing makes the alternation require nothing.
+  EXPECT_FALSE(RegexPrefilter::ForPattern("x|y*").IsRestrictive());
+}
+
+TEST(RegexPrefilterTest, CaseInsensitive) {
+  EXPECT_TRUE(MayMatch("(?i)obama", "OBAMA"));
+  EXPECT_FALSE(MayMatch("(?i)obama", "1234"));
+  EXPECT_TRUE(MayMatch("(?i:x)y", "Xy"));
+  EXPECT_FALSE(MayMatch("(?i:x)y", "XY"));
+  // Letters can match non-ASCII characters case-insensitively.
+  EXPECT_TRUE(MayMatch("(?i)k", "\xE2\x84\xAA"));
+}
+
+TEST(RegexPrefilterTest, NegatedClassesAndDotRequireAnything) {
+  EXPECT_TRUE(MayMatch("[^a]", "b"));
+  EXPECT_TRUE(MayMatch(".", "b"));
+  EXPECT_FALSE(MayMatch("[^a]x", "b"));
+}
+
+TEST(RegexPrefilterTest, UnsupportedSyntaxRequiresNothing) {
+  EXPECT_FALSE(RegexPrefilter::ForPattern("(?x) a b").IsRestrictive());
+  EXPECT_FALSE(RegexPrefilter::ForPattern("\\Qab\\E").IsRestrictive());
+  EXPECT_FALSE(RegexPrefilter::ForPattern("[[a-z]&&[b]]").IsRestrictive());
+  EXPECT_FALSE(RegexPrefilter::ForPattern("a)").IsRestrictive());
+  EXPECT_FALSE(RegexPrefilter::ForPattern("(a").IsRestrictive());
+}
+
+bool MayMatchWhole(const std::string& pattern, const std::string& text) {
+  const UnicodeText unicode_text = UTF8ToUnicodeText(text, /*do_copy=*/false);
+  return RegexPrefilter::ForPattern(pattern).MayMatchWhole(
+      unicode_text.size_codepoints(),
+      unicode_text.empty() ? 0 : *unicode_text.begin());
+}
+
+TEST(RegexPrefilterTest, LengthBoundsAndFirstChars) {
+  RegexPrefilter prefilter = RegexPrefilter::ForPattern("(ab|c)\\b\\d{2,4}x?");
+  EXPECT_EQ(prefilter.min_length(), 3);
+  EXPECT_EQ(prefilter.max_length(), 7);
+  EXPECT_EQ(prefilter.first_chars(), CharsOf("ac"));
+
+  prefilter = RegexPrefilter::ForPattern("a?(?=b)[b-c]+");
+  EXPECT_EQ(prefilter.min_length(), 1);
+  EXPECT_EQ(prefilter.max_length(), RegexPrefilter::kUnboundedLength);
+  EXPECT_EQ(prefilter.first_chars(), CharsOf("abc"));
+
+  EXPECT_TRUE(MayMatchWhole("\\d{1,2}:\\d\\d", "12:30"));
+  EXPECT_FALSE(MayMatchWhole("\\d{1,2}:\\d\\d", "12:30 pm"));
+  EXPECT_FALSE(MayMatchWhole("\\d{1,2}:\\d\\d", "1:3"));
+  EXPECT_FALSE(MayMatchWhole("\\d{1,2}:\\d\\d", "at 1:30"));
+  EXPECT_TRUE(MayMatchWhole("x*", ""));
+  EXPECT_FALSE(MayMatchWhole("x+", ""));
+
+  // A case-insensitive character can match up to three, and be matched by
+  // non-ASCII characters.
+  EXPECT_TRUE(MayMatchWhole("(?i)ffi", "\xEF\xAC\x83"));
+  EXPECT_TRUE(MayMatchWhole("(?i)\xEF\xAC\x83", "FFI"));
+  EXPECT_FALSE(MayMatchWhole("(?i)ffi", "1ffi"));
+  EXPECT_FALSE(MayMatchWhole("(?i)ss", "sssssss"));
+
+  // Unsupported syntax allows anything.
+  EXPECT_TRUE(MayMatchWhole("(?x) a b", "ab"));
+  EXPECT_TRUE(MayMatchWhole("(.)\\1", "aa"));
+}
+
+#ifdef LIBTEXTCLASSIFIER_UNILIB_ICU
+// The prefilter must never reject a text that the pattern has a match in.
+TEST(RegexPrefilterTest, NeverRejectsMatches) {
+  CREATE_UNILIB_FOR_TESTING;
+  const std::vector<std::string> patterns = {
+      "[a-zA-Z]{2}\\d{2,4}",
+      "([a-zA-Z]{2} ?\\d{2,4})",
+      " (Barack Obama) ",
+      "(?i)\\b(jan(uary)?|feb(ruary)?)\\b\\s+\\d{1,2}",
+      "\\d{1,2}[/.-]\\d{1,2}([/.-]\\d{2,4})?",
+      "[\\w.+-]+@[\\w-]+\\.[\\w.-]+",
+      "(?<year>\\d{4})-(?<month>\\d\\d)",
+      "(a|b)(?=c)",
+      "(?<!x)y",
+      "\\x41\\u0042\\x{43}",
+      "[^\\s]+\\s[^\\s]+",
+      "(?i)stra\xC3\x9F" "e",
+      "(?i)[k-m]+",
+      "\\p{Lu}\\p{Ll}+",
+      "\\$\\d+(\\.\\d\\d)?",
+      "(.)\\1",
+      "caf\xC3\xA9",
+      "[\xC3\xA0-\xC3\xBF]n",
+      "^\\s*$",
+      "\\(\\d{3}\\) \\d{3}-\\d{4}",
+      "(?i)ffi",
+      "(?i)ss",
+      "a{2,3}b?",
+      "\\R",
+      "\\X",
+      "(?i)\\bfeb\\b",
+  };
+  const std::vector<std::string> texts = {
+      "",
+      "Flight LX38 to Zurich",
+      "LX 1234",
+      "I saw Barack Obama today",
+      "see you on January 12",
+      "FEB 3",
+      "on 12/31/2017 or 1.2.18",
+      "mail john.doe+x@example.com",
+      "2017-12",
+      "ac bc",
+      "zy",
+      "ABC",
+      "one two",
+      "STRASSE",
+      "\xE2\x84\xAA",
+      "kKlLmM",
+      "Hello",
+      "$12.99",
+      "aa",
+      "caf\xC3\xA9",
+      "\xC3\xA9n",
+      "   ",
+      "(800) 123-4567",
+      "\xD9\xA1\xD9\xA2/\xD9\xA3",
+      "\xEF\xAC\x83",
+      "\xC3\x9F",
+      "\r\n",
+      "e\xCC\x81",
+      "aab",
+      "feb",
+  };
+  for (const std::string& pattern : patterns) {
+    const RegexPrefilter prefilter = RegexPrefilter::ForPattern(pattern);
+    std::unique_ptr<UniLib::RegexPattern> regex = unilib.CreateRegexPattern(
+        UTF8ToUnicodeText(pattern, /*do_copy=*/false));
+    ASSERT_TRUE(regex) << pattern;
+    for (const std::string& text : texts) {
+      const std::unique_ptr<UniLib::RegexMatcher> matcher =
+          regex->Matcher(UTF8ToUnicodeText(text, /*do_copy=*/false));
+      int status;
+      if (matcher->Find(&status)) {
+        EXPECT_TRUE(prefilter.MayMatch(CharsOf(text)))
+            << "Pattern: " << pattern << " text: " << text;
+      }
+      if (regex->Matcher(UTF8ToUnicodeText(text, /*do_copy=*/false))
+              ->Matches(&status)) {
+        EXPECT_TRUE(MayMatchWhole(pattern, text))
+            << "Pattern: " << pattern << " text: " << text;
+      }
+    }
+  }
+}
+
+TEST(RegexPrefilterTest, RegexPatternMayMatch) {
+  CREATE_UNILIB_FOR_TESTING;
+  std::unique_ptr<UniLib::RegexPattern> regex = unilib.CreateRegexPattern(
+      UTF8ToUnicodeText("\\d+@", /*do_copy=*/false));
+  EXPECT_TRUE(regex->MayMatch(*unilib.CreateRegexInput(
+      UTF8ToUnicodeText("12@ \xF0\x9F\x98\x8B", /*do_copy=*/false))));
+  EXPECT_FALSE(regex->MayMatch(*unilib.CreateRegexInput(
+      UTF8ToUnicodeText("12 \xF0\x9F\x98\x8B", /*do_copy=*/false))));
+
+  EXPECT_TRUE(regex->MayMatchWhole(*unilib.CreateRegexInput(
+      UTF8ToUnicodeText("12@", /*do_copy=*/false))));
+  EXPECT_FALSE(regex->MayMatchWhole(*unilib.CreateRegexInput(
+      UTF8ToUnicodeText("@12@", /*do_copy=*/false))));
+  EXPECT_FALSE(regex->MayMatchWhole(*unilib.CreateRegexInput(
+      UTF8ToUnicodeText("12", /*do_copy=*/false))));
+}
+#endif  // LIBTEXTCLASSIFIER_UNILIB_ICU
+
+}  // namespace
+}  // namespace libtextclassifier2
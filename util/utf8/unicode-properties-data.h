@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Tables of the Unicode character properties that UniLib needs, generated
+// from ICU by unicode-properties_generator.cc into unicode-properties-data.cc,
+// for the builds that don't link ICU. Use the functions of
+// unicode-properties.h instead of the tables.
+
+#ifndef LIBTEXTCLASSIFIER_UTIL_UTF8_UNICODE_PROPERTIES_DATA_H_
+#define LIBTEXTCLASSIFIER_UTIL_UTF8_UNICODE_PROPERTIES_DATA_H_
+
+#include "util/base/integral_types.h"
+
+namespace libtextclassifier2 {
+namespace internal {
+
+// The codepoints first, first + stride, ..., up to last map to themselves
+// plus delta.
+struct CodepointMappingRange {
+  char32 first;
+  char32 last;
+  int32 delta;
+  int32 stride;
+};
+
+// A codepoint whose full case folding is more than one codepoint.
+struct CaseFoldingExpansion {
+  char32 codepoint;
+  const char* folded_utf8;
+};
+
+struct BracketPair {
+  char32 codepoint;
+  char32 paired_bracket;
+};
+
+// The codepoints from kPropertyRunStarts[i] up to the next start all have the
+// properties kPropertyRunValues[i], a mask of UnicodeProperty values.
+extern const char32 kPropertyRunStarts[];
+extern const uint8 kPropertyRunValues[];
+extern const int kNumPropertyRuns;
+
+// Sorted by codepoint.
+extern const CodepointMappingRange kLowercaseMappings[];
+extern const int kNumLowercaseMappings;
+extern const CodepointMappingRange kSimpleCaseFoldings[];
+extern const int kNumSimpleCaseFoldings;
+extern const CaseFoldingExpansion kCaseFoldingExpansions[];
+extern const int kNumCaseFoldingExpansions;
+extern const BracketPair kBracketPairs[];
+extern const int kNumBracketPairs;
+
+// The zero digits of the decimal digit blocks, each followed by the digits
+// one to nine.
+extern const char32 kDigitZeros[];
+extern const int kNumDigitZeros;
+
+}  // namespace internal
+}  // namespace libtextclassifier2
+
+#endif  // LIBTEXTCLASSIFIER_UTIL_UTF8_UNICODE_PROPERTIES_DATA_H_
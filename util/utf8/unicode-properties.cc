@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/utf8/unicode-properties.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "util/utf8/unicode-properties-data.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+// Returns the range of the mapping that contains the codepoint, or nullptr.
+const internal::CodepointMappingRange* FindMappingRange(
+    const internal::CodepointMappingRange* ranges, int num_ranges,
+    char32 codepoint) {
+  const internal::CodepointMappingRange* end = ranges + num_ranges;
+  const internal::CodepointMappingRange* range = std::lower_bound(
+      ranges, end, codepoint,
+      [](const internal::CodepointMappingRange& range, char32 codepoint) {
+        return range.last < codepoint;
+      });
+  if (range == end || range->first > codepoint ||
+      (codepoint - range->first) % range->stride != 0) {
+    return nullptr;
+  }
+  return range;
+}
+
+char32 MapCodepoint(const internal::CodepointMappingRange* ranges,
+                    int num_ranges, char32 codepoint) {
+  const internal::CodepointMappingRange* range =
+      FindMappingRange(ranges, num_ranges, codepoint);
+  return range == nullptr ? codepoint : codepoint + range->delta;
+}
+
+}  // namespace
+
+uint8 GetUnicodeProperties(char32 codepoint) {
+  if (codepoint < 0) {
+    return 0;
+  }
+  const char32* end =
+      internal::kPropertyRunStarts + internal::kNumPropertyRuns;
+  const char32* run =
+      std::upper_bound(internal::kPropertyRunStarts, end, codepoint);
+  return internal::kPropertyRunValues[run - internal::kPropertyRunStarts - 1];
+}
+
+char32 UnicodeToLower(char32 codepoint) {
+  return MapCodepoint(internal::kLowercaseMappings,
+                      internal::kNumLowercaseMappings, codepoint);
+}
+
+char32 UnicodePairedBracket(char32 codepoint) {
+  const internal::BracketPair* end =
+      internal::kBracketPairs + internal::kNumBracketPairs;
+  const internal::BracketPair* pair = std::lower_bound(
+      internal::kBracketPairs, end, codepoint,
+      [](const internal::BracketPair& pair, char32 codepoint) {
+        return pair.codepoint < codepoint;
+      });
+  if (pair == end || pair->codepoint != codepoint) {
+    return codepoint;
+  }
+  return pair->paired_bracket;
+}
+
+int UnicodeDigitValue(char32 codepoint) {
+  if (!HasUnicodeProperty(codepoint, kUnicodeDecimalDigit)) {
+    return -1;
+  }
+  const char32* end = internal::kDigitZeros + internal::kNumDigitZeros;
+  const char32* zero =
+      std::upper_bound(internal::kDigitZeros, end, codepoint) - 1;
+  return codepoint - *zero;
+}
+
+void AppendUnicodeCaseFolding(char32 codepoint, UnicodeText* folded) {
+  const internal::CaseFoldingExpansion* end =
+      internal::kCaseFoldingExpansions + internal::kNumCaseFoldingExpansions;
+  const internal::CaseFoldingExpansion* expansion = std::lower_bound(
+      internal::kCaseFoldingExpansions, end, codepoint,
+      [](const internal::CaseFoldingExpansion& expansion, char32 codepoint) {
+        return expansion.codepoint < codepoint;
+      });
+  if (expansion != end && expansion->codepoint == codepoint) {
+    folded->AppendUTF8(expansion->folded_utf8,
+                       strlen(expansion->folded_utf8));
+    return;
+  }
+  folded->AppendCodepoint(MapCodepoint(internal::kSimpleCaseFoldings,
+                                       internal::kNumSimpleCaseFoldings,
+                                       codepoint));
+}
+
+}  // namespace libtextclassifier2
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBTEXTCLASSIFIER_UTIL_UTF8_UNICODE_PROPERTIES_H_
+#define LIBTEXTCLASSIFIER_UTIL_UTF8_UNICODE_PROPERTIES_H_
+
+#include "util/base/integral_types.h"
+#include "util/utf8/unicodetext.h"
+
+namespace libtextclassifier2 {
+
+// Character properties of the Unicode codepoints, as ICU defines them, looked
+// up in compact tables generated from ICU instead of linking it.
+enum UnicodeProperty : uint8 {
+  // u_isWhitespace(): Java whitespace, i.e. spaces without the no-break ones,
+  // the line and paragraph separators and the ASCII control whitespace.
+  kUnicodeWhitespace = 1 << 0,
+
+  // The White_Space binary property, i.e. what ICU regexes match with \s.
+  kUnicodeWhiteSpaceProperty = 1 << 1,
+
+  // General category Nd.
+  kUnicodeDecimalDigit = 1 << 2,
+
+  // General category Lu.
+  kUnicodeUppercaseLetter = 1 << 3,
+
+  // General categories L*.
+  kUnicodeLetter = 1 << 4,
+
+  // What ICU regexes match with \w: Alphabetic, M*, Nd, Pc, ZWNJ and ZWJ.
+  kUnicodeRegexWord = 1 << 5,
+
+  // Bidi_Paired_Bracket_Type Open and Close.
+  kUnicodeOpeningBracket = 1 << 6,
+  kUnicodeClosingBracket = 1 << 7,
+};
+
+// Returns the mask of the properties of the codepoint.
+uint8 GetUnicodeProperties(char32 codepoint);
+
+inline bool HasUnicodeProperty(char32 codepoint, UnicodeProperty property) {
+  return (GetUnicodeProperties(codepoint) & property) != 0;
+}
+
+// Returns the simple lowercase mapping of the codepoint, as u_tolower().
+char32 UnicodeToLower(char32 codepoint);
+
+// Returns the Bidi_Paired_Bracket of the codepoint, or the codepoint itself.
+char32 UnicodePairedBracket(char32 codepoint);
+
+// Returns the value of a decimal digit, or -1 for the other codepoints.
+int UnicodeDigitValue(char32 codepoint);
+
+// Appends the full case folding of the codepoint to the text.
+void AppendUnicodeCaseFolding(char32 codepoint, UnicodeText* folded);
+
+}  // namespace libtextclassifier2
+
+#endif  // LIBTEXTCLASSIFIER_UTIL_UTF8_UNICODE_PROPERTIES_H_
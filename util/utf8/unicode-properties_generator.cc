@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Generates unicode-properties-data.cc from the character properties of the
+// ICU it is built with:
+//
+//   unicode-properties_generator > util/utf8/unicode-properties-data.cc
+//
+// Not part of the library.
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "util/base/integral_types.h"
+#include "util/utf8/unicode-properties.h"
+#include "unicode/uchar.h"
+#include "unicode/unistr.h"
+#include "unicode/uvernum.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+const char32 kMaxCodepoint = 0x10FFFF;
+
+uint8 ComputeProperties(char32 c) {
+  const int bracket_type =
+      u_getIntPropertyValue(c, UCHAR_BIDI_PAIRED_BRACKET_TYPE);
+  const bool regex_word =
+      u_hasBinaryProperty(c, UCHAR_ALPHABETIC) ||
+      (U_GET_GC_MASK(c) & (U_GC_M_MASK | U_GC_ND_MASK | U_GC_PC_MASK)) != 0 ||
+      c == 0x200C || c == 0x200D;
+  return (u_isWhitespace(c) ? kUnicodeWhitespace : 0) |
+         (u_hasBinaryProperty(c, UCHAR_WHITE_SPACE) ? kUnicodeWhiteSpaceProperty
+                                                    : 0) |
+         (u_charType(c) == U_DECIMAL_DIGIT_NUMBER ? kUnicodeDecimalDigit : 0) |
+         (u_charType(c) == U_UPPERCASE_LETTER ? kUnicodeUppercaseLetter : 0) |
+         ((U_GET_GC_MASK(c) & U_GC_L_MASK) != 0 ? kUnicodeLetter : 0) |
+         (regex_word ? kUnicodeRegexWord : 0) |
+         (bracket_type == U_BPT_OPEN ? kUnicodeOpeningBracket : 0) |
+         (bracket_type == U_BPT_CLOSE ? kUnicodeClosingBracket : 0);
+}
+
+struct MappingRange {
+  char32 first;
+  char32 last;
+  int32 delta;
+  int32 stride;
+};
+
+// Groups the codepoints that map to themselves plus the same delta, at
+// regular intervals, into ranges.
+template <typename MapFn>
+std::vector<MappingRange> ComputeMappingRanges(const MapFn& map) {
+  std::vector<MappingRange> ranges;
+  for (char32 c = 0; c <= kMaxCodepoint; ++c) {
+    const char32 mapped = map(c);
+    if (mapped == c) {
+      continue;
+    }
+    const int32 delta = mapped - c;
+    if (!ranges.empty()) {
+      MappingRange& range = ranges.back();
+      if (range.delta == delta && range.first == range.last &&
+          c - range.last <= 2) {
+        range.stride = c - range.last;
+        range.last = c;
+        continue;
+      }
+      if (range.delta == delta && c - range.last == range.stride) {
+        range.last = c;
+        continue;
+      }
+    }
+    ranges.push_back({c, c, delta, 1});
+  }
+  return ranges;
+}
+
+void PrintMappingRanges(const char* name,
+                        const std::vector<MappingRange>& ranges) {
+  printf("const CodepointMappingRange %s[] = {\n", name);
+  for (const MappingRange& range : ranges) {
+    printf("    {0x%X, 0x%X, %d, %d},\n", range.first, range.last, range.delta,
+           range.stride);
+  }
+  printf("};\nconst int kNum%s = %d;\n\n", name + 1,
+         static_cast<int>(ranges.size()));
+}
+
+std::string EscapeUTF8(const std::string& utf8) {
+  std::string escaped;
+  char buffer[8];
+  for (const char c : utf8) {
+    snprintf(buffer, sizeof(buffer), "\\x%02X", static_cast<uint8>(c));
+    escaped += buffer;
+  }
+  return escaped;
+}
+
+void Generate() {
+  printf("%s", R"(/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Generated by unicode-properties_generator.cc, do not edit.
+)");
+  printf("// ICU %s, Unicode %s.\n\n", U_ICU_VERSION, U_UNICODE_VERSION);
+  printf("#include \"util/utf8/unicode-properties-data.h\"\n\n");
+  printf("namespace libtextclassifier2 {\nnamespace internal {\n\n");
+
+  std::vector<char32> run_starts;
+  std::vector<uint8> run_values;
+  for (char32 c = 0; c <= kMaxCodepoint; ++c) {
+    const uint8 properties = ComputeProperties(c);
+    if (run_values.empty() || run_values.back() != properties) {
+      run_starts.push_back(c);
+      run_values.push_back(properties);
+    }
+  }
+  printf("const char32 kPropertyRunStarts[] = {\n");
+  for (int i = 0; i < run_starts.size(); ++i) {
+    printf("%s0x%X,%s", i % 8 == 0 ? "    " : " ", run_starts[i],
+           i % 8 == 7 ? "\n" : "");
+  }
+  printf("%s};\n", run_starts.size() % 8 == 0 ? "" : "\n");
+  printf("const uint8 kPropertyRunValues[] = {\n");
+  for (int i = 0; i < run_values.size(); ++i) {
+    printf("%s0x%02X,%s", i % 12 == 0 ? "    " : " ", run_values[i],
+           i % 12 == 11 ? "\n" : "");
+  }
+  printf("%s};\n", run_values.size() % 12 == 0 ? "" : "\n");
+  printf("const int kNumPropertyRuns = %d;\n\n",
+         static_cast<int>(run_starts.size()));
+
+  PrintMappingRanges("kLowercaseMappings", ComputeMappingRanges([](char32 c) {
+                       return u_tolower(c);
+                     }));
+  PrintMappingRanges("kSimpleCaseFoldings",
+                     ComputeMappingRanges([](char32 c) {
+                       return u_foldCase(c, U_FOLD_CASE_DEFAULT);
+                     }));
+
+  printf("const CaseFoldingExpansion kCaseFoldingExpansions[] = {\n");
+  int num_expansions = 0;
+  for (char32 c = 0; c <= kMaxCodepoint; ++c) {
+    icu::UnicodeString folded(c);
+    folded.foldCase();
+    if (folded.countChar32() > 1) {
+      std::string folded_utf8;
+      folded.toUTF8String(folded_utf8);
+      printf("    {0x%X, \"%s\"},\n", c, EscapeUTF8(folded_utf8).c_str());
+      ++num_expansions;
+    }
+  }
+  printf("};\nconst int kNumCaseFoldingExpansions = %d;\n\n", num_expansions);
+
+  printf("const BracketPair kBracketPairs[] = {\n");
+  int num_brackets = 0;
+  for (char32 c = 0; c <= kMaxCodepoint; ++c) {
+    const char32 paired = u_getBidiPairedBracket(c);
+    if (paired != c) {
+      printf("    {0x%X, 0x%X},\n", c, paired);
+      ++num_brackets;
+    }
+  }
+  printf("};\nconst int kNumBracketPairs = %d;\n\n", num_brackets);
+
+  printf("const char32 kDigitZeros[] = {\n");
+  int num_zeros = 0;
+  for (char32 c = 0; c <= kMaxCodepoint; ++c) {
+    if (u_charType(c) == U_DECIMAL_DIGIT_NUMBER && u_charDigitValue(c) == 0) {
+      printf("%s0x%X,%s", num_zeros % 8 == 0 ? "    " : " ", c,
+             num_zeros % 8 == 7 ? "\n" : "");
+      ++num_zeros;
+    }
+  }
+  printf("%s};\nconst int kNumDigitZeros = %d;\n\n",
+         num_zeros % 8 == 0 ? "" : "\n", num_zeros);
+
+  printf("}  // namespace internal\n}  // namespace libtextclassifier2\n");
+}
+
+}  // namespace
+}  // namespace libtextclassifier2
+
+int main() {
+  libtextclassifier2::Generate();
+  return 0;
+}
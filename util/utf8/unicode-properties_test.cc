@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/utf8/unicode-properties.h"
+
+#include "gtest/gtest.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+TEST(UnicodePropertiesTest, Properties) {
+  EXPECT_TRUE(HasUnicodeProperty('a', kUnicodeLetter));
+  EXPECT_TRUE(HasUnicodeProperty('a', kUnicodeRegexWord));
+  EXPECT_FALSE(HasUnicodeProperty('a', kUnicodeUppercaseLetter));
+  EXPECT_TRUE(HasUnicodeProperty(0x0416, kUnicodeUppercaseLetter));  // Ж
+  EXPECT_TRUE(HasUnicodeProperty(0x0664, kUnicodeDecimalDigit));     // ٤
+  EXPECT_TRUE(HasUnicodeProperty(0x1D7D9, kUnicodeDecimalDigit));    // 𝟙
+  EXPECT_FALSE(HasUnicodeProperty(0x00B2, kUnicodeDecimalDigit));    // ²
+  EXPECT_TRUE(HasUnicodeProperty(0x0301, kUnicodeRegexWord));
+  EXPECT_FALSE(HasUnicodeProperty('-', kUnicodeRegexWord));
+  EXPECT_EQ(GetUnicodeProperties(0x10FFFF), 0);
+
+  // The no-break space is White_Space, but not Java whitespace.
+  EXPECT_TRUE(HasUnicodeProperty(0x00A0, kUnicodeWhiteSpaceProperty));
+  EXPECT_FALSE(HasUnicodeProperty(0x00A0, kUnicodeWhitespace));
+  EXPECT_TRUE(HasUnicodeProperty(0x3000, kUnicodeWhitespace));
+
+  EXPECT_TRUE(HasUnicodeProperty('(', kUnicodeOpeningBracket));
+  EXPECT_TRUE(HasUnicodeProperty(0xFF09, kUnicodeClosingBracket));  // ）
+  EXPECT_FALSE(HasUnicodeProperty('<', kUnicodeOpeningBracket));
+}
+
+TEST(UnicodePropertiesTest, Mappings) {
+  EXPECT_EQ(UnicodeToLower('A'), 'a');
+  EXPECT_EQ(UnicodeToLower('a'), 'a');
+  EXPECT_EQ(UnicodeToLower(0x0416), 0x0436);  // Ж
+  EXPECT_EQ(UnicodeToLower(0x0100), 0x0101);  // Ā
+  EXPECT_EQ(UnicodeToLower(0x0101), 0x0101);
+  EXPECT_EQ(UnicodeToLower(0x10400), 0x10428);  // 𐐀
+
+  EXPECT_EQ(UnicodePairedBracket('('), ')');
+  EXPECT_EQ(UnicodePairedBracket(']'), '[');
+  EXPECT_EQ(UnicodePairedBracket(0x300C), 0x300D);  // 「
+  EXPECT_EQ(UnicodePairedBracket('a'), 'a');
+
+  EXPECT_EQ(UnicodeDigitValue('7'), 7);
+  EXPECT_EQ(UnicodeDigitValue(0xFF13), 3);  // ３
+  EXPECT_EQ(UnicodeDigitValue(0x0669), 9);  // ٩
+  EXPECT_EQ(UnicodeDigitValue('a'), -1);
+}
+
+TEST(UnicodePropertiesTest, CaseFolding) {
+  UnicodeText folded;
+  for (const char32 codepoint :
+       UTF8ToUnicodeText("Straße ΣΑΣ ﬁ", /*do_copy=*/false)) {
+    AppendUnicodeCaseFolding(codepoint, &folded);
+  }
+  EXPECT_EQ(folded.ToUTF8String(), "strasse σασ fi");
+}
+
+}  // namespace
+}  // namespace libtextclassifier2
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/utf8/unicodetext-index.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+bool IsLeadByte(char c) { return (static_cast<uint8>(c) & 0xC0) != 0x80; }
+
+}  // namespace
+
+UnicodeTextIndex::UnicodeTextIndex(const UnicodeText& text)
+    : data_(text.data()), size_bytes_(text.size_bytes()) {
+  checkpoints_.reserve(size_bytes_ / kCheckpointInterval + 1);
+  for (int i = 0; i < size_bytes_; ++i) {
+    if (!IsLeadByte(data_[i])) {
+      continue;
+    }
+    if (num_codepoints_ % kCheckpointInterval == 0) {
+      checkpoints_.push_back(i);
+    }
+    ++num_codepoints_;
+  }
+}
+
+UnicodeText::const_iterator UnicodeTextIndex::IteratorAt(
+    int codepoint_index) const {
+  if (codepoint_index <= 0) {
+    return UnicodeText::const_iterator(data_);
+  }
+  if (codepoint_index >= num_codepoints_) {
+    return UnicodeText::const_iterator(data_ + size_bytes_);
+  }
+  const int checkpoint = codepoint_index / kCheckpointInterval;
+  int byte = checkpoints_[checkpoint];
+  for (int i = checkpoint * kCheckpointInterval; i < codepoint_index; ++i) {
+    do {
+      ++byte;
+    } while (byte < size_bytes_ && !IsLeadByte(data_[byte]));
+  }
+  return UnicodeText::const_iterator(data_ + byte);
+}
+
+std::string UnicodeTextIndex::UTF8Substring(std::pair<int, int> span) const {
+  return UnicodeText::UTF8Substring(IteratorAt(span.first),
+                                    IteratorAt(span.second));
+}
+
+}  // namespace libtextclassifier2
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBTEXTCLASSIFIER_UTIL_UTF8_UNICODETEXT_INDEX_H_
+#define LIBTEXTCLASSIFIER_UTIL_UTF8_UNICODETEXT_INDEX_H_
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "util/utf8/unicodetext.h"
+
+namespace libtextclassifier2 {
+
+// Random access to the codepoints of a UnicodeText. Remembers the byte offset
+// of every kCheckpointInterval-th codepoint in one pass over the text, after
+// which seeking to a codepoint index takes at most kCheckpointInterval - 1
+// steps instead of a walk from the beginning.
+//
+// The index points into the data of the text, so the text must outlive it
+// and must not be changed in the meantime.
+class UnicodeTextIndex {
+ public:
+  static const int kCheckpointInterval = 64;
+
+  explicit UnicodeTextIndex(const UnicodeText& text);
+
+  int NumCodepoints() const { return num_codepoints_; }
+
+  // Returns the iterator at the given codepoint index. Indices outside of the
+  // text are clamped to its beginning or end.
+  UnicodeText::const_iterator IteratorAt(int codepoint_index) const;
+
+  // Returns the iterators at both ends of a codepoint span.
+  UnicodeTextRange RangeAt(std::pair<int, int> span) const {
+    return {IteratorAt(span.first), IteratorAt(span.second)};
+  }
+
+  // Returns the UTF8 string of the codepoint span.
+  std::string UTF8Substring(std::pair<int, int> span) const;
+
+ private:
+  const char* data_;
+  int size_bytes_;
+  int num_codepoints_ = 0;
+
+  // The byte offset of codepoint i * kCheckpointInterval.
+  std::vector<int> checkpoints_;
+};
+
+}  // namespace libtextclassifier2
+
+#endif  // LIBTEXTCLASSIFIER_UTIL_UTF8_UNICODETEXT_INDEX_H_
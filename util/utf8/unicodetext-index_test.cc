@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/utf8/unicodetext-index.h"
+
+#include <iterator>
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+TEST(UnicodeTextIndexTest, MatchesAdvance) {
+  std::string text;
+  for (int i = 0; i < 100; ++i) {
+    text += "aé😁";
+  }
+  const UnicodeText unicode = UTF8ToUnicodeText(text, /*do_copy=*/false);
+  const UnicodeTextIndex index(unicode);
+  EXPECT_EQ(index.NumCodepoints(), 300);
+
+  auto it = unicode.begin();
+  for (int i = 0; i <= 300; ++i, ++it) {
+    EXPECT_TRUE(index.IteratorAt(i) == it) << i;
+  }
+}
+
+TEST(UnicodeTextIndexTest, ClampsIndices) {
+  const UnicodeText unicode = UTF8ToUnicodeText("hello", /*do_copy=*/false);
+  const UnicodeTextIndex index(unicode);
+  EXPECT_TRUE(index.IteratorAt(-1) == unicode.begin());
+  EXPECT_TRUE(index.IteratorAt(6) == unicode.end());
+}
+
+TEST(UnicodeTextIndexTest, Substring) {
+  const UnicodeText unicode =
+      UTF8ToUnicodeText("😁 Hellö wörld", /*do_copy=*/false);
+  const UnicodeTextIndex index(unicode);
+  EXPECT_EQ(index.UTF8Substring({2, 7}), "Hellö");
+  EXPECT_EQ(index.UTF8Substring({8, 13}), "wörld");
+  EXPECT_EQ(index.UTF8Substring({3, 3}), "");
+
+  const UnicodeTextRange range = index.RangeAt({0, 1});
+  EXPECT_EQ(*range.first, 0x1F601);
+  EXPECT_EQ(std::distance(range.first, range.second), 1);
+}
+
+TEST(UnicodeTextIndexTest, EmptyText) {
+  const UnicodeText unicode = UTF8ToUnicodeText("", /*do_copy=*/false);
+  const UnicodeTextIndex index(unicode);
+  EXPECT_EQ(index.NumCodepoints(), 0);
+  EXPECT_TRUE(index.IteratorAt(0) == unicode.end());
+}
+
+}  // namespace
+}  // namespace libtextclassifier2
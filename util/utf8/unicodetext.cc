@@ -186,7 +186,10 @@ UnicodeText& UnicodeText::AppendCodepoint(char32 ch) {
 void UnicodeText::clear() { repr_.clear(); }
 
 int UnicodeText::size_codepoints() const {
-  return std::distance(begin(), end());
+  int num_codepoints = 0;
+  CountUTF8Codepoints(repr_.data_, repr_.size_, &num_codepoints,
+                      /*num_supplementary_codepoints=*/nullptr);
+  return num_codepoints;
 }
 
 bool UnicodeText::empty() const { return size_bytes() == 0; }
@@ -296,4 +299,8 @@ UnicodeText UTF8ToUnicodeText(const std::string& str) {
   return UTF8ToUnicodeText(str, /*do_copy=*/true);
 }
 
+UnicodeText UTF8ToUnicodeText(StringPiece str, bool do_copy) {
+  return UTF8ToUnicodeText(str.data(), str.size(), do_copy);
+}
+
 }  // namespace libtextclassifier2
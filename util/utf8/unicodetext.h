@@ -22,9 +22,12 @@
 #include <utility>
 
 #include "util/base/integral_types.h"
+#include "util/strings/stringpiece.h"
 
 namespace libtextclassifier2 {
 
+class UnicodeTextIndex;
+
 // ***************************** UnicodeText **************************
 //
 // A UnicodeText object is a wrapper around a sequence of Unicode
@@ -133,6 +136,7 @@ class UnicodeText {
 
    private:
     friend class UnicodeText;
+    friend class UnicodeTextIndex;
     explicit const_iterator(const char* it) : it_(it) {}
 
     const char* it_;
@@ -218,6 +222,7 @@ UnicodeText UTF8ToUnicodeText(const char* utf8_buf, int len, bool do_copy);
 UnicodeText UTF8ToUnicodeText(const char* utf8_buf, bool do_copy);
 UnicodeText UTF8ToUnicodeText(const std::string& str, bool do_copy);
 UnicodeText UTF8ToUnicodeText(const std::string& str);
+UnicodeText UTF8ToUnicodeText(StringPiece str, bool do_copy);
 
 }  // namespace libtextclassifier2
 
@@ -16,8 +16,11 @@
 
 #include "util/utf8/unilib-icu.h"
 
+#include <string>
 #include <utility>
 
+#include "util/base/logging.h"
+
 namespace libtextclassifier2 {
 
 bool UniLib::ParseInt32(const UnicodeText& text, int* result) const {
@@ -40,52 +43,297 @@ bool UniLib::ParseInt32(const UnicodeText& text, int* result) const {
   return true;
 }
 
+namespace {
+
+// The properties of the Latin-1 codepoints, which make up most of the text,
+// computed once with ICU so that the fast paths below agree with it.
+class Latin1Properties {
+ public:
+  static constexpr int kSize = 0x100;
+
+  enum Property : uint8 {
+    kOpeningBracket = 1 << 0,
+    kClosingBracket = 1 << 1,
+    kWhitespace = 1 << 2,
+    kDigit = 1 << 3,
+    kUpper = 1 << 4,
+    kLetterOrDigit = 1 << 5,
+  };
+
+  static const Latin1Properties& Instance() {
+    static const Latin1Properties* const instance = new Latin1Properties();
+    return *instance;
+  }
+
+  static bool Contains(char32 codepoint) {
+    return codepoint >= 0 && codepoint < kSize;
+  }
+
+  bool Has(char32 codepoint, Property property) const {
+    return (properties_[codepoint] & property) != 0;
+  }
+  char32 Lower(char32 codepoint) const { return lower_[codepoint]; }
+  char32 PairedBracket(char32 codepoint) const {
+    return paired_bracket_[codepoint];
+  }
+
+ private:
+  Latin1Properties() {
+    for (char32 codepoint = 0; codepoint < kSize; ++codepoint) {
+      const int bracket_type =
+          u_getIntPropertyValue(codepoint, UCHAR_BIDI_PAIRED_BRACKET_TYPE);
+      properties_[codepoint] =
+          (bracket_type == U_BPT_OPEN ? kOpeningBracket : 0) |
+          (bracket_type == U_BPT_CLOSE ? kClosingBracket : 0) |
+          (u_isWhitespace(codepoint) ? kWhitespace : 0) |
+          (u_isdigit(codepoint) ? kDigit : 0) |
+          (u_isupper(codepoint) ? kUpper : 0) |
+          (u_isalnum(codepoint) ? kLetterOrDigit : 0);
+      lower_[codepoint] = u_tolower(codepoint);
+      paired_bracket_[codepoint] = u_getBidiPairedBracket(codepoint);
+    }
+  }
+
+  uint8 properties_[kSize];
+  char32 lower_[kSize];
+  char32 paired_bracket_[kSize];
+};
+
+}  // namespace
+
 bool UniLib::IsOpeningBracket(char32 codepoint) const {
+  if (Latin1Properties::Contains(codepoint)) {
+    return Latin1Properties::Instance().Has(codepoint,
+                                            Latin1Properties::kOpeningBracket);
+  }
   return u_getIntPropertyValue(codepoint, UCHAR_BIDI_PAIRED_BRACKET_TYPE) ==
          U_BPT_OPEN;
 }
 
 bool UniLib::IsClosingBracket(char32 codepoint) const {
+  if (Latin1Properties::Contains(codepoint)) {
+    return Latin1Properties::Instance().Has(codepoint,
+                                            Latin1Properties::kClosingBracket);
+  }
   return u_getIntPropertyValue(codepoint, UCHAR_BIDI_PAIRED_BRACKET_TYPE) ==
          U_BPT_CLOSE;
 }
 
 bool UniLib::IsWhitespace(char32 codepoint) const {
+  if (Latin1Properties::Contains(codepoint)) {
+    return Latin1Properties::Instance().Has(codepoint,
+                                            Latin1Properties::kWhitespace);
+  }
   return u_isWhitespace(codepoint);
 }
 
-bool UniLib::IsDigit(char32 codepoint) const { return u_isdigit(codepoint); }
+bool UniLib::IsDigit(char32 codepoint) const {
+  if (Latin1Properties::Contains(codepoint)) {
+    return Latin1Properties::Instance().Has(codepoint,
+                                            Latin1Properties::kDigit);
+  }
+  return u_isdigit(codepoint);
+}
 
-bool UniLib::IsUpper(char32 codepoint) const { return u_isupper(codepoint); }
+bool UniLib::IsUpper(char32 codepoint) const {
+  if (Latin1Properties::Contains(codepoint)) {
+    return Latin1Properties::Instance().Has(codepoint,
+                                            Latin1Properties::kUpper);
+  }
+  return u_isupper(codepoint);
+}
 
-char32 UniLib::ToLower(char32 codepoint) const { return u_tolower(codepoint); }
+bool UniLib::IsLetterOrDigit(char32 codepoint) const {
+  if (Latin1Properties::Contains(codepoint)) {
+    return Latin1Properties::Instance().Has(codepoint,
+                                            Latin1Properties::kLetterOrDigit);
+  }
+  return u_isalnum(codepoint);
+}
+
+char32 UniLib::ToLower(char32 codepoint) const {
+  if (Latin1Properties::Contains(codepoint)) {
+    return Latin1Properties::Instance().Lower(codepoint);
+  }
+  return u_tolower(codepoint);
+}
 
 char32 UniLib::GetPairedBracket(char32 codepoint) const {
+  if (Latin1Properties::Contains(codepoint)) {
+    return Latin1Properties::Instance().PairedBracket(codepoint);
+  }
   return u_getBidiPairedBracket(codepoint);
 }
 
+std::string UniLib::FoldCase(const UnicodeText& text) const {
+  std::string result;
+  icu::UnicodeString::fromUTF8(icu::StringPiece(text.data(), text.size_bytes()))
+      .foldCase()
+      .toUTF8String(result);
+  return result;
+}
+
+UniLib::RegexInput::RegexInput(const UnicodeText& text)
+    : text_(icu::UnicodeString::fromUTF8(
+          icu::StringPiece(text.data(), text.size_bytes()))) {
+  const int length = text_.length();
+  const UChar* buffer = text_.getBuffer();
+  bool has_surrogate_pairs = false;
+  for (int i = 0; i < length; ++i) {
+    text_chars_.Add(buffer[i]);
+    if (U16_IS_LEAD(buffer[i])) {
+      has_surrogate_pairs = true;
+    }
+  }
+  if (!has_surrogate_pairs) {
+    return;
+  }
+
+  codepoint_offsets_.resize(length + 1);
+  int num_codepoints = 0;
+  for (int i = 0; i < length; ++i) {
+    codepoint_offsets_[i] = num_codepoints;
+    if (!(U16_IS_TRAIL(buffer[i]) && i > 0 && U16_IS_LEAD(buffer[i - 1]))) {
+      ++num_codepoints;
+    }
+  }
+  codepoint_offsets_[length] = num_codepoints;
+}
+
+int UniLib::RegexInput::NumCodepoints() const {
+  return CodepointOffset(text_.length());
+}
+
+UniLib::RegexMatcher::RegexMatcher(icu::RegexPattern* pattern,
+                                   std::unique_ptr<RegexInput> owned_input)
+    : RegexMatcher(pattern, owned_input.get()) {
+  owned_input_ = std::move(owned_input);
+}
+
 UniLib::RegexMatcher::RegexMatcher(icu::RegexPattern* pattern,
-                                   icu::UnicodeString text)
-    : text_(std::move(text)),
-      last_find_offset_(0),
-      last_find_offset_codepoints_(0),
-      last_find_offset_dirty_(true) {
+                                   const RegexInput* input)
+    : input_(input) {
   UErrorCode status = U_ZERO_ERROR;
-  matcher_.reset(pattern->matcher(text_, status));
+  matcher_.reset(pattern->matcher(input_->text_, status));
   if (U_FAILURE(status)) {
     matcher_.reset(nullptr);
   }
 }
 
+namespace {
+
+std::unique_ptr<icu::RegexPattern> CompileIcuPattern(
+    const icu::UnicodeString& regex) {
+  UErrorCode status = U_ZERO_ERROR;
+  std::unique_ptr<icu::RegexPattern> pattern(
+      icu::RegexPattern::compile(regex, /*flags=*/UREGEX_MULTILINE, status));
+  if (U_FAILURE(status)) {
+    pattern.reset();
+  }
+  return pattern;
+}
+
+}  // namespace
+
+bool UniLib::RegexPattern::MayMatchWhole(const RegexInput& input) const {
+  return prefilter_.MayMatchWhole(
+             input.NumCodepoints(),
+             input.text_.isEmpty() ? 0 : input.text_.char32At(0)) &&
+         prefilter_.MayMatch(input.text_chars_);
+}
+
+std::shared_ptr<icu::RegexPattern> UniLib::RegexPattern::AcquireLazyPattern()
+    const {
+  std::lock_guard<std::mutex> lock(lazy_mutex_);
+  if (pattern_ == nullptr && !lazy_compile_failed_) {
+    pattern_ = CompileIcuPattern(lazy_pattern_text_);
+    if (!pattern_) {
+      std::string pattern_text;
+      TC_LOG(ERROR) << "Could not compile pattern: "
+                    << lazy_pattern_text_.toUTF8String(pattern_text);
+      lazy_compile_failed_ = true;
+    }
+    lazy_compiled_ = (pattern_ != nullptr);
+  }
+  return pattern_;
+}
+
+bool UniLib::RegexPattern::Compile() const {
+  if (lazy_) {
+    return AcquireLazyPattern() != nullptr;
+  }
+  return pattern_ != nullptr;
+}
+
+void UniLib::RegexPattern::ReleaseCompiled() const {
+  if (!lazy_) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(lazy_mutex_);
+  pattern_.reset();
+  lazy_compiled_ = false;
+}
+
+int64 UniLib::RegexPattern::EstimateMemoryBytes() const {
+  int64 bytes = sizeof(RegexPattern);
+  bool compiled;
+  int pattern_length;
+  if (lazy_) {
+    compiled = lazy_compiled_;
+    pattern_length = lazy_pattern_text_.length();
+    bytes += pattern_length * sizeof(UChar);
+  } else {
+    compiled = (pattern_ != nullptr);
+    pattern_length = compiled ? pattern_->pattern().length() : 0;
+  }
+  if (compiled) {
+    // ICU keeps a copy of the pattern text and compiles it to roughly one
+    // 64-bit op per character, plus the sets of the character classes.
+    bytes += sizeof(icu::RegexPattern) +
+             pattern_length * (sizeof(UChar) + sizeof(int64));
+  }
+  return bytes;
+}
+
 std::unique_ptr<UniLib::RegexMatcher> UniLib::RegexPattern::Matcher(
     const UnicodeText& input) const {
-  return std::unique_ptr<UniLib::RegexMatcher>(new UniLib::RegexMatcher(
-      pattern_.get(), icu::UnicodeString::fromUTF8(
-                          icu::StringPiece(input.data(), input.size_bytes()))));
+  std::unique_ptr<RegexInput> owned_input(new RegexInput(input));
+  const RegexInput* input_ptr = owned_input.get();
+  return Matcher(std::move(owned_input), input_ptr);
+}
+
+std::unique_ptr<UniLib::RegexMatcher> UniLib::RegexPattern::Matcher(
+    const RegexInput& input) const {
+  return Matcher(std::unique_ptr<RegexInput>(), &input);
+}
+
+std::unique_ptr<UniLib::RegexMatcher> UniLib::RegexPattern::Matcher(
+    std::unique_ptr<RegexInput> owned_input, const RegexInput* input) const {
+  std::shared_ptr<icu::RegexPattern> pattern =
+      lazy_ ? AcquireLazyPattern() : nullptr;
+  icu::RegexPattern* icu_pattern = lazy_ ? pattern.get() : pattern_.get();
+  if (icu_pattern == nullptr) {
+    return nullptr;
+  }
+  std::unique_ptr<UniLib::RegexMatcher> matcher(
+      owned_input != nullptr
+          ? new UniLib::RegexMatcher(icu_pattern, std::move(owned_input))
+          : new UniLib::RegexMatcher(icu_pattern, input));
+  matcher->pattern_ref_ = std::move(pattern);
+  return matcher;
 }
 
 constexpr int UniLib::RegexMatcher::kError;
 constexpr int UniLib::RegexMatcher::kNoError;
+constexpr int UniLib::RegexMatcher::kTimeout;
+
+void UniLib::RegexMatcher::SetTimeLimit(int time_limit_millis) {
+  if (!matcher_) {
+    return;
+  }
+  UErrorCode icu_status = U_ZERO_ERROR;
+  matcher_->setTimeLimit(time_limit_millis, icu_status);
+}
 
 bool UniLib::RegexMatcher::Matches(int* status) const {
   if (!matcher_) {
@@ -96,7 +344,7 @@ bool UniLib::RegexMatcher::Matches(int* status) const {
   UErrorCode icu_status = U_ZERO_ERROR;
   const bool result = matcher_->matches(/*startIndex=*/0, icu_status);
   if (U_FAILURE(icu_status)) {
-    *status = kError;
+    *status = icu_status == U_REGEX_TIME_OUT ? kTimeout : kError;
     return false;
   }
   *status = kNoError;
@@ -122,31 +370,12 @@ bool UniLib::RegexMatcher::ApproximatelyMatches(int* status) {
   if (*status != kNoError) {
     return false;
   }
-  if (found_start != 0 || found_end != text_.countChar32()) {
+  if (found_start != 0 || found_end != input_->NumCodepoints()) {
     return false;
   }
   return true;
 }
 
-bool UniLib::RegexMatcher::UpdateLastFindOffset() const {
-  if (!last_find_offset_dirty_) {
-    return true;
-  }
-
-  // Update the position of the match.
-  UErrorCode icu_status = U_ZERO_ERROR;
-  const int find_offset = matcher_->start(0, icu_status);
-  if (U_FAILURE(icu_status)) {
-    return false;
-  }
-  last_find_offset_codepoints_ +=
-      text_.countChar32(last_find_offset_, find_offset - last_find_offset_);
-  last_find_offset_ = find_offset;
-  last_find_offset_dirty_ = false;
-
-  return true;
-}
-
 bool UniLib::RegexMatcher::Find(int* status) {
   if (!matcher_) {
     *status = kError;
@@ -155,11 +384,10 @@ bool UniLib::RegexMatcher::Find(int* status) {
   UErrorCode icu_status = U_ZERO_ERROR;
   const bool result = matcher_->find(icu_status);
   if (U_FAILURE(icu_status)) {
-    *status = kError;
+    *status = icu_status == U_REGEX_TIME_OUT ? kTimeout : kError;
     return false;
   }
 
-  last_find_offset_dirty_ = true;
   *status = kNoError;
   return result;
 }
@@ -169,7 +397,7 @@ int UniLib::RegexMatcher::Start(int* status) const {
 }
 
 int UniLib::RegexMatcher::Start(int group_idx, int* status) const {
-  if (!matcher_ || !UpdateLastFindOffset()) {
+  if (!matcher_) {
     *status = kError;
     return kError;
   }
@@ -182,15 +410,13 @@ int UniLib::RegexMatcher::Start(int group_idx, int* status) const {
   }
   *status = kNoError;
 
-  // If the group didn't participate in the match the result is -1 and is
-  // incompatible with the caching logic bellow.
+  // If the group didn't participate in the match the result is -1, which is
+  // not an offset.
   if (result == -1) {
     return -1;
   }
 
-  return last_find_offset_codepoints_ +
-         text_.countChar32(/*start=*/last_find_offset_,
-                           /*length=*/result - last_find_offset_);
+  return input_->CodepointOffset(result);
 }
 
 int UniLib::RegexMatcher::End(int* status) const {
@@ -198,7 +424,7 @@ int UniLib::RegexMatcher::End(int* status) const {
 }
 
 int UniLib::RegexMatcher::End(int group_idx, int* status) const {
-  if (!matcher_ || !UpdateLastFindOffset()) {
+  if (!matcher_) {
     *status = kError;
     return kError;
   }
@@ -210,15 +436,13 @@ int UniLib::RegexMatcher::End(int group_idx, int* status) const {
   }
   *status = kNoError;
 
-  // If the group didn't participate in the match the result is -1 and is
-  // incompatible with the caching logic bellow.
+  // If the group didn't participate in the match the result is -1, which is
+  // not an offset.
   if (result == -1) {
     return -1;
   }
 
-  return last_find_offset_codepoints_ +
-         text_.countChar32(/*start=*/last_find_offset_,
-                           /*length=*/result - last_find_offset_);
+  return input_->CodepointOffset(result);
 }
 
 UnicodeText UniLib::RegexMatcher::Group(int* status) const {
@@ -259,6 +483,16 @@ UniLib::BreakIterator::BreakIterator(const UnicodeText& text)
   break_iterator_->setText(text_);
 }
 
+void UniLib::BreakIterator::Reset(const UnicodeText& text) {
+  text_ = icu::UnicodeString::fromUTF8(
+      icu::StringPiece(text.data(), text.size_bytes()));
+  last_break_index_ = 0;
+  last_unicode_index_ = 0;
+  if (break_iterator_) {
+    break_iterator_->setText(text_);
+  }
+}
+
 int UniLib::BreakIterator::Next() {
   const int break_index = break_iterator_->next();
   if (break_index == icu::BreakIterator::DONE) {
@@ -272,16 +506,29 @@ int UniLib::BreakIterator::Next() {
 
 std::unique_ptr<UniLib::RegexPattern> UniLib::CreateRegexPattern(
     const UnicodeText& regex) const {
-  UErrorCode status = U_ZERO_ERROR;
-  std::unique_ptr<icu::RegexPattern> pattern(
-      icu::RegexPattern::compile(icu::UnicodeString::fromUTF8(icu::StringPiece(
-                                     regex.data(), regex.size_bytes())),
-                                 /*flags=*/UREGEX_MULTILINE, status));
-  if (U_FAILURE(status) || !pattern) {
+  std::unique_ptr<icu::RegexPattern> pattern =
+      CompileIcuPattern(icu::UnicodeString::fromUTF8(
+          icu::StringPiece(regex.data(), regex.size_bytes())));
+  if (!pattern) {
     return nullptr;
   }
-  return std::unique_ptr<UniLib::RegexPattern>(
-      new UniLib::RegexPattern(std::move(pattern)));
+  return std::unique_ptr<UniLib::RegexPattern>(new UniLib::RegexPattern(
+      std::move(pattern), RegexPrefilter::ForPattern(StringPiece(
+                              regex.data(), regex.size_bytes()))));
+}
+
+std::unique_ptr<UniLib::RegexPattern> UniLib::CreateLazyRegexPattern(
+    const UnicodeText& regex) const {
+  return std::unique_ptr<UniLib::RegexPattern>(new UniLib::RegexPattern(
+      icu::UnicodeString::fromUTF8(
+          icu::StringPiece(regex.data(), regex.size_bytes())),
+      RegexPrefilter::ForPattern(
+          StringPiece(regex.data(), regex.size_bytes()))));
+}
+
+std::unique_ptr<UniLib::RegexInput> UniLib::CreateRegexInput(
+    const UnicodeText& text) const {
+  return std::unique_ptr<UniLib::RegexInput>(new UniLib::RegexInput(text));
 }
 
 std::unique_ptr<UniLib::BreakIterator> UniLib::CreateBreakIterator(
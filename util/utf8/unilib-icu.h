@@ -20,9 +20,13 @@
 #ifndef LIBTEXTCLASSIFIER_UTIL_UTF8_UNILIB_ICU_H_
 #define LIBTEXTCLASSIFIER_UTIL_UTF8_UNILIB_ICU_H_
 
+#include <atomic>
 #include <memory>
+#include <mutex>  // NOLINT
+#include <vector>
 
 #include "util/base/integral_types.h"
+#include "util/utf8/regex-prefilter.h"
 #include "util/utf8/unicodetext.h"
 #include "unicode/brkiter.h"
 #include "unicode/errorcode.h"
@@ -40,18 +44,64 @@ class UniLib {
   bool IsWhitespace(char32 codepoint) const;
   bool IsDigit(char32 codepoint) const;
   bool IsUpper(char32 codepoint) const;
+  bool IsLetterOrDigit(char32 codepoint) const;
 
   char32 ToLower(char32 codepoint) const;
   char32 GetPairedBracket(char32 codepoint) const;
 
+  // Returns the full case folding of the text, UTF8 encoded. Two texts match
+  // case-insensitively iff their foldings are equal.
+  std::string FoldCase(const UnicodeText& text) const;
+
   // Forward declaration for friend.
   class RegexPattern;
+  class RegexMatcher;
+
+  // Text converted once for matching with many regex patterns, see
+  // RegexPattern::Matcher(const RegexInput&).
+  class RegexInput {
+   public:
+    // Returns the number of codepoints of the text.
+    int NumCodepoints() const;
+
+    // Converts an offset into the UTF16 text to a codepoint offset.
+    int CodepointOffset(int utf16_offset) const {
+      return codepoint_offsets_.empty() ? utf16_offset
+                                        : codepoint_offsets_[utf16_offset];
+    }
+
+   protected:
+    friend class UniLib;
+    friend class RegexMatcher;
+    friend class RegexPattern;
+    explicit RegexInput(const UnicodeText& text);
+
+   private:
+    icu::UnicodeString text_;
+
+    // The characters that occur in the text, for the prefilters of the
+    // patterns.
+    PrefilterCharSet text_chars_;
+
+    // The codepoint offset of each UTF16 offset, and of the end of the text.
+    // Empty if the text has no surrogate pairs, when the offsets are the same.
+    std::vector<int> codepoint_offsets_;
+  };
 
   class RegexMatcher {
    public:
     static constexpr int kError = -1;
     static constexpr int kNoError = 0;
 
+    // The status of a call that ran out of the time limit, see
+    // SetTimeLimit().
+    static constexpr int kTimeout = -2;
+
+    // Limits the work of each Matches() and Find() call to about this many
+    // milliseconds, see icu::RegexMatcher::setTimeLimit(). A call that runs
+    // out of it fails with 'kTimeout'. 0, the default, is no limit.
+    void SetTimeLimit(int time_limit_millis);
+
     // Checks whether the input text matches the pattern exactly.
     bool Matches(int* status) const;
 
@@ -102,35 +152,100 @@ class UniLib {
 
    protected:
     friend class RegexPattern;
-    explicit RegexMatcher(icu::RegexPattern* pattern, icu::UnicodeString text);
+    RegexMatcher(icu::RegexPattern* pattern,
+                 std::unique_ptr<RegexInput> owned_input);
+    RegexMatcher(icu::RegexPattern* pattern, const RegexInput* input);
 
    private:
-    bool UpdateLastFindOffset() const;
-
+    // Keeps a pattern that can be released alive while it's matched, see
+    // RegexPattern::ReleaseCompiled(). Outlives 'matcher_'.
+    std::shared_ptr<icu::RegexPattern> pattern_ref_;
     std::unique_ptr<icu::RegexMatcher> matcher_;
-    icu::UnicodeString text_;
-    mutable int last_find_offset_;
-    mutable int last_find_offset_codepoints_;
-    mutable bool last_find_offset_dirty_;
+    std::unique_ptr<RegexInput> owned_input_;
+    const RegexInput* input_;
   };
 
   class RegexPattern {
    public:
     std::unique_ptr<RegexMatcher> Matcher(const UnicodeText& input) const;
 
+    // Same as above, but matches the already converted 'input', to match many
+    // patterns against the same text without converting it for each. The
+    // input must outlive the returned matcher.
+    std::unique_ptr<RegexMatcher> Matcher(const RegexInput& input) const;
+
+    // Returns false if the pattern certainly has no match in 'input', based
+    // on the characters it contains, so that running a matcher can be
+    // skipped. Much cheaper than a matcher.
+    bool MayMatch(const RegexInput& input) const {
+      return prefilter_.MayMatch(input.text_chars_);
+    }
+
+    // Same as above, but for a match of the whole input, as with
+    // RegexMatcher::Matches(). Also rejects inputs of impossible lengths or
+    // with an impossible first character.
+    bool MayMatchWhole(const RegexInput& input) const;
+
+    // Compiles a pattern from CreateLazyRegexPattern() now instead of on the
+    // first Matcher() call. Thread-safe. Returns false if the pattern doesn't
+    // compile, in which case Matcher() returns nullptr.
+    bool Compile() const;
+
+    // Releases the compiled form of a pattern from CreateLazyRegexPattern(),
+    // which then compiles again on its next use. Matchers that are still in
+    // use keep it until they are destroyed. A no-op for the other patterns.
+    // Thread-safe.
+    void ReleaseCompiled() const;
+
+    // Returns an estimate of the memory held by the pattern. ICU doesn't
+    // expose the size of a compiled pattern, so it is estimated from the
+    // length of the pattern.
+    int64 EstimateMemoryBytes() const;
+
    protected:
     friend class UniLib;
-    explicit RegexPattern(std::unique_ptr<icu::RegexPattern> pattern)
-        : pattern_(std::move(pattern)) {}
+    RegexPattern(std::unique_ptr<icu::RegexPattern> pattern,
+                 RegexPrefilter prefilter)
+        : pattern_(std::move(pattern)),
+          lazy_(false),
+          prefilter_(std::move(prefilter)) {}
+    RegexPattern(icu::UnicodeString lazy_pattern_text,
+                 RegexPrefilter prefilter)
+        : lazy_pattern_text_(std::move(lazy_pattern_text)),
+          lazy_(true),
+          prefilter_(std::move(prefilter)) {}
 
    private:
-    std::unique_ptr<icu::RegexPattern> pattern_;
+    // Returns the compiled pattern of a lazy pattern, compiling it if needed.
+    std::shared_ptr<icu::RegexPattern> AcquireLazyPattern() const;
+
+    // Matches 'input', which 'owned_input' owns if set.
+    std::unique_ptr<RegexMatcher> Matcher(
+        std::unique_ptr<RegexInput> owned_input,
+        const RegexInput* input) const;
+
+    // Constant for the patterns that are compiled at creation, guarded by
+    // 'lazy_mutex_' for the lazy ones.
+    mutable std::shared_ptr<icu::RegexPattern> pattern_;
+
+    // The pattern text, if the pattern is compiled on first use.
+    const icu::UnicodeString lazy_pattern_text_;
+    const bool lazy_;
+    mutable std::mutex lazy_mutex_;
+    mutable bool lazy_compile_failed_ = false;
+    mutable std::atomic<bool> lazy_compiled_{false};
+
+    const RegexPrefilter prefilter_;
   };
 
   class BreakIterator {
    public:
     int Next();
 
+    // Restarts the iteration on new text, reusing the ICU break iterator
+    // instead of creating a new one, which is expensive.
+    void Reset(const UnicodeText& text);
+
     static constexpr int kDone = -1;
 
    protected:
@@ -146,6 +261,13 @@ class UniLib {
 
   std::unique_ptr<RegexPattern> CreateRegexPattern(
       const UnicodeText& regex) const;
+
+  // Same as above, but defers compiling the pattern to its first use, see
+  // RegexPattern::Compile(). Never returns nullptr, errors in the pattern
+  // only show when it's used.
+  std::unique_ptr<RegexPattern> CreateLazyRegexPattern(
+      const UnicodeText& regex) const;
+  std::unique_ptr<RegexInput> CreateRegexInput(const UnicodeText& text) const;
   std::unique_ptr<BreakIterator> CreateBreakIterator(
       const UnicodeText& text) const;
 };
@@ -0,0 +1,555 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/utf8/unilib-lite.h"
+
+#include <limits>
+#include <string>
+#include <utility>
+
+#include "util/base/logging.h"
+#include "util/strings/utf8.h"
+#include "util/utf8/unicode-properties.h"
+
+namespace libtextclassifier2 {
+
+bool UniLib::ParseInt32(const UnicodeText& text, int* result) const {
+  auto it = text.begin();
+  const bool negative = (it != text.end() && *it == '-');
+  if (negative) {
+    ++it;
+  }
+  if (it == text.end()) {
+    return false;
+  }
+  int64 value = 0;
+  for (; it != text.end(); ++it) {
+    const int digit = UnicodeDigitValue(*it);
+    if (digit < 0) {
+      return false;
+    }
+    value = value * 10 + digit;
+    if (value > -static_cast<int64>(std::numeric_limits<int32>::min())) {
+      return false;
+    }
+  }
+  if (negative) {
+    value = -value;
+  }
+  if (value > std::numeric_limits<int32>::max()) {
+    return false;
+  }
+  *result = value;
+  return true;
+}
+
+bool UniLib::IsOpeningBracket(char32 codepoint) const {
+  return HasUnicodeProperty(codepoint, kUnicodeOpeningBracket);
+}
+
+bool UniLib::IsClosingBracket(char32 codepoint) const {
+  return HasUnicodeProperty(codepoint, kUnicodeClosingBracket);
+}
+
+bool UniLib::IsWhitespace(char32 codepoint) const {
+  return HasUnicodeProperty(codepoint, kUnicodeWhitespace);
+}
+
+bool UniLib::IsDigit(char32 codepoint) const {
+  return HasUnicodeProperty(codepoint, kUnicodeDecimalDigit);
+}
+
+bool UniLib::IsUpper(char32 codepoint) const {
+  return HasUnicodeProperty(codepoint, kUnicodeUppercaseLetter);
+}
+
+bool UniLib::IsLetterOrDigit(char32 codepoint) const {
+  return (GetUnicodeProperties(codepoint) &
+          (kUnicodeLetter | kUnicodeDecimalDigit)) != 0;
+}
+
+char32 UniLib::ToLower(char32 codepoint) const {
+  return UnicodeToLower(codepoint);
+}
+
+char32 UniLib::GetPairedBracket(char32 codepoint) const {
+  return UnicodePairedBracket(codepoint);
+}
+
+std::string UniLib::FoldCase(const UnicodeText& text) const {
+  UnicodeText folded;
+  for (const char32 codepoint : text) {
+    AppendUnicodeCaseFolding(codepoint, &folded);
+  }
+  return folded.ToUTF8String();
+}
+
+UniLib::RegexInput::RegexInput(const UnicodeText& text)
+    : text_(text.data(), text.size_bytes()) {
+  bool is_ascii = true;
+  for (const char32 codepoint : text) {
+    text_chars_.Add(codepoint);
+    if (codepoint >= 0x80) {
+      is_ascii = false;
+    }
+  }
+  if (!text.empty()) {
+    first_char_ = *text.begin();
+  }
+  if (is_ascii) {
+    return;
+  }
+
+  codepoint_offsets_.resize(text_.size() + 1);
+  int num_codepoints = 0;
+  for (int i = 0; i < text_.size(); ++i) {
+    if (IsTrailByte(text_[i])) {
+      codepoint_offsets_[i] = num_codepoints - 1;
+    } else {
+      codepoint_offsets_[i] = num_codepoints++;
+    }
+  }
+  codepoint_offsets_[text_.size()] = num_codepoints;
+}
+
+int UniLib::RegexInput::NumCodepoints() const {
+  return CodepointOffset(text_.size());
+}
+
+UniLib::RegexMatcher::RegexMatcher(const RE2* pattern,
+                                   std::unique_ptr<RegexInput> owned_input)
+    : RegexMatcher(pattern, owned_input.get()) {
+  owned_input_ = std::move(owned_input);
+}
+
+UniLib::RegexMatcher::RegexMatcher(const RE2* pattern, const RegexInput* input)
+    : pattern_(pattern), input_(input) {}
+
+namespace {
+
+// The items of RE2 character classes that match what '\d', '\s' and '\w'
+// match in ICU.
+const char kDigitClassItems[] = "\\p{Nd}";
+const char kSpaceClassItems[] = "\\t-\\r\\x{85}\\p{Z}";
+const char kWordClassItems[] =
+    "\\p{L}\\p{Nl}\\p{M}\\p{Nd}\\p{Pc}\\x{200C}\\x{200D}";
+
+// Translates a pattern in ICU syntax to RE2 syntax, in multi-line mode like
+// the ICU patterns. Constructs that RE2 doesn't have are kept, so that the
+// pattern fails to compile.
+std::string TranslateIcuPattern(const std::string& pattern) {
+  std::string result = "(?m)";
+  bool in_class = false;
+
+  // The position after the '[' or '[^' that opened the class, where a ']' is
+  // a literal.
+  int class_start = -1;
+  for (int i = 0; i < pattern.size(); ++i) {
+    const char c = pattern[i];
+    if (c != '\\' || i + 1 == pattern.size()) {
+      if (!in_class && c == '[') {
+        in_class = true;
+        class_start = i + 1;
+        if (class_start < pattern.size() && pattern[class_start] == '^') {
+          ++class_start;
+        }
+      } else if (in_class && c == ']' && i != class_start) {
+        in_class = false;
+      } else if (!in_class && c == '(' &&
+                 pattern.compare(i, 3, "(?<") == 0 && i + 3 < pattern.size() &&
+                 pattern[i + 3] != '=' && pattern[i + 3] != '!') {
+        // Named groups are "(?P<name>...)" in RE2.
+        result += "(?P<";
+        i += 2;
+        continue;
+      }
+      result += c;
+      continue;
+    }
+
+    const char escaped = pattern[++i];
+    switch (escaped) {
+      case 'd':
+        result += kDigitClassItems;
+        break;
+      case 'D':
+        result += "\\P{Nd}";
+        break;
+      case 's':
+        result += in_class ? std::string(kSpaceClassItems)
+                           : std::string("[") + kSpaceClassItems + "]";
+        break;
+      case 'S':
+        result += in_class ? std::string("\\S")
+                           : std::string("[^") + kSpaceClassItems + "]";
+        break;
+      case 'w':
+        result += in_class ? std::string(kWordClassItems)
+                           : std::string("[") + kWordClassItems + "]";
+        break;
+      case 'W':
+        result += in_class ? std::string("\\W")
+                           : std::string("[^") + kWordClassItems + "]";
+        break;
+      case 'u':
+      case 'U': {
+        // \uhhhh and \Uhhhhhhhh are \x{...} in RE2.
+        const int num_digits = (escaped == 'u' ? 4 : 8);
+        if (i + num_digits >= pattern.size()) {
+          result += '\\';
+          result += escaped;
+          break;
+        }
+        result += "\\x{" + pattern.substr(i + 1, num_digits) + "}";
+        i += num_digits;
+        break;
+      }
+      case 'Q': {
+        // Quoted literal text, which is the same in RE2.
+        const size_t quote_end = pattern.find("\\E", i + 1);
+        const size_t end =
+            (quote_end == std::string::npos ? pattern.size() : quote_end + 2);
+        result += "\\Q";
+        result += pattern.substr(i + 1, end - i - 1);
+        i = end - 1;
+        break;
+      }
+      default:
+        result += '\\';
+        result += escaped;
+        break;
+    }
+  }
+  return result;
+}
+
+std::shared_ptr<const RE2> CompileRe2Pattern(const std::string& pattern) {
+  RE2::Options options;
+  options.set_log_errors(false);
+  std::shared_ptr<const RE2> compiled(
+      new RE2(TranslateIcuPattern(pattern), options));
+  if (!compiled->ok()) {
+    compiled.reset();
+  }
+  return compiled;
+}
+
+// RE2 programs take 8 bytes per instruction, and about as much again for the
+// reverse program and the caches of the matchers.
+const int kBytesPerProgramInstruction = 16;
+
+int64 EstimateCompiledBytes(const RE2& pattern) {
+  return sizeof(RE2) + pattern.pattern().size() +
+         static_cast<int64>(pattern.ProgramSize()) *
+             kBytesPerProgramInstruction;
+}
+
+}  // namespace
+
+bool UniLib::RegexPattern::MayMatchWhole(const RegexInput& input) const {
+  return prefilter_.MayMatchWhole(input.NumCodepoints(), input.first_char_) &&
+         prefilter_.MayMatch(input.text_chars_);
+}
+
+std::shared_ptr<const RE2> UniLib::RegexPattern::AcquireLazyPattern() const {
+  std::lock_guard<std::mutex> lock(lazy_mutex_);
+  if (pattern_ == nullptr && !lazy_compile_failed_) {
+    pattern_ = CompileRe2Pattern(lazy_pattern_text_);
+    if (!pattern_) {
+      TC_LOG(ERROR) << "Could not compile pattern: " << lazy_pattern_text_;
+      lazy_compile_failed_ = true;
+    }
+    lazy_compiled_bytes_ =
+        (pattern_ != nullptr ? EstimateCompiledBytes(*pattern_) : 0);
+  }
+  return pattern_;
+}
+
+bool UniLib::RegexPattern::Compile() const {
+  if (lazy_) {
+    return AcquireLazyPattern() != nullptr;
+  }
+  return pattern_ != nullptr;
+}
+
+void UniLib::RegexPattern::ReleaseCompiled() const {
+  if (!lazy_) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(lazy_mutex_);
+  pattern_.reset();
+  lazy_compiled_bytes_ = 0;
+}
+
+int64 UniLib::RegexPattern::EstimateMemoryBytes() const {
+  int64 bytes = sizeof(RegexPattern) + lazy_pattern_text_.size();
+  if (lazy_) {
+    bytes += lazy_compiled_bytes_;
+  } else if (pattern_ != nullptr) {
+    bytes += EstimateCompiledBytes(*pattern_);
+  }
+  return bytes;
+}
+
+std::unique_ptr<UniLib::RegexMatcher> UniLib::RegexPattern::Matcher(
+    const UnicodeText& input) const {
+  std::unique_ptr<RegexInput> owned_input(new RegexInput(input));
+  const RegexInput* input_ptr = owned_input.get();
+  return Matcher(std::move(owned_input), input_ptr);
+}
+
+std::unique_ptr<UniLib::RegexMatcher> UniLib::RegexPattern::Matcher(
+    const RegexInput& input) const {
+  return Matcher(std::unique_ptr<RegexInput>(), &input);
+}
+
+std::unique_ptr<UniLib::RegexMatcher> UniLib::RegexPattern::Matcher(
+    std::unique_ptr<RegexInput> owned_input, const RegexInput* input) const {
+  std::shared_ptr<const RE2> pattern =
+      lazy_ ? AcquireLazyPattern() : nullptr;
+  const RE2* re2_pattern = lazy_ ? pattern.get() : pattern_.get();
+  if (re2_pattern == nullptr) {
+    return nullptr;
+  }
+  std::unique_ptr<UniLib::RegexMatcher> matcher(
+      owned_input != nullptr
+          ? new UniLib::RegexMatcher(re2_pattern, std::move(owned_input))
+          : new UniLib::RegexMatcher(re2_pattern, input));
+  matcher->pattern_ref_ = std::move(pattern);
+  return matcher;
+}
+
+constexpr int UniLib::RegexMatcher::kError;
+constexpr int UniLib::RegexMatcher::kNoError;
+constexpr int UniLib::RegexMatcher::kTimeout;
+
+bool UniLib::RegexMatcher::Matches(int* status) const {
+  const std::string& text = input_->text_;
+  groups_.assign(1 + pattern_->NumberOfCapturingGroups(), re2::StringPiece());
+  const bool result = pattern_->Match(text, /*startpos=*/0, text.size(),
+                                      RE2::ANCHOR_BOTH, groups_.data(),
+                                      groups_.size());
+  if (!result) {
+    groups_.clear();
+  }
+  *status = kNoError;
+  return result;
+}
+
+bool UniLib::RegexMatcher::ApproximatelyMatches(int* status) {
+  find_start_ = 0;
+  groups_.clear();
+  *status = kNoError;
+  if (!Find(status) || *status != kNoError) {
+    return false;
+  }
+  const int found_start = Start(status);
+  if (*status != kNoError) {
+    return false;
+  }
+  const int found_end = End(status);
+  if (*status != kNoError) {
+    return false;
+  }
+  if (found_start != 0 || found_end != input_->NumCodepoints()) {
+    return false;
+  }
+  return true;
+}
+
+bool UniLib::RegexMatcher::Find(int* status) {
+  *status = kNoError;
+  const std::string& text = input_->text_;
+  if (find_start_ > text.size()) {
+    groups_.clear();
+    return false;
+  }
+  groups_.assign(1 + pattern_->NumberOfCapturingGroups(), re2::StringPiece());
+  if (!pattern_->Match(text, find_start_, text.size(), RE2::UNANCHORED,
+                       groups_.data(), groups_.size())) {
+    groups_.clear();
+    find_start_ = text.size() + 1;
+    return false;
+  }
+
+  // The next search starts at the end of the match, or after the next
+  // codepoint if the match was empty, like in ICU.
+  find_start_ = groups_[0].data() + groups_[0].size() - text.data();
+  if (groups_[0].empty()) {
+    ++find_start_;
+    while (find_start_ < text.size() && IsTrailByte(text[find_start_])) {
+      ++find_start_;
+    }
+  }
+  return true;
+}
+
+bool UniLib::RegexMatcher::GetGroup(int group_idx, int* status,
+                                    const re2::StringPiece** group) const {
+  if (group_idx < 0 || group_idx >= groups_.size()) {
+    *status = kError;
+    return false;
+  }
+  *status = kNoError;
+  *group = &groups_[group_idx];
+  return true;
+}
+
+int UniLib::RegexMatcher::Start(int* status) const {
+  return Start(/*group_idx=*/0, status);
+}
+
+int UniLib::RegexMatcher::Start(int group_idx, int* status) const {
+  const re2::StringPiece* group;
+  if (!GetGroup(group_idx, status, &group)) {
+    return kError;
+  }
+
+  // If the group didn't participate in the match the result is -1, which is
+  // not an offset.
+  if (group->data() == nullptr) {
+    return -1;
+  }
+  return input_->CodepointOffset(group->data() - input_->text_.data());
+}
+
+int UniLib::RegexMatcher::End(int* status) const {
+  return End(/*group_idx=*/0, status);
+}
+
+int UniLib::RegexMatcher::End(int group_idx, int* status) const {
+  const re2::StringPiece* group;
+  if (!GetGroup(group_idx, status, &group)) {
+    return kError;
+  }
+  if (group->data() == nullptr) {
+    return -1;
+  }
+  return input_->CodepointOffset(group->data() + group->size() -
+                                 input_->text_.data());
+}
+
+UnicodeText UniLib::RegexMatcher::Group(int* status) const {
+  return Group(/*group_idx=*/0, status);
+}
+
+UnicodeText UniLib::RegexMatcher::Group(int group_idx, int* status) const {
+  const re2::StringPiece* group;
+  if (!GetGroup(group_idx, status, &group)) {
+    return UTF8ToUnicodeText("", /*do_copy=*/false);
+  }
+  return UTF8ToUnicodeText(group->data(), group->size(), /*do_copy=*/true);
+}
+
+constexpr int UniLib::BreakIterator::kDone;
+
+namespace {
+
+bool IsLineTerminator(char32 c) {
+  return (c >= 0x0A && c <= 0x0D) || c == 0x85 || c == 0x2028 || c == 0x2029;
+}
+
+// The spaces that stay together, i.e. the white space that is neither a
+// control character nor a line terminator.
+bool IsSegmentSpace(char32 c) {
+  return c >= 0x20 && c != 0x85 && !IsLineTerminator(c) &&
+         HasUnicodeProperty(c, kUnicodeWhiteSpaceProperty);
+}
+
+bool IsWordChar(char32 c) { return HasUnicodeProperty(c, kUnicodeRegexWord); }
+
+// Whether the middle character keeps two others in the same word, like "'" in
+// "can't" or "," in "1,000".
+bool IsInWordPunctuation(char32 before, char32 c, char32 after) {
+  const bool apostrophe_or_period = (c == '\'' || c == 0x2019 || c == '.');
+  const bool letters = HasUnicodeProperty(before, kUnicodeLetter) &&
+                       HasUnicodeProperty(after, kUnicodeLetter);
+  const bool digits = HasUnicodeProperty(before, kUnicodeDecimalDigit) &&
+                      HasUnicodeProperty(after, kUnicodeDecimalDigit);
+  return (letters && (apostrophe_or_period || c == ':' || c == 0xB7)) ||
+         (digits && (apostrophe_or_period || c == ',' || c == ';'));
+}
+
+}  // namespace
+
+UniLib::BreakIterator::BreakIterator(const UnicodeText& text) { Reset(text); }
+
+void UniLib::BreakIterator::Reset(const UnicodeText& text) {
+  codepoints_.assign(text.begin(), text.end());
+  position_ = 0;
+}
+
+int UniLib::BreakIterator::Next() {
+  const int size = codepoints_.size();
+  if (position_ >= size) {
+    return kDone;
+  }
+  const char32 c = codepoints_[position_];
+  int end = position_ + 1;
+  if (c == '\r' && end < size && codepoints_[end] == '\n') {
+    ++end;
+  } else if (IsSegmentSpace(c)) {
+    while (end < size && IsSegmentSpace(codepoints_[end])) {
+      ++end;
+    }
+  } else if (IsWordChar(c)) {
+    while (end < size) {
+      if (IsWordChar(codepoints_[end])) {
+        ++end;
+      } else if (end + 1 < size &&
+                 IsInWordPunctuation(codepoints_[end - 1], codepoints_[end],
+                                     codepoints_[end + 1])) {
+        end += 2;
+      } else {
+        break;
+      }
+    }
+  }
+  position_ = end;
+  return position_;
+}
+
+std::unique_ptr<UniLib::RegexPattern> UniLib::CreateRegexPattern(
+    const UnicodeText& regex) const {
+  const std::string regex_text = regex.ToUTF8String();
+  std::shared_ptr<const RE2> pattern = CompileRe2Pattern(regex_text);
+  if (!pattern) {
+    return nullptr;
+  }
+  return std::unique_ptr<UniLib::RegexPattern>(new UniLib::RegexPattern(
+      std::move(pattern), RegexPrefilter::ForPattern(regex_text)));
+}
+
+std::unique_ptr<UniLib::RegexPattern> UniLib::CreateLazyRegexPattern(
+    const UnicodeText& regex) const {
+  std::string regex_text = regex.ToUTF8String();
+  RegexPrefilter prefilter = RegexPrefilter::ForPattern(regex_text);
+  return std::unique_ptr<UniLib::RegexPattern>(
+      new UniLib::RegexPattern(std::move(regex_text), std::move(prefilter)));
+}
+
+std::unique_ptr<UniLib::RegexInput> UniLib::CreateRegexInput(
+    const UnicodeText& text) const {
+  return std::unique_ptr<UniLib::RegexInput>(new UniLib::RegexInput(text));
+}
+
+std::unique_ptr<UniLib::BreakIterator> UniLib::CreateBreakIterator(
+    const UnicodeText& text) const {
+  return std::unique_ptr<UniLib::BreakIterator>(
+      new UniLib::BreakIterator(text));
+}
+
+}  // namespace libtextclassifier2
@@ -0,0 +1,292 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// UniLib implementation without ICU: the character properties come from
+// compact tables generated from ICU, see unicode-properties.h, and the regular
+// expressions are matched with RE2, in time linear in the length of the text.
+//
+// The regular expressions are ICU patterns translated to RE2 syntax, so the
+// patterns that need backtracking, e.g. back-references or lookaround, don't
+// compile. '\d', '\s' and '\w' match the same Unicode characters as in ICU,
+// except for '\S' and '\W' inside of character classes, which only match
+// ASCII characters. The word breaks follow a simplified version of the
+// Unicode word boundary rules, without ICU's dictionaries, so e.g. Thai or
+// Chinese text is not split into words.
+
+#ifndef LIBTEXTCLASSIFIER_UTIL_UTF8_UNILIB_LITE_H_
+#define LIBTEXTCLASSIFIER_UTIL_UTF8_UNILIB_LITE_H_
+
+#include <atomic>
+#include <memory>
+#include <mutex>  // NOLINT
+#include <string>
+#include <vector>
+
+#include "util/base/integral_types.h"
+#include "util/utf8/regex-prefilter.h"
+#include "util/utf8/unicodetext.h"
+#include "re2/re2.h"
+
+namespace libtextclassifier2 {
+
+class UniLib {
+ public:
+  bool ParseInt32(const UnicodeText& text, int* result) const;
+  bool IsOpeningBracket(char32 codepoint) const;
+  bool IsClosingBracket(char32 codepoint) const;
+  bool IsWhitespace(char32 codepoint) const;
+  bool IsDigit(char32 codepoint) const;
+  bool IsUpper(char32 codepoint) const;
+  bool IsLetterOrDigit(char32 codepoint) const;
+
+  char32 ToLower(char32 codepoint) const;
+  char32 GetPairedBracket(char32 codepoint) const;
+
+  // Returns the full case folding of the text, UTF8 encoded. Two texts match
+  // case-insensitively iff their foldings are equal.
+  std::string FoldCase(const UnicodeText& text) const;
+
+  // Forward declaration for friend.
+  class RegexPattern;
+  class RegexMatcher;
+
+  // Text converted once for matching with many regex patterns, see
+  // RegexPattern::Matcher(const RegexInput&).
+  class RegexInput {
+   public:
+    // Returns the number of codepoints of the text.
+    int NumCodepoints() const;
+
+    // Converts a byte offset into the UTF8 text to a codepoint offset.
+    int CodepointOffset(int byte_offset) const {
+      return codepoint_offsets_.empty() ? byte_offset
+                                        : codepoint_offsets_[byte_offset];
+    }
+
+   protected:
+    friend class UniLib;
+    friend class RegexMatcher;
+    friend class RegexPattern;
+    explicit RegexInput(const UnicodeText& text);
+
+   private:
+    std::string text_;
+
+    // The characters that occur in the text, for the prefilters of the
+    // patterns.
+    PrefilterCharSet text_chars_;
+    char32 first_char_ = 0;
+
+    // The codepoint offset of each byte offset, and of the end of the text.
+    // Empty if the text is ASCII, when the offsets are the same.
+    std::vector<int> codepoint_offsets_;
+  };
+
+  class RegexMatcher {
+   public:
+    static constexpr int kError = -1;
+    static constexpr int kNoError = 0;
+
+    // The status of a call that ran out of the time limit, see
+    // SetTimeLimit().
+    static constexpr int kTimeout = -2;
+
+    // Limits the work of each Matches() and Find() call, as in the ICU
+    // implementation. Does nothing here: RE2 runs in time linear in the size
+    // of the input, so it never times out.
+    void SetTimeLimit(int time_limit_millis) {}
+
+    // Checks whether the input text matches the pattern exactly.
+    bool Matches(int* status) const;
+
+    // Approximate Matches() implementation implemented using Find(). It uses
+    // the first Find() result and then checks that it spans the whole input.
+    // NOTE: Unlike Matches() it can result in false negatives.
+    // NOTE: Resets the matcher, so the current Find() state will be lost.
+    bool ApproximatelyMatches(int* status);
+
+    // Finds occurrences of the pattern in the input text.
+    // Can be called repeatedly to find all occurences. A call will update
+    // internal state, so that 'Start', 'End' and 'Group' can be called to get
+    // information about the match.
+    // NOTE: Any call to ApproximatelyMatches() in between Find() calls will
+    // modify the state.
+    bool Find(int* status);
+
+    // Gets the start offset of the last match (from  'Find').
+    // Sets status to 'kError' if 'Find'
+    // was not called previously.
+    int Start(int* status) const;
+
+    // Gets the start offset of the specified group of the last match.
+    // (from  'Find').
+    // Sets status to 'kError' if an invalid group was specified or if 'Find'
+    // was not called previously.
+    int Start(int group_idx, int* status) const;
+
+    // Gets the end offset of the last match (from  'Find').
+    // Sets status to 'kError' if 'Find'
+    // was not called previously.
+    int End(int* status) const;
+
+    // Gets the end offset of the specified group of the last match.
+    // (from  'Find').
+    // Sets status to 'kError' if an invalid group was specified or if 'Find'
+    // was not called previously.
+    int End(int group_idx, int* status) const;
+
+    // Gets the text of the last match (from 'Find').
+    // Sets status to 'kError' if 'Find' was not called previously.
+    UnicodeText Group(int* status) const;
+
+    // Gets the text of the specified group of the last match (from 'Find').
+    // Sets status to 'kError' if an invalid group was specified or if 'Find'
+    // was not called previously.
+    UnicodeText Group(int group_idx, int* status) const;
+
+   protected:
+    friend class RegexPattern;
+    RegexMatcher(const RE2* pattern, std::unique_ptr<RegexInput> owned_input);
+    RegexMatcher(const RE2* pattern, const RegexInput* input);
+
+   private:
+    // Returns the byte span of a group of the last match in 'groups_', or
+    // false with the status set to 'kError' if there is none.
+    bool GetGroup(int group_idx, int* status,
+                  const re2::StringPiece** group) const;
+
+    // Keeps a pattern that can be released alive while it's matched, see
+    // RegexPattern::ReleaseCompiled().
+    std::shared_ptr<const RE2> pattern_ref_;
+    const RE2* pattern_;
+    std::unique_ptr<RegexInput> owned_input_;
+    const RegexInput* input_;
+
+    // The whole match and the groups of the last match, empty before the
+    // first one. Matches() sets them too, like in ICU.
+    mutable std::vector<re2::StringPiece> groups_;
+
+    // The byte offset where the next Find() starts.
+    int find_start_ = 0;
+  };
+
+  class RegexPattern {
+   public:
+    std::unique_ptr<RegexMatcher> Matcher(const UnicodeText& input) const;
+
+    // Same as above, but matches the already converted 'input', to match many
+    // patterns against the same text without converting it for each. The
+    // input must outlive the returned matcher.
+    std::unique_ptr<RegexMatcher> Matcher(const RegexInput& input) const;
+
+    // Returns false if the pattern certainly has no match in 'input', based
+    // on the characters it contains, so that running a matcher can be
+    // skipped. Much cheaper than a matcher.
+    bool MayMatch(const RegexInput& input) const {
+      return prefilter_.MayMatch(input.text_chars_);
+    }
+
+    // Same as above, but for a match of the whole input, as with
+    // RegexMatcher::Matches(). Also rejects inputs of impossible lengths or
+    // with an impossible first character.
+    bool MayMatchWhole(const RegexInput& input) const;
+
+    // Compiles a pattern from CreateLazyRegexPattern() now instead of on the
+    // first Matcher() call. Thread-safe. Returns false if the pattern doesn't
+    // compile, in which case Matcher() returns nullptr.
+    bool Compile() const;
+
+    // Releases the compiled form of a pattern from CreateLazyRegexPattern(),
+    // which then compiles again on its next use. Matchers that are still in
+    // use keep it until they are destroyed. A no-op for the other patterns.
+    // Thread-safe.
+    void ReleaseCompiled() const;
+
+    // Returns an estimate of the memory held by the pattern, from the size of
+    // its compiled program.
+    int64 EstimateMemoryBytes() const;
+
+   protected:
+    friend class UniLib;
+    RegexPattern(std::shared_ptr<const RE2> pattern, RegexPrefilter prefilter)
+        : pattern_(std::move(pattern)),
+          lazy_(false),
+          prefilter_(std::move(prefilter)) {}
+    RegexPattern(std::string lazy_pattern_text, RegexPrefilter prefilter)
+        : lazy_pattern_text_(std::move(lazy_pattern_text)),
+          lazy_(true),
+          prefilter_(std::move(prefilter)) {}
+
+   private:
+    // Returns the compiled pattern of a lazy pattern, compiling it if needed.
+    std::shared_ptr<const RE2> AcquireLazyPattern() const;
+
+    // Matches 'input', which 'owned_input' owns if set.
+    std::unique_ptr<RegexMatcher> Matcher(
+        std::unique_ptr<RegexInput> owned_input,
+        const RegexInput* input) const;
+
+    // Constant for the patterns that are compiled at creation, guarded by
+    // 'lazy_mutex_' for the lazy ones.
+    mutable std::shared_ptr<const RE2> pattern_;
+
+    // The pattern text in ICU syntax, if the pattern is compiled on first use.
+    const std::string lazy_pattern_text_;
+    const bool lazy_;
+    mutable std::mutex lazy_mutex_;
+    mutable bool lazy_compile_failed_ = false;
+
+    // The estimated size of the compiled lazy pattern while it is compiled,
+    // readable without the lock.
+    mutable std::atomic<int64> lazy_compiled_bytes_{0};
+
+    const RegexPrefilter prefilter_;
+  };
+
+  class BreakIterator {
+   public:
+    int Next();
+
+    // Restarts the iteration on new text.
+    void Reset(const UnicodeText& text);
+
+    static constexpr int kDone = -1;
+
+   protected:
+    friend class UniLib;
+    explicit BreakIterator(const UnicodeText& text);
+
+   private:
+    std::vector<char32> codepoints_;
+    int position_ = 0;
+  };
+
+  std::unique_ptr<RegexPattern> CreateRegexPattern(
+      const UnicodeText& regex) const;
+
+  // Same as above, but defers compiling the pattern to its first use, see
+  // RegexPattern::Compile(). Never returns nullptr, errors in the pattern
+  // only show when it's used.
+  std::unique_ptr<RegexPattern> CreateLazyRegexPattern(
+      const UnicodeText& regex) const;
+  std::unique_ptr<RegexInput> CreateRegexInput(const UnicodeText& text) const;
+  std::unique_ptr<BreakIterator> CreateBreakIterator(
+      const UnicodeText& text) const;
+};
+
+}  // namespace libtextclassifier2
+
+#endif  // LIBTEXTCLASSIFIER_UTIL_UTF8_UNILIB_LITE_H_
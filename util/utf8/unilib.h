@@ -17,7 +17,12 @@
 #ifndef LIBTEXTCLASSIFIER_UTIL_UTF8_UNILIB_H_
 #define LIBTEXTCLASSIFIER_UTIL_UTF8_UNILIB_H_
 
+#if defined(LIBTEXTCLASSIFIER_UNILIB_LITE)
+#include "util/utf8/unilib-lite.h"
+#define CREATE_UNILIB_FOR_TESTING const UniLib unilib;
+#else
 #include "util/utf8/unilib-icu.h"
 #define CREATE_UNILIB_FOR_TESTING const UniLib unilib;
+#endif
 
 #endif  // LIBTEXTCLASSIFIER_UTIL_UTF8_UNILIB_H_
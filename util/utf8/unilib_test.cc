@@ -16,6 +16,9 @@
 
 #include "util/utf8/unilib.h"
 
+#include <thread>  // NOLINT
+#include <vector>
+
 #include "util/base/logging.h"
 #include "util/utf8/unicodetext.h"
 #include "gmock/gmock.h"
@@ -38,6 +41,9 @@ TEST(UniLibTest, CharacterClassesAscii) {
   EXPECT_FALSE(unilib.IsUpper(')'));
   EXPECT_TRUE(unilib.IsUpper('A'));
   EXPECT_TRUE(unilib.IsUpper('Z'));
+  EXPECT_TRUE(unilib.IsLetterOrDigit('a'));
+  EXPECT_TRUE(unilib.IsLetterOrDigit('7'));
+  EXPECT_FALSE(unilib.IsLetterOrDigit('.'));
   EXPECT_EQ(unilib.ToLower('A'), 'a');
   EXPECT_EQ(unilib.ToLower('Z'), 'z');
   EXPECT_EQ(unilib.ToLower(')'), ')');
@@ -67,9 +73,46 @@ TEST(UniLibTest, CharacterClassesUnicode) {
 
   EXPECT_EQ(unilib.GetPairedBracket(0x0F3C), 0x0F3D);
   EXPECT_EQ(unilib.GetPairedBracket(0x0F3D), 0x0F3C);
+
+  EXPECT_EQ(unilib.FoldCase(UTF8ToUnicodeText("Stra\xC3\x9F" "E")),
+            "strasse");
+  EXPECT_EQ(unilib.FoldCase(UTF8ToUnicodeText("\xD0\x9C\xD0\x90\xD0\x99")),
+            "\xD0\xBC\xD0\xB0\xD0\xB9");  // CYRILLIC MAY
 }
 #endif  // ndef LIBTEXTCLASSIFIER_UNILIB_DUMMY
 
+#ifdef LIBTEXTCLASSIFIER_UNILIB_ICU
+TEST(UniLibTest, CharacterClassesLatin1MatchICU) {
+  CREATE_UNILIB_FOR_TESTING;
+  // The Latin-1 codepoints go through a table, the rest straight to ICU.
+  for (char32 codepoint = 0; codepoint < 0x300; ++codepoint) {
+    const int bracket_type =
+        u_getIntPropertyValue(codepoint, UCHAR_BIDI_PAIRED_BRACKET_TYPE);
+    EXPECT_EQ(unilib.IsOpeningBracket(codepoint), bracket_type == U_BPT_OPEN)
+        << codepoint;
+    EXPECT_EQ(unilib.IsClosingBracket(codepoint), bracket_type == U_BPT_CLOSE)
+        << codepoint;
+    EXPECT_EQ(unilib.IsWhitespace(codepoint),
+              static_cast<bool>(u_isWhitespace(codepoint)))
+        << codepoint;
+    EXPECT_EQ(unilib.IsDigit(codepoint),
+              static_cast<bool>(u_isdigit(codepoint)))
+        << codepoint;
+    EXPECT_EQ(unilib.IsUpper(codepoint),
+              static_cast<bool>(u_isupper(codepoint)))
+        << codepoint;
+    EXPECT_EQ(unilib.IsLetterOrDigit(codepoint),
+              static_cast<bool>(u_isalnum(codepoint)))
+        << codepoint;
+    EXPECT_EQ(unilib.ToLower(codepoint), u_tolower(codepoint)) << codepoint;
+    EXPECT_EQ(unilib.GetPairedBracket(codepoint),
+              u_getBidiPairedBracket(codepoint))
+        << codepoint;
+  }
+  EXPECT_FALSE(unilib.IsWhitespace(-1));
+}
+#endif  // LIBTEXTCLASSIFIER_UNILIB_ICU
+
 TEST(UniLibTest, RegexInterface) {
   CREATE_UNILIB_FOR_TESTING;
   const UnicodeText regex_pattern =
@@ -86,7 +129,8 @@ TEST(UniLibTest, RegexInterface) {
   TC_LOG(INFO) << matcher->Group(0, &status).size_codepoints();
 }
 
-#ifdef LIBTEXTCLASSIFIER_UNILIB_ICU
+#if defined(LIBTEXTCLASSIFIER_UNILIB_ICU) || \
+    defined(LIBTEXTCLASSIFIER_UNILIB_LITE)
 TEST(UniLibTest, Regex) {
   CREATE_UNILIB_FOR_TESTING;
 
@@ -125,9 +169,71 @@ TEST(UniLibTest, Regex) {
   EXPECT_EQ(matcher->Group(0, &status).ToUTF8String(), "0123😋");
   EXPECT_EQ(status, UniLib::RegexMatcher::kNoError);
 }
-#endif  // LIBTEXTCLASSIFIER_UNILIB_ICU
+#endif  // LIBTEXTCLASSIFIER_UNILIB_ICU || LIBTEXTCLASSIFIER_UNILIB_LITE
+
+#if defined(LIBTEXTCLASSIFIER_UNILIB_ICU) || \
+    defined(LIBTEXTCLASSIFIER_UNILIB_LITE)
+TEST(UniLibTest, RegexSharedInput) {
+  CREATE_UNILIB_FOR_TESTING;
+  std::unique_ptr<UniLib::RegexPattern> digits_pattern =
+      unilib.CreateRegexPattern(
+          UTF8ToUnicodeText("[0-9]+😋", /*do_copy=*/false));
+  std::unique_ptr<UniLib::RegexPattern> words_pattern =
+      unilib.CreateRegexPattern(UTF8ToUnicodeText("[a-z]+", /*do_copy=*/false));
+  const std::unique_ptr<UniLib::RegexInput> input = unilib.CreateRegexInput(
+      UTF8ToUnicodeText("hello😋😋 0123😋 world", /*do_copy=*/false));
+  EXPECT_EQ(input->NumCodepoints(), 19);
+
+  int status;
+  std::unique_ptr<UniLib::RegexMatcher> matcher =
+      digits_pattern->Matcher(*input);
+  EXPECT_TRUE(matcher->Find(&status));
+  EXPECT_EQ(matcher->Start(0, &status), 8);
+  EXPECT_EQ(matcher->End(0, &status), 13);
+  EXPECT_FALSE(matcher->Find(&status));
+
+  matcher = words_pattern->Matcher(*input);
+  std::vector<std::pair<int, int>> spans;
+  while (matcher->Find(&status) && status == UniLib::RegexMatcher::kNoError) {
+    spans.push_back({matcher->Start(&status), matcher->End(&status)});
+  }
+  EXPECT_THAT(spans, ElementsAre(std::make_pair(0, 5), std::make_pair(14, 19)));
+
+  const std::unique_ptr<UniLib::RegexInput> word_input =
+      unilib.CreateRegexInput(UTF8ToUnicodeText("world", /*do_copy=*/false));
+  matcher = words_pattern->Matcher(*word_input);
+  EXPECT_TRUE(matcher->Matches(&status));
+  EXPECT_TRUE(matcher->ApproximatelyMatches(&status));
+}
+#endif  // LIBTEXTCLASSIFIER_UNILIB_ICU || LIBTEXTCLASSIFIER_UNILIB_LITE
 
 #ifdef LIBTEXTCLASSIFIER_UNILIB_ICU
+TEST(UniLibTest, RegexTimeLimit) {
+  CREATE_UNILIB_FOR_TESTING;
+
+  // Backtracks exponentially in the length of the run of 'a's.
+  std::unique_ptr<UniLib::RegexPattern> pattern = unilib.CreateRegexPattern(
+      UTF8ToUnicodeText("(a+)+b", /*do_copy=*/false));
+  const std::string input = std::string(40, 'a') + "c";
+  std::unique_ptr<UniLib::RegexMatcher> matcher =
+      pattern->Matcher(UTF8ToUnicodeText(input, /*do_copy=*/false));
+  matcher->SetTimeLimit(1);
+  int status;
+  EXPECT_FALSE(matcher->Find(&status));
+  EXPECT_EQ(status, UniLib::RegexMatcher::kTimeout);
+  EXPECT_FALSE(matcher->Matches(&status));
+  EXPECT_EQ(status, UniLib::RegexMatcher::kTimeout);
+
+  // Within the limit, the matching is the same.
+  matcher = pattern->Matcher(UTF8ToUnicodeText("aab", /*do_copy=*/false));
+  matcher->SetTimeLimit(1);
+  EXPECT_TRUE(matcher->Matches(&status));
+  EXPECT_EQ(status, UniLib::RegexMatcher::kNoError);
+}
+#endif  // LIBTEXTCLASSIFIER_UNILIB_ICU
+
+#if defined(LIBTEXTCLASSIFIER_UNILIB_ICU) || \
+    defined(LIBTEXTCLASSIFIER_UNILIB_LITE)
 TEST(UniLibTest, RegexGroups) {
   CREATE_UNILIB_FOR_TESTING;
 
@@ -164,9 +270,112 @@ TEST(UniLibTest, RegexGroups) {
   EXPECT_EQ(matcher->Group(2, &status).ToUTF8String(), "123");
   EXPECT_EQ(status, UniLib::RegexMatcher::kNoError);
 }
-#endif  // LIBTEXTCLASSIFIER_UNILIB_ICU
+#endif  // LIBTEXTCLASSIFIER_UNILIB_ICU || LIBTEXTCLASSIFIER_UNILIB_LITE
 
-#ifdef LIBTEXTCLASSIFIER_UNILIB_ICU
+#if defined(LIBTEXTCLASSIFIER_UNILIB_ICU) || \
+    defined(LIBTEXTCLASSIFIER_UNILIB_LITE)
+TEST(UniLibTest, RegexUnicodeClasses) {
+  CREATE_UNILIB_FOR_TESTING;
+  int status;
+
+  // \d, \s and \w match beyond ASCII, also inside of classes.
+  std::unique_ptr<UniLib::RegexPattern> pattern = unilib.CreateRegexPattern(
+      UTF8ToUnicodeText("\\d+\\s[\\w-]+\\W", /*do_copy=*/false));
+  ASSERT_TRUE(pattern != nullptr);
+  std::unique_ptr<UniLib::RegexMatcher> matcher = pattern->Matcher(
+      UTF8ToUnicodeText("x ٤٢\u00A0Grüße-ñ! y", /*do_copy=*/false));
+  EXPECT_TRUE(matcher->Find(&status));
+  EXPECT_EQ(matcher->Start(&status), 2);
+  EXPECT_EQ(matcher->End(&status), 13);
+
+  // Multi-line anchors, and \u escapes.
+  pattern = unilib.CreateRegexPattern(
+      UTF8ToUnicodeText("^\\u00e9t\\u00E9$", /*do_copy=*/false));
+  ASSERT_TRUE(pattern != nullptr);
+  matcher = pattern->Matcher(
+      UTF8ToUnicodeText("hiver\nété\nhiver", /*do_copy=*/false));
+  EXPECT_TRUE(matcher->Find(&status));
+  EXPECT_EQ(matcher->Start(&status), 6);
+  EXPECT_EQ(matcher->End(&status), 9);
+  EXPECT_FALSE(matcher->Find(&status));
+}
+#endif  // LIBTEXTCLASSIFIER_UNILIB_ICU || LIBTEXTCLASSIFIER_UNILIB_LITE
+
+#if defined(LIBTEXTCLASSIFIER_UNILIB_ICU) || \
+    defined(LIBTEXTCLASSIFIER_UNILIB_LITE)
+TEST(UniLibTest, LazyRegex) {
+  CREATE_UNILIB_FOR_TESTING;
+  std::unique_ptr<UniLib::RegexPattern> pattern =
+      unilib.CreateLazyRegexPattern(
+          UTF8ToUnicodeText("[0-9]+", /*do_copy=*/false));
+  const UnicodeText input = UTF8ToUnicodeText("hello 0123", /*do_copy=*/false);
+
+  // Compiled concurrently on first use.
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&pattern, &input]() {
+      std::unique_ptr<UniLib::RegexMatcher> matcher = pattern->Matcher(input);
+      ASSERT_TRUE(matcher != nullptr);
+      int status;
+      EXPECT_TRUE(matcher->Find(&status));
+      EXPECT_EQ(matcher->Start(&status), 6);
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  EXPECT_TRUE(pattern->Compile());
+
+  std::unique_ptr<UniLib::RegexPattern> invalid_pattern =
+      unilib.CreateLazyRegexPattern(
+          UTF8ToUnicodeText("[0-9", /*do_copy=*/false));
+  ASSERT_TRUE(invalid_pattern != nullptr);
+  EXPECT_FALSE(invalid_pattern->Compile());
+  EXPECT_TRUE(invalid_pattern->Matcher(input) == nullptr);
+}
+
+TEST(UniLibTest, RegexMemoryEstimate) {
+  CREATE_UNILIB_FOR_TESTING;
+  const UnicodeText regex = UTF8ToUnicodeText("[0-9]+ [a-z]+", false);
+  std::unique_ptr<UniLib::RegexPattern> pattern =
+      unilib.CreateRegexPattern(regex);
+  std::unique_ptr<UniLib::RegexPattern> lazy_pattern =
+      unilib.CreateLazyRegexPattern(regex);
+
+  // Compiling the lazy pattern adds the compiled pattern to the text.
+  const int64 uncompiled_bytes = lazy_pattern->EstimateMemoryBytes();
+  EXPECT_LT(uncompiled_bytes, pattern->EstimateMemoryBytes());
+  ASSERT_TRUE(lazy_pattern->Compile());
+  EXPECT_GT(lazy_pattern->EstimateMemoryBytes(), uncompiled_bytes);
+  EXPECT_GE(lazy_pattern->EstimateMemoryBytes(),
+            pattern->EstimateMemoryBytes());
+}
+
+TEST(UniLibTest, ReleaseCompiledLazyRegex) {
+  CREATE_UNILIB_FOR_TESTING;
+  std::unique_ptr<UniLib::RegexPattern> pattern =
+      unilib.CreateLazyRegexPattern(
+          UTF8ToUnicodeText("[0-9]+", /*do_copy=*/false));
+  const UnicodeText input = UTF8ToUnicodeText("hello 0123", /*do_copy=*/false);
+  const int64 uncompiled_bytes = pattern->EstimateMemoryBytes();
+  std::unique_ptr<UniLib::RegexMatcher> matcher = pattern->Matcher(input);
+  ASSERT_TRUE(matcher != nullptr);
+
+  // The live matcher keeps working, and the pattern compiles again.
+  pattern->ReleaseCompiled();
+  EXPECT_EQ(pattern->EstimateMemoryBytes(), uncompiled_bytes);
+  int status;
+  EXPECT_TRUE(matcher->Find(&status));
+  EXPECT_EQ(matcher->Start(&status), 6);
+  matcher = pattern->Matcher(input);
+  ASSERT_TRUE(matcher != nullptr);
+  EXPECT_TRUE(matcher->Find(&status));
+  EXPECT_GT(pattern->EstimateMemoryBytes(), uncompiled_bytes);
+}
+#endif  // LIBTEXTCLASSIFIER_UNILIB_ICU || LIBTEXTCLASSIFIER_UNILIB_LITE
+
+#if defined(LIBTEXTCLASSIFIER_UNILIB_ICU) || \
+    defined(LIBTEXTCLASSIFIER_UNILIB_LITE)
 
 TEST(UniLibTest, BreakIterator) {
   CREATE_UNILIB_FOR_TESTING;
@@ -180,9 +389,10 @@ TEST(UniLibTest, BreakIterator) {
   }
   EXPECT_THAT(break_indices, ElementsAre(4, 5, 9));
 }
-#endif  // LIBTEXTCLASSIFIER_UNILIB_ICU
+#endif  // LIBTEXTCLASSIFIER_UNILIB_ICU || LIBTEXTCLASSIFIER_UNILIB_LITE
 
-#ifdef LIBTEXTCLASSIFIER_UNILIB_ICU
+#if defined(LIBTEXTCLASSIFIER_UNILIB_ICU) || \
+    defined(LIBTEXTCLASSIFIER_UNILIB_LITE)
 TEST(UniLibTest, BreakIterator4ByteUTF8) {
   CREATE_UNILIB_FOR_TESTING;
   const UnicodeText text = UTF8ToUnicodeText("😀😂😋", /*do_copy=*/false);
@@ -195,7 +405,26 @@ TEST(UniLibTest, BreakIterator4ByteUTF8) {
   }
   EXPECT_THAT(break_indices, ElementsAre(1, 2, 3));
 }
-#endif  // LIBTEXTCLASSIFIER_UNILIB_ICU
+#endif  // LIBTEXTCLASSIFIER_UNILIB_ICU || LIBTEXTCLASSIFIER_UNILIB_LITE
+
+#if defined(LIBTEXTCLASSIFIER_UNILIB_ICU) || \
+    defined(LIBTEXTCLASSIFIER_UNILIB_LITE)
+TEST(UniLibTest, BreakIteratorReset) {
+  CREATE_UNILIB_FOR_TESTING;
+  std::unique_ptr<UniLib::BreakIterator> iterator = unilib.CreateBreakIterator(
+      UTF8ToUnicodeText("some text", /*do_copy=*/false));
+  EXPECT_EQ(iterator->Next(), 4);
+
+  const UnicodeText text = UTF8ToUnicodeText("😀 ab", /*do_copy=*/false);
+  iterator->Reset(text);
+  std::vector<int> break_indices;
+  int break_index = 0;
+  while ((break_index = iterator->Next()) != UniLib::BreakIterator::kDone) {
+    break_indices.push_back(break_index);
+  }
+  EXPECT_THAT(break_indices, ElementsAre(1, 2, 4));
+}
+#endif  // LIBTEXTCLASSIFIER_UNILIB_ICU || LIBTEXTCLASSIFIER_UNILIB_LITE
 
 #ifndef LIBTEXTCLASSIFIER_UNILIB_JAVAICU
 TEST(UniLibTest, IntegerParse) {
@@ -207,7 +436,8 @@ TEST(UniLibTest, IntegerParse) {
 }
 #endif  // ndef LIBTEXTCLASSIFIER_UNILIB_JAVAICU
 
-#ifdef LIBTEXTCLASSIFIER_UNILIB_ICU
+#if defined(LIBTEXTCLASSIFIER_UNILIB_ICU) || \
+    defined(LIBTEXTCLASSIFIER_UNILIB_LITE)
 TEST(UniLibTest, IntegerParseFullWidth) {
   CREATE_UNILIB_FOR_TESTING;
   int result;
@@ -216,9 +446,10 @@ TEST(UniLibTest, IntegerParseFullWidth) {
                                 &result));
   EXPECT_EQ(result, 123);
 }
-#endif  // LIBTEXTCLASSIFIER_UNILIB_ICU
+#endif  // LIBTEXTCLASSIFIER_UNILIB_ICU || LIBTEXTCLASSIFIER_UNILIB_LITE
 
-#ifdef LIBTEXTCLASSIFIER_UNILIB_ICU
+#if defined(LIBTEXTCLASSIFIER_UNILIB_ICU) || \
+    defined(LIBTEXTCLASSIFIER_UNILIB_LITE)
 TEST(UniLibTest, IntegerParseFullWidthWithAlpha) {
   CREATE_UNILIB_FOR_TESTING;
   int result;
@@ -226,7 +457,7 @@ TEST(UniLibTest, IntegerParseFullWidthWithAlpha) {
   EXPECT_FALSE(unilib.ParseInt32(UTF8ToUnicodeText("１a３", /*do_copy=*/false),
                                  &result));
 }
-#endif  // LIBTEXTCLASSIFIER_UNILIB_ICU
+#endif  // LIBTEXTCLASSIFIER_UNILIB_ICU || LIBTEXTCLASSIFIER_UNILIB_LITE
 
 }  // namespace
 }  // namespace libtextclassifier2
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/utf8/utf16-index-mapper.h"
+
+#include <algorithm>
+
+#include "util/strings/utf8.h"
+
+namespace libtextclassifier2 {
+
+UTF16IndexMapper::UTF16IndexMapper(const std::string& utf8_text) {
+  int num_supplementary_codepoints = 0;
+  CountUTF8Codepoints(utf8_text.data(), utf8_text.size(), &num_codepoints_,
+                      &num_supplementary_codepoints);
+  if (num_supplementary_codepoints == 0) {
+    return;
+  }
+
+  // Every byte that is not a continuation byte starts a codepoint, and the
+  // four-byte sequences encode the codepoints outside of the BMP.
+  num_codepoints_ = 0;
+  surrogate_pairs_.reserve(num_supplementary_codepoints);
+  for (const char c : utf8_text) {
+    const uint8 byte = static_cast<uint8>(c);
+    if ((byte & 0xC0) == 0x80) {
+      continue;
+    }
+    if (byte >= 0xF0) {
+      surrogate_pairs_.push_back(num_codepoints_);
+    }
+    ++num_codepoints_;
+  }
+}
+
+UTF16IndexMapper::UTF16IndexMapper(const uint16* utf16_text,
+                                   int utf16_length) {
+  for (int i = 0; i < utf16_length; ++i) {
+    if (utf16_text[i] >= 0xD800 && utf16_text[i] < 0xDC00 &&
+        i + 1 < utf16_length && utf16_text[i + 1] >= 0xDC00 &&
+        utf16_text[i + 1] < 0xE000) {
+      surrogate_pairs_.push_back(num_codepoints_);
+      ++i;
+    }
+    ++num_codepoints_;
+  }
+}
+
+int UTF16IndexMapper::CodepointToUTF16(int codepoint_index) const {
+  if (codepoint_index < 0 || codepoint_index > num_codepoints_) {
+    return -1;
+  }
+  if (surrogate_pairs_.empty()) {
+    return codepoint_index;
+  }
+  return codepoint_index +
+         (std::lower_bound(surrogate_pairs_.begin(), surrogate_pairs_.end(),
+                           codepoint_index) -
+          surrogate_pairs_.begin());
+}
+
+int UTF16IndexMapper::UTF16ToCodepoint(int utf16_index) const {
+  if (utf16_index < 0 || utf16_index > NumUTF16()) {
+    return -1;
+  }
+  if (surrogate_pairs_.empty()) {
+    return utf16_index;
+  }
+
+  // The i-th surrogate pair starts at UTF16 index surrogate_pairs_[i] + i.
+  // Finds the number of pairs that start before the index.
+  int begin = 0;
+  int end = surrogate_pairs_.size();
+  while (begin < end) {
+    const int mid = begin + (end - begin) / 2;
+    if (surrogate_pairs_[mid] + mid < utf16_index) {
+      begin = mid + 1;
+    } else {
+      end = mid;
+    }
+  }
+  if (begin > 0 &&
+      surrogate_pairs_[begin - 1] + (begin - 1) == utf16_index - 1) {
+    // Between the two halves of a pair.
+    return -1;
+  }
+  return utf16_index - begin;
+}
+
+}  // namespace libtextclassifier2
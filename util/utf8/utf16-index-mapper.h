@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBTEXTCLASSIFIER_UTIL_UTF8_UTF16_INDEX_MAPPER_H_
+#define LIBTEXTCLASSIFIER_UTIL_UTF8_UTF16_INDEX_MAPPER_H_
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "util/base/integral_types.h"
+
+namespace libtextclassifier2 {
+
+// Converts between codepoint indices and UTF16 indices (as in Java strings)
+// of a text. Built with one pass over the text, after which each conversion
+// takes O(log k) for k characters outside of the BMP, and O(1) for the
+// common texts without any.
+class UTF16IndexMapper {
+ public:
+  // Maps the empty text.
+  UTF16IndexMapper() {}
+
+  // Maps the given UTF8 text.
+  explicit UTF16IndexMapper(const std::string& utf8_text);
+
+  // Maps the given UTF16 text.
+  UTF16IndexMapper(const uint16* utf16_text, int utf16_length);
+
+  int NumCodepoints() const { return num_codepoints_; }
+  int NumUTF16() const {
+    return num_codepoints_ + static_cast<int>(surrogate_pairs_.size());
+  }
+
+  // Returns the UTF16 index of a codepoint index, also of the end of the
+  // text. Returns -1 for indices outside of the text.
+  int CodepointToUTF16(int codepoint_index) const;
+
+  // Returns the codepoint index of a UTF16 index, also of the end of the text.
+  // Returns -1 for indices outside of the text or inside of a surrogate pair.
+  int UTF16ToCodepoint(int utf16_index) const;
+
+  // Same as above, for both ends of a span.
+  std::pair<int, int> CodepointToUTF16(std::pair<int, int> span) const {
+    return {CodepointToUTF16(span.first), CodepointToUTF16(span.second)};
+  }
+  std::pair<int, int> UTF16ToCodepoint(std::pair<int, int> span) const {
+    return {UTF16ToCodepoint(span.first), UTF16ToCodepoint(span.second)};
+  }
+
+ private:
+  int num_codepoints_ = 0;
+
+  // The codepoint index of each character outside of the BMP, which takes a
+  // surrogate pair in UTF16, sorted.
+  std::vector<int> surrogate_pairs_;
+};
+
+}  // namespace libtextclassifier2
+
+#endif  // LIBTEXTCLASSIFIER_UTIL_UTF8_UTF16_INDEX_MAPPER_H_
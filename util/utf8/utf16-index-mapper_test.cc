@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "util/utf8/utf16-index-mapper.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace libtextclassifier2 {
+namespace {
+
+TEST(UTF16IndexMapperTest, BMPText) {
+  const UTF16IndexMapper mapper("hellö wörld");
+  EXPECT_EQ(mapper.NumCodepoints(), 11);
+  EXPECT_EQ(mapper.NumUTF16(), 11);
+  EXPECT_EQ(mapper.CodepointToUTF16(0), 0);
+  EXPECT_EQ(mapper.CodepointToUTF16(11), 11);
+  EXPECT_EQ(mapper.UTF16ToCodepoint(6), 6);
+  EXPECT_EQ(mapper.CodepointToUTF16(12), -1);
+  EXPECT_EQ(mapper.UTF16ToCodepoint(-1), -1);
+}
+
+TEST(UTF16IndexMapperTest, SurrogatePairs) {
+  // 😁 is U+1F601, which takes a surrogate pair.
+  const UTF16IndexMapper mapper("😁 Hell😁😁World.");
+  EXPECT_EQ(mapper.NumCodepoints(), 14);
+  EXPECT_EQ(mapper.NumUTF16(), 17);
+  const std::vector<int> utf16_indices = {0,  2,  3,  4,  5,  6,  7, 9,
+                                          11, 12, 13, 14, 15, 16, 17};
+  for (int i = 0; i < utf16_indices.size(); ++i) {
+    EXPECT_EQ(mapper.CodepointToUTF16(i), utf16_indices[i]) << i;
+    EXPECT_EQ(mapper.UTF16ToCodepoint(utf16_indices[i]), i) << i;
+  }
+
+  // Inside of the pairs, and past the end.
+  EXPECT_EQ(mapper.UTF16ToCodepoint(1), -1);
+  EXPECT_EQ(mapper.UTF16ToCodepoint(8), -1);
+  EXPECT_EQ(mapper.UTF16ToCodepoint(10), -1);
+  EXPECT_EQ(mapper.UTF16ToCodepoint(18), -1);
+
+  EXPECT_EQ(mapper.UTF16ToCodepoint(std::make_pair(3, 9)),
+            std::make_pair(2, 7));
+  EXPECT_EQ(mapper.CodepointToUTF16(std::make_pair(2, 7)),
+            std::make_pair(3, 9));
+}
+
+TEST(UTF16IndexMapperTest, MapsUTF16Text) {
+  // "a😁b" with a surrogate pair, and an unpaired surrogate at the end.
+  const std::vector<uint16> text = {'a', 0xD83D, 0xDE01, 'b', 0xD83D};
+  const UTF16IndexMapper mapper(text.data(), text.size());
+  EXPECT_EQ(mapper.NumCodepoints(), 4);
+  EXPECT_EQ(mapper.NumUTF16(), 5);
+  EXPECT_EQ(mapper.CodepointToUTF16(2), 3);
+  EXPECT_EQ(mapper.UTF16ToCodepoint(2), -1);
+  EXPECT_EQ(mapper.UTF16ToCodepoint(5), 4);
+}
+
+}  // namespace
+}  // namespace libtextclassifier2
@@ -16,8 +16,12 @@
 
 #include "zlib-utils.h"
 
+#include <functional>
 #include <memory>
 
+#include "lz4.h"
+#include "lz4hc.h"
+#include "shared-regex-patterns.h"
 #include "util/base/logging.h"
 #include "util/flatbuffers.h"
 
@@ -47,6 +51,18 @@ ZlibDecompressor::~ZlibDecompressor() {
 bool ZlibDecompressor::Decompress(const CompressedBuffer* compressed_buffer,
                                   std::string* out) {
   out->resize(compressed_buffer->uncompressed_size());
+  if (compressed_buffer->codec() == CompressionCodec_LZ4) {
+    const int size = LZ4_decompress_safe(
+        reinterpret_cast<const char*>(compressed_buffer->buffer()->Data()),
+        const_cast<char*>(out->data()), compressed_buffer->buffer()->Length(),
+        compressed_buffer->uncompressed_size());
+    return size == compressed_buffer->uncompressed_size();
+  }
+  if (compressed_buffer->codec() != CompressionCodec_ZLIB) {
+    TC_LOG(ERROR) << "Unknown compression codec: "
+                  << compressed_buffer->codec();
+    return false;
+  }
   stream_.next_in =
       reinterpret_cast<const Bytef*>(compressed_buffer->buffer()->Data());
   stream_.avail_in = compressed_buffer->buffer()->Length();
@@ -108,10 +124,54 @@ void ZlibCompressor::Compress(const std::string& uncompressed_content,
   } while (status == Z_OK);
 }
 
+void Lz4Compress(const std::string& uncompressed_content,
+                 CompressedBufferT* out) {
+  out->uncompressed_size = uncompressed_content.size();
+  out->codec = CompressionCodec_LZ4;
+  out->buffer.resize(LZ4_compressBound(uncompressed_content.size()));
+  // Models are compressed offline, so spend the time for the best ratio.
+  const int size = LZ4_compress_HC(
+      uncompressed_content.data(), reinterpret_cast<char*>(out->buffer.data()),
+      uncompressed_content.size(), out->buffer.size(), LZ4HC_CLEVEL_MAX);
+  TC_CHECK_GT(size, 0);
+  out->buffer.resize(size);
+}
+
+namespace {
+
+// Compresses with zlib or LZ4.
+class BufferCompressor {
+ public:
+  explicit BufferCompressor(CompressionCodec codec) : codec_(codec) {
+    if (codec_ == CompressionCodec_ZLIB) {
+      zlib_compressor_ = ZlibCompressor::Instance();
+    }
+  }
+
+  bool initialized() const {
+    return codec_ == CompressionCodec_LZ4 || zlib_compressor_ != nullptr;
+  }
+
+  void Compress(const std::string& uncompressed_content,
+                CompressedBufferT* out) {
+    if (codec_ == CompressionCodec_LZ4) {
+      Lz4Compress(uncompressed_content, out);
+    } else {
+      zlib_compressor_->Compress(uncompressed_content, out);
+    }
+  }
+
+ private:
+  const CompressionCodec codec_;
+  std::unique_ptr<ZlibCompressor> zlib_compressor_;
+};
+
+}  // namespace
+
 // Compress rule fields in the model.
-bool CompressModel(ModelT* model) {
-  std::unique_ptr<ZlibCompressor> zlib_compressor = ZlibCompressor::Instance();
-  if (!zlib_compressor) {
+bool CompressModel(ModelT* model, CompressionCodec codec) {
+  BufferCompressor compressor(codec);
+  if (!compressor.initialized()) {
     TC_LOG(ERROR) << "Cannot compress model.";
     return false;
   }
@@ -121,8 +181,7 @@ bool CompressModel(ModelT* model) {
     for (int i = 0; i < model->regex_model->patterns.size(); i++) {
       RegexModel_::PatternT* pattern = model->regex_model->patterns[i].get();
       pattern->compressed_pattern.reset(new CompressedBufferT);
-      zlib_compressor->Compress(pattern->pattern,
-                                pattern->compressed_pattern.get());
+      compressor.Compress(pattern->pattern, pattern->compressed_pattern.get());
       pattern->pattern.clear();
     }
   }
@@ -134,8 +193,7 @@ bool CompressModel(ModelT* model) {
       for (int j = 0; j < pattern->regexes.size(); j++) {
         DatetimeModelPattern_::RegexT* regex = pattern->regexes[j].get();
         regex->compressed_pattern.reset(new CompressedBufferT);
-        zlib_compressor->Compress(regex->pattern,
-                                  regex->compressed_pattern.get());
+        compressor.Compress(regex->pattern, regex->compressed_pattern.get());
         regex->pattern.clear();
       }
     }
@@ -143,8 +201,8 @@ bool CompressModel(ModelT* model) {
       DatetimeModelExtractorT* extractor =
           model->datetime_model->extractors[i].get();
       extractor->compressed_pattern.reset(new CompressedBufferT);
-      zlib_compressor->Compress(extractor->pattern,
-                                extractor->compressed_pattern.get());
+      compressor.Compress(extractor->pattern,
+                          extractor->compressed_pattern.get());
       extractor->pattern.clear();
     }
   }
@@ -153,9 +211,13 @@ bool CompressModel(ModelT* model) {
 
 namespace {
 
+// Keeps the uncompressed pattern if the buffer is not set.
 bool DecompressBuffer(const CompressedBufferT* compressed_pattern,
                       ZlibDecompressor* zlib_decompressor,
                       std::string* uncompressed_pattern) {
+  if (compressed_pattern == nullptr) {
+    return true;
+  }
   std::string packed_pattern =
       PackFlatbuffer<CompressedBuffer>(compressed_pattern);
   if (!zlib_decompressor->Decompress(
@@ -217,53 +279,99 @@ bool DecompressModel(ModelT* model) {
   return true;
 }
 
-std::string CompressSerializedModel(const std::string& model) {
+std::string CompressSerializedModel(const std::string& model,
+                                    CompressionCodec codec) {
   std::unique_ptr<ModelT> unpacked_model = UnPackModel(model.c_str());
   TC_CHECK(unpacked_model != nullptr);
-  TC_CHECK(CompressModel(unpacked_model.get()));
+  TC_CHECK(CompressModel(unpacked_model.get(), codec));
   flatbuffers::FlatBufferBuilder builder;
   FinishModelBuffer(builder, Model::Pack(builder, unpacked_model.get()));
   return std::string(reinterpret_cast<const char*>(builder.GetBufferPointer()),
                      builder.GetSize());
 }
 
-std::unique_ptr<UniLib::RegexPattern> UncompressMakeRegexPattern(
-    const UniLib& unilib, const flatbuffers::String* uncompressed_pattern,
-    const CompressedBuffer* compressed_pattern, ZlibDecompressor* decompressor,
-    std::string* result_pattern_text) {
-  UnicodeText unicode_regex_pattern;
-  std::string decompressed_pattern;
+bool UncompressRegexPatternText(const flatbuffers::String* uncompressed_pattern,
+                                const CompressedBuffer* compressed_pattern,
+                                ZlibDecompressor* decompressor,
+                                std::string* pattern_text) {
   if (compressed_pattern != nullptr &&
       compressed_pattern->buffer() != nullptr) {
     if (decompressor == nullptr ||
-        !decompressor->Decompress(compressed_pattern, &decompressed_pattern)) {
+        !decompressor->Decompress(compressed_pattern, pattern_text)) {
       TC_LOG(ERROR) << "Cannot decompress pattern.";
-      return nullptr;
+      return false;
     }
-    unicode_regex_pattern =
-        UTF8ToUnicodeText(decompressed_pattern.data(),
-                          decompressed_pattern.size(), /*do_copy=*/false);
-  } else {
-    if (uncompressed_pattern == nullptr) {
-      TC_LOG(ERROR) << "Cannot load uncompressed pattern.";
-      return nullptr;
-    }
-    unicode_regex_pattern =
-        UTF8ToUnicodeText(uncompressed_pattern->c_str(),
-                          uncompressed_pattern->Length(), /*do_copy=*/false);
+    return true;
+  }
+  if (uncompressed_pattern == nullptr) {
+    TC_LOG(ERROR) << "Cannot load uncompressed pattern.";
+    return false;
   }
+  *pattern_text = uncompressed_pattern->str();
+  return true;
+}
 
-  if (result_pattern_text != nullptr) {
-    *result_pattern_text = unicode_regex_pattern.ToUTF8String();
+std::unique_ptr<UniLib::RegexPattern> MakeRegexPattern(
+    const UniLib& unilib, const std::string& pattern_text, bool lazy_compile) {
+  const UnicodeText unicode_regex_pattern =
+      UTF8ToUnicodeText(pattern_text, /*do_copy=*/false);
+  if (lazy_compile) {
+    return unilib.CreateLazyRegexPattern(unicode_regex_pattern);
   }
 
   std::unique_ptr<UniLib::RegexPattern> regex_pattern =
       unilib.CreateRegexPattern(unicode_regex_pattern);
   if (!regex_pattern) {
-    TC_LOG(ERROR) << "Could not create pattern: "
-                  << unicode_regex_pattern.ToUTF8String();
+    TC_LOG(ERROR) << "Could not create pattern: " << pattern_text;
+  }
+  return regex_pattern;
+}
+
+std::unique_ptr<UniLib::RegexPattern> UncompressMakeRegexPattern(
+    const UniLib& unilib, const flatbuffers::String* uncompressed_pattern,
+    const CompressedBuffer* compressed_pattern, ZlibDecompressor* decompressor,
+    std::string* result_pattern_text, bool lazy_compile) {
+  std::string pattern_text;
+  if (!UncompressRegexPatternText(uncompressed_pattern, compressed_pattern,
+                                  decompressor, &pattern_text)) {
+    return nullptr;
+  }
+  std::unique_ptr<UniLib::RegexPattern> regex_pattern =
+      MakeRegexPattern(unilib, pattern_text, lazy_compile);
+  if (result_pattern_text != nullptr) {
+    *result_pattern_text = std::move(pattern_text);
   }
   return regex_pattern;
 }
 
+bool MakeRegexPatterns(
+    const UniLib& unilib, const std::vector<std::string>& pattern_texts,
+    bool lazy_compile, TaskRunner* task_runner,
+    SharedRegexPatterns* shared_patterns,
+    std::vector<std::shared_ptr<const UniLib::RegexPattern>>* regex_patterns) {
+  regex_patterns->clear();
+  regex_patterns->resize(pattern_texts.size());
+  std::vector<std::function<void()>> tasks;
+  for (int i = 0; i < pattern_texts.size(); ++i) {
+    tasks.push_back([&unilib, &pattern_texts, lazy_compile, shared_patterns,
+                     regex_patterns, i]() {
+      if (shared_patterns != nullptr) {
+        (*regex_patterns)[i] =
+            shared_patterns->Get(unilib, pattern_texts[i], lazy_compile);
+      } else {
+        (*regex_patterns)[i] =
+            MakeRegexPattern(unilib, pattern_texts[i], lazy_compile);
+      }
+    });
+  }
+  RunAll(task_runner, tasks);
+
+  for (const auto& regex_pattern : *regex_patterns) {
+    if (!regex_pattern) {
+      return false;
+    }
+  }
+  return true;
+}
+
 }  // namespace libtextclassifier2
@@ -20,18 +20,26 @@
 #define LIBTEXTCLASSIFIER_ZLIB_UTILS_H_
 
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "model_generated.h"
+#include "util/base/task-runner.h"
 #include "util/utf8/unilib.h"
 #include "zlib.h"
 
 namespace libtextclassifier2 {
 
+class SharedRegexPatterns;
+
 class ZlibDecompressor {
  public:
   static std::unique_ptr<ZlibDecompressor> Instance();
   ~ZlibDecompressor();
 
+  // Decompresses the buffer with its codec. Only the zlib buffers continue
+  // the stream of the previous zlib buffers, the other buffers are
+  // decompressed on their own.
   bool Decompress(const CompressedBuffer* compressed_buffer, std::string* out);
 
  private:
@@ -59,20 +67,54 @@ class ZlibCompressor {
   bool initialized_;
 };
 
-// Compresses regex and datetime rules in the model in place.
-bool CompressModel(ModelT* model);
+// Compresses a buffer on its own with LZ4.
+void Lz4Compress(const std::string& uncompressed_content,
+                 CompressedBufferT* out);
+
+// Compresses regex and datetime rules in the model in place, with the given
+// codec.
+bool CompressModel(ModelT* model,
+                   CompressionCodec codec = CompressionCodec_ZLIB);
 
-// Decompresses regex and datetime rules in the model in place.
+// Decompresses regex and datetime rules in the model in place. The rules that
+// are not compressed are kept as they are.
 bool DecompressModel(ModelT* model);
 
 // Compresses regex and datetime rules in the model.
-std::string CompressSerializedModel(const std::string& model);
+std::string CompressSerializedModel(
+    const std::string& model, CompressionCodec codec = CompressionCodec_ZLIB);
+
+// Decompresses an optionally compressed pattern into 'pattern_text'.
+bool UncompressRegexPatternText(const flatbuffers::String* uncompressed_pattern,
+                                const CompressedBuffer* compressed_pattern,
+                                ZlibDecompressor* decompressor,
+                                std::string* pattern_text);
+
+// Creates and compiles a regex pattern, or only creates it for compilation on
+// first use if 'lazy_compile' is true.
+std::unique_ptr<UniLib::RegexPattern> MakeRegexPattern(
+    const UniLib& unilib, const std::string& pattern_text, bool lazy_compile);
+
+// Same as MakeRegexPattern() for many patterns, in parallel with the given
+// runner, or one after the other if it's nullptr. The patterns are filled in
+// in the order of 'pattern_texts'. Returns false if any pattern failed.
+// The patterns share one decompression stream, so unlike the compilation the
+// decompression can't be parallelized. If 'shared_patterns' is not nullptr,
+// the patterns come from it, so that they are shared with the other models
+// that have them.
+bool MakeRegexPatterns(
+    const UniLib& unilib, const std::vector<std::string>& pattern_texts,
+    bool lazy_compile, TaskRunner* task_runner,
+    SharedRegexPatterns* shared_patterns,
+    std::vector<std::shared_ptr<const UniLib::RegexPattern>>* regex_patterns);
 
 // Create and compile a regex pattern from optionally compressed pattern.
+// If 'lazy_compile' is true, the pattern is only decompressed and compiles on
+// first use, see UniLib::CreateLazyRegexPattern.
 std::unique_ptr<UniLib::RegexPattern> UncompressMakeRegexPattern(
     const UniLib& unilib, const flatbuffers::String* uncompressed_pattern,
     const CompressedBuffer* compressed_pattern, ZlibDecompressor* decompressor,
-    std::string* result_pattern_text = nullptr);
+    std::string* result_pattern_text = nullptr, bool lazy_compile = false);
 
 }  // namespace libtextclassifier2
 
@@ -17,8 +17,13 @@
 #include "zlib-utils.h"
 
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "model_generated.h"
+#include "shared-regex-patterns.h"
+#include "util/base/task-runner.h"
+#include "util/utf8/unilib.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
@@ -95,4 +100,107 @@ TEST(ZlibUtilsTest, CompressModel) {
             "an example datetime extractor");
 }
 
+TEST(ZlibUtilsTest, CompressModelWithLz4) {
+  ModelT model;
+  model.regex_model.reset(new RegexModelT);
+  model.regex_model->patterns.emplace_back(new RegexModel_::PatternT);
+  model.regex_model->patterns.back()->pattern = "this is a test pattern";
+  model.datetime_model.reset(new DatetimeModelT);
+  model.datetime_model->extractors.emplace_back(new DatetimeModelExtractorT);
+  model.datetime_model->extractors.back()->pattern =
+      "an example datetime extractor";
+
+  EXPECT_TRUE(CompressModel(&model, CompressionCodec_LZ4));
+  EXPECT_TRUE(model.regex_model->patterns[0]->pattern.empty());
+  EXPECT_EQ(model.regex_model->patterns[0]->compressed_pattern->codec,
+            CompressionCodec_LZ4);
+
+  // A zlib buffer in between doesn't disturb the LZ4 buffers.
+  model.regex_model->patterns.emplace_back(new RegexModel_::PatternT);
+  model.regex_model->patterns.back()->compressed_pattern.reset(
+      new CompressedBufferT);
+  ZlibCompressor::Instance()->Compress(
+      "a zlib pattern",
+      model.regex_model->patterns.back()->compressed_pattern.get());
+
+  flatbuffers::FlatBufferBuilder builder;
+  builder.Finish(Model::Pack(builder, &model));
+  const Model* compressed_model =
+      GetModel(reinterpret_cast<const char*>(builder.GetBufferPointer()));
+  ASSERT_TRUE(compressed_model != nullptr);
+
+  // The LZ4 buffers can be decompressed in any order.
+  std::unique_ptr<ZlibDecompressor> decompressor = ZlibDecompressor::Instance();
+  ASSERT_TRUE(decompressor != nullptr);
+  std::string uncompressed_pattern;
+  EXPECT_TRUE(decompressor->Decompress(compressed_model->datetime_model()
+                                           ->extractors()
+                                           ->Get(0)
+                                           ->compressed_pattern(),
+                                       &uncompressed_pattern));
+  EXPECT_EQ(uncompressed_pattern, "an example datetime extractor");
+  EXPECT_TRUE(decompressor->Decompress(
+      compressed_model->regex_model()->patterns()->Get(1)->compressed_pattern(),
+      &uncompressed_pattern));
+  EXPECT_EQ(uncompressed_pattern, "a zlib pattern");
+  EXPECT_TRUE(decompressor->Decompress(
+      compressed_model->regex_model()->patterns()->Get(0)->compressed_pattern(),
+      &uncompressed_pattern));
+  EXPECT_EQ(uncompressed_pattern, "this is a test pattern");
+
+  EXPECT_TRUE(DecompressModel(&model));
+  EXPECT_EQ(model.regex_model->patterns[0]->pattern, "this is a test pattern");
+  EXPECT_EQ(model.regex_model->patterns[1]->pattern, "a zlib pattern");
+  EXPECT_EQ(model.datetime_model->extractors[0]->pattern,
+            "an example datetime extractor");
+}
+
+TEST(ZlibUtilsTest, MakeRegexPatternsInParallel) {
+  CREATE_UNILIB_FOR_TESTING;
+  std::vector<std::string> pattern_texts;
+  for (int i = 0; i < 100; ++i) {
+    pattern_texts.push_back("a{" + std::to_string(i) + "}");
+  }
+  ThreadTaskRunner task_runner(/*num_threads=*/4);
+  std::vector<std::shared_ptr<const UniLib::RegexPattern>> regex_patterns;
+  ASSERT_TRUE(MakeRegexPatterns(unilib, pattern_texts, /*lazy_compile=*/false,
+                                &task_runner, /*shared_patterns=*/nullptr,
+                                &regex_patterns));
+  ASSERT_EQ(regex_patterns.size(), pattern_texts.size());
+
+  // The patterns are in the original order.
+  const UnicodeText text = UTF8ToUnicodeText(std::string(99, 'a'));
+  for (int i = 0; i < regex_patterns.size(); ++i) {
+    int status;
+    std::unique_ptr<UniLib::RegexMatcher> matcher =
+        regex_patterns[i]->Matcher(text);
+    ASSERT_TRUE(matcher->Find(&status));
+    EXPECT_EQ(matcher->End(&status), i);
+  }
+
+  pattern_texts.push_back("a{");
+  EXPECT_FALSE(MakeRegexPatterns(unilib, pattern_texts,
+                                 /*lazy_compile=*/false, &task_runner,
+                                 /*shared_patterns=*/nullptr, &regex_patterns));
+}
+
+TEST(ZlibUtilsTest, MakeRegexPatternsShared) {
+  CREATE_UNILIB_FOR_TESTING;
+  SharedRegexPatterns shared_patterns;
+  ThreadTaskRunner task_runner(/*num_threads=*/4);
+  std::vector<std::shared_ptr<const UniLib::RegexPattern>> regex_patterns;
+  ASSERT_TRUE(MakeRegexPatterns(unilib, {"a+", "b+", "a+"},
+                                /*lazy_compile=*/false, &task_runner,
+                                &shared_patterns, &regex_patterns));
+  EXPECT_EQ(regex_patterns[0], regex_patterns[2]);
+  EXPECT_NE(regex_patterns[0], regex_patterns[1]);
+
+  std::vector<std::shared_ptr<const UniLib::RegexPattern>> other_patterns;
+  ASSERT_TRUE(MakeRegexPatterns(unilib, {"b+"}, /*lazy_compile=*/false,
+                                /*task_runner=*/nullptr, &shared_patterns,
+                                &other_patterns));
+  EXPECT_EQ(other_patterns[0], regex_patterns[1]);
+  EXPECT_EQ(shared_patterns.NumPatterns(), 2);
+}
+
 }  // namespace libtextclassifier2